@@ -1006,6 +1006,499 @@ test_pipe(void)
     return 1;
 }
 
+/****
+ * Test writing from several threads at once
+ */
+
+#define THREADED_FILES 4
+#define THREADED_ATTRS 2	/* buffer attributes per file */
+#define THREADED_FD_ATTRID 30	/* attribute filled with add_data_fd_in_thread */
+
+/* each attribute's data is the PRNG stream seeded with this */
+#define ATTR_SEED(filenum, attrid) ((guint32)(filenum) * 1000 + (attrid))
+
+typedef struct buffer_writer_s {
+    amar_attr_t *attr;
+    guint32 seed;
+    gsize size;
+    gsize chunk;	/* bytes per call, or 0 for a mix of sizes */
+    guint64 nrecords;
+    GError *error;
+} buffer_writer_t;
+
+static gpointer
+buffer_writer_thread(
+    gpointer data)
+{
+    buffer_writer_t *bw = data;
+    simpleprng_state_t prng, sizes;
+    gsize left = bw->size;
+    gchar *buf = g_malloc0(bw->chunk? bw->chunk : 600*1024);
+
+    /* with a fixed chunk size, the data doesn't matter */
+    if (!bw->chunk) {
+	simpleprng_seed(&prng, bw->seed);
+	simpleprng_seed(&sizes, ~bw->seed);
+    }
+    while (left) {
+	gsize n = bw->chunk;
+
+	/* mostly small buffers, with a few too big to be worth copying */
+	if (!n) {
+	    guint32 r = simpleprng_rand(&sizes);
+
+	    switch (r % 20) {
+	    case 0: n = 64*1024 + r % (536*1024); break;
+	    case 1: case 2: case 3: case 4: case 5:
+		    n = 4096 + r % (60*1024); break;
+	    default: n = 1 + r % 4096; break;
+	    }
+	}
+	n = MIN(n, left);
+
+	if (!bw->chunk)
+	    simpleprng_fill_buffer(&prng, buf, n);
+	left -= n;
+	if (!amar_attr_add_data_buffer(bw->attr, buf, n, left == 0, &bw->error))
+	    break;
+	bw->nrecords++;
+    }
+
+    g_free(buf);
+    return NULL;
+}
+
+typedef struct attr_check_s {
+    simpleprng_state_t prng;
+    gsize size;
+    gboolean eoa;
+} attr_check_t;
+
+typedef struct archive_check_s {
+    attr_check_t attrs[THREADED_FILES+1][THREADED_FD_ATTRID+1];
+    gboolean ok;
+} archive_check_t;
+
+static gboolean
+check_frag_cb(
+	gpointer user_data,
+	uint16_t filenum,
+	gpointer file_data G_GNUC_UNUSED,
+	uint16_t attrid,
+	gpointer attrid_data G_GNUC_UNUSED,
+	gpointer *attr_data G_GNUC_UNUSED,
+	gpointer data,
+	gsize datasize,
+	gboolean eoa,
+	gboolean truncated G_GNUC_UNUSED)
+{
+    archive_check_t *check = user_data;
+    attr_check_t *ac;
+
+    if (filenum > THREADED_FILES || attrid > THREADED_FD_ATTRID) {
+	tu_dbg("unexpected file %d attribute %d\n", (int)filenum, (int)attrid);
+	check->ok = FALSE;
+	return FALSE;
+    }
+
+    ac = &check->attrs[filenum][attrid];
+    if (ac->eoa) {
+	tu_dbg("file %d attribute %d: data after EOA\n", (int)filenum, (int)attrid);
+	check->ok = FALSE;
+	return FALSE;
+    }
+    if (!ac->size && !ac->prng.count)
+	simpleprng_seed(&ac->prng, ATTR_SEED(filenum, attrid));
+    if (!simpleprng_verify_buffer(&ac->prng, data, datasize)) {
+	tu_dbg("file %d attribute %d: data does not match at offset %zu\n",
+	    (int)filenum, (int)attrid, ac->size);
+	check->ok = FALSE;
+	return FALSE;
+    }
+    ac->size += datasize;
+    ac->eoa = eoa;
+
+    return TRUE;
+}
+
+static gboolean
+check_file_start_cb(
+	gpointer user_data G_GNUC_UNUSED,
+	uint16_t filenum G_GNUC_UNUSED,
+	gpointer filename G_GNUC_UNUSED,
+	gsize filename_len G_GNUC_UNUSED,
+	gboolean *ignore G_GNUC_UNUSED,
+	gpointer *file_data G_GNUC_UNUSED)
+{
+    return TRUE;
+}
+
+static int
+test_threads(void)
+{
+    int fd, fd2;
+    char *bigbuf;
+    size_t bigbuf_size = 4*1024*1024 + 1274; /* a record and a bit */
+    simpleprng_state_t prng;
+    amar_t *arch = NULL;
+    amar_file_t *af[THREADED_FILES];
+    amar_attr_t *fd_attr;
+    buffer_writer_t bw[THREADED_FILES][THREADED_ATTRS];
+    GThread *threads[THREADED_FILES][THREADED_ATTRS];
+    archive_check_t *check;
+    GError *error = NULL;
+    gboolean ok;
+    off_t size, last_size = 0;
+    struct stat st;
+    int f, a;
+
+    /* the data for the attribute filled from an fd */
+    bigbuf = g_malloc(bigbuf_size);
+    simpleprng_seed(&prng, ATTR_SEED(1, THREADED_FD_ATTRID));
+    simpleprng_fill_buffer(&prng, bigbuf, bigbuf_size);
+    fd = open("amar-test.big", O_CREAT|O_WRONLY|O_TRUNC, 0777);
+    g_assert(fd >= 0);
+    g_assert(full_write(fd, bigbuf, bigbuf_size) == bigbuf_size);
+    close(fd);
+    g_free(bigbuf);
+
+    fd = open_temp(1);
+    arch = amar_new(fd, O_WRONLY, &error);
+    check_gerror(arch, error, "amar_new");
+
+    for (f = 0; f < THREADED_FILES; f++) {
+	char *filename = g_strdup_printf("file%d", f+1);
+	af[f] = amar_new_file(arch, filename, 0, NULL, &error);
+	check_gerror(af[f], error, "amar_new_file");
+	g_free(filename);
+    }
+
+    /* fill one attribute from an fd, in amar's own thread */
+    fd_attr = amar_new_attr(af[0], THREADED_FD_ATTRID, &error);
+    check_gerror(fd_attr, error, "amar_new_attr");
+    fd2 = open("amar-test.big", O_RDONLY);
+    g_assert(fd2 >= 0);
+    amar_attr_add_data_fd_in_thread(fd_attr, fd2, 1, &error);
+    check_gerror(TRUE, error, "amar_attr_add_data_fd_in_thread");
+
+    /* and the others from our threads, all at once */
+    for (f = 0; f < THREADED_FILES; f++) {
+	for (a = 0; a < THREADED_ATTRS; a++) {
+	    guint16 attrid = AMAR_ATTR_APP_START + a;
+
+	    bw[f][a].attr = amar_new_attr(af[f], attrid, &error);
+	    check_gerror(bw[f][a].attr, error, "amar_new_attr");
+	    bw[f][a].seed = ATTR_SEED(f+1, attrid);
+	    bw[f][a].size = 3*1024*1024 + f*1000 + a;
+	    bw[f][a].chunk = 0;
+	    bw[f][a].nrecords = 0;
+	    bw[f][a].error = NULL;
+	}
+    }
+    for (f = 0; f < THREADED_FILES; f++) {
+	for (a = 0; a < THREADED_ATTRS; a++) {
+	    threads[f][a] = g_thread_create(buffer_writer_thread, &bw[f][a],
+					    TRUE, NULL);
+	}
+    }
+
+    /* the size only ever grows while the threads run */
+    for (a = 0; a < 100; a++) {
+	size = amar_size(arch);
+	if (size < last_size) {
+	    g_fprintf(stderr, "amar_size went from %lld to %lld\n",
+		      (long long)last_size, (long long)size);
+	    return 0;
+	}
+	last_size = size;
+	g_thread_yield();
+    }
+
+    for (f = 0; f < THREADED_FILES; f++) {
+	for (a = 0; a < THREADED_ATTRS; a++) {
+	    g_thread_join(threads[f][a]);
+	    check_gerror(TRUE, bw[f][a].error, "amar_attr_add_data_buffer");
+	    ok = amar_attr_close(bw[f][a].attr, &error);
+	    check_gerror(ok, error, "amar_attr_close");
+	}
+    }
+    for (f = 0; f < THREADED_FILES; f++) {
+	ok = amar_file_close(af[f], &error);
+	check_gerror(ok, error, "amar_file_close");
+    }
+    unlink("amar-test.big");
+
+    size = amar_size(arch);
+    ok = amar_close(arch, &error);
+    check_gerror(ok, error, "amar_close");
+    g_assert(fstat(fd, &st) == 0);
+    close(fd);
+    if (st.st_size != size) {
+	g_fprintf(stderr, "archive is %lld bytes, but amar_size said %lld\n",
+		  (long long)st.st_size, (long long)size);
+	return 0;
+    }
+
+    /* read it back and check every attribute */
+    {
+	amar_attr_handling_t handling[] = {
+	    { 0, 0, check_frag_cb, NULL },
+	};
+
+	check = g_new0(archive_check_t, 1);
+	check->ok = TRUE;
+	fd = open_temp(0);
+	arch = amar_new(fd, O_RDONLY, &error);
+	check_gerror(arch, error, "amar_new");
+	ok = amar_read(arch, check, handling, check_file_start_cb, NULL, NULL,
+		       &error);
+	if (ok || error)
+	    check_gerror(ok, error, "amar_read");
+	amar_close(arch, NULL);
+	close(fd);
+	if (!check->ok)
+	    return 0;
+
+	for (f = 0; f < THREADED_FILES; f++) {
+	    for (a = 0; a < THREADED_ATTRS; a++) {
+		attr_check_t *ac = &check->attrs[f+1][AMAR_ATTR_APP_START + a];
+
+		if (ac->size != bw[f][a].size || !ac->eoa) {
+		    g_fprintf(stderr, "file %d attribute %d: read %zu bytes%s, wrote %zu\n",
+			      f+1, AMAR_ATTR_APP_START + a, ac->size,
+			      ac->eoa? "" : " without EOA", bw[f][a].size);
+		    return 0;
+		}
+	    }
+	}
+	if (check->attrs[1][THREADED_FD_ATTRID].size != bigbuf_size ||
+	    !check->attrs[1][THREADED_FD_ATTRID].eoa) {
+	    g_fprintf(stderr, "attribute filled from an fd read back as %zu bytes\n",
+		      check->attrs[1][THREADED_FD_ATTRID].size);
+	    return 0;
+	}
+	g_free(check);
+    }
+
+    return 1;
+}
+
+/****
+ * Test the index trailer
+ */
+
+/* write three interleaved files to an archive with an index */
+static void
+write_indexed_archive(void)
+{
+    int fd;
+    amar_t *arch;
+    amar_file_t *af1, *af2, *af3;
+    amar_attr_t *at;
+    GError *error = NULL;
+    gboolean ok;
+
+    fd = open_temp(1);
+    arch = amar_new(fd, O_WRONLY, &error);
+    check_gerror(arch, error, "amar_new");
+    amar_set_write_index(arch, TRUE);
+
+    af1 = amar_new_file(arch, "one", 0, NULL, &error);
+    check_gerror(af1, error, "amar_new_file");
+    af2 = amar_new_file(arch, "two", 0, NULL, &error);
+    check_gerror(af2, error, "amar_new_file");
+
+    at = amar_new_attr(af2, AMAR_ATTR_APP_START+1, &error);
+    check_gerror(at, error, "amar_new_attr");
+    ok = amar_attr_add_data_buffer(at, "bb", 2, 0, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+
+    at = amar_new_attr(af1, AMAR_ATTR_APP_START, &error);
+    check_gerror(at, error, "amar_new_attr");
+    ok = amar_attr_add_data_buffer(at, "aaa", 3, 1, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+    ok = amar_file_close(af1, &error);
+    check_gerror(ok, error, "amar_file_close");
+
+    af3 = amar_new_file(arch, "three", 0, NULL, &error);
+    check_gerror(af3, error, "amar_new_file");
+    at = amar_new_attr(af3, AMAR_ATTR_APP_START, &error);
+    check_gerror(at, error, "amar_new_attr");
+    ok = amar_attr_add_data_buffer(at, "ccc", 3, 1, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+
+    at = amar_new_attr(af2, AMAR_ATTR_APP_START, &error);
+    check_gerror(at, error, "amar_new_attr");
+    ok = amar_attr_add_data_buffer(at, "b", 1, 1, &error);
+    check_gerror(ok, error, "amar_attr_add_data_buffer");
+
+    ok = amar_file_close(af2, &error);
+    check_gerror(ok, error, "amar_file_close");
+    ok = amar_file_close(af3, &error);
+    check_gerror(ok, error, "amar_file_close");
+
+    ok = amar_close(arch, &error);
+    check_gerror(ok, error, "amar_close");
+    close(fd);
+}
+
+static int
+test_index(void)
+{
+    int fd;
+    int p[2];
+    amar_t *ar;
+    expected_state_t state;
+    GError *error = NULL;
+    gboolean ok;
+    struct stat st;
+    amar_attr_handling_t handling[] = {
+	{ 0, 0, frag_cb, NULL },
+    };
+
+    write_indexed_archive();
+
+    /* read without the index, the trailer is skipped like the data of an
+     * unknown file, as an older reader would */
+    {
+	expected_step_t steps[] = {
+	    EXPECT_START_FILE_STR(1, "one", 0),
+	    EXPECT_START_FILE_STR(2, "two", 0),
+	    EXPECT_ATTR_DATA_STR(2, AMAR_ATTR_APP_START+1, "bb", 0, 0),
+	    EXPECT_ATTR_DATA_STR(1, AMAR_ATTR_APP_START, "aaa", 1, 0),
+	    EXPECT_FINISH_FILE(1, 0),
+	    EXPECT_START_FILE_STR(3, "three", 0),
+	    EXPECT_ATTR_DATA_STR(3, AMAR_ATTR_APP_START, "ccc", 1, 0),
+	    EXPECT_ATTR_DATA_STR(2, AMAR_ATTR_APP_START, "b", 1, 0),
+	    EXPECT_ATTR_DATA_STR(2, AMAR_ATTR_APP_START+1, "", 1, 0),
+	    EXPECT_FINISH_FILE(2, 0),
+	    EXPECT_FINISH_FILE(3, 0),
+	    EXPECT_END(),
+	};
+	try_reading(steps, handling);
+    }
+
+    /* with the index, files are read one after the other, and an ignored
+     * file's records are not read at all */
+    {
+	expected_step_t steps[] = {
+	    EXPECT_START_FILE_STR(1, "one", 1),
+	    EXPECT_START_FILE_STR(2, "two", 0),
+	    EXPECT_ATTR_DATA_STR(2, AMAR_ATTR_APP_START+1, "bb", 0, 0),
+	    EXPECT_ATTR_DATA_STR(2, AMAR_ATTR_APP_START, "b", 1, 0),
+	    EXPECT_ATTR_DATA_STR(2, AMAR_ATTR_APP_START+1, "", 1, 0),
+	    EXPECT_FINISH_FILE(2, 0),
+	    EXPECT_START_FILE_STR(3, "three", 0),
+	    EXPECT_ATTR_DATA_STR(3, AMAR_ATTR_APP_START, "ccc", 1, 0),
+	    EXPECT_FINISH_FILE(3, 0),
+	    EXPECT_END(),
+	};
+
+	fd = open_temp(0);
+	ar = amar_new(fd, O_RDONLY, &error);
+	check_gerror(ar, error, "amar_new");
+	ok = amar_read_index(ar, &error);
+	check_gerror(ok, error, "amar_read_index");
+	state.steps = steps;
+	state.curstep = 0;
+	ok = amar_read(ar, &state, handling, file_start_cb, file_finish_cb,
+		       NULL, &error);
+	check_gerror(ok, error, "amar_read");
+	if (steps[state.curstep].kind != EXP_END)
+	    EXPECT_FAILURE("Stopped reading early at step %d", state.curstep);
+
+	/* the read ends just past the archive, as a sequential one does */
+	g_assert(fstat(fd, &st) == 0);
+	if (amar_size(ar) != st.st_size || lseek(fd, 0, SEEK_CUR) != st.st_size) {
+	    g_fprintf(stderr, "indexed read ended at %lld, archive is %lld bytes\n",
+		      (long long)amar_size(ar), (long long)st.st_size);
+	    return 0;
+	}
+	amar_close(ar, NULL);
+	close(fd);
+    }
+
+    /* an archive without an index is still read sequentially */
+    fd = open_temp(1);
+    WRITE_HEADER(fd, 1);
+    WRITE_RECORD_STR(fd, 1, AMAR_ATTR_FILENAME, 1, "hi");
+    WRITE_RECORD_STR(fd, 1, AMAR_ATTR_EOF, 1, "");
+    close(fd);
+    fd = open_temp(0);
+    ar = amar_new(fd, O_RDONLY, &error);
+    check_gerror(ar, error, "amar_new");
+    if (amar_read_index(ar, &error) || error) {
+	g_fprintf(stderr, "found an index in an archive without one\n");
+	return 0;
+    }
+    {
+	expected_step_t steps[] = {
+	    EXPECT_START_FILE_STR(1, "hi", 0),
+	    EXPECT_FINISH_FILE(1, 0),
+	    EXPECT_END(),
+	};
+
+	state.steps = steps;
+	state.curstep = 0;
+	ok = amar_read(ar, &state, handling, file_start_cb, file_finish_cb,
+		       NULL, &error);
+	check_gerror(ok, error, "amar_read");
+	if (steps[state.curstep].kind != EXP_END)
+	    EXPECT_FAILURE("Stopped reading early at step %d", state.curstep);
+    }
+    amar_close(ar, NULL);
+    close(fd);
+
+    /* and so is a pipe */
+    g_assert(pipe(p) == 0);
+    ar = amar_new(p[0], O_RDONLY, &error);
+    check_gerror(ar, error, "amar_new");
+    if (amar_read_index(ar, &error) || error) {
+	g_fprintf(stderr, "found an index in a pipe\n");
+	return 0;
+    }
+    amar_close(ar, NULL);
+    close(p[0]);
+    close(p[1]);
+
+    return 1;
+}
+
+static int
+test_invalid_index(void)
+{
+    int fd;
+    amar_t *ar;
+    GError *error = NULL;
+    gboolean ok;
+    struct {
+	char magic[8];
+	guint64 index_offset;
+	guint64 archive_size;
+    } locator;
+
+    /* a locator pointing into the header */
+    memcpy(locator.magic, "AMARIDX1", 8);
+    locator.index_offset = GUINT64_TO_BE(3);
+    locator.archive_size = GUINT64_TO_BE(28 + 8 + sizeof(locator));
+
+    fd = open_temp(1);
+    WRITE_HEADER(fd, 1);
+    WRITE_RECORD(fd, 0, 0xffff, sizeof(locator), 1, &locator);
+    close(fd);
+
+    fd = open_temp(0);
+    ar = amar_new(fd, O_RDONLY, &error);
+    check_gerror(ar, error, "amar_new");
+    ok = amar_read_index(ar, &error);
+    check_gerror_matches(ok, error, "Invalid archive index, position = 3",
+			 "amar_read_index");
+    amar_close(ar, NULL);
+    close(fd);
+
+    return 1;
+}
+
 /****
  * Invalid inputs - test error returns
  */
@@ -1089,6 +1582,92 @@ test_header_vers(void)
     return 1;
 }
 
+/****
+ * Benchmark
+ */
+
+/* write MB megabytes to /dev/null in records of the given size, from
+ * NTHREADS threads each filling an attribute of its own file */
+static void
+bench_run(
+    int nthreads,
+    gsize record_size,
+    int mbytes)
+{
+    int fd;
+    amar_t *arch;
+    amar_file_t **af = g_new0(amar_file_t *, nthreads);
+    buffer_writer_t *bw = g_new0(buffer_writer_t, nthreads);
+    GThread **threads = g_new0(GThread *, nthreads);
+    GError *error = NULL;
+    GTimer *timer;
+    gdouble elapsed;
+    guint64 nrecords = 0;
+    off_t size;
+    int i;
+
+    fd = open("/dev/null", O_WRONLY);
+    g_assert(fd >= 0);
+    arch = amar_new(fd, O_WRONLY, &error);
+    check_gerror(arch, error, "amar_new");
+
+    for (i = 0; i < nthreads; i++) {
+	char *filename = g_strdup_printf("file%d", i);
+
+	af[i] = amar_new_file(arch, filename, 0, NULL, &error);
+	check_gerror(af[i], error, "amar_new_file");
+	g_free(filename);
+	bw[i].attr = amar_new_attr(af[i], AMAR_ATTR_GENERIC_DATA, &error);
+	check_gerror(bw[i].attr, error, "amar_new_attr");
+	bw[i].size = ((guint64)mbytes * 1024 * 1024) / nthreads;
+	bw[i].chunk = record_size;
+    }
+
+    timer = g_timer_new();
+    for (i = 0; i < nthreads; i++)
+	threads[i] = g_thread_create(buffer_writer_thread, &bw[i], TRUE, NULL);
+    for (i = 0; i < nthreads; i++) {
+	g_thread_join(threads[i]);
+	check_gerror(TRUE, bw[i].error, "amar_attr_add_data_buffer");
+	nrecords += bw[i].nrecords;
+	if (!amar_file_close(af[i], &error))
+	    check_gerror(FALSE, error, "amar_file_close");
+    }
+    size = amar_size(arch);
+    if (!amar_close(arch, &error))
+	check_gerror(FALSE, error, "amar_close");
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+    close(fd);
+
+    g_fprintf(stdout, "%d threads, %zu-byte records: %ju records in %.2fs: %.0f records/s, %.1f MB/s\n",
+	      nthreads, record_size, (uintmax_t)nrecords, elapsed,
+	      elapsed > 0? nrecords / elapsed : 0.0,
+	      elapsed > 0? size / elapsed / (1024 * 1024) : 0.0);
+
+    g_free(af);
+    g_free(bw);
+    g_free(threads);
+}
+
+/* amar-test --bench [threads [bytes [MB]]]: run bench_run with 1, 2, 4, ..
+ * threads, up to the given number */
+static void
+bench(
+    int max_threads,
+    gsize record_size,
+    int mbytes)
+{
+    int nthreads = 1;
+
+    while (1) {
+	bench_run(nthreads, record_size, mbytes);
+	if (nthreads >= max_threads)
+	    break;
+	nthreads = MIN(nthreads * 2, max_threads);
+    }
+}
+
 /****
  * Driver
  */
@@ -1109,12 +1688,25 @@ main(int argc, char **argv)
 	TU_TEST(test_writing_coverage, 90),
 	TU_TEST(test_big_attr, 90),
 	TU_TEST(test_pipe, 90),
+	TU_TEST(test_threads, 90),
+	TU_TEST(test_index, 90),
 	TU_TEST(test_no_header, 90),
 	TU_TEST(test_invalid_eof, 90),
+	TU_TEST(test_invalid_index, 90),
 	TU_TEST(test_header_vers, 90),
 	TU_END()
     };
 
+    glib_init();
+
+    /* amar-test --bench [threads [bytes [MB]]]: benchmark instead of testing */
+    if (argc > 1 && g_str_equal(argv[1], "--bench")) {
+	bench(argc > 2? atoi(argv[2]) : 8,
+	      argc > 3? (gsize)atoi(argv[3]) : 4096,
+	      argc > 4? atoi(argv[4]) : 4096);
+	return 0;
+    }
+
     temp_filename = g_strjoin(NULL, cwd, "/amar-test.tmp", NULL);
 
     rv = testutils_run_tests(argc, argv, tests);
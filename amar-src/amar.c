@@ -74,9 +74,80 @@ typedef struct record_s {
     a = ntohs(r.attrid); \
 } while(0)
 
-/* performance knob: how much data will we buffer before just
- * writing straight out of the user's buffers? */
-#define WRITE_BUFFER_SIZE (512*1024)
+/* An archive may end with an index trailer, giving the filename of each file
+ * and the extent of its records.  The trailer is made of records with
+ * INDEX_FILENUM, which is never assigned to a file, and INDEX_ATTRID, so a
+ * reader that doesn't know about it skips it like the data of a file it never
+ * saw start.  The data of those records is a sequence of index entries, each
+ * followed by its filename, then an index_locator_t in a record of its own at
+ * the very end, where a reader with a seekable fd can find it.  All integers
+ * are in network byte order. */
+
+#define INDEX_FILENUM 0
+#define INDEX_ATTRID 0xffff
+#define INDEX_MAGIC "AMARIDX1"
+
+typedef struct index_locator_s {
+    char     magic[8];		/* INDEX_MAGIC, without a NUL */
+    guint64  index_offset;	/* offset of the first index record */
+    guint64  archive_size;	/* offset just past the locator's record */
+} index_locator_t;
+#define INDEX_LOCATOR_SIZE (sizeof(index_locator_t))
+
+typedef struct index_entry_s {
+    guint64  start;		/* offset of the filename record */
+    guint64  end;		/* offset just past the EOF record */
+    guint32  filename_len;
+    guint16  filenum;
+    guint16  reserved;		/* zero */
+} index_entry_t;
+#define INDEX_ENTRY_SIZE (sizeof(index_entry_t))
+
+/* Records are written through a ring of WRITE_SEGMENTS segments of
+ * WRITE_SEGMENT_SIZE bytes.  A writer claims room for a record in the current
+ * segment by atomically adding its length to the segment's 'reserved' count,
+ * copies the record in, then adds the length to 'committed'.  No lock is
+ * taken on that path, so attributes being filled from several threads pack
+ * their records into the same segments.
+ *
+ * The writer whose claim is the first to run past the end of the segment
+ * seals it: it records where the claims that fit end, rotates the next
+ * segment in, waits until every claim in the sealed segment is committed,
+ * and writes the segment out.  Segments are written in the order they were
+ * sealed, which is the order in which their records were claimed.
+ *
+ * performance knob: records with more than WRITE_COPY_MAX bytes of data are
+ * not copied; they seal the current segment and are written straight out of
+ * the user's buffer, after the segment, in the same writev. */
+#define WRITE_SEGMENT_SIZE (256*1024)
+#define WRITE_SEGMENTS 4
+#define WRITE_COPY_MAX (WRITE_SEGMENT_SIZE/4)
+
+typedef struct write_segment_s {
+    gchar   *buf;
+    off_t    base;		/* archive offset of buf[0]		*/
+    guint64  seq;		/* position in the ring's write order	*/
+    gboolean busy;		/* filling or not yet written		*/
+
+    /* updated with atomic operations */
+    gint     reserved;		/* bytes claimed; may run past the end	*/
+    gint     committed;		/* bytes copied in			*/
+    gint     sealed;
+
+    /* set when sealed */
+    gint     fill;		/* bytes claimed before the end		*/
+    struct iovec direct[2];	/* a record to write after buf		*/
+    int      ndirect;
+} write_segment_t;
+
+/* an index entry, as read back by amar_read_index */
+typedef struct indexed_file_s {
+    guint16  filenum;
+    off_t    start;
+    off_t    end;
+    gchar   *filename;		/* points into archive->index		*/
+    gsize    filename_len;
+} indexed_file_t;
 
 typedef struct amar_file_attr_handling_s {
     guint16  filenum;
@@ -117,30 +188,44 @@ struct amar_s {
     GHashTable *files;		/* List of all amar_file_t		*/
     gboolean  seekable;		/* does lseek() work on this fd?	*/
 
-    /* internal buffer; on writing, this is WRITE_BUFFER_SIZE bytes, and
-     * always has at least RECORD_SIZE bytes free. */
-    gchar *buf;
-    size_t buf_len;
-    size_t buf_size;
+    /* output segments, when writing */
+    write_segment_t *segments;
+    write_segment_t *cur;	/* segment being filled			*/
+    guint64   written_seq;	/* next segment to write out		*/
+    GMutex   *write_mutex;	/* protects rotation and writing	*/
+    GCond    *write_cond;
+    GError   *write_error;	/* first write error, if any		*/
+
+    /* index trailer */
+    gboolean  write_index;	/* write one when closing		*/
+    GByteArray *index;		/* serialized entries			*/
+    GArray   *indexed_files;	/* entries read back, by start		*/
+    off_t     index_base;	/* fd offset of the archive's start	*/
+    off_t     indexed_size;	/* size of the indexed archive		*/
+
     handling_params_t *hp;
 };
 
 struct amar_file_s {
     amar_t     *archive;	/* archive for this file	*/
-    off_t       size;		/* size of the file             */
+    off_t       size;		/* size of the file, less open attributes */
     gint        filenum;	/* filenum of this file; gint is required by hash table */
     GHashTable  *attributes;	/* all attributes for this file */
+    off_t       start;		/* offset of the filename record */
+    gchar      *filename;	/* kept for the index, if any	*/
+    gsize       filename_len;
 };
 
 struct amar_attr_s {
     amar_file_t *file;		/* file for this attribute	*/
     off_t        size;		/* size of the attribute        */
+    off_t        file_size;	/* bytes of records written for it */
     gint         attrid;	/* id of this attribute		*/
     gboolean     wrote_eoa;	/* If the attribute is finished	*/
     GThread     *thread;
     int          fd;
     int          eoa;
-    GError     **error;
+    GError      *thread_error;	/* error from the thread, if any */
 };
 
 /*
@@ -159,83 +244,323 @@ amar_error_quark(void)
     return q;
 }
 
+/* Wait while SEG is current and has a claim past its end, that is, until
+ * the writer of that claim has sealed it.  A writer that read 'cur' before a
+ * rotation may have made its claim in SEG's previous use, so if SEG has been
+ * rotated back in since, there is nothing to wait for.  Called with the
+ * write mutex held. */
+static void
+wait_for_rotation(
+	amar_t *archive,
+	write_segment_t *seg)
+{
+    while (g_atomic_pointer_get(&archive->cur) == seg &&
+	   g_atomic_int_get(&seg->reserved) > WRITE_SEGMENT_SIZE)
+	g_cond_wait(archive->write_cond, archive->write_mutex);
+}
+
+/* Seal SEG, whose claims that fit end at FILL, and make the next segment
+ * current.  HDR and DATA, if given, are a record to be written after the
+ * segment's contents.  Called with the write mutex held. */
+static void
+seal_segment(
+	amar_t *archive,
+	write_segment_t *seg,
+	gint fill,
+	gpointer hdr,
+	gpointer data,
+	gsize data_size)
+{
+    write_segment_t *next;
+    off_t direct_size = 0;
+
+    next = archive->segments + (seg - archive->segments + 1) % WRITE_SEGMENTS;
+
+    /* the next segment is free once its previous contents are written */
+    while (next->busy)
+	g_cond_wait(archive->write_cond, archive->write_mutex);
+
+    seg->fill = fill;
+    seg->ndirect = 0;
+    if (hdr) {
+	seg->direct[0].iov_base = hdr;
+	seg->direct[0].iov_len = RECORD_SIZE;
+	seg->direct[1].iov_base = data;
+	seg->direct[1].iov_len = data_size;
+	seg->ndirect = data_size? 2 : 1;
+	direct_size = RECORD_SIZE + data_size;
+    }
+    g_atomic_int_set(&seg->sealed, 1);
+
+    /* a writer still holding a stale pointer to the next segment may claim
+     * space in it as soon as 'reserved' is reset, so that comes last */
+    next->base = seg->base + fill + direct_size;
+    next->seq = seg->seq + 1;
+    next->busy = TRUE;
+    g_atomic_int_set(&next->committed, 0);
+    g_atomic_int_set(&next->sealed, 0);
+    g_atomic_int_set(&next->reserved, 0);
+    g_atomic_pointer_set(&archive->cur, next);
+    g_cond_broadcast(archive->write_cond);
+}
+
+/* Wait for the claims in the sealed segment SEG to be committed and for the
+ * segments sealed before it to be written, then write it out.  Called with
+ * the write mutex held; the mutex is released during the write. */
 static gboolean
-flush_buffer(
+flush_segment(
 	amar_t *archive,
+	write_segment_t *seg,
 	GError **error)
 {
-    if (archive->buf_len) {
-	if (full_write(archive->fd, archive->buf, archive->buf_len) != archive->buf_len) {
-	    g_set_error(error, amar_error_quark(), errno,
-			"Error writing to amanda archive: %s", strerror(errno));
-	    return FALSE;
+    struct iovec iov[3];
+    int niov = 0;
+    int i;
+    gboolean success = TRUE;
+
+    while (g_atomic_int_get(&seg->committed) != seg->fill ||
+	   archive->written_seq != seg->seq)
+	g_cond_wait(archive->write_cond, archive->write_mutex);
+
+    /* after a write error, nothing more is written */
+    if (!archive->write_error) {
+	if (seg->fill) {
+	    iov[niov].iov_base = seg->buf;
+	    iov[niov].iov_len = seg->fill;
+	    niov++;
+	}
+	for (i = 0; i < seg->ndirect; i++)
+	    iov[niov++] = seg->direct[i];
+
+	if (niov) {
+	    g_mutex_unlock(archive->write_mutex);
+	    if (full_writev(archive->fd, iov, niov) < 0) {
+		int save_errno = errno;
+		g_mutex_lock(archive->write_mutex);
+		archive->write_error = g_error_new(amar_error_quark(), save_errno,
+			"Error writing to amanda archive: %s", strerror(save_errno));
+	    } else {
+		g_mutex_lock(archive->write_mutex);
+	    }
 	}
-	archive->buf_len = 0;
     }
 
-    return TRUE;
+    if (archive->write_error) {
+	g_propagate_error(error, g_error_copy(archive->write_error));
+	success = FALSE;
+    }
+
+    seg->ndirect = 0;
+    seg->busy = FALSE;
+    archive->written_seq++;
+    g_cond_broadcast(archive->write_cond);
+
+    return success;
 }
 
+/* Seal the current segment and write it out, followed by the record in HDR
+ * and DATA, if HDR is given, whose offset goes in *OFFSET if that is not
+ * NULL.  The write is finished when this returns. */
 static gboolean
-write_header(
+flush_records(
 	amar_t *archive,
+	gpointer hdr,
+	gpointer data,
+	gsize data_size,
+	off_t *offset,
 	GError **error)
 {
-    /* if it won't fit in the buffer, take the easy way out and flush it */
-    if (archive->buf_len + HEADER_SIZE >= WRITE_BUFFER_SIZE - RECORD_SIZE) {
-	if (!flush_buffer(archive, error))
-	    return FALSE;
+    gboolean success;
+
+    while (1) {
+	write_segment_t *seg = g_atomic_pointer_get(&archive->cur);
+	/* claim more than the segment holds, so that the claim runs past
+	 * the end whatever the segment's fill */
+	gint old = __sync_fetch_and_add(&seg->reserved, WRITE_SEGMENT_SIZE + 1);
+
+	g_mutex_lock(archive->write_mutex);
+	if (old <= WRITE_SEGMENT_SIZE) {
+	    seal_segment(archive, seg, old, hdr, data, data_size);
+	    if (offset)
+		*offset = seg->base + old;
+	    success = flush_segment(archive, seg, error);
+	    g_mutex_unlock(archive->write_mutex);
+	    return success;
+	}
+
+	/* somebody else is sealing this segment; try again after */
+	wait_for_rotation(archive, seg);
+	g_mutex_unlock(archive->write_mutex);
     }
+}
+
+/* Claim SIZE bytes in the current segment, where SIZE is no more than
+ * RECORD_SIZE + WRITE_COPY_MAX.  Returns the segment and sets *OFFSET, or
+ * returns NULL on error.  The caller copies its bytes to that offset, then
+ * calls commit_claim. */
+static write_segment_t *
+claim_space(
+	amar_t *archive,
+	gsize size,
+	gint *offset,
+	GError **error)
+{
+    while (1) {
+	write_segment_t *seg = g_atomic_pointer_get(&archive->cur);
+	gint old = __sync_fetch_and_add(&seg->reserved, (gint)size);
 
-    memcpy(archive->buf + archive->buf_len, &archive->hdr, HEADER_SIZE);
-    archive->buf_len += HEADER_SIZE;
-    archive->position += HEADER_SIZE;
+	/* the common case: it fits */
+	if (old + (gint)size <= WRITE_SEGMENT_SIZE) {
+	    *offset = old;
+	    return seg;
+	}
+
+	g_mutex_lock(archive->write_mutex);
+	if (old <= WRITE_SEGMENT_SIZE) {
+	    /* this is the first claim past the end, so it's ours to seal */
+	    seal_segment(archive, seg, old, NULL, NULL, 0);
+	    if (!flush_segment(archive, seg, error)) {
+		g_mutex_unlock(archive->write_mutex);
+		return NULL;
+	    }
+	} else {
+	    wait_for_rotation(archive, seg);
+	}
+	g_mutex_unlock(archive->write_mutex);
+    }
+}
+
+static void
+commit_claim(
+	amar_t *archive,
+	write_segment_t *seg,
+	gsize size)
+{
+    (void)__sync_fetch_and_add(&seg->committed, (gint)size);
+
+    /* if the segment has been sealed, its sealer may be waiting for this */
+    if (g_atomic_int_get(&seg->sealed)) {
+	g_mutex_lock(archive->write_mutex);
+	g_cond_broadcast(archive->write_cond);
+	g_mutex_unlock(archive->write_mutex);
+    }
+}
+
+static gboolean
+write_header(
+	amar_t *archive,
+	off_t *header_offset,
+	GError **error)
+{
+    write_segment_t *seg;
+    gint offset;
+
+    seg = claim_space(archive, HEADER_SIZE, &offset, error);
+    if (!seg)
+	return FALSE;
+
+    memcpy(seg->buf + offset, &archive->hdr, HEADER_SIZE);
+    if (header_offset)
+	*header_offset = seg->base + offset;
+    commit_claim(archive, seg, HEADER_SIZE);
 
     return TRUE;
 }
 
+/* Write a record, and add its size to *FILE_SIZE: the file's own count for
+ * its filename and EOF records, or the attribute's for its records.  If
+ * RECORD_OFFSET is not NULL, the record's offset goes there.  This may be
+ * called from several threads at once, for different attributes. */
 static gboolean
 write_record(
 	amar_t *archive,
-	amar_file_t *file,
+	guint16  filenum,
+	off_t *file_size,
 	guint16  attrid,
 	gboolean eoa,
 	gpointer data,
 	gsize data_size,
+	off_t *record_offset,
 	GError **error)
 {
-    /* the buffer always has room for a new record header */
-    MKRECORD(archive->buf + archive->buf_len, file->filenum, attrid, data_size, eoa);
-    archive->buf_len += RECORD_SIZE;
-
-    /* is it worth copying this record into the buffer? */
-    if (archive->buf_len + RECORD_SIZE + data_size < WRITE_BUFFER_SIZE - RECORD_SIZE) {
+    /* is it worth copying this record into a segment? */
+    if (data_size <= WRITE_COPY_MAX) {
 	/* yes, it is */
+	write_segment_t *seg;
+	gint offset;
+
+	seg = claim_space(archive, RECORD_SIZE + data_size, &offset, error);
+	if (!seg)
+	    return FALSE;
+
+	MKRECORD(seg->buf + offset, filenum, attrid, data_size, eoa);
 	if (data_size)
-	    memcpy(archive->buf + archive->buf_len, data, data_size);
-	archive->buf_len += data_size;
+	    memcpy(seg->buf + offset + RECORD_SIZE, data, data_size);
+	if (record_offset)
+	    *record_offset = seg->base + offset;
+	commit_claim(archive, seg, RECORD_SIZE + data_size);
     } else {
-	/* no, it's not */
-	struct iovec iov[2];
-
-	/* flush the buffer and write the new data, all in one syscall */
-	iov[0].iov_base = archive->buf;
-	iov[0].iov_len = archive->buf_len;
-	iov[1].iov_base = data;
-	iov[1].iov_len = data_size;
-	if (full_writev(archive->fd, iov, 2) < 0) {
-	    g_set_error(error, amar_error_quark(), errno,
-			"Error writing to amanda archive: %s", strerror(errno));
+	/* no, it's not; write it out after the current segment */
+	char hdr[RECORD_SIZE];
+
+	MKRECORD(hdr, filenum, attrid, data_size, eoa);
+	if (!flush_records(archive, hdr, data, data_size, record_offset, error))
 	    return FALSE;
-	}
-	archive->buf_len = 0;
     }
 
-    archive->position += data_size + RECORD_SIZE;
-    file->size += data_size + RECORD_SIZE;
+    *file_size += data_size + RECORD_SIZE;
     return TRUE;
 }
 
+/* Add an index entry for FILE, whose EOF record ends at END */
+static void
+add_index_entry(
+	amar_t *archive,
+	amar_file_t *file,
+	off_t end)
+{
+    index_entry_t entry;
+
+    entry.start = GUINT64_TO_BE((guint64)file->start);
+    entry.end = GUINT64_TO_BE((guint64)end);
+    entry.filename_len = htonl(file->filename_len);
+    entry.filenum = htons(file->filenum);
+    entry.reserved = 0;
+    g_byte_array_append(archive->index, (guint8 *)&entry, INDEX_ENTRY_SIZE);
+    g_byte_array_append(archive->index, (guint8 *)file->filename,
+			file->filename_len);
+}
+
+/* Write the index trailer; this must be the last thing in the archive */
+static gboolean
+write_index(
+	amar_t *archive,
+	GError **error)
+{
+    index_locator_t locator;
+    off_t index_offset = amar_size(archive);
+    off_t trailer_size = 0;
+    guint done = 0;
+
+    /* the entries, in records as large as the format allows */
+    while (done < archive->index->len) {
+	gsize size = MIN(archive->index->len - done, MAX_RECORD_DATA_SIZE);
+
+	if (!write_record(archive, INDEX_FILENUM, &trailer_size, INDEX_ATTRID,
+			  FALSE, archive->index->data + done, size, NULL, error))
+	    return FALSE;
+	done += size;
+    }
+
+    /* and the locator, which ends the archive */
+    memcpy(locator.magic, INDEX_MAGIC, sizeof(locator.magic));
+    locator.index_offset = GUINT64_TO_BE((guint64)index_offset);
+    locator.archive_size = GUINT64_TO_BE((guint64)(index_offset +
+			trailer_size + RECORD_SIZE + INDEX_LOCATOR_SIZE));
+    return write_record(archive, INDEX_FILENUM, &trailer_size, INDEX_ATTRID,
+			TRUE, &locator, INDEX_LOCATOR_SIZE, NULL, error);
+}
+
 /*
  * Public functions
  */
@@ -259,22 +584,36 @@ amar_new(
     archive->position = 0;
     archive->seekable = TRUE; /* assume seekable until lseek() fails */
     archive->files = g_hash_table_new(g_int_hash, g_int_equal);
-    archive->buf = NULL;
+    archive->segments = NULL;
+    archive->cur = NULL;
+    archive->written_seq = 0;
+    archive->write_mutex = NULL;
+    archive->write_cond = NULL;
+    archive->write_error = NULL;
+    archive->write_index = FALSE;
+    archive->index = NULL;
+    archive->indexed_files = NULL;
+    archive->index_base = 0;
+    archive->indexed_size = 0;
 
     if (mode == O_WRONLY) {
-	archive->buf = g_malloc(WRITE_BUFFER_SIZE);
-	archive->buf_size = WRITE_BUFFER_SIZE;
-    }
-    archive->buf_len = 0;
+	int i;
+
+	archive->segments = g_new0(write_segment_t, WRITE_SEGMENTS);
+	for (i = 0; i < WRITE_SEGMENTS; i++)
+	    archive->segments[i].buf = g_malloc(WRITE_SEGMENT_SIZE);
+	archive->segments[0].busy = TRUE;
+	archive->cur = &archive->segments[0];
+	archive->write_mutex = g_mutex_new();
+	archive->write_cond = g_cond_new();
 
-    if (mode == O_WRONLY) {
 	/* preformat a header with our version number */
 	bzero(archive->hdr.magic, HEADER_SIZE);
 	snprintf(archive->hdr.magic, HEADER_SIZE,
 	    HEADER_MAGIC " %d", HEADER_VERSION);
 
 	/* and write it out to start the file */
-	if (!write_header(archive, error)) {
+	if (!write_header(archive, NULL, error)) {
 	    amar_close(archive, NULL); /* flushing buffer won't fail */
 	    return NULL;
 	}
@@ -293,11 +632,28 @@ amar_close(
     /* verify all files are done */
     g_assert(g_hash_table_size(archive->files) == 0);
 
-    if (archive->mode == O_WRONLY && !flush_buffer(archive, error))
-	success = FALSE;
+    if (archive->mode == O_WRONLY) {
+	int i;
 
+	if (archive->write_index)
+	    success = write_index(archive, error);
+	if (success && !flush_records(archive, NULL, NULL, 0, NULL, error))
+	    success = FALSE;
+
+	for (i = 0; i < WRITE_SEGMENTS; i++)
+	    g_free(archive->segments[i].buf);
+	g_free(archive->segments);
+	g_mutex_free(archive->write_mutex);
+	g_cond_free(archive->write_cond);
+	if (archive->write_error)
+	    g_error_free(archive->write_error);
+    }
+
+    if (archive->index)
+	g_byte_array_free(archive->index, TRUE);
+    if (archive->indexed_files)
+	g_array_free(archive->indexed_files, TRUE);
     g_hash_table_destroy(archive->files);
-    if (archive->buf) g_free(archive->buf);
     amfree(archive);
 
     return success;
@@ -307,7 +663,30 @@ off_t
 amar_size(
     amar_t *archive)
 {
-    return archive->position;
+    write_segment_t *seg;
+    off_t size;
+
+    if (archive->mode != O_WRONLY)
+	return archive->position;
+
+    /* everything claimed so far, whether or not it is written yet */
+    g_mutex_lock(archive->write_mutex);
+    while (1) {
+	gint reserved;
+
+	seg = g_atomic_pointer_get(&archive->cur);
+	reserved = g_atomic_int_get(&seg->reserved);
+	if (reserved <= WRITE_SEGMENT_SIZE) {
+	    size = seg->base + reserved;
+	    break;
+	}
+
+	/* the segment is being sealed; its size is not known until then */
+	wait_for_rotation(archive, seg);
+    }
+    g_mutex_unlock(archive->write_mutex);
+
+    return size;
 }
 
 off_t
@@ -317,6 +696,19 @@ amar_record(
     return archive->record;
 }
 
+void
+amar_set_write_index(
+    amar_t *archive,
+    gboolean write_index)
+{
+    g_assert(archive->mode == O_WRONLY);
+    g_assert(archive->maxfilenum == 0);
+
+    archive->write_index = write_index;
+    if (write_index && !archive->index)
+	archive->index = g_byte_array_new();
+}
+
 /*
  * Writing
  */
@@ -347,7 +739,7 @@ amar_new_file(
 
     /* pick a new, unused filenum */
 
-    if (g_hash_table_size(archive->files) == 65535) {
+    if (g_hash_table_size(archive->files) == 65534) {
 	g_set_error(error, amar_error_quark(), ENOSPC,
 		    "No more file numbers available");
 	return NULL;
@@ -358,8 +750,10 @@ amar_new_file(
 
 	archive->maxfilenum++;
 
-	/* MAGIC_FILENUM can't be used because it matches the header record text */
-	if (archive->maxfilenum == MAGIC_FILENUM) {
+	/* MAGIC_FILENUM can't be used because it matches the header record
+	 * text, and INDEX_FILENUM belongs to the index trailer */
+	if (archive->maxfilenum == MAGIC_FILENUM ||
+	    archive->maxfilenum == INDEX_FILENUM) {
 	    continue;
 	}
 
@@ -384,16 +778,21 @@ amar_new_file(
 
     /* record the current position and write a header there, if desired */
     if (header_offset) {
-	*header_offset = archive->position;
-	if (!write_header(archive, error))
+	if (!write_header(archive, header_offset, error))
 	    goto error_exit;
     }
 
     /* add a filename record */
-    if (!write_record(archive, file, AMAR_ATTR_FILENAME,
-		      1, filename_buf, filename_len, error))
+    if (!write_record(archive, file->filenum, &file->size, AMAR_ATTR_FILENAME,
+		      1, filename_buf, filename_len, &file->start, error))
 	goto error_exit;
 
+    /* keep the filename until the file is closed and indexed */
+    if (archive->write_index) {
+	file->filename = g_memdup(filename_buf, filename_len);
+	file->filename_len = filename_len;
+    }
+
     return file;
 
 error_exit:
@@ -405,11 +804,52 @@ error_exit:
     return NULL;
 }
 
+static void
+foreach_attr_file_size(
+	gpointer key G_GNUC_UNUSED,
+	gpointer value,
+	gpointer user_data)
+{
+    amar_attr_t *attr = value;
+    off_t *size = user_data;
+
+    *size += attr->file_size;
+}
+
 off_t
 amar_file_size(
     amar_file_t *file)
 {
-    return file->size;
+    off_t size = file->size;
+
+    /* attributes count their own records until they are closed, so that
+     * attributes being filled by different threads don't share a counter */
+    g_hash_table_foreach(file->attributes, foreach_attr_file_size, &size);
+    return size;
+}
+
+/* wait for the thread filling this attribute, if any, and pass along its
+ * error, unless ERROR is already set */
+static gboolean
+join_attr_thread(
+	amar_attr_t *attribute,
+	GError **error)
+{
+    if (attribute->thread) {
+	g_thread_join(attribute->thread);
+	attribute->thread = NULL;
+    }
+
+    if (attribute->thread_error) {
+	if (error && !*error)
+	    g_propagate_error(error, attribute->thread_error);
+	else
+	    g_error_free(attribute->thread_error);
+	attribute->thread_error = NULL;
+	return FALSE;
+    }
+
+    return TRUE;
 }
 
 static void
@@ -421,10 +861,7 @@ foreach_attr_close(
     amar_attr_t *attr = value;
     GError **error = user_data;
 
-    if (attr->thread) {
-	g_thread_join(attr->thread);
-	attr->thread = NULL;
-    }
+    (void)join_attr_thread(attr, error);
 
     /* return immediately if we've already seen an error */
     if (*error)
@@ -442,6 +879,7 @@ amar_file_close(
 {
     gboolean success = TRUE;
     amar_t *archive = file->archive;
+    off_t eof_offset;
 
     /* close all attributes that haven't already written EOA */
     g_hash_table_foreach(file->attributes, foreach_attr_close, error);
@@ -450,16 +888,20 @@ amar_file_close(
 
     /* write an EOF record */
     if (success) {
-	if (!write_record(archive, file, AMAR_ATTR_EOF, 1,
-			  NULL, 0, error))
+	if (!write_record(archive, file->filenum, &file->size, AMAR_ATTR_EOF, 1,
+			  NULL, 0, &eof_offset, error))
 	    success = FALSE;
     }
 
+    if (success && file->filename)
+	add_index_entry(archive, file, eof_offset + RECORD_SIZE);
+
     /* remove from archive->file list */
     g_hash_table_remove(archive->files, &file->filenum);
 
     /* clean up */
     g_hash_table_destroy(file->attributes);
+    g_free(file->filename);
     amfree(file);
 
     return success;
@@ -486,11 +928,13 @@ amar_new_attr(
     }
     attribute->file = file;
     attribute->size = 0;
+    attribute->file_size = 0;
     attribute->attrid = attrid;
     attribute->wrote_eoa = FALSE;
     attribute->thread = NULL;
     attribute->fd = -1;
     attribute->eoa = 0;
+    attribute->thread_error = NULL;
     g_hash_table_replace(file->attributes, &attribute->attrid, attribute);
 
     /* (note this function cannot currently return an error) */
@@ -514,16 +958,15 @@ amar_attr_close_no_remove(
     amar_t        *archive = file->archive;
     gboolean rv = TRUE;
 
-    if (attribute->thread) {
-	g_thread_join(attribute->thread);
-	attribute->thread = NULL;
-    }
+    /* an attribute whose thread failed is left without an EOA */
+    if (!join_attr_thread(attribute, error))
+	return FALSE;
 
     /* write an empty record with EOA_BIT set if we haven't ended
      * this attribute already */
     if (!attribute->wrote_eoa) {
-	if (!write_record(archive, file, attribute->attrid,
-			  1, NULL, 0, error))
+	if (!write_record(archive, file->filenum, &attribute->file_size,
+			  attribute->attrid, 1, NULL, 0, NULL, error))
 	    rv = FALSE;
 	attribute->wrote_eoa = TRUE;
     }
@@ -541,6 +984,7 @@ amar_attr_close(
     gint  attrid_gint = attribute->attrid;
 
     rv = amar_attr_close_no_remove(attribute, error);
+    file->size += attribute->file_size;
     g_hash_table_remove(file->attributes, &attrid_gint);
 
     return rv;
@@ -571,8 +1015,9 @@ amar_attr_add_data_buffer(
 		rec_eoa = TRUE;
 	}
 
-	if (!write_record(archive, file, attribute->attrid,
-			  rec_eoa, data, rec_data_size, error))
+	if (!write_record(archive, file->filenum, &attribute->file_size,
+			  attribute->attrid, rec_eoa, data, rec_data_size,
+			  NULL, error))
 	    return FALSE;
 
 	data = (gchar *)data + rec_data_size;
@@ -593,11 +1038,11 @@ amar_attr_add_data_fd_in_thread(
     amar_attr_t *attribute,
     int fd,
     gboolean eoa,
-    GError **error)
+    GError **error G_GNUC_UNUSED)
 {
+    /* errors are reported when the attribute is closed */
     attribute->fd = fd;
     attribute->eoa = eoa;
-    attribute->error = error;
     attribute->thread = g_thread_create(amar_attr_add_data_fd_thread, attribute, TRUE, NULL);
     return 0;
 }
@@ -608,11 +1053,11 @@ amar_attr_add_data_fd_thread(
 {
     amar_attr_t *attribute = (amar_attr_t *)data;
 
-    amar_attr_add_data_fd(attribute, attribute->fd, attribute->eoa, attribute->error);
+    amar_attr_add_data_fd(attribute, attribute->fd, attribute->eoa,
+			  &attribute->thread_error);
     close(attribute->fd);
     attribute->fd = -1;
     attribute->eoa = 0;
-    attribute->error = NULL;
     return NULL;
 }
 
@@ -646,8 +1091,8 @@ amar_attr_add_data_fd(
 
 	if (size == 0) {
 	    if (eoa && !attribute->wrote_eoa) {
-		if (!write_record(archive, file, attribute->attrid,
-				  1, buf, size, error)) {
+		if (!write_record(archive, file->filenum, &attribute->file_size,
+				  attribute->attrid, 1, buf, size, NULL, error)) {
 		    filesize = -1;
 		}
 	    }
@@ -656,8 +1101,8 @@ amar_attr_add_data_fd(
 
 	short_read = (size < MAX_RECORD_DATA_SIZE);
 
-	if (!write_record(archive, file, attribute->attrid,
-	    eoa && short_read, buf, size, error)) {
+	if (!write_record(archive, file->filenum, &attribute->file_size,
+	    attribute->attrid, eoa && short_read, buf, size, NULL, error)) {
 	    filesize = -1;
 	    break;
 	}
@@ -1347,20 +1792,19 @@ set_amar_read_cb(
     return amar_read_cb;
 }
 
-gboolean
-amar_read(
+/* Read and handle records from the start of the archive to its end, or, if
+ * IFILE is given, the records of that file from the current position to its
+ * EOF record. */
+static gboolean
+read_records(
 	amar_t *archive,
-	gpointer user_data,
-	amar_attr_handling_t *handling_array,
-	amar_file_start_callback_t file_start_cb,
-	amar_file_finish_callback_t file_finish_cb,
-	amar_done_callback_t done_cb,
+	handling_params_t *hp,
+	indexed_file_t *ifile,
 	GError **error)
 {
     file_state_t *fs = NULL;
     attr_state_t *as = NULL;
     GSList *iter;
-    handling_params_t hp;
     guint16  filenum;
     guint16  attrid;
     guint32  datasize;
@@ -1368,25 +1812,10 @@ amar_read(
     amar_attr_handling_t *hdl;
     gboolean success = TRUE;
 
-    g_assert(archive->mode == O_RDONLY);
-
-    hp.user_data = user_data;
-    hp.handling_array = handling_array;
-    hp.file_start_cb = file_start_cb;
-    hp.file_finish_cb = file_finish_cb;
-    hp.done_cb = done_cb;
-    hp.file_states = NULL;
-    hp.buf_len = 0;
-    hp.buf_offset = 0;
-    hp.buf_size = 1024; /* use a 1K buffer to start */
-    hp.buf = g_malloc(hp.buf_size);
-    hp.got_eof = FALSE;
-    hp.just_lseeked = FALSE;
-
     /* check that we are starting at a header record, but don't advance
      * the buffer past it */
-    if (buf_atleast(archive, &hp, RECORD_SIZE)) {
-	GETRECORD(buf_ptr(&hp), filenum, attrid, datasize, eoa);
+    if (!ifile && buf_atleast(archive, hp, RECORD_SIZE)) {
+	GETRECORD(buf_ptr(hp), filenum, attrid, datasize, eoa);
 	if (filenum != MAGIC_FILENUM) {
 	    g_set_error(error, amar_error_quark(), EINVAL,
 			"Archive read does not begin at a header record, position = %lld",
@@ -1396,10 +1825,14 @@ amar_read(
     }
 
     while (1) {
-	if (!buf_atleast(archive, &hp, RECORD_SIZE))
+	/* when reading one indexed file, stop at its end */
+	if (ifile && (archive->position >= ifile->end || !hp->file_states))
 	    break;
 
-	GETRECORD(buf_ptr(&hp), filenum, attrid, datasize, eoa);
+	if (!buf_atleast(archive, hp, RECORD_SIZE))
+	    break;
+
+	GETRECORD(buf_ptr(hp), filenum, attrid, datasize, eoa);
 
 	archive->record++;
 	/* handle headers specially */
@@ -1407,10 +1840,10 @@ amar_read(
 	    int vers;
 
 	    /* bail if an EOF occurred in the middle of the header */
-	    if (!buf_atleast(archive, &hp, HEADER_SIZE))
+	    if (!buf_atleast(archive, hp, HEADER_SIZE))
 		break;
 
-	    if (sscanf(buf_ptr(&hp), HEADER_MAGIC " %d", &vers) != 1) {
+	    if (sscanf(buf_ptr(hp), HEADER_MAGIC " %d", &vers) != 1) {
 		g_set_error(error, amar_error_quark(), EINVAL,
 			    "Invalid archive header, position = %lld",
 			    (long long)archive->position);
@@ -1424,12 +1857,12 @@ amar_read(
 		return FALSE;
 	    }
 
-	    buf_skip(archive, &hp, HEADER_SIZE);
+	    buf_skip(archive, hp, HEADER_SIZE);
 
 	    continue;
 	}
 
-	buf_skip(archive, &hp, RECORD_SIZE);
+	buf_skip(archive, hp, RECORD_SIZE);
 
 	if (datasize > MAX_RECORD_DATA_SIZE) {
 	    g_set_error(error, amar_error_quark(), EINVAL,
@@ -1438,10 +1871,17 @@ amar_read(
 	    return FALSE;
 	}
 
+	/* and every other file's records are skipped */
+	if (ifile && filenum != ifile->filenum) {
+	    buf_skip(archive, hp, datasize);
+	    continue;
+	}
+
 	/* find the file_state_t, if it exists */
 	if (!fs || fs->filenum != filenum) {
 	    fs = NULL;
-	    for (iter = hp.file_states; iter; iter = iter->next) {
+	    as = NULL; /* it belongs to the previous file */
+	    for (iter = hp->file_states; iter; iter = iter->next) {
 		if (((file_state_t *)iter->data)->filenum == filenum) {
 		    fs = (file_state_t *)iter->data;
 		    break;
@@ -1459,8 +1899,8 @@ amar_read(
 		    return FALSE;
 		}
 		if (fs) {
-		    hp.file_states = g_slist_remove(hp.file_states, fs);
-		    success = finish_file(&hp, fs, FALSE);
+		    hp->file_states = g_slist_remove(hp->file_states, fs);
+		    success = finish_file(hp, fs, FALSE);
 		    as = NULL;
 		    g_free(fs);
 		    fs = NULL;
@@ -1470,13 +1910,13 @@ amar_read(
 		continue;
 	    } else if (attrid == AMAR_ATTR_FILENAME) {
 		/* for filenames, we need the whole filename in the buffer */
-		if (!buf_atleast(archive, &hp, datasize))
+		if (!buf_atleast(archive, hp, datasize))
 		    break;
 
 		if (fs) {
 		    /* TODO: warn - previous file did not end correctly */
-		    hp.file_states = g_slist_remove(hp.file_states, fs);
-		    success = finish_file(&hp, fs, TRUE);
+		    hp->file_states = g_slist_remove(hp->file_states, fs);
+		    success = finish_file(hp, fs, TRUE);
 		    as = NULL;
 		    g_free(fs);
 		    fs = NULL;
@@ -1488,11 +1928,11 @@ amar_read(
 		    unsigned int i, nul_padding = 1;
 		    char *bb;
 		    /* try to detect NULL padding bytes */
-		    if (!buf_atleast(archive, &hp, 512 - RECORD_SIZE)) {
+		    if (!buf_atleast(archive, hp, 512 - RECORD_SIZE)) {
 			/* close to end of file */
 			break;
 		    }
-		    bb = buf_ptr(&hp);
+		    bb = buf_ptr(hp);
 		    /* check all byte == 0 */
 		    for (i=0; i<512 - RECORD_SIZE; i++) {
 			if (*bb++ != 0)
@@ -1517,17 +1957,17 @@ amar_read(
 
 		fs = g_new0(file_state_t, 1);
 		fs->filenum = filenum;
-		hp.file_states = g_slist_prepend(hp.file_states, fs);
+		hp->file_states = g_slist_prepend(hp->file_states, fs);
 
-		if (hp.file_start_cb) {
-		    success = hp.file_start_cb(hp.user_data, filenum,
-			    buf_ptr(&hp), datasize,
+		if (hp->file_start_cb) {
+		    success = hp->file_start_cb(hp->user_data, filenum,
+			    buf_ptr(hp), datasize,
 			    &fs->ignore, &fs->file_data);
 		    if (!success)
 			break;
 		}
 
-		buf_skip(archive, &hp, datasize);
+		buf_skip(archive, hp, datasize);
 
 		continue;
 	    } else {
@@ -1541,7 +1981,7 @@ amar_read(
 	/* if this is an unrecognized file or a known file that's being
 	 * ignored, then skip it. */
 	if (!fs || fs->ignore) {
-	    buf_skip(archive, &hp, datasize);
+	    buf_skip(archive, hp, datasize);
 	    continue;
 	}
 
@@ -1560,7 +2000,7 @@ amar_read(
 	if (as) {
 	    hdl = as->handling;
 	} else {
-	    for (hdl = hp.handling_array; hdl->attrid != 0; hdl++) {
+	    for (hdl = hp->handling_array; hdl->attrid != 0; hdl++) {
 		if (hdl->attrid == attrid)
 		    break;
 	    }
@@ -1572,41 +2012,41 @@ amar_read(
 	    gpointer tmp = NULL;
 	    if (hdl->callback) {
 		/* a simple single-part callback */
-		if (buf_avail(&hp) >= datasize) {
-		    success = hdl->callback(hp.user_data, filenum, fs->file_data, attrid,
-			    hdl->attrid_data, &tmp, buf_ptr(&hp), datasize, eoa, FALSE);
+		if (buf_avail(hp) >= datasize) {
+		    success = hdl->callback(hp->user_data, filenum, fs->file_data, attrid,
+			    hdl->attrid_data, &tmp, buf_ptr(hp), datasize, eoa, FALSE);
 		    if (!success)
 			break;
-		    buf_skip(archive, &hp, datasize);
+		    buf_skip(archive, hp, datasize);
 		    continue;
 		}
 
 		/* we only have part of the data, but if it's big enough to exceed
 		 * the attribute's min_size, then just call the callback for each
 		 * part of the data */
-		else if (buf_avail(&hp) >= hdl->min_size) {
-		    gsize firstpart = buf_avail(&hp);
+		else if (buf_avail(hp) >= hdl->min_size) {
+		    gsize firstpart = buf_avail(hp);
 		    gsize lastpart = datasize - firstpart;
 
-		    success = hdl->callback(hp.user_data, filenum, fs->file_data, attrid,
-			    hdl->attrid_data, &tmp, buf_ptr(&hp), firstpart, FALSE, FALSE);
+		    success = hdl->callback(hp->user_data, filenum, fs->file_data, attrid,
+			    hdl->attrid_data, &tmp, buf_ptr(hp), firstpart, FALSE, FALSE);
 		    if (!success)
 			break;
-		    buf_skip(archive, &hp, firstpart);
+		    buf_skip(archive, hp, firstpart);
 
-		    if (!buf_atleast(archive, &hp, lastpart))
+		    if (!buf_atleast(archive, hp, lastpart))
 			break;
 
-		    success = hdl->callback(hp.user_data, filenum, fs->file_data, attrid,
-			    hdl->attrid_data, &tmp, buf_ptr(&hp), lastpart, eoa, FALSE);
+		    success = hdl->callback(hp->user_data, filenum, fs->file_data, attrid,
+			    hdl->attrid_data, &tmp, buf_ptr(hp), lastpart, eoa, FALSE);
 		    if (!success)
 			break;
-		    buf_skip(archive, &hp, lastpart);
+		    buf_skip(archive, hp, lastpart);
 		    continue;
 		}
 	    } else {
 		/* no callback -> just skip it */
-		buf_skip(archive, &hp, datasize);
+		buf_skip(archive, hp, datasize);
 		continue;
 	    }
 	}
@@ -1622,32 +2062,32 @@ amar_read(
 	if (hdl->callback) {
 	    /* handle the data as one or two hunks, depending on whether it's
 	     * all in the buffer right now */
-	    if (buf_avail(&hp) >= datasize) {
-		success = handle_hunk(&hp, fs, as, hdl, buf_ptr(&hp), datasize, eoa);
+	    if (buf_avail(hp) >= datasize) {
+		success = handle_hunk(hp, fs, as, hdl, buf_ptr(hp), datasize, eoa);
 		if (!success)
 		    break;
-		buf_skip(archive, &hp, datasize);
+		buf_skip(archive, hp, datasize);
 	    } else {
-		gsize hunksize = buf_avail(&hp);
-		success = handle_hunk(&hp, fs, as, hdl, buf_ptr(&hp), hunksize, FALSE);
+		gsize hunksize = buf_avail(hp);
+		success = handle_hunk(hp, fs, as, hdl, buf_ptr(hp), hunksize, FALSE);
 		if (!success)
 		    break;
-		buf_skip(archive, &hp, hunksize);
+		buf_skip(archive, hp, hunksize);
 
 		hunksize = datasize - hunksize;
-		if (!buf_atleast(archive, &hp, hunksize))
+		if (!buf_atleast(archive, hp, hunksize))
 		    break;
 
-		handle_hunk(&hp, fs, as, hdl, buf_ptr(&hp), hunksize, eoa);
-		buf_skip(archive, &hp, hunksize);
+		handle_hunk(hp, fs, as, hdl, buf_ptr(hp), hunksize, eoa);
+		buf_skip(archive, hp, hunksize);
 	    }
 	} else {
-	    buf_skip(archive, &hp, datasize);
+	    buf_skip(archive, hp, datasize);
 	}
 
 	/* finish the attribute if this is its last record */
 	if (eoa) {
-	    success = finish_attr(&hp, fs, as, FALSE);
+	    success = finish_attr(hp, fs, as, FALSE);
 	    fs->attr_states = g_slist_remove(fs->attr_states, as);
 	    g_free(as);
 	    as = NULL;
@@ -1657,11 +2097,286 @@ amar_read(
     }
 
     /* close any open files, assuming that they have been truncated */
-
-    for (iter = hp.file_states; iter; iter = iter->next) {
+    for (iter = hp->file_states; iter; iter = iter->next) {
 	file_state_t *fs = (file_state_t *)iter->data;
-	finish_file(&hp, fs, TRUE);
+	finish_file(hp, fs, TRUE);
     }
+    slist_free_full(hp->file_states, g_free);
+    hp->file_states = NULL;
+
+    return success;
+}
+
+/* Move the read position to OFFSET in the archive */
+static gboolean
+seek_archive(
+	amar_t *archive,
+	handling_params_t *hp,
+	off_t offset,
+	GError **error)
+{
+    /* a short hop forward stays within the buffer */
+    if (offset >= archive->position &&
+	offset - archive->position <= (off_t)hp->buf_len) {
+	gsize skip = offset - archive->position;
+	return buf_skip(archive, hp, skip);
+    }
+
+    if (lseek(archive->fd, archive->index_base + offset, SEEK_SET) < 0) {
+	int save_errno = errno;
+	g_set_error(error, amar_error_quark(), save_errno,
+		    "Error seeking to position %lld: %s",
+		    (long long)offset, strerror(save_errno));
+	return FALSE;
+    }
+    hp->buf_len = 0;
+    hp->buf_offset = 0;
+    hp->got_eof = FALSE;
+    archive->position = offset;
+
+    return TRUE;
+}
+
+/* Read the indexed files that the file_start callback wants, seeking straight
+ * to each one and reading no further than its EOF record; the files that are
+ * ignored are not read at all.  Files are handled one after the other, in the
+ * order in which they start in the archive. */
+static gboolean
+read_indexed_files(
+	amar_t *archive,
+	handling_params_t *hp,
+	GError **error)
+{
+    gboolean success = TRUE;
+    guint i;
+
+    for (i = 0; i < archive->indexed_files->len; i++) {
+	indexed_file_t *ifile = &g_array_index(archive->indexed_files,
+					       indexed_file_t, i);
+	file_state_t *fs = g_new0(file_state_t, 1);
+
+	fs->filenum = ifile->filenum;
+	if (hp->file_start_cb) {
+	    success = hp->file_start_cb(hp->user_data, ifile->filenum,
+			ifile->filename, ifile->filename_len,
+			&fs->ignore, &fs->file_data);
+	    if (!success) {
+		g_free(fs);
+		break;
+	    }
+	}
+
+	if (fs->ignore) {
+	    g_free(fs);
+	    continue;
+	}
+
+	/* start just after the filename record */
+	hp->file_states = g_slist_prepend(hp->file_states, fs);
+	success = seek_archive(archive, hp,
+			ifile->start + RECORD_SIZE + ifile->filename_len, error)
+	       && read_records(archive, hp, ifile, error);
+	if (!success)
+	    break;
+    }
+
+    /* leave the fd just past the archive, as a sequential read would */
+    if (success)
+	success = seek_archive(archive, hp, archive->indexed_size, error);
+
+    return success;
+}
+
+/* Read SIZE bytes at OFFSET in the fd, for amar_read_index */
+static gboolean
+read_index_bytes(
+	int fd,
+	off_t offset,
+	gpointer buf,
+	gsize size,
+	GError **error)
+{
+    int read_error = 0;
+
+    if (lseek(fd, offset, SEEK_SET) < 0)
+	read_error = errno;
+    else if (read_fully(fd, buf, size, &read_error) < size && !read_error)
+	read_error = EIO; /* the file was truncated under us */
+
+    if (read_error) {
+	g_set_error(error, amar_error_quark(), read_error,
+		    "Error reading the archive index: %s", strerror(read_error));
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gint
+compare_indexed_files(
+	gconstpointer a,
+	gconstpointer b)
+{
+    const indexed_file_t *fa = a, *fb = b;
+
+    if (fa->start != fb->start)
+	return fa->start < fb->start ? -1 : 1;
+    return 0;
+}
+
+gboolean
+amar_read_index(
+	amar_t *archive,
+	GError **error)
+{
+    gchar tail[RECORD_SIZE + INDEX_LOCATOR_SIZE];
+    index_locator_t locator;
+    GByteArray *index = NULL;
+    GArray *files = NULL;
+    off_t base, end;
+    guint64 index_offset, archive_size;
+    guint16  filenum;
+    guint16  attrid;
+    guint32  datasize;
+    gboolean eoa;
+    gsize pos, len;
+
+    g_assert(archive->mode == O_RDONLY);
+    g_assert(archive->position == 0);
+
+    /* the index is found from the end of the archive, so the fd must be
+     * seekable; a pipe just doesn't have an index */
+    base = lseek(archive->fd, 0, SEEK_CUR);
+    if (base < 0)
+	return FALSE;
+    end = lseek(archive->fd, 0, SEEK_END);
+    if (end < 0 || end - base < (off_t)(HEADER_SIZE + sizeof(tail)))
+	goto no_index;
+    if (!read_index_bytes(archive->fd, end - sizeof(tail), tail, sizeof(tail),
+			  error))
+	goto no_index;
+
+    GETRECORD(tail, filenum, attrid, datasize, eoa);
+    memcpy(&locator, tail + RECORD_SIZE, INDEX_LOCATOR_SIZE);
+    if (filenum != INDEX_FILENUM || attrid != INDEX_ATTRID || !eoa ||
+	datasize != INDEX_LOCATOR_SIZE ||
+	memcmp(locator.magic, INDEX_MAGIC, sizeof(locator.magic)) != 0)
+	goto no_index;
+
+    /* an index for an archive that doesn't start here belongs to another
+     * archive, maybe one written after this one in the same file */
+    index_offset = GUINT64_FROM_BE(locator.index_offset);
+    archive_size = GUINT64_FROM_BE(locator.archive_size);
+    if (archive_size != (guint64)(end - base))
+	goto no_index;
+    if (index_offset < HEADER_SIZE || index_offset > archive_size - sizeof(tail))
+	goto invalid;
+
+    /* read the index records, and pack their data together */
+    len = archive_size - sizeof(tail) - index_offset;
+    index = g_byte_array_new();
+    g_byte_array_set_size(index, len);
+    if (!read_index_bytes(archive->fd, base + index_offset, index->data, len,
+			  error))
+	goto no_index;
+
+    for (pos = 0, len = 0; pos < index->len; pos += RECORD_SIZE + datasize) {
+	if (index->len - pos < RECORD_SIZE)
+	    goto invalid;
+	GETRECORD(index->data + pos, filenum, attrid, datasize, eoa);
+	if (filenum != INDEX_FILENUM || attrid != INDEX_ATTRID || eoa ||
+	    datasize > index->len - pos - RECORD_SIZE)
+	    goto invalid;
+	memmove(index->data + len, index->data + pos + RECORD_SIZE, datasize);
+	len += datasize;
+    }
+    g_byte_array_set_size(index, len);
+
+    /* and parse the entries */
+    files = g_array_new(FALSE, FALSE, sizeof(indexed_file_t));
+    for (pos = 0; pos < index->len; pos += INDEX_ENTRY_SIZE) {
+	index_entry_t entry;
+	indexed_file_t ifile;
+
+	if (index->len - pos < INDEX_ENTRY_SIZE)
+	    goto invalid;
+	memcpy(&entry, index->data + pos, INDEX_ENTRY_SIZE);
+	ifile.filenum = ntohs(entry.filenum);
+	ifile.start = GUINT64_FROM_BE(entry.start);
+	ifile.end = GUINT64_FROM_BE(entry.end);
+	ifile.filename_len = ntohl(entry.filename_len);
+	ifile.filename = (gchar *)index->data + pos + INDEX_ENTRY_SIZE;
+	if (ifile.filename_len == 0 ||
+	    ifile.filename_len > index->len - pos - INDEX_ENTRY_SIZE ||
+	    ifile.start < (off_t)HEADER_SIZE ||
+	    ifile.end > (off_t)index_offset ||
+	    ifile.end - ifile.start <
+		(off_t)(2 * RECORD_SIZE + ifile.filename_len))
+	    goto invalid;
+	g_array_append_val(files, ifile);
+	pos += ifile.filename_len;
+    }
+    g_array_sort(files, compare_indexed_files);
+    (void)lseek(archive->fd, base, SEEK_SET);
+
+    if (archive->index)
+	g_byte_array_free(archive->index, TRUE);
+    if (archive->indexed_files)
+	g_array_free(archive->indexed_files, TRUE);
+    archive->index = index;
+    archive->indexed_files = files;
+    archive->index_base = base;
+    archive->indexed_size = archive_size;
+    return TRUE;
+
+invalid:
+    g_set_error(error, amar_error_quark(), EINVAL,
+		"Invalid archive index, position = %lld",
+		(long long)index_offset);
+
+no_index:
+    if (index)
+	g_byte_array_free(index, TRUE);
+    if (files)
+	g_array_free(files, TRUE);
+    (void)lseek(archive->fd, base, SEEK_SET);
+    return FALSE;
+}
+
+gboolean
+amar_read(
+	amar_t *archive,
+	gpointer user_data,
+	amar_attr_handling_t *handling_array,
+	amar_file_start_callback_t file_start_cb,
+	amar_file_finish_callback_t file_finish_cb,
+	amar_done_callback_t done_cb,
+	GError **error)
+{
+    handling_params_t hp;
+    gboolean success;
+
+    g_assert(archive->mode == O_RDONLY);
+
+    hp.user_data = user_data;
+    hp.handling_array = handling_array;
+    hp.file_start_cb = file_start_cb;
+    hp.file_finish_cb = file_finish_cb;
+    hp.done_cb = done_cb;
+    hp.file_states = NULL;
+    hp.buf_len = 0;
+    hp.buf_offset = 0;
+    hp.buf_size = 1024; /* use a 1K buffer to start */
+    hp.buf = g_malloc(hp.buf_size);
+    hp.got_eof = FALSE;
+    hp.just_lseeked = FALSE;
+
+    if (archive->indexed_files)
+	success = read_indexed_files(archive, &hp, error);
+    else
+	success = read_records(archive, &hp, NULL, error);
+
+    /* files are only left open by an error */
     slist_free_full(hp.file_states, g_free);
     g_free(hp.buf);
 
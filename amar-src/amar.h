@@ -65,7 +65,8 @@ enum {
 amar_t *amar_new(int fd, mode_t mode, GError **error);
 
 /* Finish writing to this fd.  All buffers are flushed, but the file descriptor
- * is not closed -- the user must close it. */
+ * is not closed -- the user must close it.  If any write to the archive
+ * failed, even one made on behalf of another thread, this returns its error. */
 gboolean amar_close(amar_t *archive, GError **error);
 
 /* Return the size of the archive if opened in write mode,
@@ -75,6 +76,26 @@ off_t amar_size(amar_t *archive);
 /* Return the record number of the archive if opened in read mode */
 off_t amar_record(amar_t *archive);
 
+/* Have amar_close end the archive with an index trailer, giving the filename
+ * of each file and where its records are.  Readers that don't know about the
+ * index skip it.  This must be called before the first file is created.
+ */
+void amar_set_write_index(amar_t *archive, gboolean write_index);
+
+/* Look for an index trailer at the end of an archive opened in read mode, and
+ * if there is one, have amar_read use it: amar_read then calls the file_start
+ * callback for each file from the index, seeks straight to the files that are
+ * not ignored, and handles them one after the other, without reading the rest
+ * of the archive.  The fd must be positioned at the start of the archive, and
+ * must be seekable.  The file_finish callback will not be called for ignored
+ * files, as usual.
+ *
+ * @returns: TRUE if the index was found; FALSE if it was not, or on error,
+ *	in which case the error is set.  amar_read can still read the archive
+ *	sequentially in either case.
+ */
+gboolean amar_read_index(amar_t *archive, GError **error);
+
 /* create a new 'file' object on the archive.  The filename is treated as a
  * binary blob, but if filename_len is zero, then its length will be calculated
  * with strlen().  A zero-length filename_buf is not allowed.
@@ -127,6 +148,9 @@ gboolean amar_attr_close(
  * last data in this attribute, set eoa to TRUE.  This will save space by
  * writing and end-of-attribute indication in this record, instead of adding
  * an empty EOA record.
+ *
+ * This function may be called from several threads at once, as long as each
+ * uses a different attribute.
  */
 gboolean amar_attr_add_data_buffer(
 	    amar_attr_t *attribute,
@@ -152,7 +176,11 @@ off_t amar_attr_add_data_fd(
 
 /* Same but do it in a new thread
  * Return immediately
- * Caller should not use the archive, next call must be attr->close
+ * Any number of attributes, in the same file or in different files, can be
+ * filled by threads at once, and the caller can go on writing data to other
+ * attributes meanwhile; records from all of them are packed into the same
+ * output buffers.  Closing the attribute (or its file) waits for the thread,
+ * and returns any error it encountered.
  */
 off_t amar_attr_add_data_fd_in_thread(
 	    amar_attr_t *attribute,
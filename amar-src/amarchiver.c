@@ -33,6 +33,7 @@ static struct option long_options[] = {
     {"verbose"         , 0, NULL,  4},
     {"file"            , 1, NULL,  5},
     {"version"         , 0, NULL,  6},
+    {"index"           , 0, NULL,  7},
     {NULL, 0, NULL, 0}
 };
 
@@ -40,6 +41,7 @@ static void
 usage(void)
 {
     printf("Usage: amarchiver [--version|--create|--list|--extract] [--verbose]* [--file file]\n");
+    printf("            [--index]\n");
     printf("            [filename]*\n");
     exit(1);
 }
@@ -53,7 +55,7 @@ error_exit(const char *action, GError *gerror)
 }
 
 static void
-do_create(char *opt_file, int opt_verbose, int argc, char **argv)
+do_create(char *opt_file, int opt_verbose, int opt_index, int argc, char **argv)
 {
     FILE *output = stdout;
     amar_t *archive;
@@ -75,6 +77,8 @@ do_create(char *opt_file, int opt_verbose, int argc, char **argv)
     archive = amar_new(fd_out, O_WRONLY, &gerror);
     if (!archive)
 	error_exit("amar_new", gerror);
+    if (opt_index)
+	amar_set_write_index(archive, TRUE);
 
     i = 0;
     while (i<argc) {
@@ -281,6 +285,23 @@ do_extract(
     if (!archive)
 	error_exit("amar_new", gerror);
 
+    /* when only some files are wanted, an index lets us seek straight to
+     * them instead of reading the whole archive */
+    if (argc && amar_read_index(archive, &gerror)) {
+	if (!amar_read(archive, &ud, handling, extract_file_start_cb,
+		       extract_file_finish_cb, NULL, &gerror)) {
+	    if (gerror)
+		error_exit("amar_read", gerror);
+	    else
+		/* one of the callbacks already printed an error message */
+		exit(1);
+	}
+	amar_close(archive, NULL);
+	return;
+    }
+    if (gerror)
+	error_exit("amar_read_index", gerror);
+
 //    if (!amar_read(archive, &ud, handling, extract_file_start_cb,
 //		   extract_file_finish_cb, NULL, &gerror)) {
 //	if (gerror)
@@ -340,6 +361,10 @@ do_list(
     if (!archive)
 	error_exit("amar_new", gerror);
 
+    /* with an index, every file is ignored, so nothing else is read */
+    if (!amar_read_index(archive, &gerror) && gerror)
+	error_exit("amar_read_index", gerror);
+
     if (!amar_read(archive, NULL, handling, list_file_start_cb,
 		   NULL, NULL, &gerror)) {
 	if (gerror)
@@ -360,6 +385,7 @@ int main(
     int   opt_extract   = 0;
     int   opt_list      = 0;
     int   opt_verbose   = 0;
+    int   opt_index     = 0;
     char *opt_file      = NULL;
 
     glib_init();
@@ -385,6 +411,8 @@ int main(
 	case 6: printf("amarchiver %s\n", VERSION);
 		exit(0);
 		break;
+	case 7: opt_index = 1;
+		break;
 	}
     }
     argc -= optind;
@@ -401,7 +429,7 @@ int main(
     }
 
     if (opt_create > 0)
-	do_create(opt_file, opt_verbose, argc, argv);
+	do_create(opt_file, opt_verbose, opt_index, argc, argv);
     else if (opt_extract > 0)
 	do_extract(opt_file, opt_verbose, argc, argv);
     else if (opt_list > 0)
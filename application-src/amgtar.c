@@ -60,6 +60,7 @@
  * TAR-BLOCKSIZE   (default does not add --blocking-factor option,
  *                  using tar's default)
  * VERBOSE
+ * STREAMS         (default 1)
  */
 
 #include "amanda.h"
@@ -73,6 +74,7 @@
 #include "conffile.h"
 #include "getopt.h"
 #include "security-file.h"
+#include "amar.h"
 
 int debug_application = 1;
 #define application_debug(i, ...) do {	\
@@ -143,6 +145,26 @@ typedef struct application_argument_s {
 
 enum { CMD_ESTIMATE, CMD_BACKUP };
 
+/* With a STREAMS property greater than 1, the entries of the DLE are shared
+ * among that many gnutar, which run at the same time.  Each one has its own
+ * listed-incremental files, and its output is a file of an amanda archive
+ * written on the data stream. */
+typedef struct amgtar_stream_s {
+    int           num;
+    GPtrArray    *members;	/* entries given to this gnutar */
+    off_t         size;		/* their estimated size, in bytes */
+    char         *file_include;
+    char         *incrname;
+    pid_t         tarpid;
+    int           dataf;
+    FILE         *outstream;
+    GThread      *thread;
+    off_t         dump_size;	/* in KB, from the gnutar output */
+    amar_file_t  *file;
+    application_argument_t *argument;
+    FILE         *indexstream;
+} amgtar_stream_t;
+
 static void amgtar_support(application_argument_t *argument);
 static void amgtar_selfcheck(application_argument_t *argument);
 static void amgtar_discover(application_argument_t *argument);
@@ -156,13 +178,25 @@ static void amgtar_build_exinclude(dle_t *dle,
 				   int *nb_include, char **file_includei,
 				   char *dirname, messagelist_t *mlist);
 static char *amgtar_get_incrname(application_argument_t *argument, int level,
-				 FILE *mesgstream, int command);
+				 int stream, FILE *mesgstream, int command);
 static void check_no_check_device(void);
 static GPtrArray *amgtar_build_argv(char *gnutar_realpath,
 				application_argument_t *argument,
-				char *incrname, char **file_exclude,
-				char **file_include, int command,
-				messagelist_t *mlist);
+				char *incrname, char *file_exclude,
+				char *file_include, int command);
+static GPtrArray *amgtar_split_streams(application_argument_t *argument,
+				int level, char *file_include,
+				FILE *mesgstream, int command,
+				char **mapname);
+static void amgtar_free_streams(application_argument_t *argument,
+				GPtrArray *streams);
+static off_t amgtar_backup_streams(application_argument_t *argument,
+				char *gnutar_realpath, GPtrArray *streams,
+				char *file_exclude, FILE *indexstream,
+				char **errmsg);
+static char *amgtar_extract_streams(char *cmd, GPtrArray *argv_ptr,
+				gboolean need_root, gboolean index);
+static gboolean amgtar_stdin_is_archive(void);
 static char *command = NULL;
 static char *gnutar_path;
 static char *gnutar_listdir;
@@ -183,6 +217,7 @@ static char   *exit_handling;
 static int     exit_value[256];
 static FILE   *mesgstream = NULL;
 static int     amgtar_exit_value = 0;
+static int     amgtar_streams;
 
 static struct option long_options[] = {
     {"config"          , 1, NULL,  1},
@@ -231,6 +266,7 @@ static struct option long_options[] = {
     {"cmd-from-sendbackup=s"  , 1, NULL, 44},
     {"cmd-to-sendbackup=s"    , 1, NULL, 45},
     {"server-backup-result"   , 1, NULL, 46},
+    {"streams"                , 1, NULL, 47},
     {NULL, 0, NULL, 0}
 };
 
@@ -361,6 +397,7 @@ main(
     char *gnutar_checkdevice_value = NULL;
     char *gnutar_no_unquote_value = NULL;
     char *gnutar_dar_value = NULL;
+    char *gnutar_streams_value = NULL;
 
 #ifdef GNUTAR
     gnutar_path = g_strdup(GNUTAR);
@@ -377,6 +414,7 @@ main(
     gnutar_checkdevice = 1;
     gnutar_sparse = 1;
     gnutar_no_unquote = 0;
+    amgtar_streams = 1;
     exit_handling = NULL;
 
     /* initialize */
@@ -592,6 +630,9 @@ main(
 		 break;
 	case 46: argument.server_backup_result = 1;
 		 break;
+	case 47: amfree(gnutar_streams_value);
+		 gnutar_streams_value = g_strdup(optarg);
+		 break;
 	case ':':
 	case '?':
 		break;
@@ -713,6 +754,23 @@ main(
 	}
     }
 
+    if (gnutar_streams_value) {
+	char *end;
+	long  streams = strtol(gnutar_streams_value, &end, 10);
+
+	if (*gnutar_streams_value == '\0' || *end != '\0' ||
+	    streams < 1 || streams > 256) {
+	    delete_message(amgtar_print_message(build_message(
+			AMANDA_FILE, __LINE__, 3700016, MSG_ERROR, 4,
+			"value", gnutar_streams_value,
+			"disk", argument.dle.disk,
+			"device", argument.dle.device,
+			"hostname", argument.host)));
+	} else {
+	    amgtar_streams = streams;
+	}
+    }
+
     argument.argc = argc - optind;
     argument.argv = argv + optind;
 
@@ -778,6 +836,7 @@ main(
     dbprintf("SELINUX %s\n", gnutar_selinux? "yes":"no");
     dbprintf("XATTRS %s\n", gnutar_xattrs? "yes":"no");
     dbprintf("CHECK-DEVICE %s\n", gnutar_checkdevice? "yes":"no");
+    dbprintf("STREAMS %d\n", amgtar_streams);
     {
 	amregex_t *rp;
 	for (rp = re_table; rp->regex != NULL; rp++) {
@@ -1097,29 +1156,150 @@ amgtar_selfcheck(
     set_root_privs(0);
 }
 
-static void
-amgtar_estimate(
-    application_argument_t *argument)
+/* Run gnutar to estimate the size of one level, with the given
+ * listed-incremental file and include list; returns the size in KB, or -1.
+ * Errors are appended to *errmsg. */
+static off_t
+amgtar_estimate_one(
+    application_argument_t *argument,
+    char  *gnutar_realpath,
+    char  *incrname,
+    char  *file_exclude,
+    char  *file_include,
+    char  *qdisk,
+    int    level,
+    char **errmsg)
 {
-    char      *incrname = NULL;
     GPtrArray *argv_ptr;
     int        nullfd = -1;
     int        pipefd = -1;
     FILE      *dumpout = NULL;
     off_t      size = -1;
     char       line[32768];
-    char      *errmsg = NULL;
-    char      *qerrmsg = NULL;
-    char      *qdisk = NULL;
     amwait_t   wait_status;
     int        tarpid;
     amregex_t *rp;
     times_t    start_time;
+    GString   *strbuf;
+
+    argv_ptr = amgtar_build_argv(gnutar_realpath,
+				 argument, incrname, file_exclude,
+				 file_include, CMD_ESTIMATE);
+
+    start_time = curclock();
+
+    if ((nullfd = open("/dev/null", O_RDWR)) == -1) {
+	*errmsg = g_strdup_printf(_("Cannot access /dev/null : %s"),
+			    strerror(errno));
+	g_ptr_array_free_full(argv_ptr);
+	return -1;
+    }
+
+    tarpid = pipespawnv(gnutar_realpath, STDERR_PIPE, 1,
+			&nullfd, &nullfd, &pipefd,
+			(char **)argv_ptr->pdata);
+
+    dumpout = fdopen(pipefd,"r");
+    if (!dumpout) {
+	error(_("Can't fdopen: %s"), strerror(errno));
+	/*NOTREACHED*/
+    }
+
+    size = (off_t)-1;
+    while (size < 0 && (fgets(line, sizeof(line), dumpout) != NULL)) {
+	if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
+	    /* remove trailling \n */
+	    line[strlen(line)-1] = '\0';
+	}
+	if (line[0] == '\0')
+	    continue;
+	dbprintf("%s\n", line);
+	/* check for size match */
+	/*@ignore@*/
+	for(rp = re_table; rp->regex != NULL; rp++) {
+	    if(match(rp->regex, line)) {
+		if (rp->typ == DMP_SIZE) {
+		    size = ((the_num(line, rp->field)*rp->scale+1023.0)/1024.0);
+		    if(size < 0.0)
+			size = 1.0;             /* found on NeXT -- sigh */
+		}
+		break;
+	    }
+	}
+	/*@end@*/
+    }
+
+    while (fgets(line, sizeof(line), dumpout) != NULL) {
+	dbprintf("%s", line);
+    }
+
+    dbprintf(".....\n");
+    dbprintf(_("estimate time for %s level %d: %s\n"),
+	     qdisk,
+	     level,
+	     walltime_str(timessub(curclock(), start_time)));
+    if(size == (off_t)-1) {
+	*errmsg = g_strdup_printf(_("no size line match in %s output"), gnutar_realpath);
+	dbprintf(_("%s for %s\n"), *errmsg, qdisk);
+	dbprintf(".....\n");
+    } else if(size == (off_t)0 && argument->level == 0) {
+	dbprintf(_("possible %s problem -- is \"%s\" really empty?\n"),
+		 gnutar_realpath, argument->dle.disk);
+	dbprintf(".....\n");
+    }
+    dbprintf(_("estimate size for %s level %d: %lld KB\n"),
+	     qdisk,
+	     level,
+	     (long long)size);
+
+    (void)kill(-tarpid, SIGTERM);
+
+    dbprintf(_("waiting for %s \"%s\" child\n"), gnutar_realpath, qdisk);
+    waitpid(tarpid, &wait_status, 0);
+    if (WIFSIGNALED(wait_status)) {
+	strbuf = g_string_new(*errmsg);
+	g_string_append_printf(strbuf, "%s terminated with signal %d: see %s",
+	    gnutar_realpath, WTERMSIG(wait_status), dbfn());
+	g_free(*errmsg);
+	*errmsg = g_string_free(strbuf, FALSE);
+    } else if (WIFEXITED(wait_status)) {
+	if (exit_value[WEXITSTATUS(wait_status)] == 1) {
+	    strbuf = g_string_new(*errmsg);
+	    g_string_append_printf(strbuf, "%s exited with status %d: see %s",
+		gnutar_realpath, WEXITSTATUS(wait_status), dbfn());
+	    g_free(*errmsg);
+	    *errmsg = g_string_free(strbuf, FALSE);
+	} else {
+	    /* Normal exit */
+	}
+    } else {
+	g_free(*errmsg);
+	*errmsg = g_strdup_printf(_("%s got bad exit: see %s"),
+			    gnutar_realpath, dbfn());
+    }
+    dbprintf(_("after %s %s wait\n"), gnutar_realpath, qdisk);
+
+    g_ptr_array_free_full(argv_ptr);
+    aclose(nullfd);
+    afclose(dumpout);
+
+    return size;
+}
+
+static void
+amgtar_estimate(
+    application_argument_t *argument)
+{
+    char      *incrname = NULL;
+    off_t      size = -1;
+    char      *errmsg = NULL;
+    char      *qerrmsg = NULL;
+    char      *qdisk = NULL;
     int        level;
     GSList    *levels;
+    char      *dirname;
     char      *file_exclude = NULL;
     char      *file_include = NULL;
-    GString   *strbuf;
     char      *option;
     char      *gnutar_realpath = NULL;
     message_t *message;
@@ -1142,19 +1322,18 @@ amgtar_estimate(
 	error("Invalid '%s' COMMAND-OPTIONS", option);
     }
 
+    if (gnutar_target) {
+	dirname = gnutar_target;
+    } else {
+	dirname = argument->dle.device;
+    }
+
     if (argument->calcsize) {
-	char *dirname;
 	int   nb_exclude;
 	int   nb_include;
 	messagelist_t mlist = NULL;
 	messagelist_t mesglist = NULL;
 
-	if (gnutar_target) {
-	    dirname = gnutar_target;
-	} else {
-	    dirname = argument->dle.device;
-	}
-
 	amgtar_build_exinclude(&argument->dle,
 			       &nb_exclude, &file_exclude,
 			       &nb_include, &file_include, dirname, &mlist);
@@ -1202,10 +1381,11 @@ amgtar_estimate(
 	messagelist_t mlist = NULL;
 	messagelist_t mesglist = NULL;
 	level = GPOINTER_TO_INT(levels->data);
-	incrname = amgtar_get_incrname(argument, level, stdout, CMD_ESTIMATE);
-	argv_ptr = amgtar_build_argv(gnutar_realpath,
-				     argument, incrname, &file_exclude,
-				     &file_include, CMD_ESTIMATE, &mlist);
+	if (amgtar_streams == 1)
+	    incrname = amgtar_get_incrname(argument, level, -1, stdout,
+					   CMD_ESTIMATE);
+	amgtar_build_exinclude(&argument->dle, NULL, &file_exclude,
+			       NULL, &file_include, dirname, &mlist);
 	for (mesglist = mlist; mesglist != NULL; mesglist = mesglist->next){
 	    message_t *message = mesglist->data;
 	    if (message_get_severity(message) > MSG_INFO)
@@ -1215,118 +1395,60 @@ amgtar_estimate(
 	g_slist_free(mlist);
 	mlist = NULL;
 
-	start_time = curclock();
-
-	if ((nullfd = open("/dev/null", O_RDWR)) == -1) {
-	    errmsg = g_strdup_printf(_("Cannot access /dev/null : %s"),
-				strerror(errno));
-	    goto common_exit;
-	}
-
-	tarpid = pipespawnv(gnutar_realpath, STDERR_PIPE, 1,
-			    &nullfd, &nullfd, &pipefd,
-			    (char **)argv_ptr->pdata);
-
-	dumpout = fdopen(pipefd,"r");
-	if (!dumpout) {
-	    error(_("Can't fdopen: %s"), strerror(errno));
-	    /*NOTREACHED*/
-	}
-
-	size = (off_t)-1;
-	while (size < 0 && (fgets(line, sizeof(line), dumpout) != NULL)) {
-	    if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
-		/* remove trailling \n */
-		line[strlen(line)-1] = '\0';
-	    }
-	    if (line[0] == '\0')
-		continue;
-	    dbprintf("%s\n", line);
-	    /* check for size match */
-	    /*@ignore@*/
-	    for(rp = re_table; rp->regex != NULL; rp++) {
-		if(match(rp->regex, line)) {
-		    if (rp->typ == DMP_SIZE) {
-			size = ((the_num(line, rp->field)*rp->scale+1023.0)/1024.0);
-			if(size < 0.0)
-			    size = 1.0;             /* found on NeXT -- sigh */
-		    }
-		    break;
+	if (amgtar_streams == 1) {
+	    size = amgtar_estimate_one(argument, gnutar_realpath, incrname,
+				       file_exclude, file_include, qdisk,
+				       level, &errmsg);
+	    unlink(incrname);
+	    amfree(incrname);
+	} else {
+	    /* each stream has its own listed-incremental files, so the
+	     * estimate is the sum of one per stream */
+	    GPtrArray *streams = amgtar_split_streams(argument, level,
+						      file_include, stdout,
+						      CMD_ESTIMATE);
+	    guint      i;
+
+	    size = 0;
+	    for (i = 0; i < streams->len && size >= 0; i++) {
+		amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+		off_t            stream_size;
+
+		if (!stream->incrname)
+		    continue;
+		stream_size = amgtar_estimate_one(argument, gnutar_realpath,
+						  stream->incrname,
+						  file_exclude,
+						  stream->file_include,
+						  qdisk, level, &errmsg);
+		if (stream_size < 0 || errmsg) {
+		    size = -1;
+		} else {
+		    size += stream_size;
 		}
 	    }
-	    /*@end@*/
-	}
-
-	while (fgets(line, sizeof(line), dumpout) != NULL) {
-	    dbprintf("%s", line);
-	}
-
-	dbprintf(".....\n");
-	dbprintf(_("estimate time for %s level %d: %s\n"),
-		 qdisk,
-		 level,
-		 walltime_str(timessub(curclock(), start_time)));
-	if(size == (off_t)-1) {
-	    errmsg = g_strdup_printf(_("no size line match in %s output"), gnutar_realpath);
-	    dbprintf(_("%s for %s\n"), errmsg, qdisk);
-	    dbprintf(".....\n");
-	} else if(size == (off_t)0 && argument->level == 0) {
-	    dbprintf(_("possible %s problem -- is \"%s\" really empty?\n"),
-		     gnutar_realpath, argument->dle.disk);
-	    dbprintf(".....\n");
-	}
-	dbprintf(_("estimate size for %s level %d: %lld KB\n"),
-		 qdisk,
-		 level,
-		 (long long)size);
-
-	(void)kill(-tarpid, SIGTERM);
-
-	dbprintf(_("waiting for %s \"%s\" child\n"), gnutar_realpath, qdisk);
-	waitpid(tarpid, &wait_status, 0);
-	if (WIFSIGNALED(wait_status)) {
-	    strbuf = g_string_new(errmsg);
-	    g_string_append_printf(strbuf, "%s terminated with signal %d: see %s",
-                gnutar_realpath, WTERMSIG(wait_status), dbfn());
-	    g_free(errmsg);
-            errmsg = g_string_free(strbuf, FALSE);
-	} else if (WIFEXITED(wait_status)) {
-	    if (exit_value[WEXITSTATUS(wait_status)] == 1) {
-                strbuf = g_string_new(errmsg);
-                g_string_append_printf(strbuf, "%s exited with status %d: see %s",
-                    gnutar_realpath, WEXITSTATUS(wait_status), dbfn());
-		g_free(errmsg);
-                errmsg = g_string_free(strbuf, FALSE);
-	    } else {
-		/* Normal exit */
+	    for (i = 0; i < streams->len; i++) {
+		amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+		if (stream->incrname)
+		    unlink(stream->incrname);
 	    }
-	} else {
-	    errmsg = g_strdup_printf(_("%s got bad exit: see %s"),
-				gnutar_realpath, dbfn());
+	    amgtar_free_streams(argument, streams);
 	}
-	dbprintf(_("after %s %s wait\n"), gnutar_realpath, qdisk);
 
-common_exit:
 	if (errmsg) {
 	    dbprintf("%s", errmsg);
 	    fprintf(stdout, "ERROR %s\n", errmsg);
 	    amfree(errmsg);
 	}
 
-	unlink(incrname);
-
 	if (argument->verbose == 0) {
 	    if (file_exclude)
 		unlink(file_exclude);
 	    if (file_include)
 		unlink(file_include);
         }
-
-	g_ptr_array_free_full(argv_ptr);
-	amfree(incrname);
-
-	aclose(nullfd);
-	afclose(dumpout);
+	amfree(file_exclude);
+	amfree(file_include);
 
 	fprintf(stdout, "%d %lld 1\n", level, (long long)size);
     }
@@ -1353,18 +1475,128 @@ common_error:
     return;
 }
 
+/* Handle one line of the gnutar output during a backup: either a filename,
+ * for the index and the state, or a message.  The size from the "Total bytes
+ * written" message is stored in *dump_size, in KB. */
+static void
+amgtar_backup_line(
+    application_argument_t *argument,
+    char     *line,
+    FILE     *indexstream,
+    gboolean  with_state,
+    off_t    *dump_size)
+{
+    amregex_t *rp;
+    char      *type;
+    char       startchr;
+
+    if (strncmp(line, "block ", 6) == 0) { /* filename */
+	off_t block_no = g_ascii_strtoull(line+6, NULL, 0);
+	char *filename = strchr(line, ':');
+	if (filename) {
+	    filename += 2;
+	    if (*filename == '.' && *(filename+1) == '/') {
+		if (argument->dle.create_index) {
+		    fprintf(indexstream, "%s\n", &filename[1]); /* remove . */
+		}
+		if (!with_state) {
+		    /* block numbers are only meaningful for a single stream */
+		} else if (argument->state_stream != -1) {
+		    char *s = g_strdup_printf("%lld %s\n",
+				     (long long)block_no, &filename[1]);
+		    guint a = full_write(argument->state_stream, s, strlen(s));
+		    if (a < strlen(s)) {
+			g_debug("Failed to write to the state stream: %s",
+				strerror(errno));
+		    }
+		    g_free(s);
+		} else if (argument->amfeatures &&
+			   am_has_feature(argument->amfeatures,
+					  fe_sendbackup_state)) {
+		    fprintf(mesgstream, "sendbackup: state %lld %s\n",
+			    (long long)block_no, &filename[1]);
+		}
+	    }
+	}
+    } else { /* message */
+	for(rp = re_table; rp->regex != NULL; rp++) {
+	    if(match(rp->regex, line)) {
+		break;
+	    }
+	}
+	if(rp->typ == DMP_SIZE) {
+	    *dump_size = (off_t)((the_num(line, rp->field)* rp->scale+1023.0)/1024.0);
+	}
+	switch(rp->typ) {
+	case DMP_NORMAL:
+	    type = "normal";
+	    startchr = '|';
+	    break;
+	case DMP_IGNORE:
+	    return;
+	case DMP_STRANGE:
+	    type = "strange";
+	    startchr = '?';
+	    break;
+	case DMP_SIZE:
+	    type = "size";
+	    startchr = '|';
+	    break;
+	case DMP_ERROR:
+	    type = "error";
+	    startchr = '?';
+	    break;
+	default:
+	    type = "unknown";
+	    startchr = '!';
+	    break;
+	}
+	dbprintf("%3d: %7s(%c): %s\n", rp->srcline, type, startchr, line);
+	fprintf(mesgstream,"%c %s\n", startchr, line);
+    }
+}
+
+/* At the end of a backup, give a ".new" listed-incremental file (or stream
+ * map) its final name if the backup succeeded and is recorded, otherwise
+ * remove it. */
+static void
+amgtar_finish_incrname(
+    application_argument_t *argument,
+    char *incrname,
+    char *errmsg)
+{
+    if (strlen(incrname) > 4) {
+	if (argument->dle.record && !errmsg) {
+	    char *nodotnew = g_strdup(incrname);
+	    nodotnew[strlen(nodotnew)-4] = '\0';
+	    if (rename(incrname, nodotnew)) {
+		dbprintf(_("%s: warning [renaming %s to %s: %s]\n"),
+			 get_pname(), incrname, nodotnew, strerror(errno));
+		g_fprintf(mesgstream, _("? warning [renaming %s to %s: %s]\n"),
+			  incrname, nodotnew, strerror(errno));
+	    }
+	    amfree(nodotnew);
+	} else {
+	    if (unlink(incrname) == -1) {
+		dbprintf(_("%s: warning [unlink %s: %s]\n"),
+			 get_pname(), incrname, strerror(errno));
+		g_fprintf(mesgstream, _("? warning [unlink %s: %s]\n"),
+			  incrname, strerror(errno));
+	    }
+	}
+    }
+}
+
 static void
 amgtar_backup(
     application_argument_t *argument)
 {
     int         dumpin;
     char      *qdisk;
-    char      *incrname;
+    char      *incrname = NULL;
+    char      *mapname = NULL;
     char       line[32768];
-    amregex_t *rp;
     off_t      dump_size = -1;
-    char      *type;
-    char       startchr;
     int        dataf = 1;
     int        indexf = 4;
     int        outf;
@@ -1375,9 +1607,11 @@ amgtar_backup(
     char      *errmsg = NULL;
     amwait_t   wait_status;
     GPtrArray *argv_ptr;
+    GPtrArray *streams = NULL;
     int        tarpid;
-    char      *file_exclude;
-    char      *file_include;
+    char      *dirname;
+    char      *file_exclude = NULL;
+    char      *file_include = NULL;
     char      *option;
     char      *gnutar_realpath = NULL;
     messagelist_t mlist = NULL;
@@ -1439,12 +1673,13 @@ amgtar_backup(
     }
     qdisk = quote_string(argument->dle.disk);
 
-    incrname = amgtar_get_incrname(argument,
-				   GPOINTER_TO_INT(argument->level->data),
-				   mesgstream, CMD_BACKUP);
-    argv_ptr = amgtar_build_argv(gnutar_realpath,
-				 argument, incrname, &file_exclude,
-				 &file_include, CMD_BACKUP, &mlist);
+    if (gnutar_target) {
+	dirname = gnutar_target;
+    } else {
+	dirname = argument->dle.device;
+    }
+    amgtar_build_exinclude(&argument->dle, NULL, &file_exclude,
+			   NULL, &file_include, dirname, &mlist);
     for (mesglist = mlist; mesglist != NULL; mesglist = mesglist->next){
 	message_t *message = mesglist->data;
 	if (message_get_severity(message) <= MSG_INFO) {
@@ -1456,18 +1691,37 @@ amgtar_backup(
     }
     g_slist_free(mlist);
 
-    tarpid = pipespawnv(gnutar_realpath, STDIN_PIPE|STDERR_PIPE, 1,
-			&dumpin, &dataf, &outf, (char **)argv_ptr->pdata);
-    /* close the write ends of the pipes */
-
-    aclose(dumpin);
-    aclose(dataf);
     if (argument->dle.create_index) {
 	indexstream = fdopen(indexf, "w");
 	if (!indexstream) {
 	    error(_("error indexstream(%d): %s\n"), indexf, strerror(errno));
 	}
     }
+
+    if (amgtar_streams > 1) {
+	streams = amgtar_split_streams(argument,
+				GPOINTER_TO_INT(argument->level->data),
+				file_include, mesgstream, CMD_BACKUP,
+				&mapname);
+	dump_size = amgtar_backup_streams(argument, gnutar_realpath, streams,
+					  file_exclude, indexstream, &errmsg);
+	aclose(dataf);
+	goto backup_done;
+    }
+
+    incrname = amgtar_get_incrname(argument,
+				   GPOINTER_TO_INT(argument->level->data),
+				   -1, mesgstream, CMD_BACKUP);
+    argv_ptr = amgtar_build_argv(gnutar_realpath,
+				 argument, incrname, file_exclude,
+				 file_include, CMD_BACKUP);
+
+    tarpid = pipespawnv(gnutar_realpath, STDIN_PIPE|STDERR_PIPE, 1,
+			&dumpin, &dataf, &outf, (char **)argv_ptr->pdata);
+    /* close the write ends of the pipes */
+
+    aclose(dumpin);
+    aclose(dataf);
     outstream = fdopen(outf, "r");
     if (!outstream) {
 	error(_("error outstream(%d): %s\n"), outf, strerror(errno));
@@ -1478,68 +1732,7 @@ amgtar_backup(
 	    /* remove trailling \n */
 	    line[strlen(line)-1] = '\0';
 	}
-	if (strncmp(line, "block ", 6) == 0) { /* filename */
-	    off_t block_no = g_ascii_strtoull(line+6, NULL, 0);
-	    char *filename = strchr(line, ':');
-	    if (filename) {
-		filename += 2;
-		if (*filename == '.' && *(filename+1) == '/') {
-		    if (argument->dle.create_index) {
-			fprintf(indexstream, "%s\n", &filename[1]); /* remove . */
-		    }
-		    if (argument->state_stream != -1) {
-			char *s = g_strdup_printf("%lld %s\n",
-					 (long long)block_no, &filename[1]);
-			guint a = full_write(argument->state_stream, s, strlen(s));
-			if (a < strlen(s)) {
-			    g_debug("Failed to write to the state stream: %s",
-				    strerror(errno));
-			}
-			g_free(s);
-		    } else if (argument->amfeatures &&
-			       am_has_feature(argument->amfeatures,
-					      fe_sendbackup_state)) {
-			fprintf(mesgstream, "sendbackup: state %lld %s\n",
-			        (long long)block_no, &filename[1]);
-		    }
-		}
-	    }
-	} else { /* message */
-	    for(rp = re_table; rp->regex != NULL; rp++) {
-		if(match(rp->regex, line)) {
-		    break;
-		}
-	    }
-	    if(rp->typ == DMP_SIZE) {
-		dump_size = (off_t)((the_num(line, rp->field)* rp->scale+1023.0)/1024.0);
-	    }
-	    switch(rp->typ) {
-	    case DMP_NORMAL:
-		type = "normal";
-		startchr = '|';
-		break;
-	    case DMP_IGNORE:
-		continue;
-	    case DMP_STRANGE:
-		type = "strange";
-		startchr = '?';
-		break;
-	    case DMP_SIZE:
-		type = "size";
-		startchr = '|';
-		break;
-	    case DMP_ERROR:
-		type = "error";
-		startchr = '?';
-		break;
-	    default:
-		type = "unknown";
-		startchr = '!';
-		break;
-	    }
-	    dbprintf("%3d: %7s(%c): %s\n", rp->srcline, type, startchr, line);
-	    fprintf(mesgstream,"%c %s\n", startchr, line);
-        }
+	amgtar_backup_line(argument, line, indexstream, TRUE, &dump_size);
     }
     fclose(outstream);
 
@@ -1560,6 +1753,9 @@ amgtar_backup(
     }
     dbprintf(_("after %s %s wait\n"), gnutar_realpath, qdisk);
     dbprintf(_("amgtar: %s: pid %ld\n"), gnutar_realpath, (long)tarpid);
+    g_ptr_array_free_full(argv_ptr);
+
+backup_done:
     if (errmsg) {
 	dbprintf("%s", errmsg);
 	g_fprintf(mesgstream, "sendbackup: error [%s]\n", errmsg);
@@ -1602,27 +1798,20 @@ amgtar_backup(
 	}
     }
 
-    if (strlen(incrname) > 4) {
-	if (argument->dle.record && !errmsg) {
-	    char *nodotnew = g_strdup(incrname);
-	    nodotnew[strlen(nodotnew)-4] = '\0';
-	    if (rename(incrname, nodotnew)) {
-		dbprintf(_("%s: warning [renaming %s to %s: %s]\n"),
-			 get_pname(), incrname, nodotnew, strerror(errno));
-		g_fprintf(mesgstream, _("? warning [renaming %s to %s: %s]\n"),
-			  incrname, nodotnew, strerror(errno));
-	    }
-	    amfree(nodotnew);
-	} else {
-	    if (unlink(incrname) == -1) {
-		dbprintf(_("%s: warning [unlink %s: %s]\n"),
-			 get_pname(), incrname, strerror(errno));
-		g_fprintf(mesgstream, _("? warning [unlink %s: %s]\n"),
-			  incrname, strerror(errno));
-	    }
-	}
+    if (incrname) {
+	amgtar_finish_incrname(argument, incrname, errmsg);
     }
+    if (streams) {
+	guint i;
 
+	for (i = 0; i < streams->len; i++) {
+	    amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+	    if (stream->incrname)
+		amgtar_finish_incrname(argument, stream->incrname, errmsg);
+	}
+	amgtar_finish_incrname(argument, mapname, errmsg);
+	amgtar_free_streams(argument, streams);
+    }
 
     if (cmdin) {
 	fclose(cmdin);
@@ -1642,10 +1831,10 @@ amgtar_backup(
     amfree(file_exclude);
     amfree(file_include);
     amfree(incrname);
+    amfree(mapname);
     amfree(qdisk);
     amfree(errmsg);
     amfree(gnutar_realpath);
-    g_ptr_array_free_full(argv_ptr);
 }
 
 static void
@@ -1886,7 +2075,9 @@ amgtar_restore(
 		    dar_fd, strerror(save_errno));
 	   exit(1);
 	}
-	if (argument->recover_dump_state_file &&
+	/* the block numbers of a multi-stream dump are those of each stream */
+	if (amgtar_streams == 1 &&
+	    argument->recover_dump_state_file &&
 		   include_array->len > 0) {
 	    char  line[32768];
 	    FILE *recover_state_file = fopen(argument->recover_dump_state_file,
@@ -1964,38 +2155,43 @@ amgtar_restore(
 
     debug_executing(argv_ptr);
 
-    tarpid = fork();
-    switch (tarpid) {
-    case -1: error(_("%s: fork returned: %s"), get_pname(), strerror(errno));
-    case 0:
-	env = safe_env();
-	become_root();
-	execve(gnutar_realpath, (char **)argv_ptr->pdata, env);
-	free_env(env);
-	e = strerror(errno);
-	error(_("error [exec %s: %s]"), gnutar_realpath, e);
-	break;
-    default: break;
-    }
+    if (amgtar_stdin_is_archive()) {
+	errmsg = amgtar_extract_streams(gnutar_realpath, argv_ptr, TRUE, FALSE);
+	exit_status = errmsg ? 1 : 0;
+    } else {
+	tarpid = fork();
+	switch (tarpid) {
+	case -1: error(_("%s: fork returned: %s"), get_pname(), strerror(errno));
+	case 0:
+	    env = safe_env();
+	    become_root();
+	    execve(gnutar_realpath, (char **)argv_ptr->pdata, env);
+	    free_env(env);
+	    e = strerror(errno);
+	    error(_("error [exec %s: %s]"), gnutar_realpath, e);
+	    break;
+	default: break;
+	}
 
-    waitpid(tarpid, &wait_status, 0);
-    if (WIFSIGNALED(wait_status)) {
-	errmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
-                                 gnutar_realpath, WTERMSIG(wait_status), dbfn());
-	exit_status = 1;
-    } else if (WIFEXITED(wait_status)) {
-	if (WEXITSTATUS(wait_status) > 0) {
-	    errmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
-				     gnutar_realpath, WEXITSTATUS(wait_status), dbfn());
+	waitpid(tarpid, &wait_status, 0);
+	if (WIFSIGNALED(wait_status)) {
+	    errmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
+				     gnutar_realpath, WTERMSIG(wait_status), dbfn());
 	    exit_status = 1;
+	} else if (WIFEXITED(wait_status)) {
+	    if (WEXITSTATUS(wait_status) > 0) {
+		errmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
+					 gnutar_realpath, WEXITSTATUS(wait_status), dbfn());
+		exit_status = 1;
+	    } else {
+		/* Normal exit */
+		exit_status = 0;
+	    }
 	} else {
-	    /* Normal exit */
-	    exit_status = 0;
+	    errmsg = g_strdup_printf(_("%s got bad exit: see %s"),
+				     gnutar_realpath, dbfn());
+	    exit_status = 1;
 	}
-    } else {
-	errmsg = g_strdup_printf(_("%s got bad exit: see %s"),
-				 gnutar_realpath, dbfn());
-	exit_status = 1;
     }
     if (errmsg) {
 	dbprintf("%s", errmsg);
@@ -2039,6 +2235,17 @@ amgtar_validate(
     g_ptr_array_add(argv_ptr, NULL);
 
     debug_executing(argv_ptr);
+    if (amgtar_stdin_is_archive()) {
+	char *errmsg = amgtar_extract_streams(cmd, argv_ptr, FALSE, FALSE);
+	if (errmsg) {
+	    dbprintf("%s\n", errmsg);
+	    fprintf(stderr, "%s\n", errmsg);
+	    amgtar_exit_value = 1;
+	    amfree(errmsg);
+	}
+	amfree(cmd);
+	return;
+    }
     env = safe_env();
     execve(cmd, (char **)argv_ptr->pdata, env);
     e = strerror(errno);
@@ -2082,41 +2289,45 @@ amgtar_index(
     g_ptr_array_add(argv_ptr, g_strdup("-"));
     g_ptr_array_add(argv_ptr, NULL);
 
-    tarpid = pipespawnv(cmd, STDOUT_PIPE, 0,
-			&datain, &indexf, &errf, (char **)argv_ptr->pdata);
-    aclose(datain);
-
-    indexstream = fdopen(indexf, "r");
-    if (!indexstream) {
-	error(_("error indexstream(%d): %s\n"), indexf, strerror(errno));
-    }
+    if (amgtar_stdin_is_archive()) {
+	errmsg = amgtar_extract_streams(cmd, argv_ptr, FALSE, TRUE);
+    } else {
+	tarpid = pipespawnv(cmd, STDOUT_PIPE, 0,
+			    &datain, &indexf, &errf, (char **)argv_ptr->pdata);
+	aclose(datain);
 
-    while (fgets(line, sizeof(line), indexstream) != NULL) {
-	if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
-	    /* remove trailling \n */
-	    line[strlen(line)-1] = '\0';
+	indexstream = fdopen(indexf, "r");
+	if (!indexstream) {
+	    error(_("error indexstream(%d): %s\n"), indexf, strerror(errno));
 	}
-	if (*line == '.' && *(line+1) == '/') { /* filename */
-	    fprintf(stdout, "%s\n", &line[1]); /* remove . */
+
+	while (fgets(line, sizeof(line), indexstream) != NULL) {
+	    if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
+		/* remove trailling \n */
+		line[strlen(line)-1] = '\0';
+	    }
+	    if (*line == '.' && *(line+1) == '/') { /* filename */
+		fprintf(stdout, "%s\n", &line[1]); /* remove . */
+	    }
 	}
-    }
-    fclose(indexstream);
-    waitpid(tarpid, &wait_status, 0);
-    if (WIFSIGNALED(wait_status)) {
-	errmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
-				 cmd, WTERMSIG(wait_status), dbfn());
-    } else if (WIFEXITED(wait_status)) {
-	if (exit_value[WEXITSTATUS(wait_status)] == 1) {
-	    errmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
-				     cmd, WEXITSTATUS(wait_status), dbfn());
+	fclose(indexstream);
+	waitpid(tarpid, &wait_status, 0);
+	if (WIFSIGNALED(wait_status)) {
+	    errmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
+				     cmd, WTERMSIG(wait_status), dbfn());
+	} else if (WIFEXITED(wait_status)) {
+	    if (exit_value[WEXITSTATUS(wait_status)] == 1) {
+		errmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
+					 cmd, WEXITSTATUS(wait_status), dbfn());
+	    } else {
+		/* Normal exit */
+	    }
 	} else {
-	    /* Normal exit */
+	    errmsg = g_strdup_printf(_("%s got bad exit: see %s"),
+				     cmd, dbfn());
 	}
-    } else {
-	errmsg = g_strdup_printf(_("%s got bad exit: see %s"),
-				 cmd, dbfn());
+	dbprintf(_("amgtar: %s: pid %ld\n"), cmd, (long)tarpid);
     }
-    dbprintf(_("amgtar: %s: pid %ld\n"), cmd, (long)tarpid);
     if (errmsg) {
 	dbprintf("%s", errmsg);
 	fprintf(stderr, "error [%s]\n", errmsg);
@@ -2167,6 +2378,7 @@ static char *
 amgtar_get_incrname(
     application_argument_t *argument,
     int                     level,
+    int                     stream,
     FILE                   *mesgstream,
     int                     command)
 {
@@ -2183,11 +2395,16 @@ amgtar_get_incrname(
 	int baselevel;
 	char *sdisk = sanitise_filename(argument->dle.disk);
 
-	basename = g_strjoin(NULL, gnutar_listdir,
-			     "/",
-			     argument->host,
-			     sdisk,
-			     NULL);
+	if (stream >= 0) {
+	    basename = g_strdup_printf("%s/%s%s-stream%d", gnutar_listdir,
+				       argument->host, sdisk, stream);
+	} else {
+	    basename = g_strjoin(NULL, gnutar_listdir,
+				 "/",
+				 argument->host,
+				 sdisk,
+				 NULL);
+	}
 	amfree(sdisk);
 
 	snprintf(number, sizeof(number), "%d", level);
@@ -2363,13 +2580,10 @@ GPtrArray *amgtar_build_argv(
     char *gnutar_realpath,
     application_argument_t *argument,
     char  *incrname,
-    char **file_exclude,
-    char **file_include,
-    int    command,
-    messagelist_t *mlist)
+    char  *file_exclude,
+    char  *file_include,
+    int    command)
 {
-    int    nb_exclude;
-    int    nb_include;
     char  *dirname;
     char   tmppath[PATH_MAX];
     GPtrArray *argv_ptr = g_ptr_array_new();
@@ -2383,10 +2597,6 @@ GPtrArray *amgtar_build_argv(
 	dirname = argument->dle.device;
     }
 
-    amgtar_build_exinclude(&argument->dle,
-			   &nb_exclude, file_exclude,
-			   &nb_include, file_include, dirname, mlist);
-
     g_ptr_array_add(argv_ptr, g_strdup(gnutar_realpath));
 
     g_ptr_array_add(argv_ptr, g_strdup("--create"));
@@ -2468,14 +2678,14 @@ GPtrArray *amgtar_build_argv(
 	g_ptr_array_add(argv_ptr, g_strdup((char *)copt->data));
     }
 
-    if (*file_exclude) {
+    if (file_exclude) {
 	g_ptr_array_add(argv_ptr, g_strdup("--exclude-from"));
-	g_ptr_array_add(argv_ptr, g_strdup(*file_exclude));
+	g_ptr_array_add(argv_ptr, g_strdup(file_exclude));
     }
 
-    if (*file_include) {
+    if (file_include) {
 	g_ptr_array_add(argv_ptr, g_strdup("--files-from"));
-	g_ptr_array_add(argv_ptr, g_strdup(*file_include));
+	g_ptr_array_add(argv_ptr, g_strdup(file_include));
     }
     else {
 	g_ptr_array_add(argv_ptr, g_strdup("."));
@@ -2485,3 +2695,923 @@ GPtrArray *amgtar_build_argv(
     return(argv_ptr);
 }
 
+
+/*
+ * Multiple streams
+ */
+
+/* an entry of the DLE, while it is assigned to a stream */
+typedef struct amgtar_unit_s {
+    char  *name;	/* as given to gnutar */
+    char  *path;
+    off_t  size;	/* estimated size in bytes */
+    int    stream;	/* or -1 if not assigned yet */
+} amgtar_unit_t;
+
+static GMutex *amgtar_stream_mutex = NULL;
+
+static void
+amgtar_stream_error(
+    FILE *mesgstream,
+    int   command,
+    char *errmsg)
+{
+    dbprintf("%s\n", errmsg);
+    if (command == CMD_ESTIMATE) {
+	fprintf(mesgstream, "ERROR %s\n", errmsg);
+    } else {
+	fprintf(mesgstream, "sendbackup: error [%s]\n", errmsg);
+    }
+    exit(1);
+}
+
+/* Quote a top-level filename the way gnutar reads it from --files-from */
+static char *
+amgtar_quote_member(
+    char *name)
+{
+    GString *strbuf = g_string_sized_new(strlen(name) + 3);
+    char    *s;
+
+    g_string_append(strbuf, "./");
+    for (s = name; *s != '\0'; s++) {
+	if (!gnutar_no_unquote && *s == '\\') {
+	    g_string_append(strbuf, "\\\\");
+	} else if (!gnutar_no_unquote && *s == '\n') {
+	    g_string_append(strbuf, "\\n");
+	} else {
+	    g_string_append_c(strbuf, *s);
+	}
+    }
+    return g_string_free(strbuf, FALSE);
+}
+
+/* Add up the size of everything under path, staying on the device dev if
+ * ONE-FILE-SYSTEM is set. */
+static off_t
+amgtar_tree_size(
+    char  *path,
+    dev_t  dev)
+{
+    struct stat    stat_buf;
+    DIR           *dir;
+    struct dirent *entry;
+    off_t          size;
+
+    if (lstat(path, &stat_buf) != 0)
+	return 0;
+    size = stat_buf.st_size;
+    if (!S_ISDIR(stat_buf.st_mode) ||
+	(gnutar_onefilesystem && stat_buf.st_dev != dev))
+	return size;
+
+    if ((dir = opendir(path)) == NULL)
+	return size;
+    while ((entry = readdir(dir)) != NULL) {
+	char *subpath;
+
+	if (is_dot_or_dotdot(entry->d_name))
+	    continue;
+	subpath = g_strjoin(NULL, path, "/", entry->d_name, NULL);
+	size += amgtar_tree_size(subpath, dev);
+	g_free(subpath);
+    }
+    closedir(dir);
+
+    return size;
+}
+
+static int
+amgtar_unit_cmp(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const amgtar_unit_t *unit_a = *(amgtar_unit_t * const *)a;
+    const amgtar_unit_t *unit_b = *(amgtar_unit_t * const *)b;
+
+    if (unit_a->size != unit_b->size)
+	return unit_a->size > unit_b->size ? -1 : 1;
+    return strcmp(unit_a->name, unit_b->name);
+}
+
+/* Share the entries of the DLE among amgtar_streams streams.  The entries are
+ * the lines of file_include if there is one, or else the top-level entries of
+ * the directory.
+ *
+ * An entry stays in the stream it had in the stream map of the previous level,
+ * since the listed-incremental files of that stream are the ones that know
+ * about it.  The others, and all of them at level 0, go to the least loaded
+ * stream, the largest first.  If mapname is not NULL, the map for this level
+ * is written to a new ".new" file, whose name is returned there.
+ *
+ * Each stream gets an include file and a listed-incremental file, unless no
+ * entry was given to it.
+ */
+static GPtrArray *
+amgtar_split_streams(
+    application_argument_t *argument,
+    int    level,
+    char  *file_include,
+    FILE  *mesgstream,
+    int    command,
+    char **mapname)
+{
+    GPtrArray  *streams = g_ptr_array_new();
+    GPtrArray  *units = g_ptr_array_new();
+    GHashTable *map;
+    char       *dirname;
+    char       *sdisk;
+    char       *basename;
+    char        line[32768];
+    off_t      *loads;
+    dev_t       dev = 0;
+    struct stat stat_buf;
+    int         set_root;
+    int         baselevel;
+    FILE       *mapfile = NULL;
+    guint       i;
+
+    if (gnutar_target) {
+	dirname = gnutar_target;
+    } else {
+	dirname = argument->dle.device;
+    }
+    sdisk = sanitise_filename(argument->dle.disk);
+    basename = g_strdup_printf("%s/%s%s-streams", gnutar_listdir,
+			       argument->host, sdisk);
+    map = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    /* the stream map of the previous level */
+    for (baselevel = level - 1; baselevel >= 0 && !mapfile; baselevel--) {
+	char *inputname = g_strdup_printf("%s_%d", basename, baselevel);
+	int   nb_streams = 0;
+
+	mapfile = fopen(inputname, "r");
+	if (!mapfile) {
+	    g_free(inputname);
+	    continue;
+	}
+	if (fgets(line, sizeof(line), mapfile) == NULL ||
+	    sscanf(line, "STREAMS %d", &nb_streams) != 1 ||
+	    nb_streams != amgtar_streams) {
+	    dbprintf(_("ignoring %s, not written for %d streams\n"),
+		     inputname, amgtar_streams);
+	} else {
+	    while (fgets(line, sizeof(line), mapfile) != NULL) {
+		amgtar_unit_t *unit;
+		int            stream;
+		long long      size;
+		int            n = 0;
+
+		if (strlen(line) > 0 && line[strlen(line)-1] == '\n')
+		    line[strlen(line)-1] = '\0';
+		if (sscanf(line, "%d %lld %n", &stream, &size, &n) < 2 ||
+		    n == 0 || stream < 0 || stream >= amgtar_streams)
+		    continue;
+		unit = g_new0(amgtar_unit_t, 1);
+		unit->stream = stream;
+		unit->size = size;
+		g_hash_table_insert(map, g_strdup(line + n), unit);
+	    }
+	}
+	fclose(mapfile);
+	g_free(inputname);
+    }
+
+    set_root = set_root_privs(1);
+    if (lstat(dirname, &stat_buf) == 0)
+	dev = stat_buf.st_dev;
+
+    /* the entries to share */
+    if (file_include) {
+	FILE *include = fopen(file_include, "r");
+
+	if (!include) {
+	    amgtar_stream_error(mesgstream, command,
+		g_strdup_printf(_("Can't open include file '%s': %s"),
+				file_include, strerror(errno)));
+	}
+	while (fgets(line, sizeof(line), include) != NULL) {
+	    amgtar_unit_t *unit;
+
+	    if (strlen(line) > 0 && line[strlen(line)-1] == '\n')
+		line[strlen(line)-1] = '\0';
+	    if (*line == '\0')
+		continue;
+	    unit = g_new0(amgtar_unit_t, 1);
+	    unit->name = g_strdup(line);
+	    if (strncmp(line, "./", 2) == 0) {
+		unit->path = g_strjoin(NULL, dirname, "/", line + 2, NULL);
+	    } else {
+		unit->path = g_strjoin(NULL, dirname, "/", line, NULL);
+	    }
+	    g_ptr_array_add(units, unit);
+	}
+	fclose(include);
+    } else {
+	DIR           *dir = opendir(dirname);
+	struct dirent *entry;
+
+	if (!dir) {
+	    amgtar_stream_error(mesgstream, command,
+		g_strdup_printf(_("Can't open directory '%s': %s"),
+				dirname, strerror(errno)));
+	}
+	while ((entry = readdir(dir)) != NULL) {
+	    amgtar_unit_t *unit;
+
+	    if (is_dot_or_dotdot(entry->d_name))
+		continue;
+	    unit = g_new0(amgtar_unit_t, 1);
+	    unit->name = amgtar_quote_member(entry->d_name);
+	    unit->path = g_strjoin(NULL, dirname, "/", entry->d_name, NULL);
+	    g_ptr_array_add(units, unit);
+	}
+	closedir(dir);
+    }
+
+    for (i = 0; i < units->len; i++) {
+	amgtar_unit_t *unit = g_ptr_array_index(units, i);
+	amgtar_unit_t *previous = g_hash_table_lookup(map, unit->name);
+
+	if (previous) {
+	    unit->stream = previous->stream;
+	    unit->size = previous->size;
+	} else {
+	    unit->stream = -1;
+	    unit->size = amgtar_tree_size(unit->path, dev);
+	}
+	amfree(unit->path);
+    }
+    if (set_root)
+	set_root_privs(0);
+    g_hash_table_destroy(map);
+
+    loads = g_new0(off_t, amgtar_streams);
+    for (i = 0; i < units->len; i++) {
+	amgtar_unit_t *unit = g_ptr_array_index(units, i);
+	if (unit->stream >= 0)
+	    loads[unit->stream] += unit->size;
+    }
+    g_ptr_array_sort(units, amgtar_unit_cmp);
+    for (i = 0; i < units->len; i++) {
+	amgtar_unit_t *unit = g_ptr_array_index(units, i);
+	int            stream;
+
+	if (unit->stream >= 0)
+	    continue;
+	unit->stream = 0;
+	for (stream = 1; stream < amgtar_streams; stream++) {
+	    if (loads[stream] < loads[unit->stream])
+		unit->stream = stream;
+	}
+	loads[unit->stream] += unit->size;
+    }
+
+    if (mapname) {
+	*mapname = g_strdup_printf("%s_%d.new", basename, level);
+	mapfile = fopen(*mapname, "w");
+	if (!mapfile) {
+	    amgtar_stream_error(mesgstream, command,
+		g_strdup_printf(_("error opening %s: %s"),
+				*mapname, strerror(errno)));
+	}
+	fprintf(mapfile, "STREAMS %d\n", amgtar_streams);
+	for (i = 0; i < units->len; i++) {
+	    amgtar_unit_t *unit = g_ptr_array_index(units, i);
+	    fprintf(mapfile, "%d %lld %s\n", unit->stream,
+		    (long long)unit->size, unit->name);
+	}
+	if (fclose(mapfile) != 0) {
+	    amgtar_stream_error(mesgstream, command,
+		g_strdup_printf(_("writing to %s: %s"),
+				*mapname, strerror(errno)));
+	}
+    }
+
+    for (i = 0; i < (guint)amgtar_streams; i++) {
+	amgtar_stream_t *stream = g_new0(amgtar_stream_t, 1);
+
+	stream->num = i;
+	stream->members = g_ptr_array_new();
+	stream->size = loads[i];
+	stream->tarpid = -1;
+	stream->dataf = -1;
+	stream->dump_size = -1;
+	g_ptr_array_add(streams, stream);
+    }
+    for (i = 0; i < units->len; i++) {
+	amgtar_unit_t   *unit = g_ptr_array_index(units, i);
+	amgtar_stream_t *stream = g_ptr_array_index(streams, unit->stream);
+
+	g_ptr_array_add(stream->members, unit->name);
+	g_free(unit);
+    }
+    g_ptr_array_free(units, TRUE);
+    g_free(loads);
+
+    for (i = 0; i < streams->len; i++) {
+	amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+	FILE            *include;
+	guint            j;
+
+	dbprintf(_("stream %d: %d entries, %lld bytes\n"), stream->num,
+		 stream->members->len, (long long)stream->size);
+	if (stream->members->len == 0)
+	    continue;
+
+	stream->file_include = g_strdup_printf("%s/amgtar.%s.%ld.stream%d.include",
+					       AMANDA_TMPDIR, sdisk,
+					       (long)getpid(), stream->num);
+	include = fopen(stream->file_include, "w");
+	if (!include) {
+	    amgtar_stream_error(mesgstream, command,
+		g_strdup_printf(_("error opening %s: %s"),
+				stream->file_include, strerror(errno)));
+	}
+	for (j = 0; j < stream->members->len; j++) {
+	    fprintf(include, "%s\n",
+		    (char *)g_ptr_array_index(stream->members, j));
+	}
+	if (fclose(include) != 0) {
+	    amgtar_stream_error(mesgstream, command,
+		g_strdup_printf(_("writing to %s: %s"),
+				stream->file_include, strerror(errno)));
+	}
+
+	stream->incrname = amgtar_get_incrname(argument, level, stream->num,
+					       mesgstream, command);
+    }
+
+    amfree(basename);
+    amfree(sdisk);
+    return streams;
+}
+
+static void
+amgtar_free_streams(
+    application_argument_t *argument,
+    GPtrArray *streams)
+{
+    guint i;
+
+    for (i = 0; i < streams->len; i++) {
+	amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+
+	if (stream->file_include && argument->verbose == 0)
+	    unlink(stream->file_include);
+	g_ptr_array_free_full(stream->members);
+	amfree(stream->file_include);
+	amfree(stream->incrname);
+	g_free(stream);
+    }
+    g_ptr_array_free(streams, TRUE);
+}
+
+static void
+amgtar_amar_error(
+    char   **errmsg,
+    GError **error)
+{
+    if (!*errmsg) {
+	*errmsg = g_strdup_printf("amar: %s",
+			*error ? (*error)->message : "unknown error");
+    }
+    g_clear_error(error);
+}
+
+static gpointer
+amgtar_stream_thread(
+    gpointer data)
+{
+    amgtar_stream_t *stream = data;
+    char             line[32768];
+
+    while (fgets(line, sizeof(line), stream->outstream) != NULL) {
+	if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
+	    /* remove trailling \n */
+	    line[strlen(line)-1] = '\0';
+	}
+	g_mutex_lock(amgtar_stream_mutex);
+	amgtar_backup_line(stream->argument, line, stream->indexstream,
+			   FALSE, &stream->dump_size);
+	g_mutex_unlock(amgtar_stream_mutex);
+    }
+    fclose(stream->outstream);
+    stream->outstream = NULL;
+
+    return NULL;
+}
+
+/* Run one gnutar for each stream that has entries, and write their outputs
+ * as the files of an amanda archive on the data stream.  Returns the size of
+ * the dump in KB, or -1 if a gnutar did not give it. */
+static off_t
+amgtar_backup_streams(
+    application_argument_t *argument,
+    char       *gnutar_realpath,
+    GPtrArray  *streams,
+    char       *file_exclude,
+    FILE       *indexstream,
+    char      **errmsg)
+{
+    amar_t  *archive;
+    GError  *error = NULL;
+    off_t    dump_size = 0;
+    guint    i;
+
+    archive = amar_new(1, O_WRONLY, &error);
+    if (!archive) {
+	amgtar_amar_error(errmsg, &error);
+	return -1;
+    }
+    amgtar_stream_mutex = g_mutex_new();
+
+    /* start every gnutar before any thread */
+    for (i = 0; i < streams->len; i++) {
+	amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+	GPtrArray       *argv_ptr;
+	int              dumpin;
+	int              outf;
+
+	if (!stream->incrname)
+	    continue;
+	argv_ptr = amgtar_build_argv(gnutar_realpath,
+				     argument, stream->incrname, file_exclude,
+				     stream->file_include, CMD_BACKUP);
+	stream->tarpid = pipespawnv(gnutar_realpath,
+				    STDIN_PIPE|STDOUT_PIPE|STDERR_PIPE, 1,
+				    &dumpin, &stream->dataf, &outf,
+				    (char **)argv_ptr->pdata);
+	aclose(dumpin);
+	g_ptr_array_free_full(argv_ptr);
+
+	stream->outstream = fdopen(outf, "r");
+	if (!stream->outstream) {
+	    error(_("error outstream(%d): %s\n"), outf, strerror(errno));
+	}
+	stream->argument = argument;
+	stream->indexstream = indexstream;
+    }
+
+    for (i = 0; i < streams->len; i++) {
+	amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+	char            *filename;
+
+	if (stream->tarpid == -1)
+	    continue;
+	filename = g_strdup_printf("stream-%d", stream->num);
+	stream->file = amar_new_file(archive, filename, 0, NULL, &error);
+	g_free(filename);
+	if (stream->file) {
+	    amar_attr_t *attr = amar_new_attr(stream->file,
+					      AMAR_ATTR_GENERIC_DATA, &error);
+	    /* the thread closes dataf when gnutar is done */
+	    amar_attr_add_data_fd_in_thread(attr, stream->dataf, TRUE, &error);
+	} else {
+	    amgtar_amar_error(errmsg, &error);
+	    aclose(stream->dataf);
+	}
+	stream->thread = g_thread_create(amgtar_stream_thread, stream,
+					 TRUE, NULL);
+    }
+
+    for (i = 0; i < streams->len; i++) {
+	amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+
+	if (stream->tarpid == -1)
+	    continue;
+	if (stream->file && !amar_file_close(stream->file, &error))
+	    amgtar_amar_error(errmsg, &error);
+	g_thread_join(stream->thread);
+    }
+    if (!amar_close(archive, &error))
+	amgtar_amar_error(errmsg, &error);
+    g_mutex_free(amgtar_stream_mutex);
+    amgtar_stream_mutex = NULL;
+
+    for (i = 0; i < streams->len; i++) {
+	amgtar_stream_t *stream = g_ptr_array_index(streams, i);
+	amwait_t         wait_status;
+	char            *tarmsg = NULL;
+
+	if (stream->tarpid == -1)
+	    continue;
+	waitpid(stream->tarpid, &wait_status, 0);
+	if (WIFSIGNALED(wait_status)) {
+	    tarmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
+				gnutar_realpath, WTERMSIG(wait_status), dbfn());
+	} else if (WIFEXITED(wait_status)) {
+	    if (exit_value[WEXITSTATUS(wait_status)] == 1) {
+		tarmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
+				gnutar_realpath, WEXITSTATUS(wait_status), dbfn());
+	    } else {
+		/* Normal exit */
+	    }
+	} else {
+	    tarmsg = g_strdup_printf(_("%s got bad exit: see %s"),
+				gnutar_realpath, dbfn());
+	}
+	dbprintf(_("amgtar: %s: stream %d: pid %ld\n"), gnutar_realpath,
+		 stream->num, (long)stream->tarpid);
+	if (tarmsg) {
+	    dbprintf("%s\n", tarmsg);
+	    if (!*errmsg)
+		*errmsg = tarmsg;
+	    else
+		g_free(tarmsg);
+	}
+
+	if (stream->dump_size < 0 || dump_size < 0) {
+	    dump_size = -1;
+	} else {
+	    dump_size += stream->dump_size;
+	}
+    }
+
+    return dump_size;
+}
+
+typedef struct amgtar_extract_s {
+    char      *cmd;
+    GPtrArray *argv_ptr;
+    gboolean   need_root;
+    gboolean   index;
+    GPtrArray *files;
+    char      *errmsg;
+} amgtar_extract_t;
+
+/* a stream of the archive, and the gnutar it is given to */
+typedef struct amgtar_extract_file_s {
+    pid_t      tarpid;
+    int        fd;
+    FILE      *outstream;
+    GThread   *thread;
+    FILE      *errstream;
+    GThread   *errthread;
+    GPtrArray *not_found;	/* "Not found in archive" messages */
+    int        nb_errors;	/* any other message */
+} amgtar_extract_file_t;
+
+#define AMGTAR_NOT_FOUND ": Not found in archive"
+#define AMGTAR_EXITING ": Exiting with failure status due to previous errors"
+
+static gpointer
+amgtar_extract_index_thread(
+    gpointer data)
+{
+    amgtar_extract_file_t *efile = data;
+    char                   line[32768];
+
+    while (fgets(line, sizeof(line), efile->outstream) != NULL) {
+	if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
+	    /* remove trailling \n */
+	    line[strlen(line)-1] = '\0';
+	}
+	if (*line == '.' && *(line+1) == '/') { /* filename */
+	    g_mutex_lock(amgtar_stream_mutex);
+	    fprintf(stdout, "%s\n", &line[1]); /* remove . */
+	    g_mutex_unlock(amgtar_stream_mutex);
+	}
+    }
+    fclose(efile->outstream);
+    efile->outstream = NULL;
+
+    return NULL;
+}
+
+/* The members to extract are given to every gnutar, but each is in only one
+ * of the streams: keep the "Not found in archive" messages, they are an
+ * error only if every stream gives them, and pass the others along. */
+static gpointer
+amgtar_extract_stderr_thread(
+    gpointer data)
+{
+    amgtar_extract_file_t *efile = data;
+    char                   line[32768];
+
+    while (fgets(line, sizeof(line), efile->errstream) != NULL) {
+	if (strlen(line) > 0 && line[strlen(line)-1] == '\n') {
+	    /* remove trailling \n */
+	    line[strlen(line)-1] = '\0';
+	}
+	if (g_str_has_suffix(line, AMGTAR_NOT_FOUND)) {
+	    g_ptr_array_add(efile->not_found, g_strdup(line));
+	} else if (!g_str_has_suffix(line, AMGTAR_EXITING)) {
+	    efile->nb_errors++;
+	    g_mutex_lock(amgtar_stream_mutex);
+	    fprintf(stderr, "%s\n", line);
+	    g_mutex_unlock(amgtar_stream_mutex);
+	}
+    }
+    fclose(efile->errstream);
+    efile->errstream = NULL;
+
+    return NULL;
+}
+
+static gboolean
+amgtar_extract_file_start(
+    gpointer  user_data,
+    guint16   filenum G_GNUC_UNUSED,
+    gpointer  filename_buf G_GNUC_UNUSED,
+    gsize     filename_len G_GNUC_UNUSED,
+    gboolean *ignore,
+    gpointer *file_data)
+{
+    amgtar_extract_t      *extract = user_data;
+    amgtar_extract_file_t *efile = g_new0(amgtar_extract_file_t, 1);
+    int                    datapipe[2];
+    int                    outpipe[2];
+    int                    errpipe[2];
+    char                 **env;
+    char                  *e;
+
+    if (pipe(datapipe) == -1 ||
+	(extract->index && pipe(outpipe) == -1) ||
+	pipe(errpipe) == -1) {
+	error(_("error [pipe: %s]"), strerror(errno));
+    }
+
+    efile->tarpid = fork();
+    switch (efile->tarpid) {
+    case -1: error(_("%s: fork returned: %s"), get_pname(), strerror(errno));
+    case 0:
+	dup2(datapipe[0], 0);
+	if (extract->index)
+	    dup2(outpipe[1], 1);
+	dup2(errpipe[1], 2);
+	safe_fd(-1, 0);
+	env = safe_env();
+	if (extract->need_root)
+	    become_root();
+	execve(extract->cmd, (char **)extract->argv_ptr->pdata, env);
+	free_env(env);
+	e = strerror(errno);
+	error(_("error [exec %s: %s]"), extract->cmd, e);
+	break;
+    default: break;
+    }
+
+    close(datapipe[0]);
+    efile->fd = datapipe[1];
+    if (extract->index) {
+	close(outpipe[1]);
+	efile->outstream = fdopen(outpipe[0], "r");
+	if (!efile->outstream) {
+	    error(_("error indexstream(%d): %s\n"), outpipe[0], strerror(errno));
+	}
+	efile->thread = g_thread_create(amgtar_extract_index_thread, efile,
+					TRUE, NULL);
+    }
+    close(errpipe[1]);
+    efile->errstream = fdopen(errpipe[0], "r");
+    if (!efile->errstream) {
+	error(_("error errstream(%d): %s\n"), errpipe[0], strerror(errno));
+    }
+    efile->not_found = g_ptr_array_new_with_free_func(g_free);
+    efile->errthread = g_thread_create(amgtar_extract_stderr_thread, efile,
+				       TRUE, NULL);
+    g_ptr_array_add(extract->files, efile);
+
+    *ignore = FALSE;
+    *file_data = efile;
+    return TRUE;
+}
+
+static gboolean
+amgtar_extract_frag(
+    gpointer  user_data,
+    guint16   filenum G_GNUC_UNUSED,
+    gpointer  file_data,
+    guint16   attrid G_GNUC_UNUSED,
+    gpointer  attrid_data G_GNUC_UNUSED,
+    gpointer *attr_data G_GNUC_UNUSED,
+    gpointer  data,
+    gsize     size,
+    gboolean  eoa G_GNUC_UNUSED,
+    gboolean  truncated G_GNUC_UNUSED)
+{
+    amgtar_extract_t      *extract = user_data;
+    amgtar_extract_file_t *efile = file_data;
+
+    /* if a gnutar is gone, go on for the other streams */
+    if (efile->fd != -1 && full_write(efile->fd, data, size) < size) {
+	if (!extract->errmsg) {
+	    extract->errmsg = g_strdup_printf(_("writing to %s: %s"),
+					      extract->cmd, strerror(errno));
+	}
+	aclose(efile->fd);
+    }
+    return TRUE;
+}
+
+static gboolean
+amgtar_extract_file_finish(
+    gpointer  user_data G_GNUC_UNUSED,
+    guint16   filenum G_GNUC_UNUSED,
+    gpointer *file_data,
+    gboolean  truncated G_GNUC_UNUSED)
+{
+    amgtar_extract_file_t *efile = *file_data;
+
+    aclose(efile->fd);
+    return TRUE;
+}
+
+/* Read the amanda archive written by a multi-stream backup on stdin, and
+ * give each of its streams to a separate run of cmd, all of them at once.
+ * If index is set, the filenames that they print are written to stdout.
+ * A member given in argv_ptr needs to be found in one of the streams only.
+ * Returns an error message, or NULL. */
+static char *
+amgtar_extract_streams(
+    char      *cmd,
+    GPtrArray *argv_ptr,
+    gboolean   need_root,
+    gboolean   index)
+{
+    amgtar_extract_t extract;
+    amar_attr_handling_t handling[] = {
+	{ AMAR_ATTR_GENERIC_DATA, 0, amgtar_extract_frag, NULL },
+	{ 0, 0, NULL, NULL },
+    };
+    amar_t     *archive;
+    GError     *error = NULL;
+    GHashTable *not_found;
+    guint       i;
+    guint       j;
+
+    extract.cmd = cmd;
+    extract.argv_ptr = argv_ptr;
+    extract.need_root = need_root;
+    extract.index = index;
+    extract.files = g_ptr_array_new();
+    extract.errmsg = NULL;
+    amgtar_stream_mutex = g_mutex_new();
+    not_found = g_hash_table_new(g_str_hash, g_str_equal);
+
+    archive = amar_new(0, O_RDONLY, &error);
+    if (!archive) {
+	amgtar_amar_error(&extract.errmsg, &error);
+    } else {
+	if (!amar_read(archive, &extract, handling,
+		       amgtar_extract_file_start, amgtar_extract_file_finish,
+		       NULL, &error)) {
+	    amgtar_amar_error(&extract.errmsg, &error);
+	}
+	amar_close(archive, NULL);
+    }
+
+    for (i = 0; i < extract.files->len; i++) {
+	amgtar_extract_file_t *efile = g_ptr_array_index(extract.files, i);
+	amwait_t               wait_status;
+	char                  *tarmsg = NULL;
+
+	/* a truncated archive may leave a stream open */
+	aclose(efile->fd);
+	if (efile->thread)
+	    g_thread_join(efile->thread);
+	g_thread_join(efile->errthread);
+	waitpid(efile->tarpid, &wait_status, 0);
+	for (j = 0; j < efile->not_found->len; j++) {
+	    char *msg = g_ptr_array_index(efile->not_found, j);
+	    guint count = GPOINTER_TO_UINT(g_hash_table_lookup(not_found, msg));
+
+	    g_hash_table_insert(not_found, msg, GUINT_TO_POINTER(count + 1));
+	}
+	if (WIFSIGNALED(wait_status)) {
+	    tarmsg = g_strdup_printf(_("%s terminated with signal %d: see %s"),
+				     cmd, WTERMSIG(wait_status), dbfn());
+	} else if (WIFEXITED(wait_status)) {
+	    /* a member in another stream only */
+	    if (WEXITSTATUS(wait_status) == 2 && efile->nb_errors == 0 &&
+		efile->not_found->len > 0) {
+		dbprintf(_("amgtar: %s: stream %d: %d members not found\n"),
+			 cmd, i, efile->not_found->len);
+	    } else if (WEXITSTATUS(wait_status) > 0) {
+		tarmsg = g_strdup_printf(_("%s exited with status %d: see %s"),
+					 cmd, WEXITSTATUS(wait_status), dbfn());
+	    }
+	} else {
+	    tarmsg = g_strdup_printf(_("%s got bad exit: see %s"),
+				     cmd, dbfn());
+	}
+	dbprintf(_("amgtar: %s: stream %d: pid %ld\n"), cmd, i,
+		 (long)efile->tarpid);
+	if (tarmsg) {
+	    dbprintf("%s\n", tarmsg);
+	    if (!extract.errmsg)
+		extract.errmsg = tarmsg;
+	    else
+		g_free(tarmsg);
+	}
+    }
+
+    /* report the members that are in none of the streams */
+    for (i = 0; i < extract.files->len; i++) {
+	amgtar_extract_file_t *efile = g_ptr_array_index(extract.files, i);
+
+	for (j = 0; j < efile->not_found->len; j++) {
+	    char *msg = g_ptr_array_index(efile->not_found, j);
+
+	    if (GPOINTER_TO_UINT(g_hash_table_lookup(not_found, msg)) ==
+							extract.files->len) {
+		fprintf(stderr, "%s\n", msg);
+		if (!extract.errmsg)
+		    extract.errmsg = g_strdup(msg);
+		g_hash_table_remove(not_found, msg);
+	    }
+	}
+    }
+    for (i = 0; i < extract.files->len; i++) {
+	amgtar_extract_file_t *efile = g_ptr_array_index(extract.files, i);
+
+	g_ptr_array_free(efile->not_found, TRUE);
+	g_free(efile);
+    }
+    g_hash_table_destroy(not_found);
+    g_ptr_array_free(extract.files, TRUE);
+    g_mutex_free(amgtar_stream_mutex);
+    amgtar_stream_mutex = NULL;
+
+    return extract.errmsg;
+}
+
+/* the start of an amanda archive; see amar-src/amar.c */
+#define AMGTAR_AMAR_MAGIC "AMANDA ARCHIVE FORMAT "
+
+typedef struct amgtar_refeed_s {
+    int    in;
+    int    out;
+    char   head[sizeof(AMGTAR_AMAR_MAGIC)];
+    size_t head_len;
+} amgtar_refeed_t;
+
+/* write the bytes already read from stdin, then the rest of it */
+static gpointer
+amgtar_refeed_thread(
+    gpointer data)
+{
+    amgtar_refeed_t *refeed = data;
+    char             buf[32768];
+    ssize_t          nb;
+
+    if (full_write(refeed->out, refeed->head, refeed->head_len) ==
+							refeed->head_len) {
+	while ((nb = read(refeed->in, buf, sizeof(buf))) > 0) {
+	    if (full_write(refeed->out, buf, (size_t)nb) < (size_t)nb)
+		break;
+	}
+    }
+    close(refeed->in);
+    close(refeed->out);
+    g_free(refeed);
+    return NULL;
+}
+
+/* Tell whether the dump on stdin was written by a multi-stream backup, by
+ * looking for the amanda archive header, so that the restore does not
+ * depend on the STREAMS property.  The bytes looked at are put back on
+ * stdin: by seeking back if it is a file, otherwise by making stdin a pipe
+ * fed by a thread. */
+static gboolean
+amgtar_stdin_is_archive(void)
+{
+    amgtar_refeed_t *refeed = g_new0(amgtar_refeed_t, 1);
+    off_t            offset;
+    gboolean         is_archive;
+    int              pipefd[2];
+
+    offset = lseek(0, 0, SEEK_CUR);
+    refeed->head_len = full_read(0, refeed->head,
+				 strlen(AMGTAR_AMAR_MAGIC));
+    is_archive = (refeed->head_len == strlen(AMGTAR_AMAR_MAGIC) &&
+		  strncmp(refeed->head, AMGTAR_AMAR_MAGIC,
+			  refeed->head_len) == 0);
+    dbprintf(_("the dump is %s\n"), is_archive ?
+	     _("an amanda archive of several gnutar streams") :
+	     _("a single gnutar stream"));
+
+    if (offset != (off_t)-1 && lseek(0, offset, SEEK_SET) == offset) {
+	g_free(refeed);
+	return is_archive;
+    }
+
+    if (pipe(pipefd) < 0) {
+	error(_("Can't create pipe: %s"), strerror(errno));
+	/*NOTREACHED*/
+    }
+    refeed->in = dup(0);
+    refeed->out = pipefd[1];
+    if (refeed->in < 0 || dup2(pipefd[0], 0) < 0) {
+	error(_("Can't dup stdin: %s"), strerror(errno));
+	/*NOTREACHED*/
+    }
+    close(pipefd[0]);
+    /* gnutar must see the end of the pipe when the thread closes it */
+    fcntl(refeed->in, F_SETFD, FD_CLOEXEC);
+    fcntl(refeed->out, F_SETFD, FD_CLOEXEC);
+    g_thread_create(amgtar_refeed_thread, refeed, FALSE, NULL);
+    return is_archive;
+}
@@ -64,29 +64,34 @@ round_function(n, x)
 
 #define	FILETYPES	(S_IFREG|S_IFLNK|S_IFDIR)
 
-typedef struct name_s {
-    struct name_s *next;
-    char *str;
-} Name;
-
-Name *name_stack;
-
 #define MAXDUMPS 10
 
-struct {
+/* default number of threads walking the directory tree; most of their time
+ * is spent waiting for the filesystem, so this is not tied to the number of
+ * processors */
+#define CALCSIZE_THREADS 8
+
+typedef struct dumpstats_s {
     int max_inode;
     int total_dirs;
     int total_files;
     off_t total_size;
     off_t total_size_name;
-} dumpstats[MAXDUMPS];
+} dumpstats_t;
+
+dumpstats_t dumpstats[MAXDUMPS];
 
 time_t dumpdate[MAXDUMPS];
 int  dumplevel[MAXDUMPS];
 int ndumps;
 
-void (*add_file_name)(int, char *);
-void (*add_file)(int, struct stat *);
+int nthreads = CALCSIZE_THREADS;
+
+/* add_file_name and add_file accumulate into the STATS array they are given,
+ * one per walker thread; the arrays are summed into dumpstats once the walk
+ * is done. */
+void (*add_file_name)(dumpstats_t *, int, char *);
+void (*add_file)(dumpstats_t *, int, struct stat *);
 off_t (*final_size)(int, char *);
 
 
@@ -94,20 +99,20 @@ int main(int, char **);
 void traverse_dirs(char *, char *);
 
 
-void add_file_name_dump(int, char *);
-void add_file_dump(int, struct stat *);
+void add_file_name_dump(dumpstats_t *, int, char *);
+void add_file_dump(dumpstats_t *, int, struct stat *);
 off_t final_size_dump(int, char *);
 
-void add_file_name_star(int, char *);
-void add_file_star(int, struct stat *);
+void add_file_name_star(dumpstats_t *, int, char *);
+void add_file_star(dumpstats_t *, int, struct stat *);
 off_t final_size_star(int, char *);
 
-void add_file_name_gnutar(int, char *);
-void add_file_gnutar(int, struct stat *);
+void add_file_name_gnutar(dumpstats_t *, int, char *);
+void add_file_gnutar(dumpstats_t *, int, struct stat *);
 off_t final_size_gnutar(int, char *);
 
-void add_file_name_unknown(int, char *);
-void add_file_unknown(int, struct stat *);
+void add_file_name_unknown(dumpstats_t *, int, char *);
+void add_file_unknown(dumpstats_t *, int, struct stat *);
 off_t final_size_unknown(int, char *);
 
 am_sl_t *calc_load_file(char *filename);
@@ -204,7 +209,7 @@ main(
     /* need at least program, amname, and directory name */
 
     if(argc < 4) {
-	error(_("Usage: %s config [BSDTAR|DUMP|STAR|GNUTAR] name dir [-X exclude-file] [-I include-file] [level date]*"),
+	error(_("Usage: %s config [BSDTAR|DUMP|STAR|GNUTAR] name dir [-X exclude-file] [-I include-file] [-T threads] [level date]*"),
 	      get_pname());
         /*NOTREACHED*/
     }
@@ -323,6 +328,18 @@ main(
 	argv++;
     }
 
+    if ((argc > 1) && g_str_equal(*argv, "-T")) {
+	argv++;
+
+	nthreads = atoi(*argv);
+	if (nthreads < 1) {
+	    error("invalid number of threads \"%s\"", *argv);
+	    /*NOTREACHED*/
+	}
+	argc -= 2;
+	argv++;
+    }
+
     /* the dump levels to calculate sizes for */
 
     ndumps = 0;
@@ -393,155 +410,295 @@ basename(
 }
 #endif
 
-void push_name(char *str);
-char *pop_name(void);
+/*
+ * The tree is walked by a bounded number of threads.  Each has its own stack
+ * of directories to visit, which it works through depth-first; a thread whose
+ * stack is empty steals the oldest directory of another stack, which is the
+ * closest to the top of the tree and so likely the largest piece of work.
+ *
+ * Entries are stat'ed relative to their directory, and the ones that would
+ * be skipped whatever their stat says are not stat'ed at all.  Every size is
+ * a sum, so accumulating per thread gives the same totals as a serial walk.
+ */
+
+typedef struct walk_s {
+    GMutex   *mutex;
+    GCond    *cond;
+    GQueue  **stacks;		/* one stack of directory names per walker */
+    int       nwalkers;
+    int       busy;		/* walkers visiting a directory */
+    dev_t     parent_dev;
+    size_t    parent_len;
+    int       has_exclude;
+} walk_t;
+
+typedef struct walker_s {
+    walk_t   *walk;
+    int       id;
+    GThread  *thread;
+    dumpstats_t stats[MAXDUMPS];
+} walker_t;
+
+static void walk_push(walker_t *walker, char *dirname);
+static char *walk_pop(walker_t *walker);
+static void walk_dir(walker_t *walker, char *dirname);
+static gpointer walker_thread(gpointer data);
 
 void
 traverse_dirs(
     char *	parent_dir,
     char *	include)
 {
-    DIR *d;
-    struct dirent *f;
     struct stat finfo;
-    char *dirname, *newname = NULL;
-    char *newbase = NULL;
-    dev_t parent_dev = (dev_t)0;
-    int i;
-    size_t l;
-    size_t parent_len;
-    int has_exclude;
+    walk_t walk;
+    walker_t *walkers;
     char *aparent;
+    int i, j;
 
     if(parent_dir == NULL || include == NULL)
 	return;
 
-    has_exclude = !is_empty_sl(exclude_sl) && (use_gtar_excl || use_star_excl);
+    memset(&walk, 0, sizeof(walk));
+    walk.has_exclude = !is_empty_sl(exclude_sl) &&
+		       (use_gtar_excl || use_star_excl);
     aparent = g_strjoin(NULL, parent_dir, "/", include, NULL);
 
     /* We (may) need root privs for the *stat() calls here. */
     set_root_privs(1);
     if(stat(parent_dir, &finfo) != -1)
-	parent_dev = finfo.st_dev;
+	walk.parent_dev = finfo.st_dev;
+
+    walk.parent_len = strlen(parent_dir);
+    walk.mutex = g_mutex_new();
+    walk.cond = g_cond_new();
+    walk.nwalkers = nthreads;
+    walk.stacks = g_new0(GQueue *, walk.nwalkers);
+    walkers = g_new0(walker_t, walk.nwalkers);
+    for (i = 0; i < walk.nwalkers; i++) {
+	walk.stacks[i] = g_queue_new();
+	walkers[i].walk = &walk;
+	walkers[i].id = i;
+    }
 
-    parent_len = strlen(parent_dir);
+    walk_push(&walkers[0], aparent);
 
-    push_name(aparent);
+    /* the first walker is this thread */
+    for (i = 1; i < walk.nwalkers; i++) {
+	walkers[i].thread = g_thread_create(walker_thread, &walkers[i],
+					    TRUE, NULL);
+    }
+    walker_thread(&walkers[0]);
+    for (i = 1; i < walk.nwalkers; i++) {
+	g_thread_join(walkers[i].thread);
+    }
 
-    for(; (dirname = pop_name()) != NULL; free(dirname)) {
-	if(has_exclude && calc_check_exclude(dirname+parent_len+1)) {
-	    continue;
+    /* drop root privs -- we're done with the permission-sensitive calls */
+    set_root_privs(0);
+
+    for (i = 0; i < walk.nwalkers; i++) {
+	for (j = 0; j < ndumps; j++) {
+	    dumpstats[j].max_inode += walkers[i].stats[j].max_inode;
+	    dumpstats[j].total_dirs += walkers[i].stats[j].total_dirs;
+	    dumpstats[j].total_files += walkers[i].stats[j].total_files;
+	    dumpstats[j].total_size += walkers[i].stats[j].total_size;
+	    dumpstats[j].total_size_name += walkers[i].stats[j].total_size_name;
 	}
-	if((d = opendir(dirname)) == NULL) {
-	    perror(dirname);
-	    continue;
+	g_queue_free(walk.stacks[i]);
+    }
+
+    g_mutex_free(walk.mutex);
+    g_cond_free(walk.cond);
+    amfree(walk.stacks);
+    amfree(walkers);
+    amfree(aparent);
+}
+
+static gpointer
+walker_thread(
+    gpointer	data)
+{
+    walker_t *walker = data;
+    char *dirname;
+
+    while ((dirname = walk_pop(walker)) != NULL) {
+	walk_dir(walker, dirname);
+	g_free(dirname);
+
+	g_mutex_lock(walker->walk->mutex);
+	walker->walk->busy--;
+	if (walker->walk->busy == 0)
+	    g_cond_broadcast(walker->walk->cond);
+	g_mutex_unlock(walker->walk->mutex);
+    }
+
+    return NULL;
+}
+
+static void
+walk_push(
+    walker_t *	walker,
+    char *	dirname)
+{
+    walk_t *walk = walker->walk;
+
+    g_mutex_lock(walk->mutex);
+    g_queue_push_head(walk->stacks[walker->id], g_strdup(dirname));
+    g_cond_signal(walk->cond);
+    g_mutex_unlock(walk->mutex);
+}
+
+/* Get the next directory to visit, from our own stack or stolen from another
+ * walker.  Returns NULL once all the stacks are empty and no walker is busy,
+ * as nothing more can be pushed. */
+static char *
+walk_pop(
+    walker_t *	walker)
+{
+    walk_t *walk = walker->walk;
+    char *dirname = NULL;
+    int i;
+
+    g_mutex_lock(walk->mutex);
+    while (1) {
+	dirname = g_queue_pop_head(walk->stacks[walker->id]);
+	for (i = 1; dirname == NULL && i < walk->nwalkers; i++) {
+	    dirname = g_queue_pop_tail(
+			walk->stacks[(walker->id + i) % walk->nwalkers]);
+	}
+	if (dirname != NULL) {
+	    walk->busy++;
+	    break;
 	}
+	if (walk->busy == 0)
+	    break;
+	g_cond_wait(walk->cond, walk->mutex);
+    }
+    g_mutex_unlock(walk->mutex);
 
-	l = strlen(dirname);
-	if(l > 0 && dirname[l - 1] != '/') {
-	    g_free(newbase);
-	    newbase = g_strconcat(dirname, "/", NULL);
-	} else {
-	    g_free(newbase);
-	    newbase = g_strdup(dirname);
+    return dirname;
+}
+
+static void
+walk_dir(
+    walker_t *	walker,
+    char *	dirname)
+{
+    walk_t *walk = walker->walk;
+    DIR *d;
+    struct dirent *f;
+    struct stat finfo;
+    char *newname = NULL;
+    char *newbase;
+    int i;
+    size_t l;
+#if defined(HAVE_FDOPENDIR) && defined(HAVE_FSTATAT)
+    int fd;
+#endif
+
+    if(walk->has_exclude && calc_check_exclude(dirname+walk->parent_len+1)) {
+	return;
+    }
+#if defined(HAVE_FDOPENDIR) && defined(HAVE_FSTATAT)
+    if ((fd = open(dirname, O_RDONLY)) == -1) {
+	perror(dirname);
+	return;
+    }
+    if((d = fdopendir(fd)) == NULL) {
+	perror(dirname);
+	close(fd);
+	return;
+    }
+#else
+    if((d = opendir(dirname)) == NULL) {
+	perror(dirname);
+	return;
+    }
+#endif
+
+    l = strlen(dirname);
+    if(l > 0 && dirname[l - 1] != '/') {
+	newbase = g_strconcat(dirname, "/", NULL);
+    } else {
+	newbase = g_strdup(dirname);
+    }
+
+    while((f = readdir(d)) != NULL) {
+	int is_symlink = 0;
+	int is_dir;
+	int is_file;
+	if(is_dot_or_dotdot(f->d_name)) {
+	    continue;
 	}
 
-	while((f = readdir(d)) != NULL) {
-	    int is_symlink = 0;
-	    int is_dir;
-	    int is_file;
-	    if(is_dot_or_dotdot(f->d_name)) {
-		continue;
-	    }
+#ifdef HAVE_STRUCT_DIRENT_D_TYPE
+	/* these are skipped below, whatever lstat would say */
+	if (f->d_type != DT_UNKNOWN && f->d_type != DT_REG &&
+	    f->d_type != DT_DIR && f->d_type != DT_LNK) {
+	    continue;
+	}
+#endif
 
-	    g_free(newname);
-	    newname = g_strconcat(newbase, f->d_name, NULL);
-	    if(lstat(newname, &finfo) == -1) {
-		g_fprintf(stderr, "%s/%s: %s\n",
-			dirname, f->d_name, strerror(errno));
-		continue;
-	    }
+	g_free(newname);
+	newname = g_strconcat(newbase, f->d_name, NULL);
+#if defined(HAVE_FDOPENDIR) && defined(HAVE_FSTATAT)
+	if(fstatat(fd, f->d_name, &finfo, AT_SYMLINK_NOFOLLOW) == -1) {
+#else
+	if(lstat(newname, &finfo) == -1) {
+#endif
+	    g_fprintf(stderr, "%s/%s: %s\n",
+		    dirname, f->d_name, strerror(errno));
+	    continue;
+	}
 
-	    if(finfo.st_dev != parent_dev)
-		continue;
+	if(finfo.st_dev != walk->parent_dev)
+	    continue;
 
 #ifdef S_IFLNK
-	    is_symlink = ((finfo.st_mode & S_IFMT) == S_IFLNK);
+	is_symlink = ((finfo.st_mode & S_IFMT) == S_IFLNK);
 #endif
-	    is_dir = ((finfo.st_mode & S_IFMT) == S_IFDIR);
-	    is_file = ((finfo.st_mode & S_IFMT) == S_IFREG);
+	is_dir = ((finfo.st_mode & S_IFMT) == S_IFDIR);
+	is_file = ((finfo.st_mode & S_IFMT) == S_IFREG);
 
-	    if (!(is_file || is_dir || is_symlink)) {
-		continue;
-	    }
+	if (!(is_file || is_dir || is_symlink)) {
+	    continue;
+	}
 
-	    {
-		int is_excluded = -1;
-		for(i = 0; i < ndumps; i++) {
-		    add_file_name(i, newname);
-		    if(is_file && (time_t)finfo.st_ctime >= dumpdate[i]) {
-
-			if(has_exclude) {
-			    if(is_excluded == -1)
-				is_excluded =
-				       calc_check_exclude(newname+parent_len+1);
-			    if(is_excluded == 1) {
-				i = ndumps;
-				continue;
-			    }
+	{
+	    int is_excluded = -1;
+	    for(i = 0; i < ndumps; i++) {
+		add_file_name(walker->stats, i, newname);
+		if(is_file && (time_t)finfo.st_ctime >= dumpdate[i]) {
+
+		    if(walk->has_exclude) {
+			if(is_excluded == -1)
+			    is_excluded =
+				calc_check_exclude(newname+walk->parent_len+1);
+			if(is_excluded == 1) {
+			    i = ndumps;
+			    continue;
 			}
-			add_file(i, &finfo);
 		    }
+		    add_file(walker->stats, i, &finfo);
 		}
-		if(is_dir) {
-		    if(has_exclude && calc_check_exclude(newname+parent_len+1))
-			continue;
-		    push_name(newname);
-		}
+	    }
+	    if(is_dir) {
+		if(walk->has_exclude &&
+		   calc_check_exclude(newname+walk->parent_len+1))
+		    continue;
+		walk_push(walker, newname);
 	    }
 	}
+    }
 
 #ifdef CLOSEDIR_VOID
-	closedir(d);
+    closedir(d);
 #else
-	if(closedir(d) == -1)
-	    perror(dirname);
+    if(closedir(d) == -1)
+	perror(dirname);
 #endif
-    }
-
-    /* drop root privs -- we're done with the permission-sensitive calls */
-    set_root_privs(0);
 
     amfree(newbase);
     amfree(newname);
-    amfree(aparent);
-}
-
-void
-push_name(
-    char *	str)
-{
-    Name *newp;
-
-    newp = g_malloc(sizeof(*newp));
-    newp->str = g_strdup(str);
-
-    newp->next = name_stack;
-    name_stack = newp;
-}
-
-char *
-pop_name(void)
-{
-    Name *newp = name_stack;
-    char *str;
-
-    if(!newp) return NULL;
-
-    name_stack = newp->next;
-    str = newp->str;
-    amfree(newp);
-    return str;
 }
 
 
@@ -563,9 +720,11 @@ pop_name(void)
  */
 void
 add_file_name_dump(
+    dumpstats_t *	stats,
     int		level,
     char *	name)
 {
+    (void)stats;	/* Quiet unused parameter warning */
     (void)level;	/* Quiet unused parameter warning */
     (void)name;		/* Quiet unused parameter warning */
 
@@ -574,12 +733,13 @@ add_file_name_dump(
 
 void
 add_file_dump(
+    dumpstats_t *	stats,
     int			level,
     struct stat *	sp)
 {
     /* keep the size in kbytes, rounded up, plus a 1k header block */
     if((sp->st_mode & S_IFMT) == S_IFREG || (sp->st_mode & S_IFMT) == S_IFDIR)
-    	dumpstats[level].total_size +=
+    	stats[level].total_size +=
 			(ST_BLOCKS(*sp) + (off_t)1) / (off_t)2 + (off_t)1;
 }
 
@@ -629,22 +789,24 @@ final_size_dump(
  */
 void
 add_file_name_gnutar(
+    dumpstats_t *	stats,
     int		level,
     char *	name)
 {
     (void)name;	/* Quiet unused parameter warning */
 
-/*  dumpstats[level].total_size_name += strlen(name) + 64;*/
-    dumpstats[level].total_size += (off_t)1;
+/*  stats[level].total_size_name += strlen(name) + 64;*/
+    stats[level].total_size += (off_t)1;
 }
 
 void
 add_file_gnutar(
+    dumpstats_t *	stats,
     int			level,
     struct stat *	sp)
 {
     /* the header takes one additional block */
-    dumpstats[level].total_size += ST_BLOCKS(*sp);
+    stats[level].total_size += ST_BLOCKS(*sp);
 }
 
 off_t
@@ -669,9 +831,11 @@ final_size_gnutar(
 
 void
 add_file_name_unknown(
+    dumpstats_t *	stats,
     int		level,
     char *	name)
 {
+    (void)stats;	/* Quiet unused parameter warning */
     (void)level;	/* Quiet unused parameter warning */
     (void)name;		/* Quiet unused parameter warning */
 
@@ -680,12 +844,13 @@ add_file_name_unknown(
 
 void
 add_file_unknown(
+    dumpstats_t *	stats,
     int			level,
     struct stat *	sp)
 {
     /* just add up the block counts */
     if((sp->st_mode & S_IFMT) == S_IFREG || (sp->st_mode & S_IFMT) == S_IFDIR)
-    	dumpstats[level].total_size += ST_BLOCKS(*sp);
+    	stats[level].total_size += ST_BLOCKS(*sp);
 }
 
 off_t
@@ -1107,11 +1107,11 @@ main(
 	}
 	if (shm_ring) {
 	    shm_ring->mc->cancelled = TRUE;
-	    sem_post(shm_ring->sem_ready);
-	    sem_post(shm_ring->sem_ready);
-	    sem_post(shm_ring->sem_start);
-	    sem_post(shm_ring->sem_write);
-	    sem_post(shm_ring->sem_read);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_start);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
 	    close_producer_shm_ring(shm_ring);
 	    shm_ring = NULL;
 	}
@@ -1824,11 +1824,7 @@ start_index(
     dup2(input, 3);
     aclose(input);
   }
-  for(index = 4; index < (int)FD_SETSIZE; index++) {
-    if (index != dbfd()) {
-      close(index);
-    }
-  }
+  safe_fd2(3, 1, dbfd());
 
   if ((pipe_fp = popen(cmd, "w")) == NULL) {
     error(_("couldn't start index creator [%s]"), strerror(errno));
@@ -1943,10 +1939,10 @@ stderr_thread(
     while ((buf = areads(fsp->fd)) != NULL) {
 	if (shm_ring) {
 	    shm_ring->mc->cancelled = TRUE;
-	    sem_post(shm_ring->sem_ready);
-	    sem_post(shm_ring->sem_start);
-	    sem_post(shm_ring->sem_write);
-	    sem_post(shm_ring->sem_read);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_start);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
 	}
 	if (strncmp(buf, "sendbackup: error [", 19) == 0) {
 	    fdprintf(mesgfd, "%s\n", buf);
@@ -0,0 +1,128 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2007-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/* CRC-32C folding with 512 bits VPCLMULQDQ; this is the algorithm of
+ * amcrc32pclmul.c, with four zmm registers holding 256 bytes of state. */
+
+#include <amanda.h>
+#include <amutil.h>
+#include <amcrc32chw.h>
+
+#if defined __AVX512F__ && defined __VPCLMULQDQ__ && defined __x86_64__
+#include <immintrin.h>
+
+gboolean compiled_with_avx512 = TRUE;
+
+/* fold by sixteen lanes (2048 bits) */
+static __m512i fold_2048;
+
+void
+crc32c_init_avx512(void)
+{
+    __m128i k = _mm_set_epi64x(crc32c_xnmodp(2048 - 33),
+			       crc32c_xnmodp(2048 + 64 - 33));
+
+    fold_2048 = _mm512_broadcast_i32x4(k);
+}
+
+static inline __m512i
+fold(
+    __m512i x,
+    __m512i k,
+    __m512i data)
+{
+    __m512i lo = _mm512_clmulepi64_epi128(x, k, 0x00);
+    __m512i hi = _mm512_clmulepi64_epi128(x, k, 0x11);
+
+    /* lo ^ hi ^ data */
+    return _mm512_ternarylogic_epi64(lo, hi, data, 0x96);
+}
+
+void
+crc32c_add_avx512(
+    uint8_t *buf,
+    size_t len,
+    crc_t *crc)
+{
+    __m512i x0, x1, x2, x3;
+    uint8_t state[256] __attribute__((aligned(64)));
+    off_t size;
+
+    if (len < 1024) {
+	crc32c_add_pclmul(buf, len, crc);
+	return;
+    }
+
+    size = crc->size + len;
+
+    x0 = _mm512_loadu_si512((void *)buf);
+    x0 = _mm512_xor_si512(x0, _mm512_zextsi128_si512(
+				_mm_cvtsi32_si128((int)crc->crc)));
+    x1 = _mm512_loadu_si512((void *)(buf + 64));
+    x2 = _mm512_loadu_si512((void *)(buf + 128));
+    x3 = _mm512_loadu_si512((void *)(buf + 192));
+    buf += 256;
+    len -= 256;
+
+    while (len >= 256) {
+	x0 = fold(x0, fold_2048, _mm512_loadu_si512((void *)buf));
+	x1 = fold(x1, fold_2048, _mm512_loadu_si512((void *)(buf + 64)));
+	x2 = fold(x2, fold_2048, _mm512_loadu_si512((void *)(buf + 128)));
+	x3 = fold(x3, fold_2048, _mm512_loadu_si512((void *)(buf + 192)));
+	buf += 256;
+	len -= 256;
+    }
+
+    _mm512_store_si512((void *)state, x0);
+    _mm512_store_si512((void *)(state + 64), x1);
+    _mm512_store_si512((void *)(state + 128), x2);
+    _mm512_store_si512((void *)(state + 192), x3);
+
+    crc->crc = 0;
+    crc32c_add_pclmul(state, 256, crc);
+    crc->size = size - len;
+    crc32c_add_pclmul(buf, len, crc);
+}
+
+#else
+gboolean compiled_with_avx512 = FALSE;
+
+void
+crc32c_init_avx512(void)
+{
+   g_error("crc32c_init_avx512 is not defined");
+}
+
+void crc32c_add_avx512(
+    uint8_t *buf G_GNUC_UNUSED,
+    size_t len G_GNUC_UNUSED,
+    crc_t *crc G_GNUC_UNUSED)
+{
+   g_error("crc32c_add_avx512 is not defined");
+}
+
+#endif
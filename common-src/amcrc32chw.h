@@ -34,4 +34,18 @@ extern gboolean compiled_with_sse4_2;
 void crc32c_init_hw(void);
 void crc32c_add_hw(uint8_t *buf, size_t len, crc_t *crc);
 
+/* folding with PCLMULQDQ, see amcrc32pclmul.c */
+extern gboolean compiled_with_pclmul;
+void crc32c_init_pclmul(void);
+void crc32c_add_pclmul(uint8_t *buf, size_t len, crc_t *crc);
+
+/* folding with AVX-512 VPCLMULQDQ, see amcrc32avx512.c */
+extern gboolean compiled_with_avx512;
+void crc32c_init_avx512(void);
+void crc32c_add_avx512(uint8_t *buf, size_t len, crc_t *crc);
+
+/* GF(2) arithmetic modulo the CRC-32C polynomial, in amutil.c */
+uint32_t crc32c_multmodp(uint32_t a, uint32_t b);
+uint32_t crc32c_xnmodp(guint64 n);
+
 #endif /* AMCRCC32HW_H */
@@ -0,0 +1,140 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2007-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+
+/* CRC-32C by folding 16 bytes lanes with carry-less multiplications.
+ *
+ * The state is kept in four 128 bits registers covering 64 bytes of data.
+ * Folding a lane forward by D bits multiplies it by x^D modulo the
+ * polynomial; a lane is two 64 bits halves, each multiplied by a 32 bits
+ * constant with PCLMULQDQ, and the (at most 96 bits) products are xored into
+ * the lane D bits further in the data.  Once the data is exhausted, the 64
+ * bytes of state are an input with the same CRC as everything folded so far,
+ * and are fed to the crc32 instruction with the remaining bytes.
+ *
+ * In the bit-reflected layout, the product of a clmul is the true product
+ * times x^33 relative to the 128 bits lane, hence the -33 in the constants
+ * below; the first half of a lane carries another x^64.
+ */
+
+#include <amanda.h>
+#include <amutil.h>
+#include <amcrc32chw.h>
+
+#if defined __SSE4_2__ && defined __PCLMUL__ && defined __x86_64__
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+
+gboolean compiled_with_pclmul = TRUE;
+
+/* fold by four lanes (512 bits) */
+static __m128i fold_512;
+
+void
+crc32c_init_pclmul(void)
+{
+    fold_512 = _mm_set_epi64x(crc32c_xnmodp(512 - 33),
+			      crc32c_xnmodp(512 + 64 - 33));
+}
+
+static inline __m128i
+fold(
+    __m128i x,
+    __m128i k,
+    __m128i data)
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), data);
+}
+
+void
+crc32c_add_pclmul(
+    uint8_t *buf,
+    size_t len,
+    crc_t *crc)
+{
+    __m128i x0, x1, x2, x3;
+    uint8_t state[64] __attribute__((aligned(16)));
+    off_t size;
+
+    /* not worth setting up the fold for short buffers */
+    if (len < 256) {
+	crc32c_add_hw(buf, len, crc);
+	return;
+    }
+
+    size = crc->size + len;
+
+    /* starting from crc is the same as starting from 0 with crc xored into
+     * the first four bytes */
+    x0 = _mm_loadu_si128((__m128i *)buf);
+    x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128((int)crc->crc));
+    x1 = _mm_loadu_si128((__m128i *)(buf + 16));
+    x2 = _mm_loadu_si128((__m128i *)(buf + 32));
+    x3 = _mm_loadu_si128((__m128i *)(buf + 48));
+    buf += 64;
+    len -= 64;
+
+    while (len >= 64) {
+	x0 = fold(x0, fold_512, _mm_loadu_si128((__m128i *)buf));
+	x1 = fold(x1, fold_512, _mm_loadu_si128((__m128i *)(buf + 16)));
+	x2 = fold(x2, fold_512, _mm_loadu_si128((__m128i *)(buf + 32)));
+	x3 = fold(x3, fold_512, _mm_loadu_si128((__m128i *)(buf + 48)));
+	buf += 64;
+	len -= 64;
+    }
+
+    _mm_store_si128((__m128i *)state, x0);
+    _mm_store_si128((__m128i *)(state + 16), x1);
+    _mm_store_si128((__m128i *)(state + 32), x2);
+    _mm_store_si128((__m128i *)(state + 48), x3);
+
+    crc->crc = 0;
+    crc32c_add_hw(state, 64, crc);
+    crc->size = size - len;
+    crc32c_add_hw(buf, len, crc);
+}
+
+#else
+gboolean compiled_with_pclmul = FALSE;
+
+void
+crc32c_init_pclmul(void)
+{
+   g_error("crc32c_init_pclmul is not defined");
+}
+
+void crc32c_add_pclmul(
+    uint8_t *buf G_GNUC_UNUSED,
+    size_t len G_GNUC_UNUSED,
+    crc_t *crc G_GNUC_UNUSED)
+{
+   g_error("crc32c_add_pclmul is not defined");
+}
+
+#endif
@@ -1208,6 +1208,9 @@ set_message(
 	msg = "%{hostname} %{diskname}: holdingdisk NEVER with tags matching more than one storage, will be dumped to only one storage";
     } else if (message->code == 2800235) {
 	msg  = "program %{program}: wrong permission, must be 'rwsr-x---'";
+    } else if (message->code == 2800236) {
+	msg  = "info database '%{infodb}' (%{errnostr}): not readable and writable";
+	hint = "check permissions";
     } else if (message->code == 2900000) {
 	msg = "The Application '%{application}' failed: %{errmsg}";
     } else if (message->code == 2900001) {
@@ -1482,6 +1485,8 @@ set_message(
 	msg = "Invalid '%{command-options}' COMMAND-OPTIONS";
     } else if (message->code == 3700015) {
 	msg = "bad DAR property value '%{property_value}'";
+    } else if (message->code == 3700016) {
+	msg = "bad STREAMS property value '%{value}'";
 
     } else if (message->code == 3701000) {
 	msg = "%{disk}";
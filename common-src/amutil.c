@@ -43,6 +43,7 @@
 #include <string.h>
 #include "fsusage.h"
 #include "ammessage.h"
+#include <poll.h>
 
 GMutex *priv_mutex = NULL;
 static int make_socket(sa_family_t family);
@@ -69,12 +70,6 @@ make_socket(
         errno = save_errno;
         return -1;
     }
-    if (s < 0 || s >= (int)FD_SETSIZE) {
-        aclose(s);
-        errno = EMFILE;                         /* out of range */
-        return -1;
-    }
-
     g_debug("make_socket opening socket with family %d: %d", family, s);
 #ifdef USE_REUSEADDR
     r = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
@@ -636,17 +631,14 @@ interruptible_accept(
     gpointer prolong_data,
     time_t timeout)
 {
-    SELECT_ARG_TYPE readset;
-    struct timeval tv;
+    struct pollfd pfd;
     int nfound;
 
-    if (sock < 0 || sock >= FD_SETSIZE) {
+    if (sock < 0) {
 	g_debug("interruptible_accept: bad socket %d", sock);
 	return EBADF;
     }
 
-    memset(&readset, 0, sizeof(readset));
-
     while (1) {
 	if (prolong && !prolong(prolong_data)) {
 	    errno = 0;
@@ -657,20 +649,18 @@ interruptible_accept(
 	    return -1;
 	}
 
-	FD_ZERO(&readset);
-	FD_SET(sock, &readset);
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
 
 	/* try accepting for 1s */
-	memset(&tv, 0, sizeof(tv));
-	tv.tv_sec = 1;
-
-	nfound = select(sock+1, &readset, NULL, NULL, &tv);
+	nfound = poll(&pfd, 1, 1000);
 	if (nfound < 0) {
 	    return -1;
 	} else if (nfound == 0) {
 	    continue;
-	} else if (!FD_ISSET(sock, &readset)) {
-	    g_debug("interruptible_accept: select malfunction");
+	} else if (pfd.revents & POLLNVAL) {
+	    g_debug("interruptible_accept: bad socket %d", sock);
 	    errno = EBADF;
 	    return -1;
 	} else {
@@ -2169,44 +2159,178 @@ make_amanda_tmpdir(void)
 
 #define POLY 0x82F63B78
 #if defined __x86_64__ || defined __i386__ || defined __i486__ || defined __i586__ || defined __i686__
-static int get_sse42(void)
+static void
+get_cpuid(
+    uint32_t op,
+    uint32_t subop,
+    uint32_t *eax,
+    uint32_t *ebx,
+    uint32_t *ecx,
+    uint32_t *edx)
 {
-    uint32_t op, eax, ebx, ecx, edx;
-    op = 1;
 #ifdef __i386__
     __asm__ volatile(
 		"pushl %%ebx;\n\t"
 		"cpuid;\n\t"
 		"movl %%ebx, %1;\n\t"
 		"popl %%ebx;\n\t"
-                : "=a" (eax), "=r" (ebx), "=c" (ecx), "=d" (edx)
-		: "a" (op)
+                : "=a" (*eax), "=r" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "a" (op), "c" (subop)
 		: "cc"
     );
 #else
     __asm__ volatile(
 		"cpuid;\n\t"
-                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-		: "a" (op)
+                : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx)
+		: "a" (op), "c" (subop)
 		: "cc"
     );
 #endif
+}
+
+static int get_sse42(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    get_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
     return (ecx >> 20) & 1;
 }
+
+static int get_pclmul(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    get_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return (ecx >> 1) & 1;
+}
+
+/* AVX-512 needs both the cpu flags and the OS saving the zmm/opmask state */
+static int get_avx512(void)
+{
+#ifdef __x86_64__
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t xcr0_lo, xcr0_hi;
+
+    get_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 7)
+	return 0;
+    get_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!((ecx >> 27) & 1))		/* OSXSAVE */
+	return 0;
+    __asm__ volatile(
+		"xgetbv;\n\t"
+		: "=a" (xcr0_lo), "=d" (xcr0_hi)
+		: "c" (0)
+    );
+    if ((xcr0_lo & 0xE6) != 0xE6)
+	return 0;
+    get_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    return ((ebx >> 16) & 1) &&		/* AVX512F */
+	   ((ecx >> 10) & 1);		/* VPCLMULQDQ */
+#else
+    return 0;
+#endif
+}
+
+/* the xsave state enabled by the OS, see get_avx512 */
+static uint32_t get_xcr0(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+    uint32_t xcr0_lo, xcr0_hi;
+
+    get_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 7)
+	return 0;
+    get_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!((ecx >> 27) & 1))		/* OSXSAVE */
+	return 0;
+    __asm__ volatile(
+		"xgetbv;\n\t"
+		: "=a" (xcr0_lo), "=d" (xcr0_hi)
+		: "c" (0)
+    );
+    return xcr0_lo;
+}
+
+gboolean
+cpu_has_avx2(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if ((get_xcr0() & 0x06) != 0x06)
+	return FALSE;
+    get_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    return (ebx >> 5) & 1;
+}
+
+gboolean
+cpu_has_avx512f(void)
+{
+#ifdef __x86_64__
+    uint32_t eax, ebx, ecx, edx;
+
+    if ((get_xcr0() & 0xE6) != 0xE6)
+	return FALSE;
+    get_cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+    return (ebx >> 16) & 1;
+#else
+    return FALSE;
+#endif
+}
 #else
 static int get_sse42(void)
 {
     return 0;
 }
+
+static int get_pclmul(void)
+{
+    return 0;
+}
+
+static int get_avx512(void)
+{
+    return 0;
+}
+
+gboolean
+cpu_has_avx2(void)
+{
+    return FALSE;
+}
+
+gboolean
+cpu_has_avx512f(void)
+{
+    return FALSE;
+}
 #endif
 
 static uint32_t crc_table[16][256];
+static uint32_t crc_x2n_table[64];
 static gboolean crc_initialized = FALSE;
 gboolean have_sse42 = FALSE;
+gboolean have_pclmul = FALSE;
+gboolean have_avx512 = FALSE;
 void (* crc32_function)(uint8_t *buf, size_t len, crc_t *crc);
+static const char *crc32_function_name;
 
   #include "amcrc32chw.h"
 
+/* All implementations of crc32_add, from the slowest to the fastest.  The
+ * fastest one available on this cpu is selected by make_crc_table. */
+static struct {
+    const char *name;
+    void (* function)(uint8_t *buf, size_t len, crc_t *crc);
+    gboolean *available;
+} crc32_impls[] = {
+    { "slice-by-16", &crc32_add_16bytes, NULL },
+    { "sse4.2", &crc32c_add_hw, &have_sse42 },
+    { "pclmul", &crc32c_add_pclmul, &have_pclmul },
+    { "avx512", &crc32c_add_avx512, &have_avx512 },
+    { NULL, NULL, NULL }
+};
+
 /* Run this function previously */
 void
 make_crc_table(void)
@@ -2214,18 +2338,9 @@ make_crc_table(void)
     int i;
     int j;
     int slice;
+    uint32_t p;
 
     if (!crc_initialized) {
-	if (compiled_with_sse4_2) {
-	    have_sse42 = get_sse42();
-	}
-	if (have_sse42) {
-	    crc32c_init_hw();
-	    crc32_function = &crc32c_add_hw;
-	} else {
-            crc32_function = &crc32_add_16bytes;
-	}
-
         for (i = 0; i < 256; i++) {
             uint32_t c = i;
             for (j = 0; j < 8; j++) {
@@ -2238,6 +2353,35 @@ make_crc_table(void)
 		crc_table[slice][i] = (crc_table[slice - 1][i] >> 8) ^ crc_table[0][crc_table[slice - 1][i] & 0xFF];
 	    }
 	}
+
+	/* x^(2^n) mod POLY, for crc32_combine and the folding constants */
+	p = (uint32_t)1 << 30;		/* x^1 */
+	crc_x2n_table[0] = p;
+	for (i = 1; i < 64; i++) {
+	    crc_x2n_table[i] = p = crc32c_multmodp(p, p);
+	}
+
+	if (compiled_with_sse4_2) {
+	    have_sse42 = get_sse42();
+	}
+	if (have_sse42) {
+	    crc32c_init_hw();
+	    if (compiled_with_pclmul && get_pclmul()) {
+		have_pclmul = TRUE;
+		crc32c_init_pclmul();
+		if (compiled_with_avx512 && get_avx512()) {
+		    have_avx512 = TRUE;
+		    crc32c_init_avx512();
+		}
+	    }
+	}
+
+	for (i = 0; crc32_impls[i].name != NULL; i++) {
+	    if (!crc32_impls[i].available || *crc32_impls[i].available) {
+		crc32_function = crc32_impls[i].function;
+		crc32_function_name = crc32_impls[i].name;
+	    }
+	}
         crc_initialized = TRUE;
     }
 }
@@ -2369,6 +2513,101 @@ crc32_finish(
     return crc->crc ^ 0xFFFFFFFF;
 }
 
+/* Multiply a and b modulo POLY; both are bit-reflected, x^0 is 0x80000000. */
+uint32_t
+crc32c_multmodp(
+    uint32_t a,
+    uint32_t b)
+{
+    uint32_t m = (uint32_t)1 << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+	if (a & m) {
+	    p ^= b;
+	    if ((a & (m - 1)) == 0)
+		break;
+	}
+	m >>= 1;
+	b = (b & 1) ? (b >> 1) ^ POLY : b >> 1;
+    }
+    return p;
+}
+
+/* Return x^n modulo POLY */
+uint32_t
+crc32c_xnmodp(
+    guint64 n)
+{
+    uint32_t p = (uint32_t)1 << 31;	/* x^0 */
+    int k = 0;
+
+    while (n) {
+	if (n & 1)
+	    p = crc32c_multmodp(crc_x2n_table[k % 64], p);
+	n >>= 1;
+	k++;
+    }
+    return p;
+}
+
+void
+crc32_combine(
+    crc_t *crc1,
+    crc_t *crc2)
+{
+    uint32_t c1 = crc32_finish(crc1);
+    uint32_t c2 = crc32_finish(crc2);
+
+    make_crc_table();
+    if (crc2->size == 0)
+	return;
+    c1 = crc32c_multmodp(crc32c_xnmodp((guint64)crc2->size * 8), c1) ^ c2;
+    crc1->crc = c1 ^ 0xFFFFFFFF;
+    crc1->size += crc2->size;
+}
+
+const char *
+crc32_get_implementation(void)
+{
+    make_crc_table();
+    return crc32_function_name;
+}
+
+GPtrArray *
+crc32_get_implementations(void)
+{
+    GPtrArray *impls = g_ptr_array_new();
+    int i;
+
+    make_crc_table();
+    for (i = 0; crc32_impls[i].name != NULL; i++) {
+	if (!crc32_impls[i].available || *crc32_impls[i].available) {
+	    g_ptr_array_add(impls, (gpointer)crc32_impls[i].name);
+	}
+    }
+    return impls;
+}
+
+gboolean
+crc32_set_implementation(
+    const char *name)
+{
+    int i;
+
+    make_crc_table();
+    for (i = 0; crc32_impls[i].name != NULL; i++) {
+	if (g_str_equal(crc32_impls[i].name, name)) {
+	    if (crc32_impls[i].available && !*crc32_impls[i].available)
+		return FALSE;
+	    crc32_function = crc32_impls[i].function;
+	    crc32_function_name = crc32_impls[i].name;
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
 void
 parse_crc(
     char *s,
@@ -433,14 +433,34 @@ typedef struct crc_s {
 } crc_t;
 
 extern int have_sse42;
+extern int have_pclmul;
+extern int have_avx512;
 void make_crc_table(void);
 void crc32_init(crc_t *crc);
 void crc32_add_1byte(uint8_t *buf, size_t len, crc_t *crc);
 void crc32_add_16bytes(uint8_t *buf, size_t len, crc_t *crc);
 void crc32_add(uint8_t *buf, size_t len, crc_t *crc);
 uint32_t crc32_finish(crc_t *crc);
+
+/* Append the data checksummed in crc2 to crc1, as if crc32_add had been
+ * called on crc1 with the data of crc2.  Both must have been started with
+ * crc32_init. */
+void crc32_combine(crc_t *crc1, crc_t *crc2);
+
+/* The crc32_add implementations ("slice-by-16", "sse4.2", "pclmul",
+ * "avx512").  make_crc_table selects the fastest one this cpu supports;
+ * crc32_set_implementation returns FALSE if NAME is unknown or unsupported.
+ * The array returned by crc32_get_implementations must be freed with
+ * g_ptr_array_free(impls, TRUE); the strings are static. */
+const char *crc32_get_implementation(void);
+GPtrArray *crc32_get_implementations(void);
+gboolean crc32_set_implementation(const char *name);
 void parse_crc(char *s, crc_t *crc);
 
+/* TRUE if the cpu and the OS support these instructions sets */
+gboolean cpu_has_avx2(void);
+gboolean cpu_has_avx512f(void);
+
 gint64 get_fsusage(char *dir);
 void get_platform_and_distro(char **r_platform, char **r_distro);
 char *get_platform(void);
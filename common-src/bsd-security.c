@@ -747,26 +747,26 @@ ring_failed:
 	bsd_stream_read_cancel(bs);
 	bs->shm_ring->mc->cancelled = TRUE;
 	bs->shm_ring->mc->eof_flag = TRUE;
-	sem_post(bs->shm_ring->sem_read);
-	sem_post(bs->shm_ring->sem_read);
-	sem_post(bs->shm_ring->sem_write);
+	shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_read);
+	shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_read);
+	shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_write);
 	auth_debug(1, _("bsd_stream_read_to_shm_ring_callback: C return(-1)\n"));
     } else if (n == 0) {
 	bsd_stream_read_cancel(bs);
 	bs->shm_ring->mc->eof_flag = TRUE;
-	sem_post(bs->shm_ring->sem_read);
-	sem_post(bs->shm_ring->sem_read);
+	shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_read);
+	shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_read);
     } else {
 	if (bs->shm_ring->mc->written == 0 && bs->shm_ring->mc->need_sem_ready) {
-	    sem_post(bs->shm_ring->sem_ready);
+	    shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_ready);
 	    if (shm_ring_sem_wait(bs->shm_ring, bs->shm_ring->sem_start) != 0) {
 		security_stream_seterror(&bs->secstr, "%s", strerror(errno));
 		bsd_stream_read_cancel(bs);
 		bs->shm_ring->mc->cancelled = TRUE;
 		bs->shm_ring->mc->eof_flag = TRUE;
-		sem_post(bs->shm_ring->sem_read);
-		sem_post(bs->shm_ring->sem_read);
-		sem_post(bs->shm_ring->sem_write);
+		shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_read);
+		shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_read);
+		shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_write);
 		auth_debug(1, _("bsd_stream_read_to_shm_ring_callback: D return(-1)\n"));
 		goto shm_failed;
 	    }
@@ -777,7 +777,7 @@ ring_failed:
 	}
 	bs->shm_ring->mc->write_offset = write_offset;
 	bs->shm_ring->mc->written += n;
-	sem_post(bs->shm_ring->sem_read);
+	shm_ring_sem_post(bs->shm_ring, bs->shm_ring->sem_read);
     }
 
 shm_failed:
@@ -36,6 +36,7 @@
 #include "amutil.h"
 #include "conffile.h"
 #include "clock.h"
+#include "shm-ring.h"
 #include <glib.h>
 
 /*
@@ -102,7 +103,8 @@ typedef enum {
     /* storage setting */
     CONF_SET_NO_REUSE,	       CONF_ERASE_VOLUME,
     CONF_ERASE_ON_FAILURE,     CONF_COMPRESS_INDEX,	CONF_SORT_INDEX,
-    CONF_ERASE_ON_FULL,
+    CONF_ERASE_ON_FULL,        CONF_HOLDING_DIRECT_IO,
+    CONF_HOLDING_READ_AHEAD,   CONF_ESTIMATE_PARALLEL,
 
     /* execute on */
     CONF_PRE_AMCHECK,          CONF_POST_AMCHECK,
@@ -144,6 +146,7 @@ typedef enum {
     CONF_SSL_CA_CERT_FILE,	CONF_SSL_CIPHER_LIST,	CONF_SSL_CHECK_HOST,
     CONF_SSL_CHECK_CERTIFICATE_HOST,			CONF_SSL_DIR,
     CONF_SSL_CHECK_FINGERPRINT,
+    CONF_SHM_RING_SIZE,		CONF_SHM_RING_HUGE_PAGES,
 
     /* tape type */
     /*COMMENT,*/		CONF_BLOCKSIZE,
@@ -690,6 +693,7 @@ static void validate_positive(conf_var_t *, val_t *);
 static void validate_runspercycle(conf_var_t *, val_t *);
 static void validate_bumppercent(conf_var_t *, val_t *);
 static void validate_bumpmult(conf_var_t *, val_t *);
+static void validate_shm_ring_size(conf_var_t *, val_t *);
 static void validate_displayunit(conf_var_t *, val_t *);
 static void validate_reserve(conf_var_t *, val_t *);
 static void validate_use(conf_var_t *, val_t *);
@@ -1094,6 +1098,7 @@ keytab_t server_keytab[] = {
     { "ENCRYPT", CONF_ENCRYPT },
     { "ERROR", CONF_ERROR },
     { "ESTIMATE", CONF_ESTIMATE },
+    { "ESTIMATE_PARALLEL", CONF_ESTIMATE_PARALLEL },
     { "ETIMEOUT", CONF_ETIMEOUT },
     { "EXCLUDE", CONF_EXCLUDE },
     { "EXCLUDE_FILE", CONF_EXCLUDE_FILE },
@@ -1111,6 +1116,8 @@ keytab_t server_keytab[] = {
     { "HIDDEN", CONF_HIDDEN },
     { "HIGH", CONF_HIGH },
     { "HOLDINGDISK", CONF_HOLDING },
+    { "HOLDING_DIRECT_IO", CONF_HOLDING_DIRECT_IO },
+    { "HOLDING_READ_AHEAD", CONF_HOLDING_READ_AHEAD },
     { "IGNORE", CONF_IGNORE },
     { "INCLUDE", CONF_INCLUDE },
     { "INCLUDEFILE", CONF_INCLUDEFILE },
@@ -1221,6 +1228,8 @@ keytab_t server_keytab[] = {
     { "SERVER_DECRYPT_OPTION", CONF_SRV_DECRYPT_OPT },
     { "SERVER_ENCRYPT", CONF_SRV_ENCRYPT },
     { "SET_NO_REUSE", CONF_SET_NO_REUSE },
+    { "SHM_RING_HUGE_PAGES", CONF_SHM_RING_HUGE_PAGES },
+    { "SHM_RING_SIZE", CONF_SHM_RING_SIZE },
     { "SKIP", CONF_SKIP },
     { "SKIP_FULL", CONF_SKIP_FULL },
     { "SKIP_INCR", CONF_SKIP_INCR },
@@ -1512,6 +1521,9 @@ conf_var_t server_var [] = {
    { CONF_SSL_DIR              , CONFTYPE_STR      , read_str         , CNF_SSL_DIR              , NULL },
    { CONF_COMPRESS_INDEX       , CONFTYPE_BOOLEAN  , read_bool        , CNF_COMPRESS_INDEX       , NULL },
    { CONF_SORT_INDEX           , CONFTYPE_BOOLEAN  , read_bool        , CNF_SORT_INDEX           , NULL },
+   { CONF_HOLDING_DIRECT_IO    , CONFTYPE_BOOLEAN  , read_bool        , CNF_HOLDING_DIRECT_IO    , NULL },
+   { CONF_HOLDING_READ_AHEAD   , CONFTYPE_SIZE     , read_size        , CNF_HOLDING_READ_AHEAD   , NULL },
+   { CONF_ESTIMATE_PARALLEL    , CONFTYPE_INT      , read_int         , CNF_ESTIMATE_PARALLEL    , validate_nonnegative },
    { CONF_UNKNOWN              , CONFTYPE_INT      , NULL             , CNF_CNF                  , NULL }
 };
 
@@ -1588,6 +1600,8 @@ conf_var_t dumptype_var [] = {
    { CONF_SSL_CHECK_HOST            , CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_SSL_CHECK_HOST            , NULL },
    { CONF_SSL_CHECK_CERTIFICATE_HOST, CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_SSL_CHECK_CERTIFICATE_HOST, NULL },
    { CONF_SSL_CHECK_FINGERPRINT     , CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_SSL_CHECK_FINGERPRINT     , NULL },
+   { CONF_SHM_RING_SIZE             , CONFTYPE_INT64       , read_int64       , DUMPTYPE_SHM_RING_SIZE             , validate_shm_ring_size },
+   { CONF_SHM_RING_HUGE_PAGES       , CONFTYPE_BOOLEAN     , read_bool        , DUMPTYPE_SHM_RING_HUGE_PAGES       , NULL },
    { CONF_UNKNOWN                   , CONFTYPE_INT         , NULL             , DUMPTYPE_DUMPTYPE                  , NULL }
 };
 
@@ -2736,6 +2750,8 @@ init_dumptype_defaults(void)
     conf_init_host_limit_server(&dpcur.value[DUMPTYPE_DUMP_LIMIT]);
     conf_init_int      (&dpcur.value[DUMPTYPE_RETRY_DUMP]        , CONF_UNIT_NONE, 2);
     conf_init_str_list (&dpcur.value[DUMPTYPE_TAG]               , NULL);
+    conf_init_int64    (&dpcur.value[DUMPTYPE_SHM_RING_SIZE]     , CONF_UNIT_K, (gint64)0);
+    conf_init_bool     (&dpcur.value[DUMPTYPE_SHM_RING_HUGE_PAGES], 0);
 }
 
 static void
@@ -5967,6 +5983,17 @@ validate_bumppercent(
 	conf_parserror(_("bumppercent must be between 0 and 100"));
 }
 
+static void
+validate_shm_ring_size(
+    struct conf_var_s *np G_GNUC_UNUSED,
+    val_t        *val)
+{
+    if (val_t__int64(val) < 0 ||
+	val_t__int64(val) > (gint64)(SHM_RING_MAX_SIZE / 1024))
+	conf_parserror(_("shm-ring-size must be between 0 and %lld Kbytes"),
+		       (long long)(SHM_RING_MAX_SIZE / 1024));
+}
+
 static void
 validate_bumpmult(
     struct conf_var_s *np G_GNUC_UNUSED,
@@ -6688,6 +6715,9 @@ init_defaults(
     conf_init_str_list (&conf_data[CNF_REPORT_FORMAT]        , NULL);
     conf_init_bool     (&conf_data[CNF_COMPRESS_INDEX]       , TRUE);
     conf_init_bool     (&conf_data[CNF_SORT_INDEX]           , FALSE);
+    conf_init_bool     (&conf_data[CNF_HOLDING_DIRECT_IO]    , FALSE);
+    conf_init_size     (&conf_data[CNF_HOLDING_READ_AHEAD]   , CONF_UNIT_NONE, 32*DISK_BLOCK_BYTES);
+    conf_init_int      (&conf_data[CNF_ESTIMATE_PARALLEL]    , CONF_UNIT_NONE, 0);
     conf_init_str      (&conf_data[CNF_TMPDIR]               , AMANDA_TMPDIR);
     conf_init_identlist(&conf_data[CNF_ACTIVE_STORAGE]       , NULL);
     conf_init_identlist(&conf_data[CNF_STORAGE]              , NULL);
@@ -585,6 +585,9 @@ typedef enum {
     CNF_CMDFILE,
     CNF_COMPRESS_INDEX,
     CNF_SORT_INDEX,
+    CNF_HOLDING_DIRECT_IO,
+    CNF_HOLDING_READ_AHEAD,
+    CNF_ESTIMATE_PARALLEL,
     CNF_REST_API_PORT,
     CNF_REST_SSL_CERT,
     CNF_REST_SSL_KEY,
@@ -843,6 +846,8 @@ typedef enum {
     DUMPTYPE_SSL_CHECK_HOST,
     DUMPTYPE_SSL_CHECK_CERTIFICATE_HOST,
     DUMPTYPE_SSL_CHECK_FINGERPRINT,
+    DUMPTYPE_SHM_RING_SIZE,
+    DUMPTYPE_SHM_RING_HUGE_PAGES,
     DUMPTYPE_DUMPTYPE /* sentinel */
 } dumptype_key;
 
@@ -947,6 +952,8 @@ char *dumptype_key_to_name(int parm);
 #define dumptype_get_ssl_check_host(dtyp)       (val_t_to_boolean(dumptype_getconf((dtyp), DUMPTYPE_SSL_CHECK_HOST)))
 #define dumptype_get_ssl_check_certificate_host(dtyp) (val_t_to_boolean(dumptype_getconf((dtyp), DUMPTYPE_SSL_CHECK_CERTIFICATE_HOST)))
 #define dumptype_get_ssl_check_fingerprint(dtyp)(val_t_to_boolean(dumptype_getconf((dtyp), DUMPTYPE_SSL_CHECK_FINGERPRINT)))
+#define dumptype_get_shm_ring_size(dtyp)       (val_t_to_int64(dumptype_getconf((dtyp), DUMPTYPE_SHM_RING_SIZE)))
+#define dumptype_get_shm_ring_huge_pages(dtyp) (val_t_to_boolean(dumptype_getconf((dtyp), DUMPTYPE_SHM_RING_HUGE_PAGES)))
 
 /*
  * Interface parameter access
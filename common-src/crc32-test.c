@@ -49,47 +49,143 @@ test_size(
 {
     crc_t crc1;
     crc_t crc16;
-#ifdef __SSE4_2__
-    crc_t crchw;
-#endif
+    GPtrArray *impls = crc32_get_implementations();
+    int result = TRUE;
+    guint i;
 
     crc32_init(&crc1);
     crc32_init(&crc16);
-#ifdef __SSE4_2__
-    crc32_init(&crchw);
-#endif
 
     crc32_add_1byte(test_buf, size, &crc1);
     crc32_add_16bytes(test_buf, size, &crc16);
-#ifdef __SSE4_2__
-    if (have_sse42) {
-	crc32c_add_hw(test_buf, size, &crchw);
-    }
-#endif
 
-#ifdef __SSE4_2__
-    g_fprintf(stderr, " %08x:%lld  %08x:%lld  %08x:%lld\n", crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc16), (long long)crc16.size, crc32_finish(&crchw), (long long)crchw.size);
-#else
-    g_fprintf(stderr, " %08x:%lld  %08x:%lld\n", crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc16), (long long)crc16.size);
-#endif
+    g_fprintf(stderr, " %08x:%lld  %08x:%lld", crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc16), (long long)crc16.size);
 
     if (crc1.crc != crc16.crc ||
 	crc1.size != crc16.size) {
-	g_fprintf(stderr, " CRC16 %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc16), (long long)crc16.size);
-	return FALSE;
+	g_fprintf(stderr, "\n CRC16 %zu %08x:%lld != %08x:%lld", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc16), (long long)crc16.size);
+	result = FALSE;
+    }
+
+    /* every implementation available on this cpu, through crc32_add */
+    for (i = 0; i < impls->len; i++) {
+	char *name = g_ptr_array_index(impls, i);
+	crc_t crc;
+
+	crc32_set_implementation(name);
+	crc32_init(&crc);
+	crc32_add(test_buf, size, &crc);
+	g_fprintf(stderr, "  %08x:%lld", crc32_finish(&crc), (long long)crc.size);
+	if (crc1.crc != crc.crc ||
+	    crc1.size != crc.size) {
+	    g_fprintf(stderr, "\n CRC %s %zu %08x:%lld != %08x:%lld", name, size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc), (long long)crc.size);
+	    result = FALSE;
+	}
     }
-#ifdef __SSE4_2__
-    if (have_sse42) {
-	if (crc1.crc != crchw.crc ||
-	    crc1.size != crchw.size) {
-	    g_fprintf(stderr, " CRChw %zu %08x:%lld != %08x:%lld\n", size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crchw), (long long)crchw.size);
+    g_fprintf(stderr, "\n");
+
+    g_ptr_array_free(impls, TRUE);
+    return result;
+}
+
+/* checksum the buffer in two pieces and combine them */
+static int
+test_combine(
+    size_t size)
+{
+    crc_t crc1;
+    crc_t crc_a;
+    crc_t crc_b;
+    size_t split;
+
+    crc32_init(&crc1);
+    crc32_add_1byte(test_buf, size, &crc1);
+
+    for (split = 0; split <= size; split += size / 7 + 1) {
+	crc32_init(&crc_a);
+	crc32_init(&crc_b);
+	crc32_add(test_buf, split, &crc_a);
+	crc32_add(test_buf + split, size - split, &crc_b);
+	crc32_combine(&crc_a, &crc_b);
+	if (crc1.crc != crc_a.crc ||
+	    crc1.size != crc_a.size) {
+	    g_fprintf(stderr, " COMBINE %zu/%zu %08x:%lld != %08x:%lld\n", split, size, crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc_a), (long long)crc_a.size);
 	    return FALSE;
 	}
     }
-#endif
     return TRUE;
 }
 
+/* combine with a second piece of 512MB or more, where x^(8*size) needs more
+ * than 32 squarings; the data is the test buffer repeated, so nothing that
+ * large is allocated */
+static int
+test_combine_large(void)
+{
+    crc_t crc1;
+    crc_t crc_a;
+    crc_t crc_b;
+    size_t i;
+
+    crc32_init(&crc1);
+    crc32_init(&crc_a);
+    crc32_init(&crc_b);
+    for (i = 0; i < 600 * 32; i++) {	/* 600 * 32 * 32768 bytes */
+	crc32_add(test_buf, 32768, &crc1);
+	if (i < 3 * 32) {
+	    crc32_add(test_buf, 32768, &crc_a);
+	} else {
+	    crc32_add(test_buf, 32768, &crc_b);
+	}
+    }
+    crc32_combine(&crc_a, &crc_b);
+    if (crc1.crc != crc_a.crc ||
+	crc1.size != crc_a.size) {
+	g_fprintf(stderr, " COMBINE large %08x:%lld != %08x:%lld\n", crc32_finish(&crc1), (long long)crc1.size, crc32_finish(&crc_a), (long long)crc_a.size);
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/* report the throughput of each implementation, in GB/s */
+static void
+bench(
+    size_t mbytes)
+{
+    GPtrArray *impls = crc32_get_implementations();
+    size_t bufsize = 32768;
+    size_t iter = mbytes * 1024 * 1024 / bufsize;
+    uint8_t *buf = g_malloc(bufsize);
+    guint i;
+    size_t j;
+
+    for (j = 0; j < bufsize; j++) {
+	buf[j] = rand();
+    }
+
+    for (i = 0; i < impls->len; i++) {
+	char *name = g_ptr_array_index(impls, i);
+	GTimer *timer;
+	gdouble elapsed;
+	crc_t crc;
+
+	crc32_set_implementation(name);
+	crc32_init(&crc);
+	timer = g_timer_new();
+	for (j = 0; j < iter; j++) {
+	    crc32_add(buf, bufsize, &crc);
+	}
+	elapsed = g_timer_elapsed(timer, NULL);
+	g_timer_destroy(timer);
+
+	g_fprintf(stdout, "%-12s %08x %8.2f GB/s\n", name, crc32_finish(&crc),
+		  elapsed > 0 ? (gdouble)crc.size / elapsed / 1e9 : 0.0);
+    }
+
+    g_free(buf);
+    g_ptr_array_free(impls, TRUE);
+}
+
 
 /*
  * Main driver
@@ -97,8 +193,8 @@ test_size(
 
 int
 main(
-    int    argc G_GNUC_UNUSED,
-    char **argv G_GNUC_UNUSED)
+    int    argc,
+    char **argv)
 {
     int i;
     int nb_error = 0;
@@ -106,10 +202,23 @@ main(
     make_crc_table();
     init_test_buf();
 
+    /* crc32-test --bench [MB]: benchmark instead of testing */
+    if (argc > 1 && g_str_equal(argv[1], "--bench")) {
+	bench(argc > 2 ? (size_t)atoi(argv[2]) : 1024);
+	return 0;
+    }
+
+    g_fprintf(stderr, " using %s\n", crc32_get_implementation());
     for (i=0; size_of_test[i] != 0; i++) {
 	if (!test_size(size_of_test[i])) {
 	    nb_error++;
 	}
+	if (!test_combine(size_of_test[i])) {
+	    nb_error++;
+	}
+    }
+    if (!test_combine_large()) {
+	nb_error++;
     }
     if (nb_error) {
 	g_fprintf(stderr, " FAIL CRC \n");
@@ -36,15 +36,15 @@
 #include "amutil.h"
 #include "conffile.h"
 #include "sockaddr-util.h"
+#include <poll.h>
 
 void
 dgram_socket(
     dgram_t *	dgram,
     int		socket)
 {
-    if(socket < 0 || socket >= (int)FD_SETSIZE) {
-	error(_("dgram_socket: socket %d out of range (0 .. %d)\n"),
-	      socket, (int)FD_SETSIZE-1);
+    if(socket < 0) {
+	error(_("dgram_socket: bad socket %d\n"), socket);
         /*NOTREACHED*/
     }
     dgram->socket = socket;
@@ -77,14 +77,6 @@ dgram_bind(
 	errno = save_errno;
 	return -1;
     }
-    if(s < 0 || s >= (int)FD_SETSIZE) {
-	dbprintf(_("dgram_bind: socket out of range: %d\n"),
-		  s);
-	aclose(s);
-	errno = EMFILE;				/* out of range */
-	return -1;
-    }
-
     /* try setting the buffer size (= maximum allowable UDP packet size) */
     if (setsockopt(s, SOL_SOCKET, SO_SNDBUF,
 		   (void *) &sndbufsize, sizeof(sndbufsize)) < 0) {
@@ -203,9 +195,9 @@ dgram_send_addr(
 	}
     }
 
-    if(s < 0 || s >= (int)FD_SETSIZE) {
-	dbprintf(_("dgram_send_addr: socket out of range: %d\n"), s);
-	errno = EMFILE;				/* out of range */
+    if(s < 0) {
+	dbprintf(_("dgram_send_addr: bad socket: %d\n"), s);
+	errno = EBADF;
 	rc = -1;
     } else {
 	max_wait = 300 / 5;				/* five minutes */
@@ -270,8 +262,7 @@ dgram_recv(
     int			timeout,
     sockaddr_union *fromaddr)
 {
-    SELECT_ARG_TYPE ready;
-    struct timeval to;
+    struct pollfd pfd;
     ssize_t size;
     int sock;
     socklen_t_equiv addrlen;
@@ -280,33 +271,26 @@ dgram_recv(
 
     sock = dgram->socket;
 
-    FD_ZERO(&ready);
-    FD_SET(sock, &ready);
-    to.tv_sec = timeout;
-    to.tv_usec = 0;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
 
     dbprintf(_("dgram_recv(dgram=%p, timeout=%u, fromaddr=%p socket=%d)\n"),
 		dgram, timeout, fromaddr, sock);
     
-    nfound = (ssize_t)select(sock+1, &ready, NULL, NULL, &to);
-    if(nfound <= 0 || !FD_ISSET(sock, &ready)) {
+    nfound = (ssize_t)poll(&pfd, 1, timeout * 1000);
+    if(nfound <= 0 || (pfd.revents & POLLNVAL)) {
 	save_errno = errno;
 	if(nfound < 0) {
-	    dbprintf(_("dgram_recv: select() failed: %s\n"), strerror(save_errno));
+	    dbprintf(_("dgram_recv: poll() failed: %s\n"), strerror(save_errno));
 	} else if(nfound == 0) {
 	    dbprintf(plural(_("dgram_recv: timeout after %d second\n"),
 			    _("dgram_recv: timeout after %d seconds\n"),
 			    timeout),
 		     timeout);
 	    nfound = 0;
-	} else if (!FD_ISSET(sock, &ready)) {
-	    int i;
-
-	    for(i = 0; i < sock + 1; i++) {
-		if(FD_ISSET(i, &ready)) {
-		    dbprintf(_("dgram_recv: got fd %d instead of %d\n"), i, sock);
-		}
-	    }
+	} else {
+	    dbprintf(_("dgram_recv: bad socket %d\n"), sock);
 	    save_errno = EBADF;
 	    nfound = -1;
 	}
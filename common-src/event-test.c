@@ -640,6 +640,267 @@ test_child_watch_source(void)
     return test_child_watch_result;
 }
 
+/****
+ * Stress the event loop with many fds, EV_WAIT ids and timers at once.  The
+ * fds go well past FD_SETSIZE.
+ */
+
+typedef struct stress_s {
+    int npairs;
+    int *rfd;			/* read ends, under EV_READFD */
+    int *wfd;			/* write ends */
+    event_handle_t **ev;
+    event_handle_t *round_done;	/* EV_WAIT, released when a round is read */
+    int remaining;		/* bytes left to read in this round */
+    int fired;
+} stress_t;
+
+static stress_t *stress_cur;
+
+static void
+stress_fd_cb(void *up)
+{
+    int idx = GPOINTER_TO_INT(up);
+    stress_t *st = stress_cur;
+    char buf[16];
+
+    if (read(st->rfd[idx], buf, sizeof(buf)) <= 0)
+	return;
+    if (--st->remaining == 0)
+	event_release(st->round_done);
+}
+
+static void
+stress_count_cb(void *up G_GNUC_UNUSED)
+{
+    stress_cur->fired++;
+}
+
+static void
+stress_timer_cb(void *up)
+{
+    int idx = GPOINTER_TO_INT(up);
+
+    stress_cur->fired++;
+    event_release(stress_cur->ev[idx]);
+}
+
+/* Raise the fd limit as far as it goes; returns the number of socketpairs
+ * that fit, up to want */
+static int
+stress_fd_limit(int want)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+	return 0;
+    if (rl.rlim_cur != RLIM_INFINITY &&
+	(rl.rlim_max == RLIM_INFINITY || rl.rlim_cur < rl.rlim_max)) {
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+	getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    if (rl.rlim_cur == RLIM_INFINITY)
+	return want;
+    return min(want, ((int)rl.rlim_cur - 64) / 2);
+}
+
+/* Read one byte from each of npairs (or only a few, if sparse) socketpairs,
+ * rounds times; then fire npairs EV_WAIT ids and npairs timers. */
+static gboolean
+stress(int npairs, int rounds, gboolean report)
+{
+    stress_t st;
+    GTimer *timer;
+    int i, r;
+    gboolean ok = TRUE;
+
+    memset(&st, 0, sizeof(st));
+    st.npairs = npairs;
+    st.rfd = g_new0(int, npairs);
+    st.wfd = g_new0(int, npairs);
+    st.ev = g_new0(event_handle_t *, npairs);
+    stress_cur = &st;
+
+    for (i = 0; i < npairs; i++) {
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+	    tu_dbg("socketpair %d: %s\n", i, strerror(errno));
+	    return FALSE;
+	}
+	st.rfd[i] = sv[0];
+	st.wfd[i] = sv[1];
+	(void)fcntl(sv[0], F_SETFL, O_NONBLOCK);
+	st.ev[i] = event_create(sv[0], EV_READFD, stress_fd_cb,
+				GINT_TO_POINTER(i));
+	event_activate(st.ev[i]);
+    }
+    tu_dbg("highest fd is %d; FD_SETSIZE is %d\n", st.wfd[npairs - 1],
+	   (int)FD_SETSIZE);
+
+    /* every fd ready at once */
+    timer = g_timer_new();
+    for (r = 0; r < rounds; r++) {
+	st.remaining = npairs;
+	st.round_done = event_create(1234567, EV_WAIT, NULL, NULL);
+	event_activate(st.round_done);
+	for (i = 0; i < npairs; i++) {
+	    if (write(st.wfd[i], "x", 1) != 1)
+		ok = FALSE;
+	}
+	event_wait(st.round_done);
+    }
+    if (report) {
+	g_fprintf(stdout, "%d fds, all ready: %.0f events/s\n", npairs,
+		  (gdouble)npairs * rounds / g_timer_elapsed(timer, NULL));
+    }
+
+    /* one fd ready at a time, among all of them */
+    g_timer_start(timer);
+    for (r = 0; r < rounds * 100; r++) {
+	st.remaining = 1;
+	st.round_done = event_create(1234567, EV_WAIT, NULL, NULL);
+	event_activate(st.round_done);
+	if (write(st.wfd[(r * 7919) % npairs], "x", 1) != 1)
+	    ok = FALSE;
+	event_wait(st.round_done);
+    }
+    if (report) {
+	g_fprintf(stdout, "%d fds, one ready: %.0f events/s\n", npairs,
+		  (gdouble)rounds * 100 / g_timer_elapsed(timer, NULL));
+    }
+
+    for (i = 0; i < npairs; i++) {
+	event_release(st.ev[i]);
+	close(st.rfd[i]);
+	close(st.wfd[i]);
+    }
+
+    /* EV_WAIT, each on its own id */
+    st.fired = 0;
+    for (i = 0; i < npairs; i++) {
+	st.ev[i] = event_create(100000 + i, EV_WAIT, stress_count_cb, NULL);
+	event_activate(st.ev[i]);
+    }
+    g_timer_start(timer);
+    for (r = 0; r < rounds; r++) {
+	for (i = 0; i < npairs; i++)
+	    event_wakeup(100000 + i);
+    }
+    if (report) {
+	g_fprintf(stdout, "%d EV_WAIT ids: %.0f wakeups/s\n", npairs,
+		  (gdouble)npairs * rounds / g_timer_elapsed(timer, NULL));
+    }
+    if (st.fired != npairs * rounds) {
+	tu_dbg("%d of %d EV_WAIT events fired\n", st.fired, npairs * rounds);
+	ok = FALSE;
+    }
+    for (i = 0; i < npairs; i++)
+	event_release(st.ev[i]);
+
+    /* EV_TIME, all due in a second; each releases itself */
+    st.fired = 0;
+    for (i = 0; i < npairs; i++) {
+	st.ev[i] = event_create(1, EV_TIME, stress_timer_cb, GINT_TO_POINTER(i));
+	event_activate(st.ev[i]);
+    }
+    g_timer_start(timer);
+    event_loop(0);
+    if (report) {
+	g_fprintf(stdout, "%d timers of 1s: all fired in %.2fs\n", npairs,
+		  g_timer_elapsed(timer, NULL));
+    }
+    if (st.fired != npairs) {
+	tu_dbg("%d of %d EV_TIME events fired\n", st.fired, npairs);
+	ok = FALSE;
+    }
+
+    g_timer_destroy(timer);
+    g_free(st.rfd);
+    g_free(st.wfd);
+    g_free(st.ev);
+    return ok;
+}
+
+static gboolean
+test_many_fds(void)
+{
+    int npairs = stress_fd_limit((int)FD_SETSIZE + 100);
+
+    if (npairs < (int)FD_SETSIZE / 2 + 50) {
+	tu_dbg("can't open enough fds to go past FD_SETSIZE; skipping\n");
+	return TRUE;
+    }
+    return stress(npairs, 3, FALSE);
+}
+
+/****
+ * Test that an fd closed before its handle is released, while its file is
+ * still open elsewhere, fires neither the handles of a new fd that gets its
+ * number nor anything else.
+ */
+static void
+test_closed_fd_cb(void *up G_GNUC_UNUSED)
+{
+    global++;
+    tu_dbg("spurious event on fd %d\n", cb_fd);
+}
+
+static void
+test_closed_fd_timer_cb(void *up G_GNUC_UNUSED)
+{
+    event_release(hdl[1]);
+    event_release(hdl[2]);
+}
+
+static gboolean
+test_closed_fd(void)
+{
+    int sv[2];
+    int p[2];
+    int keep;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+	perror("socketpair");
+	return FALSE;
+    }
+    keep = dup(sv[0]);
+
+    global = 0;
+    hdl[0] = event_create(sv[0], EV_READFD, test_closed_fd_cb, NULL);
+    event_activate(hdl[0]);
+
+    /* in the wrong order, the file stays open through keep */
+    cb_fd = sv[0];
+    close(sv[0]);
+    event_release(hdl[0]);
+    if (write(sv[1], "x", 1) != 1) {
+	perror("write");
+	return FALSE;
+    }
+
+    /* a pipe that is never ready, on the same fd if it is free */
+    if (pipe(p) == -1) {
+	perror("pipe");
+	return FALSE;
+    }
+    tu_dbg("closed fd %d, new fd %d\n", cb_fd, p[0]);
+    cb_fd = p[0];
+    hdl[1] = event_create(p[0], EV_READFD, test_closed_fd_cb, NULL);
+    event_activate(hdl[1]);
+    hdl[2] = event_create(1, EV_TIME, test_closed_fd_timer_cb, NULL);
+    event_activate(hdl[2]);
+
+    event_loop(0);
+
+    close(p[0]);
+    close(p[1]);
+    close(keep);
+    close(sv[1]);
+    return global == 0;
+}
+
 /*
  * Main driver
  */
@@ -658,9 +919,22 @@ main(int argc, char **argv)
 	TU_TEST(test_nonblock, 90),
 	TU_TEST(test_read_timeout, 90),
 	TU_TEST(test_child_watch_source, 90),
+	TU_TEST(test_many_fds, 90),
+	TU_TEST(test_closed_fd, 90),
 	/* fdsource is used by ev_readfd/ev_writefd, and is sufficiently tested there */
 	TU_END()
     };
 
+    /* event-test --stress [N]: time N fds, EV_WAIT ids and timers instead
+     * of testing */
+    if (argc > 1 && g_str_equal(argv[1], "--stress")) {
+	int want = argc > 2 ? atoi(argv[2]) : 10000;
+	int npairs = stress_fd_limit(want);
+
+	if (npairs < want)
+	    g_fprintf(stderr, "fd limit allows only %d socketpairs\n", npairs);
+	return stress(npairs, 10, TRUE) ? 0 : 1;
+    }
+
     return testutils_run_tests(argc, argv, tests);
 }
@@ -35,8 +35,15 @@
  * This is a compatibility wrapper over Glib's GMainLoop.  New code should
  * use Glib's interface directly.
  *
- * Each event_handle is associated with a unique GSource, identified by it
- * event_source_id.
+ * Rather than one GSource per event_handle, which GMainLoop would prepare
+ * and check on every iteration, the handles are kept in structures indexed
+ * by what they wait for:
+ *
+ *  - EV_READFD and EV_WRITEFD handles are listed by fd.  Where epoll is
+ *    available, a single GSource polls an epoll fd and dispatches only the
+ *    fds that are ready; elsewhere, each handle has its own FDSource.
+ *  - EV_TIME handles are kept in a timer wheel, run by a single GSource.
+ *  - EV_WAIT handles are hashed by id.
  */
 
 #include "amanda.h"
@@ -44,9 +51,22 @@
 #include "event.h"
 #include "glib-util.h"
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#define EVENT_EPOLL
+#endif
+
 /* TODO: use mem chunks to allocate event_handles */
 /* TODO: lock stuff for threading */
 
+/* The EV_TIME timer wheel has EVENT_WHEEL_SLOTS slots of EVENT_WHEEL_TICK
+ * milliseconds each; a timer goes in the slot of the tick it is due in. */
+#define EVENT_WHEEL_SLOTS	512
+#define EVENT_WHEEL_TICK	100
+
+/* Most ready fds taken from a single epoll_wait */
+#define EVENT_EPOLL_MAX		256
+
 /* Write a debugging message if the config variable debug_event
  * is greater than or equal to i */
 #define event_debug(i, ...) do {	\
@@ -66,17 +86,25 @@ struct event_handle {
     event_type_t type;		/* type of event */
     event_id_t data;		/* type data */
 
-    GSource *source;		/* Glib event source, if one exists */
-    guint source_id;	        /* ID of the glib event source */
+#ifndef EVENT_EPOLL
+    GSource *source;		/* Glib event source, for fd events */
+#endif
+
+    /* links in the list of handles on the same fd, with the same EV_WAIT
+     * id, or in the same timer wheel slot; then in the list of dead
+     * handles */
+    struct event_handle *prev;
+    struct event_handle *next;
+    gboolean is_linked;		/* in one of the lists above, but not dead */
 
+    gint64 deadline;		/* EV_TIME: when to fire, in ms */
+    gint64 tick;		/* EV_TIME: the wheel tick it is filed under */
+
+    guint pinned;		/* queued to fire, or firing; don't free it */
     gboolean has_fired;		/* for use by event_wait() */
     gboolean is_dead;		/* should this event be deleted? */
 };
 
-/* A list of all extant event_handle objects, used for searching for particular
- * events and for deleting dead events */
-GSList *all_events = NULL;
-
 #if (GLIB_MAJOR_VERSION > 2 || (GLIB_MAJOR_VERSION == 2 && GLIB_MINOR_VERSION >= 31))
 # pragma GCC diagnostic push
 # pragma GCC diagnostic ignored "-Wmissing-field-initializers"
@@ -86,6 +114,51 @@ GStaticMutex event_mutex = G_STATIC_MUTEX_INIT;
 # pragma GCC diagnostic pop
 #endif
 
+/* Released handles, waiting for flush_dead_events to free them */
+static event_handle_t *dead_events = NULL;
+
+/* The number of live EV_READFD, EV_WRITEFD and EV_TIME handles; event_loop
+ * returns when there are none */
+static int n_mainloop_events = 0;
+
+/* Timers found due, each pinned, in the order to fire them.  A callback
+ * that runs a nested event loop fires from this queue too, so that every
+ * timer fires once, and none waits on its caller. */
+static GQueue due_timers = G_QUEUE_INIT;
+
+/* EV_WAIT handles by id; each value is the first handle of a list */
+static GHashTable *wait_events = NULL;
+
+/* EV_TIME handles.  Every timer's tick is at least wheel_tick, the first
+ * tick whose slot may hold timers that are due. */
+static event_handle_t *timer_wheel[EVENT_WHEEL_SLOTS];
+static gint64 wheel_tick = 0;
+static int n_timers = 0;
+static gint64 next_deadline;
+static gboolean next_deadline_valid = FALSE;
+static GSource *timer_source = NULL;
+
+#ifdef EVENT_EPOLL
+/* EV_READFD and EV_WRITEFD handles, by fd */
+typedef struct event_fd_s {
+    event_handle_t *first;
+    guint32 events;		/* what epoll is watching for */
+    guint32 gen;		/* bumped on each EPOLL_CTL_ADD */
+    gboolean always_ready;	/* not pollable by epoll (a regular file) */
+} event_fd_t;
+
+static event_fd_t *fd_table = NULL;
+static int fd_table_size = 0;
+static GSList *always_ready_fds = NULL;
+
+/* Handles found ready, queued like due_timers */
+static GQueue ready_events = G_QUEUE_INIT;
+
+static int epoll_fd = -1;
+static pid_t epoll_pid;		/* the process epoll_fd belongs to */
+static GSource *epoll_source = NULL;
+#endif
+
 /* should event_loop_run stop? */
 gboolean stop = FALSE;
 gboolean global_return_when_empty = TRUE;
@@ -104,9 +177,573 @@ static gboolean any_mainloop_events(void);
 	(eh)->has_fired = TRUE; \
 } while(0)
 
+static void timer_add(event_handle_t *eh, gint64 now);
+static gint64 event_now(void);
+
+/* Fire the handles in queue that are still alive, then unpin them; EV_TIME
+ * handles go back on the wheel for their next interval.  The handles were
+ * pinned when they were queued, so the callbacks can release them, but they
+ * are not freed until they are unpinned. */
+static void
+fire_queued(
+    GQueue *queue)
+{
+    event_handle_t *eh;
+
+    g_static_mutex_lock(&event_mutex);
+    while ((eh = g_queue_pop_head(queue)) != NULL) {
+	if (!eh->is_dead) {
+	    /* The lock must be released before running the event */
+	    g_static_mutex_unlock(&event_mutex);
+	    fire(eh);
+	    g_static_mutex_lock(&event_mutex);
+	}
+	eh->pinned--;
+	if (eh->type == EV_TIME && !eh->is_dead)
+	    timer_add(eh, event_now());
+    }
+    g_static_mutex_unlock(&event_mutex);
+}
+
+static void
+list_prepend(
+    event_handle_t **first,
+    event_handle_t  *eh)
+{
+    eh->prev = NULL;
+    eh->next = *first;
+    if (*first)
+	(*first)->prev = eh;
+    *first = eh;
+    eh->is_linked = TRUE;
+}
+
+static void
+list_remove(
+    event_handle_t **first,
+    event_handle_t  *eh)
+{
+    if (eh->prev)
+	eh->prev->next = eh->next;
+    else
+	*first = eh->next;
+    if (eh->next)
+	eh->next->prev = eh->prev;
+    eh->prev = eh->next = NULL;
+    eh->is_linked = FALSE;
+}
+
+/* milliseconds, on a clock that does not jump */
+static gint64
+event_now(void)
+{
+#if GLIB_CHECK_VERSION(2,28,0)
+    return g_get_monotonic_time() / 1000;
+#else
+    GTimeVal tv;
+
+    g_get_current_time(&tv);
+    return (gint64)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/*
+ * EV_WAIT
+ */
+
+static void
+wait_add(
+    event_handle_t *eh)
+{
+    gpointer key = GSIZE_TO_POINTER((gsize)eh->data);
+    event_handle_t *first;
+
+    if (!wait_events)
+	wait_events = g_hash_table_new(g_direct_hash, g_direct_equal);
+    first = g_hash_table_lookup(wait_events, key);
+    list_prepend(&first, eh);
+    g_hash_table_insert(wait_events, key, first);
+}
+
+static void
+wait_remove(
+    event_handle_t *eh)
+{
+    gpointer key = GSIZE_TO_POINTER((gsize)eh->data);
+    event_handle_t *first = g_hash_table_lookup(wait_events, key);
+
+    list_remove(&first, eh);
+    if (first)
+	g_hash_table_insert(wait_events, key, first);
+    else
+	g_hash_table_remove(wait_events, key);
+}
+
+/*
+ * EV_TIME
+ */
+
+static void
+timer_add(
+    event_handle_t *eh,
+    gint64          now)
+{
+    eh->deadline = now + (gint64)eh->data * 1000;
+    if (n_timers == 0)
+	wheel_tick = now / EVENT_WHEEL_TICK;
+    eh->tick = MAX(eh->deadline / EVENT_WHEEL_TICK, wheel_tick);
+    list_prepend(&timer_wheel[eh->tick % EVENT_WHEEL_SLOTS], eh);
+    n_timers++;
+
+    if (next_deadline_valid && eh->deadline < next_deadline)
+	next_deadline = eh->deadline;
+}
+
+static void
+timer_remove(
+    event_handle_t *eh)
+{
+    list_remove(&timer_wheel[eh->tick % EVENT_WHEEL_SLOTS], eh);
+    n_timers--;
+    /* next_deadline may now be early, which only costs a wakeup */
+}
+
+/* When the next timer is due; there must be at least one timer. */
+static gint64
+timer_next_deadline(void)
+{
+    event_handle_t *eh;
+    gint64 tick;
+    int i;
+
+    if (next_deadline_valid)
+	return next_deadline;
+
+    /* the first slot holding a timer for this revolution of the wheel has
+     * the earliest ones */
+    next_deadline = G_MAXINT64;
+    for (i = 0; i < EVENT_WHEEL_SLOTS; i++) {
+	tick = wheel_tick + i;
+	for (eh = timer_wheel[tick % EVENT_WHEEL_SLOTS]; eh; eh = eh->next) {
+	    if (eh->tick == tick)
+		next_deadline = MIN(next_deadline, eh->deadline);
+	}
+	if (next_deadline != G_MAXINT64)
+	    break;
+    }
+
+    /* all of them are further away than that */
+    if (next_deadline == G_MAXINT64) {
+	for (i = 0; i < EVENT_WHEEL_SLOTS; i++) {
+	    for (eh = timer_wheel[i]; eh; eh = eh->next)
+		next_deadline = MIN(next_deadline, eh->deadline);
+	}
+    }
+
+    next_deadline_valid = TRUE;
+    return next_deadline;
+}
+
+static gint
+compare_deadline(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const event_handle_t *eha = *(event_handle_t * const *)a;
+    const event_handle_t *ehb = *(event_handle_t * const *)b;
+
+    return (eha->deadline > ehb->deadline) - (eha->deadline < ehb->deadline);
+}
+
+/* Queue the timers that are due, in order, and fire them */
+static void
+timer_run(void)
+{
+    GPtrArray *due = g_ptr_array_new();
+    event_handle_t *eh, *next;
+    gint64 now, now_tick, tick;
+    guint i;
+
+    g_static_mutex_lock(&event_mutex);
+    now = event_now();
+    now_tick = now / EVENT_WHEEL_TICK;
+    for (tick = wheel_tick;
+	 tick <= now_tick && tick < wheel_tick + EVENT_WHEEL_SLOTS;
+	 tick++) {
+	event_handle_t **slot = &timer_wheel[tick % EVENT_WHEEL_SLOTS];
+
+	for (eh = *slot; eh; eh = next) {
+	    next = eh->next;
+	    if (eh->deadline <= now) {
+		timer_remove(eh);
+		eh->pinned++;
+		g_ptr_array_add(due, eh);
+	    }
+	}
+    }
+    if (now_tick > wheel_tick)
+	wheel_tick = now_tick;
+    next_deadline_valid = FALSE;
+
+    g_ptr_array_sort(due, compare_deadline);
+    for (i = 0; i < due->len; i++)
+	g_queue_push_tail(&due_timers, g_ptr_array_index(due, i));
+    g_static_mutex_unlock(&event_mutex);
+    g_ptr_array_free(due, TRUE);
+
+    fire_queued(&due_timers);
+}
+
+static gboolean
+timer_source_prepare(
+    GSource *source G_GNUC_UNUSED,
+    gint *timeout_)
+{
+    gint64 wait = -1;
+
+    g_static_mutex_lock(&event_mutex);
+    if (!g_queue_is_empty(&due_timers))
+	wait = 0;
+    else if (n_timers > 0)
+	wait = MAX(timer_next_deadline() - event_now(), 0);
+    g_static_mutex_unlock(&event_mutex);
+
+    *timeout_ = (gint)MIN(wait, G_MAXINT);
+    return wait == 0;
+}
+
+static gboolean
+timer_source_check(
+    GSource *source G_GNUC_UNUSED)
+{
+    gboolean due;
+
+    g_static_mutex_lock(&event_mutex);
+    due = !g_queue_is_empty(&due_timers) ||
+	  (n_timers > 0 && timer_next_deadline() <= event_now());
+    g_static_mutex_unlock(&event_mutex);
+
+    return due;
+}
+
+static gboolean
+timer_source_dispatch(
+    GSource *source G_GNUC_UNUSED,
+    GSourceFunc callback G_GNUC_UNUSED,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    timer_run();
+    return TRUE;
+}
+
+static void
+timer_source_init(void)
+{
+    static GSourceFuncs timer_source_funcs = {
+	timer_source_prepare,
+	timer_source_check,
+	timer_source_dispatch,
+	NULL, NULL, NULL
+    };
+
+    if (timer_source)
+	return;
+
+    timer_source = g_source_new(&timer_source_funcs, sizeof(GSource));
+    /* EV_TIME must always be handled after EV_READ */
+    g_source_set_priority(timer_source, 10);
+    /* a callback may wait for another timer */
+    g_source_set_can_recurse(timer_source, TRUE);
+    g_source_attach(timer_source, NULL);
+}
+
+/*
+ * EV_READFD and EV_WRITEFD
+ */
+
+#ifdef EVENT_EPOLL
+
+typedef struct EpollSource {
+    GSource source; /* must be the first element in the struct */
+    GPollFD pollfd; /* the epoll fd */
+} EpollSource;
+
+static gboolean
+epoll_source_prepare(
+    GSource *source G_GNUC_UNUSED,
+    gint *timeout_)
+{
+    gboolean ready;
+
+    g_static_mutex_lock(&event_mutex);
+    ready = always_ready_fds != NULL || !g_queue_is_empty(&ready_events);
+    g_static_mutex_unlock(&event_mutex);
+
+    *timeout_ = ready ? 0 : -1;
+    return ready;
+}
+
+static gboolean
+epoll_source_check(
+    GSource *source)
+{
+    EpollSource *es = (EpollSource *)source;
+    gboolean ready;
+
+    g_static_mutex_lock(&event_mutex);
+    ready = always_ready_fds != NULL || !g_queue_is_empty(&ready_events);
+    g_static_mutex_unlock(&event_mutex);
+
+    return ready || (es->pollfd.revents & G_IO_IN);
+}
+
+/* is a handle of this type interested in these epoll events? */
+static gboolean
+epoll_matches(
+    event_type_t type,
+    guint32      revents)
+{
+    if (type == EV_READFD)
+	return (revents & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0;
+    return (revents & (EPOLLOUT | EPOLLERR)) != 0;
+}
+
+/* Queue the handles on fd that these events fire; a pinned handle is
+ * queued or firing already. */
+static void
+gather_fd(
+    int        fd,
+    guint32    revents)
+{
+    event_handle_t *eh;
+
+    for (eh = fd_table[fd].first; eh; eh = eh->next) {
+	if (!eh->pinned && epoll_matches(eh->type, revents)) {
+	    eh->pinned++;
+	    g_queue_push_tail(&ready_events, eh);
+	}
+    }
+}
+
+/* the epoll data of a registration of fd: the fd and its generation */
+static guint64
+epoll_key(
+    int fd)
+{
+    return ((guint64)fd_table[fd].gen << 32) | (guint32)fd;
+}
+
+static void epoll_reset(void);
+
+static gboolean
+epoll_source_dispatch(
+    GSource *source G_GNUC_UNUSED,
+    GSourceFunc callback G_GNUC_UNUSED,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    struct epoll_event events[EVENT_EPOLL_MAX];
+    GSList *iter;
+    gboolean stale = FALSE;
+    int n, i;
+
+    /* gather every handle to fire before firing any, as the callbacks can
+     * change the fd lists; a nested loop fires what is left first */
+    g_static_mutex_lock(&event_mutex);
+    if (g_queue_is_empty(&ready_events)) {
+	n = epoll_wait(epoll_fd, events, EVENT_EPOLL_MAX, 0);
+	for (i = 0; i < n; i++) {
+	    int fd = (int)(guint32)events[i].data.u64;
+
+	    if (fd < fd_table_size && fd_table[fd].events &&
+		epoll_key(fd) == events[i].data.u64) {
+		gather_fd(fd, events[i].events);
+	    } else {
+		stale = TRUE;
+	    }
+	}
+	for (iter = always_ready_fds; iter != NULL; iter = iter->next) {
+	    gather_fd(GPOINTER_TO_INT(iter->data), EPOLLIN | EPOLLOUT);
+	}
+	/* An fd closed before its handles were released could not be removed
+	 * from the set, and stays in it as long as its file is open elsewhere
+	 * (a child, a dup).  Only a new set gets rid of it. */
+	if (stale)
+	    epoll_reset();
+    }
+    g_static_mutex_unlock(&event_mutex);
+
+    fire_queued(&ready_events);
+
+    return TRUE;
+}
+
+/* Tell epoll what to watch fd for, after its list of handles changed.
+ * Called with the mutex held. */
+static void
+fd_update(
+    int fd)
+{
+    event_fd_t *efd = &fd_table[fd];
+    struct epoll_event ev;
+    event_handle_t *eh;
+    guint32 events = 0;
+    int op;
+
+    for (eh = efd->first; eh; eh = eh->next)
+	events |= (eh->type == EV_READFD) ? EPOLLIN : EPOLLOUT;
+
+    if (efd->always_ready) {
+	if (!events) {
+	    efd->always_ready = FALSE;
+	    always_ready_fds = g_slist_remove(always_ready_fds,
+					      GINT_TO_POINTER(fd));
+	}
+	return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+
+    if (!events) {
+	/* the fd may be closed already, which removed it from the set */
+	if (efd->events)
+	    (void)epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+	efd->events = 0;
+	return;
+    }
+
+    /* Modify even when the events are unchanged: the fd may have been
+     * closed and reused since it was added, which silently removed it from
+     * the set */
+    op = efd->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (op == EPOLL_CTL_ADD)
+	efd->gen++;
+    ev.data.u64 = epoll_key(fd);
+    if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+	if (errno == ENOENT) {
+	    op = EPOLL_CTL_ADD;
+	    efd->gen++;
+	    ev.data.u64 = epoll_key(fd);
+	} else if (errno == EEXIST) {
+	    op = EPOLL_CTL_MOD;
+	} else {
+	    op = -1;
+	}
+	if (op == -1 || epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+	    if (errno == EPERM) {
+		/* epoll can't poll regular files, which are always ready */
+		efd->always_ready = TRUE;
+		always_ready_fds = g_slist_prepend(always_ready_fds,
+						   GINT_TO_POINTER(fd));
+	    } else {
+		event_debug(1, _("event: epoll_ctl on fd %d failed: %s\n"),
+			    fd, strerror(errno));
+	    }
+	    efd->events = 0;
+	    return;
+	}
+    }
+    efd->events = events;
+}
+
+/* Put a new, empty set at epoll_fd, which keeps its number, and watch the
+ * fds of fd_table in it.  Called with the mutex held. */
+static void
+epoll_reset(void)
+{
+    int new_fd;
+    int fd;
+
+    new_fd = epoll_create(1024);
+    if (new_fd < 0) {
+	error(_("event: cannot create an epoll fd: %s"), strerror(errno));
+	/*NOTREACHED*/
+    }
+    if (epoll_fd >= 0) {
+	event_debug(1, _("event: new epoll set\n"));
+	if (dup2(new_fd, epoll_fd) == -1) {
+	    error(_("event: cannot dup the epoll fd: %s"), strerror(errno));
+	    /*NOTREACHED*/
+	}
+	close(new_fd);
+    } else {
+	epoll_fd = new_fd;
+    }
+    fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+    epoll_pid = getpid();
+
+    for (fd = 0; fd < fd_table_size; fd++) {
+	fd_table[fd].events = 0;
+	if (fd_table[fd].first && !fd_table[fd].always_ready)
+	    fd_update(fd);
+    }
+}
+
+/* Make sure epoll_fd is ours.  A child of the process that created it
+ * shares the epoll set with its parent, so it takes a set of its own. */
+static void
+epoll_init(void)
+{
+    static GSourceFuncs epoll_source_funcs = {
+	epoll_source_prepare,
+	epoll_source_check,
+	epoll_source_dispatch,
+	NULL, NULL, NULL
+    };
+    EpollSource *es;
+
+    if (epoll_fd >= 0 && epoll_pid == getpid())
+	return;
+
+    epoll_reset();
+
+    if (!epoll_source) {
+	epoll_source = g_source_new(&epoll_source_funcs, sizeof(EpollSource));
+	/* a callback may wait for another fd */
+	g_source_set_can_recurse(epoll_source, TRUE);
+	g_source_attach(epoll_source, NULL);
+	es = (EpollSource *)epoll_source;
+	es->pollfd.fd = epoll_fd;
+	es->pollfd.events = G_IO_IN;
+	g_source_add_poll(epoll_source, &es->pollfd);
+    }
+}
+
+static void
+fd_add(
+    event_handle_t *eh)
+{
+    int fd = (int)eh->data;
+
+    epoll_init();
+    if (fd >= fd_table_size) {
+	int new_size = MAX(fd + 1, MAX(fd_table_size * 2, 64));
+
+	fd_table = g_renew(event_fd_t, fd_table, new_size);
+	memset(fd_table + fd_table_size, 0,
+	       (new_size - fd_table_size) * sizeof(event_fd_t));
+	fd_table_size = new_size;
+    }
+    list_prepend(&fd_table[fd].first, eh);
+    fd_update(fd);
+}
+
+static void
+fd_remove(
+    event_handle_t *eh)
+{
+    int fd = (int)eh->data;
+
+    epoll_init();
+    list_remove(&fd_table[fd].first, eh);
+    fd_update(fd);
+}
+
+#else /* !EVENT_EPOLL */
+
 /* Adapt a Glib callback to an event_handle_t callback; assumes that the
  * user_ptr for the Glib callback is a pointer to the event_handle_t.  */
-static gboolean 
+static gboolean
 event_handle_callback(
     gpointer user_ptr)
 {
@@ -122,6 +759,44 @@ event_handle_callback(
     return TRUE;
 }
 
+static void
+fd_add(
+    event_handle_t *eh)
+{
+    GIOCondition cond;
+
+    /* create a new source */
+    if (eh->type == EV_READFD) {
+	cond = G_IO_IN | G_IO_HUP | G_IO_ERR;
+    } else {
+	cond = G_IO_OUT | G_IO_ERR;
+    }
+
+    eh->source = new_fdsource(eh->data, cond);
+
+    /* attach it to the default GMainLoop */
+    g_source_attach(eh->source, NULL);
+
+    /* And set its callbacks */
+    g_source_set_callback(eh->source, event_handle_callback,
+			  (gpointer)eh, NULL);
+
+    /* drop our reference to it, so when it's detached, it will be
+     * destroyed. */
+    g_source_unref(eh->source);
+    eh->is_linked = TRUE;
+}
+
+static void
+fd_remove(
+    event_handle_t *eh)
+{
+    /* the source is destroyed when the handle is freed */
+    eh->is_linked = FALSE;
+}
+
+#endif /* EVENT_EPOLL */
+
 /*
  * Public functions
  *  DEPRECATED because not safe in multi-thread, callback can be called before event_register return
@@ -155,8 +830,8 @@ event_create(
 
     /* sanity-checking */
     if ((type == EV_READFD) || (type == EV_WRITEFD)) {
-	/* make sure we aren't given a high fd that will overflow a fd_set */
-	if (data >= (int)FD_SETSIZE) {
+	/* any fd will do; none of the backends uses an fd_set */
+	if (data < 0 || data > G_MAXINT) {
 	    error(_("event_create: Invalid file descriptor %jd"), data);
 	    /*NOTREACHED*/
 	}
@@ -184,54 +859,29 @@ void
 event_activate(
     event_handle_t *handle)
 {
-    GIOCondition cond;
     assert(handle != NULL);
 
     g_static_mutex_lock(&event_mutex);
 
-    /* add to the list of events */
-    all_events = g_slist_prepend(all_events, (gpointer)handle);
-
-    /* and set up the GSource for this event */
     switch (handle->type) {
 	case EV_READFD:
 	case EV_WRITEFD:
-	    /* create a new source */
-	    if (handle->type == EV_READFD) {
-		cond = G_IO_IN | G_IO_HUP | G_IO_ERR;
-	    } else {
-		cond = G_IO_OUT | G_IO_ERR;
-	    }
-
-	    handle->source = new_fdsource(handle->data, cond);
-
-	    /* attach it to the default GMainLoop */
-	    g_source_attach(handle->source, NULL);
-	    handle->source_id = g_source_get_id(handle->source);
-
-	    /* And set its callbacks */
-	    g_source_set_callback(handle->source, event_handle_callback,
-				  (gpointer)handle, NULL);
-
-	    /* drop our reference to it, so when it's detached, it will be
-	     * destroyed. */
-	    g_source_unref(handle->source);
+	    fd_add(handle);
+	    n_mainloop_events++;
 	    break;
 
 	case EV_TIME:
-	    /* Glib provides a nice shortcut for timeouts.  The *1000 converts
-	     * seconds to milliseconds. */
-	    handle->source_id = g_timeout_add(handle->data * 1000, event_handle_callback,
-					      (gpointer)handle);
-
-	    /* But it doesn't give us the source directly.. */
-	    handle->source = g_main_context_find_source_by_id(NULL, handle->source_id);
-	    /* EV_TIME must always be handled after EV_READ */
-	    g_source_set_priority(handle->source, 10);
+	    timer_source_init();
+	    timer_add(handle, event_now());
+	    n_mainloop_events++;
+	    /* the loop may be asleep in another thread, with a longer
+	     * timeout than this */
+	    g_main_context_wakeup(NULL);
 	    break;
 
 	case EV_WAIT:
 	    /* nothing to do -- these are handled independently of GMainLoop */
+	    wait_add(handle);
 	    break;
 
 	default:
@@ -244,9 +894,8 @@ event_activate(
 
 
 /*
- * Mark an event to be released.  Because we may be traversing the queue
- * when this is called, we must wait until later to actually remove
- * the event.
+ * Mark an event to be released.  It stops being fired at once, but because
+ * a callback may be about to fire it, it is freed later, by the event loop.
  */
 void
 event_release(
@@ -260,8 +909,30 @@ event_release(
 		    event_type2str(handle->type));
     assert(!handle->is_dead);
 
-    /* Mark it as dead and leave it for the event_loop to remove */
+    if (handle->is_linked) {
+	switch (handle->type) {
+	    case EV_READFD:
+	    case EV_WRITEFD:
+		fd_remove(handle);
+		n_mainloop_events--;
+		break;
+	    case EV_TIME:
+		timer_remove(handle);
+		n_mainloop_events--;
+		break;
+	    case EV_WAIT:
+		wait_remove(handle);
+		break;
+	}
+    } else if (handle->type == EV_TIME && handle->pinned) {
+	/* off the wheel while it is due; it won't be put back */
+	n_mainloop_events--;
+    }
+
+    /* Mark it as dead and leave it for the event_loop to free */
     handle->is_dead = TRUE;
+    handle->next = dead_events;
+    dead_events = handle;
 
     if (global_return_when_empty && !any_mainloop_events()) {
 	g_main_loop_quit(default_main_loop());
@@ -277,9 +948,10 @@ int
 event_wakeup(
     event_id_t id)
 {
-    GSList *iter;
-    GSList *tofire = NULL;
+    GPtrArray *tofire = g_ptr_array_new();
+    event_handle_t *eh;
     int nwaken = 0;
+    guint i;
 
     g_static_mutex_lock(&event_mutex);
     event_debug(1, _("event: wakeup: enter (%jd)\n"), id);
@@ -287,17 +959,21 @@ event_wakeup(
     /* search for any and all matching events, and record them.  This way
      * we have determined the whole list of events we'll be firing *before*
      * we fire any of them. */
-    for (iter = all_events; iter != NULL; iter = g_slist_next(iter)) {
-	event_handle_t *eh = (event_handle_t *)iter->data;
-	if (eh->type == EV_WAIT && eh->data == id && !eh->is_dead) {
-	    tofire = g_slist_append(tofire, (gpointer)eh);
+    if (wait_events) {
+	eh = g_hash_table_lookup(wait_events, GSIZE_TO_POINTER((gsize)id));
+	for (; eh != NULL; eh = eh->next) {
+	    /* ids that differ only above a pointer's width share a list */
+	    if (eh->data == id) {
+		eh->pinned++;
+		g_ptr_array_add(tofire, eh);
+	    }
 	}
     }
 
     /* fire them */
-    for (iter = tofire; iter != NULL; iter = g_slist_next(iter)) {
-	event_handle_t *eh = (event_handle_t *)iter->data;
-	if (eh->type == EV_WAIT && eh->data == id && !eh->is_dead) {
+    for (i = 0; i < tofire->len; i++) {
+	eh = g_ptr_array_index(tofire, i);
+	if (!eh->is_dead) {
 	    event_debug(1, _("A: event: wakeup triggering: %p id=%jd\n"), eh, id);
 	    /* The lcok must be release before running the event */
 	    g_static_mutex_unlock(&event_mutex);
@@ -305,10 +981,11 @@ event_wakeup(
 	    g_static_mutex_lock(&event_mutex);
 	    nwaken++;
 	}
+	eh->pinned--;
     }
 
     /* and free the temporary list */
-    g_slist_free(tofire);
+    g_ptr_array_free(tofire, TRUE);
 
     g_static_mutex_unlock(&event_mutex);
     return (nwaken);
@@ -350,8 +1027,7 @@ event_wait(
     event_loop_wait(eh, 0, TRUE);
 }
 
-/* Flush out any dead events in all_events.  Be careful that this
- * isn't called while someone is iterating over all_events.
+/* Free the dead events, except those a callback may still fire.
  *
  * @param wait_eh: the event handle we're waiting on, which shouldn't
  *	    be flushed.
@@ -359,40 +1035,34 @@ event_wait(
 static void
 flush_dead_events(event_handle_t *wait_eh)
 {
-    GSList *iter, *next;
+    event_handle_t *hdl, *next;
+    event_handle_t *keep = NULL;
 
-    for (iter = all_events; iter != NULL; iter = next) {
-	event_handle_t *hdl = (event_handle_t *)iter->data;
-	next = g_slist_next(iter);
+    for (hdl = dead_events; hdl != NULL; hdl = next) {
+	next = hdl->next;
 
 	/* (handle the case when wait_eh is dead by simply not deleting
 	 * it; the next run of event_loop will take care of it) */
-	if (hdl->is_dead && hdl != wait_eh) {
-	    all_events = g_slist_delete_link(all_events, iter);
-	    if (hdl->source) g_source_destroy(hdl->source);
-
-	    amfree(hdl);
+	if (hdl == wait_eh || hdl->pinned) {
+	    hdl->next = keep;
+	    keep = hdl;
+	    continue;
 	}
+#ifndef EVENT_EPOLL
+	if (hdl->source) g_source_destroy(hdl->source);
+#endif
+	amfree(hdl);
     }
+    dead_events = keep;
 }
 
 /* Return TRUE if we have any events outstanding that can be dispatched
- * by GMainLoop.  Recall EV_WAIT events appear in all_events, but are
- * not dispatched by GMainLoop.  */
+ * by GMainLoop.  Recall EV_WAIT events are not dispatched by GMainLoop.  */
 static gboolean
 any_mainloop_events(void)
 {
-    GSList *iter;
-    gboolean ret = FALSE;
-
-    for (iter = all_events; iter != NULL; iter = g_slist_next(iter)) {
-	event_handle_t *hdl = (event_handle_t *)iter->data;
-	event_debug(2, _("list %p: %s %s/%jd\n"), hdl, hdl->is_dead?"dead":"alive", event_type2str((hdl)->type), (hdl)->data);
-	if (hdl->type != EV_WAIT && !hdl->is_dead)
-	    ret = TRUE;
-    }
-
-    return ret;
+    event_debug(2, _("%d live mainloop events\n"), n_mainloop_events);
+    return n_mainloop_events > 0;
 }
 
 static void
@@ -443,8 +1113,8 @@ event_loop_wait(
 	    break;
     }
 
-    /* extra cleanup, to keep all_events short, and to delete wait_eh if it
-     * has been released. */
+    /* extra cleanup, to keep the dead list short, and to delete wait_eh if
+     * it has been released. */
     flush_dead_events(NULL);
 
     g_static_mutex_unlock(&event_mutex);
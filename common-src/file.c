@@ -32,6 +32,7 @@
 #include "amutil.h"
 #include "timestamp.h"
 #include "file.h"
+#include <poll.h>
 
 static struct areads_buffer *areads_getbuf(const char *s, int l, int fd);
 static char *original_cwd = NULL;
@@ -228,7 +229,7 @@ safe_cd(void)
  *
  * On exit, all three standard file descriptors will be open and pointing
  * someplace (either what we were handed or /dev/null) and all other
- * file descriptors (up to FD_SETSIZE) will be closed.
+ * file descriptors will be closed.
  *=====================================================================
  */
 
@@ -254,7 +255,7 @@ safe_fd(
  *
  * On exit, all three standard file descriptors will be open and pointing
  * someplace (either what we were handed or /dev/null) and all other
- * file descriptors (up to FD_SETSIZE) will be closed.
+ * file descriptors will be closed.
  *=====================================================================
  */
 
@@ -282,7 +283,7 @@ safe_fd2(
  *
  * On exit, all three standard file descriptors will be open and pointing
  * someplace (either what we were handed or /dev/null) and all other
- * file descriptors (up to FD_SETSIZE) will be closed.
+ * file descriptors will be closed.
  *=====================================================================
  */
 
@@ -312,7 +313,7 @@ safe_fd3(
  *
  * On exit, all three standard file descriptors will be open and pointing
  * someplace (either what we were handed or /dev/null) and all other
- * file descriptors (up to FD_SETSIZE) will be closed.
+ * file descriptors will be closed.
  *=====================================================================
  */
 
@@ -344,10 +345,35 @@ safe_fd4(
  *
  * On exit, all three standard file descriptors will be open and pointing
  * someplace (either what we were handed or /dev/null) and all other
- * file descriptors (up to FD_SETSIZE) will be closed.
+ * file descriptors will be closed.
  *=====================================================================
  */
 
+/* close every file descriptor from fd_first up */
+static void
+close_from(
+    int		fd_first)
+{
+#ifdef HAVE_CLOSE_RANGE
+    if (close_range(fd_first, ~0U, 0) == 0)
+	return;
+#endif
+#ifdef HAVE_CLOSEFROM
+    closefrom(fd_first);
+#else
+    {
+	long	fd_max = sysconf(_SC_OPEN_MAX);
+	int	fd;
+
+	if (fd_max < 0 || fd_max > INT_MAX)
+	    fd_max = INT_MAX;
+	for (fd = fd_first; fd < fd_max; fd++) {
+	    close(fd);
+	}
+    }
+#endif
+}
+
 void
 safe_fd5(
     int		fd_start,
@@ -358,8 +384,16 @@ safe_fd5(
     int		fd4)
 {
     int			fd;
+    int			fd_last = 2;	/* the highest fd to leave alone */
+
+    if (fd_start >= 0 && fd_count > 0)
+	fd_last = MAX(fd_last, fd_start + fd_count - 1);
+    fd_last = MAX(fd_last, fd1);
+    fd_last = MAX(fd_last, fd2);
+    fd_last = MAX(fd_last, fd3);
+    fd_last = MAX(fd_last, fd4);
 
-    for(fd = 0; fd < (int)FD_SETSIZE; fd++) {
+    for(fd = 0; fd <= fd_last; fd++) {
 	if (fd < 3) {
 	    /*
 	     * Open three file descriptors.  If one of the standard
@@ -393,6 +427,7 @@ safe_fd5(
 	    }
 	}
     }
+    close_from(fd_last + 1);
 }
 
 /*
@@ -741,8 +776,7 @@ areads_dataready(
     int	fd)
 {
     ssize_t r = 0;
-    SELECT_ARG_TYPE ready;
-    struct timeval  to;
+    struct pollfd   pfd;
     int             nfound;
 
     if (fd < 0)
@@ -758,13 +792,12 @@ areads_dataready(
         return r;
     }
 
-    FD_ZERO(&ready);
-    FD_SET(fd, &ready);
-    to.tv_sec = 0;
-    to.tv_usec = 0;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
 
-    nfound = select(fd+1, &ready, NULL, NULL, &to);
-    if (nfound > 0 && FD_ISSET(fd, &ready)) {
+    nfound = poll(&pfd, 1, 0);
+    if (nfound > 0 && !(pfd.revents & POLLNVAL)) {
         return 1;
     } else {
 	return 0;
@@ -0,0 +1,304 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "parallel-gzip.h"
+#include "simpleprng.h"
+#include "testutils.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+
+/* compressible data: a random sequence of four letters */
+static guint8 *
+make_data(
+    gsize len)
+{
+    simpleprng_state_t prng;
+    guint8 *data = g_malloc(len);
+    gsize i;
+
+    simpleprng_seed(&prng, 0xfeedface);
+    for (i = 0; i < len; i++)
+	data[i] = 'a' + simpleprng_rand_byte(&prng) % 4;
+    return data;
+}
+
+static gboolean
+output_to_array(
+    gpointer      user_data,
+    gconstpointer buf,
+    gsize         len,
+    char        **errmsg G_GNUC_UNUSED)
+{
+    g_byte_array_append((GByteArray *)user_data, buf, len);
+    return TRUE;
+}
+
+/* Uncompress a series of gzip members, as 'gzip -dc' does */
+static GByteArray *
+gunzip(
+    GByteArray *gz)
+{
+    GByteArray *out = g_byte_array_new();
+    guint8 buf[65536];
+    z_stream zs;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    if (inflateInit2(&zs, 16 + 15) != Z_OK)
+	return NULL;
+    zs.next_in = gz->data;
+    zs.avail_in = gz->len;
+    for (;;) {
+	zs.next_out = buf;
+	zs.avail_out = sizeof(buf);
+	rc = inflate(&zs, Z_NO_FLUSH);
+	g_byte_array_append(out, buf, sizeof(buf) - zs.avail_out);
+	if (rc == Z_STREAM_END) {
+	    if (zs.avail_in == 0)
+		break;
+	    inflateReset(&zs);
+	} else if (rc != Z_OK) {
+	    tu_dbg("inflate failed: %d\n", rc);
+	    inflateEnd(&zs);
+	    g_byte_array_free(out, TRUE);
+	    return NULL;
+	}
+    }
+    inflateEnd(&zs);
+
+    return out;
+}
+
+static gboolean
+roundtrip(
+    gsize len,
+    int   threads)
+{
+    guint8 *data = make_data(len);
+    GByteArray *gz = g_byte_array_new();
+    GByteArray *out;
+    parallel_gzip_t *pgz;
+    gsize pos = 0, n = 1;
+    char *errmsg;
+    gboolean ok = TRUE;
+
+    pgz = parallel_gzip_new(6, threads, output_to_array, gz);
+    /* writes of many sizes, across block boundaries */
+    while (pos < len) {
+	n = MIN(n * 3 + 7, len - pos);
+	if (!parallel_gzip_write(pgz, data + pos, n)) {
+	    tu_dbg("parallel_gzip_write failed\n");
+	    ok = FALSE;
+	}
+	pos += n;
+    }
+    if (!parallel_gzip_finish(pgz)) {
+	tu_dbg("parallel_gzip_finish failed\n");
+	ok = FALSE;
+    }
+    errmsg = parallel_gzip_free(pgz);
+    if (errmsg) {
+	tu_dbg("error: %s\n", errmsg);
+	g_free(errmsg);
+	ok = FALSE;
+    }
+
+    out = gunzip(gz);
+    if (!out) {
+	ok = FALSE;
+    } else {
+	if (out->len != len || memcmp(out->data, data, len) != 0) {
+	    tu_dbg("got %u bytes back from %u\n", out->len, (guint)len);
+	    ok = FALSE;
+	}
+	g_byte_array_free(out, TRUE);
+    }
+    if (len >= PARALLEL_GZIP_BLOCK_SIZE && gz->len >= len / 2) {
+	tu_dbg("%u bytes compressed to %u\n", (guint)len, gz->len);
+	ok = FALSE;
+    }
+
+    g_byte_array_free(gz, TRUE);
+    g_free(data);
+    return ok;
+}
+
+/*
+ * Tests
+ */
+
+static gboolean
+test_roundtrip(void)
+{
+    return roundtrip(5 * PARALLEL_GZIP_BLOCK_SIZE + 12345, 0);
+}
+
+static gboolean
+test_roundtrip_one_thread(void)
+{
+    return roundtrip(3 * PARALLEL_GZIP_BLOCK_SIZE, 1);
+}
+
+static gboolean
+test_roundtrip_small(void)
+{
+    return roundtrip(100, 4);
+}
+
+static gboolean
+test_empty(void)
+{
+    /* still a valid gzip file */
+    return roundtrip(0, 0);
+}
+
+static gboolean
+output_fails(
+    gpointer      user_data G_GNUC_UNUSED,
+    gconstpointer buf G_GNUC_UNUSED,
+    gsize         len G_GNUC_UNUSED,
+    char        **errmsg)
+{
+    *errmsg = g_strdup("no space left");
+    return FALSE;
+}
+
+static gboolean
+test_output_error(void)
+{
+    guint8 *data = make_data(4 * PARALLEL_GZIP_BLOCK_SIZE);
+    parallel_gzip_t *pgz;
+    gboolean ok = TRUE;
+    char *errmsg;
+    int i;
+
+    pgz = parallel_gzip_new(1, 2, output_fails, NULL);
+    for (i = 0; i < 4; i++) {
+	parallel_gzip_write(pgz, data + i * PARALLEL_GZIP_BLOCK_SIZE,
+			    PARALLEL_GZIP_BLOCK_SIZE);
+    }
+    if (parallel_gzip_finish(pgz)) {
+	tu_dbg("parallel_gzip_finish succeeded\n");
+	ok = FALSE;
+    }
+    if (parallel_gzip_write(pgz, data, 10)) {
+	tu_dbg("parallel_gzip_write succeeded after an error\n");
+	ok = FALSE;
+    }
+    errmsg = parallel_gzip_free(pgz);
+    if (!errmsg || !g_str_equal(errmsg, "no space left")) {
+	tu_dbg("got error '%s'\n", errmsg ? errmsg : "(null)");
+	ok = FALSE;
+    }
+
+    g_free(errmsg);
+    g_free(data);
+    return ok;
+}
+
+static gboolean
+test_fd(void)
+{
+    gsize len = 2 * PARALLEL_GZIP_BLOCK_SIZE + 99;
+    guint8 *data = make_data(len);
+    char *in_filename = "parallel-gzip-test.in";
+    char *out_filename = "parallel-gzip-test.out.gz";
+    guint8 *buf;
+    gzFile gz;
+    int infd, outfd;
+    int n;
+    char *errmsg;
+    gboolean ok = TRUE;
+
+    infd = open(in_filename, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    outfd = open(out_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (infd < 0 || outfd < 0) {
+	tu_dbg("open: %s\n", strerror(errno));
+	return FALSE;
+    }
+    if (full_write(infd, data, len) != len) {
+	tu_dbg("write: %s\n", strerror(errno));
+	return FALSE;
+    }
+    lseek(infd, 0, SEEK_SET);
+
+    errmsg = parallel_gzip_fd(infd, outfd, 9, 3);
+    if (errmsg) {
+	tu_dbg("parallel_gzip_fd: %s\n", errmsg);
+	g_free(errmsg);
+	ok = FALSE;
+    }
+    close(infd);
+    close(outfd);
+
+    /* gzread reads every member, like 'gzip -dc' */
+    buf = g_malloc(len + 1);
+    gz = gzopen(out_filename, "rb");
+    if (!gz) {
+	tu_dbg("gzopen failed\n");
+	ok = FALSE;
+    } else {
+	n = gzread(gz, buf, len + 1);
+	if (n != (int)len || memcmp(buf, data, len) != 0) {
+	    tu_dbg("gzread returned %d bytes, expected %u\n", n, (guint)len);
+	    ok = FALSE;
+	}
+	gzclose(gz);
+    }
+
+    unlink(in_filename);
+    unlink(out_filename);
+    g_free(buf);
+    g_free(data);
+    return ok;
+}
+
+#endif /* HAVE_LIBZ */
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+#ifdef HAVE_LIBZ
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_roundtrip, 90),
+	TU_TEST(test_roundtrip_one_thread, 90),
+	TU_TEST(test_roundtrip_small, 90),
+	TU_TEST(test_empty, 90),
+	TU_TEST(test_output_error, 90),
+	TU_TEST(test_fd, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+#else
+    g_fprintf(stderr, "Amanda was built without zlib -- nothing to test\n");
+    return 0;
+#endif
+}
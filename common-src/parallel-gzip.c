@@ -0,0 +1,385 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+/*
+ * In-process gzip compression on a pool of threads.
+ */
+
+#include "amanda.h"
+#include "parallel-gzip.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* The buffer parallel_gzip_fd reads into */
+#define PARALLEL_GZIP_READ_SIZE	(128*1024)
+
+typedef struct gzip_block_s {
+    guint8   *in;
+    gsize     in_len;
+    guint8   *out;
+    gsize     out_len;
+    gboolean  done;		/* protected by the mutex */
+    char     *errmsg;
+} gzip_block_t;
+
+struct parallel_gzip_s {
+    int level;
+    parallel_gzip_output_fn output;
+    gpointer user_data;
+
+    GThreadPool *pool;
+    GMutex *mutex;
+    GCond *cond;		/* a block is done */
+
+    /* the blocks given to the pool, in order; ring[first] is the next one to
+     * be output.  Only the thread writing changes these, under the mutex. */
+    gzip_block_t **ring;
+    guint ring_size;
+    guint first;
+    guint count;
+
+    gzip_block_t *filling;	/* the block being filled */
+    gboolean started;		/* a block was given to the pool */
+    char *errmsg;
+};
+
+gboolean
+parallel_gzip_usable(void)
+{
+#ifdef HAVE_LIBZ
+    /* zlib only speaks gzip's format */
+    return g_str_equal(COMPRESS_SUFFIX, ".gz");
+#else
+    return FALSE;
+#endif
+}
+
+static guint
+online_processors(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > 0)
+	return (guint)n;
+#endif
+    return 1;
+}
+
+static void
+block_free(
+    gzip_block_t *block)
+{
+    g_free(block->in);
+    g_free(block->out);
+    g_free(block->errmsg);
+    g_free(block);
+}
+
+/* Compress block->in into a complete gzip member in block->out */
+static void
+compress_block(
+    gzip_block_t *block,
+    int           level)
+{
+#ifdef HAVE_LIBZ
+    z_stream zs;
+    gsize bound;
+    int rc;
+
+    memset(&zs, 0, sizeof(zs));
+    /* 16 + the window size asks for a gzip header and trailer */
+    rc = deflateInit2(&zs, level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY);
+    if (rc != Z_OK) {
+	block->errmsg = g_strdup_printf(_("cannot initialize zlib: %s"),
+				zs.msg ? zs.msg : _("out of memory"));
+	return;
+    }
+
+    /* deflateBound does not count the gzip header in older zlibs */
+    bound = deflateBound(&zs, block->in_len) + 64;
+    block->out = g_malloc(bound);
+    zs.next_in = block->in;
+    zs.avail_in = block->in_len;
+    zs.next_out = block->out;
+    zs.avail_out = bound;
+    rc = deflate(&zs, Z_FINISH);
+    if (rc == Z_STREAM_END) {
+	block->out_len = zs.total_out;
+    } else {
+	block->errmsg = g_strdup_printf(_("zlib compression failed: %s"),
+				zs.msg ? zs.msg : _("unknown error"));
+    }
+    deflateEnd(&zs);
+#else
+    (void)level;
+    block->errmsg = g_strdup(_("Amanda was built without zlib"));
+#endif
+
+    amfree(block->in);
+}
+
+static void
+compress_block_fn(
+    gpointer data,
+    gpointer user_data)
+{
+    gzip_block_t *block = data;
+    parallel_gzip_t *pgz = user_data;
+
+    compress_block(block, pgz->level);
+
+    g_mutex_lock(pgz->mutex);
+    block->done = TRUE;
+    g_cond_broadcast(pgz->cond);
+    g_mutex_unlock(pgz->mutex);
+}
+
+/*
+ * Take the next block to output off the ring, if it's done.  If wait is
+ * TRUE, wait until it is done.  Returns NULL if the ring is empty, or if the
+ * block is not done and wait is FALSE.
+ */
+static gzip_block_t *
+take_done_block(
+    parallel_gzip_t *pgz,
+    gboolean         wait)
+{
+    gzip_block_t *block = NULL;
+
+    g_mutex_lock(pgz->mutex);
+    if (pgz->count > 0) {
+	while (wait && !pgz->ring[pgz->first]->done)
+	    g_cond_wait(pgz->cond, pgz->mutex);
+	if (pgz->ring[pgz->first]->done) {
+	    block = pgz->ring[pgz->first];
+	    pgz->first = (pgz->first + 1) % pgz->ring_size;
+	    pgz->count--;
+	}
+    }
+    g_mutex_unlock(pgz->mutex);
+
+    return block;
+}
+
+/* Output a block that is done, then free it; nothing is output after an
+ * error. */
+static void
+output_block(
+    parallel_gzip_t *pgz,
+    gzip_block_t    *block)
+{
+    if (!pgz->errmsg) {
+	if (block->errmsg) {
+	    pgz->errmsg = block->errmsg;
+	    block->errmsg = NULL;
+	} else if (!pgz->output(pgz->user_data, block->out, block->out_len,
+				&pgz->errmsg)) {
+	    if (!pgz->errmsg)
+		pgz->errmsg = g_strdup(_("cannot output compressed data"));
+	}
+    }
+    block_free(block);
+}
+
+/* Give the block being filled to the pool */
+static void
+submit_block(
+    parallel_gzip_t *pgz)
+{
+    gzip_block_t *block = pgz->filling;
+    gzip_block_t *done;
+
+    pgz->filling = NULL;
+
+    /* bound the memory in use by waiting for the oldest block */
+    if (pgz->count == pgz->ring_size) {
+	done = take_done_block(pgz, TRUE);
+	output_block(pgz, done);
+    }
+
+    g_mutex_lock(pgz->mutex);
+    pgz->ring[(pgz->first + pgz->count) % pgz->ring_size] = block;
+    pgz->count++;
+    g_mutex_unlock(pgz->mutex);
+    pgz->started = TRUE;
+    g_thread_pool_push(pgz->pool, block, NULL);
+
+    /* and output whatever is ready */
+    while ((done = take_done_block(pgz, FALSE)) != NULL)
+	output_block(pgz, done);
+}
+
+parallel_gzip_t *
+parallel_gzip_new(
+    int                     level,
+    int                     threads,
+    parallel_gzip_output_fn output,
+    gpointer                user_data)
+{
+    parallel_gzip_t *pgz = g_new0(parallel_gzip_t, 1);
+
+    if (threads <= 0)
+	threads = MIN(online_processors(), PARALLEL_GZIP_MAX_THREADS);
+
+    pgz->level = level;
+    pgz->output = output;
+    pgz->user_data = user_data;
+    pgz->mutex = g_mutex_new();
+    pgz->cond = g_cond_new();
+    /* enough blocks to keep every thread busy while the oldest is output */
+    pgz->ring_size = 2 * threads;
+    pgz->ring = g_new0(gzip_block_t *, pgz->ring_size);
+    pgz->pool = g_thread_pool_new(compress_block_fn, pgz, threads, FALSE,
+				  NULL);
+
+    return pgz;
+}
+
+gboolean
+parallel_gzip_write(
+    parallel_gzip_t *pgz,
+    gconstpointer    buf,
+    gsize            len)
+{
+    const guint8 *p = buf;
+    gsize n;
+
+    while (len > 0 && !pgz->errmsg) {
+	if (!pgz->filling) {
+	    pgz->filling = g_new0(gzip_block_t, 1);
+	    pgz->filling->in = g_malloc(PARALLEL_GZIP_BLOCK_SIZE);
+	}
+
+	n = MIN(len, PARALLEL_GZIP_BLOCK_SIZE - pgz->filling->in_len);
+	memcpy(pgz->filling->in + pgz->filling->in_len, p, n);
+	pgz->filling->in_len += n;
+	p += n;
+	len -= n;
+
+	if (pgz->filling->in_len == PARALLEL_GZIP_BLOCK_SIZE)
+	    submit_block(pgz);
+    }
+
+    return pgz->errmsg == NULL;
+}
+
+gboolean
+parallel_gzip_finish(
+    parallel_gzip_t *pgz)
+{
+    gzip_block_t *done;
+
+    if (!pgz->errmsg) {
+	/* an empty input still makes a gzip file */
+	if (!pgz->filling && !pgz->started)
+	    pgz->filling = g_new0(gzip_block_t, 1);
+	if (pgz->filling)
+	    submit_block(pgz);
+    }
+
+    while ((done = take_done_block(pgz, TRUE)) != NULL)
+	output_block(pgz, done);
+
+    return pgz->errmsg == NULL;
+}
+
+char *
+parallel_gzip_free(
+    parallel_gzip_t *pgz)
+{
+    gzip_block_t *done;
+    char *errmsg;
+
+    /* wait for the blocks still being compressed, and drop them */
+    while ((done = take_done_block(pgz, TRUE)) != NULL)
+	block_free(done);
+    g_thread_pool_free(pgz->pool, FALSE, TRUE);
+
+    if (pgz->filling)
+	block_free(pgz->filling);
+    g_free(pgz->ring);
+    g_cond_free(pgz->cond);
+    g_mutex_free(pgz->mutex);
+
+    errmsg = pgz->errmsg;
+    g_free(pgz);
+
+    return errmsg;
+}
+
+static gboolean
+output_to_fd(
+    gpointer      user_data,
+    gconstpointer buf,
+    gsize         len,
+    char        **errmsg)
+{
+    int fd = *(int *)user_data;
+
+    if (full_write(fd, buf, len) != len) {
+	*errmsg = g_strdup_printf(_("write error: %s"), strerror(errno));
+	return FALSE;
+    }
+    return TRUE;
+}
+
+char *
+parallel_gzip_fd(
+    int infd,
+    int outfd,
+    int level,
+    int threads)
+{
+    parallel_gzip_t *pgz;
+    char *buf;
+    ssize_t n;
+
+    pgz = parallel_gzip_new(level, threads, output_to_fd, &outfd);
+    buf = g_malloc(PARALLEL_GZIP_READ_SIZE);
+
+    for (;;) {
+	n = read(infd, buf, PARALLEL_GZIP_READ_SIZE);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0) {
+	    if (!pgz->errmsg)
+		pgz->errmsg = g_strdup_printf(_("read error: %s"),
+					      strerror(errno));
+	    break;
+	}
+	if (n == 0) {
+	    parallel_gzip_finish(pgz);
+	    break;
+	}
+	if (!parallel_gzip_write(pgz, buf, n))
+	    break;
+    }
+
+    g_free(buf);
+    return parallel_gzip_free(pgz);
+}
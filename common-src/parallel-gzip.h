@@ -0,0 +1,92 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+/*
+ * In-process gzip compression on a pool of threads, in place of running
+ * COMPRESS_PATH.
+ *
+ * The input is cut into blocks that are compressed independently, each into
+ * a complete gzip member, and the members are output in order.  'gzip -dc'
+ * reads a series of members as a single stream, so the output can be
+ * restored exactly like the output of COMPRESS_PATH.  This is only possible
+ * when Amanda is built with zlib and COMPRESS_PATH is gzip; callers check
+ * parallel_gzip_usable() and run COMPRESS_PATH otherwise.
+ */
+#ifndef PARALLEL_GZIP_H
+#define PARALLEL_GZIP_H
+
+#include "amanda.h"
+
+/* The size of the blocks compressed by each thread */
+#define PARALLEL_GZIP_BLOCK_SIZE	(1024*1024)
+
+/* The default number of threads is the number of processors, up to this */
+#define PARALLEL_GZIP_MAX_THREADS	8
+
+typedef struct parallel_gzip_s parallel_gzip_t;
+
+/* Called with each piece of compressed output, in order, from the thread
+ * calling parallel_gzip_write or parallel_gzip_finish.  Returns FALSE, with
+ * *errmsg set to an allocated message, on error. */
+typedef gboolean (*parallel_gzip_output_fn)(gpointer user_data,
+					     gconstpointer buf, gsize len,
+					     char **errmsg);
+
+/* Return TRUE if the output of this module can be read by UNCOMPRESS_PATH */
+gboolean parallel_gzip_usable(void);
+
+/* Create a compressor.
+ *
+ * @param level: zlib compression level, 1 (fast) to 9 (best)
+ * @param threads: number of threads; 0 for the default
+ * @param output: where the compressed data goes
+ * @param user_data: passed to output
+ * @returns: a new compressor
+ */
+parallel_gzip_t *parallel_gzip_new(int level, int threads,
+				   parallel_gzip_output_fn output,
+				   gpointer user_data);
+
+/* Add data to be compressed.  Some compressed data may be output before this
+ * returns.  Returns FALSE if compressing or output failed, now or earlier.
+ */
+gboolean parallel_gzip_write(parallel_gzip_t *pgz, gconstpointer buf,
+			     gsize len);
+
+/* Compress and output everything that is left.  Returns FALSE on error. */
+gboolean parallel_gzip_finish(parallel_gzip_t *pgz);
+
+/* Free the compressor, waiting for its threads.  Returns the first error
+ * message, which the caller must free, or NULL if there was none.
+ */
+char *parallel_gzip_free(parallel_gzip_t *pgz);
+
+/* Compress everything read from infd to outfd.  Neither fd is closed.
+ *
+ * @returns: NULL on success, or an allocated error message
+ */
+char *parallel_gzip_fd(int infd, int outfd, int level, int threads);
+
+#endif /* PARALLEL_GZIP_H */
@@ -7,7 +7,7 @@ char skip_argument[1];
 
 pid_t pipespawnv_passwd(char *prog, int pipedef, int need_root,
                   int *stdinfd, int *stdoutfd, int *stderrfd,
-                  char **my_argv);
+                  char **add_env, char **my_argv);
 
 
 /*
@@ -50,7 +50,7 @@ pipespawn(
     arglist_end(ap);
 
     pid = pipespawnv_passwd(prog, pipedef, need_root,
-			    stdinfd, stdoutfd, stderrfd, argv);
+			    stdinfd, stdoutfd, stderrfd, NULL, argv);
     amfree(argv);
     return pid;
 }
@@ -67,7 +67,23 @@ pipespawnv(
 {
     return pipespawnv_passwd(prog, pipedef, need_root,
 			     stdinfd, stdoutfd, stderrfd,
-	my_argv);
+	NULL, my_argv);
+}
+
+pid_t
+pipespawnv_env(
+    char *	prog,
+    int		pipedef,
+    int		need_root,
+    int *	stdinfd,
+    int *	stdoutfd,
+    int *	stderrfd,
+    char **	add_env,
+    char **	my_argv)
+{
+    return pipespawnv_passwd(prog, pipedef, need_root,
+			     stdinfd, stdoutfd, stderrfd,
+	add_env, my_argv);
 }
 
 pid_t
@@ -78,6 +94,7 @@ pipespawnv_passwd(
     int *	stdinfd,
     int *	stdoutfd,
     int *	stderrfd,
+    char **	add_env,
     char **	my_argv)
 {
     pid_t pid;
@@ -218,10 +235,11 @@ pipespawnv_passwd(
 	}
 
 	/*
-	 * Get the "safe" environment.  If we are sending a password to
-	 * the child via a pipe, add the environment variable for that.
+	 * Get the "safe" environment, plus ADD_ENV.  If we are sending a
+	 * password to the child via a pipe, add the environment variable
+	 * for that.
 	 */
-	env = safe_env();
+	env = safe_env_full(add_env);
 	if ((pipedef & PASSWD_PIPE) != 0) {
 	    for (i = 0; env[i] != NULL; i++)
 		(void)i; /* make lint happy and do nothing */	
@@ -18,5 +18,10 @@ pid_t pipespawn(char *prog, int pipedef, int need_root,
 pid_t pipespawnv(char *prog, int pipedef, int need_root,
 		  int *stdinfd, int *stdoutfd, int *stderrfd,
 		  char **my_argv);
+/* like pipespawnv, but ADD_ENV ("NAME=value" strings, NULL-terminated) is
+ * added to the child's safe environment */
+pid_t pipespawnv_env(char *prog, int pipedef, int need_root,
+		     int *stdinfd, int *stdoutfd, int *stderrfd,
+		     char **add_env, char **my_argv);
 
 #endif /* PIPESPAWN_H */
@@ -0,0 +1,334 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "event.h"
+#include "security.h"
+#include "security-util.h"
+#include "simpleprng.h"
+#include "testutils.h"
+
+/* tokens the async writer keeps queued */
+#define WRITE_WINDOW 64
+
+/*
+ * Utilities
+ */
+
+/* One end of a tcpm connection over one side of a socketpair, with the
+ * BSDTCP driver's plain read and write functions. */
+static struct sec_handle *
+make_handle(
+    int fd)
+{
+    const security_driver_t *driver = security_getdriver("BSDTCP");
+    struct sec_handle *rh = g_new0(struct sec_handle, 1);
+
+    security_handleinit(&rh->sech, driver);
+    rh->rc = sec_tcp_conn_get(NULL, "localhost", 1);
+    rh->rc->read = rh->rc->write = fd;
+    rh->rc->driver = driver;
+    rh->hostname = g_strdup(rh->rc->hostname);
+
+    return rh;
+}
+
+/* token n is between 1 byte and four network blocks long, with many small
+ * ones; in bench mode, every token is the same size */
+static size_t fixed_token_size = 0;
+
+static size_t
+token_size(
+    int n)
+{
+    if (fixed_token_size)
+	return fixed_token_size;
+    switch (n % 4) {
+    case 0: return 1 + n % 100;
+    case 1: return NETWORK_BLOCK_BYTES;
+    case 2: return 1 + (n * 7919) % (4 * NETWORK_BLOCK_BYTES);
+    default: return 8;
+    }
+}
+
+/* token n is filled from simpleprng seeded with n + 1, since 0 is not a
+ * valid seed */
+static gpointer
+make_token(
+    int n)
+{
+    size_t size = token_size(n);
+
+    if (fixed_token_size) {
+	return g_malloc0(size);
+    } else {
+	simpleprng_state_t prng;
+	guint8 *buf = g_malloc(size);
+
+	simpleprng_seed(&prng, n + 1);
+	simpleprng_fill_buffer(&prng, buf, size);
+	return buf;
+    }
+}
+
+typedef struct reader_s {
+    struct sec_stream *rs;
+    int ntokens;
+    int received;
+    guint64 bytes;
+    gboolean ok;
+} reader_t;
+
+static void
+read_token(
+    void   *cookie,
+    void   *buf,
+    ssize_t size)
+{
+    reader_t *reader = cookie;
+    int n = reader->received;
+
+    if (size <= 0) {
+	tu_dbg("read error after %d tokens: %s\n", n,
+	       security_stream_geterror(&reader->rs->secstr));
+	reader->ok = FALSE;
+	return;
+    }
+
+    if ((size_t)size != token_size(n)) {
+	tu_dbg("token %d is %zd bytes, expected %zu\n", n, size, token_size(n));
+	reader->ok = FALSE;
+    } else if (!fixed_token_size) {
+	simpleprng_state_t prng;
+
+	simpleprng_seed(&prng, n + 1);
+	if (!simpleprng_verify_buffer(&prng, buf, size)) {
+	    tu_dbg("token %d is corrupt\n", n);
+	    reader->ok = FALSE;
+	}
+    }
+    reader->bytes += size;
+
+    if (++reader->received == reader->ntokens)
+	security_stream_read_cancel(&reader->rs->secstr);
+}
+
+typedef struct writer_s {
+    struct sec_stream *rs;
+    int ntokens;
+    int queued;
+    int done;
+    gboolean ok;
+} writer_t;
+
+static void write_window(writer_t *writer);
+
+static void
+wrote_token(
+    void   *cookie,
+    ssize_t stack_size G_GNUC_UNUSED,
+    void   *buf,
+    ssize_t size)
+{
+    writer_t *writer = cookie;
+
+    g_free(buf);
+    if (size < 0) {
+	tu_dbg("write error: %s\n",
+	       security_stream_geterror(&writer->rs->secstr));
+	writer->ok = FALSE;
+	return;
+    }
+    writer->done++;
+    write_window(writer);
+}
+
+static void
+write_window(
+    writer_t *writer)
+{
+    while (writer->queued < writer->ntokens &&
+	   writer->queued - writer->done < WRITE_WINDOW) {
+	int n = writer->queued++;
+
+	security_stream_write_async(&writer->rs->secstr, make_token(n),
+				    token_size(n), wrote_token, writer);
+    }
+}
+
+/*
+ * Send ntokens from a stream client to a stream server, either
+ * asynchronously from this process or with blocking writes from a child.
+ * Returns the bytes received, or -1 on error.
+ */
+static gint64
+transfer(
+    int      ntokens,
+    gboolean async)
+{
+    struct sec_handle *server_h, *client_h;
+    struct sec_stream *client_s;
+    reader_t reader;
+    writer_t writer;
+    int sv[2];
+    pid_t pid = -1;
+    int status;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+	tu_dbg("socketpair: %s\n", strerror(errno));
+	return -1;
+    }
+
+    server_h = make_handle(sv[0]);
+    memset(&reader, 0, sizeof(reader));
+    reader.rs = tcpma_stream_server(server_h);
+    reader.ntokens = ntokens;
+    reader.ok = TRUE;
+
+    if (!async) {
+	pid = fork();
+	if (pid == 0) {
+	    int n;
+
+	    close(sv[0]);
+	    client_h = make_handle(sv[1]);
+	    client_s = tcpma_stream_client(client_h, reader.rs->handle);
+	    for (n = 0; n < ntokens; n++) {
+		gpointer buf = make_token(n);
+
+		if (security_stream_write(&client_s->secstr, buf,
+					  token_size(n)) < 0)
+		    exit(1);
+		g_free(buf);
+	    }
+	    exit(0);
+	}
+	close(sv[1]);
+    } else {
+	client_h = make_handle(sv[1]);
+	client_s = tcpma_stream_client(client_h, reader.rs->handle);
+	memset(&writer, 0, sizeof(writer));
+	writer.rs = client_s;
+	writer.ntokens = ntokens;
+	writer.ok = TRUE;
+	write_window(&writer);
+    }
+
+    security_stream_read(&reader.rs->secstr, read_token, &reader);
+    event_loop(0);
+
+    if (reader.received != ntokens) {
+	tu_dbg("received %d of %d tokens\n", reader.received, ntokens);
+	reader.ok = FALSE;
+    }
+    if (async) {
+	if (!writer.ok || writer.done != ntokens) {
+	    tu_dbg("wrote %d of %d tokens\n", writer.done, ntokens);
+	    reader.ok = FALSE;
+	}
+	close(sv[1]);
+    } else {
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    tu_dbg("writer failed\n");
+	    reader.ok = FALSE;
+	}
+    }
+    close(sv[0]);
+
+    return reader.ok ? (gint64)reader.bytes : -1;
+}
+
+/*
+ * Tests
+ */
+
+static gboolean
+test_blocking(void)
+{
+    return transfer(2000, FALSE) >= 0;
+}
+
+static gboolean
+test_async(void)
+{
+    return transfer(2000, TRUE) >= 0;
+}
+
+/*
+ * Benchmark
+ */
+
+/* security-util-test --bench [MB [bytes]]: send MB megabytes in tokens of
+ * the given size through a stream, blocking and async, and report the
+ * tokens and bytes per second */
+static void
+bench(
+    int    mbytes,
+    size_t size)
+{
+    int ntokens;
+    int async;
+
+    fixed_token_size = size;
+    ntokens = (int)(((guint64)mbytes * 1024 * 1024) / size);
+    for (async = 0; async < 2; async++) {
+	GTimer *timer = g_timer_new();
+	gint64 bytes = transfer(ntokens, async);
+	gdouble elapsed = g_timer_elapsed(timer, NULL);
+
+	g_timer_destroy(timer);
+	if (bytes < 0) {
+	    g_fprintf(stderr, "transfer failed\n");
+	    exit(1);
+	}
+	g_fprintf(stdout, "%s, %zu-byte tokens: %d tokens in %.2fs: %.0f tokens/s, %.1f MB/s\n",
+		  async ? "async" : "blocking", size, ntokens, elapsed,
+		  elapsed > 0 ? ntokens / elapsed : 0.0,
+		  elapsed > 0 ? bytes / elapsed / (1024 * 1024) : 0.0);
+    }
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_blocking, 90),
+	TU_TEST(test_async, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    /* security-util-test --bench [MB [bytes]]: benchmark instead of testing */
+    if (argc > 1 && g_str_equal(argv[1], "--bench")) {
+	bench(argc > 2 ? atoi(argv[2]) : 1024,
+	      argc > 3 ? (size_t)atoi(argv[3]) : 512);
+	return 0;
+    }
+
+    return testutils_run_tests(argc, argv, tests);
+}
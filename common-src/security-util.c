@@ -42,6 +42,7 @@
 #include "security-util.h"
 #include "stream.h"
 #include "sockaddr-util.h"
+#include <poll.h>
 
 /*
  * This is a queue of open connections
@@ -50,6 +51,12 @@ GSList *connq = NULL;
 static int newhandle = 1;
 static event_id_t newevent = 1;
 
+/* Most queued tokens sent by a single data_write_non_blocking call */
+#define TCPM_WRITEV_TOKENS 16
+
+/* Most recycled async_write_data kept by a connection */
+#define TCPM_ASYNC_WRITE_FREE_MAX 64
+
 /*
  * Local functions
  */
@@ -64,7 +71,8 @@ static void sec_tcp_conn_read_callback(void *);
 
 static void tcpm_send_token_helper(struct tcp_conn *rc, int handle,
 			           const void *buf, size_t len,
-				   struct iovec **iov, int *nb_iov,
+				   guint32 *header,
+				   struct iovec *iov, int *nb_iov,
 				   char **envbuf, ssize_t *encsize);
 static void tcpm_send_token_callback(void *cookie);
 
@@ -562,6 +570,7 @@ tcpm_stream_resume(
 /*
  * Transmits a chunk of data over a rsh_handle, adding
  * the necessary headers to allow the remote end to decode it.
+ * header is the caller's room for the two header words.
  */
 static void
 tcpm_send_token_helper(
@@ -569,17 +578,14 @@ tcpm_send_token_helper(
     int		     handle,
     const void      *buf,
     size_t	     len,
-    struct iovec   **iov,
+    guint32	    *header,
+    struct iovec    *iov,
     int             *nb_iov,
     char           **encbuf,
     ssize_t         *encsize)
 {
-    guint32		*nethandle = g_malloc(sizeof(guint32));
-    guint32		*netlength = g_malloc(sizeof(guint32));
     time_t		logtime;
 
-    assert(sizeof(*netlength) == 4);
-
     logtime = time(NULL);
     if (logtime > rc->logstamp + 10) {
 	g_debug("tcpm_send_token: data is still flowing");
@@ -593,35 +599,33 @@ tcpm_send_token_helper(
      *   32 bit length (network byte order)
      *   32 bit handle (network byte order)
      *   data
+     * The two header words go out as a single iovec.
      */
-    *netlength = htonl(len);
-    (*iov)[0].iov_base = (void *)netlength;
-    (*iov)[0].iov_len = sizeof(*netlength);
-
-    *nethandle = htonl((guint32)handle);
-    (*iov)[1].iov_base = (void *)nethandle;
-    (*iov)[1].iov_len = sizeof(*nethandle);
+    header[0] = htonl(len);
+    header[1] = htonl((guint32)handle);
+    iov[0].iov_base = (void *)header;
+    iov[0].iov_len = 2 * sizeof(guint32);
 
     *encbuf = (char *)buf;
     *encsize = len;
 
     if(len == 0) {
-	(*iov)[2].iov_base = NULL;
-	(*iov)[2].iov_len = 0;
-	*nb_iov = 2;
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	*nb_iov = 1;
     }
     else {
 	if (rc->driver->data_encrypt == NULL) {
-	    (*iov)[2].iov_base = (void *)buf;
-	    (*iov)[2].iov_len = len;
+	    iov[1].iov_base = (void *)buf;
+	    iov[1].iov_len = len;
 	} else {
 	    /* (the extra (void *) cast is to quiet type-punning warnings) */
 	    rc->driver->data_encrypt(rc, (void *)buf, len, (void **)(void *)encbuf, encsize);
-	    (*iov)[2].iov_base = (void *)*encbuf;
-	    (*iov)[2].iov_len = *encsize;
-	    *netlength = htonl(*encsize);
+	    iov[1].iov_base = (void *)*encbuf;
+	    iov[1].iov_len = *encsize;
+	    header[0] = htonl(*encsize);
 	}
-        *nb_iov = 3;
+        *nb_iov = 2;
     }
 
     if (debug_auth >= 3) {
@@ -640,22 +644,18 @@ tcpm_send_token(
     const void *buf,
     size_t	len)
 {
-    struct iovec  iov[3];
-    struct iovec  iov_copy[3];
-    struct iovec  *iovx = iov;
-    int           nb_iov = 3;
+    guint32       header[2];
+    struct iovec  iov[2];
+    int           nb_iov = 2;
     char         *encbuf;
     ssize_t       encsize;
     int           rval;
     int           save_errno;
 
-    tcpm_send_token_helper(rc, handle, buf, len, &iovx, &nb_iov, &encbuf, &encsize);
-    /* copy iov because data_write modify it */
-    memcpy(iov_copy, iov, 3*sizeof(struct iovec));
-    rval = rc->driver->data_write(rc, iov_copy, nb_iov);
+    tcpm_send_token_helper(rc, handle, buf, len, header, iov, &nb_iov, &encbuf, &encsize);
+    /* data_write modifies iov, which is ours to lose */
+    rval = rc->driver->data_write(rc, iov, nb_iov);
     save_errno = errno;
-    g_free(iov[0].iov_base);
-    g_free(iov[1].iov_base);
     if (len != 0 && rc->driver->data_encrypt != NULL && buf != encbuf) {
 	amfree(encbuf);
     }
@@ -671,6 +671,37 @@ tcpm_send_token(
     return (0);
 }
 
+/* Take a queue entry from the connection's free list, or allocate one */
+static async_write_data *
+async_write_data_new(
+    struct tcp_conn *rc)
+{
+    async_write_data *awd = rc->async_write_free;
+
+    if (awd) {
+	rc->async_write_free = awd->next;
+	rc->async_write_nfree--;
+	memset(awd, 0, sizeof(*awd));
+    } else {
+	awd = g_new0(struct async_write_data, 1);
+    }
+    return awd;
+}
+
+static void
+async_write_data_free(
+    struct tcp_conn  *rc,
+    async_write_data *awd)
+{
+    if (rc->async_write_nfree < TCPM_ASYNC_WRITE_FREE_MAX) {
+	awd->next = rc->async_write_free;
+	rc->async_write_free = awd;
+	rc->async_write_nfree++;
+    } else {
+	g_free(awd);
+    }
+}
+
 ssize_t
 tcpm_send_token_async(
     struct sec_stream *rs,
@@ -679,104 +710,155 @@ tcpm_send_token_async(
     void        (*fn)(void *, ssize_t, void *, ssize_t),
     void *      arg)
 {
-    struct iovec  iov[3];
-    struct iovec  *iovx = iov;
-    int           nb_iov = 3;
+    struct tcp_conn *rc = rs->rc;
     char         *encbuf;
     ssize_t       encsize;
     async_write_data *awd;
 
     int	handle = rs->handle;
 
-    tcpm_send_token_helper(rs->rc, handle, buf, len, &iovx, &nb_iov, &encbuf, &encsize);
+    awd = async_write_data_new(rc);
+    tcpm_send_token_helper(rc, handle, buf, len, awd->header, awd->copy_iov,
+			   &awd->copy_nb_iov, &encbuf, &encsize);
 
-    awd = g_new0(struct async_write_data, 1);
-    memcpy(awd->iov, iov, 3*sizeof(struct iovec));
-    awd->nb_iov = nb_iov;
-    memcpy(awd->copy_iov, iov, 3*sizeof(struct iovec));
-    awd->copy_nb_iov = nb_iov;
+    awd->rs = rs;
     awd->buf = encbuf;
     awd->written = 0;
     awd->fn = fn;
     awd->arg = arg;
     if (encbuf != buf)
 	amfree(buf);
-    rs->rc->async_write_data_list = g_list_append(rs->rc->async_write_data_list, awd);
-    rs->rc->async_write_data_size += 8 + len;
+    if (rc->async_write_last)
+	rc->async_write_last->next = awd;
+    else
+	rc->async_write_first = awd;
+    rc->async_write_last = awd;
+    rc->async_write_data_size += 8 + len;
 
-    if(!rs->rc->ev_write) {
-	rs->rc->ev_write = event_create(
-			(event_id_t)(rs->rc->write),
+    if(!rc->ev_write) {
+	rc->ev_write = event_create(
+			(event_id_t)(rc->write),
 			EV_WRITEFD, tcpm_send_token_callback, rs);
-	event_activate(rs->rc->ev_write);
+	event_activate(rc->ev_write);
     }
-    return (rs->rc->async_write_data_size);
+    return (rc->async_write_data_size);
 }
 
+/*
+ * Write as much of the queue as the socket takes, up to
+ * TCPM_WRITEV_TOKENS tokens in a single data_write_non_blocking call.
+ */
 static void
 tcpm_send_token_callback(
     void *      cookie)
 {
     struct sec_stream *rs = cookie;
-    gboolean done = FALSE;
-    async_write_data *awd = NULL;
-
-    if (rs->rc->async_write_data_list) {
-	int rval;
+    struct tcp_conn *rc = rs->rc;
+    struct iovec iov[TCPM_WRITEV_TOKENS * 2];
+    async_write_data *awd;
+    async_write_data *next;
+    struct sec_stream *closing = NULL;
+    int nb_iov = 0;
+    int ntokens = 0;
+    int i;
+
+    for (awd = rc->async_write_first;
+	 awd != NULL && ntokens < TCPM_WRITEV_TOKENS;
+	 awd = awd->next) {
+	memcpy(iov + nb_iov, awd->copy_iov,
+	       awd->copy_nb_iov * sizeof(struct iovec));
+	nb_iov += awd->copy_nb_iov;
+	ntokens++;
+    }
+
+    if (ntokens > 0) {
+	ssize_t rval;
 	int save_errno;
-	awd = (async_write_data *)rs->rc->async_write_data_list->data;
-	rval = rs->rc->driver->data_write_non_blocking(rs->rc, awd->copy_iov, awd->copy_nb_iov);
+	rval = rc->driver->data_write_non_blocking(rc, iov, nb_iov);
 	save_errno = errno;
 	if (rval < 0) {
-	    security_stream_seterror(&rs->secstr, "write error to: %s", strerror(save_errno));
+	    awd = rc->async_write_first;
+	    security_stream_seterror(&awd->rs->secstr, "write error to: %s", strerror(save_errno));
 	    if (awd->fn) {
-		(*awd->fn)(awd->arg, rs->rc->async_write_data_size, NULL, -1);
+		(*awd->fn)(awd->arg, rc->async_write_data_size, NULL, -1);
 	    }
             return;
 	}
+	rc->async_write_data_size -= rval;
+
+	/* the tokens are written in order: give each one back what is left
+	 * of its iovecs, and finish those that are completely written */
+	nb_iov = 0;
+	for (i = 0, awd = rc->async_write_first; i < ntokens; i++, awd = next) {
+	    ssize_t before = 0;
+	    ssize_t after = 0;
+	    int j;
+
+	    next = awd->next;
+	    for (j = 0; j < awd->copy_nb_iov; j++) {
+		before += awd->copy_iov[j].iov_len;
+		after += iov[nb_iov + j].iov_len;
+		awd->copy_iov[j] = iov[nb_iov + j];
+	    }
+	    nb_iov += awd->copy_nb_iov;
+	    awd->written += before - after;
+	    if (after > 0)
+		break;
 
-	awd->written += rval;
-	rs->rc->async_write_data_size -= rval;
-	/* if completely written */
-	if (awd->copy_iov[0].iov_len == 0 &&
-	    awd->copy_iov[1].iov_len == 0 &&
-	    (awd->nb_iov < 2 || awd->copy_iov[2].iov_len == 0)) {
+	    rc->async_write_first = next;
+	    if (!next)
+		rc->async_write_last = NULL;
 	    if (awd->fn) {
-		(*awd->fn)(awd->arg, rs->rc->async_write_data_size, awd->buf, awd->written);
+		(*awd->fn)(awd->arg, rc->async_write_data_size, awd->buf, awd->written);
+	    }
+	    if (!awd->buf) {
+		/* the stream is closing; it may take the connection with it */
+		closing = awd->rs;
+		async_write_data_free(rc, awd);
+		break;
 	    }
-	    g_free(awd->iov[0].iov_base);
-	    g_free(awd->iov[1].iov_base);
-	    rs->rc->async_write_data_list = g_list_remove(rs->rc->async_write_data_list,
-						      awd);
-	    done = TRUE;
+	    async_write_data_free(rc, awd);
 	}
     }
 
     /* unschedule us */
-    if (!rs->rc->async_write_data_list) {
-	event_release(rs->rc->ev_write);
-	rs->rc->ev_write = NULL;
+    if (!rc->async_write_first && rc->ev_write) {
+	event_release(rc->ev_write);
+	rc->ev_write = NULL;
     }
 
-    if (done && !awd->buf) { /* closing */
-
-	if (rs->handle < 10000 || rs->closed_by_network == 1) {
-	    security_stream_read_cancel(&rs->secstr);
-	    rs->closed_by_network = 1;
-	    sec_tcp_conn_put(rs->rc);
+    if (closing) {
+	if (closing->handle < 10000 || closing->closed_by_network == 1) {
+	    security_stream_read_cancel(&closing->secstr);
+	    closing->closed_by_network = 1;
+	    sec_tcp_conn_put(closing->rc);
 	}
-	rs->closed_by_me = 1;
-	if (rs->closed_by_network) {
-	    amfree(((security_stream_t *)rs)->error);
+	closing->closed_by_me = 1;
+	if (closing->closed_by_network) {
+	    amfree(((security_stream_t *)closing)->error);
 	}
-
-    }
-    if (done) {
-	g_free(awd);
     }
     return;
 }
 
+/*
+ * Make rc->buffer big enough for a frame of size bytes.  The buffer is kept
+ * from one frame to the next, so this allocates only when a frame is larger
+ * than any before it.
+ */
+static void
+tcpm_reserve_buffer(
+    struct tcp_conn *rc,
+    size_t           size)
+{
+    if (rc->buffer && rc->buffer_size >= size)
+	return;
+
+    g_free(rc->buffer);
+    rc->buffer_size = MAX(size, NETWORK_BLOCK_BYTES);
+    rc->buffer = g_malloc(rc->buffer_size);
+}
+
 /*
  *  return -2 for incomplete packet
  *  return -1 on error
@@ -822,10 +904,8 @@ tcpm_recv_token(
 	    return(-2);
 	}
 	rc->size_header_read += rval;
-        amfree(rc->buffer);
 	*size = (ssize_t)ntohl(rc->netint[0]);
 	*handle = (int)ntohl(rc->netint[1]);
-        rc->buffer = NULL;
 	rc->size_buffer_read = 0;
 
 	/* amanda protocol packet can be above NETWORK_BLOCK_BYTES */
@@ -892,8 +972,8 @@ tcpm_recv_token(
 	    }
 	    if (rs && rs->shm_ring) {
 		rs->shm_ring->mc->eof_flag = TRUE;
-		sem_post(rs->shm_ring->sem_read);
-		sem_post(rs->shm_ring->sem_read);
+		shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_read);
+		shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_read);
 	    }
 	    return 0;
 	}
@@ -913,8 +993,7 @@ tcpm_recv_token(
 	}
     }
     if (!rs || !rs->shm_ring) {
-	if (!rc->buffer)
-	    rc->buffer = g_malloc((size_t)*size);
+	tcpm_reserve_buffer(rc, (size_t)*size);
 	rval = rc->driver->data_read(rc, rc->buffer + rc->size_buffer_read,
 				     (size_t)*size - rc->size_buffer_read, 0);
     } else {
@@ -939,8 +1018,7 @@ tcpm_recv_token(
 	if (rc->driver->data_decrypt) {
 
 	    // read to a buffer
-	    if (!rc->buffer)
-		rc->buffer = g_malloc((size_t)*size);
+	    tcpm_reserve_buffer(rc, (size_t)*size);
 
 	    rval = rc->driver->data_read(rc, rc->buffer + rc->size_buffer_read,
 				(size_t)*size - rc->size_buffer_read, 0);
@@ -958,6 +1036,7 @@ tcpm_recv_token(
 	    // decrypt to another buffer
 	    buf = rc->buffer;
 	    rc->buffer = NULL;
+	    rc->buffer_size = 0;
 	    rc->driver->data_decrypt(rc, buf, *size, &decbuf, &decsize);
 	    if (buf != (char *)decbuf) {
 		amfree(buf);
@@ -1017,7 +1096,7 @@ tcpm_recv_token(
 	    if (rval > 0) {
 		size_read += rval;
 		if (rs->shm_ring->mc->written == 0 && rs->shm_ring->mc->need_sem_ready) {
-		    sem_post(rs->shm_ring->sem_ready);
+		    shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_ready);
 		    if (shm_ring_sem_wait(rs->shm_ring, rs->shm_ring->sem_start) != 0) {
 			g_free(*errmsg);
 			*errmsg = g_strdup_printf("recv error: sem_wait(sem_start) failed");
@@ -1033,7 +1112,7 @@ tcpm_recv_token(
 		rs->shm_ring->mc->written += rval;
 		rs->shm_ring->data_avail += rval;
 		if (rs->shm_ring->data_avail >= rs->shm_ring->mc->consumer_block_size) {
-		    sem_post(rs->shm_ring->sem_read);
+		    shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_read);
 		    rs->shm_ring->data_avail -= rs->shm_ring->mc->consumer_block_size;
 		}
 		rc->size_buffer_read += rval;
@@ -1052,8 +1131,8 @@ tcpm_recv_token(
 	    g_debug("tcpm_recv_token: cancelling shm-ring because rval < 0");
 	    rs->shm_ring->mc->cancelled = TRUE;
 	    rs->shm_ring->mc->eof_flag = TRUE;
-	    sem_post(rs->shm_ring->sem_read);
-	    sem_post(rs->shm_ring->sem_read);
+	    shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_read);
+	    shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_read);
 	    auth_debug(1, _("tcpm_recv_token: C return(-1)\n"));
 	    amfree(buf);
 	    return (-1);
@@ -1063,8 +1142,8 @@ tcpm_recv_token(
 	    *size = 0;
 	    *handle = H_EOF;
 	    rs->shm_ring->mc->eof_flag = TRUE;
-	    sem_post(rs->shm_ring->sem_read);
-	    sem_post(rs->shm_ring->sem_read);
+	    shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_read);
+	    shm_ring_sem_post(rs->shm_ring, rs->shm_ring->sem_read);
 	    auth_debug(1, "tcpm_recv_token: C return(0)\n");
 	    amfree(buf);
 	    return (0);
@@ -1094,11 +1173,19 @@ tcpm_recv_token(
 	return (-2);
     }
     rc->size_buffer_read += rval;
-    amfree(*buf);
-    *buf = rc->buffer;
+    /* *buf is rc->pkt, the previous frame: hand the frame over, and read
+     * the next one into the old one's buffer */
+    {
+	char  *old_pkt = *buf;
+	size_t old_pkt_size = rc->pkt_size;
+
+	*buf = rc->buffer;
+	rc->pkt_size = rc->buffer_size;
+	rc->buffer = old_pkt;
+	rc->buffer_size = old_pkt_size;
+    }
     rc->size_header_read = 0;
     rc->size_buffer_read = 0;
-    rc->buffer = NULL;
 
     auth_debug(6, _("tcpm_recv_token: read %zd bytes from %d\n"), *size, *handle);
 
@@ -1109,6 +1196,7 @@ tcpm_recv_token(
 	if (*buf != (char *)decbuf) {
 	    amfree(*buf);
 	    *buf = (char *)decbuf;
+	    rc->pkt_size = decsize;
 	}
 	*size = decsize;
     }
@@ -2102,6 +2190,11 @@ sec_tcp_conn_put(
 	return;
     }
     auth_debug(1, _("sec_tcp_conn_put: closing connection to %s\n"), rc->hostname);
+    /* release the event before closing its fd, so it leaves the epoll set */
+    if (rc->ev_read != NULL) {
+	event_release(rc->ev_read);
+	rc->ev_read = NULL;
+    }
     if (rc->read != -1)
 	aclose(rc->read);
     if (rc->write != -1)
@@ -2137,14 +2230,22 @@ sec_tcp_conn_put(
 	}
 	rc->pid = -1;
     }
-    if (rc->ev_read != NULL)
-	event_release(rc->ev_read);
     if (rc->errmsg != NULL)
 	amfree(rc->errmsg);
     g_mutex_lock(security_mutex);
     connq = g_slist_remove(connq, rc);
     g_mutex_unlock(security_mutex);
     amfree(rc->pkt);
+    rc->pkt_size = 0;
+    amfree(rc->buffer);
+    rc->buffer_size = 0;
+    rc->size_header_read = 0;
+    while (rc->async_write_free) {
+	async_write_data *awd = rc->async_write_free;
+	rc->async_write_free = awd->next;
+	g_free(awd);
+    }
+    rc->async_write_nfree = 0;
     if(!rc->donotclose) {
 	/* amfree(rc) */
 	/* a memory leak occurs, but freeing it lead to memory
@@ -3184,16 +3285,14 @@ net_read_fillbuf(
     void *	buf,
     size_t	size)
 {
-    SELECT_ARG_TYPE readfds;
-    struct timeval tv;
+    struct pollfd pfd;
     ssize_t nread;
 
     auth_debug(1, _("net_read_fillbuf: begin\n"));
-    FD_ZERO(&readfds);
-    FD_SET(fd, &readfds);
-    tv.tv_sec = timeout;
-    tv.tv_usec = 0;
-    switch (select(fd + 1, &readfds, NULL, NULL, &tv)) {
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    switch (poll(&pfd, 1, timeout * 1000)) {
     case 0:
 	auth_debug(1, "net_read_fillbuf: case 0: timeout");
 	errno = ETIMEDOUT;
@@ -3203,7 +3302,10 @@ net_read_fillbuf(
 	return (-1);
     case 1:
 	auth_debug(1, _("net_read_fillbuf: case 1\n"));
-	assert(FD_ISSET(fd, &readfds));
+	if (pfd.revents & POLLNVAL) {
+	    errno = EBADF;
+	    return (-1);
+	}
 	break;
     default:
 	auth_debug(1, _("net_read_fillbuf: case default\n"));
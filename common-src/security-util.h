@@ -68,10 +68,19 @@
 #include <openssl/err.h>
 #endif
 
+struct sec_handle;
+struct sec_stream;
+
+/*
+ * A token queued by tcpm_send_token_async.  The header is kept inline, and
+ * the structures are recycled through the connection's free list, so
+ * queueing a token allocates nothing once the connection is warm.
+ */
 typedef struct async_write_data {
-    struct iovec  iov[3];
-    int           nb_iov;
-    struct iovec  copy_iov[3];
+    struct async_write_data *next;	/* in the write queue or free list */
+    struct sec_stream *rs;		/* stream the token was written to */
+    guint32       header[2];		/* length and handle, network order */
+    struct iovec  copy_iov[2];		/* what is left to write */
     int           copy_nb_iov;
     void	 *buf;
     ssize_t	  written;
@@ -79,9 +88,6 @@ typedef struct async_write_data {
     void	 *arg;
 } async_write_data;
 
-struct sec_handle;
-struct sec_stream;
-
 typedef struct reader_callback {
     int          handle;
     struct sec_stream  *s;
@@ -101,7 +107,10 @@ struct tcp_conn {
     event_handle_t *	ev_read;		/* read (EV_READFD) handle */
     event_handle_t *	ev_write;		/* write (EV_WRITEFD) handle */
     int			ev_read_refcnt;		/* number of readers */
-    GList	       *async_write_data_list;  /* list of block to write */
+    async_write_data   *async_write_first;	/* queue of tokens to write */
+    async_write_data   *async_write_last;
+    async_write_data   *async_write_free;	/* recycled queue entries */
+    int			async_write_nfree;
     ssize_t		async_write_data_size;
     char		hostname[MAX_HOSTNAME_LENGTH+1];
 						/* host we're talking to */
@@ -126,7 +135,9 @@ struct tcp_conn {
     gss_ctx_id_t	gss_context;
 #endif
     unsigned int	netint[2];
-    char *              buffer;
+    char *              buffer;			/* frame being read */
+    size_t              buffer_size;		/* allocated size of buffer */
+    size_t              pkt_size;		/* allocated size of pkt */
     ssize_t             size_header_read;
     ssize_t             size_buffer_read;
     GSource            *child_watch;
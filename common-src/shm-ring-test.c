@@ -0,0 +1,448 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "shm-ring.h"
+#include "simpleprng.h"
+#include "testutils.h"
+#include <sys/resource.h>
+
+#define TEST_IN_FILENAME "./shm-ring-test.in"
+#define TEST_OUT_FILENAME "./shm-ring-test.out"
+
+/*
+ * Utilities
+ */
+
+/* Link to the ring in a child process and copy it to fd, asking for a ring
+ * of ring_size bytes; returns the pid */
+static pid_t
+start_consumer(
+    shm_ring_t *producer,
+    int         fd,
+    size_t      ring_size)
+{
+    shm_ring_t *shm_ring;
+    pid_t pid;
+
+    switch (pid = fork()) {
+    case 0:
+	shm_ring = shm_ring_link(producer->shm_control_name);
+	shm_ring_consumer_set_size(shm_ring, ring_size, SHM_RING_BLOCK_SIZE);
+	shm_ring_to_fd(shm_ring, fd, NULL);
+	close_consumer_shm_ring(shm_ring);
+	exit(0);
+
+    case -1:
+	perror("fork");
+	exit(1);
+
+    default:
+	break;
+    }
+
+    return pid;
+}
+
+/* Put len bytes of buf in the ring, the way a glue element does, then wait
+ * for the consumer to read them all */
+static void
+produce(
+    shm_ring_t *shm_ring,
+    guint8     *buf,
+    uint64_t    len)
+{
+    uint64_t shm_ring_size = shm_ring->mc->ring_size;
+    uint64_t write_offset;
+    uint64_t written;
+    size_t n;
+
+    while (!shm_ring->mc->cancelled) {
+	write_offset = shm_ring->mc->write_offset;
+	written = shm_ring->mc->written;
+	if (written == len)
+	    break;
+
+	while (!shm_ring->mc->cancelled &&
+	       shm_ring_size - (written - shm_ring_load(&shm_ring->mc->readx))
+			< shm_ring->block_size) {
+	    shm_ring_producer_flush(shm_ring);
+	    if (shm_ring_sem_wait(shm_ring, shm_ring->sem_write) != 0)
+		break;
+	}
+	if (shm_ring->mc->cancelled)
+	    break;
+
+	n = MIN(shm_ring->block_size, shm_ring_size - write_offset);
+	n = MIN(n, len - written);
+	n = MIN(n, SHM_RING_SIZE - written % SHM_RING_SIZE);
+	memcpy(shm_ring->data + write_offset, buf + written % SHM_RING_SIZE, n);
+
+	shm_ring_produced(shm_ring, n, written + n < len);
+    }
+
+    shm_ring->mc->eof_flag = TRUE;
+    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+
+    while (!shm_ring->mc->cancelled &&
+	   shm_ring->mc->written != shm_ring_load(&shm_ring->mc->readx)) {
+	if (shm_ring_sem_wait(shm_ring, shm_ring->sem_write) != 0)
+	    break;
+    }
+}
+
+/* SHM_RING_SIZE bytes of random data; produce() repeats it */
+static guint8 *
+make_data(void)
+{
+    simpleprng_state_t prng;
+    guint8 *buf = g_malloc(SHM_RING_SIZE);
+
+    simpleprng_seed(&prng, 0xabcdef);
+    simpleprng_fill_buffer(&prng, buf, SHM_RING_SIZE);
+    return buf;
+}
+
+/* Lower this process's address space limit to what it uses now plus
+ * extra bytes, saving the old limit in old; FALSE if that can't be done */
+static gboolean
+limit_address_space(
+    rlim_t         extra,
+    struct rlimit *old)
+{
+    struct rlimit rl;
+    unsigned long pages;
+    FILE *statm;
+
+    if ((statm = fopen("/proc/self/statm", "r")) == NULL)
+	return FALSE;
+    if (fscanf(statm, "%lu", &pages) != 1) {
+	fclose(statm);
+	return FALSE;
+    }
+    fclose(statm);
+
+    if (getrlimit(RLIMIT_AS, old) == -1)
+	return FALSE;
+    rl = *old;
+    rl.rlim_cur = (rlim_t)pages * getpagesize() + extra;
+    if (old->rlim_max != RLIM_INFINITY && rl.rlim_cur > old->rlim_max)
+	return FALSE;
+    return setrlimit(RLIMIT_AS, &rl) == 0;
+}
+
+/*
+ * Tests
+ */
+
+/* How transfer limits the address space of its processes */
+#define LIMIT_NONE	0
+#define LIMIT_PRODUCER	1	/* the producer can't map the ring asked for */
+#define LIMIT_BOTH	2	/* nor can the consumer */
+
+/* Copy data through a ring of ring_size bytes to a file in another process,
+ * using fd_to_shm_ring and shm_ring_to_fd.  With a limit, the ring asked for
+ * can't be mapped and the default ring must be used instead. */
+static gboolean
+transfer(
+    size_t   ring_size,
+    gboolean huge_pages,
+    int      limit)
+{
+    gsize len = 10 * SHM_RING_SIZE + 12345;
+    guint8 *data = g_malloc(len);
+    simpleprng_state_t prng;
+    shm_ring_t *shm_ring;
+    char *errmsg = NULL;
+    crc_t crc_in, crc_out;
+    char *out;
+    gsize out_len;
+    int infd, outfd;
+    pid_t pid;
+    int status;
+    gboolean ok = TRUE;
+    struct rlimit old_rl;
+    gboolean limited = FALSE;
+
+    if (limit != LIMIT_NONE) {
+	if (!limit_address_space(ring_size / 2, &old_rl)) {
+	    tu_dbg("can't limit the address space; not testing the fallback\n");
+	    g_free(data);
+	    return TRUE;
+	}
+	setrlimit(RLIMIT_AS, &old_rl);
+    }
+
+    simpleprng_seed(&prng, 0x1234);
+    simpleprng_fill_buffer(&prng, data, len);
+    if (!g_file_set_contents(TEST_IN_FILENAME, (gchar *)data, len, NULL)) {
+	tu_dbg("could not write %s\n", TEST_IN_FILENAME);
+	return FALSE;
+    }
+    infd = open(TEST_IN_FILENAME, O_RDONLY);
+    outfd = open(TEST_OUT_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    g_assert(infd >= 0 && outfd >= 0);
+
+    shm_ring = shm_ring_create(&errmsg);
+    g_assert(shm_ring != NULL);
+    shm_ring->mc->huge_pages = huge_pages;
+    if (limit == LIMIT_BOTH)
+	limited = limit_address_space(ring_size / 2, &old_rl);
+    pid = start_consumer(shm_ring, outfd, ring_size);
+    close(outfd);
+    if (limit == LIMIT_PRODUCER)
+	limited = limit_address_space(ring_size / 2, &old_rl);
+
+    shm_ring_producer_set_size(shm_ring, SHM_RING_SIZE, SHM_RING_BLOCK_SIZE);
+    if (limited)
+	setrlimit(RLIMIT_AS, &old_rl);
+    fd_to_shm_ring(infd, shm_ring, &crc_in);
+    close(infd);
+    if (shm_ring->mc->cancelled) {
+	tu_dbg("ring was cancelled\n");
+	ok = FALSE;
+    }
+    if (limited) {
+	if (shm_ring->mc->ring_size != SHM_RING_SIZE ||
+	    shm_ring->mc->huge_pages) {
+	    tu_dbg("got a ring of %ju bytes, not the default\n",
+		   (uintmax_t)shm_ring->mc->ring_size);
+	    ok = FALSE;
+	}
+    /* the larger of the two sizes, rounded up to whole huge pages */
+    } else if (shm_ring->mc->ring_size < MAX(ring_size, SHM_RING_SIZE) ||
+	shm_ring->mc->ring_size % SHM_RING_BLOCK_SIZE != 0 ||
+	(huge_pages && shm_ring->mc->ring_size % SHM_RING_HUGE_PAGE_SIZE != 0)) {
+	tu_dbg("got a ring of %ju bytes for %zu\n",
+	       (uintmax_t)shm_ring->mc->ring_size, ring_size);
+	ok = FALSE;
+    }
+    close_producer_shm_ring(shm_ring);
+
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	tu_dbg("consumer failed\n");
+	ok = FALSE;
+    }
+
+    if (!g_file_get_contents(TEST_OUT_FILENAME, &out, &out_len, NULL)) {
+	tu_dbg("could not read %s\n", TEST_OUT_FILENAME);
+	ok = FALSE;
+    } else {
+	crc32_init(&crc_out);
+	crc32_add((uint8_t *)out, out_len, &crc_out);
+	if (out_len != len || memcmp(out, data, len) != 0 ||
+	    crc32_finish(&crc_in) != crc32_finish(&crc_out)) {
+	    tu_dbg("got %zu bytes back from %zu\n", out_len, len);
+	    ok = FALSE;
+	}
+	g_free(out);
+    }
+
+    unlink(TEST_IN_FILENAME);
+    unlink(TEST_OUT_FILENAME);
+    g_free(data);
+    return ok;
+}
+
+static gboolean
+test_transfer(void)
+{
+    return transfer(SHM_RING_SIZE, FALSE, LIMIT_NONE);
+}
+
+/* A ring larger than the producer asked for, on huge pages where the system
+ * has them; a size that isn't a multiple of the block size is rounded up */
+static gboolean
+test_huge_pages(void)
+{
+    return transfer(3 * SHM_RING_SIZE + 1000, TRUE, LIMIT_NONE);
+}
+
+/* A ring that can't be mapped falls back to the default ring, whichever
+ * side finds out */
+static gboolean
+test_fallback(void)
+{
+    return transfer(512 * 1024 * 1024, TRUE, LIMIT_PRODUCER) &&
+	   transfer(512 * 1024 * 1024, TRUE, LIMIT_BOTH);
+}
+
+/* Posts and waits balance, and nobody is woken up who isn't asleep */
+static gboolean
+test_sem_counts(void)
+{
+    shm_ring_t *shm_ring;
+    char *errmsg = NULL;
+    gboolean ok = TRUE;
+    int i;
+
+    shm_ring = shm_ring_create(&errmsg);
+    g_assert(shm_ring != NULL);
+
+    for (i = 0; i < 3; i++)
+	shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+    for (i = 0; i < 3; i++) {
+	if (shm_ring_sem_wait(shm_ring, shm_ring->sem_ready) != 0) {
+	    tu_dbg("wait %d failed\n", i);
+	    ok = FALSE;
+	}
+    }
+#ifdef SHM_RING_FUTEX
+    if (shm_ring->mc->wakeups != 0 || shm_ring->mc->sleeps != 0) {
+	tu_dbg("%ju wakeups and %ju sleeps without any waiter\n",
+	       (uintmax_t)shm_ring->mc->wakeups,
+	       (uintmax_t)shm_ring->mc->sleeps);
+	ok = FALSE;
+    }
+#endif
+
+    close_consumer_shm_ring(shm_ring);
+    return ok;
+}
+
+/* A process waiting on the ring notices when the other side goes away */
+static gboolean
+test_dead_peer(void)
+{
+#ifdef SHM_RING_FUTEX
+    shm_ring_t *shm_ring;
+    char *errmsg = NULL;
+    GTimer *timer;
+    gboolean ok = TRUE;
+    pid_t pid;
+    int r;
+
+    shm_ring = shm_ring_create(&errmsg);
+    g_assert(shm_ring != NULL);
+
+    /* link, then die without a word; don't reap it until the end, as the
+     * zombie still answers to kill(pid, 0) */
+    if ((pid = fork()) == 0) {
+	shm_ring_link(shm_ring->shm_control_name);
+	_exit(0);
+    }
+
+    timer = g_timer_new();
+    r = shm_ring_sem_wait(shm_ring, shm_ring->sem_read);
+    if (r != -1 || !shm_ring->mc->cancelled) {
+	tu_dbg("shm_ring_sem_wait returned %d\n", r);
+	ok = FALSE;
+    }
+    if (g_timer_elapsed(timer, NULL) > 10) {
+	tu_dbg("took %.1f seconds to notice\n", g_timer_elapsed(timer, NULL));
+	ok = FALSE;
+    }
+    g_timer_destroy(timer);
+
+    waitpid(pid, NULL, 0);
+    close_consumer_shm_ring(shm_ring);
+    return ok;
+#else
+    tu_dbg("without futexes, a dead peer is only noticed after 300s\n");
+    return TRUE;
+#endif
+}
+
+/*
+ * Benchmark
+ */
+
+/* shm-ring-test --bench [MB [KB [huge]]]: move data from this process to
+ * another through a ring of KB kbytes, and report the throughput and the
+ * number of wakeups per GB */
+static void
+bench(
+    uint64_t mbytes,
+    size_t   ring_size,
+    gboolean huge_pages)
+{
+    uint64_t len = mbytes * 1024 * 1024;
+    guint8 *buf = make_data();
+    shm_ring_t *shm_ring;
+    char *errmsg = NULL;
+    GTimer *timer;
+    gdouble elapsed, gbytes;
+    int devnull;
+    pid_t pid;
+
+    devnull = open("/dev/null", O_WRONLY);
+    g_assert(devnull >= 0);
+    shm_ring = shm_ring_create(&errmsg);
+    g_assert(shm_ring != NULL);
+    shm_ring->mc->huge_pages = huge_pages;
+    pid = start_consumer(shm_ring, devnull, ring_size);
+    close(devnull);
+
+    shm_ring_producer_set_size(shm_ring, SHM_RING_SIZE, SHM_RING_BLOCK_SIZE);
+    timer = g_timer_new();
+    produce(shm_ring, buf, len);
+    elapsed = g_timer_elapsed(timer, NULL);
+    g_timer_destroy(timer);
+
+    gbytes = (gdouble)shm_ring->mc->readx / 1e9;
+    g_fprintf(stdout, "%s, %ju KB ring%s: %.2f GB in %.2fs: %.2f GB/s, %.1f wakeups/GB, %.1f sleeps/GB\n",
+#ifdef SHM_RING_FUTEX
+	      "futex",
+#else
+	      "sem",
+#endif
+	      (uintmax_t)shm_ring->mc->ring_size / 1024,
+	      huge_pages ? " on huge pages" : "",
+	      gbytes, elapsed, elapsed > 0 ? gbytes / elapsed : 0.0,
+	      gbytes > 0 ? shm_ring->mc->wakeups / gbytes : 0.0,
+	      gbytes > 0 ? shm_ring->mc->sleeps / gbytes : 0.0);
+
+    close_producer_shm_ring(shm_ring);
+    waitpid(pid, NULL, 0);
+    g_free(buf);
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_transfer, 90),
+	TU_TEST(test_huge_pages, 90),
+	TU_TEST(test_fallback, 90),
+	TU_TEST(test_sem_counts, 90),
+	TU_TEST(test_dead_peer, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    /* shm-ring-test --bench [MB [KB [huge]]]: benchmark instead of testing */
+    if (argc > 1 && g_str_equal(argv[1], "--bench")) {
+	bench(argc > 2 ? (uint64_t)atoi(argv[2]) : 4096,
+	      argc > 3 ? (size_t)atoi(argv[3]) * 1024 : SHM_RING_SIZE,
+	      argc > 4 && g_str_equal(argv[4], "huge"));
+	return 0;
+    }
+
+    return testutils_run_tests(argc, argv, tests);
+}
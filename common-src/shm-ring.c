@@ -44,6 +44,12 @@
 #include <glib.h>
 #include <semaphore.h>
 #include <glob.h>
+#if HAVE_DECL_SYS_FUTEX || HAVE_DECL_SYS_PIDFD_OPEN || HAVE_DECL_SYS_MBIND
+#include <sys/syscall.h>
+#endif
+#if HAVE_DECL_SYS_PIDFD_OPEN
+#include <poll.h>
+#endif
 
 #include "amanda.h"
 #include "glib.h"
@@ -51,6 +57,17 @@
 #include "security.h"
 #include "shm-ring.h"
 
+#ifdef SHM_RING_FUTEX
+#include <linux/futex.h>
+#endif
+
+/* Place the ring on the consumer's NUMA node */
+#if defined(HAVE_LINUX_MEMPOLICY_H) && HAVE_DECL_SYS_MBIND && HAVE_DECL_SYS_GETCPU
+# define SHM_RING_NUMA 1
+# include <linux/mempolicy.h>
+# define SHM_RING_MAX_NODES 1024
+#endif
+
 #define DEFAULT_SHM_RING_BLOCK_SIZE (NETWORK_BLOCK_BYTES)
 #define DEFAULT_SHM_RING_SIZE (DEFAULT_SHM_RING_BLOCK_SIZE*8)
 
@@ -78,14 +95,29 @@
 # define SHM_CONTROL_GLOB "/dev/shm/amanda_shm_control-*-*"
 # define AMANDA_GLOB      "/dev/shm/amanda*-*-*"
 #endif
+
+/* How often, in seconds, a process waiting on a semaphore checks that all
+ * the processes using the ring are alive */
+#ifdef SHM_RING_FUTEX
+# define SHM_RING_PID_CHECK_INTERVAL 1
+#else
+# define SHM_RING_PID_CHECK_INTERVAL 300
+#endif
+
 static int shm_ring_id = 0;
 GMutex *shm_ring_mutex = NULL;
-static GHashTable *hash_sem = NULL;
 
 static void alloc_shm_ring(shm_ring_t *shm_ring);
+static gboolean map_shm_ring(shm_ring_t *shm_ring);
+static void place_shm_ring(shm_ring_t *shm_ring);
+static int current_numa_node(void);
+#ifndef SHM_RING_FUTEX
+static GHashTable *hash_sem = NULL;
+
 static sem_t *am_sem_create(char *name);
 static sem_t *am_sem_open(char *name);
 static void am_sem_close(sem_t *sem);
+#endif
 
 
 static int
@@ -140,10 +172,12 @@ cleanup_shm_ring(void)
 			gboolean all_dead = TRUE;
 			int i;
 
+#ifndef SHM_RING_FUTEX
 			g_hash_table_insert(names, g_strdup(mc->sem_write_name), GINT_TO_POINTER(1));
 			g_hash_table_insert(names, g_strdup(mc->sem_read_name), GINT_TO_POINTER(1));
 			g_hash_table_insert(names, g_strdup(mc->sem_ready_name), GINT_TO_POINTER(1));
 			g_hash_table_insert(names, g_strdup(mc->sem_start_name), GINT_TO_POINTER(1));
+#endif
 			g_hash_table_insert(names, g_strdup(mc->shm_data_name), GINT_TO_POINTER(1));
 
 			for (i=0; i<SHM_RING_MAX_PID; i++) {
@@ -159,15 +193,17 @@ cleanup_shm_ring(void)
 			}
 			// check all pids
 			if (all_dead) {
+#ifndef SHM_RING_FUTEX
 			    g_debug("sem_unlink %s", mc->sem_write_name);
 			    g_debug("sem_unlink %s", mc->sem_read_name);
 			    g_debug("sem_unlink %s", mc->sem_ready_name);
 			    g_debug("sem_unlink %s", mc->sem_start_name);
-			    g_debug("shm_unlink %s", mc->shm_data_name);
 			    sem_unlink(mc->sem_write_name);
 			    sem_unlink(mc->sem_read_name);
 			    sem_unlink(mc->sem_ready_name);
 			    sem_unlink(mc->sem_start_name);
+#endif
+			    g_debug("shm_unlink %s", mc->shm_data_name);
 			    shm_unlink(mc->shm_data_name);
 			    munmap(mc, sizeof(shm_ring_control_t));
 			    g_debug("shm_unlink %s", *aglob+8);
@@ -217,15 +253,156 @@ cleanup_shm_ring(void)
     g_hash_table_destroy(names);
 }
 
+#ifdef SHM_RING_FUTEX
+static int
+futex_wait(
+    uint32_t *addr,
+    uint32_t  value,
+    struct timespec *timeout)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+static int
+futex_wake(
+    uint32_t *addr,
+    int       count)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+#endif
+
+/*
+ * Return TRUE if one of the processes using the ring is gone.
+ */
+static gboolean
+shm_ring_peer_died(
+    shm_ring_t *shm_ring)
+{
+    int i;
+
+    for (i=0; i<SHM_RING_MAX_PID; i++) {
+	pid_t pid = shm_ring->mc->pids[i];
+
+	if (pid == 0)
+	    continue;
+#if HAVE_DECL_SYS_PIDFD_OPEN
+	/* A pidfd keeps referring to the process if its pid is reused, and is
+	 * readable as soon as it exits, even before it is reaped. */
+	if (shm_ring->watched_pids[i] != pid) {
+	    if (shm_ring->watched_pids[i] != 0 && shm_ring->pidfds[i] >= 0)
+		close(shm_ring->pidfds[i]);
+	    shm_ring->watched_pids[i] = pid;
+	    shm_ring->pidfds[i] = syscall(SYS_pidfd_open, pid, 0);
+	    if (shm_ring->pidfds[i] == -1 && errno == ESRCH) {
+		g_debug("shm_ring: process %d is gone", (int)pid);
+		return TRUE;
+	    }
+	}
+	if (shm_ring->pidfds[i] >= 0) {
+	    struct pollfd pfd;
+
+	    pfd.fd = shm_ring->pidfds[i];
+	    pfd.events = POLLIN;
+	    pfd.revents = 0;
+	    if (poll(&pfd, 1, 0) > 0) {
+		g_debug("shm_ring: process %d exited", (int)pid);
+		return TRUE;
+	    }
+	    continue;
+	}
+#endif
+	if (kill(pid, 0) == -1 && errno == ESRCH) {
+	    g_debug("shm_ring: process %d is gone", (int)pid);
+	    return TRUE;
+	}
+    }
+
+    return FALSE;
+}
+
+static void
+shm_ring_close_pidfds(
+    shm_ring_t *shm_ring)
+{
+    int i;
+
+    for (i=0; i<SHM_RING_MAX_PID; i++) {
+	if (shm_ring->watched_pids[i] != 0 && shm_ring->pidfds[i] >= 0)
+	    close(shm_ring->pidfds[i]);
+	shm_ring->watched_pids[i] = 0;
+    }
+}
+
+void
+shm_ring_sem_post(
+    shm_ring_t     *shm_ring,
+    shm_ring_sem_t *sem)
+{
+#ifdef SHM_RING_FUTEX
+    uint32_t value = __sync_fetch_and_add(&sem->value, 1);
+    uint32_t waiters = __sync_fetch_and_add(&sem->waiters, 0);
+
+    /* If nobody is asleep, the next wait takes the count without a system
+     * call.  If the value was already positive, the post that raised it
+     * woke the waiter, which has just not run yet.  Either way, a run of
+     * posts costs at most one wakeup. */
+    if (waiters == 0 || (value > 0 && waiters == 1))
+	return;
+    __sync_fetch_and_add(&shm_ring->mc->wakeups, 1);
+    futex_wake(&sem->value, 1);
+#else
+    __sync_fetch_and_add(&shm_ring->mc->wakeups, 1);
+    sem_post(sem);
+#endif
+}
+
 int
 shm_ring_sem_wait(
-    shm_ring_t *shm_ring,
-    sem_t      *sem)
+    shm_ring_t     *shm_ring,
+    shm_ring_sem_t *sem)
 {
-    int i;
+#ifdef SHM_RING_FUTEX
+    while(1) {
+	struct timespec tv = {SHM_RING_PID_CHECK_INTERVAL, 0};
+	uint32_t value = *(volatile uint32_t *)&sem->value;
+	int r;
+
+	if (value > 0) {
+	    if (__sync_bool_compare_and_swap(&sem->value, value, value - 1))
+		return 0;
+	    continue;
+	}
+
+	if (shm_ring->mc->cancelled) {
+	    g_debug("shm_ring_sem_wait: shm-ring is cancelled");
+	    return -1;
+	}
+
+	/* the kernel only puts us to sleep if the value is still 0, so a
+	 * post made after the check above is not lost */
+	__sync_fetch_and_add(&sem->waiters, 1);
+	__sync_fetch_and_add(&shm_ring->mc->sleeps, 1);
+	r = futex_wait(&sem->value, 0, &tv);
+	__sync_fetch_and_sub(&sem->waiters, 1);
+
+	if (r == 0 || errno == EAGAIN || errno == EINTR)
+	    continue;
+
+	if (errno != ETIMEDOUT) {
+	    goto failed_sem_wait;
+	}
+
+	if (shm_ring_peer_died(shm_ring))
+	    goto failed_sem_wait;
+    }
+#else
     while(1) {
-	struct timespec tv = {time(NULL)+300, 0};
+	struct timespec tv = {time(NULL)+SHM_RING_PID_CHECK_INTERVAL, 0};
 
+	if (sem_trywait(sem) == 0)
+	    return 0;
+	__sync_fetch_and_add(&shm_ring->mc->sleeps, 1);
 #ifdef HAVE_SEM_TIMEDWAIT
 	if (sem_timedwait(sem, &tv) == 0)
 	    return 0;
@@ -246,28 +423,54 @@ shm_ring_sem_wait(
 	    goto failed_sem_wait;
 	}
 
-	/* Check all pids */
-	for (i=0; i<SHM_RING_MAX_PID; i++) {
-	    if (shm_ring->mc->pids[i] != 0) {
-		if (kill(shm_ring->mc->pids[i], 0) == -1) {
-		    if (errno == ESRCH) {
-			goto failed_sem_wait;
-		    }
-		}
-	    }
-	}
+	if (shm_ring_peer_died(shm_ring))
+	    goto failed_sem_wait;
     }
+#endif
 
 failed_sem_wait:
     g_debug("shm_ring_sem_wait: failed_sem_wait: %s", strerror(errno));
     shm_ring->mc->cancelled = 1;
-    sem_post(shm_ring->sem_read);
-    sem_post(shm_ring->sem_write);
-    sem_post(shm_ring->sem_ready);
-    sem_post(shm_ring->sem_start);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_start);
     return -1;
 }
 
+void
+shm_ring_produced(
+    shm_ring_t *shm_ring,
+    size_t      n,
+    gboolean    more)
+{
+    uint64_t write_offset = shm_ring->mc->write_offset + n;
+
+    if (write_offset >= shm_ring->mc->ring_size)
+	write_offset -= shm_ring->mc->ring_size;
+    shm_ring_store(&shm_ring->mc->write_offset, write_offset);
+    shm_ring_store(&shm_ring->mc->written, shm_ring->mc->written + n);
+
+    /* While more is coming, wake the consumer once per quarter of the ring
+     * instead of once per block. */
+    shm_ring->data_avail += n;
+    if (shm_ring->data_avail >= shm_ring->mc->consumer_block_size &&
+	(!more || shm_ring->data_avail >= shm_ring->mc->ring_size / 4)) {
+	shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+	shm_ring->data_avail = 0;
+    }
+}
+
+void
+shm_ring_producer_flush(
+    shm_ring_t *shm_ring)
+{
+    if (shm_ring->data_avail > 0) {
+	shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+	shm_ring->data_avail = 0;
+    }
+}
+
 void
 fd_to_shm_ring(
     int fd,
@@ -281,21 +484,20 @@ fd_to_shm_ring(
     struct iovec iov[2];
     int          iov_count;
     ssize_t      n;
-    size_t      consumer_block_size;
 
     g_debug("fd_to_shm_ring");
 
     shm_ring_size = shm_ring->mc->ring_size;
-    consumer_block_size = shm_ring->mc->consumer_block_size;
     crc32_init(crc);
 
     while (!shm_ring->mc->cancelled) {
         write_offset = shm_ring->mc->write_offset;
         written = shm_ring->mc->written;
 	while (!shm_ring->mc->cancelled) {
-            readx = shm_ring->mc->readx;
+            readx = shm_ring_load(&shm_ring->mc->readx);
 	    if (shm_ring_size - (written - readx) >= shm_ring->block_size)
 		break;
+	    shm_ring_producer_flush(shm_ring);
             if (shm_ring_sem_wait(shm_ring, shm_ring->sem_write) != 0) {
 		break;
 	    }
@@ -318,20 +520,14 @@ fd_to_shm_ring(
         n = readv(fd, iov, iov_count);
         if (n > 0) {
 	    if (shm_ring->mc->written == 0 && shm_ring->mc->need_sem_ready) {
-		sem_post(shm_ring->sem_ready);
+		shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
 		if (shm_ring_sem_wait(shm_ring, shm_ring->sem_start) != 0) {
 		    break;
 		}
 	    }
-            write_offset += n;
-            write_offset %= shm_ring_size;
-            shm_ring->mc->write_offset = write_offset;
-            shm_ring->mc->written += n;
-            shm_ring->data_avail += n;
-            if (shm_ring->data_avail >= consumer_block_size) {
-                sem_post(shm_ring->sem_read);
-                shm_ring->data_avail -= consumer_block_size;
-            }
+            /* a short read means the input is not keeping up: hand the
+             * consumer what there is */
+            shm_ring_produced(shm_ring, n, n == (ssize_t)shm_ring->block_size);
             if (n <= (ssize_t)iov[0].iov_len) {
                 crc32_add((uint8_t *)iov[0].iov_base, n, crc);
             } else {
@@ -344,12 +540,12 @@ fd_to_shm_ring(
         }
     }
 
-    sem_post(shm_ring->sem_read);
-    sem_post(shm_ring->sem_read);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
 
     // wait for the consumer to read everything
     while (!shm_ring->mc->cancelled &&
-	   (shm_ring->mc->written != shm_ring->mc->readx ||
+	   (shm_ring->mc->written != shm_ring_load(&shm_ring->mc->readx) ||
 	    !shm_ring->mc->eof_flag)) {
 	if (shm_ring_sem_wait(shm_ring, shm_ring->sem_write) != 0) {
 	    break;
@@ -364,15 +560,18 @@ close_producer_shm_ring(
     if (!shm_ring->mc->eof_flag) {
 	shm_ring->mc->eof_flag = TRUE;
     }
-    sem_post(shm_ring->sem_ready);
-    sem_post(shm_ring->sem_start);
-    sem_post(shm_ring->sem_write);
-    sem_post(shm_ring->sem_read);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_start);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
 g_debug("close_producer_shm_ring sem_close(sem_write %p", shm_ring->sem_write);
+#ifndef SHM_RING_FUTEX
     am_sem_close(shm_ring->sem_write);
     am_sem_close(shm_ring->sem_ready);
     am_sem_close(shm_ring->sem_read);
     am_sem_close(shm_ring->sem_start);
+#endif
+    shm_ring_close_pidfds(shm_ring);
     if (shm_ring->shm_data_mmap_size > 0 && shm_ring->data) {
 	if (munmap(shm_ring->data, shm_ring->shm_data_mmap_size) == -1) {;
 	    g_debug("munmap(data) failed: %s", strerror(errno));
@@ -397,19 +596,20 @@ shm_ring_to_security_stream(
 {
     uint64_t     read_offset;
     uint64_t     shm_ring_size;
+    uint64_t     unposted = 0;
     gsize        usable = 0;
     gboolean     eof_flag = FALSE;
 
     g_debug("shm_ring_to_security_stream");
     shm_ring_size = shm_ring->mc->ring_size;
 
-    sem_post(shm_ring->sem_write);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
     while (!shm_ring->mc->cancelled) {
 	do {
 	    if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) != 0) {
 		break;
 	    }
-	    usable = shm_ring->mc->written - shm_ring->mc->readx;
+	    usable = shm_ring_load(&shm_ring->mc->written) - shm_ring->mc->readx;
 	    eof_flag = shm_ring->mc->eof_flag;
 	} while (!shm_ring->mc->cancelled &&
 		 usable < shm_ring->block_size && !eof_flag);
@@ -441,18 +641,29 @@ shm_ring_to_security_stream(
 		read_offset += to_write;
 		if (read_offset >= shm_ring_size)
 		    read_offset -= shm_ring_size;
-		shm_ring->mc->read_offset = read_offset;
-		shm_ring->mc->readx += to_write;
-		sem_post(shm_ring->sem_write);
+		shm_ring_store(&shm_ring->mc->read_offset, read_offset);
+		shm_ring_store(&shm_ring->mc->readx,
+			       shm_ring->mc->readx + to_write);
 		usable -= to_write;
+		/* a producer waiting on a full ring refills it in quarters */
+		unposted += to_write;
+		if (unposted >= shm_ring_size / 4) {
+		    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+		    unposted = 0;
+		}
 	    }
-	    if (shm_ring->mc->write_offset == shm_ring->mc->read_offset &&
+	    if (shm_ring_load(&shm_ring->mc->write_offset) == read_offset &&
 		shm_ring->mc->eof_flag) {
 		// notify the producer that everything is read
-		sem_post(shm_ring->sem_write);
+		shm_ring_sem_post(shm_ring, shm_ring->sem_write);
 		return;
 	    }
 	}
+	/* all that was there is consumed: tell the producer before waiting */
+	if (unposted) {
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+	    unposted = 0;
+	}
     }
 }
 
@@ -464,19 +675,20 @@ shm_ring_to_fd(
 {
     uint64_t     read_offset;
     uint64_t     shm_ring_size;
+    uint64_t     unposted = 0;
     gsize        usable = 0;
     gboolean     eof_flag = FALSE;
 
     g_debug("shm_ring_to_fd");
     shm_ring_size = shm_ring->mc->ring_size;
 
-    sem_post(shm_ring->sem_write);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
     while (!shm_ring->mc->cancelled) {
 	do {
 	    if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) != 0) {
 		break;
 	    }
-	    usable = shm_ring->mc->written - shm_ring->mc->readx;
+	    usable = shm_ring_load(&shm_ring->mc->written) - shm_ring->mc->readx;
 	    eof_flag = shm_ring->mc->eof_flag;
 	} while (!shm_ring->mc->cancelled &&
 		 usable < shm_ring->block_size && !eof_flag);
@@ -491,7 +703,7 @@ shm_ring_to_fd(
 		if (full_write(fd, shm_ring->data + read_offset, to_write) != to_write) {
 		    g_debug("full_write failed: %s", strerror(errno));
 		    shm_ring->mc->cancelled = TRUE;
-		    sem_post(shm_ring->sem_write);
+		    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
 		    return;
 		}
 		if (crc) {
@@ -503,14 +715,14 @@ shm_ring_to_fd(
 			   shm_ring_size - read_offset) != shm_ring_size - read_offset) {
 		    g_debug("full_write failed: %s", strerror(errno));
 		    shm_ring->mc->cancelled = TRUE;
-		    sem_post(shm_ring->sem_write);
+		    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
 		    return;
 		}
 		if (full_write(fd, shm_ring->data,
 			   to_write - shm_ring_size + read_offset) != to_write - shm_ring_size + read_offset) {
 		    g_debug("full_write failed: %s", strerror(errno));
 		    shm_ring->mc->cancelled = TRUE;
-		    sem_post(shm_ring->sem_write);
+		    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
 		    return;
 		}
 		if (crc) {
@@ -522,18 +734,29 @@ shm_ring_to_fd(
 		read_offset += to_write;
 		if (read_offset >= shm_ring_size)
 		    read_offset -= shm_ring_size;
-		shm_ring->mc->read_offset = read_offset;
-		shm_ring->mc->readx += to_write;
-		sem_post(shm_ring->sem_write);
+		shm_ring_store(&shm_ring->mc->read_offset, read_offset);
+		shm_ring_store(&shm_ring->mc->readx,
+			       shm_ring->mc->readx + to_write);
 		usable -= to_write;
+		/* a producer waiting on a full ring refills it in quarters */
+		unposted += to_write;
+		if (unposted >= shm_ring_size / 4) {
+		    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+		    unposted = 0;
+		}
 	    }
-	    if (shm_ring->mc->write_offset == shm_ring->mc->read_offset &&
+	    if (shm_ring_load(&shm_ring->mc->write_offset) == read_offset &&
 		shm_ring->mc->eof_flag) {
 		// notify the producer that everythinng is read
-		sem_post(shm_ring->sem_write);
+		shm_ring_sem_post(shm_ring, shm_ring->sem_write);
 		return;
 	    }
 	}
+	/* all that was there is consumed: tell the producer before waiting */
+	if (unposted) {
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+	    unposted = 0;
+	}
     }
 }
 
@@ -556,19 +779,28 @@ shm_ring_producer_set_size(
 
     alloc_shm_ring(shm_ring);
 
-    if (ftruncate(shm_ring->shm_data, shm_ring->mc->ring_size) == -1) {
-	g_debug("ftruncate of shm_data failed: %s", strerror(errno));
-	exit(1);
-    }
-    shm_ring->shm_data_mmap_size = shm_ring->mc->ring_size;
-    shm_ring->data = mmap(NULL, shm_ring->shm_data_mmap_size,
-			   PROT_READ|PROT_WRITE, MAP_SHARED,
-			   shm_ring->shm_data, 0);
-    if (shm_ring->data == MAP_FAILED) {
-	g_debug("shm_ring shm_ring->data failed: %s", strerror(errno));
-	exit(1);
+    if (!map_shm_ring(shm_ring)) {
+	if (shm_ring->mc->ring_size <= SHM_RING_SIZE &&
+	    !shm_ring->mc->huge_pages) {
+	    g_debug("shm_ring shm_ring->data failed: %s", strerror(errno));
+	    exit(1);
+	}
+	/* a configured ring too large for this system: use a normal one */
+	g_warning("shm_ring: can't map a ring of %lld bytes (%s); using a ring of normal pages",
+		  (long long)shm_ring->mc->ring_size, strerror(errno));
+	shm_ring->mc->huge_pages = FALSE;
+	shm_ring->mc->producer_ring_size = MIN(shm_ring->mc->producer_ring_size,
+					       SHM_RING_SIZE);
+	shm_ring->mc->consumer_ring_size = MIN(shm_ring->mc->consumer_ring_size,
+					       SHM_RING_SIZE);
+	alloc_shm_ring(shm_ring);
+	if (!map_shm_ring(shm_ring)) {
+	    g_debug("shm_ring shm_ring->data failed: %s", strerror(errno));
+	    exit(1);
+	}
     }
-    sem_post(shm_ring->sem_read);
+    place_shm_ring(shm_ring);
+    shm_ring_sem_post(shm_ring, shm_ring->sem_read);
 }
 
 static void
@@ -588,8 +820,19 @@ alloc_shm_ring(
 	    best_ring_size = shm_ring->mc->consumer_block_size * 2;
     }
 
+    if (best_ring_size > SHM_RING_MAX_SIZE) {
+	g_debug("shm_ring: ring of %lld bytes capped to %lld",
+		(long long)best_ring_size, (long long)SHM_RING_MAX_SIZE);
+	best_ring_size = SHM_RING_MAX_SIZE;
+    }
+
+    if (shm_ring->mc->huge_pages &&
+	best_ring_size % SHM_RING_HUGE_PAGE_SIZE != 0) {
+	best_ring_size = ((best_ring_size / SHM_RING_HUGE_PAGE_SIZE)+1) * SHM_RING_HUGE_PAGE_SIZE;
+    }
+
     if (best_ring_size % shm_ring->mc->producer_block_size != 0) {
-	best_ring_size = ((best_ring_size % shm_ring->mc->producer_block_size)+1) * shm_ring->mc->producer_block_size;
+	best_ring_size = ((best_ring_size / shm_ring->mc->producer_block_size)+1) * shm_ring->mc->producer_block_size;
     }
 
     while (best_ring_size % shm_ring->mc->consumer_block_size != 0) {
@@ -600,6 +843,87 @@ alloc_shm_ring(
     shm_ring->mc->ring_size = shm_ring->ring_size;
 }
 
+/* Size the data object to the ring and map it; FALSE with errno set if
+ * either fails */
+static gboolean
+map_shm_ring(
+    shm_ring_t *shm_ring)
+{
+    shm_ring->data = MAP_FAILED;
+    if (ftruncate(shm_ring->shm_data, shm_ring->mc->ring_size) == -1)
+	return FALSE;
+    shm_ring->shm_data_mmap_size = shm_ring->mc->ring_size;
+    shm_ring->data = mmap(NULL, shm_ring->shm_data_mmap_size,
+			   PROT_READ|PROT_WRITE, MAP_SHARED,
+			   shm_ring->shm_data, 0);
+    return shm_ring->data != MAP_FAILED;
+}
+
+/*
+ * Called by each side on its new mapping of the data, before it touches it.
+ * POSIX shared memory can't be mapped with MAP_HUGETLB, but the kernel backs
+ * shmem with transparent huge pages where the mapping asks for them (and
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it).  The memory
+ * policy set with mbind() on a shmem mapping is the policy of the object, so
+ * the pages are allocated on the consumer's node whichever process faults
+ * them in.  The ring is then faulted in at once, rather than a page at a
+ * time while the data flows.
+ */
+static void
+place_shm_ring(
+    shm_ring_t *shm_ring)
+{
+#ifdef SHM_RING_NUMA
+    unsigned long nodemask[SHM_RING_MAX_NODES / (8 * sizeof(unsigned long))];
+    int node = shm_ring->mc->consumer_node;
+#endif
+
+    if (shm_ring->mc->huge_pages) {
+#ifdef MADV_HUGEPAGE
+	if (madvise(shm_ring->data, shm_ring->shm_data_mmap_size,
+		    MADV_HUGEPAGE) == -1) {
+	    g_debug("shm_ring: madvise(MADV_HUGEPAGE) failed: %s",
+		    strerror(errno));
+	}
+#else
+	g_debug("shm_ring: huge pages are not supported on this system");
+#endif
+    }
+
+#ifdef SHM_RING_NUMA
+    if (node >= 0 && node < SHM_RING_MAX_NODES) {
+	memset(nodemask, 0, sizeof(nodemask));
+	nodemask[node / (8 * sizeof(unsigned long))] |=
+			1UL << (node % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_mbind, shm_ring->data, shm_ring->shm_data_mmap_size,
+		    MPOL_PREFERRED, nodemask, SHM_RING_MAX_NODES, 0) == -1) {
+	    /* ENOSYS on a kernel without NUMA support */
+	    g_debug("shm_ring: mbind to node %d failed: %s", node,
+		    strerror(errno));
+	}
+    }
+#endif
+
+#ifdef MADV_POPULATE_WRITE
+    /* EINVAL before Linux 5.14; the pages are then faulted in on use */
+    madvise(shm_ring->data, shm_ring->shm_data_mmap_size, MADV_POPULATE_WRITE);
+#endif
+}
+
+/* The NUMA node this thread runs on, or -1 if unknown */
+static int
+current_numa_node(void)
+{
+#ifdef SHM_RING_NUMA
+    unsigned cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+	return (int)node;
+#endif
+    return -1;
+}
+
+#ifndef SHM_RING_FUTEX
 static sem_t *
 am_sem_create(
     char *name)
@@ -670,6 +994,7 @@ g_debug("am_sem_close %p %d", sem, nb);
     }
     g_mutex_unlock(shm_ring_mutex);
 }
+#endif
 
 shm_ring_t *
 shm_ring_create(
@@ -724,8 +1049,10 @@ shm_ring_create(
     shm_ring->mc->write_offset = 0;
     shm_ring->mc->read_offset = 0;
     shm_ring->mc->eof_flag = FALSE;
+    shm_ring->mc->consumer_node = -1;
     shm_ring->mc->pids[0] = getpid();;
 
+#ifndef SHM_RING_FUTEX
     g_snprintf(shm_ring->mc->sem_write_name,
 	       sizeof(shm_ring->mc->sem_write_name),
 	       SEM_WRITE_NAME, (int)getpid(), get_next_shm_ring_id());
@@ -738,6 +1065,7 @@ shm_ring_create(
     g_snprintf(shm_ring->mc->sem_start_name,
 	       sizeof(shm_ring->mc->sem_start_name),
 	       SEM_START_NAME, (int)getpid(), get_next_shm_ring_id());
+#endif
     g_snprintf(shm_ring->mc->shm_data_name,
 	       sizeof(shm_ring->mc->shm_data_name),
 	       SHM_DATA_NAME, (int)getpid(), get_next_shm_ring_id());
@@ -759,6 +1087,14 @@ shm_ring_create(
 	}
 	exit(1);
     }
+    g_debug("shm_data: %s", shm_ring->mc->shm_data_name);
+#ifdef SHM_RING_FUTEX
+    /* the new control block is zero-filled: all four start at 0 */
+    shm_ring->sem_write = &shm_ring->mc->futex_write;
+    shm_ring->sem_read  = &shm_ring->mc->futex_read;
+    shm_ring->sem_ready = &shm_ring->mc->futex_ready;
+    shm_ring->sem_start = &shm_ring->mc->futex_start;
+#else
     sem_unlink(shm_ring->mc->sem_write_name);
     shm_ring->sem_write = am_sem_create(shm_ring->mc->sem_write_name);
     sem_unlink(shm_ring->mc->sem_read_name);
@@ -767,11 +1103,11 @@ shm_ring_create(
     shm_ring->sem_ready  = am_sem_create(shm_ring->mc->sem_ready_name);
     sem_unlink(shm_ring->mc->sem_start_name);
     shm_ring->sem_start  = am_sem_create(shm_ring->mc->sem_start_name);
-    g_debug("shm_data: %s", shm_ring->mc->shm_data_name);
     g_debug("sem_write: %s", shm_ring->mc->sem_write_name);
     g_debug("sem_read: %s", shm_ring->mc->sem_read_name);
     g_debug("sem_ready: %s", shm_ring->mc->sem_ready_name);
     g_debug("sem_start: %s", shm_ring->mc->sem_start_name);
+#endif
 
     return shm_ring;
 }
@@ -784,11 +1120,34 @@ shm_ring_consumer_set_size(
 {
     g_debug("shm_ring_consumer_set_size");
 
+    /* ask for a ring this process can map; the producer maps it first */
+    if ((uint64_t)ring_size > SHM_RING_SIZE || shm_ring->mc->huge_pages) {
+	uint64_t want = MIN((uint64_t)ring_size, SHM_RING_MAX_SIZE);
+	int flags = MAP_PRIVATE|MAP_ANON;
+	void *probe;
+
+#ifdef MAP_NORESERVE
+	flags |= MAP_NORESERVE;
+#endif
+	if (shm_ring->mc->huge_pages)
+	    want = ((want + SHM_RING_HUGE_PAGE_SIZE - 1) / SHM_RING_HUGE_PAGE_SIZE) * SHM_RING_HUGE_PAGE_SIZE;
+	probe = mmap(NULL, want, PROT_NONE, flags, -1, 0);
+	if (probe == MAP_FAILED) {
+	    g_warning("shm_ring: can't map a ring of %lld bytes (%s); using a ring of normal pages",
+		      (long long)want, strerror(errno));
+	    shm_ring->mc->huge_pages = FALSE;
+	    ring_size = MIN(ring_size, SHM_RING_SIZE);
+	} else {
+	    munmap(probe, want);
+	}
+    }
+
     shm_ring->ring_size = ring_size;
     shm_ring->block_size = block_size;
     shm_ring->mc->consumer_ring_size = ring_size;
     shm_ring->mc->consumer_block_size = block_size;
-    sem_post(shm_ring->sem_write);
+    shm_ring->mc->consumer_node = current_numa_node();
+    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
     if (shm_ring_sem_wait(shm_ring, shm_ring->sem_read) == -1) {
 	g_debug("shm_ring_consumer_set_size: fail shm_ring_sem_wait");
 	return;
@@ -801,10 +1160,10 @@ shm_ring_consumer_set_size(
     if (shm_ring->mc->ring_size == 0) {
 	g_debug("shm_ring_consumer_set_size: ring_size == 0");
 	shm_ring->mc->cancelled = TRUE;
-	sem_post(shm_ring->sem_read);
-	sem_post(shm_ring->sem_write);
-	sem_post(shm_ring->sem_ready);
-	sem_post(shm_ring->sem_start);
+	shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+	shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+	shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+	shm_ring_sem_post(shm_ring, shm_ring->sem_start);
 	return;
     }
     shm_ring->ring_size = shm_ring->mc->ring_size;
@@ -814,7 +1173,9 @@ shm_ring_consumer_set_size(
 			   PROT_READ|PROT_WRITE, MAP_SHARED,
 			   shm_ring->shm_data, 0);
     if (shm_ring->data == MAP_FAILED) {
-	g_debug("shm_ring shm_ring->data failed (%lld): %s", (long long)shm_ring->shm_data_mmap_size, strerror(errno));
+	int save_errno = errno;
+
+	g_debug("shm_ring shm_ring->data failed (%lld): %s", (long long)shm_ring->shm_data_mmap_size, strerror(save_errno));
 	g_debug("shm_ring->ring_size %lld", (long long)shm_ring->ring_size);
 	g_debug("shm_ring->block_size %lld", (long long)shm_ring->block_size);
 	g_debug("shm_ring->mc->consumer_ring_size %lld", (long long)shm_ring->mc->consumer_ring_size);
@@ -822,8 +1183,19 @@ shm_ring_consumer_set_size(
 	g_debug("shm_ring->mc->consumer_block_size %lld", (long long)shm_ring->mc->consumer_block_size);
 	g_debug("shm_ring->mc->producer_block_size %lld", (long long)shm_ring->mc->producer_block_size);
 	g_debug("shm_ring->mc->ring_size %lld", (long long)shm_ring->mc->ring_size);
-	exit(1);
+	/* fail the transfer rather than the process */
+	g_warning("shm_ring: can't map the ring of %lld bytes: %s",
+		  (long long)shm_ring->shm_data_mmap_size, strerror(save_errno));
+	shm_ring->data = NULL;
+	shm_ring->shm_data_mmap_size = 0;
+	shm_ring->mc->cancelled = TRUE;
+	shm_ring_sem_post(shm_ring, shm_ring->sem_read);
+	shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+	shm_ring_sem_post(shm_ring, shm_ring->sem_ready);
+	shm_ring_sem_post(shm_ring, shm_ring->sem_start);
+	return;
     }
+    place_shm_ring(shm_ring);
 }
 
 shm_ring_t *
@@ -852,10 +1224,17 @@ shm_ring_link(
 	exit(1);
     }
     shm_ring->shm_data_mmap_size = 0;
+#ifdef SHM_RING_FUTEX
+    shm_ring->sem_write = &shm_ring->mc->futex_write;
+    shm_ring->sem_read  = &shm_ring->mc->futex_read;
+    shm_ring->sem_ready = &shm_ring->mc->futex_ready;
+    shm_ring->sem_start = &shm_ring->mc->futex_start;
+#else
     shm_ring->sem_write = am_sem_open(shm_ring->mc->sem_write_name);
     shm_ring->sem_read  = am_sem_open(shm_ring->mc->sem_read_name);
     shm_ring->sem_ready = am_sem_open(shm_ring->mc->sem_ready_name);
     shm_ring->sem_start = am_sem_open(shm_ring->mc->sem_start_name);
+#endif
     for (i=1; i < SHM_RING_MAX_PID; i++) {
 	if (shm_ring->mc->pids[i] == 0) {
 	    shm_ring->mc->pids[i] = getpid();
@@ -870,6 +1249,7 @@ close_consumer_shm_ring(
     shm_ring_t *shm_ring)
 {
 g_debug("close_consumer_shm_ring sem_close(sem_write %p", shm_ring->sem_write);
+#ifndef SHM_RING_FUTEX
     am_sem_close(shm_ring->sem_write);
     am_sem_close(shm_ring->sem_read);
     am_sem_close(shm_ring->sem_ready);
@@ -890,6 +1270,8 @@ g_debug("close_consumer_shm_ring sem_close(sem_write %p", shm_ring->sem_write);
 	g_debug("sem_unlink(sem_start_name) failed: %s", strerror(errno));
 	exit(1);
     }
+#endif
+    shm_ring_close_pidfds(shm_ring);
     if (shm_ring->shm_data_mmap_size > 0 && shm_ring->data) {
 	if (munmap(shm_ring->data, shm_ring->shm_data_mmap_size) == -1) {
 	    g_debug("munmap(data) failed: %s", strerror(errno));
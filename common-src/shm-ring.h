@@ -42,12 +42,38 @@
 #define SHM_RING_SIZE (SHM_RING_BLOCK_SIZE * 32)
 #define SHM_RING_NAME_LENGTH 50
 #define SHM_RING_MAX_PID 10
+/* A ring backed by huge pages is a multiple of this size */
+#define SHM_RING_HUGE_PAGE_SIZE (2*1024*1024)
+/* The largest ring either side may ask for */
+#define SHM_RING_MAX_SIZE ((uint64_t)1024*1024*1024)
+
+/*
+ * On Linux, the four semaphores of a ring are futex words in the control
+ * block: posting only makes a system call if the other side is asleep, and
+ * waiting only makes one if there is nothing to take.  Elsewhere they are
+ * named POSIX semaphores.
+ */
+#if defined(HAVE_LINUX_FUTEX_H) && HAVE_DECL_SYS_FUTEX
+# define SHM_RING_FUTEX 1
+#endif
+
+#ifdef SHM_RING_FUTEX
+typedef struct shm_ring_sem_t {
+    uint32_t value;		/* the futex word */
+    uint32_t waiters;		/* number of processes asleep on value */
+    char     padding[64 - 2*sizeof(uint32_t)];
+} shm_ring_sem_t;
+#else
+typedef sem_t shm_ring_sem_t;
+#endif
 
 typedef struct shm_ring_control_t {
+    /* the producer's side: write_offset and written are the ring head */
     uint64_t write_offset;
     uint64_t written;
     gboolean eof_flag;
     char     padding1[64 - 2*sizeof(uint64_t) - sizeof(gboolean)];
+    /* the consumer's side: read_offset and readx are the ring tail */
     uint64_t read_offset;
     uint64_t readx;
     char     padding2[64 - 2*sizeof(uint64_t)];
@@ -64,6 +90,16 @@ typedef struct shm_ring_control_t {
     size_t   producer_block_size;
     uint64_t consumer_ring_size;
     uint64_t producer_ring_size;
+    uint64_t wakeups;		/* posts that had to wake a process */
+    uint64_t sleeps;		/* waits that had to go to sleep */
+    gboolean huge_pages;	/* set by the creator: back the data with huge pages */
+    int      consumer_node;	/* NUMA node of the consumer, or -1 */
+#ifdef SHM_RING_FUTEX
+    shm_ring_sem_t futex_write;
+    shm_ring_sem_t futex_read;
+    shm_ring_sem_t futex_ready;
+    shm_ring_sem_t futex_start;
+#endif
 } shm_ring_control_t;
 
 typedef struct shm_ring_t {
@@ -71,30 +107,76 @@ typedef struct shm_ring_t {
     int             shm_control;
     int             shm_data;
     off_t	    shm_data_mmap_size;
-    sem_t          *sem_write;
-    sem_t          *sem_read;
-    sem_t          *sem_ready;
-    sem_t          *sem_start;
+    shm_ring_sem_t *sem_write;
+    shm_ring_sem_t *sem_read;
+    shm_ring_sem_t *sem_ready;
+    shm_ring_sem_t *sem_start;
     char           *data;
     char           *data2;
     char           *shm_control_name;
     size_t         ring_size;	/* shm_ring desired size */
     size_t         block_size;
     size_t         data_avail;
+    /* pidfds watching mc->pids, opened as the pids appear */
+    pid_t          watched_pids[SHM_RING_MAX_PID];
+    int            pidfds[SHM_RING_MAX_PID];
 } shm_ring_t;
 
+/*
+ * The producer is the only writer of the head and the consumer the only
+ * writer of the tail.  Each side stores its own counter with
+ * shm_ring_store() after the data it covers is in (or out of) the ring, and
+ * reads the other side's counter with shm_ring_load().
+ */
+static inline uint64_t
+shm_ring_load(
+    uint64_t *p)
+{
+#ifdef __ATOMIC_ACQUIRE
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    uint64_t v = *(volatile uint64_t *)p;
+    __sync_synchronize();
+    return v;
+#endif
+}
+
+static inline void
+shm_ring_store(
+    uint64_t *p,
+    uint64_t  v)
+{
+#ifdef __ATOMIC_RELEASE
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#else
+    __sync_synchronize();
+    *(volatile uint64_t *)p = v;
+#endif
+}
+
 #include "security.h"
 #include "stream.h"
 
 extern GMutex *shm_ring_mutex;
 
-int shm_ring_sem_wait(shm_ring_t *shm_ring, sem_t *sem);
+/* Wait on one of the ring's semaphores.  Returns -1, after cancelling the
+ * ring, if a process using the ring died. */
+int shm_ring_sem_wait(shm_ring_t *shm_ring, shm_ring_sem_t *sem);
+void shm_ring_sem_post(shm_ring_t *shm_ring, shm_ring_sem_t *sem);
 shm_ring_t *shm_ring_create(char **errmsg);
 shm_ring_t *shm_ring_link(char *name);
 void shm_ring_to_security_stream(shm_ring_t *shm_ring, struct security_stream_t *netfd, crc_t *crc);
 void shm_ring_consumer_set_size(shm_ring_t *shm_ring, ssize_t ring_size, ssize_t block_size);
 void shm_ring_producer_set_size(shm_ring_t *shm_ring, ssize_t ring_size, ssize_t block_size);
 
+/* The producer put n bytes in the ring at write_offset: publish them, and
+ * wake the consumer if it has enough to do.  more is TRUE if more data is
+ * coming right away, which lets the wakeups be batched. */
+void shm_ring_produced(shm_ring_t *shm_ring, size_t n, gboolean more);
+/* Wake the consumer for everything produced so far; the producer must call
+ * this before it waits on sem_write. */
+void shm_ring_producer_flush(shm_ring_t *shm_ring);
+
 void close_producer_shm_ring(shm_ring_t *shm_ring);
 void close_consumer_shm_ring(shm_ring_t *shm_ring);
 void clean_shm_ring(void);
@@ -92,15 +92,6 @@ stream_server(
 	errno = save_errno;
 	return -1;
     }
-    if(server_socket < 0 || server_socket >= (int)FD_SETSIZE) {
-	aclose(server_socket);
-	errno = EMFILE;				/* out of range */
-	save_errno = errno;
-	g_debug(_("stream_server: socket out of range: %d"),
-		  server_socket);
-	errno = save_errno;
-	return -1;
-    }
 
     SU_INIT(&server, socket_family);
     SU_SET_INADDR_ANY(&server);
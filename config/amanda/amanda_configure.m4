@@ -256,6 +256,7 @@ AMANDA_CHECK_GLIB
 AMANDA_CHECK_READLINE
 AC_CHECK_LIB(m,modf)
 AMANDA_CHECK_LIBDL
+AMANDA_CHECK_ZLIB
 AMANDA_GLIBC_BACKTRACE
 AC_SEARCH_LIBS([shm_open], [rt], [], [
   AC_MSG_ERROR([unable to find the shm_open() function])
@@ -367,6 +368,13 @@ ICE_CHECK_DECL(eaccess,unistd.h)
 ICE_CHECK_DECL(clock_gettime,time.h)
 AX_FUNC_WHICH_GETSERVBYNAME_R
 AC_CHECK_FUNCS(sem_timedwait)
+AC_CHECK_HEADERS(linux/futex.h linux/mempolicy.h sys/epoll.h)
+AC_CHECK_DECLS([SYS_futex, SYS_pidfd_open, SYS_mbind, SYS_getcpu],,,[#include <sys/syscall.h>])
+AC_CHECK_FUNCS(splice tee)
+AC_CHECK_FUNCS(fdopendir fstatat)
+AC_CHECK_FUNCS(posix_fadvise)
+AC_CHECK_FUNCS(closefrom close_range)
+AC_STRUCT_DIRENT_D_TYPE
 
 #
 # Devices
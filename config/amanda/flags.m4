@@ -324,7 +324,9 @@ AC_DEFUN([AMANDA_DISABLE_GCC_WARNING],
 #
 # OVERVIEW
 #
-#   Check if gcc support -msse4.2
+#   Check if gcc support -msse4.2, and the -mpclmul and -mvpclmulqdq flags
+#   used by the folding crc32 implementations.  Also check for the -mavx2
+#   and -mavx512f flags used by the RAIT parity code.
 #
 AC_DEFUN([AMANDA_CHECK_SSE42],
 [
@@ -332,8 +334,28 @@ AC_DEFUN([AMANDA_CHECK_SSE42],
     AMANDA_TEST_GCC_FLAG(-msse4.2,
     [
 	SSE42_CFLAGS=-msse4.2
+	AMANDA_TEST_GCC_FLAG(-mpclmul,
+	[
+	    PCLMUL_CFLAGS="-msse4.2 -mpclmul"
+	    AMANDA_TEST_GCC_FLAG(-mvpclmulqdq,
+	    [
+		AVX512_CFLAGS="-msse4.2 -mpclmul -mavx512f -mvpclmulqdq"
+	    ])
+	])
+    ])
+    AMANDA_TEST_GCC_FLAG(-mavx2,
+    [
+	AVX2_CFLAGS=-mavx2
+	AMANDA_TEST_GCC_FLAG(-mavx512f,
+	[
+	    AVX512F_CFLAGS="-mavx2 -mavx512f"
+	])
     ])
     AC_SUBST(SSE42_CFLAGS)
+    AC_SUBST(PCLMUL_CFLAGS)
+    AC_SUBST(AVX512_CFLAGS)
+    AC_SUBST(AVX2_CFLAGS)
+    AC_SUBST(AVX512F_CFLAGS)
 ])
 
 # SYNOPSIS
@@ -24,6 +24,38 @@ AC_DEFUN([AMANDA_CHECK_LIBDL], [
     fi
 ])
 
+# SYNOPSIS
+#
+#   AMANDA_CHECK_ZLIB
+#
+# OVERVIEW
+#
+#   Check for zlib, which the server uses to read and write compressed index
+#   files without running COMPRESS_PATH and UNCOMPRESS_PATH.  If it is found,
+#   HAVE_LIBZ is defined and -lz is added to LIBS.  Use --without-zlib to
+#   always run the external programs.
+#
+AC_DEFUN([AMANDA_CHECK_ZLIB], [
+    WANT_ZLIB=yes
+    AC_ARG_WITH(zlib,
+        AS_HELP_STRING([--without-zlib],
+                [do not use zlib to (un)compress index files]),
+        [
+            case "$withval" in
+                n | no) WANT_ZLIB=no ;;
+                y |  ye | yes) WANT_ZLIB=yes ;;
+                *) AC_MSG_ERROR([*** You must not supply an argument to --without-zlib.])
+                    ;;
+            esac
+        ],
+    )
+
+    if test x"$WANT_ZLIB" = x"yes"; then
+	# gzbuffer appeared in zlib 1.2.4
+	AC_CHECK_HEADERS([zlib.h], [AC_CHECK_LIB(z, gzbuffer)])
+    fi
+])
+
 # SYNOPSIS
 #
 #   AMANDA_CHECK_LIBCURL
@@ -31,6 +31,7 @@
 #include "device.h"
 #include "fileheader.h"
 #include "amsemaphore.h"
+#include "rait-parity.h"
 
 /* Just a note about the failure mode of different operations:
    - Recovers from a failure (enters degraded mode)
@@ -83,12 +84,16 @@ struct _RaitDeviceClass {
 
 typedef enum {
     RAIT_STATUS_COMPLETE, /* All subdevices OK. */
-    RAIT_STATUS_DEGRADED, /* One subdevice failed. */
-    RAIT_STATUS_FAILED    /* Two or more subdevices failed. */
+    RAIT_STATUS_DEGRADED, /* No more subdevices failed than there are parity
+			     subdevices. */
+    RAIT_STATUS_FAILED    /* More subdevices failed. */
 } RaitStatus;
 
-/* Older versions of glib have a deadlock in their thread pool implementations,
- * so we include a simple thread-pool implementation here to replace it.
+/* Each child device gets a long-lived worker thread, created by the first
+ * operation and kept until the RaitDevice is finalized, so that a write_block
+ * does not pay for starting threads; with a new thread pool for each
+ * operation, a RAIT of fast children stays well below the sum of their
+ * bandwidth.
  *
  * This implementation assumes that threads are used for paralellizing a single
  * operation, so all threads run a function to completion before the main thread
@@ -96,32 +101,30 @@ typedef enum {
  * there is no need to wait for stray threads to finish an operation when
  * finalizing the RaitDevice object or when beginning a new operation.
  */
-#if !(GLIB_CHECK_VERSION(2,10,0))
-#define USE_INTERNAL_THREADPOOL
-#endif
 
 typedef struct RaitDevicePrivate_s {
     GPtrArray * children;
     /* These flags are only relevant for reading. */
     RaitStatus status;
-    /* If status == RAIT_STATUS_DEGRADED, this holds the index of the
-       failed node. It holds a negative number otherwise. */
-    int failed;
+    /* Bit i is set if child i has failed; if status ==
+       RAIT_STATUS_DEGRADED, there are at most nparity of them. */
+    guint64 failed;
+
+    /* the number of parity children, which are the last children: 1 is
+       XOR parity (a mirror with two children), more is Reed-Solomon */
+    guint nparity;
 
     /* the child block size */
     gsize child_block_size;
 
-#ifdef USE_INTERNAL_THREADPOOL
     /* array of ThreadInfo for performing parallel operations */
     GArray *threads;
 
     /* value of this semaphore is the number of threaded operations
      * in progress */
     amsemaphore_t *threads_sem;
-#endif
 } RaitDevicePrivate;
 
-#ifdef USE_INTERNAL_THREADPOOL
 typedef struct ThreadInfo {
     GThread *thread;
 
@@ -136,7 +139,6 @@ typedef struct ThreadInfo {
     /* give threads access to active_threads and its mutex/cond */
     struct RaitDevicePrivate_s *private;
 } ThreadInfo;
-#endif
 
 /* This device uses a special sentinel node to indicate that the child devices
  * will be set later (in rait_device_open).  It contains a control character to
@@ -145,6 +147,8 @@ typedef struct ThreadInfo {
 
 #define PRIVATE(o) (o->private)
 
+#define CHILD_FAILED(self, i) ((PRIVATE(self)->failed >> (i)) & 1)
+
 #define rait_device_in_error(dev) \
     (device_in_error((dev)) || PRIVATE(RAIT_DEVICE((dev)))->status == RAIT_STATUS_FAILED)
 
@@ -206,6 +210,14 @@ static gboolean property_get_max_volume_usage_fn(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety *surety, PropertySource *source);
 
+static gboolean property_get_rait_parity_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety *surety, PropertySource *source);
+
+static gboolean property_set_rait_parity_fn(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
 static gboolean property_set_max_volume_usage_fn(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
@@ -214,6 +226,10 @@ static gboolean property_set_max_volume_usage_fn(Device *self,
 /* pointer to the class of our parent */
 static DeviceClass *parent_class = NULL;
 
+/* device-specific properties */
+DevicePropertyBase device_property_rait_parity;
+#define PROPERTY_RAIT_PARITY (device_property_rait_parity.ID)
+
 static GType
 rait_device_get_type (void)
 {
@@ -259,7 +275,6 @@ rait_device_finalize(GObject *obj_self)
         g_ptr_array_free (self->private->children, TRUE);
         self->private->children = NULL;
     }
-#ifdef USE_INTERNAL_THREADPOOL
     g_assert(PRIVATE(self)->threads_sem == NULL || PRIVATE(self)->threads_sem->value == 0);
 
     if (PRIVATE(self)->threads) {
@@ -290,7 +305,6 @@ rait_device_finalize(GObject *obj_self)
 
     if (PRIVATE(self)->threads_sem)
 	amsemaphore_free(PRIVATE(self)->threads_sem);
-#endif
     amfree(self->private);
 }
 
@@ -300,11 +314,10 @@ rait_device_init (RaitDevice * o G_GNUC_UNUSED)
     PRIVATE(o) = g_new(RaitDevicePrivate, 1);
     PRIVATE(o)->children = g_ptr_array_new();
     PRIVATE(o)->status = RAIT_STATUS_COMPLETE;
-    PRIVATE(o)->failed = -1;
-#ifdef USE_INTERNAL_THREADPOOL
+    PRIVATE(o)->failed = 0;
+    PRIVATE(o)->nparity = 1;
     PRIVATE(o)->threads = NULL;
     PRIVATE(o)->threads_sem = NULL;
-#endif
 }
 
 static void
@@ -329,21 +342,6 @@ rait_device_class_init (RaitDeviceClass * c)
     device_class->read_label = rait_device_read_label;
 
     g_object_class->finalize = rait_device_finalize;
-
-#ifndef USE_INTERNAL_THREADPOOL
-#if !GLIB_CHECK_VERSION(2,10,2)
-    /* Versions of glib before 2.10.2 crash if
-     * g_thread_pool_set_max_unused_threads is called before the first
-     * invocation of g_thread_pool_new.  So we make up a thread pool, but don't
-     * start any threads in it, and free it */
-    {
-	GThreadPool *pool = g_thread_pool_new((GFunc)-1, NULL, -1, FALSE, NULL);
-	g_thread_pool_free(pool, TRUE, FALSE);
-    }
-#endif
-
-    g_thread_pool_set_max_unused_threads(-1);
-#endif
 }
 
 static void
@@ -394,15 +392,21 @@ rait_device_base_init (RaitDeviceClass * c)
 	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
 	    property_get_max_volume_usage_fn,
 	    property_set_max_volume_usage_fn);
+
+    device_class_register_property(device_class, PROPERTY_RAIT_PARITY,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    property_get_rait_parity_fn,
+	    property_set_rait_parity_fn);
 }
 
 /* This function does something a little clever and a little
  * complicated. It takes an array of operations and runs the given
  * function on each element in the array. The trick is that it runs them
  * all in parallel, in different threads. This is more efficient than it
- * sounds because we use a GThreadPool, which means calling this function
- * will probably not start any new threads at all, but rather use
- * existing ones. The func is called with two gpointer arguments: The
+ * sounds because the threads are the per-child workers described above,
+ * which means calling this function will not start any new threads after
+ * the first operation.  The calling thread runs the last operation itself
+ * rather than sleeping.  The func is called with two gpointer arguments: The
  * first from the array, the second is the data argument.
  *
  * When it returns, all the operations have been successfully
@@ -410,7 +414,6 @@ rait_device_base_init (RaitDeviceClass * c)
  * through the array.
  */
 
-#ifdef USE_INTERNAL_THREADPOOL
 static gpointer rait_thread_pool_func(gpointer data) {
     ThreadInfo *inf = data;
 
@@ -451,10 +454,13 @@ static void do_thread_pool_op(RaitDevice *self, GFunc func, GPtrArray * ops) {
     if (PRIVATE(self)->threads->len < ops->len)
 	g_array_set_size(PRIVATE(self)->threads, ops->len);
 
+    if (ops->len == 0)
+	return;
+
     /* the semaphore will hit zero when each thread has decremented it */
-    amsemaphore_force_set(PRIVATE(self)->threads_sem, ops->len);
+    amsemaphore_force_set(PRIVATE(self)->threads_sem, ops->len - 1);
 
-    for (i = 0; i < ops->len; i++) {
+    for (i = 0; i < ops->len - 1; i++) {
 	ThreadInfo *inf = &g_array_index(PRIVATE(self)->threads, ThreadInfo, i);
 	if (!inf->thread) {
 	    inf->mutex = g_mutex_new();
@@ -471,26 +477,12 @@ static void do_thread_pool_op(RaitDevice *self, GFunc func, GPtrArray * ops) {
 	g_mutex_unlock(inf->mutex);
     }
 
+    func(g_ptr_array_index(ops, ops->len - 1), NULL);
+
     /* wait until semaphore hits zero */
     amsemaphore_wait_empty(PRIVATE(self)->threads_sem);
 }
 
-#else /* USE_INTERNAL_THREADPOOL */
-
-static void do_thread_pool_op(RaitDevice *self G_GNUC_UNUSED, GFunc func, GPtrArray * ops) {
-    GThreadPool * pool;
-    guint i;
-
-    pool = g_thread_pool_new(func, NULL, -1, FALSE, NULL);
-    for (i = 0; i < ops->len; i ++) {
-        g_thread_pool_push(pool, g_ptr_array_index(ops, i), NULL);
-    }
-
-    g_thread_pool_free(pool, FALSE, TRUE);
-}
-
-#endif /* USE_INTERNAL_THREADPOOL */
-
 /* This does the above, in a serial fashion (and without using threads) */
 static void do_unthreaded_ops(RaitDevice *self G_GNUC_UNUSED, GFunc func, GPtrArray * ops) {
     guint i;
@@ -526,7 +518,7 @@ child_device_names_to_rait_name(RaitDevice * self) {
 
         bzero(&val, sizeof(val));
 
-        if ((signed)i != self->private->failed) {
+        if (!CHILD_FAILED(self, i)) {
 	    if (device_property_get(child, PROPERTY_CANONICAL_NAME, &val)) {
 		child_name = g_value_get_string(&val);
 		got_prop = TRUE;
@@ -580,7 +572,7 @@ calculate_block_size_from_children(RaitDevice * self, gsize *rait_size)
 
         bzero(&property_result, sizeof(property_result));
 
-	if ((signed)i == self->private->failed)
+	if (CHILD_FAILED(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -671,7 +663,7 @@ set_block_size_on_children(RaitDevice *self, gsize child_block_size)
 
 	bzero(&property_result, sizeof(property_result));
 
-	if ((signed)i == self->private->failed)
+	if (CHILD_FAILED(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -709,6 +701,43 @@ set_block_size_on_children(RaitDevice *self, gsize child_block_size)
     return TRUE;
 }
 
+/* Returns the number of failed children. */
+static guint count_failed_children(RaitDevice * self) {
+    guint64 failed = self->private->failed;
+    guint count = 0;
+
+    while (failed) {
+        failed &= failed - 1;
+        count ++;
+    }
+    return count;
+}
+
+/* Once the number of parity children is known, check that they can make up
+ * for the failed children.  Returns FALSE, with the device's error status
+ * set, if they cannot. */
+static gboolean
+check_failed_children(RaitDevice *self)
+{
+    guint num_children, data_children;
+    guint nfailed = count_failed_children(self);
+
+    if (nfailed == 0)
+	return TRUE;
+
+    find_simple_params(self, &num_children, &data_children);
+    if (nfailed > num_children - data_children) {
+	self->private->status = RAIT_STATUS_FAILED;
+	device_set_error((Device *)self,
+	    g_strdup_printf(_("%d child devices are missing or failed, but only %d hold parity"),
+			    nfailed, num_children - data_children),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
 /* The time for users to specify block sizes has ended; set this device's
  * block-size attributes for easy access by other RAIT functions.  Returns
  * FALSE on error, with the device's error status already set. */
@@ -718,6 +747,11 @@ fix_block_size(RaitDevice *self)
     Device *dself = (Device *)self;
     gsize my_block_size, child_block_size;
 
+    /* the number of parity children is known too, so check that they can
+     * make up for the children that failed to open */
+    if (!check_failed_children(self))
+	return FALSE;
+
     if (dself->block_size_source == PROPERTY_SOURCE_DEFAULT) {
 	child_block_size = calculate_block_size_from_children(self, &my_block_size);
 	if (child_block_size == 0)
@@ -799,7 +833,7 @@ static GPtrArray * make_generic_boolean_op_array(RaitDevice* self) {
     for (i = 0; i < self->private->children->len; i ++) {
         GenericOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (CHILD_FAILED(self, i)) {
             continue;
         }
 
@@ -819,7 +853,7 @@ static GPtrArray * make_generic_boolean_op_array(RaitDevice* self) {
 static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
                                          BooleanExtractor extractor) {
     int nfailed = 0;
-    int lastfailed = 0;
+    guint num_children, data_children;
     guint i;
 
     /* We found one or more failed elements.  See which elements failed, and
@@ -827,13 +861,12 @@ static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
     for (i = 0; i < ops->len; i ++) {
 	GenericOp * op = g_ptr_array_index(ops, i);
 	if (!extractor(op)) {
-	    self->private->failed = op->child_index;
+	    self->private->failed |= (guint64)1 << op->child_index;
 	    g_warning("RAIT array %s isolated device %s: %s",
 		    DEVICE(self)->device_name,
 		    op->child->device_name,
 		    device_error(op->child));
 	    nfailed++;
-            lastfailed = i;
 	}
     }
 
@@ -841,11 +874,13 @@ static gboolean g_ptr_array_union_robust(RaitDevice * self, GPtrArray * ops,
     if (nfailed == 0)
 	return TRUE;
 
-    /* a single failure in COMPLETE just puts us in DEGRADED mode */
-    if (self->private->status == RAIT_STATUS_COMPLETE && nfailed == 1) {
+    /* as long as the parity children can make up for all the failed
+     * children, we are only DEGRADED */
+    find_simple_params(self, &num_children, &data_children);
+    if (count_failed_children(self) <= num_children - data_children) {
+	if (self->private->status == RAIT_STATUS_COMPLETE)
+	    g_warning("RAIT array %s DEGRADED", DEVICE(self)->device_name);
 	self->private->status = RAIT_STATUS_DEGRADED;
-        self->private->failed = lastfailed;
-	g_warning("RAIT array %s DEGRADED", DEVICE(self)->device_name);
 	return TRUE;
     } else {
 	self->private->status = RAIT_STATUS_FAILED;
@@ -919,6 +954,15 @@ open_child_devices (Device * dself, char * device_name,
         return FALSE;
     }
 
+    if (device_names->len > RAIT_MAX_CHILDREN) {
+	device_set_error(dself,
+	    g_strdup_printf(_("RAIT device '%s' has more than %d child devices"),
+			    device_name, RAIT_MAX_CHILDREN),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	g_ptr_array_free_full(device_names);
+        return FALSE;
+    }
+
     /* Open devices in a separate thread, in case they have to rewind etc. */
     device_open_ops = g_ptr_array_new();
 
@@ -937,7 +981,6 @@ open_child_devices (Device * dself, char * device_name,
     g_ptr_array_free(device_names, TRUE);
     do_rait_child_ops(self, device_open_do_op, device_open_ops);
 
-    failure = FALSE;
     failure_errmsgs = NULL;
     failure_flags = 0;
 
@@ -958,31 +1001,32 @@ open_child_devices (Device * dself, char * device_name,
             append_message(&failure_errmsgs,
                            strdup(this_failure_errmsg));
 	    failure_flags |= status;
-            if (self->private->status == RAIT_STATUS_COMPLETE) {
-                /* The first failure just puts us in degraded mode. */
-                g_warning("%s: %s",
-                          device_name, this_failure_errmsg);
-		g_warning("%s: %s failed, entering degraded mode.",
-                          device_name, op->device_name);
-                g_ptr_array_add(self->private->children, op->result);
-                self->private->status = RAIT_STATUS_DEGRADED;
-                self->private->failed = i;
-            } else {
-                /* The second and further failures are fatal. */
-                failure = TRUE;
-            }
+            /* A failure just puts us in degraded mode; whether the parity
+             * children can make up for all of them is checked once the
+             * RAIT_PARITY property is known, see fix_block_size. */
+            g_warning("%s: %s",
+                      device_name, this_failure_errmsg);
+            g_warning("%s: %s failed, entering degraded mode.",
+                      device_name, op->device_name);
+            g_ptr_array_add(self->private->children, op->result);
+            self->private->status = RAIT_STATUS_DEGRADED;
+            self->private->failed |= (guint64)1 << i;
+            amfree(this_failure_errmsg);
         }
         amfree(op->device_name);
     }
 
     g_ptr_array_free_full(device_open_ops);
 
+    /* but with no child at all, there is nothing to work with */
+    failure = (count_failed_children(self) == self->private->children->len);
     if (failure) {
         self->private->status = RAIT_STATUS_FAILED;
 	device_set_error(dself, failure_errmsgs, failure_flags);
         return FALSE;
     }
 
+    amfree(failure_errmsgs);
     return TRUE;
 }
 
@@ -1025,7 +1069,8 @@ rait_device_open_from_children (GSList *child_devices) {
 	/* a NULL kid is OK -- it opens the device in degraded mode */
 	if (!kid) {
 	    nfailures++;
-	    self->private->failed = i;
+	    if (i < RAIT_MAX_CHILDREN)
+		self->private->failed |= (guint64)1 << i;
 	} else {
 	    g_assert(IS_DEVICE(kid));
 	    g_object_ref((GObject *)kid);
@@ -1034,22 +1079,23 @@ rait_device_open_from_children (GSList *child_devices) {
 	g_ptr_array_add(self->private->children, kid);
     }
 
-    /* and set the status based on the children */
-    switch (nfailures) {
-	case 0:
-	    self->private->status = RAIT_STATUS_COMPLETE;
-	    break;
-
-	case 1:
-	    self->private->status = RAIT_STATUS_DEGRADED;
-	    break;
-
-	default:
-	    self->private->status = RAIT_STATUS_FAILED;
-	    device_set_error(dself,
-		    _("more than one child device is missing"),
-		    DEVICE_STATUS_DEVICE_ERROR);
-	    break;
+    /* and set the status based on the children; whether the parity
+     * children can make up for the missing ones is checked once the
+     * RAIT_PARITY property is known, see fix_block_size. */
+    if (i > RAIT_MAX_CHILDREN) {
+	self->private->status = RAIT_STATUS_FAILED;
+	device_set_error(dself,
+		g_strdup_printf(_("more than %d child devices"), RAIT_MAX_CHILDREN),
+		DEVICE_STATUS_DEVICE_ERROR);
+    } else if (nfailures == 0) {
+	self->private->status = RAIT_STATUS_COMPLETE;
+    } else if (nfailures < i) {
+	self->private->status = RAIT_STATUS_DEGRADED;
+    } else {
+	self->private->status = RAIT_STATUS_FAILED;
+	device_set_error(dself,
+		g_strdup(_("all child devices are missing")),
+		DEVICE_STATUS_DEVICE_ERROR);
     }
 
     /* create a name from the children's names and use it to chain up
@@ -1180,7 +1226,7 @@ rait_device_configure(Device * dself, gboolean use_global_config)
     for (i = 0; i < self->private->children->len; i ++) {
 	Device *child;
 
-	if ((signed)i == self->private->failed)
+	if (CHILD_FAILED(self, i))
 	    continue;
 
 	child = g_ptr_array_index(self->private->children, i);
@@ -1240,7 +1286,7 @@ rait_device_start (Device * dself, DeviceAccessMode mode, char * label,
     for (i = 0; i < self->private->children->len; i ++) {
         StartOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (CHILD_FAILED(self, i)) {
             continue;
         }
 
@@ -1429,7 +1475,7 @@ static void find_simple_params(RaitDevice * self,
 
     num = self->private->children->len;
     if (num > 1)
-        data = num - 1;
+        data = num - MIN((int)self->private->nparity, num - 1);
     else
         data = num;
     if (num_children != NULL)
@@ -1443,73 +1489,51 @@ typedef struct {
     guint size;           /* IN */
     gpointer data;        /* IN */
     gboolean data_needs_free; /* bookkeeping */
+    /* for the parity children: the RAIT block to compute DATA from */
+    char * parity_of;     /* IN */
+    guint data_chunks;    /* IN */
+    guint parity_row;     /* IN */
 } WriteBlockOp;
 
+static void make_parity_block(char * data, char * parity,
+                              guint chunk_size, guint data_chunks,
+                              guint row);
+
 /* a GFunc. */
 static void write_block_do_op(gpointer data,
                               gpointer user_data G_GNUC_UNUSED) {
     WriteBlockOp * op = data;
 
+    /* the parity is computed here, in parallel with the writes of the
+     * data children */
+    if (op->parity_of)
+        make_parity_block(op->parity_of, op->data, op->size,
+                          op->data_chunks, op->parity_row);
+
     op->base.result =
         GINT_TO_POINTER(device_write_block(op->base.child, op->size, op->data));
 }
 
-/* Parity block generation. Performance of this function can be improved
-   considerably by using larger-sized integers or
-   assembly-coded vector instructions. Parameters are:
-   % data       - All data chunks in series (chunk_size * num_chunks bytes)
+/* Parity block generation, with the vector instructions of the cpu; see
+   rait-parity.c. Parameters are:
+   % data       - All data chunks in series (chunk_size * data_chunks bytes)
    % parity     - Allocated space for parity block (chunk_size bytes)
+   % row        - Which parity child: 0 is the XOR parity, the others
+                  Reed-Solomon parity
  */
 static void make_parity_block(char * data, char * parity,
-                              guint chunk_size, guint num_chunks) {
+                              guint chunk_size, guint data_chunks,
+                              guint row) {
+    char * sources[RAIT_MAX_CHILDREN];
     guint i;
-    bzero(parity, chunk_size);
-    for (i = 0; i < num_chunks - 1; i ++) {
-        guint j;
-        for (j = 0; j < chunk_size; j ++) {
-            parity[j] ^= data[chunk_size*i + j];
-        }
-    }
-}
 
-/* Does the same thing as make_parity_block, but instead of using a
-   single memory chunk holding all chunks, it takes a GPtrArray of
-   chunks. */
-static void make_parity_block_extents(GPtrArray * data, char * parity,
-                                      guint chunk_size) {
-    guint i;
-    bzero(parity, chunk_size);
-    for (i = 0; i < data->len; i ++) {
-        guint j;
-        char * data_chunk;
-        data_chunk = g_ptr_array_index(data, i);
-        for (j = 0; j < chunk_size; j ++) {
-            parity[j] ^= data_chunk[j];
-        }
+    for (i = 0; i < data_chunks; i ++) {
+        sources[i] = data + chunk_size * i;
     }
-}
-
-/* Does the parity creation algorithm. Allocates and returns a single
-   device block from a larger RAIT block. chunks and chunk are 1-indexed. */
-static char * extract_data_block(char * data, guint size,
-                                 guint chunks, guint chunk) {
-    char * rval;
-    guint chunk_size;
-
-    g_assert(chunks > 0 && chunk > 0 && chunk <= chunks);
-    g_assert(data != NULL);
-    g_assert(size > 0 && size % (chunks - 1) == 0);
-
-    chunk_size = size / (chunks - 1);
-    rval = g_malloc(chunk_size);
-    if (chunks != chunk) {
-        /* data block. */
-        memcpy(rval, data + chunk_size * (chunk - 1), chunk_size);
-    } else {
-        make_parity_block(data, rval, chunk_size, chunks);
-    }
-
-    return rval;
+    if (row == 0)
+        rait_parity(parity, sources, data_chunks, chunk_size);
+    else
+        rait_rs_parity(parity, sources, data_chunks, row, chunk_size);
 }
 
 static DeviceWriteResult
@@ -1528,11 +1552,6 @@ rait_device_write_block (Device * dself, guint size, gpointer data) {
     if (self->private->status != RAIT_STATUS_COMPLETE) return WRITE_FAILED;
 
     find_simple_params(RAIT_DEVICE(self), &num_children, &data_children);
-    num_children = self->private->children->len;
-    if (num_children != 1)
-        data_children = num_children - 1;
-    else
-        data_children = num_children;
 
     g_assert(size % data_children == 0 || last_block);
 
@@ -1549,18 +1568,30 @@ rait_device_write_block (Device * dself, guint size, gpointer data) {
         size = blocksize;
     }
 
+    /* The data children write their chunk straight from the RAIT block; the
+     * parity children compute their block in their own thread.  With a
+     * single data child, every child mirrors it. */
     ops = g_ptr_array_sized_new(num_children);
     for (i = 0; i < self->private->children->len; i ++) {
         WriteBlockOp * op;
         op = g_malloc(sizeof(*op));
         op->base.child = g_ptr_array_index(self->private->children, i);
         op->size = size / data_children;
-        if (num_children <= 2) {
+        op->parity_of = NULL;
+        op->data_chunks = 0;
+        op->parity_row = 0;
+        if (data_children == 1) {
             op->data = data;
             op->data_needs_free = FALSE;
+        } else if (i < data_children) {
+            op->data = (char *)data + op->size * i;
+            op->data_needs_free = FALSE;
         } else {
+            op->data = g_malloc(op->size);
             op->data_needs_free = TRUE;
-            op->data = extract_data_block(data, size, num_children, i + 1);
+            op->parity_of = data;
+            op->data_chunks = data_children;
+            op->parity_row = i - data_children;
         }
         g_ptr_array_add(ops, op);
     }
@@ -1689,7 +1720,7 @@ rait_device_seek_file (Device * dself, guint file) {
     ops = g_ptr_array_sized_new(self->private->children->len);
     for (i = 0; i < self->private->children->len; i ++) {
         SeekFileOp * op;
-        if ((int)i == self->private->failed)
+        if (CHILD_FAILED(self, i))
             continue; /* This device is broken. */
         op = g_new(SeekFileOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -1714,7 +1745,7 @@ rait_device_seek_file (Device * dself, guint file) {
 
         this_op = (SeekFileOp*)g_ptr_array_index(ops, i);
 
-        if ((signed)this_op->base.child_index == self->private->failed)
+        if (CHILD_FAILED(self, this_op->base.child_index))
             continue;
 
         this_result = this_op->base.result;
@@ -1782,7 +1813,7 @@ rait_device_seek_block (Device * dself, guint64 block) {
     ops = g_ptr_array_sized_new(self->private->children->len);
     for (i = 0; i < self->private->children->len; i ++) {
         SeekBlockOp * op;
-        if ((int)i == self->private->failed)
+        if (CHILD_FAILED(self, i))
             continue; /* This device is broken. */
         op = g_new(SeekBlockOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -1857,98 +1888,83 @@ static int g_ptr_array_count(GPtrArray * array, BooleanExtractor filter) {
 
 static gboolean raid_block_reconstruction(RaitDevice * self, GPtrArray * ops,
                                       gpointer buf, size_t bufsize) {
-    guint num_children, data_children;
+    guint num_children, data_children, parity_children;
     gsize blocksize;
     gsize child_blocksize;
     guint i;
-    int parity_child;
-    gpointer parity_block = NULL;
+    char * chunks[RAIT_MAX_CHILDREN];
+    guint64 missing;
     gboolean success;
 
     success = TRUE;
 
     blocksize = DEVICE(self)->block_size;
     find_simple_params(self, &num_children, &data_children);
-
-    if (num_children > 1)
-        parity_child = num_children - 1;
-    else
-        parity_child = -1;
+    parity_children = num_children - data_children;
 
     child_blocksize = blocksize / data_children;
 
+    /* the data chunks go straight to their place in buf, and the missing
+     * ones are rebuilt there */
+    if (num_children == RAIT_MAX_CHILDREN)
+        missing = G_MAXUINT64;
+    else
+        missing = ((guint64)1 << num_children) - 1;
+    for (i = 0; i < data_children; i ++) {
+	g_assert(child_blocksize * (i+1) <= bufsize);
+        chunks[i] = (char *)buf + child_blocksize * i;
+    }
     for (i = 0; i < ops->len; i ++) {
         ReadBlockOp * op = g_ptr_array_index(ops, i);
         if (!extract_boolean_read_block_op_data(op))
             continue;
-        if ((int)(op->base.child_index) == parity_child) {
-            parity_block = op->buffer;
+        missing &= ~((guint64)1 << op->base.child_index);
+        if (op->base.child_index < data_children) {
+            memcpy(chunks[op->base.child_index], op->buffer, child_blocksize);
         } else {
-	    g_assert(child_blocksize * (op->base.child_index+1) <= bufsize);
-            memcpy((char *)buf + child_blocksize * op->base.child_index, op->buffer,
-                   child_blocksize);
+            chunks[op->base.child_index] = op->buffer;
         }
     }
+
     if (self->private->status == RAIT_STATUS_COMPLETE) {
-	g_assert(parity_block != NULL); /* should have found parity_child */
+	g_assert(missing == 0); /* should have read every child */
 
-        if (num_children >= 2) {
-            /* Verify the parity block. This code is inefficient but
-               does the job for the 2-device case, too. */
+        if (parity_children > 0) {
+            /* Verify the parity blocks. This code does the job for the
+               2-device case, too. */
             gpointer constructed_parity;
-            GPtrArray * data_extents;
 
             constructed_parity = g_malloc(child_blocksize);
-            data_extents = g_ptr_array_sized_new(data_children);
-            for (i = 0; i < data_children; i ++) {
-                ReadBlockOp * op = g_ptr_array_index(ops, i);
-                g_assert(extract_boolean_read_block_op_data(op));
-                if ((int)op->base.child_index == parity_child)
-                    continue;
-                g_ptr_array_add(data_extents, op->buffer);
-            }
-            make_parity_block_extents(data_extents, constructed_parity,
-                                      child_blocksize);
-
-            if (0 != memcmp(parity_block, constructed_parity,
-                            child_blocksize)) {
-                device_set_error(DEVICE(self),
-		    g_strdup(_("RAIT is inconsistent: Parity block did not match data blocks.")),
-		    DEVICE_STATUS_DEVICE_ERROR);
-		/* TODO: can't we just isolate the device in this case? */
-                success = FALSE;
+            for (i = 0; i < parity_children && success; i ++) {
+                if (i == 0)
+                    rait_parity(constructed_parity, chunks, data_children,
+                                child_blocksize);
+                else
+                    rait_rs_parity(constructed_parity, chunks, data_children,
+                                   i, child_blocksize);
+
+                if (0 != memcmp(chunks[data_children + i], constructed_parity,
+                                child_blocksize)) {
+                    device_set_error(DEVICE(self),
+                        g_strdup(_("RAIT is inconsistent: Parity block did not match data blocks.")),
+                        DEVICE_STATUS_DEVICE_ERROR);
+                    /* TODO: can't we just isolate the device in this case? */
+                    success = FALSE;
+                }
             }
-            g_ptr_array_free(data_extents, TRUE);
             amfree(constructed_parity);
         } else { /* do nothing. */ }
     } else if (self->private->status == RAIT_STATUS_DEGRADED) {
-	g_assert(self->private->failed >= 0 && self->private->failed < (int)num_children);
-        /* We are in degraded mode. What's missing? */
-        if (self->private->failed == parity_child) {
-            /* do nothing. */
-        } else if (num_children >= 2) {
-            /* Reconstruct failed block from parity block. */
-            GPtrArray * data_extents = g_ptr_array_new();
-
-            for (i = 0; i < data_children; i ++) {
-                ReadBlockOp * op = g_ptr_array_index(ops, i);
-                if (!extract_boolean_read_block_op_data(op))
-                    continue;
-                g_ptr_array_add(data_extents, op->buffer);
-            }
-
-            /* Conveniently, the reconstruction is the same procedure
-               as the parity generation. This even works if there is
-               only one remaining device! */
-            make_parity_block_extents(data_extents,
-                                      (char *)buf + (child_blocksize *
-                                             self->private->failed),
-                                      child_blocksize);
-
-            /* The array members belong to our ops argument. */
-            g_ptr_array_free(data_extents, TRUE);
-        } else {
-            g_assert_not_reached();
+        /* We are in degraded mode.  Missing parity chunks need nothing;
+           missing data chunks are rebuilt from the parity chunks.  With a
+           single parity child, this is the XOR of the other chunks, which
+           even works if there is only one remaining device! */
+        if (!rait_rs_reconstruct(chunks, missing, data_children,
+                                 parity_children, child_blocksize)) {
+            device_set_error(DEVICE(self),
+                g_strdup(_("Too many child devices failed to rebuild the data")),
+                DEVICE_STATUS_DEVICE_ERROR);
+            success = FALSE;
         }
     } else {
 	/* device is already in FAILED state -- we shouldn't even be here */
@@ -1985,7 +2001,7 @@ rait_device_read_block (Device * dself, gpointer buf, int * size, int max_block)
     ops = g_ptr_array_sized_new(num_children);
     for (i = 0; i < num_children; i ++) {
         ReadBlockOp * op;
-        if ((int)i == self->private->failed)
+        if (CHILD_FAILED(self, i))
             continue; /* This device is broken. */
         op = g_new(ReadBlockOp, 1);
         op->base.child = g_ptr_array_index(self->private->children, i);
@@ -2071,7 +2087,7 @@ static GPtrArray * make_property_op_array(RaitDevice * self,
     for (i = 0; i < self->private->children->len; i ++) {
         PropertyOp * op;
 
-        if ((signed)i == self->private->failed) {
+        if (CHILD_FAILED(self, i)) {
             continue;
         }
 
@@ -2547,6 +2563,64 @@ property_set_max_volume_usage_fn(Device *dself,
     return success;
 }
 
+static gboolean
+property_get_rait_parity_fn(Device *dself,
+    DevicePropertyBase *base G_GNUC_UNUSED, GValue *val,
+    PropertySurety *surety, PropertySource *source)
+{
+    RaitDevice *self = RAIT_DEVICE(dself);
+
+    g_value_unset_init(val, G_TYPE_UINT);
+    g_value_set_uint(val, self->private->nparity);
+
+    if (surety)
+	*surety = PROPERTY_SURETY_GOOD;
+
+    if (source)
+	*source = PROPERTY_SOURCE_DEFAULT;
+
+    return TRUE;
+}
+
+static gboolean
+property_set_rait_parity_fn(Device *dself,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    RaitDevice *self = RAIT_DEVICE(dself);
+    guint nparity = g_value_get_uint(val);
+    guint num_children = self->private->children->len;
+    guint data_children;
+
+    if (nparity < 1 || nparity >= num_children) {
+	device_set_error(dself,
+	    g_strdup_printf(_("RAIT_PARITY must be between 1 and %d"),
+			    (int)num_children - 1),
+	    DEVICE_STATUS_DEVICE_ERROR);
+	return FALSE;
+    }
+
+    self->private->nparity = nparity;
+
+    /* the block size calculated for the previous number of data children
+     * does not hold anymore; one given by the user must still divide */
+    if (dself->block_size_source == PROPERTY_SOURCE_DETECTED) {
+	dself->block_size_source = PROPERTY_SOURCE_DEFAULT;
+    } else if (dself->block_size_source != PROPERTY_SOURCE_DEFAULT) {
+	find_simple_params(self, NULL, &data_children);
+	if ((dself->block_size % data_children) != 0) {
+	    device_set_error(dself,
+		g_strdup_printf(_("Block size must be a multiple of %d"), data_children),
+		DEVICE_STATUS_DEVICE_ERROR);
+	    return FALSE;
+	}
+	if (!fix_block_size(self))
+	    return FALSE;
+    }
+
+    return device_simple_property_set_fn(dself, base, val, surety, source);
+}
+
 typedef struct {
     GenericOp base;
     guint filenum;
@@ -2636,5 +2710,11 @@ rait_device_factory (char * device_name, char * device_type, char * device_node)
 void
 rait_device_register (void) {
     static const char * device_prefix_list[] = {"rait", NULL};
+
+    device_property_fill_and_register(&device_property_rait_parity,
+                                      G_TYPE_UINT, "rait_parity",
+      "Number of parity child devices; more than one uses Reed-Solomon parity");
+
+    rait_parity_init();
     register_device(rait_device_factory, device_prefix_list);
 }
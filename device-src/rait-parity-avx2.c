@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2007-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* RAIT parity with AVX2, with four ymm registers holding 128 bytes of parity,
+ * and the Reed-Solomon multiply-and-add. */
+
+#include "amanda.h"
+#include "rait-parity.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+
+gboolean compiled_with_avx2 = TRUE;
+
+void
+rait_parity_avx2(
+    char *parity,
+    char **sources,
+    guint num_sources,
+    gsize len)
+{
+    gsize j;
+    guint i;
+
+    for (j = 0; j + 128 <= len; j += 128) {
+	__m256i p0 = _mm256_loadu_si256((__m256i *)(sources[0] + j));
+	__m256i p1 = _mm256_loadu_si256((__m256i *)(sources[0] + j + 32));
+	__m256i p2 = _mm256_loadu_si256((__m256i *)(sources[0] + j + 64));
+	__m256i p3 = _mm256_loadu_si256((__m256i *)(sources[0] + j + 96));
+	for (i = 1; i < num_sources; i++) {
+	    char *s = sources[i] + j;
+	    p0 = _mm256_xor_si256(p0, _mm256_loadu_si256((__m256i *)s));
+	    p1 = _mm256_xor_si256(p1, _mm256_loadu_si256((__m256i *)(s + 32)));
+	    p2 = _mm256_xor_si256(p2, _mm256_loadu_si256((__m256i *)(s + 64)));
+	    p3 = _mm256_xor_si256(p3, _mm256_loadu_si256((__m256i *)(s + 96)));
+	}
+	_mm256_storeu_si256((__m256i *)(parity + j), p0);
+	_mm256_storeu_si256((__m256i *)(parity + j + 32), p1);
+	_mm256_storeu_si256((__m256i *)(parity + j + 64), p2);
+	_mm256_storeu_si256((__m256i *)(parity + j + 96), p3);
+    }
+    rait_parity_tail(parity, sources, num_sources, j, len);
+}
+
+/* GF(2^8) multiplication by a constant, sixteen bytes at a time per lane:
+ * the products of the low and high nibbles are looked up with VPSHUFB in
+ * two sixteen-entry tables, and added. */
+void
+rait_rs_combine_avx2(
+    char *dst,
+    char **sources,
+    const guint8 *coefs,
+    guint num_sources,
+    gsize len)
+{
+    __m256i lo[RAIT_MAX_CHILDREN];
+    __m256i hi[RAIT_MAX_CHILDREN];
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    gsize j;
+    guint i, x;
+
+    g_assert(num_sources <= RAIT_MAX_CHILDREN);
+    for (i = 0; i < num_sources; i++) {
+	const guint8 *mul = rait_gf_mul_table[coefs[i]];
+	guint8 tlo[16], thi[16];
+
+	for (x = 0; x < 16; x++) {
+	    tlo[x] = mul[x];
+	    thi[x] = mul[x << 4];
+	}
+	lo[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)tlo));
+	hi[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)thi));
+    }
+
+    for (j = 0; j + 64 <= len; j += 64) {
+	__m256i p0 = _mm256_setzero_si256();
+	__m256i p1 = _mm256_setzero_si256();
+	for (i = 0; i < num_sources; i++) {
+	    __m256i x0 = _mm256_loadu_si256((__m256i *)(sources[i] + j));
+	    __m256i x1 = _mm256_loadu_si256((__m256i *)(sources[i] + j + 32));
+	    p0 = _mm256_xor_si256(p0, _mm256_xor_si256(
+		    _mm256_shuffle_epi8(lo[i], _mm256_and_si256(x0, mask)),
+		    _mm256_shuffle_epi8(hi[i], _mm256_and_si256(_mm256_srli_epi64(x0, 4), mask))));
+	    p1 = _mm256_xor_si256(p1, _mm256_xor_si256(
+		    _mm256_shuffle_epi8(lo[i], _mm256_and_si256(x1, mask)),
+		    _mm256_shuffle_epi8(hi[i], _mm256_and_si256(_mm256_srli_epi64(x1, 4), mask))));
+	}
+	_mm256_storeu_si256((__m256i *)(dst + j), p0);
+	_mm256_storeu_si256((__m256i *)(dst + j + 32), p1);
+    }
+    rait_rs_tail(dst, sources, coefs, num_sources, j, len);
+}
+
+#else
+gboolean compiled_with_avx2 = FALSE;
+
+void
+rait_parity_avx2(
+    char *parity G_GNUC_UNUSED,
+    char **sources G_GNUC_UNUSED,
+    guint num_sources G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED)
+{
+   g_error("rait_parity_avx2 is not defined");
+}
+
+void
+rait_rs_combine_avx2(
+    char *dst G_GNUC_UNUSED,
+    char **sources G_GNUC_UNUSED,
+    const guint8 *coefs G_GNUC_UNUSED,
+    guint num_sources G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED)
+{
+   g_error("rait_rs_combine_avx2 is not defined");
+}
+
+#endif
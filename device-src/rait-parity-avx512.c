@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2007-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* RAIT parity with AVX-512, with four zmm registers holding 256 bytes of parity. */
+
+#include "amanda.h"
+#include "rait-parity.h"
+
+#ifdef __AVX512F__
+#include <immintrin.h>
+
+gboolean compiled_with_avx512f = TRUE;
+
+void
+rait_parity_avx512(
+    char *parity,
+    char **sources,
+    guint num_sources,
+    gsize len)
+{
+    gsize j;
+    guint i;
+
+    for (j = 0; j + 256 <= len; j += 256) {
+	__m512i p0 = _mm512_loadu_si512((__m512i *)(sources[0] + j));
+	__m512i p1 = _mm512_loadu_si512((__m512i *)(sources[0] + j + 64));
+	__m512i p2 = _mm512_loadu_si512((__m512i *)(sources[0] + j + 128));
+	__m512i p3 = _mm512_loadu_si512((__m512i *)(sources[0] + j + 192));
+	for (i = 1; i < num_sources; i++) {
+	    char *s = sources[i] + j;
+	    p0 = _mm512_xor_si512(p0, _mm512_loadu_si512((__m512i *)s));
+	    p1 = _mm512_xor_si512(p1, _mm512_loadu_si512((__m512i *)(s + 64)));
+	    p2 = _mm512_xor_si512(p2, _mm512_loadu_si512((__m512i *)(s + 128)));
+	    p3 = _mm512_xor_si512(p3, _mm512_loadu_si512((__m512i *)(s + 192)));
+	}
+	_mm512_storeu_si512((__m512i *)(parity + j), p0);
+	_mm512_storeu_si512((__m512i *)(parity + j + 64), p1);
+	_mm512_storeu_si512((__m512i *)(parity + j + 128), p2);
+	_mm512_storeu_si512((__m512i *)(parity + j + 192), p3);
+    }
+    rait_parity_tail(parity, sources, num_sources, j, len);
+}
+
+#else
+gboolean compiled_with_avx512f = FALSE;
+
+void
+rait_parity_avx512(
+    char *parity G_GNUC_UNUSED,
+    char **sources G_GNUC_UNUSED,
+    guint num_sources G_GNUC_UNUSED,
+    gsize len G_GNUC_UNUSED)
+{
+   g_error("rait_parity_avx512 is not defined");
+}
+
+#endif
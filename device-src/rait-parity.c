@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2007-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* The SSE2 parity implementation (always available on x86_64), a portable
+ * one for the other architectures, and the dispatch to the AVX ones.
+ *
+ * The Reed-Solomon code works in GF(2^8) with the polynomial
+ * x^8 + x^4 + x^3 + x^2 + 1.  Its generator matrix is the identity over a
+ * Cauchy matrix, with rows and columns scaled so that the first row and the
+ * first column are all ones: parity row 0 is the XOR parity, and a single
+ * data chunk is mirrored.  Every square submatrix of a scaled Cauchy matrix
+ * is invertible, so any K of the K + M chunks are enough to rebuild the
+ * data. */
+
+#include "amanda.h"
+#include "amutil.h"
+#include "rait-parity.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef void (* parity_func)(char *parity, char **sources, guint num_sources, gsize len);
+
+typedef void (* rs_func)(char *dst, char **sources, const guint8 *coefs,
+			 guint num_sources, gsize len);
+
+static parity_func parity_function = NULL;
+static const char *parity_function_name = NULL;
+static rs_func rs_function = NULL;
+
+guint8 rait_gf_mul_table[256][256];
+static guint8 gf_log[256];
+static guint8 gf_exp[512];
+
+void
+rait_parity_tail(
+    char *parity,
+    char **sources,
+    guint num_sources,
+    gsize start,
+    gsize len)
+{
+    gsize j;
+    guint i;
+
+    for (j = start; j < len; j++) {
+	char p = sources[0][j];
+	for (i = 1; i < num_sources; i++)
+	    p ^= sources[i][j];
+	parity[j] = p;
+    }
+}
+
+#ifndef __SSE2__
+static void
+parity_word(
+    char *parity,
+    char **sources,
+    guint num_sources,
+    gsize len)
+{
+    gsize j;
+    guint i;
+
+    /* the sources of a block are rarely aligned on the same boundary, so
+     * copy the words in and out with memcpy, which the compiler turns into
+     * plain loads and stores */
+    for (j = 0; j + sizeof(guint64) <= len; j += sizeof(guint64)) {
+	guint64 p, w;
+	memcpy(&p, sources[0] + j, sizeof(p));
+	for (i = 1; i < num_sources; i++) {
+	    memcpy(&w, sources[i] + j, sizeof(w));
+	    p ^= w;
+	}
+	memcpy(parity + j, &p, sizeof(p));
+    }
+    rait_parity_tail(parity, sources, num_sources, j, len);
+}
+#endif
+
+#ifdef __SSE2__
+static void
+parity_sse2(
+    char *parity,
+    char **sources,
+    guint num_sources,
+    gsize len)
+{
+    gsize j;
+    guint i;
+
+    for (j = 0; j + 64 <= len; j += 64) {
+	__m128i p0 = _mm_loadu_si128((__m128i *)(sources[0] + j));
+	__m128i p1 = _mm_loadu_si128((__m128i *)(sources[0] + j + 16));
+	__m128i p2 = _mm_loadu_si128((__m128i *)(sources[0] + j + 32));
+	__m128i p3 = _mm_loadu_si128((__m128i *)(sources[0] + j + 48));
+	for (i = 1; i < num_sources; i++) {
+	    char *s = sources[i] + j;
+	    p0 = _mm_xor_si128(p0, _mm_loadu_si128((__m128i *)s));
+	    p1 = _mm_xor_si128(p1, _mm_loadu_si128((__m128i *)(s + 16)));
+	    p2 = _mm_xor_si128(p2, _mm_loadu_si128((__m128i *)(s + 32)));
+	    p3 = _mm_xor_si128(p3, _mm_loadu_si128((__m128i *)(s + 48)));
+	}
+	_mm_storeu_si128((__m128i *)(parity + j), p0);
+	_mm_storeu_si128((__m128i *)(parity + j + 16), p1);
+	_mm_storeu_si128((__m128i *)(parity + j + 32), p2);
+	_mm_storeu_si128((__m128i *)(parity + j + 48), p3);
+    }
+    rait_parity_tail(parity, sources, num_sources, j, len);
+}
+#endif
+
+static void
+rs_combine_table(
+    char *dst,
+    char **sources,
+    const guint8 *coefs,
+    guint num_sources,
+    gsize len)
+{
+    rait_rs_tail(dst, sources, coefs, num_sources, 0, len);
+}
+
+void
+rait_rs_tail(
+    char *dst,
+    char **sources,
+    const guint8 *coefs,
+    guint num_sources,
+    gsize start,
+    gsize len)
+{
+    const guint8 *mul;
+    guint8 *d = (guint8 *)dst;
+    guint8 *src;
+    gsize j;
+    guint i;
+
+    mul = rait_gf_mul_table[coefs[0]];
+    src = (guint8 *)sources[0];
+    for (j = start; j < len; j++)
+	d[j] = mul[src[j]];
+
+    for (i = 1; i < num_sources; i++) {
+	mul = rait_gf_mul_table[coefs[i]];
+	src = (guint8 *)sources[i];
+	for (j = start; j < len; j++)
+	    d[j] ^= mul[src[j]];
+    }
+}
+
+static void
+make_gf_tables(void)
+{
+    guint x = 1;
+    guint a, b;
+    int i;
+
+    for (i = 0; i < 255; i++) {
+	gf_exp[i] = gf_exp[i + 255] = x;
+	gf_log[x] = i;
+	x <<= 1;
+	if (x & 0x100)
+	    x ^= 0x11d;
+    }
+
+    for (a = 0; a < 256; a++) {
+	for (b = 0; b < 256; b++) {
+	    if (a == 0 || b == 0)
+		rait_gf_mul_table[a][b] = 0;
+	    else
+		rait_gf_mul_table[a][b] = gf_exp[gf_log[a] + gf_log[b]];
+	}
+    }
+}
+
+static guint8
+gf_inv(
+    guint8 a)
+{
+    return gf_exp[255 - gf_log[a]];
+}
+
+static guint8
+gf_div(
+    guint8 a,
+    guint8 b)
+{
+    if (a == 0)
+	return 0;
+    return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+void
+rait_parity_init(void)
+{
+    if (parity_function)
+	return;
+
+    make_gf_tables();
+    if (compiled_with_avx2 && cpu_has_avx2())
+	rs_function = rait_rs_combine_avx2;
+    else
+	rs_function = rs_combine_table;
+
+    if (compiled_with_avx512f && cpu_has_avx512f()) {
+	parity_function_name = "avx512";
+	parity_function = rait_parity_avx512;
+    } else if (compiled_with_avx2 && cpu_has_avx2()) {
+	parity_function_name = "avx2";
+	parity_function = rait_parity_avx2;
+    } else {
+#ifdef __SSE2__
+	parity_function_name = "sse2";
+	parity_function = parity_sse2;
+#else
+	parity_function_name = "word";
+	parity_function = parity_word;
+#endif
+    }
+}
+
+void
+rait_parity(
+    char *parity,
+    char **sources,
+    guint num_sources,
+    gsize len)
+{
+    if (num_sources == 0) {
+	memset(parity, 0, len);
+	return;
+    }
+
+    if (!parity_function)
+	rait_parity_init();
+    parity_function(parity, sources, num_sources, len);
+}
+
+const char *
+rait_parity_get_implementation(void)
+{
+    rait_parity_init();
+    return parity_function_name;
+}
+
+void
+rait_rs_combine(
+    char *dst,
+    char **sources,
+    const guint8 *coefs,
+    guint num_sources,
+    gsize len)
+{
+    guint i;
+
+    if (!parity_function)
+	rait_parity_init();
+
+    for (i = 0; i < num_sources; i++) {
+	if (coefs[i] != 1)
+	    break;
+    }
+    if (i == num_sources) {
+	rait_parity(dst, sources, num_sources, len);
+    } else {
+	rs_function(dst, sources, coefs, num_sources, len);
+    }
+}
+
+/* The Cauchy matrix is 1 / (x_row + y_col), with x_row = row and
+ * y_col = 255 - col, all distinct while K + M <= 256.  Scaling it by
+ * (x_row + y_0) * y_col / y_0 puts ones in the first row and column. */
+guint8
+rait_rs_coefficient(
+    guint row,
+    guint col)
+{
+    guint8 x = row;
+    guint8 y = 255 - col;
+
+    if (!parity_function)
+	rait_parity_init();
+
+    return gf_div(rait_gf_mul_table[x ^ 255][y],
+		  rait_gf_mul_table[x ^ y][255]);
+}
+
+void
+rait_rs_parity(
+    char *parity,
+    char **data,
+    guint k,
+    guint row,
+    gsize len)
+{
+    guint8 coefs[RAIT_MAX_CHILDREN];
+    guint i;
+
+    g_assert(k <= RAIT_MAX_CHILDREN);
+    for (i = 0; i < k; i++)
+	coefs[i] = rait_rs_coefficient(row, i);
+    rait_rs_combine(parity, data, coefs, k, len);
+}
+
+/* invert the N x N matrix M into INV, by Gauss-Jordan elimination; M is
+ * destroyed */
+static gboolean
+gf_invert_matrix(
+    guint8 *m,
+    guint8 *inv,
+    guint n)
+{
+    guint r, c, i;
+
+    for (r = 0; r < n; r++)
+	for (c = 0; c < n; c++)
+	    inv[r * n + c] = (r == c);
+
+    for (c = 0; c < n; c++) {
+	guint8 f;
+
+	/* find a pivot and swap it into place */
+	for (r = c; r < n && m[r * n + c] == 0; r++);
+	if (r == n)
+	    return FALSE;
+	if (r != c) {
+	    for (i = 0; i < n; i++) {
+		guint8 t;
+		t = m[r * n + i]; m[r * n + i] = m[c * n + i]; m[c * n + i] = t;
+		t = inv[r * n + i]; inv[r * n + i] = inv[c * n + i]; inv[c * n + i] = t;
+	    }
+	}
+
+	/* scale the pivot row to a one on the diagonal */
+	f = gf_inv(m[c * n + c]);
+	for (i = 0; i < n; i++) {
+	    m[c * n + i] = rait_gf_mul_table[f][m[c * n + i]];
+	    inv[c * n + i] = rait_gf_mul_table[f][inv[c * n + i]];
+	}
+
+	/* and clear the column in the other rows */
+	for (r = 0; r < n; r++) {
+	    if (r == c || m[r * n + c] == 0)
+		continue;
+	    f = m[r * n + c];
+	    for (i = 0; i < n; i++) {
+		m[r * n + i] ^= rait_gf_mul_table[f][m[c * n + i]];
+		inv[r * n + i] ^= rait_gf_mul_table[f][inv[c * n + i]];
+	    }
+	}
+    }
+
+    return TRUE;
+}
+
+gboolean
+rait_rs_reconstruct(
+    char **chunks,
+    guint64 missing,
+    guint k,
+    guint m,
+    gsize len)
+{
+    guint erased[RAIT_MAX_CHILDREN];
+    guint rows[RAIT_MAX_CHILDREN];
+    char *sources[RAIT_MAX_CHILDREN];
+    guint8 coefs[RAIT_MAX_CHILDREN];
+    guint8 *mat, *inv;
+    guint nerased = 0, nrows = 0, nsources;
+    guint i, c, r;
+    gboolean success;
+
+    g_assert(k + m <= RAIT_MAX_CHILDREN);
+
+    for (i = 0; i < k; i++) {
+	if (missing & ((guint64)1 << i))
+	    erased[nerased++] = i;
+    }
+    if (nerased == 0)
+	return TRUE;
+
+    /* use the first parity chunks that were read */
+    for (i = 0; i < m && nrows < nerased; i++) {
+	if (!(missing & ((guint64)1 << (k + i))))
+	    rows[nrows++] = i;
+    }
+    if (nrows < nerased)
+	return FALSE;
+
+    /* the parity rows restricted to the erased columns, inverted */
+    mat = g_new(guint8, nerased * nerased);
+    inv = g_new(guint8, nerased * nerased);
+    for (r = 0; r < nerased; r++)
+	for (c = 0; c < nerased; c++)
+	    mat[r * nerased + c] = rait_rs_coefficient(rows[r], erased[c]);
+    success = gf_invert_matrix(mat, inv, nerased);
+    g_assert(success);
+
+    /* each erased chunk is a combination of the chunks that were read:
+     * the parity chunks with the coefficients of the inverse, and the data
+     * chunks with those coefficients times their own coefficients in the
+     * parity rows */
+    for (c = 0; c < nerased; c++) {
+	nsources = 0;
+	for (i = 0; i < k; i++) {
+	    guint8 coef = 0;
+
+	    if (missing & ((guint64)1 << i))
+		continue;
+	    for (r = 0; r < nerased; r++)
+		coef ^= rait_gf_mul_table[inv[c * nerased + r]]
+					 [rait_rs_coefficient(rows[r], i)];
+	    sources[nsources] = chunks[i];
+	    coefs[nsources++] = coef;
+	}
+	for (r = 0; r < nerased; r++) {
+	    sources[nsources] = chunks[k + rows[r]];
+	    coefs[nsources++] = inv[c * nerased + r];
+	}
+	rait_rs_combine(chunks[erased[c]], sources, coefs, nsources, len);
+    }
+
+    g_free(mat);
+    g_free(inv);
+    return TRUE;
+}
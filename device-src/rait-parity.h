@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2007-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#ifndef RAIT_PARITY_H
+#define RAIT_PARITY_H
+
+#include <glib.h>
+
+/* XOR parity for the RAIT device.
+ *
+ * rait_parity stores the XOR of the NUM_SOURCES buffers in SOURCES into
+ * PARITY, all LEN bytes long, in a single pass over the memory.  PARITY may
+ * not overlap the sources; with no source, PARITY is zeroed.
+ *
+ * rait_parity_init selects the fastest implementation this cpu supports
+ * ("word", "sse2", "avx2" or "avx512"); it is called when the RAIT device is
+ * registered. */
+void rait_parity_init(void);
+void rait_parity(char *parity, char **sources, guint num_sources, gsize len);
+
+const char *rait_parity_get_implementation(void);
+
+/* Reed-Solomon parity, for K data chunks and M parity chunks, with
+ * K + M <= RAIT_MAX_CHILDREN.  Parity row 0 is the XOR parity above, so a
+ * K+1 array is the classic RAIT.
+ *
+ * rait_rs_coefficient is the GF(2^8) coefficient of data chunk COL in parity
+ * row ROW; it does not depend on K or M.  rait_rs_parity computes parity row
+ * ROW of the K chunks in DATA.
+ *
+ * rait_rs_reconstruct rebuilds the missing data chunks: CHUNKS holds the K
+ * data chunks followed by the M parity chunks, and bit i of MISSING is set if
+ * chunk i could not be read.  Each missing data chunk is written to the
+ * buffer in CHUNKS; missing parity chunks are not rebuilt.  It returns FALSE
+ * if more than M chunks are missing.
+ *
+ * rait_rs_combine stores the sum of the NUM_SOURCES buffers in SOURCES, each
+ * multiplied by the corresponding coefficient in COEFS, into DST. */
+#define RAIT_MAX_CHILDREN 64
+
+guint8 rait_rs_coefficient(guint row, guint col);
+void rait_rs_parity(char *parity, char **data, guint k, guint row, gsize len);
+gboolean rait_rs_reconstruct(char **chunks, guint64 missing, guint k, guint m,
+			     gsize len);
+void rait_rs_combine(char *dst, char **sources, const guint8 *coefs,
+		     guint num_sources, gsize len);
+
+/* Implementations, see rait-parity-avx2.c and rait-parity-avx512.c; the
+ * compiled_with_ flags are FALSE if the compiler lacked the instructions.
+ * rait_parity_tail computes the bytes from START to LEN that are left over
+ * by their vector loops, and rait_rs_tail does the same for rait_rs_combine,
+ * with the multiplication table rait_gf_mul_table. */
+void rait_parity_tail(char *parity, char **sources, guint num_sources,
+		      gsize start, gsize len);
+void rait_rs_tail(char *dst, char **sources, const guint8 *coefs,
+		  guint num_sources, gsize start, gsize len);
+extern guint8 rait_gf_mul_table[256][256];
+
+extern gboolean compiled_with_avx2;
+void rait_parity_avx2(char *parity, char **sources, guint num_sources, gsize len);
+void rait_rs_combine_avx2(char *dst, char **sources, const guint8 *coefs,
+			  guint num_sources, gsize len);
+
+extern gboolean compiled_with_avx512f;
+void rait_parity_avx512(char *parity, char **sources, guint num_sources, gsize len);
+
+#endif /* RAIT_PARITY_H */
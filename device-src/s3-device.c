@@ -69,6 +69,20 @@
 #define S3_DEVICE_DEFAULT_BLOCK_SIZE (10*1024*1024)
 #define EOM_EARLY_WARNING_ZONE_BLOCKS 4
 
+/* S3 refuses parts smaller than 5MB, except the last one, and more than
+ * 10000 parts in a multi-part upload */
+#define S3_MULTI_PART_MIN_SIZE (5*1024*1024)
+#define S3_MULTI_PART_MAX_SIZE (128*1024*1024)
+#define S3_MULTI_PART_MAX_PARTS 10000
+/* The part size is adapted for a part to be uploaded in about that time */
+#define S3_MULTI_PART_TARGET_USEC (10 * G_USEC_PER_SEC)
+
+/* Number of times a block or part is uploaded again after a failure */
+#define S3_UPLOAD_RETRIES 3
+
+/* Maximum number of threads computing the hash of the blocks */
+#define S3_HASH_THREADS 4
+
 /* This goes in lieu of file number for metadata. */
 #define SPECIAL_INFIX "special-"
 
@@ -150,6 +164,18 @@ static DevicePropertyBase device_property_s3_ssl;
 static DevicePropertyBase device_property_s3_subdomain;
 #define PROPERTY_S3_SUBDOMAIN (device_property_s3_subdomain.ID)
 
+/* The number of blocks read ahead */
+static DevicePropertyBase device_property_s3_read_ahead;
+#define PROPERTY_S3_READ_AHEAD (device_property_s3_read_ahead.ID)
+
+/* The size of the ranges a block is read in */
+static DevicePropertyBase device_property_s3_read_range_size;
+#define PROPERTY_S3_READ_RANGE_SIZE (device_property_s3_read_range_size.ID)
+
+/* The number of requests in flight in the curl_multi engine */
+static DevicePropertyBase device_property_s3_max_inflight;
+#define PROPERTY_S3_MAX_INFLIGHT (device_property_s3_max_inflight.ID)
+
 /* Whether to use s3 multi-part upload */
 static DevicePropertyBase device_property_s3_multi_part_upload;
 #define PROPERTY_S3_MULTI_PART_UPLOAD (device_property_s3_multi_part_upload.ID)
@@ -472,6 +498,18 @@ static gboolean s3_device_set_s3_multi_part_upload(Device *self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
 
+static gboolean s3_device_set_s3_max_inflight(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_s3_read_ahead(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
+static gboolean s3_device_set_s3_read_range_size(Device *self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source);
+
 static gboolean s3_device_set_max_volume_usage_fn(Device *p_self,
     DevicePropertyBase *base, GValue *val,
     PropertySurety surety, PropertySource source);
@@ -522,8 +560,20 @@ static gboolean s3_device_set_reps_bucket_fn(Device *self,
 
 static void s3_thread_read_block(gpointer thread_data,
 				 gpointer data);
+static void s3_async_read_done(S3Handle *hdl, gboolean success, char *etag,
+			       gpointer data);
+static void s3_read_block_done(S3Device *self, S3_by_thread *s3t,
+			       gboolean result);
+static S3_by_thread *s3_find_read_range(S3Device *self, const char *key,
+					guint64 range_min);
 static void s3_thread_write_block(gpointer thread_data,
 				  gpointer data);
+static void s3_thread_hash_block(gpointer thread_data,
+				 gpointer data);
+static void s3_async_write_done(S3Handle *hdl, gboolean success, char *etag,
+				gpointer data);
+static void s3_write_block_done(S3Device *self, S3_by_thread *s3t,
+				gboolean result, char *etag);
 static gboolean make_bucket(Device * pself);
 
 
@@ -1182,6 +1232,18 @@ s3_device_register(void)
                                       G_TYPE_BOOLEAN, "s3_multi_part_upload",
        "If multi part upload must be used");
 
+    device_property_fill_and_register(&device_property_s3_max_inflight,
+                                      G_TYPE_UINT64, "s3_max_inflight",
+       "The number of requests in flight in the curl_multi engine");
+
+    device_property_fill_and_register(&device_property_s3_read_ahead,
+                                      G_TYPE_UINT64, "s3_read_ahead",
+       "The number of blocks read ahead");
+
+    device_property_fill_and_register(&device_property_s3_read_range_size,
+                                      G_TYPE_UINT64, "s3_read_range_size",
+       "The size of the ranges a block is read in");
+
     device_property_fill_and_register(&device_property_timeout,
                                       G_TYPE_UINT64, "timeout",
        "The timeout for one tranfer");
@@ -1231,10 +1293,18 @@ s3_device_init(S3Device * self)
     self->nb_threads = 1;
     self->nb_threads_backup = 1;
     self->nb_threads_recovery = 1;
+    self->read_ahead = 0;
+    self->nb_read_slots = 1;
+    self->read_range_size = 0;
     self->use_s3_multi_part_upload = FALSE;
     self->thread_pool_delete = NULL;
     self->thread_pool_write = NULL;
     self->thread_pool_read = NULL;
+    self->thread_pool_hash = NULL;
+    self->s3_async = NULL;
+    self->s3_max_inflight = 0;
+    self->filling_thread = -1;
+    self->part_size = 0;
     self->thread_idle_cond = NULL;
     self->thread_idle_mutex = NULL;
     self->use_s3_multi_delete = 1;
@@ -1524,6 +1594,21 @@ s3_device_base_init(
 	    device_simple_property_get_fn,
 	    s3_device_set_s3_multi_part_upload);
 
+    device_class_register_property(device_class, PROPERTY_S3_MAX_INFLIGHT,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_s3_max_inflight);
+
+    device_class_register_property(device_class, PROPERTY_S3_READ_AHEAD,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_s3_read_ahead);
+
+    device_class_register_property(device_class, PROPERTY_S3_READ_RANGE_SIZE,
+	    PROPERTY_ACCESS_GET_MASK | PROPERTY_ACCESS_SET_BEFORE_START,
+	    device_simple_property_get_fn,
+	    s3_device_set_s3_read_range_size);
+
     device_class_register_property(device_class, PROPERTY_COMPRESSION,
 	    PROPERTY_ACCESS_GET_MASK,
 	    device_simple_property_get_fn,
@@ -2148,6 +2233,25 @@ s3_device_set_nb_threads_backup(Device *p_self,
     return device_simple_property_set_fn(p_self, base, val, surety, source);
 }
 
+static gboolean
+s3_device_set_s3_max_inflight(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    /* each upload in flight needs its own handle and buffer */
+    self->s3_max_inflight = g_value_get_uint64(val);
+    if ((int)self->s3_max_inflight > self->nb_threads_backup) {
+	self->nb_threads_backup = self->s3_max_inflight;
+    }
+    if (self->nb_threads_backup > self->nb_threads) {
+	self->nb_threads = self->nb_threads_backup;
+    }
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
 static gboolean
 s3_device_set_nb_threads_recovery(Device *p_self,
     DevicePropertyBase *base, GValue *val,
@@ -2158,13 +2262,43 @@ s3_device_set_nb_threads_recovery(Device *p_self,
 
     new_val = g_value_get_uint64(val);
     self->nb_threads_recovery = new_val;
-    if (self->nb_threads_recovery > self->nb_threads) {
-	self->nb_threads = self->nb_threads_recovery;
+    self->nb_read_slots = MAX(self->nb_threads_recovery, self->read_ahead);
+    if (self->nb_read_slots > self->nb_threads) {
+	self->nb_threads = self->nb_read_slots;
+    }
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
+static gboolean
+s3_device_set_s3_read_ahead(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    /* each block read ahead needs its own handle and buffer */
+    self->read_ahead = g_value_get_uint64(val);
+    self->nb_read_slots = MAX(self->nb_threads_recovery, self->read_ahead);
+    if (self->nb_read_slots > self->nb_threads) {
+	self->nb_threads = self->nb_read_slots;
     }
 
     return device_simple_property_set_fn(p_self, base, val, surety, source);
 }
 
+static gboolean
+s3_device_set_s3_read_range_size(Device *p_self,
+    DevicePropertyBase *base, GValue *val,
+    PropertySurety surety, PropertySource source)
+{
+    S3Device *self = S3_DEVICE(p_self);
+
+    self->read_range_size = g_value_get_uint64(val);
+
+    return device_simple_property_set_fn(p_self, base, val, surety, source);
+}
+
 static gboolean
 s3_device_set_s3_multi_part_upload(Device *p_self,
     DevicePropertyBase *base, GValue *val,
@@ -2463,6 +2597,14 @@ static void s3_device_finalize(GObject * obj_self) {
 	g_thread_pool_free(self->thread_pool_delete, 1, 1);
 	self->thread_pool_delete = NULL;
     }
+    if (self->thread_pool_hash) {
+	g_thread_pool_free(self->thread_pool_hash, 1, 1);
+	self->thread_pool_hash = NULL;
+    }
+    if (self->s3_async) {
+	s3_async_free(self->s3_async);
+	self->s3_async = NULL;
+    }
     if (self->thread_pool_write) {
 	g_thread_pool_free(self->thread_pool_write, 1, 1);
 	self->thread_pool_write = NULL;
@@ -2751,6 +2893,7 @@ setup_handle(S3Device * self) {
 	    self->s3t[thread].curl_buffer.buffer_len = 0;
 	    self->s3t[thread].timeout = 0;
 	    self->s3t[thread].now_mutex = g_mutex_new();
+	    self->s3t[thread].device = self;
             self->s3t[thread].s3 = s3_open(self->access_key, self->secret_key,
 					   self->session_token,
 					   self->swift_account_id,
@@ -2790,8 +2933,18 @@ setup_handle(S3Device * self) {
 						     NULL);
 	self->thread_pool_write = g_thread_pool_new(s3_thread_write_block, self,
 					      self->nb_threads, 0, NULL);
+	/* the blocks read ahead beyond nb_threads_recovery wait in the pool */
 	self->thread_pool_read = g_thread_pool_new(s3_thread_read_block, self,
-					      self->nb_threads, 0, NULL);
+					      self->nb_threads_recovery, 0, NULL);
+	if (self->s3_max_inflight > 0 && !self->chunked) {
+	    /* falls back to the thread pools if NULL */
+	    self->s3_async = s3_async_new(self->nb_threads);
+	}
+	if (self->s3_async) {
+	    self->thread_pool_hash = g_thread_pool_new(s3_thread_hash_block,
+				self, MIN(self->nb_threads_backup, S3_HASH_THREADS),
+				0, NULL);
+	}
 
 	for (thread = 0; thread < self->nb_threads; thread++) {
 	    s3_verbose(self->s3t[thread].s3, self->verbose);
@@ -3211,7 +3364,7 @@ s3_device_get_bytes_read(
     /* Add per thread */
     g_mutex_lock(self->thread_idle_mutex);
     dltotal = self->dltotal;
-    for (thread = 0; thread < self->nb_threads_recovery; thread++) {
+    for (thread = 0; thread < self->nb_read_slots; thread++) {
 	g_mutex_lock(self->s3t[thread].now_mutex);
 	dltotal += self->s3t[thread].dlnow;
 	g_mutex_unlock(self->s3t[thread].now_mutex);
@@ -3327,18 +3480,178 @@ s3_device_start_file (Device *pself, dumpfile_t *jobInfo) {
 	self->uploadId = g_strdup(s3_initiate_multi_part_upload(self->s3t[0].s3,
 						self->bucket, self->filename));
 	self->part_etag = g_tree_new_full(gint_cmp, NULL, NULL, g_free);
+	self->part_number = 0;
+	self->filling_thread = -1;
+	if (self->part_size < S3_MULTI_PART_MIN_SIZE)
+	    self->part_size = S3_MULTI_PART_MIN_SIZE;
+	if (self->part_size < pself->block_size)
+	    self->part_size = pself->block_size;
     }
 
     return TRUE;
 }
 
+/* Wait for a thread to be idle, and return it; return -1 and set the
+ * device error if a thread is in error.  Called with thread_idle_mutex held. */
+static int
+get_idle_thread(
+    S3Device *self)
+{
+    int idle_thread = 0;
+    int thread;
+    int first_idle = -1;
+
+    while (!idle_thread) {
+	idle_thread = 0;
+	for (thread = 0; thread < self->nb_threads_backup; thread++)  {
+	    if (self->s3t[thread].idle == 1) {
+		idle_thread++;
+		/* Check if the thread is in error */
+		if (self->s3t[thread].errflags != DEVICE_STATUS_SUCCESS) {
+		    device_set_error(DEVICE(self), (char *)self->s3t[thread].errmsg,
+				     self->s3t[thread].errflags);
+		    self->s3t[thread].errflags = DEVICE_STATUS_SUCCESS;
+		    self->s3t[thread].errmsg = NULL;
+		    return -1;
+		}
+		if (first_idle == -1) {
+		    first_idle = thread;
+		    break;
+		}
+	    }
+	}
+	if (!idle_thread) {
+	    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+	}
+    }
+    return first_idle;
+}
+
+/* Start the upload of the block or part in S3T; the async engine is given the
+ * block once its hash is computed by the hash threads, while the write
+ * threads compute it themselves. */
+static void
+s3_device_upload_block(
+    S3Device *self,
+    S3_by_thread *s3t)
+{
+    if (self->s3_async) {
+	g_thread_pool_push(self->thread_pool_hash, s3t, NULL);
+    } else {
+	g_thread_pool_push(self->thread_pool_write, s3t, NULL);
+    }
+}
+
+/* Upload the part being filled, if any */
+static void
+s3_device_send_part(
+    S3Device *self)
+{
+    int thread = self->filling_thread;
+
+    if (thread == -1)
+	return;
+    self->filling_thread = -1;
+    s3_device_upload_block(self, &self->s3t[thread]);
+}
+
+/* Add a block to the part being filled, and upload the part once it reaches
+ * part_size; the next part is filled while the previous ones are hashed and
+ * uploaded. */
+static DeviceWriteResult
+s3_device_write_part(
+    S3Device *self,
+    guint size,
+    gpointer data)
+{
+    Device *pself = DEVICE(self);
+    S3_by_thread *s3t;
+    int thread;
+
+    g_mutex_lock(self->thread_idle_mutex);
+    if (self->filling_thread == -1) {
+	guint64 allocate = MAX(self->part_size, size);
+
+	thread = get_idle_thread(self);
+	if (thread == -1) {
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    return WRITE_FAILED;
+	}
+	s3t = &self->s3t[thread];
+	if (s3t->curl_buffer.buffer && s3t->buffer_len < allocate) {
+	    g_free((char *)s3t->curl_buffer.buffer);
+	    s3t->curl_buffer.buffer = NULL;
+	    s3t->buffer_len = 0;
+	}
+	if (s3t->curl_buffer.buffer == NULL) {
+	    s3t->curl_buffer.buffer = g_try_malloc(allocate);
+	    if (s3t->curl_buffer.buffer == NULL) {
+		device_set_error(pself, g_strdup("Failed to allocate memory"),
+				 DEVICE_STATUS_DEVICE_ERROR);
+		g_mutex_unlock(self->thread_idle_mutex);
+		return WRITE_FAILED;
+	    }
+	    s3t->buffer_len = allocate;
+	}
+	s3t->idle = 0;
+	s3t->done = 0;
+	s3t->retries = 0;
+	s3t->curl_buffer.buffer_pos = 0;
+	s3t->curl_buffer.buffer_len = 0;
+	s3t->curl_buffer.max_buffer_size = s3t->buffer_len;
+	s3t->curl_buffer.end_of_buffer = TRUE;
+	s3t->curl_buffer.mutex = NULL;
+	s3t->curl_buffer.cond = NULL;
+	s3t->filename = g_strdup(self->filename);
+	s3t->uploadId = g_strdup(self->uploadId);
+	s3t->partNumber = ++self->part_number;
+	self->filling_thread = thread;
+    }
+    s3t = &self->s3t[self->filling_thread];
+    g_mutex_unlock(self->thread_idle_mutex);
+
+    /* only this thread uses the buffer until the part is sent */
+    if (s3t->curl_buffer.buffer_len + size > s3t->buffer_len) {
+	char *buffer = g_try_realloc(s3t->curl_buffer.buffer,
+				     s3t->curl_buffer.buffer_len + size);
+	if (buffer == NULL) {
+	    device_set_error(pself, g_strdup("Failed to allocate memory"),
+			     DEVICE_STATUS_DEVICE_ERROR);
+	    /* give the slot back, so nothing waits for this part */
+	    g_mutex_lock(self->thread_idle_mutex);
+	    g_free((void *)s3t->filename);
+	    g_free((void *)s3t->uploadId);
+	    s3t->filename = NULL;
+	    s3t->uploadId = NULL;
+	    s3t->curl_buffer.buffer_len = 0;
+	    s3t->idle = 1;
+	    s3t->done = 1;
+	    self->filling_thread = -1;
+	    g_cond_broadcast(self->thread_idle_cond);
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    return WRITE_FAILED;
+	}
+	s3t->curl_buffer.buffer = buffer;
+	s3t->buffer_len = s3t->curl_buffer.buffer_len + size;
+	s3t->curl_buffer.max_buffer_size = s3t->buffer_len;
+    }
+    memcpy(s3t->curl_buffer.buffer + s3t->curl_buffer.buffer_len, data, size);
+    s3t->curl_buffer.buffer_len += size;
+
+    if (s3t->curl_buffer.buffer_len >= self->part_size) {
+	s3_device_send_part(self);
+    }
+
+    pself->block++;
+    self->volume_bytes += size;
+    return WRITE_SUCCEED;
+}
+
 static DeviceWriteResult
 s3_device_write_block (Device * pself, guint size, gpointer data) {
     char *filename;
     S3Device * self = S3_DEVICE(pself);
-    int idle_thread = 0;
     int thread = -1;
-    int first_idle = -1;
     guint allocate;
 
     g_assert (self != NULL);
@@ -3357,7 +3670,7 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
     }
 
     if (self->use_s3_multi_part_upload && self->uploadId) {
-	filename = g_strdup(self->filename);
+	return s3_device_write_part(self, size, data);
     } else if (self->chunked) {
 	filename = g_strdup(self->filename);
     } else {
@@ -3414,31 +3727,11 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
 	    return WRITE_SUCCEED;
 	}
     } else {
-	while (!idle_thread) {
-	    idle_thread = 0;
-	    for (thread = 0; thread < self->nb_threads_backup; thread++)  {
-		if (self->s3t[thread].idle == 1) {
-		    idle_thread++;
-		    /* Check if the thread is in error */
-		    if (self->s3t[thread].errflags != DEVICE_STATUS_SUCCESS) {
-			device_set_error(pself, (char *)self->s3t[thread].errmsg,
-					 self->s3t[thread].errflags);
-			self->s3t[thread].errflags = DEVICE_STATUS_SUCCESS;
-			self->s3t[thread].errmsg = NULL;
-			g_mutex_unlock(self->thread_idle_mutex);
-			return WRITE_FAILED;
-		    }
-		    if (first_idle == -1) {
-			first_idle = thread;
-			break;
-		    }
-		}
-	    }
-	    if (!idle_thread) {
-		g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
-	    }
+	thread = get_idle_thread(self);
+	if (thread == -1) {
+	    g_mutex_unlock(self->thread_idle_mutex);
+	    return WRITE_FAILED;
 	}
-	thread = first_idle;
 	allocate = size;
     }
 
@@ -3478,14 +3771,51 @@ s3_device_write_block (Device * pself, guint size, gpointer data) {
     self->s3t[thread].filename = filename;
     self->s3t[thread].uploadId = g_strdup(self->uploadId);
     self->s3t[thread].partNumber = pself->block + 1;
+    self->s3t[thread].retries = 0;
     g_mutex_unlock(self->thread_idle_mutex);
-    g_thread_pool_push(self->thread_pool_write, &self->s3t[thread], NULL);
+    if (self->chunked) {
+	g_thread_pool_push(self->thread_pool_write, &self->s3t[thread], NULL);
+    } else {
+	s3_device_upload_block(self, &self->s3t[thread]);
+    }
 
     pself->block++;
     self->volume_bytes += size;
     return WRITE_SUCCEED;
 }
 
+static gint64
+s3_device_now(void)
+{
+    GTimeVal now;
+
+    g_get_current_time(&now);
+    return (gint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+}
+
+/* Whether the upload of S3T must be tried again after a failure; the
+ * other threads keep uploading meanwhile. */
+static gboolean
+s3_device_retry_upload(
+    S3Device *self,
+    S3_by_thread *s3t)
+{
+    if (self->chunked || s3t->retries >= S3_UPLOAD_RETRIES)
+	return FALSE;
+
+    s3t->retries++;
+    if (s3t->uploadId) {
+	g_debug("Upload of part %d of %s failed, trying again (%d/%d): %s",
+		s3t->partNumber, s3t->filename, s3t->retries,
+		S3_UPLOAD_RETRIES, s3_strerror(s3t->s3));
+    } else {
+	g_debug("Upload of %s failed, trying again (%d/%d): %s",
+		s3t->filename, s3t->retries, S3_UPLOAD_RETRIES,
+		s3_strerror(s3t->s3));
+    }
+    return TRUE;
+}
+
 static void
 s3_thread_write_block(
     gpointer thread_data,
@@ -3497,30 +3827,143 @@ s3_thread_write_block(
     gboolean result;
     char *etag = NULL;
 
+    if (!self->chunked) {
+	s3_buffer_compute_hash(s3t->s3, &s3t->curl_buffer);
+    }
+    s3t->upload_start = s3_device_now();
+
+    do {
+	g_free(etag);
+	etag = NULL;
+	if (s3t->uploadId) {
+	    g_mutex_lock(s3t->now_mutex);
+	    s3t->timeout = time(NULL) + 300;
+	    g_mutex_unlock(s3t->now_mutex);
+	    result = s3_part_upload(s3t->s3, self->bucket, (char *)s3t->filename,
+				    (char *)s3t->uploadId, s3t->partNumber, &etag,
+				    S3_BUFFER_READ_FUNCS,
+				    (CurlBuffer *)&s3t->curl_buffer,
+				    progress_func, s3t);
+	    g_mutex_lock(s3t->now_mutex);
+	    s3t->timeout = 0;
+	    g_mutex_unlock(s3t->now_mutex);
+	} else {
+	    g_mutex_lock(s3t->now_mutex);
+	    s3t->timeout = time(NULL) + 300;
+	    g_mutex_unlock(s3t->now_mutex);
+	    result = s3_upload(s3t->s3, self->bucket, (char *)s3t->filename,
+			       self->chunked,
+			       S3_BUFFER_READ_FUNCS,
+			       (CurlBuffer *)&s3t->curl_buffer,
+			       progress_func, s3t);
+	    g_mutex_lock(s3t->now_mutex);
+	    s3t->timeout = 0;
+	    g_mutex_unlock(s3t->now_mutex);
+	}
+    } while (!result && s3_device_retry_upload(self, s3t));
+    s3_write_block_done(self, s3t, result, etag);
+}
+
+/* Compute the hash of the block in S3T, and give it to the async engine */
+static void
+s3_thread_hash_block(
+    gpointer thread_data,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)thread_data;
+    S3Device *self = S3_DEVICE(data);
+
+    /* already done if the upload is tried again */
+    s3_buffer_compute_hash(s3t->s3, &s3t->curl_buffer);
+
+    g_mutex_lock(s3t->now_mutex);
+    s3t->timeout = time(NULL) + 300;
+    g_mutex_unlock(s3t->now_mutex);
+    if (s3t->retries == 0)
+	s3t->upload_start = s3_device_now();
+
     if (s3t->uploadId) {
-	g_mutex_lock(s3t->now_mutex);
-	s3t->timeout = time(NULL) + 300;
-	g_mutex_unlock(s3t->now_mutex);
-	result = s3_part_upload(s3t->s3, self->bucket, (char *)s3t->filename,
-				(char *)s3t->uploadId, s3t->partNumber, &etag,
-				S3_BUFFER_READ_FUNCS,
-				(CurlBuffer *)&s3t->curl_buffer,
-				progress_func, s3t);
-	g_mutex_lock(s3t->now_mutex);
-	s3t->timeout = 0;
-	g_mutex_unlock(s3t->now_mutex);
+	s3_async_part_upload(self->s3_async, s3t->s3, self->bucket,
+			     s3t->filename, s3t->uploadId, s3t->partNumber,
+			     S3_BUFFER_READ_FUNCS,
+			     (CurlBuffer *)&s3t->curl_buffer,
+			     progress_func, s3t,
+			     s3_async_write_done, s3t);
     } else {
-	g_mutex_lock(s3t->now_mutex);
-	s3t->timeout = time(NULL) + 300;
-	g_mutex_unlock(s3t->now_mutex);
-	result = s3_upload(s3t->s3, self->bucket, (char *)s3t->filename,
-			   self->chunked,
-			   S3_BUFFER_READ_FUNCS,
-			   (CurlBuffer *)&s3t->curl_buffer,
-			   progress_func, s3t);
-	g_mutex_lock(s3t->now_mutex);
-	s3t->timeout = 0;
-	g_mutex_unlock(s3t->now_mutex);
+	s3_async_upload(self->s3_async, s3t->s3, self->bucket,
+			s3t->filename,
+			S3_BUFFER_READ_FUNCS,
+			(CurlBuffer *)&s3t->curl_buffer,
+			progress_func, s3t,
+			s3_async_write_done, s3t);
+    }
+}
+
+/* Called by the S3Async engine when the upload of S3T is done */
+static void
+s3_async_write_done(
+    S3Handle *hdl G_GNUC_UNUSED,
+    gboolean success,
+    char *etag,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)data;
+    S3Device *self = s3t->device;
+
+    g_mutex_lock(s3t->now_mutex);
+    s3t->timeout = 0;
+    g_mutex_unlock(s3t->now_mutex);
+
+    /* the engine thread can't wait to queue it again */
+    if (!success && s3_device_retry_upload(self, s3t)) {
+	g_free(etag);
+	g_thread_pool_push(self->thread_pool_hash, s3t, NULL);
+	return;
+    }
+    s3_write_block_done(self, s3t, success, etag);
+}
+
+/* Adapt the part size to the throughput of the part uploaded by S3T, for the
+ * next parts to be uploaded in about S3_MULTI_PART_TARGET_USEC.  Called with
+ * thread_idle_mutex held. */
+static void
+s3_device_adapt_part_size(
+    S3Device *self,
+    S3_by_thread *s3t)
+{
+    guint64 min_size = MAX(S3_MULTI_PART_MIN_SIZE, DEVICE(self)->block_size);
+    gint64 elapsed = s3_device_now() - s3t->upload_start;
+    guint64 target;
+
+    if (elapsed <= 0)
+	elapsed = 1;
+    target = (guint64)((double)s3t->curl_buffer.buffer_len *
+		       S3_MULTI_PART_TARGET_USEC / elapsed);
+
+    /* go half-way, to smooth the measurements */
+    self->part_size = (self->part_size + target) / 2;
+
+    /* grow fast if the upload is getting close to the maximum number of
+     * parts */
+    if (self->part_number > S3_MULTI_PART_MAX_PARTS / 2)
+	self->part_size *= 2;
+
+    if (self->part_size < min_size)
+	self->part_size = min_size;
+    if (self->part_size > S3_MULTI_PART_MAX_SIZE)
+	self->part_size = MAX(S3_MULTI_PART_MAX_SIZE, min_size);
+}
+
+/* Record the result of the upload of S3T, and make it idle */
+static void
+s3_write_block_done(
+    S3Device *self,
+    S3_by_thread *s3t,
+    gboolean result,
+    char *etag)
+{
+    if (!self->chunked) {
+	s3_buffer_free_hash(&s3t->curl_buffer);
     }
     g_free((void *)s3t->filename);
     g_free((void *)s3t->uploadId);
@@ -3532,6 +3975,7 @@ s3_thread_write_block(
     g_mutex_lock(self->thread_idle_mutex);
     if (result && self->uploadId && etag) {
 	g_tree_insert(self->part_etag, GINT_TO_POINTER(s3t->partNumber), etag);
+	s3_device_adapt_part_size(self, s3t);
     } else {
 	g_free(etag);
     }
@@ -3583,6 +4027,7 @@ s3_device_finish_file (Device * pself) {
     }
 
     g_mutex_lock(self->thread_idle_mutex);
+    s3_device_send_part(self);
 
     while (idle_thread != self->nb_threads) {
 	idle_thread = 0;
@@ -3616,6 +4061,8 @@ s3_device_finish_file (Device * pself) {
 	data.end_of_buffer = FALSE;
 	data.mutex = NULL;
 	data.cond = NULL;
+	data.md5_hash = NULL;
+	data.sha256_hash = NULL;
 	s3_complete_multi_part_upload(self->s3t[0].s3,
 				self->bucket, self->filename, self->uploadId,
 				S3_BUFFER_READ_FUNCS, &data);
@@ -3962,6 +4409,7 @@ s3_device_seek_file(Device *pself, guint file) {
     self->last_byte_read = -1;
     self->next_block_to_read = 0;
     self->next_byte_to_read = 0;
+    self->next_range_to_read = 0;
     self->dltotal = 0;
     g_mutex_unlock(self->thread_idle_mutex);
 
@@ -4072,9 +4520,28 @@ s3_device_seek_block(Device *pself, guint64 block) {
     self->last_byte_read = (block * pself->block_size) - 1;
     self->next_block_to_read = block;
     self->next_byte_to_read = block * pself->block_size;
+    self->next_range_to_read = 0;
     return TRUE;
 }
 
+/* The size of the ranges a block of SIZE_REQ bytes is read in.  The ranges
+ * of a block must all fit in the read slots at once, as the block is only
+ * returned when all of them are read. */
+static guint64
+s3_read_range_size(
+    S3Device *self,
+    int size_req)
+{
+    guint64 range_size;
+
+    if (self->read_range_size == 0 || self->chunked)
+	return size_req;
+    range_size = (size_req + self->nb_read_slots - 1) / self->nb_read_slots;
+    range_size = MAX(range_size, self->read_range_size);
+    range_size = MAX(range_size, S3_DEVICE_MIN_BLOCK_SIZE);
+    return MIN(range_size, (guint64)size_req);
+}
+
 static void
 s3_start_read_ahead(
     Device * pself,
@@ -4086,46 +4553,96 @@ s3_start_read_ahead(
     int thread;
     guint64 range_min = 0;
     guint64 range_max = 0;
-
-    int allocate = size_req;
-    if (self->chunked) {
-	allocate = size_req*2 + 1;
+    guint64 block_len;
+    guint64 length;
+    int allocate;
+
+    /* free the ranges left by the blocks already read, past the end of a
+     * short block */
+    if (!self->chunked) {
+	for (thread = 0; thread < self->nb_read_slots; thread++) {
+	    S3_by_thread *s3t = &self->s3t[thread];
+	    if (!s3t->idle && s3t->done && s3t->block < (gint64)pself->block) {
+		g_free(s3t->filename);
+		s3t->filename = NULL;
+		s3t->idle = 1;
+	    }
+	}
     }
 
     /* start a read ahead for each thread */
-    for (thread = 0; thread < self->nb_threads_recovery; thread++) {
+    for (thread = 0; thread < self->nb_read_slots; thread++) {
 	S3_by_thread *s3t = &self->s3t[thread];
 	if (s3t->idle) {
+	    /* the ranges of a block are all of the same size, and a block
+	     * started is always finished */
+	    if (self->next_range_to_read == 0) {
+		self->next_block_size = size_req;
+		self->next_range_size = s3_read_range_size(self, size_req);
+	    }
 	    if (self->filename) {
-		if (max_block >= 0 &&
+		if (max_block >= 0 && self->next_range_to_read == 0 &&
 		    self->next_byte_to_read > self->last_byte_read + max_block * size_req)
 		    break;
-		range_min = self->next_byte_to_read;
-		if (range_min >= self->object_size) {
+		if ((guint64)self->next_byte_to_read >= self->object_size) {
 		    break;
 		}
-		if (self->chunked && max_block > 0) {
-		    range_max = range_min + max_block * size_req - 1;
-		} else if (self->chunked && max_block < 0) {
-		    range_max = self->object_size-1;
+		if (self->chunked) {
+		    range_min = self->next_byte_to_read;
+		    if (max_block > 0) {
+			range_max = range_min + max_block * size_req - 1;
+		    } else if (max_block < 0) {
+			range_max = self->object_size-1;
+		    } else {
+			range_max = range_min + size_req - 1;
+		    }
+		    if (range_max >= self->object_size) {
+			range_max = self->object_size-1;
+		    }
+		    block_len = length = size_req;
 		} else {
-		    range_max = range_min + size_req - 1;
-		}
-		if (range_max >= self->object_size) {
-		    range_max = self->object_size-1;
+		    block_len = MIN(self->next_block_size,
+				    self->object_size - self->next_byte_to_read);
+		    length = MIN(self->next_range_size,
+				 block_len - self->next_range_to_read);
+		    range_min = self->next_byte_to_read + self->next_range_to_read;
+		    range_max = range_min + length - 1;
 		}
 		key = g_strdup(self->filename);
 	    } else {
-		if (max_block >= 0 &&
+		if (max_block >= 0 && self->next_range_to_read == 0 &&
 		    self->next_block_to_read >= (gint64)pself->block + max_block)
 		    break;
+		block_len = self->next_block_size;
+		length = MIN(self->next_range_size,
+			     block_len - self->next_range_to_read);
+		if (length == block_len) {
+		    /* the whole object */
+		    range_min = 0;
+		    range_max = 0;
+		} else {
+		    range_min = self->next_range_to_read;
+		    if (range_min + length < block_len) {
+			range_max = range_min + length - 1;
+		    } else {
+			/* up to the end of the object, so that a block larger
+			 * than the buffer is noticed */
+			range_max = S3_DEVICE_MAX_BLOCK_SIZE - 1;
+		    }
+		}
 		key = file_and_block_to_key(self, pself->file,
 					    self->next_block_to_read);
 	    }
 
+	    allocate = length;
+	    if (self->chunked) {
+		allocate = size_req*2 + 1;
+	    }
+
 	    s3t->filename = key;
 	    s3t->range_min = range_min;
 	    s3t->range_max = range_max;
+	    s3t->block = self->next_block_to_read;
 	    s3t->done = 0;
 	    s3t->idle = 0;
 	    s3t->eof = FALSE;
@@ -4134,7 +4651,7 @@ s3_start_read_ahead(
 	    s3t->errflags = DEVICE_STATUS_SUCCESS;
 	    if (self->chunked ||
 		(self->s3t[thread].curl_buffer.buffer &&
-		 (int)self->s3t[thread].curl_buffer.buffer_len < size_req)) {
+		 (int)self->s3t[thread].curl_buffer.buffer_len < allocate)) {
 		g_free(self->s3t[thread].curl_buffer.buffer);
 		self->s3t[thread].curl_buffer.buffer = NULL;
 		self->s3t[thread].curl_buffer.buffer_len = 0;
@@ -4165,9 +4682,25 @@ s3_start_read_ahead(
 		s3t->curl_buffer.mutex = NULL;
 		s3t->curl_buffer.cond = NULL;
 	    }
-	    self->next_block_to_read++;
-	    self->next_byte_to_read += size_req;
-	    g_thread_pool_push(self->thread_pool_read, s3t, NULL);
+	    self->next_range_to_read += length;
+	    if (self->next_range_to_read >= block_len) {
+		self->next_range_to_read = 0;
+		self->next_block_to_read++;
+		self->next_byte_to_read += self->next_block_size;
+	    }
+	    if (self->s3_async && !self->chunked && !self->read_from_glacier) {
+		g_mutex_lock(s3t->now_mutex);
+		s3t->timeout = time(NULL) + 300;
+		g_mutex_unlock(s3t->now_mutex);
+		s3_async_read_range(self->s3_async, s3t->s3, self->bucket,
+				    s3t->filename, s3t->range_min, s3t->range_max,
+				    s3_buffer_write_func, s3_buffer_reset_func,
+				    (CurlBuffer *)&s3t->curl_buffer,
+				    progress_func, s3t,
+				    s3_async_read_done, s3t);
+	    } else {
+		g_thread_pool_push(self->thread_pool_read, s3t, NULL);
+	    }
 	}
     }
 }
@@ -4176,11 +4709,12 @@ static int
 s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_block G_GNUC_UNUSED) {
     S3Device * self = S3_DEVICE(pself);
     char *key;
-    int thread;
-    int done = 0;
-    int found = 0;
+    int nb_ranges = 0;
     guint64 range_min = 0;
+    guint64 nbytes;
     S3_by_thread *s3t = NULL;
+    S3_by_thread *first = NULL;
+    S3_by_thread *last = NULL;
 
     g_assert (self != NULL);
     if (device_in_error(self)) return -1;
@@ -4270,19 +4804,50 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
     }
     g_assert(key != NULL);
 
-    found = 0;
-    /* find which thread read the key */
-    for (thread = 0; thread < self->nb_threads_recovery; thread++) {
-	s3t = &self->s3t[thread];
-	if (!s3t->idle &&
-	    g_str_equal(key, (char *)s3t->filename) &&
-	    range_min == s3t->range_min) {
-	    found = 1;
+    /* wait for the ranges of the block, in order; most blocks are read in
+     * a single range */
+    nbytes = 0;
+    while (1) {
+	s3t = s3_find_read_range(self, key, range_min + nbytes);
+	while (!s3t && nb_ranges > 0 && self->next_range_to_read > 0) {
+	    /* the rest of the block waits for a free slot */
+	    s3_start_read_ahead(pself, max_block, *size_req);
+	    if (device_in_error(self)) {
+		g_free(key);
+		g_mutex_unlock(self->thread_idle_mutex);
+		return -1;
+	    }
+	    s3t = s3_find_read_range(self, key, range_min + nbytes);
+	    if (!s3t) {
+		g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+	    }
+	}
+	if (!s3t)
+	    break;
+
+	while (!s3t->done) {
+	    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
+	}
+	if (nb_ranges > 0 && s3t->eof &&
+	    s3t->errflags == DEVICE_STATUS_SUCCESS) {
+	    /* past the end of a short block */
 	    break;
 	}
+	if (nb_ranges == 0)
+	    first = s3t;
+	last = s3t;
+	nb_ranges++;
+	if (s3t->eof || s3t->errflags != DEVICE_STATUS_SUCCESS)
+	    break;
+	nbytes += s3t->curl_buffer.buffer_pos;
+	/* a block object ends with a whole or a short range */
+	if (s3t->range_max == 0 ||
+	    s3t->curl_buffer.buffer_pos < s3t->range_max - s3t->range_min + 1 ||
+	    (self->filename && nbytes >= (guint64)*size_req))
+	    break;
     }
 
-   if (!found) {
+    if (nb_ranges == 0 || first->eof) {
 	/* return eof */
 	g_free(key);
 	pself->is_eof = TRUE;
@@ -4290,48 +4855,48 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 	device_set_error(pself, g_strdup(_("EOF")), DEVICE_STATUS_SUCCESS);
 	g_mutex_unlock(self->thread_idle_mutex);
 	return -1;
-   }
-
-    while (!done) {
-	if (!s3t->done) {
-	} else if (s3t->eof) {
-	    /* return eof */
-	    g_free(key);
-	    pself->is_eof = TRUE;
-	    pself->in_file = FALSE;
-	    device_set_error(pself, g_strdup(_("EOF")), DEVICE_STATUS_SUCCESS);
-	    g_mutex_unlock(self->thread_idle_mutex);
-	    return -1;
-	} else if (s3t->errflags != DEVICE_STATUS_SUCCESS) {
-	    /* return the error */
-	    device_set_error(pself, (char *)s3t->errmsg, s3t->errflags);
-	    g_free(key);
-	    g_mutex_unlock(self->thread_idle_mutex);
-	    return -1;
-       } else if ((guint)*size_req >= s3t->curl_buffer.buffer_pos) {
-	    /* return the buffer */
-	    g_mutex_unlock(self->thread_idle_mutex);
-	    memcpy(data, s3t->curl_buffer.buffer, s3t->curl_buffer.buffer_pos);
-	    *size_req = s3t->curl_buffer.buffer_pos;
-	    g_free(key);
-	    s3t->idle = 1;
-	    g_free((char *)s3t->filename);
-	    pself->block++;
-	    self->last_byte_read += *size_req;
-	    done = 1;
-	    g_mutex_lock(self->thread_idle_mutex);
-	    break;
+    }
+    if (last->errflags != DEVICE_STATUS_SUCCESS) {
+	/* return the error */
+	device_set_error(pself, (char *)last->errmsg, last->errflags);
+	g_free(key);
+	g_mutex_unlock(self->thread_idle_mutex);
+	return -1;
+    }
+    if (nbytes > (guint64)*size_req) {
+	if (self->filename && nb_ranges > 1) {
+	    /* the last range is returned by the next read */
+	    nb_ranges--;
+	    nbytes -= last->curl_buffer.buffer_pos;
 	} else { /* buffer not enough large */
-	    *size_req = s3t->curl_buffer.buffer_len;
+	    if (nb_ranges > 1) {
+		*size_req = nbytes;
+	    } else {
+		*size_req = last->curl_buffer.buffer_len;
+	    }
 	    g_free(key);
 	    g_mutex_unlock(self->thread_idle_mutex);
 	    return 0;
 	}
+    }
 
-	if (!done) {
-	    g_cond_wait(self->thread_idle_cond, self->thread_idle_mutex);
-	}
+    /* return the buffers */
+    nbytes = 0;
+    while (nb_ranges-- > 0) {
+	s3t = s3_find_read_range(self, key, range_min + nbytes);
+	g_mutex_unlock(self->thread_idle_mutex);
+	memcpy((char *)data + nbytes, s3t->curl_buffer.buffer,
+	       s3t->curl_buffer.buffer_pos);
+	g_mutex_lock(self->thread_idle_mutex);
+	nbytes += s3t->curl_buffer.buffer_pos;
+	s3t->idle = 1;
+	g_free((char *)s3t->filename);
+	s3t->filename = NULL;
     }
+    g_free(key);
+    *size_req = nbytes;
+    pself->block++;
+    self->last_byte_read += *size_req;
 
     /* start a read ahead for each thread */
     s3_start_read_ahead(pself, max_block-1, *size_req);
@@ -4342,6 +4907,26 @@ s3_device_read_block (Device * pself, gpointer data, int *size_req, int max_bloc
 
 }
 
+/* Find the slot reading KEY from RANGE_MIN; call with thread_idle_mutex */
+static S3_by_thread *
+s3_find_read_range(
+    S3Device *self,
+    const char *key,
+    guint64 range_min)
+{
+    int thread;
+
+    for (thread = 0; thread < self->nb_read_slots; thread++) {
+	S3_by_thread *s3t = &self->s3t[thread];
+	if (!s3t->idle &&
+	    g_str_equal(key, (char *)s3t->filename) &&
+	    range_min == s3t->range_min) {
+	    return s3t;
+	}
+    }
+    return NULL;
+}
+
 static void
 s3_thread_read_block(
     gpointer thread_data,
@@ -4377,6 +4962,33 @@ s3_thread_read_block(
 	g_mutex_unlock(s3t->now_mutex);
     }
 
+    s3_read_block_done(self, s3t, result);
+}
+
+/* Called by the S3Async engine when the read of S3T is done */
+static void
+s3_async_read_done(
+    S3Handle *hdl G_GNUC_UNUSED,
+    gboolean success,
+    char *etag,
+    gpointer data)
+{
+    S3_by_thread *s3t = (S3_by_thread *)data;
+
+    g_free(etag);
+    g_mutex_lock(s3t->now_mutex);
+    s3t->timeout = 0;
+    g_mutex_unlock(s3t->now_mutex);
+    s3_read_block_done(s3t->device, s3t, success);
+}
+
+/* Record the result of the read of S3T */
+static void
+s3_read_block_done(
+    S3Device *self,
+    S3_by_thread *s3t,
+    gboolean result)
+{
     if (s3t->curl_buffer.mutex) {
 	g_mutex_lock(s3t->curl_buffer.mutex);
 	s3t->curl_buffer.end_of_buffer = TRUE;
@@ -4414,8 +5026,6 @@ s3_thread_read_block(
     s3t->done = 1;
     g_cond_broadcast(self->thread_idle_cond);
     g_mutex_unlock(self->thread_idle_mutex);
-
-    return;
 }
 
 static gboolean
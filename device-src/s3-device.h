@@ -65,11 +65,15 @@ struct _S3_by_thread {
     int			 partNumber;
     guint64		 range_min;
     guint64		 range_max;
+    gint64		 block;		/* the block the range belongs to */
     DeviceStatusFlags    errflags;	/* device_status */
     char                *errmsg;	/* device error message */
     GMutex		*now_mutex;
     guint64		 dlnow, ulnow;
     time_t		 timeout;
+    S3Device		*device;
+    int			 retries;	/* uploads tried again after a failure */
+    gint64		 upload_start;	/* usec */
 };
 
 struct _S3Device {
@@ -144,19 +148,31 @@ struct _S3Device {
     char        *uploadId;
     GTree       *part_etag;
     char        *filename;
+    int          part_number;	/* of the last part of the upload */
+    int          filling_thread;	/* whose buffer is filled with a part */
+    guint64      part_size;
 
     int          nb_threads;
     int          nb_threads_backup;
     int          nb_threads_recovery;
+    int          read_ahead;	/* blocks */
+    int          nb_read_slots;	/* max(nb_threads_recovery, read_ahead) */
+    guint64      read_range_size;	/* 0 to read a block in one request */
     gboolean     use_s3_multi_part_upload;
     GThreadPool *thread_pool_delete;
     GThreadPool *thread_pool_write;
     GThreadPool *thread_pool_read;
+    GThreadPool *thread_pool_hash;
+    S3Async     *s3_async;
+    guint64      s3_max_inflight;
     GCond       *thread_idle_cond;
     GMutex      *thread_idle_mutex;
     gint64	 last_byte_read;
     gint64	 next_block_to_read;
     gint64	 next_byte_to_read;
+    guint64	 next_range_to_read;	/* offset in next_block_to_read */
+    guint64	 next_block_size;	/* its size and the size of its ranges */
+    guint64	 next_range_size;
     GSList      *objects;
     guint64	 object_size;
     gboolean	 bucket_made;
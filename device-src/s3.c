@@ -2132,6 +2132,12 @@ s3_buffer_md5_func(void *stream)
     CurlBuffer *data = stream;
     GByteArray req_body_gba = {(guint8 *)data->buffer, data->buffer_len};
 
+    if (data->md5_hash) {
+	GByteArray *md5_hash = g_byte_array_sized_new(data->md5_hash->len);
+	g_byte_array_append(md5_hash, data->md5_hash->data,
+			    data->md5_hash->len);
+	return md5_hash;
+    }
     return s3_compute_md5_hash(&req_body_gba);
 }
 
@@ -2142,6 +2148,37 @@ s3_buffer_reset_func(void *stream)
     data->buffer_pos = 0;
 }
 
+void
+s3_buffer_compute_hash(
+    S3Handle *hdl,
+    CurlBuffer *data)
+{
+    GByteArray req_body_gba = {(guint8 *)data->buffer, data->buffer_len};
+
+    g_assert(data->mutex == NULL);
+
+    /* the same hash perform_request would compute */
+    if (hdl->s3_api == S3_API_AWS4) {
+	if (!data->sha256_hash)
+	    data->sha256_hash = s3_compute_sha256_hash_ba(&req_body_gba);
+    } else {
+	if (!data->md5_hash)
+	    data->md5_hash = s3_compute_md5_hash(&req_body_gba);
+    }
+}
+
+void
+s3_buffer_free_hash(
+    CurlBuffer *data)
+{
+    if (data->md5_hash) {
+	g_byte_array_free(data->md5_hash, TRUE);
+	data->md5_hash = NULL;
+    }
+    g_free(data->sha256_hash);
+    data->sha256_hash = NULL;
+}
+
 /* a CURLOPT_WRITEFUNCTION to write data to a buffer. */
 size_t
 s3_buffer_write_func(void *ptr, size_t size, size_t nmemb, void *stream)
@@ -2399,49 +2436,139 @@ curl_debug_message(CURL *curl G_GNUC_UNUSED,
 
     return 0;
 }
-static s3_result_t
-perform_request(S3Handle *hdl,
-                const char *verb,
-                const char *bucket,
-                const char *key,
-                const char *subresource,
-                const char **query,
-                const char *content_type,
-                const char *project_id,
-		struct curl_slist *user_headers,
-                s3_read_func read_func,
-                s3_reset_func read_reset_func,
-                s3_size_func size_func,
-                s3_md5_func md5_func,
-                gpointer read_data,
-                s3_write_func write_func,
-                s3_reset_func write_reset_func,
-                gpointer write_data,
-                s3_progress_func progress_func,
-                gpointer progress_data,
-                const result_handling_t *result_handling,
-		gboolean chunked)
-{
-    char *url = NULL;
-    s3_result_t result = S3_RESULT_FAIL; /* assume the worst.. */
-    CURLcode curl_code = CURLE_OK;
-    char curl_error_buffer[CURL_ERROR_SIZE] = "";
-    struct curl_slist *headers = NULL;
-    /* Set S3Internal Data */
-    S3InternalData int_writedata = {{NULL, 0, 0, MAX_ERROR_RESPONSE_LEN, TRUE, NULL, NULL}, NULL, NULL, NULL, FALSE, FALSE, NULL, hdl};
-    gboolean should_retry;
-    gint retries = 0;
-    gint retry_after_close = 0;
-    gulong backoff = EXPONENTIAL_BACKOFF_START_USEC;
+
+/* The state of one request while it is being performed, either synchronously
+ * by perform_request or asynchronously by an S3Async engine.  The strings
+ * are copies, so that an asynchronous request does not depend on the
+ * caller's storage. */
+typedef struct S3Request {
+    S3Handle *hdl;
+    char *verb;
+    char *bucket;
+    char *key;
+    char *subresource;
+    char **query;
+    char *content_type;
+    char *project_id;
+    struct curl_slist *user_headers;
+    s3_read_func read_func;
+    s3_reset_func read_reset_func;
+    s3_size_func size_func;
+    s3_md5_func md5_func;
+    gpointer read_data;
+    s3_progress_func progress_func;
+    gpointer progress_data;
+    const result_handling_t *result_handling;
+    gboolean chunked;
+
+    /* set up once by s3_request_start */
+    gboolean started;
+    char *url;
     /* corresponds to PUT, HEAD, GET, and POST */
-    int curlopt_upload = 0, curlopt_nobody = 0, curlopt_httpget = 0, curlopt_post = 0;
+    int curlopt_upload, curlopt_nobody, curlopt_httpget, curlopt_post;
     /* do we want to examine the headers */
-    const char *curlopt_customrequest = NULL;
+    const char *curlopt_customrequest;
     /* for MD5 calculation */
-    GByteArray *md5_hash = NULL;
-    gchar *md5_hash_hex = NULL, *md5_hash_b64 = NULL;
-    size_t request_body_size = 0;
-    char *data_SHA256Hash = NULL;
+    gchar *md5_hash_hex, *md5_hash_b64;
+    size_t request_body_size;
+    char *data_SHA256Hash;
+
+    /* set up for each attempt by s3_request_setup */
+    struct curl_slist *headers;
+    char curl_error_buffer[CURL_ERROR_SIZE];
+    S3InternalData int_writedata;
+
+    s3_result_t result;
+    gint retries;
+    gint retry_after_close;
+    gulong backoff;
+
+    /* asynchronous requests only */
+    gboolean server_side_encryption_header;
+    s3_done_func done_func;
+    gpointer done_data;
+    gint64 retry_time;
+} S3Request;
+
+static S3Request *
+s3_request_new(S3Handle *hdl,
+               const char *verb,
+               const char *bucket,
+               const char *key,
+               const char *subresource,
+               const char **query,
+               const char *content_type,
+               const char *project_id,
+               struct curl_slist *user_headers,
+               s3_read_func read_func,
+               s3_reset_func read_reset_func,
+               s3_size_func size_func,
+               s3_md5_func md5_func,
+               gpointer read_data,
+               s3_write_func write_func,
+               s3_reset_func write_reset_func,
+               gpointer write_data,
+               s3_progress_func progress_func,
+               gpointer progress_data,
+               const result_handling_t *result_handling,
+               gboolean chunked)
+{
+    S3Request *req = g_new0(S3Request, 1);
+    struct curl_slist *header;
+
+    req->hdl = hdl;
+    req->verb = g_strdup(verb);
+    req->bucket = g_strdup(bucket);
+    req->key = g_strdup(key);
+    req->subresource = g_strdup(subresource);
+    req->query = g_strdupv((gchar **)query);
+    req->content_type = g_strdup(content_type);
+    req->project_id = g_strdup(project_id);
+    for (header = user_headers; header != NULL; header = header->next) {
+	req->user_headers = curl_slist_append(req->user_headers, header->data);
+    }
+    req->read_func = read_func;
+    req->read_reset_func = read_reset_func;
+    req->size_func = size_func;
+    req->md5_func = md5_func;
+    req->read_data = read_data;
+    req->progress_func = progress_func;
+    req->progress_data = progress_data;
+    req->result_handling = result_handling;
+    req->chunked = chunked;
+
+    req->int_writedata.resp_buf.max_buffer_size = MAX_ERROR_RESPONSE_LEN;
+    req->int_writedata.resp_buf.end_of_buffer = TRUE;
+    req->int_writedata.hdl = hdl;
+    if (write_func) {
+        req->int_writedata.write_func = write_func;
+        req->int_writedata.reset_func = write_reset_func;
+        req->int_writedata.write_data = write_data;
+    } else {
+        /* Curl will use fwrite() otherwise */
+        req->int_writedata.write_func = s3_counter_write_func;
+        req->int_writedata.reset_func = s3_counter_reset_func;
+        req->int_writedata.write_data = NULL;
+    }
+
+    req->result = S3_RESULT_FAIL; /* assume the worst.. */
+    req->backoff = EXPONENTIAL_BACKOFF_START_USEC;
+
+    return req;
+}
+
+/* Get the tokens, build the url and hash the request body; this is done once
+ * for all the attempts of a request.
+ *
+ * @returns: FALSE if the request can't be performed; the result is then in
+ * req->result
+ */
+static gboolean
+s3_request_start(S3Request *req)
+{
+    S3Handle *hdl = req->hdl;
+    s3_result_t result;
+    const char *verb = req->verb;
 
     g_assert(hdl != NULL && hdl->curl != NULL);
 
@@ -2450,309 +2577,704 @@ perform_request(S3Handle *hdl,
 	result = oauth2_get_access_token(hdl);
 	if (!result) {
 	    g_debug("oauth2_get_access_token returned %d", result);
-	    return result;
+	    req->result = result;
+	    return FALSE;
 	}
     } else if (hdl->s3_api == S3_API_SWIFT_2 && !hdl->getting_swift_2_token &&
 	       (!hdl->x_auth_token || hdl->expires < time(NULL))) {
 	result = get_openstack_swift_api_v2_setting(hdl);
 	if (!result) {
 	    g_debug("get_openstack_swift_api_v2_setting returned %d", result);
-	    return result;
+	    req->result = result;
+	    return FALSE;
 	}
     } else if (hdl->s3_api == S3_API_SWIFT_3 && !hdl->getting_swift_3_token &&
 	       (!hdl->x_auth_token || hdl->expires < time(NULL))) {
 	result = get_openstack_swift_api_v3_setting(hdl);
 	if (!result) {
 	    g_debug("get_openstack_swift_api_v3_setting returned %d", result);
-	    return result;
+	    req->result = result;
+	    return FALSE;
 	}
     }
 
     s3_reset(hdl);
+    req->started = TRUE;
 
-    url = build_url(hdl, bucket, key, subresource, query);
-    if (!url) goto cleanup;
+    req->url = build_url(hdl, req->bucket, req->key, req->subresource,
+			 (const char **)req->query);
+    if (!req->url) return FALSE;
 
     /* libcurl may behave strangely if these are not set correctly */
     if (g_str_has_prefix(verb, "PUT")) {
-        curlopt_upload = 1;
+        req->curlopt_upload = 1;
     } else if (g_str_has_prefix(verb, "GET")) {
-        curlopt_httpget = 1;
+        req->curlopt_httpget = 1;
     } else if (g_str_has_prefix(verb, "POST")) {
-        curlopt_post = 1;
+        req->curlopt_post = 1;
     } else if (g_str_has_prefix(verb, "HEAD")) {
-        curlopt_nobody = 1;
+        req->curlopt_nobody = 1;
     } else {
-        curlopt_customrequest = verb;
+        req->curlopt_customrequest = verb;
     }
 
-    if (size_func) {
-        request_body_size = size_func(read_data);
+    if (req->size_func) {
+        req->request_body_size = req->size_func(req->read_data);
     }
 
     if (hdl->s3_api == S3_API_AWS4) {
-	if (read_data) {
-	    data_SHA256Hash = s3_compute_sha256_hash_ba(read_data);
+	if (req->read_func == s3_buffer_read_func &&
+	    ((CurlBuffer *)req->read_data)->sha256_hash) {
+	    req->data_SHA256Hash = g_strdup(
+			((CurlBuffer *)req->read_data)->sha256_hash);
+	} else if (req->read_data) {
+	    req->data_SHA256Hash = s3_compute_sha256_hash_ba(req->read_data);
 	} else {
-	    data_SHA256Hash = s3_compute_sha256_hash((unsigned char *)"", 0);
+	    req->data_SHA256Hash = s3_compute_sha256_hash((unsigned char *)"", 0);
 	}
-    } else if (md5_func) {
-        md5_hash = md5_func(read_data);
+    } else if (req->md5_func) {
+	GByteArray *md5_hash = req->md5_func(req->read_data);
         if (md5_hash) {
-            md5_hash_b64 = s3_base64_encode(md5_hash);
-            md5_hash_hex = s3_hex_encode(md5_hash);
+            req->md5_hash_b64 = s3_base64_encode(md5_hash);
+            req->md5_hash_hex = s3_hex_encode(md5_hash);
             g_byte_array_free(md5_hash, TRUE);
         }
     }
-    if (!read_func) {
+    if (!req->read_func) {
         /* Curl will use fread() otherwise */
-        read_func = s3_empty_read_func;
+        req->read_func = s3_empty_read_func;
     }
 
-    if (write_func) {
-        int_writedata.write_func = write_func;
-        int_writedata.reset_func = write_reset_func;
-        int_writedata.write_data = write_data;
-    } else {
-        /* Curl will use fwrite() otherwise */
-        int_writedata.write_func = s3_counter_write_func;
-        int_writedata.reset_func = s3_counter_reset_func;
-        int_writedata.write_data = NULL;
-    }
-
-    while (1) {
-	struct curl_slist *header;
-
-        /* reset things */
-        if (headers) {
-            curl_slist_free_all(headers);
-        }
-        curl_error_buffer[0] = '\0';
-        if (read_reset_func) {
-            read_reset_func(read_data);
-        }
-        /* calls write_reset_func */
-        s3_internal_reset_func(&int_writedata);
+    return TRUE;
+}
 
-        /* set up the request */
-        headers = authenticate_request(hdl, verb, bucket, key, subresource, query,
-            md5_hash_b64, data_SHA256Hash, content_type, request_body_size, project_id);
+/* Set up hdl->curl for the next attempt of the request */
+static CURLcode
+s3_request_setup(S3Request *req)
+{
+    S3Handle *hdl = req->hdl;
+    CURLcode curl_code = CURLE_OK;
+    struct curl_slist *header;
 
-	/* add user header to headers */
-	for (header = user_headers; header != NULL; header = header->next) {
-	    headers = curl_slist_append(headers, header->data);
-	}
+    /* reset things */
+    if (req->headers) {
+	curl_slist_free_all(req->headers);
+    }
+    req->curl_error_buffer[0] = '\0';
+    if (req->read_reset_func) {
+	req->read_reset_func(req->read_data);
+    }
+    /* calls write_reset_func */
+    s3_internal_reset_func(&req->int_writedata);
+
+    /* set up the request */
+    req->headers = authenticate_request(hdl, req->verb, req->bucket, req->key,
+	req->subresource, (const char **)req->query, req->md5_hash_b64,
+	req->data_SHA256Hash, req->content_type, req->request_body_size,
+	req->project_id);
+
+    /* add user header to headers */
+    for (header = req->user_headers; header != NULL; header = header->next) {
+	req->headers = curl_slist_append(req->headers, header->data);
+    }
 
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4 ))) {
-	    goto curl_error;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_IPRESOLVE, CURL_IPRESOLVE_V4 ))) {
+	return curl_code;
 
-	}
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOSIGNAL, TRUE)))
-	    goto curl_error;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOSIGNAL, TRUE)))
+	return curl_code;
 
-        if (hdl->ca_info) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CAINFO, hdl->ca_info)))
-                goto curl_error;
-        }
+    if (hdl->ca_info) {
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CAINFO, hdl->ca_info)))
+	    return curl_code;
+    }
 
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_VERBOSE, hdl->verbose)))
-            goto curl_error;
-        if (hdl->verbose) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_DEBUGFUNCTION,
-                              curl_debug_message)))
-                goto curl_error;
-        }
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_ERRORBUFFER,
-                                          curl_error_buffer)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOPROGRESS, 1)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FOLLOWLOCATION, 1)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_URL, url)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPHEADER,
-                                          headers)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEFUNCTION, s3_internal_write_func)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEDATA, &int_writedata)))
-            goto curl_error;
-        /* Note: we always have to set this apparently, for consistent "end of header" detection */
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERFUNCTION, s3_internal_header_func)))
-            goto curl_error;
-        /* Note: if set, CURLOPT_HEADERDATA seems to also be used for CURLOPT_WRITEDATA ? */
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERDATA, &int_writedata)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSFUNCTION, progress_func)))
-            goto curl_error;
-	if (progress_func) {
-	    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOPROGRESS,0)))
-		goto curl_error;
-	}
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSDATA, progress_data)))
-            goto curl_error;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_VERBOSE, hdl->verbose)))
+	return curl_code;
+    if (hdl->verbose) {
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_DEBUGFUNCTION,
+			  curl_debug_message)))
+	    return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_ERRORBUFFER,
+				      req->curl_error_buffer)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOPROGRESS, 1)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FOLLOWLOCATION, 1)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_URL, req->url)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPHEADER,
+				      req->headers)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEFUNCTION, s3_internal_write_func)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_WRITEDATA, &req->int_writedata)))
+	return curl_code;
+    /* Note: we always have to set this apparently, for consistent "end of header" detection */
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERFUNCTION, s3_internal_header_func)))
+	return curl_code;
+    /* Note: if set, CURLOPT_HEADERDATA seems to also be used for CURLOPT_WRITEDATA ? */
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HEADERDATA, &req->int_writedata)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSFUNCTION, req->progress_func)))
+	return curl_code;
+    if (req->progress_func) {
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOPROGRESS,0)))
+	    return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROGRESSDATA, req->progress_data)))
+	return curl_code;
 
-	if (!chunked) {
-	    /* CURLOPT_INFILESIZE_LARGE added in 7.11.0 */
+    if (!req->chunked) {
+	/* CURLOPT_INFILESIZE_LARGE added in 7.11.0 */
 #if LIBCURL_VERSION_NUM >= 0x070b00
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_INFILESIZE_LARGE,
-					      (curl_off_t)request_body_size)))
-		goto curl_error;
+	if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_INFILESIZE_LARGE,
+					  (curl_off_t)req->request_body_size)))
+	    return curl_code;
 #else
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_INFILESIZE,
-					      (long)request_body_size)))
-		goto curl_error;
+	if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_INFILESIZE,
+					  (long)req->request_body_size)))
+	    return curl_code;
 #endif
 
-	    /* CURLOPT_POSTFIELDSIZE_LARGE added in 7.11.1 */
+	/* CURLOPT_POSTFIELDSIZE_LARGE added in 7.11.1 */
 #if LIBCURL_VERSION_NUM >= 0x070b01
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_POSTFIELDSIZE_LARGE,
-					      (curl_off_t)request_body_size)))
-		goto curl_error;
+	if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_POSTFIELDSIZE_LARGE,
+					  (curl_off_t)req->request_body_size)))
+	    return curl_code;
 #else
-            if ((curl_code = curl_easy_setopt(hdl->curl,
-					      CURLOPT_POSTFIELDSIZE,
-					      (long)request_body_size)))
-		goto curl_error;
+	if ((curl_code = curl_easy_setopt(hdl->curl,
+					  CURLOPT_POSTFIELDSIZE,
+					  (long)req->request_body_size)))
+	    return curl_code;
 #endif
-	}
+    }
 
 /* CURLOPT_MAX_{RECV,SEND}_SPEED_LARGE added in 7.15.5 */
 #if LIBCURL_VERSION_NUM >= 0x070f05
-	if (s3_curl_throttling_compat()) {
-	    if (hdl->max_send_speed)
-		if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_SEND_SPEED_LARGE, (curl_off_t)hdl->max_send_speed)))
-		    goto curl_error;
-
-	    if (hdl->max_recv_speed)
-		if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)hdl->max_recv_speed)))
-		    goto curl_error;
-	}
+    if (s3_curl_throttling_compat()) {
+	if (hdl->max_send_speed)
+	    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_SEND_SPEED_LARGE, (curl_off_t)hdl->max_send_speed)))
+		return curl_code;
+
+	if (hdl->max_recv_speed)
+	    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_MAX_RECV_SPEED_LARGE, (curl_off_t)hdl->max_recv_speed)))
+		return curl_code;
+    }
 #endif
 
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPGET, curlopt_httpget)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_UPLOAD, curlopt_upload)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_POST, curlopt_post)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOBODY, curlopt_nobody)))
-            goto curl_error;
-        if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CUSTOMREQUEST,
-                                          curlopt_customrequest)))
-            goto curl_error;
-
-
-        if (curlopt_upload || curlopt_post) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION, read_func)))
-                goto curl_error;
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA, read_data)))
-                goto curl_error;
-        } else {
-            /* Clear request_body options. */
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION,
-                                              NULL)))
-                goto curl_error;
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA,
-                                              NULL)))
-                goto curl_error;
-        }
-	if (hdl->proxy) {
-            if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROXY,
-                                              hdl->proxy)))
-                goto curl_error;
-	}
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_HTTPGET, req->curlopt_httpget)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_UPLOAD, req->curlopt_upload)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_POST, req->curlopt_post)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_NOBODY, req->curlopt_nobody)))
+	return curl_code;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_CUSTOMREQUEST,
+				      req->curlopt_customrequest)))
+	return curl_code;
+
+
+    if (req->curlopt_upload || req->curlopt_post) {
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION, req->read_func)))
+	    return curl_code;
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA, req->read_data)))
+	    return curl_code;
+    } else {
+	/* Clear request_body options. */
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READFUNCTION,
+					  NULL)))
+	    return curl_code;
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_READDATA,
+					  NULL)))
+	    return curl_code;
+    }
+    if (hdl->proxy) {
+	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PROXY,
+					  hdl->proxy)))
+	    return curl_code;
+    }
 
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FRESH_CONNECT,
-		(long)(hdl->reuse_connection && retry_after_close == 0 ? 0 : 1)))) {
-	    goto curl_error;
-	}
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FORBID_REUSE,
-		(long)(hdl->reuse_connection? 0 : 1)))) {
-	    goto curl_error;
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FRESH_CONNECT,
+	    (long)(hdl->reuse_connection && req->retry_after_close == 0 ? 0 : 1)))) {
+	return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_FORBID_REUSE,
+	    (long)(hdl->reuse_connection? 0 : 1)))) {
+	return curl_code;
+    }
+    if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_TIMEOUT,
+	    (long)hdl->timeout))) {
+	return curl_code;
+    }
+
+    return CURLE_OK;
+}
+
+/* Interpret the response of an attempt into hdl->last*, and decide whether
+ * the request must be retried.
+ *
+ * @returns: TRUE if the request must be retried after sleeping for
+ * req->backoff microseconds; the caller then calls s3_request_retried.
+ */
+static gboolean
+s3_request_done(S3Request *req, CURLcode curl_code)
+{
+    S3Handle *hdl = req->hdl;
+    gboolean should_retry;
+
+    should_retry = interpret_response(hdl, curl_code, req->curl_error_buffer,
+	req->int_writedata.resp_buf.buffer,
+	req->int_writedata.resp_buf.buffer_pos,
+	req->int_writedata.etag, req->md5_hash_hex);
+
+    if (hdl->last_response_code == 503) {
+	s3_new_curl(hdl);
+    }
+
+    if (hdl->s3_api == S3_API_OAUTH2 &&
+	hdl->last_response_code == 401 &&
+	hdl->last_s3_error_code == S3_ERROR_AuthenticationRequired) {
+	should_retry = oauth2_get_access_token(hdl);
+    }
+    /* and, unless we know we need to retry, see what we're to do now */
+    if (!should_retry) {
+	req->result = lookup_result(req->result_handling,
+				    hdl->last_response_code,
+				    hdl->last_s3_error_code,
+				    hdl->last_curl_code);
+
+	/* we're done unless we're retrying */
+	if (req->result != S3_RESULT_RETRY)
+	    return FALSE;
+    }
+
+    if (req->retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES &&
+	req->retry_after_close < 3 &&
+	hdl->last_s3_error_code == S3_ERROR_RequestTimeout) {
+	req->retries = -1;
+	req->retry_after_close++;
+	g_debug("Retry on a new connection");
+    }
+    if (req->retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES) {
+	/* we're out of retries, so annotate hdl->last_message appropriately and bail
+	 * out. */
+	char *m = g_strdup_printf("Too many retries; last message was '%s'", hdl->last_message);
+	if (hdl->last_message) g_free(hdl->last_message);
+	hdl->last_message = m;
+	req->result = S3_RESULT_FAIL;
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Account for a retry, after sleeping for req->backoff */
+static void
+s3_request_retried(S3Request *req)
+{
+    req->retries++;
+    req->backoff *= EXPONENTIAL_BACKOFF_BASE;
+}
+
+/* Leave the details of the response in hdl->last*, free the request and
+ * return its result. */
+static s3_result_t
+s3_request_finish(S3Request *req)
+{
+    S3Handle *hdl = req->hdl;
+    s3_result_t result = req->result;
+
+    if (req->started) {
+	if (result != S3_RESULT_OK) {
+	    g_debug(_("%s %s failed with %d/%s"), req->verb, req->url,
+		    hdl->last_response_code,
+		    s3_error_name_from_code(hdl->last_s3_error_code));
 	}
-	if ((curl_code = curl_easy_setopt(hdl->curl, CURLOPT_TIMEOUT,
-		(long)hdl->timeout))) {
-	    goto curl_error;
+
+	/* we don't deallocate the response body -- we keep it for later */
+	g_free(hdl->etag);
+	hdl->etag = req->int_writedata.etag;
+	hdl->last_response_body = req->int_writedata.resp_buf.buffer;
+	hdl->last_response_body_size = req->int_writedata.resp_buf.buffer_pos;
+	hdl->last_num_retries = req->retries;
+    } else {
+	g_free(req->int_writedata.etag);
+	g_free(req->int_writedata.resp_buf.buffer);
+    }
+
+    g_free(req->url);
+    if (req->headers) curl_slist_free_all(req->headers);
+    if (req->user_headers) curl_slist_free_all(req->user_headers);
+    g_free(req->md5_hash_b64);
+    g_free(req->md5_hash_hex);
+    g_free(req->data_SHA256Hash);
+    g_free(req->verb);
+    g_free(req->bucket);
+    g_free(req->key);
+    g_free(req->subresource);
+    g_strfreev(req->query);
+    g_free(req->content_type);
+    g_free(req->project_id);
+    g_free(req);
+
+    return result;
+}
+
+static s3_result_t
+perform_request(S3Handle *hdl,
+                const char *verb,
+                const char *bucket,
+                const char *key,
+                const char *subresource,
+                const char **query,
+                const char *content_type,
+                const char *project_id,
+		struct curl_slist *user_headers,
+                s3_read_func read_func,
+                s3_reset_func read_reset_func,
+                s3_size_func size_func,
+                s3_md5_func md5_func,
+                gpointer read_data,
+                s3_write_func write_func,
+                s3_reset_func write_reset_func,
+                gpointer write_data,
+                s3_progress_func progress_func,
+                gpointer progress_data,
+                const result_handling_t *result_handling,
+		gboolean chunked)
+{
+    S3Request *req;
+
+    req = s3_request_new(hdl, verb, bucket, key, subresource, query,
+			 content_type, project_id, user_headers,
+			 read_func, read_reset_func, size_func, md5_func,
+			 read_data, write_func, write_reset_func, write_data,
+			 progress_func, progress_data, result_handling, chunked);
+
+    if (s3_request_start(req)) {
+	while (1) {
+	    CURLcode curl_code;
+
+	    /* Perform the request */
+	    curl_code = s3_request_setup(req);
+	    if (curl_code == CURLE_OK)
+		curl_code = curl_easy_perform(hdl->curl);
+
+	    /* interpret the response into hdl->last* */
+	    if (!s3_request_done(req, curl_code))
+		break;
+
+	    g_usleep(req->backoff);
+	    s3_request_retried(req);
 	}
+    }
+
+    return s3_request_finish(req);
+}
+
+/*
+ * curl_multi engine
+ */
+
+#if LIBCURL_VERSION_NUM >= 0x071c00
+/* curl_multi_wait was added in 7.28.0 */
+
+struct S3Async {
+    CURLM *multi;
+    guint max_inflight;
+    GThread *thread;
+    int wakeup_pipe[2];
+
+    /* protects the fields below */
+    GMutex *mutex;
+    GCond *cond;
+    GSList *pending;	/* requests submitted but not yet added to the engine */
+    guint inflight;	/* requests submitted and not yet done */
+    gboolean quit;
+
+    /* used only by the engine thread */
+    GSList *retrying;	/* requests waiting for their backoff to expire */
+};
+
+static gint64
+s3_async_now(void)
+{
+    GTimeVal now;
+
+    g_get_current_time(&now);
+    return (gint64)now.tv_sec * G_USEC_PER_SEC + now.tv_usec;
+}
+
+static void s3_async_complete(S3Async *async, S3Request *req, CURLcode curl_code);
+static void s3_async_finish(S3Async *async, S3Request *req);
+
+/* Start an attempt of REQ */
+static void
+s3_async_attempt(
+    S3Async *async,
+    S3Request *req)
+{
+    S3Handle *hdl = req->hdl;
+    CURLcode curl_code;
+    CURLMcode curlm_code;
+
+    if (!req->url) {
+	/* s3_request_start failed */
+	s3_async_finish(async, req);
+	return;
+    }
+
+    hdl->server_side_encryption_header = req->server_side_encryption_header;
+    curl_code = s3_request_setup(req);
+    hdl->server_side_encryption_header = FALSE;
+    if (curl_code == CURLE_OK)
+	curl_code = curl_easy_setopt(hdl->curl, CURLOPT_PRIVATE, req);
+    if (curl_code != CURLE_OK) {
+	s3_async_complete(async, req, curl_code);
+	return;
+    }
+
+    curlm_code = curl_multi_add_handle(async->multi, hdl->curl);
+    if (curlm_code != CURLM_OK) {
+	g_debug("curl_multi_add_handle failed: %s",
+		curl_multi_strerror(curlm_code));
+	s3_async_complete(async, req, CURLE_FAILED_INIT);
+    }
+}
+
+/* Handle the end of an attempt of REQ: schedule a retry, or call its
+ * done_func */
+static void
+s3_async_complete(
+    S3Async *async,
+    S3Request *req,
+    CURLcode curl_code)
+{
+    if (s3_request_done(req, curl_code)) {
+	req->retry_time = s3_async_now() + req->backoff;
+	s3_request_retried(req);
+	async->retrying = g_slist_append(async->retrying, req);
+	return;
+    }
+
+    s3_async_finish(async, req);
+}
+
+/* Free REQ and call its done_func */
+static void
+s3_async_finish(
+    S3Async *async,
+    S3Request *req)
+{
+    S3Handle *hdl = req->hdl;
+    s3_done_func done_func = req->done_func;
+    gpointer done_data = req->done_data;
+    s3_result_t result;
+    char *etag;
 
-        /* Perform the request */
-        curl_code = curl_easy_perform(hdl->curl);
+    result = s3_request_finish(req);
+    etag = hdl->etag;
+    hdl->etag = NULL;
+    done_func(hdl, result == S3_RESULT_OK, etag, done_data);
 
+    g_mutex_lock(async->mutex);
+    async->inflight--;
+    g_cond_broadcast(async->cond);
+    g_mutex_unlock(async->mutex);
+}
 
-        /* interpret the response into hdl->last* */
-    curl_error: /* (label for short-circuiting the curl_easy_perform call) */
-        should_retry = interpret_response(hdl, curl_code, curl_error_buffer,
-            int_writedata.resp_buf.buffer, int_writedata.resp_buf.buffer_pos, int_writedata.etag, md5_hash_hex);
+static gpointer
+s3_async_thread(
+    gpointer data)
+{
+    S3Async *async = (S3Async *)data;
 
-	if (hdl->last_response_code == 503) {
-	    s3_new_curl(hdl);
+    while (1) {
+	GSList *new, *iter, *next;
+	CURLMsg *msg;
+	struct curl_waitfd waitfd;
+	int running, msgs, numfds;
+	long timeout = 1000;
+	gint64 now;
+
+	g_mutex_lock(async->mutex);
+	if (async->quit && async->inflight == 0) {
+	    g_mutex_unlock(async->mutex);
+	    break;
 	}
+	new = async->pending;
+	async->pending = NULL;
+	g_mutex_unlock(async->mutex);
 
-	if (hdl->s3_api == S3_API_OAUTH2 &&
-	    hdl->last_response_code == 401 &&
-	    hdl->last_s3_error_code == S3_ERROR_AuthenticationRequired) {
-	    should_retry = oauth2_get_access_token(hdl);
+	for (iter = new; iter != NULL; iter = iter->next) {
+	    s3_async_attempt(async, (S3Request *)iter->data);
 	}
-        /* and, unless we know we need to retry, see what we're to do now */
-        if (!should_retry) {
-            result = lookup_result(result_handling, hdl->last_response_code,
-                                   hdl->last_s3_error_code, hdl->last_curl_code);
-
-            /* break out of the while(1) unless we're retrying */
-            if (result != S3_RESULT_RETRY)
-                break;
-        }
+	g_slist_free(new);
+
+	/* restart the requests whose backoff expired */
+	now = s3_async_now();
+	for (iter = async->retrying; iter != NULL; iter = next) {
+	    S3Request *req = (S3Request *)iter->data;
+
+	    next = iter->next;
+	    if (req->retry_time <= now) {
+		async->retrying = g_slist_delete_link(async->retrying, iter);
+		s3_async_attempt(async, req);
+	    } else if ((req->retry_time - now) / 1000 < timeout) {
+		timeout = (req->retry_time - now) / 1000 + 1;
+	    }
+	}
+
+	curl_multi_perform(async->multi, &running);
 
-        if (retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES &&
-	    retry_after_close < 3 &&
-	    hdl->last_s3_error_code == S3_ERROR_RequestTimeout) {
-	    retries = -1;
-	    retry_after_close++;
-	    g_debug("Retry on a new connection");
+	while ((msg = curl_multi_info_read(async->multi, &msgs)) != NULL) {
+	    CURL *curl = msg->easy_handle;
+	    CURLcode curl_code = msg->data.result;
+	    S3Request *req = NULL;
+
+	    if (msg->msg != CURLMSG_DONE)
+		continue;
+	    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&req);
+	    curl_multi_remove_handle(async->multi, curl);
+	    s3_async_complete(async, req, curl_code);
 	}
-        if (retries >= EXPONENTIAL_BACKOFF_MAX_RETRIES) {
-            /* we're out of retries, so annotate hdl->last_message appropriately and bail
-             * out. */
-            char *m = g_strdup_printf("Too many retries; last message was '%s'", hdl->last_message);
-            if (hdl->last_message) g_free(hdl->last_message);
-            hdl->last_message = m;
-            result = S3_RESULT_FAIL;
-            break;
-        }
 
-        g_usleep(backoff);
-        retries++;
-        backoff *= EXPONENTIAL_BACKOFF_BASE;
+	waitfd.fd = async->wakeup_pipe[0];
+	waitfd.events = CURL_WAIT_POLLIN;
+	waitfd.revents = 0;
+	curl_multi_wait(async->multi, &waitfd, 1, timeout, &numfds);
+	if (waitfd.revents) {
+	    char buf[64];
+	    if (read(async->wakeup_pipe[0], buf, sizeof(buf)) < 0 &&
+		errno != EAGAIN) {
+		g_debug("s3_async_thread: read from wakeup pipe failed: %s",
+			strerror(errno));
+	    }
+	}
     }
 
-    if (result != S3_RESULT_OK) {
-        g_debug(_("%s %s failed with %d/%s"), verb, url,
-                hdl->last_response_code,
-                s3_error_name_from_code(hdl->last_s3_error_code));
+    return NULL;
+}
+
+/* Queue REQ in the engine; blocks while MAX_INFLIGHT requests are running */
+static void
+s3_async_submit(
+    S3Async *async,
+    S3Request *req)
+{
+    g_mutex_lock(async->mutex);
+    while (async->inflight >= async->max_inflight) {
+	g_cond_wait(async->cond, async->mutex);
     }
+    async->inflight++;
+    async->pending = g_slist_append(async->pending, req);
+    g_mutex_unlock(async->mutex);
 
-cleanup:
-    g_free(url);
-    if (headers) curl_slist_free_all(headers);
-    g_free(md5_hash_b64);
-    g_free(md5_hash_hex);
-    g_free(data_SHA256Hash);
-
-    /* we don't deallocate the response body -- we keep it for later */
-    g_free(hdl->etag);
-    hdl->etag = int_writedata.etag;
-    hdl->last_response_body = int_writedata.resp_buf.buffer;
-    hdl->last_response_body_size = int_writedata.resp_buf.buffer_pos;
-    hdl->last_num_retries = retries;
+    if (write(async->wakeup_pipe[1], "", 1) < 0 && errno != EAGAIN) {
+	g_debug("s3_async_submit: write to wakeup pipe failed: %s",
+		strerror(errno));
+    }
+}
 
-    return result;
+S3Async *
+s3_async_new(
+    guint max_inflight)
+{
+    S3Async *async;
+
+    if (max_inflight == 0)
+	return NULL;
+
+    async = g_new0(S3Async, 1);
+    async->max_inflight = max_inflight;
+    if (pipe(async->wakeup_pipe) < 0) {
+	g_debug("s3_async_new: can't create pipe: %s", strerror(errno));
+	g_free(async);
+	return NULL;
+    }
+    fcntl(async->wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(async->wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+
+    async->multi = curl_multi_init();
+    if (!async->multi) {
+	close(async->wakeup_pipe[0]);
+	close(async->wakeup_pipe[1]);
+	g_free(async);
+	return NULL;
+    }
+    /* keep a connection open for each request that can be in flight */
+    curl_multi_setopt(async->multi, CURLMOPT_MAXCONNECTS, (long)max_inflight);
+
+    async->mutex = g_mutex_new();
+    async->cond = g_cond_new();
+    async->thread = g_thread_create(s3_async_thread, async, TRUE, NULL);
+    g_debug("Created S3 curl_multi engine for %u requests", max_inflight);
+
+    return async;
 }
 
+void
+s3_async_free(
+    S3Async *async)
+{
+    if (!async)
+	return;
+
+    g_mutex_lock(async->mutex);
+    async->quit = TRUE;
+    g_mutex_unlock(async->mutex);
+    if (write(async->wakeup_pipe[1], "", 1) < 0 && errno != EAGAIN) {
+	g_debug("s3_async_free: write to wakeup pipe failed: %s",
+		strerror(errno));
+    }
+    g_thread_join(async->thread);
+
+    curl_multi_cleanup(async->multi);
+    close(async->wakeup_pipe[0]);
+    close(async->wakeup_pipe[1]);
+    g_mutex_free(async->mutex);
+    g_cond_free(async->cond);
+    g_free(async);
+}
+
+#else /* LIBCURL_VERSION_NUM >= 0x071c00 */
+
+struct S3Async {
+    guint max_inflight;
+};
+
+static void
+s3_async_submit(
+    S3Async *async G_GNUC_UNUSED,
+    S3Request *req G_GNUC_UNUSED)
+{
+    g_assert_not_reached();
+}
+
+S3Async *
+s3_async_new(
+    guint max_inflight G_GNUC_UNUSED)
+{
+    g_debug("S3 curl_multi engine requires libcurl 7.28.0 or later");
+    return NULL;
+}
+
+void
+s3_async_free(
+    S3Async *async G_GNUC_UNUSED)
+{
+}
+
+#endif /* LIBCURL_VERSION_NUM >= 0x071c00 */
+
 
 static size_t
 s3_internal_write_func(void *ptr, size_t size, size_t nmemb, void * stream)
@@ -3537,6 +4059,19 @@ s3_strerror(S3Handle *hdl)
     return g_strdup_printf("%s%s%s%s%s", message, s3_info, curl_info, response_info, retries_info);
 }
 
+static result_handling_t upload_result_handling[] = {
+    { 200,  0, 0, S3_RESULT_OK },
+    { 201,  0, 0, S3_RESULT_OK },
+    RESULT_HANDLING_ALWAYS_RETRY,
+    { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
+    };
+
+static result_handling_t part_upload_result_handling[] = {
+    { 200,  0, 0, S3_RESULT_OK },
+    RESULT_HANDLING_ALWAYS_RETRY,
+    { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
+    };
+
 /* Perform an upload. When this function returns, KEY and
  * BUFFER remain the responsibility of the caller.
  *
@@ -3561,12 +4096,6 @@ s3_upload(S3Handle *hdl,
           gpointer progress_data)
 {
     s3_result_t result = S3_RESULT_FAIL;
-    static result_handling_t result_handling[] = {
-        { 200,  0, 0, S3_RESULT_OK },
-        { 201,  0, 0, S3_RESULT_OK },
-        RESULT_HANDLING_ALWAYS_RETRY,
-        { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
-        };
     char *verb = "PUT";
     char *content_type = NULL;
     struct curl_slist *headers = NULL;
@@ -3589,7 +4118,7 @@ s3_upload(S3Handle *hdl,
 		 NULL, content_type, NULL, headers,
                  read_func, reset_func, size_func, md5_func, read_data,
                  NULL, NULL, NULL, progress_func, progress_data,
-                 result_handling, chunked);
+                 upload_result_handling, chunked);
     hdl->server_side_encryption_header = FALSE;
 
     return result == S3_RESULT_OK;
@@ -3624,11 +4153,6 @@ s3_part_upload(S3Handle *hdl,
     char *subresource = NULL;
     char **query = NULL;
     s3_result_t result = S3_RESULT_FAIL;
-    static result_handling_t result_handling[] = {
-        { 200,  0, 0, S3_RESULT_OK },
-        RESULT_HANDLING_ALWAYS_RETRY,
-        { 0,    0, 0, /* default: */ S3_RESULT_FAIL }
-        };
 
     g_assert(hdl != NULL);
 
@@ -3649,7 +4173,7 @@ s3_part_upload(S3Handle *hdl,
 		 NULL,
                  read_func, reset_func, size_func, md5_func, read_data,
                  NULL, NULL, NULL, progress_func, progress_data,
-                 result_handling, FALSE);
+                 part_upload_result_handling, FALSE);
 
     g_free(subresource);
     if (query) {
@@ -3666,6 +4190,105 @@ s3_part_upload(S3Handle *hdl,
 }
 
 
+/* Queue a request in ASYNC; if it can't be started, the engine thread only
+ * calls its done_func, so that it is never called by the caller */
+static gboolean
+s3_async_start(
+    S3Async *async,
+    S3Request *req)
+{
+    gboolean started = s3_request_start(req);
+
+    s3_async_submit(async, req);
+    return started;
+}
+
+gboolean
+s3_async_upload(S3Async *async,
+                S3Handle *hdl,
+                const char *bucket,
+                const char *key,
+                s3_read_func read_func,
+                s3_reset_func reset_func,
+                s3_size_func size_func,
+                s3_md5_func md5_func,
+                gpointer read_data,
+                s3_progress_func progress_func,
+                gpointer progress_data,
+                s3_done_func done_func,
+                gpointer done_data)
+{
+    S3Request *req;
+    char *verb = "PUT";
+    char *content_type = NULL;
+
+    g_assert(async != NULL && hdl != NULL);
+
+    if (hdl->s3_api == S3_API_CASTOR) {
+        verb = "POST";
+	content_type = "application/x-amanda-backup-data";
+    }
+
+    req = s3_request_new(hdl, verb, bucket, key, NULL, NULL, content_type,
+			 NULL, NULL,
+			 read_func, reset_func, size_func, md5_func, read_data,
+			 NULL, NULL, NULL, progress_func, progress_data,
+			 upload_result_handling, FALSE);
+    req->server_side_encryption_header = TRUE;
+    req->done_func = done_func;
+    req->done_data = done_data;
+
+    return s3_async_start(async, req);
+}
+
+gboolean
+s3_async_part_upload(S3Async *async,
+                     S3Handle *hdl,
+                     const char *bucket,
+                     const char *key,
+                     const char *uploadId,
+                     int         partNumber,
+                     s3_read_func read_func,
+                     s3_reset_func reset_func,
+                     s3_size_func size_func,
+                     s3_md5_func md5_func,
+                     gpointer read_data,
+                     s3_progress_func progress_func,
+                     gpointer progress_data,
+                     s3_done_func done_func,
+                     gpointer done_data)
+{
+    S3Request *req;
+    char *subresource = NULL;
+    char *query[3] = { NULL, NULL, NULL };
+
+    g_assert(async != NULL && hdl != NULL && uploadId != NULL);
+
+    if (hdl->s3_api == S3_API_AWS4) {
+	query[0] = g_strdup_printf("partNumber=%d", partNumber);
+	query[1] = g_strdup_printf("uploadId=%s", uploadId);
+    } else {
+	subresource = g_strdup_printf("partNumber=%d&uploadId=%s",
+				      partNumber, uploadId);
+    }
+
+    req = s3_request_new(hdl, "PUT", bucket, key, subresource,
+			 query[0] ? (const char **)query : NULL, NULL, NULL,
+			 NULL,
+			 read_func, reset_func, size_func, md5_func, read_data,
+			 NULL, NULL, NULL, progress_func, progress_data,
+			 part_upload_result_handling, FALSE);
+    req->done_func = done_func;
+    req->done_data = done_data;
+
+    g_free(subresource);
+    g_free(query[0]);
+    g_free(query[1]);
+
+    return s3_async_start(async, req);
+}
+
+
 char *
 s3_initiate_multi_part_upload(
     S3Handle *hdl,
@@ -4117,6 +4740,8 @@ s3_init_restore(
     data.end_of_buffer = TRUE;
     data.mutex = NULL;
     data.cond = NULL;
+    data.md5_hash = NULL;
+    data.sha256_hash = NULL;
 
     result = perform_request(hdl, "POST", bucket, key, "restore", NULL,
 	"application/xml", NULL, NULL,
@@ -4261,6 +4886,55 @@ s3_read_range(S3Handle *hdl,
     return result == S3_RESULT_OK;
 }
 
+static result_handling_t read_result_handling[] = {
+    { 200, 0, 0, S3_RESULT_OK },
+    { 206, 0, 0, S3_RESULT_OK },
+    RESULT_HANDLING_ALWAYS_RETRY,
+    { 0,   0, 0, /* default: */ S3_RESULT_FAIL  }
+    };
+
+gboolean
+s3_async_read_range(S3Async *async,
+                    S3Handle *hdl,
+                    const char *bucket,
+                    const char *key,
+                    const guint64 range_begin,
+                    const guint64 range_end,
+                    s3_write_func write_func,
+                    s3_reset_func reset_func,
+                    gpointer write_data,
+                    s3_progress_func progress_func,
+                    gpointer progress_data,
+                    s3_done_func done_func,
+                    gpointer done_data)
+{
+    S3Request *req;
+    struct curl_slist *headers = NULL;
+
+    g_assert(async != NULL && hdl != NULL);
+    g_assert(write_func != NULL);
+
+    if (range_end > 0) {
+	char *buf = g_strdup_printf("Range: bytes=%llu-%llu",
+				    (long long unsigned)range_begin,
+				    (long long unsigned)range_end);
+	headers = curl_slist_append(headers, buf);
+	g_free(buf);
+    }
+
+    req = s3_request_new(hdl, "GET", bucket, key, NULL, NULL, NULL,
+			 NULL, headers,
+			 NULL, NULL, NULL, NULL, NULL,
+			 write_func, reset_func, write_data,
+			 progress_func, progress_data,
+			 read_result_handling, FALSE);
+    req->done_func = done_func;
+    req->done_data = done_data;
+    curl_slist_free_all(headers);
+
+    return s3_async_start(async, req);
+}
+
 gboolean
 s3_delete(S3Handle *hdl,
           const char *bucket,
@@ -4327,6 +5001,8 @@ s3_multi_delete(S3Handle *hdl,
 	data.end_of_buffer = TRUE;
 	data.mutex = NULL;
 	data.cond = NULL;
+	data.md5_hash = NULL;
+	data.sha256_hash = NULL;
 
 	if (hdl->s3_api == S3_API_SWIFT_3)
 	    cmd = "POST";
@@ -4361,6 +5037,8 @@ s3_multi_delete(S3Handle *hdl,
 	data.end_of_buffer = TRUE;
 	data.mutex = NULL;
 	data.cond = NULL;
+	data.md5_hash = NULL;
+	data.sha256_hash = NULL;
 
 	result = perform_request(hdl, "POST", bucket, NULL, "delete", NULL,
 		 "application/xml", NULL, NULL,
@@ -4564,6 +5242,8 @@ oauth2_get_access_token(
     data.end_of_buffer = TRUE;
     data.mutex = NULL;
     data.cond = NULL;
+    data.md5_hash = NULL;
+    data.sha256_hash = NULL;
 
     hdl->x_storage_url = "https://accounts.google.com/o/oauth2/token";
     hdl->getting_oauth2_access_token = 1;
@@ -127,6 +127,22 @@ typedef size_t (*s3_write_func)(void *data, size_t size, size_t nmemb, void *str
  */
 typedef curl_progress_callback s3_progress_func;
 
+/**
+ * Callback function called when an asynchronous request is done
+ *
+ * @note this is called from the thread of the S3Async engine
+ *
+ * @param hdl: the S3Handle used by the request; the details of the
+ * response are in it, as after a synchronous request
+ * @param success: TRUE if the request succeeded
+ * @param etag: the etag of the response, to be freed by the callback
+ * @param data: the done_data given with the request
+ */
+typedef void (*s3_done_func)(S3Handle *hdl, gboolean success, char *etag, gpointer data);
+
+/* An engine performing S3 requests asynchronously, with curl_multi */
+typedef struct S3Async S3Async;
+
 /*
  * Constants
  */
@@ -490,6 +506,100 @@ s3_part_upload(S3Handle *hdl,
           s3_progress_func progress_func,
           gpointer progress_data);
 
+/* Create an engine performing up to MAX_INFLIGHT requests at once from its
+ * own thread.  Each S3Handle can have only one request in the engine at a
+ * time, and must not be used synchronously while it does.
+ *
+ * @param max_inflight: the maximum number of requests in flight
+ *
+ * @returns: the engine, or NULL if libcurl is too old to support it
+ */
+S3Async *
+s3_async_new(guint max_inflight);
+
+/* Wait for all the requests of the engine to be done, and free it.
+ *
+ * @param async: the engine, may be NULL
+ */
+void
+s3_async_free(S3Async *async);
+
+/* Queue an upload in the engine, like s3_upload.  This blocks while the
+ * engine already has max_inflight requests.
+ *
+ * The data passed to the callbacks must stay valid until DONE_FUNC is
+ * called.  DONE_FUNC is always called from the engine thread, even if the
+ * request can't be started.
+ *
+ * @param async: the engine
+ * @param done_func: the callback called when the request is done
+ * @param done_data: pointer to pass to C{done_func}
+ * (other parameters as for s3_upload)
+ *
+ * @returns: false if the request could not be started
+ */
+gboolean
+s3_async_upload(S3Async *async,
+                S3Handle *hdl,
+                const char *bucket,
+                const char *key,
+                s3_read_func read_func,
+                s3_reset_func reset_func,
+                s3_size_func size_func,
+                s3_md5_func md5_func,
+                gpointer read_data,
+                s3_progress_func progress_func,
+                gpointer progress_data,
+                s3_done_func done_func,
+                gpointer done_data);
+
+/* Queue a part upload in the engine, like s3_part_upload; the etag of the
+ * part is given to DONE_FUNC.
+ *
+ * (parameters as for s3_async_upload and s3_part_upload)
+ *
+ * @returns: false if the request could not be started
+ */
+gboolean
+s3_async_part_upload(S3Async *async,
+                     S3Handle *hdl,
+                     const char *bucket,
+                     const char *key,
+                     const char *uploadId,
+                     int         partNumber,
+                     s3_read_func read_func,
+                     s3_reset_func reset_func,
+                     s3_size_func size_func,
+                     s3_md5_func md5_func,
+                     gpointer read_data,
+                     s3_progress_func progress_func,
+                     gpointer progress_data,
+                     s3_done_func done_func,
+                     gpointer done_data);
+
+/* Queue a read in the engine, like s3_read_range, or like s3_read if
+ * RANGE_END is 0.  Unlike them, it does not wait for an object being
+ * restored from glacier.
+ *
+ * (parameters as for s3_async_upload and s3_read_range)
+ *
+ * @returns: false if the request could not be started
+ */
+gboolean
+s3_async_read_range(S3Async *async,
+                    S3Handle *hdl,
+                    const char *bucket,
+                    const char *key,
+                    const guint64 range_begin,
+                    const guint64 range_end,
+                    s3_write_func write_func,
+                    s3_reset_func reset_func,
+                    gpointer write_data,
+                    s3_progress_func progress_func,
+                    gpointer progress_data,
+                    s3_done_func done_func,
+                    gpointer done_data);
+
 /* Initiate a multi part upload.
  *
  * @param hdl: the S3Handle object
@@ -740,6 +850,8 @@ gboolean sts_refresh_token(char ** token, const char * directory);
  * end_of_buffer: unused
  * mutex: NULL
  * cond: unused
+ * md5_hash, sha256_hash: the hashes of the data, if computed in advance
+ *     by s3_buffer_compute_hash
  */
 /* circle buffer (use for chunked transfer-encodig)
  * buffer: pointer to the buffer
@@ -764,6 +876,8 @@ typedef struct {
     gboolean end_of_buffer;
     GMutex   *mutex;
     GCond    *cond;
+    GByteArray *md5_hash;
+    char     *sha256_hash;
 } CurlBuffer;
 
 #define S3_BUFFER_READ_FUNCS s3_buffer_read_func, s3_buffer_reset_func, s3_buffer_size_func, s3_buffer_md5_func
@@ -783,6 +897,24 @@ s3_buffer_md5_func(void *stream);
 void
 s3_buffer_reset_func(void *stream);
 
+/* Compute in advance the hash of a simple buffer that a request made with
+ * HDL will need, so that it is not computed by the thread performing the
+ * request, nor again when it is retried.  The buffer must not be modified
+ * until s3_buffer_free_hash is called.
+ *
+ * @param hdl: the S3Handle object
+ * @param buffer: the simple buffer
+ */
+void
+s3_buffer_compute_hash(S3Handle *hdl, CurlBuffer *buffer);
+
+/* Forget the hashes computed by s3_buffer_compute_hash
+ *
+ * @param buffer: the simple buffer
+ */
+void
+s3_buffer_free_hash(CurlBuffer *buffer);
+
 #define S3_EMPTY_READ_FUNCS s3_empty_read_func, NULL, s3_empty_size_func, s3_empty_md5_func
 
 /* a CURLOPT_WRITEFUNCTION to write data to a buffer. */
@@ -456,7 +456,7 @@ device_thread_consume_block(
 	    read_offset -= elt->shm_ring->ring_size;
 	elt->shm_ring->mc->readx += readx;
 	elt->shm_ring->mc->read_offset = read_offset;
-	sem_post(elt->shm_ring->sem_write);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
     }
 }
 
@@ -641,10 +641,10 @@ part_done:
 	    part_status = PART_FAILED;
 	    xfer_cancel_with_error(elt, "shm_ring cancelled");
 	}
-	sem_post(elt->shm_ring->sem_read);
-	sem_post(elt->shm_ring->sem_read);
-	sem_post(elt->shm_ring->sem_read);
-	sem_post(elt->shm_ring->sem_write);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
     }
     /* if we write all of the blocks, but the finish_file fails, then likely
      * there was some buffering going on in the device driver, and the blocks
@@ -770,7 +770,7 @@ device_thread(
 
     // notify the producer that everythinng is read
     if (elt->input_mech == XFER_MECH_SHM_RING) {
-	sem_post(elt->shm_ring->sem_write);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
     }
 
     g_debug("device_thread sending XMSG_CRC message");
@@ -913,10 +913,10 @@ cancel_impl(
 	    g_debug("XDTS:cancel_impl: cancelling shm-ring because xfer is cancelled");
 	    elt->shm_ring->mc->cancelled = TRUE;
 	}
-	sem_post(elt->shm_ring->sem_ready);
-	sem_post(elt->shm_ring->sem_start);
-	sem_post(elt->shm_ring->sem_read);
-	sem_post(elt->shm_ring->sem_write);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_ready);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_start);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
     }
     if (self->mem_ring) {
 	g_mutex_lock(self->mem_ring->mutex);
@@ -955,10 +955,10 @@ start_part_impl(
 		_("Previous part did not fail; cannot retry"));
 	    if (elt->shm_ring && !elt->shm_ring->mc->cancelled) {
 		elt->shm_ring->mc->cancelled = TRUE;
-		sem_post(elt->shm_ring->sem_ready);
-		sem_post(elt->shm_ring->sem_start);
-		sem_post(elt->shm_ring->sem_read);
-		sem_post(elt->shm_ring->sem_write);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_ready);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_start);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
 	    }
 	    return;
 	}
@@ -968,10 +968,10 @@ start_part_impl(
 		_("No cache for previous failed part; cannot retry"));
 	    if (elt->shm_ring && !elt->shm_ring->mc->cancelled) {
 		elt->shm_ring->mc->cancelled = TRUE;
-		sem_post(elt->shm_ring->sem_ready);
-		sem_post(elt->shm_ring->sem_start);
-		sem_post(elt->shm_ring->sem_read);
-		sem_post(elt->shm_ring->sem_write);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_ready);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_start);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
 	    }
 	    return;
 	}
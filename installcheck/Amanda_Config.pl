@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 381;
+use Test::More tests => 383;
 use strict;
 use warnings;
 use Data::Dumper;
@@ -181,6 +181,8 @@ $testconf->add_dumptype('mydump-type', [    # note dash
     'estimate' => 'server calcsize client',
     'allow_split' => 'no',
     'allow_split' => 'no',
+    'shm-ring-size' => '4 mbytes',
+    'shm-ring-huge-pages' => 'yes',
 ]);
 $testconf->add_dumptype('second_dumptype', [ # note underscore
     '' => 'mydump-type',
@@ -343,6 +345,10 @@ is(dumptype_getconf($dtyp, $DUMPTYPE_BUMPMULT), 1.75,
     "dumptype real");
 is(dumptype_getconf($dtyp, $DUMPTYPE_STARTTIME), 1829,
     "dumptype time");
+is(dumptype_getconf($dtyp, $DUMPTYPE_SHM_RING_SIZE), 4096,
+    "dumptype shm-ring-size, in kbytes");
+ok(dumptype_getconf($dtyp, $DUMPTYPE_SHM_RING_HUGE_PAGES),
+    "dumptype shm-ring-huge-pages");
 is(dumptype_getconf($dtyp, $DUMPTYPE_HOLDINGDISK), $HOLD_REQUIRED,
     "dumptype holdingdisk");
 is(dumptype_getconf($dtyp, $DUMPTYPE_COMPRESS), $COMP_BEST,
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 18;
+use Test::More tests => 22;
 use strict;
 use warnings;
 
@@ -1316,3 +1316,17 @@ if ($use_diff) {
     is($filedata, $data, "file writing functional. ")
       or diag("original and written infofile different.");
 }
+
+## the same, in an info database
+
+my $infodb = "$Installcheck::TMP/curinfo.db";
+unlink($infodb);
+ok(my $dbci = Amanda::Curinfo->new($infodb),
+    "create an Amanda::Curinfo object for an info database");
+ok(!defined $dbci->put_info($host, $disk, $info),
+    "write the Info object to the info database");
+is($dbci->get_info($host, $disk)->to_text(), $info->to_text(),
+    "read it back from the info database");
+$dbci->del_info($host, $disk);
+is($dbci->get_info($host, $disk)->{'last_level'}, -1,
+    "record deleted from the info database");
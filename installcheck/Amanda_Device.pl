@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 634;
+use Test::More tests => 684;
 use File::Path qw( mkpath rmtree );
 use Sys::Hostname;
 use Carp;
@@ -929,6 +929,67 @@ ok(!($dev->start($ACCESS_WRITE, "TESTCONF29", undef)),
    "start a RAIT device in write mode fails, when created with 'undef'")
     or diag($dev->error_or_status());
 
+####
+## Test a RAIT device of four vfs devices, two of them holding parity
+
+my @vtapes = map { mkvtape($_) } (1 .. 4);
+$dev_name = "rait:file:{" . join(",", @vtapes) . "}";
+
+$dev = Amanda::Device->new($dev_name);
+is($dev->status(), $DEVICE_STATUS_SUCCESS,
+   "$dev_name: create successful")
+    or diag($dev->error_or_status());
+
+is($dev->property_set("RAIT_PARITY", 2), undef,
+    "rait device accepts property RAIT_PARITY");
+
+is($dev->property_get("block_size"), 32768*2,
+    "rait device with two parity children calculates its block size");
+
+ok($dev->start($ACCESS_WRITE, "TESTCONF13", undef),
+   "start in write mode")
+    or diag($dev->error_or_status());
+
+for (my $i = 1; $i <= 2; $i++) {
+    write_file(0x2FACE + $i, $dev->block_size()*10+17, $i);
+}
+
+ok($dev->finish(),
+   "finish device after write")
+    or diag($dev->error_or_status());
+
+# lose any two children, and the data is still there
+for my $missing ([0, 1], [1, 3], [2, 3]) {
+    my @names = map { "file:$_" } @vtapes;
+    $names[$_] = "MISSING" for @$missing;
+    $dev_name = "rait:{" . join(",", @names) . "}";
+
+    $dev = Amanda::Device->new($dev_name);
+    is($dev->property_set("RAIT_PARITY", 2), undef,
+	"set RAIT_PARITY with children @$missing MISSING");
+
+    ok($dev->start($ACCESS_READ, undef, undef),
+       "start in read mode with children @$missing MISSING")
+	or diag($dev->error_or_status());
+
+    verify_file(0x2FACE + 2, $dev->block_size()*10+17, 2);
+    verify_file(0x2FACE + 1, $dev->block_size()*10+17, 1);
+
+    ok($dev->finish(),
+       "finish device read with children @$missing MISSING")
+	or diag($dev->error_or_status());
+}
+
+# but not three
+$dev = Amanda::Device->new("rait:{MISSING,MISSING,file:$vtapes[2],MISSING}");
+is($dev->property_set("RAIT_PARITY", 2), undef,
+    "set RAIT_PARITY with three children MISSING");
+
+ok(!($dev->start($ACCESS_READ, undef, undef)),
+   "start in read mode fails with three children MISSING");
+
+undef $dev;
+
 # Make two devices with different labels, should get a
 # message accordingly.
 ($vtape1, $vtape2) = (mkvtape(1), mkvtape(2));
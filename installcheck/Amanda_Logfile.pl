@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 39;
+use Test::More tests => 45;
 use File::Path;
 use strict;
 use warnings;
@@ -323,6 +323,45 @@ is_deeply(\@results_arr,
 	  [ '20071109010002', 'thatbox', '/u_win',          3, 'TESTCONF004', 2,  'OK',       'OK',   '',         4, 4 ],
 	], "results are correct");
 
+# search_logfile keeps what it parsed in the find catalogue, and answers from it
+{
+    my $catalog = "$logdir/find.catalog";
+    my $catalog_data = sub {
+	open(my $fh, "<", $catalog) or return '';
+	my $data = do { local $/; <$fh> };
+	close($fh);
+	return $data;
+    };
+
+    ok(-f $catalog, "search_logfile wrote the find catalogue");
+    like($catalog_data->(), qr/log\.20071109010002\.0/,
+	"..with a section for the logfile it parsed");
+
+    my @again = Amanda::Logfile::search_logfile(undef, "20071109010002",
+					   "$logdir/log.20071109010002.0", 1, 1);
+    @again = sort { $a->{'label'} cmp $b->{'label'} ||
+		    $a->{'filenum'} <=> $b->{'filenum'} } @again;
+    is_deeply([ map { res2arr($_) } @again ], \@results_arr,
+	"the catalogue gives the same results");
+
+    # the logfile amdump is writing, behind the log symlink
+    open $logf, ">", "$logdir/log.20300506070809.0" or die("Could not write logfile");
+    print $logf "START taper datestamp 20300506070809 label TESTCONF006 tape 1\n";
+    close $logf;
+    symlink("log.20300506070809.0", "$logdir/log") or die("Could not symlink: $!");
+
+    Amanda::Logfile::search_logfile(undef, "20300506070809",
+				    "$logdir/log.20300506070809.0", 1, 1);
+    unlike($catalog_data->(), qr/log\.20300506070809\.0/,
+	"the logfile being written is not catalogued");
+
+    Amanda::Logfile::log_rename("20300506070809");
+    ok(! -l "$logdir/log", "log_rename removes the log symlink");
+    like($catalog_data->(), qr/log\.20300506070809\.0/,
+	"..and catalogues the logfile it pointed to");
+    unlink("$logdir/log.20300506070809.0");
+}
+
 my @filtered;
 my @filtered_arr;
 
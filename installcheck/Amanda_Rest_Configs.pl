@@ -379,6 +379,9 @@ is_deeply (Installcheck::Config::remove_source_line($reply),
 			'DISKFILE' => 'disklist',
 			'TAPERFLUSH' => 0,
 			'SORT-INDEX' => 'NO',
+			'HOLDING-DIRECT-IO' => 'NO',
+			'HOLDING-READ-AHEAD' => 1048576,
+			'ESTIMATE-PARALLEL' => 0,
 			'REST-SSL-KEY' => undef,
 			'REST-SSL-CERT' => undef,
 			'CTIMEOUT' => 30,
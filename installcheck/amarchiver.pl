@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 18;
+use Test::More tests => 23;
 use strict;
 use warnings;
 
@@ -117,6 +117,30 @@ ok(run('amarchiver', '--extract', '--file', $archfile, "test.tmp-2"),
 ok((! -f "test.tmp-1" && -f "test.tmp-2"), "..and the file reappears")
     or diag(`find .`);
 
+# test archives with an index
+
+open($fh, ">", "test.tmp-1");
+print $fh $data;
+close($fh);
+
+unlink($archfile);
+ok(run('amarchiver', '--create', '--index', '--file', $archfile,
+	"test.tmp-1", "test.tmp-2"),
+    "archive creation with --index succeeds");
+
+ok(run('amarchiver', '--list', '--file', $archfile),
+    "listing an archive with an index succeeds");
+is($Installcheck::Run::stdout, "test.tmp-1\ntest.tmp-2\nsize: 4204\n",
+    "..and output is correct");
+
+unlink("test.tmp-1");
+unlink("test.tmp-2");
+ok(run('amarchiver', '--extract', '--file', $archfile, "test.tmp-2"),
+    "extraction of one file from an archive with an index succeeds");
+ok((! -f "test.tmp-1" && -s "test.tmp-2" == length($data)),
+    "..and the file reappears, whole")
+    or diag(`find .`);
+
 END {
     chdir("$tmpdir/..");
     rmtree($tmpdir);
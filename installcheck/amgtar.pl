@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 47;
+use Test::More tests => 56;
 
 use lib '@amperldir@';
 use strict;
@@ -165,6 +165,40 @@ ok(-f "$rest_dir/foo", "foo restored");
 ok(-d "$rest_dir/bar", "bar/ restored");
 ok(-d "$rest_dir/bar", "bar/baz/bat/ restored");
 
+# a multi-stream dump; each member to restore is in only one of the streams
+$app->add_property('streams', 3);
+$backup = $app->backup('device' => $back_dir, 'level' => 0, 'index' => 'line');
+is($backup->{'exit_status'}, 0, "multi-stream backup: error status ok");
+ok(!@{$backup->{'errors'}}, "multi-stream backup: no errors")
+    or diag(@{$backup->{'errors'}});
+
+rmtree($rest_dir);
+mkpath($rest_dir);
+chdir($rest_dir);
+$restore = $app->restore('objects' => ['./foo', './bar'], 'data' => $backup->{'data'});
+is($restore->{'exit_status'}, 0, "multi-stream partial restore: error status ok")
+    or diag($restore->{'errs'});
+ok(-f "$rest_dir/foo" && -d "$rest_dir/bar/baz/bat",
+   "multi-stream partial restore: foo and bar/baz/bat/ restored");
+ok(!-e "$rest_dir/hard", "multi-stream partial restore: hard not restored");
+
+$restore = $app->restore('objects' => ['./foo', './nosuch'], 'data' => $backup->{'data'});
+is($restore->{'exit_status'}, 256, "multi-stream partial restore: error status of 1 for a missing member");
+like($restore->{'errs'}, qr/\.\/nosuch: Not found in archive/,
+     "multi-stream partial restore: missing member reported");
+
+# the restore recognizes a multi-stream dump without the property
+$app->delete_property('streams');
+rmtree($rest_dir);
+mkpath($rest_dir);
+chdir($rest_dir);
+$restore = $app->restore('objects' => ['./foo', './bar'], 'data' => $backup->{'data'});
+is($restore->{'exit_status'}, 0, "multi-stream restore without STREAMS: error status ok")
+    or diag($restore->{'errs'});
+ok(-f "$rest_dir/foo" && -d "$rest_dir/bar/baz/bat",
+   "multi-stream restore without STREAMS: foo and bar/baz/bat/ restored");
+chdir($orig_cur_dir);
+
 $app->add_property('GNUTAR-PATH' => '/do/not/exists');
 $restore = $app->restore('objects' => ['./foo', './bar'], 'data' => $backup->{'data'}, data_sigpipe => 1);
 is($restore->{'exit_status'}, 256, "error status of 1 if GNUTAR-PATH does not exists");
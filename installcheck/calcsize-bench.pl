@@ -0,0 +1,94 @@
+#! @PERL@
+# Copyright (c) 2009-2012 Zmanda, Inc.  All Rights Reserved.
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+# This utility generates a directory tree and measures how long calcsize
+# takes to walk it with several numbers of threads, checking that every run
+# gives the same sizes.  It's not used in normal Amanda operations, nor even
+# during installchecks.
+#
+#   calcsize-bench [--files <count>] [--dir <directory>] [--keep]
+#
+# The tree is built in --dir, which should be on the filesystem to measure
+# (e.g., an NFS mount); it is reused if it already holds a tree of the same
+# size.  Drop the page cache between runs to measure cold walks.
+
+use lib '@top_srcdir@/installcheck';
+use lib '@amperldir@';
+
+use strict;
+use warnings;
+use Getopt::Long;
+use File::Path qw( mkpath rmtree );
+use Time::HiRes qw( time );
+
+use Installcheck;
+use Amanda::Paths;
+
+my $files = 2000000;
+my $dir = "$Installcheck::TMP/calcsize-bench";
+my $keep = 0;
+GetOptions(
+    'files=i' => \$files,
+    'dir=s' => \$dir,
+    'keep' => \$keep,
+) or die "usage: $0 [--files <count>] [--dir <directory>] [--keep]";
+
+# 100 files per directory, 20 directories per directory
+my $stamp = "$dir/.calcsize-bench-$files";
+if (! -f $stamp) {
+    rmtree($dir);
+    my @dirs = ($dir);
+    my $made = 0;
+    while ($made < $files) {
+	my $d = shift @dirs;
+	mkpath($d);
+	for my $i (1 .. 100) {
+	    last if $made >= $files;
+	    open(my $fh, ">", "$d/file$i") or die "$d/file$i: $!";
+	    print $fh "x" x (($made * 7919) % 65536);
+	    close($fh);
+	    $made++;
+	}
+	push @dirs, map { "$d/dir$_" } (1 .. 20);
+    }
+    open(my $fh, ">", $stamp) or die "$stamp: $!";
+    close($fh);
+}
+
+my $calcsize = "$amlibexecdir/calcsize";
+my $reference;
+printf("%d files in %s\n", $files, $dir);
+printf("%-8s %10s\n", "threads", "seconds");
+for my $threads (1, 2, 4, 8, 16, 32) {
+    my $start = time();
+    my $sizes = `$calcsize NOCONFIG GNUTAR bench $dir -T $threads 0 0 1 1 2>&1`;
+    my $elapsed = time() - $start;
+    die "calcsize failed: $sizes" if $?;
+
+    $sizes = join("\n", grep { /SIZE/ } split(/\n/, $sizes));
+    $reference = $sizes if !defined $reference;
+    die "sizes differ with $threads threads:\n$sizes\nfrom:\n$reference"
+	if $sizes ne $reference;
+
+    printf("%-8d %10.2f\n", $threads, $elapsed);
+}
+
+rmtree($dir) unless $keep;
@@ -18,7 +18,7 @@
 # Contact information: Carbonite Inc., 756 N Pastoria Ave
 # Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
 
-use Test::More tests => 71;
+use Test::More tests => 95;
 
 use warnings;
 use strict;
@@ -65,6 +65,7 @@ sub run_chunker {
 
     my $testconf = Installcheck::Run::setup();
     $testconf->add_param('debug_chunker', 9);
+    $testconf->add_param('holding_direct_io', 'yes') if $params{'direct_io'};
     $testconf->write( do_catalog => 0 );
     config_init($CONFIG_INIT_EXPLICIT_NAME, "TESTCONF");
     my $catalog = Amanda::DB::Catalog2->new(undef, create => 1, drop_tables => 1, load => 1);
@@ -261,6 +262,69 @@ sub check_holding_chunks {
     return is($nchunks, $exp_nchunks, $msg);
 }
 
+# check that the data in the holding chunks is what write_dumpfile_data_to
+# wrote
+sub check_holding_data {
+    my ($filename, $size) = @_;
+
+    my $msg = "holding chunk data";
+    my $data = '';
+    while ($filename) {
+	my $filename_tmp = "$filename.tmp";
+	my $fh;
+	open($fh, "<", $filename_tmp) or die("opening $filename_tmp: $!");
+	my $hdr_str = Amanda::Util::full_read(fileno($fh), Amanda::Holding::DISK_BLOCK_BYTES);
+	$data .= do { local $/; <$fh> };
+	close($fh);
+
+	$filename = Amanda::Header->from_string($hdr_str)->{'cont_filename'};
+    }
+
+    my $expected = '';
+    my $k = 0;
+    while (length($expected) < $size) {
+	$expected .= dumpfile_block($k++);
+    }
+    $expected = substr($expected, 0, $size);
+
+    if (length($data) != $size) {
+	fail($msg);
+	diag("expected $size bytes, got " . length($data));
+	return 0;
+    }
+    return ok($data eq $expected, $msg);
+}
+
+# check the writes the chunker's holding-direct-io engine made, from its
+# debug log; each is [ $length, $direct ].  If the filesystem refuses
+# O_DIRECT, only the lengths are checked.
+sub check_direct_writes {
+    my ($expected) = @_;
+
+    my $msg = "holding-direct-io writes";
+    my ($dbfile) = sort { -M $a <=> -M $b }
+		   glob("$AMANDA_DBGDIR/server/TESTCONF/chunker.*.debug");
+    if (!$dbfile) {
+	fail($msg);
+	diag("no chunker debug file");
+	return 0;
+    }
+
+    my $fh;
+    open($fh, "<", $dbfile) or die("opening $dbfile: $!");
+    my @lines = <$fh>;
+    close($fh);
+
+    my $refused = grep(/using buffered writes/, @lines);
+    diag("O_DIRECT is refused here; expecting buffered writes") if $refused and $debug;
+    my @got = map { /XDH: writing (\d+) bytes to holding( with O_DIRECT)?$/ ?
+		    ("$1" . (($2 and !$refused) ? " direct" : "")) : () } @lines;
+    my @exp = map { $_->[0] . (($_->[1] and !$refused) ? " direct" : "") }
+		  @$expected;
+
+    return is_deeply(\@got, \@exp, $msg);
+}
+
 sub cleanup_log {
     my $logfile = "$CONFIG_DIR/TESTCONF/log/log";
     -f $logfile and unlink($logfile);
@@ -286,15 +350,22 @@ sub write_dumpfile_header_to {
     $fh->write($hdr);
 }
 
+# the K'th kilobyte of a dumpfile
+sub dumpfile_block {
+    my ($k) = @_;
+
+    my $bufbase = substr((('='x127)."\n".('-'x127)."\n") x 4, 8, -3) . "1K\n";
+    die length($bufbase) unless length($bufbase) == 1024-8;
+    return sprintf("%08x", $k).$bufbase;
+}
+
 sub write_dumpfile_data_to {
     my ($fh, $size, $hostname, $disk, $expect_failure) = @_;
 
     my $bytes_to_write = $size;
-    my $bufbase = substr((('='x127)."\n".('-'x127)."\n") x 4, 8, -3) . "1K\n";
-    die length($bufbase) unless length($bufbase) == 1024-8;
     my $k = 0;
     while ($bytes_to_write > 0) {
-	my $buf = sprintf("%08x", $k++).$bufbase;
+	my $buf = dumpfile_block($k++);
 	my $written = $fh->syswrite($buf, $bytes_to_write);
 	if (!defined($written)) {
 	    die "writing: $!" unless $expect_failure;
@@ -344,7 +415,7 @@ $handle = "11-11111";
 $datestamp = "20070102030405";
 run_chunker("simple");
 # note that features (ffff here) and options (ops) are ignored by the chunker
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /boot 0 $datestamp 512 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /boot 0 $datestamp 512 INSTALLCHECK 10240 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 700*1024, "ghost", "/boot", 0);
@@ -369,7 +440,7 @@ check_holding_chunks($test_hfile, [ 480, 220 ], "ghost", "/boot", $datestamp, 0)
 $handle = "22-11111";
 $datestamp = "20080808080808";
 run_chunker("partial");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /root 0 $datestamp 512 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /root 0 $datestamp 512 INSTALLCHECK 10240 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 768*1024, "ghost", "/root", 0);
@@ -395,7 +466,7 @@ check_holding_chunks($test_hfile, [ 480, 288 ], "ghost", "/root", $datestamp, 0)
 $handle = "33-11111";
 $datestamp = "20070202020202";
 run_chunker("failed");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /usr 0 $datestamp 512 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /usr 0 $datestamp 512 INSTALLCHECK 10240 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 0, "ghost", "/usr", 0);
@@ -423,7 +494,7 @@ cleanup_chunker();
 $handle = "44-11111";
 $datestamp = "20040404040404";
 run_chunker("more-than-use");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 10240 INSTALLCHECK 512 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 10240 INSTALLCHECK 512 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 700*1024, "ghost", "/var", 1);
@@ -452,7 +523,7 @@ check_holding_chunks($test_hfile, [ 480, 220 ], "ghost", "/var", $datestamp, 0);
 $handle = "55-11111";
 $datestamp = "20050505050505";
 run_chunker("more-than-use-and-chunks");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 96 INSTALLCHECK 160 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var 0 $datestamp 96 INSTALLCHECK 160 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 400*1024, "ghost", "/var", 1);
@@ -484,7 +555,7 @@ cleanup_chunker();
 $handle = "55-22222";
 $datestamp = "20050505050505";
 run_chunker("use, continue on same file");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var/lib 0 $datestamp 10240 INSTALLCHECK 64 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /var/lib 0 $datestamp 10240 INSTALLCHECK 64 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 70*1024, "ghost", "/var/lib", 1);
@@ -516,7 +587,7 @@ cleanup_chunker();
 $handle = "66-11111";
 $datestamp = "20060606060606";
 run_chunker("out-of-use-during-header");
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /u01 0 $datestamp 96 INSTALLCHECK 120 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /u01 0 $datestamp 96 INSTALLCHECK 120 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 400*1024, "ghost", "/u01", 1);
@@ -539,6 +610,91 @@ check_logs([
 check_holding_chunks($test_hfile, [ 64, 96, 96, 96, 48 ],
     "ghost", "/u01", $datestamp, 0);
 
+##
+# holding-direct-io: whole blocks, aligned, are written with O_DIRECT
+
+$handle = "77-11111";
+$datestamp = "20070707070707";
+run_chunker("direct-io-aligned", direct_io => 1);
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /opt 0 $datestamp 10240 INSTALLCHECK 10240 0 0 ops");
+like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
+	"got PORT with data address");
+write_to_port($last_chunker_reply, 3072*1024, "ghost", "/opt", 0);
+wait_for_writer();
+like(chunker_reply, qr/^DUMPER-STATUS $handle$/,
+	"got DUMPER-STATUS") or die;
+chunker_cmd("DONE $handle 9ec394aa:3145728");
+like(chunker_reply, qr/^DONE $handle 3072 \"9ec394aa:3145728\" "\[sec [\d.]+ kb 3072 kps [\d.]+\]"$/,
+	"got DONE") or die;
+chunker_cmd("QUIT");
+wait_for_exit();
+
+check_logs([
+    qr(^SUCCESS chunker ghost /opt $datestamp 0 9ec394aa:3145728 \[sec [\d.]+ kb 3072 kps [\d.]+\]$),
+], "logs correct");
+
+check_holding_chunks($test_hfile, [ 3072 ], "ghost", "/opt", $datestamp, 0);
+check_holding_data($test_hfile, 3072*1024);
+check_direct_writes([ [ 1048576, 1 ], [ 1048576, 1 ], [ 1048576, 1 ] ]);
+
+##
+# holding-direct-io: an unaligned tail at EOF is a buffered write
+
+$handle = "77-22222";
+$datestamp = "20070707070707";
+run_chunker("direct-io-unaligned-tail", direct_io => 1);
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /opt 0 $datestamp 10240 INSTALLCHECK 10240 0 0 ops");
+like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
+	"got PORT with data address");
+write_to_port($last_chunker_reply, 3072*1024+512, "ghost", "/opt", 0);
+wait_for_writer();
+like(chunker_reply, qr/^DUMPER-STATUS $handle$/,
+	"got DUMPER-STATUS") or die;
+chunker_cmd("DONE $handle a4693e96:3146240");
+like(chunker_reply, qr/^DONE $handle [\d.]+ \"a4693e96:3146240\" "\[sec [\d.]+ kb [\d.]+ kps [\d.]+\]"$/,
+	"got DONE") or die;
+chunker_cmd("QUIT");
+wait_for_exit();
+
+check_logs([
+    qr(^SUCCESS chunker ghost /opt $datestamp 0 a4693e96:3146240 \[sec [\d.]+ kb [\d.]+ kps [\d.]+\]$),
+], "logs correct");
+
+check_holding_chunks($test_hfile, [ 3072.5 ], "ghost", "/opt", $datestamp, 0);
+check_holding_data($test_hfile, 3072*1024+512);
+check_direct_writes([ [ 1048576, 1 ], [ 1048576, 1 ], [ 1048576, 1 ],
+		      [ 512, 0 ] ]);
+
+##
+# holding-direct-io across chunks: each chunk ends on an aligned block, and
+# the last one with an unaligned tail
+
+$handle = "77-33333";
+$datestamp = "20070707070707";
+run_chunker("direct-io-chunks", direct_io => 1);
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" ghost ffff /opt 0 $datestamp 1056 INSTALLCHECK 10240 0 0 ops");
+like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
+	"got PORT with data address");
+write_to_port($last_chunker_reply, 2500*1024+512, "ghost", "/opt", 0);
+wait_for_writer();
+like(chunker_reply, qr/^DUMPER-STATUS $handle$/,
+	"got DUMPER-STATUS") or die;
+chunker_cmd("DONE $handle d9039243:2560512");
+like(chunker_reply, qr/^DONE $handle [\d.]+ \"d9039243:2560512\" "\[sec [\d.]+ kb [\d.]+ kps [\d.]+\]"$/,
+	"got DONE") or die;
+chunker_cmd("QUIT");
+wait_for_exit();
+
+check_logs([
+    qr(^SUCCESS chunker ghost /opt $datestamp 0 d9039243:2560512 \[sec [\d.]+ kb [\d.]+ kps [\d.]+\]$),
+], "logs correct");
+
+check_holding_chunks($test_hfile, [ 1024, 1024, 452.5 ], "ghost", "/opt", $datestamp, 0);
+check_holding_data($test_hfile, 2500*1024+512);
+check_direct_writes([ [ 1048576, 1 ], [ 1048576, 1 ], [ 463360, 0 ] ]);
+
+cleanup_chunker();
+
 ##
 # A two-disk PORT-WRITE, where the first disk runs out of space before it hits
 # the USE limit.
@@ -546,7 +702,7 @@ check_holding_chunks($test_hfile, [ 64, 96, 96, 96, 48 ],
 $handle = "88-11111";
 $datestamp = "20080808080808";
 run_chunker("ENOSPC-1", ENOSPC_at => 90*1024);
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 10240 INSTALLCHECK 10240 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 10240 INSTALLCHECK 10240 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 100*1024, "roast", "/boot", 0);
@@ -578,7 +734,7 @@ check_holding_chunks($test_hfile, [ 32, 68 ], "roast", "/boot", $datestamp, 0);
 $handle = "88-22222";
 $datestamp = "20080808080808";
 run_chunker("ENOSPC-2", ENOSPC_at => 130*1024);
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 128*1024, "roast", "/boot", 0);
@@ -611,7 +767,7 @@ ok(!-f "$test_hfile.1.tmp",
 $handle = "88-33333";
 $datestamp = "20080808080809";
 run_chunker("ENOSPC-2", ENOSPC_at => 130*1024);
-chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 ops");
+chunker_cmd("PORT-WRITE $handle \"$test_hfile\" roast ffff /boot 0 $datestamp 128 INSTALLCHECK 1000 0 0 ops");
 like(chunker_reply, qr/^PORT $handle (\d+) "?(\d+\.\d+\.\d+\.\d+:\d+;?)+"?$/,
 	"got PORT with data address");
 write_to_port($last_chunker_reply, 128*1024, "roast", "/boot", 0);
@@ -0,0 +1,385 @@
+#! @PERL@
+# Copyright (c) 2009-2012 Zmanda, Inc.  All Rights Reserved.
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+use strict;
+use warnings;
+use Getopt::Long;
+use IO::Socket::INET;
+use File::Path qw( mkpath rmtree );
+use Digest::MD5 qw( md5_hex );
+use Time::HiRes qw( usleep );
+use POSIX ":sys_wait_h";
+
+# A minimal S3 server, enough for the s3 device with STORAGE_API "S3",
+# S3_SSL "NO" and S3_SUBDOMAIN "NO".  Requests are not authenticated.  The
+# objects are stored in files under --dir, one directory per bucket.
+#
+#   mock/s3 --dir <dir> [--port <port>] [--latency <ms>] [--bandwidth <kB/s>]
+#
+# The server prints "PORT <port>" once it listens (useful with the default
+# port 0), and serves each connection, with keep-alive, in its own process.
+# --latency delays each response, and --bandwidth limits the speed at which
+# each connection sends data, to look like a remote object store.
+
+my $dir;
+my $port = 0;
+my $latency = 0;
+my $bandwidth = 0;
+GetOptions(
+    'dir=s' => \$dir,
+    'port=i' => \$port,
+    'latency=i' => \$latency,
+    'bandwidth=i' => \$bandwidth,
+) or die "usage: $0 --dir <dir> [--port <port>] [--latency <ms>] [--bandwidth <kB/s>]";
+die "--dir is required" unless defined $dir;
+mkpath($dir);
+
+my $listen = IO::Socket::INET->new(
+    LocalAddr => '127.0.0.1',
+    LocalPort => $port,
+    Proto => 'tcp',
+    Listen => 128,
+    ReuseAddr => 1,
+) or die "can't listen: $!";
+$| = 1;
+print "PORT ", $listen->sockport(), "\n";
+
+$SIG{'CHLD'} = sub { while (waitpid(-1, WNOHANG) > 0) { } };
+
+while (1) {
+    my $conn = $listen->accept();
+    next unless $conn;
+    my $pid = fork();
+    if (!defined $pid) {
+	die "can't fork: $!";
+    } elsif ($pid == 0) {
+	$listen->close();
+	binmode($conn);
+	while (handle_request($conn)) { }
+	exit(0);
+    }
+    $conn->close();
+}
+
+sub key_file {
+    my ($bucket, $key) = @_;
+    return "$dir/$bucket/" . unpack("H*", $key);
+}
+
+sub file_key {
+    my ($file) = @_;
+    return pack("H*", $file);
+}
+
+sub unescape {
+    my ($str) = @_;
+    $str =~ s/\+/ /g;
+    $str =~ s/%([0-9a-fA-F]{2})/chr(hex($1))/ge;
+    return $str;
+}
+
+sub xml_escape {
+    my ($str) = @_;
+    $str =~ s/&/&amp;/g;
+    $str =~ s/</&lt;/g;
+    $str =~ s/>/&gt;/g;
+    return $str;
+}
+
+sub read_body {
+    my ($conn, $headers) = @_;
+    my $body = '';
+
+    if (($headers->{'expect'} || '') =~ /100-continue/i) {
+	print $conn "HTTP/1.1 100 Continue\r\n\r\n";
+    }
+    if (($headers->{'transfer-encoding'} || '') =~ /chunked/i) {
+	while (1) {
+	    my $line = <$conn>;
+	    return undef unless defined $line;
+	    my $size = hex($line);
+	    last if $size == 0;
+	    my $chunk = '';
+	    while (length($chunk) < $size) {
+		my $n = read($conn, $chunk, $size - length($chunk), length($chunk));
+		return undef unless $n;
+	    }
+	    $body .= $chunk;
+	    <$conn>;
+	}
+	while (my $line = <$conn>) {
+	    last if $line =~ /^\r?\n$/;
+	}
+    } elsif (my $len = $headers->{'content-length'}) {
+	while (length($body) < $len) {
+	    my $n = read($conn, $body, $len - length($body), length($body));
+	    return undef unless $n;
+	}
+    }
+    return $body;
+}
+
+sub respond {
+    my ($conn, $method, $code, $headers, $body) = @_;
+    my %msg = (200 => 'OK', 204 => 'No Content', 206 => 'Partial Content',
+	       404 => 'Not Found', 409 => 'Conflict', 416 => 'Requested Range Not Satisfiable',
+	       400 => 'Bad Request', 501 => 'Not Implemented');
+    $body = '' unless defined $body;
+
+    usleep($latency * 1000) if $latency;
+    my $resp = "HTTP/1.1 $code $msg{$code}\r\n";
+    $headers->{'Content-Length'} = length($body)
+	unless exists $headers->{'Content-Length'};
+    $resp .= "$_: $headers->{$_}\r\n" for keys %$headers;
+    $resp .= "\r\n";
+    print $conn $resp;
+    return if $method eq 'HEAD';
+
+    if ($bandwidth) {
+	my $slice = $bandwidth * 1024 / 10;
+	for (my $pos = 0; $pos < length($body); $pos += $slice) {
+	    print $conn substr($body, $pos, $slice);
+	    usleep(100000);
+	}
+    } else {
+	print $conn $body;
+    }
+}
+
+sub error {
+    my ($conn, $method, $code, $s3code) = @_;
+    respond($conn, $method, $code, { 'Content-Type' => 'application/xml' },
+	"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" .
+	"<Error><Code>$s3code</Code><Message>$s3code</Message></Error>");
+}
+
+sub slurp {
+    my ($file) = @_;
+    open(my $fh, "<", $file) or return undef;
+    binmode($fh);
+    local $/;
+    my $data = <$fh>;
+    close($fh);
+    return $data;
+}
+
+sub spew {
+    my ($file, $data) = @_;
+    open(my $fh, ">", "$file.tmp$$") or die "can't write $file: $!";
+    binmode($fh);
+    print $fh $data;
+    close($fh);
+    rename("$file.tmp$$", $file);
+}
+
+sub list_bucket {
+    my ($conn, $method, $bucket, $query) = @_;
+    my $prefix = $query->{'prefix'} || '';
+    my $delimiter = $query->{'delimiter'};
+    my $marker = $query->{'marker'} || '';
+    my $max_keys = $query->{'max-keys'} || 1000;
+    my (@contents, %prefixes);
+    my $truncated = 'false';
+    my $next_marker;
+
+    opendir(my $dh, "$dir/$bucket") or return error($conn, $method, 404, 'NoSuchBucket');
+    my @keys = sort map { file_key($_) } grep { /^[0-9a-f]+$/ } readdir($dh);
+    closedir($dh);
+
+    for my $key (@keys) {
+	next if substr($key, 0, length($prefix)) ne $prefix;
+	next if $key le $marker;
+	if (@contents + keys(%prefixes) >= $max_keys) {
+	    $truncated = 'true';
+	    last;
+	}
+	if (defined $delimiter and $delimiter ne '') {
+	    my $i = index($key, $delimiter, length($prefix));
+	    if ($i >= 0) {
+		$prefixes{substr($key, 0, $i + length($delimiter))} = 1;
+		$next_marker = $key;
+		next;
+	    }
+	}
+	push @contents, $key;
+	$next_marker = $key;
+    }
+
+    my $xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<ListBucketResult>" .
+	      "<Name>$bucket</Name><Prefix>" . xml_escape($prefix) . "</Prefix>" .
+	      "<IsTruncated>$truncated</IsTruncated>";
+    $xml .= "<NextMarker>" . xml_escape($next_marker) . "</NextMarker>"
+	if $truncated eq 'true';
+    for my $key (@contents) {
+	my $size = -s key_file($bucket, $key);
+	$xml .= "<Contents><Key>" . xml_escape($key) . "</Key><Size>$size</Size>" .
+		"<StorageClass>STANDARD</StorageClass></Contents>";
+    }
+    for my $p (sort keys %prefixes) {
+	$xml .= "<CommonPrefixes><Prefix>" . xml_escape($p) . "</Prefix></CommonPrefixes>";
+    }
+    $xml .= "</ListBucketResult>";
+    respond($conn, $method, 200, { 'Content-Type' => 'application/xml' }, $xml);
+}
+
+sub list_uploads {
+    my ($conn, $method, $bucket) = @_;
+    my $xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<ListMultipartUploadsResult>" .
+	      "<Bucket>$bucket</Bucket><IsTruncated>false</IsTruncated>";
+
+    if (opendir(my $dh, "$dir/.uploads/$bucket")) {
+	for my $id (sort grep { /^\d+$/ } readdir($dh)) {
+	    my $key = slurp("$dir/.uploads/$bucket/$id/key");
+	    $xml .= "<Upload><Key>" . xml_escape($key) . "</Key>" .
+		    "<UploadId>$id</UploadId></Upload>";
+	}
+	closedir($dh);
+    }
+    $xml .= "</ListMultipartUploadsResult>";
+    respond($conn, $method, 200, { 'Content-Type' => 'application/xml' }, $xml);
+}
+
+sub handle_request {
+    my ($conn) = @_;
+    my $line = <$conn>;
+    return 0 unless defined $line;
+    $line =~ s/\r?\n$//;
+    my ($method, $uri) = split / /, $line;
+    return 0 unless defined $uri;
+
+    my %headers;
+    while (my $h = <$conn>) {
+	$h =~ s/\r?\n$//;
+	last if $h eq '';
+	my ($name, $value) = split /:\s*/, $h, 2;
+	$headers{lc $name} = $value;
+    }
+    my $body = read_body($conn, \%headers);
+    return 0 unless defined $body;
+
+    $uri =~ s{^https?://[^/]*}{};
+    my ($path, $qs) = split /\?/, $uri, 2;
+    my %query;
+    for my $q (split /&/, ($qs || '')) {
+	my ($k, $v) = split /=/, $q, 2;
+	$query{unescape($k)} = defined $v ? unescape($v) : '';
+    }
+    $path =~ s{^/+}{};
+    my ($bucket, $key) = split m{/}, $path, 2;
+    $bucket = unescape($bucket || '');
+    $key = unescape($key) if defined $key;
+    $key = undef if defined $key and $key eq '';
+
+    if ($bucket eq '') {
+	respond($conn, $method, 200, { 'Content-Type' => 'application/xml' },
+	    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<ListAllMyBucketsResult><Buckets/></ListAllMyBucketsResult>");
+    } elsif (!defined $key) {
+	if ($method eq 'PUT') {
+	    mkpath("$dir/$bucket");
+	    respond($conn, $method, 200, {});
+	} elsif ($method eq 'DELETE') {
+	    rmdir("$dir/$bucket");
+	    respond($conn, $method, 204, {});
+	} elsif ($method eq 'POST' and exists $query{'delete'}) {
+	    my $xml = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<DeleteResult>";
+	    while ($body =~ m{<Key>([^<]*)</Key>}g) {
+		my $k = $1;
+		$k =~ s/&lt;/</g; $k =~ s/&gt;/>/g; $k =~ s/&amp;/&/g;
+		unlink(key_file($bucket, $k));
+		$xml .= "<Deleted><Key>" . xml_escape($k) . "</Key></Deleted>";
+	    }
+	    $xml .= "</DeleteResult>";
+	    respond($conn, $method, 200, { 'Content-Type' => 'application/xml' }, $xml);
+	} elsif (!-d "$dir/$bucket") {
+	    error($conn, $method, 404, 'NoSuchBucket');
+	} elsif (exists $query{'uploads'}) {
+	    list_uploads($conn, $method, $bucket);
+	} elsif (exists $query{'location'}) {
+	    respond($conn, $method, 200, { 'Content-Type' => 'application/xml' },
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<LocationConstraint/>");
+	} else {
+	    list_bucket($conn, $method, $bucket, \%query);
+	}
+    } elsif (!-d "$dir/$bucket") {
+	error($conn, $method, 404, 'NoSuchBucket');
+    } elsif ($method eq 'POST' and exists $query{'uploads'}) {
+	my $id = sprintf("%d%06d", time(), int(rand(1000000)));
+	mkpath("$dir/.uploads/$bucket/$id");
+	spew("$dir/.uploads/$bucket/$id/key", $key);
+	respond($conn, $method, 200, { 'Content-Type' => 'application/xml' },
+	    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<InitiateMultipartUploadResult>" .
+	    "<Bucket>$bucket</Bucket><Key>" . xml_escape($key) . "</Key>" .
+	    "<UploadId>$id</UploadId></InitiateMultipartUploadResult>");
+    } elsif (defined $query{'uploadId'}) {
+	my $updir = "$dir/.uploads/$bucket/$query{'uploadId'}";
+	if (!-d $updir) {
+	    error($conn, $method, 404, 'NoSuchUpload');
+	} elsif ($method eq 'PUT') {
+	    spew("$updir/$query{'partNumber'}", $body);
+	    respond($conn, $method, 200, { 'ETag' => '"' . md5_hex($body) . '"' });
+	} elsif ($method eq 'POST') {
+	    my $data = '';
+	    opendir(my $dh, $updir);
+	    for my $part (sort { $a <=> $b } grep { /^\d+$/ } readdir($dh)) {
+		$data .= slurp("$updir/$part");
+	    }
+	    closedir($dh);
+	    spew(key_file($bucket, $key), $data);
+	    rmtree($updir);
+	    respond($conn, $method, 200, { 'Content-Type' => 'application/xml' },
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<CompleteMultipartUploadResult>" .
+		"<Key>" . xml_escape($key) . "</Key><ETag>\"" . md5_hex($data) . "\"</ETag>" .
+		"</CompleteMultipartUploadResult>");
+	} else {
+	    rmtree($updir);
+	    respond($conn, $method, 204, {});
+	}
+    } elsif ($method eq 'PUT') {
+	spew(key_file($bucket, $key), $body);
+	respond($conn, $method, 200, { 'ETag' => '"' . md5_hex($body) . '"' });
+    } elsif ($method eq 'GET' or $method eq 'HEAD') {
+	my $data = slurp(key_file($bucket, $key));
+	my $size = defined $data ? length($data) : 0;
+	if (!defined $data) {
+	    error($conn, $method, 404, 'NoSuchKey');
+	} elsif (($headers{'range'} || '') =~ /^bytes=(\d+)-(\d*)$/) {
+	    my ($first, $last) = ($1, $2);
+	    $last = $size - 1 if $last eq '' or $last >= $size;
+	    if ($first >= $size) {
+		error($conn, $method, 416, 'InvalidRange');
+	    } else {
+		respond($conn, $method, 206,
+		    { 'Content-Range' => "bytes $first-$last/$size" },
+		    substr($data, $first, $last - $first + 1));
+	    }
+	} else {
+	    respond($conn, $method, 200, {}, $data);
+	}
+    } elsif ($method eq 'DELETE') {
+	unlink(key_file($bucket, $key));
+	respond($conn, $method, 204, {});
+    } else {
+	error($conn, $method, 501, 'NotImplemented');
+    }
+
+    return 0 if ($headers{'connection'} || '') =~ /close/i;
+    return 1;
+}
@@ -0,0 +1,177 @@
+#! @PERL@
+# Copyright (c) 2009-2012 Zmanda, Inc.  All Rights Reserved.
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+# This utility runs the planner on synthetic disklists of several sizes and
+# reports how long each of its phases takes.  It's not used in normal Amanda
+# operations, nor even during installchecks.
+#
+#   planner-bench [--dles <count>,...] [--seed <seed>] [--reference <planner>]
+#
+# Every DLE is on localhost and uses server estimates, computed from a
+# generated curinfo history.  The tape is made too small for all the full
+# dumps that are due, so that the planner delays some and promotes others.
+# With --reference, another planner binary is run on the same configuration
+# and its schedule must be identical.
+
+use lib '@top_srcdir@/installcheck';
+use lib '@amperldir@';
+
+use strict;
+use warnings;
+use Getopt::Long;
+use File::Path qw( mkpath );
+use Time::HiRes qw( time );
+
+use Installcheck;
+use Installcheck::Run qw( $diskname );
+use Amanda::Paths;
+
+my $dles = "1000,10000,100000";
+my $seed = 1;
+my $reference;
+GetOptions(
+    'dles=s' => \$dles,
+    'seed=i' => \$seed,
+    'reference=s' => \$reference,
+) or die "usage: $0 [--dles <count>,...] [--seed <seed>] [--reference <planner>]";
+
+my $dumpcycle = 10;
+my $starttime = "20160101000000";
+
+# make up a history for each DLE; sizes are in KB
+sub make_histories {
+    my ($count) = @_;
+    my $now = time();
+    my @histories;
+
+    srand($seed);
+    for my $i (1 .. $count) {
+	my $full_days = int(rand($dumpcycle + 3));
+	my $full = 1024 * (1 + int(rand(1000)));
+	push @histories, {
+	    'full_days' => $full_days,
+	    'full' => $full,
+	    'incr' => int($full / (5 + int(rand(50)))),
+	    'full_date' => int($now - $full_days * 86400),
+	    'incr_date' => int($now - 86400),
+	};
+    }
+
+    return @histories;
+}
+
+sub write_curinfo {
+    my ($infodir, @histories) = @_;
+
+    for my $i (1 .. @histories) {
+	my $h = $histories[$i-1];
+	my $dir = "$infodir/localhost/dle$i";
+	mkpath($dir);
+
+	open(my $fh, ">", "$dir/info") or die "$dir/info: $!";
+	print $fh <<EOF;
+version: 0
+command: 0
+full-rate: 10240.000000
+full-comp: 1.000000
+incr-rate: 10240.000000
+incr-comp: 1.000000
+stats: 0 $h->{full} $h->{full} 100 $h->{full_date}
+stats: 1 $h->{incr} $h->{incr} 10 $h->{incr_date}
+last_level: 1 $h->{full_days}
+history: 1 $h->{incr} $h->{incr} $h->{incr_date} 10
+history: 0 $h->{full} $h->{full} $h->{full_date} 100
+//
+EOF
+	close($fh);
+    }
+}
+
+sub run_planner {
+    my ($planner) = @_;
+
+    my $start = time();
+    my $schedule = `$planner TESTCONF --starttime $starttime 2>$Installcheck::TMP/planner-bench.err`;
+    my $elapsed = time() - $start;
+    die "$planner failed; see $Installcheck::TMP/planner-bench.err" if $?;
+
+    open(my $fh, "<", "$Installcheck::TMP/planner-bench.err") or die "$!";
+    my %phases = ( 'total' => $elapsed );
+    while (<$fh>) {
+	$phases{'setup'} = $1 if /setting up estimates took (\S+) secs/;
+	$phases{'estimates'} = $1 if /getting estimates took (\S+) secs/;
+	$phases{'analysis'} = $1 if /analysis took (\S+) secs/;
+    }
+    close($fh);
+
+    return ($schedule, \%phases);
+}
+
+printf("%-8s %10s %10s %10s %10s\n", "DLEs", "setup", "estimates", "analysis", "total");
+for my $count (split /,/, $dles) {
+    my $testconf = Installcheck::Run::setup();
+    $testconf->add_param('dumpcycle', $dumpcycle);
+    $testconf->add_param('runspercycle', $dumpcycle);
+    for my $i (1 .. $count) {
+	$testconf->add_dle(<<EODLE);
+localhost dle$i $diskname {
+    installcheck-test
+    estimate server
+}
+EODLE
+    }
+
+    # leave room for about a third of the full dumps that are due
+    my @histories = make_histories($count);
+    my $total = 0;
+    $total += $_->{'full'} for @histories;
+    my $length = int($total / $dumpcycle / 3) + 1;
+    $testconf->add_tapetype('TEST-TAPE', [
+	'length' => "$length kbytes",
+    ]);
+    $testconf->write();
+    write_curinfo("$CONFIG_DIR/TESTCONF/curinfo", @histories);
+
+    my ($schedule, $phases) = run_planner("$amlibexecdir/planner");
+    printf("%-8d %10.2f %10.2f %10.2f %10.2f\n", $count,
+	   $phases->{'setup'}, $phases->{'estimates'},
+	   $phases->{'analysis'}, $phases->{'total'});
+
+    if (defined $reference) {
+	my ($ref_schedule, $ref_phases) = run_planner($reference);
+	printf("%-8s %10.2f %10.2f %10.2f %10.2f\n", "  ref",
+	       $ref_phases->{'setup'}, $ref_phases->{'estimates'},
+	       $ref_phases->{'analysis'}, $ref_phases->{'total'});
+	my @lines = split /\n/, $schedule;
+	my @ref_lines = split /\n/, $ref_schedule;
+	if ($schedule ne $ref_schedule) {
+	    my $i = 0;
+	    $i++ while ($i < @lines && $i < @ref_lines
+			&& $lines[$i] eq $ref_lines[$i]);
+	    die "schedules differ with $count DLEs, at line " . ($i+1) . ":\n"
+	      . "  planner:   " . (defined $lines[$i] ? $lines[$i] : "(end)") . "\n"
+	      . "  reference: " . (defined $ref_lines[$i] ? $ref_lines[$i] : "(end)") . "\n";
+	}
+	printf("%-8s schedule identical, %d lines\n", "  ref", scalar @lines);
+    }
+}
+
+Installcheck::Run::cleanup();
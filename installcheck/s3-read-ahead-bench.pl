@@ -0,0 +1,157 @@
+#! @PERL@
+# Copyright (c) 2009-2012 Zmanda, Inc.  All Rights Reserved.
+# Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version 2
+# of the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+# for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+#
+# Contact information: Carbonite Inc., 756 N Pastoria Ave
+# Sunnyvale, CA 94086, USA, or: http://www.zmanda.com
+
+# This utility measures the restore throughput of the s3 device against the
+# mock S3 server, for several values of NB_THREADS_RECOVERY and S3_READ_AHEAD,
+# with each block read in one request or, with --range-size, in ranges.
+# It's not used in normal Amanda operations, nor even during installchecks.
+#
+#   s3-read-ahead-bench [--size <MB>] [--latency <ms>] [--bandwidth <kB/s>]
+#                       [--block-size <kB>] [--range-size <kB>] [--multi-part]
+
+use lib '@top_srcdir@/installcheck';
+use lib '@amperldir@';
+
+use strict;
+use warnings;
+use Getopt::Long;
+use File::Path qw( mkpath rmtree );
+use Time::HiRes qw( time );
+use Cwd qw( abs_path );
+
+use Installcheck;
+use Installcheck::Config;
+use Amanda::Debug;
+use Amanda::Device qw( :constants );
+use Amanda::Config qw( :init );
+use Amanda::Header qw( :constants );
+
+my $size = 64;
+my $latency = 20;
+my $bandwidth = 0;
+my $block_size = 1024;
+my $range_size = 0;
+my $multi_part = 0;
+GetOptions(
+    'size=i' => \$size,
+    'latency=i' => \$latency,
+    'bandwidth=i' => \$bandwidth,
+    'block-size=i' => \$block_size,
+    'range-size=i' => \$range_size,
+    'multi-part' => \$multi_part,
+) or die "usage: $0 [--size <MB>] [--latency <ms>] [--bandwidth <kB/s>] [--block-size <kB>] [--range-size <kB>] [--multi-part]";
+
+my $testconf = Installcheck::Config->new();
+$testconf->write();
+config_init($CONFIG_INIT_EXPLICIT_NAME, 'TESTCONF') == $CFGERR_OK
+    or die "config errors";
+Amanda::Debug::dbopen("installcheck");
+Installcheck::log_test_output();
+
+# start the mock server and wait for it to tell us its port
+my $s3dir = "$Installcheck::TMP/s3-read-ahead-bench";
+rmtree($s3dir);
+my $mock_pid = open(my $mock, "-|", abs_path("mock") . "/s3",
+		    "--dir", $s3dir, "--latency", $latency,
+		    "--bandwidth", $bandwidth)
+    or die "can't run mock/s3: $!";
+my $line = <$mock>;
+die "mock/s3 did not start" unless defined $line and $line =~ /^PORT (\d+)/;
+my $port = $1;
+
+sub make_device {
+    my (%props) = @_;
+
+    my $dev = Amanda::Device->new("s3:bench-bucket/bench-");
+    die $dev->error_or_status() if $dev->status() != $DEVICE_STATUS_SUCCESS;
+
+    my %all_props = (
+	'S3_HOST' => "127.0.0.1:$port",
+	'S3_SSL' => 'NO',
+	'S3_SUBDOMAIN' => 'NO',
+	'STORAGE_API' => 'S3',
+	'S3_ACCESS_KEY' => 'bench',
+	'S3_SECRET_KEY' => 'bench',
+	'BLOCK_SIZE' => $block_size * 1024,
+	'S3_MULTI_PART_UPLOAD' => $multi_part ? 'YES' : 'NO',
+	%props,
+    );
+    for my $prop (sort keys %all_props) {
+	my $err = $dev->property_set($prop, $all_props{$prop});
+	die "setting $prop: $err" if defined $err;
+    }
+    return $dev;
+}
+
+# write the test file
+my $length = $size * 1024 * 1024;
+my $dev = make_device();
+$dev->start($ACCESS_WRITE, "BENCH", undef)
+    or die $dev->error_or_status();
+
+my $hdr = Amanda::Header->new();
+$hdr->{type} = $Amanda::Header::F_DUMPFILE;
+$hdr->{datestamp} = "20070102030405";
+$hdr->{dumplevel} = 0;
+$hdr->{name} = "localhost";
+$hdr->{disk} = "/bench";
+$hdr->{program} = "INSTALLCHECK";
+
+$dev->start_file($hdr) or die $dev->error_or_status();
+Amanda::Device::write_random_to_device(0xBEEF, $length, $dev)
+    or die $dev->error_or_status();
+$dev->finish_file() or die $dev->error_or_status();
+$dev->finish() or die $dev->error_or_status();
+
+printf("%d MB, %d kB blocks, %d ms latency, %s, %s objects\n",
+       $size, $block_size, $latency,
+       $bandwidth ? "$bandwidth kB/s per connection" : "unlimited bandwidth",
+       $multi_part ? "multi-part" : "per-block");
+printf("blocks read in %s\n",
+       $range_size ? "$range_size kB ranges" : "one request");
+printf("%-10s %-10s %10s\n", "recovery", "read-ahead", "MB/s");
+
+# and read it back with each configuration
+for my $recovery (1, 2, 4, 8) {
+    for my $read_ahead (0, 4, 8, 16, 32) {
+	next if $read_ahead && $read_ahead < $recovery;
+
+	$dev = make_device('NB_THREADS_RECOVERY' => $recovery,
+			   'S3_READ_AHEAD' => $read_ahead,
+			   'S3_READ_RANGE_SIZE' => $range_size * 1024);
+	$dev->start($ACCESS_READ, undef, undef)
+	    or die $dev->error_or_status();
+
+	my $start = time();
+	$dev->seek_file(1) or die $dev->error_or_status();
+	Amanda::Device::verify_random_from_device(0xBEEF, $length, $dev)
+	    or die "verify failed: " . $dev->error_or_status();
+	my $elapsed = time() - $start;
+	$dev->finish();
+
+	printf("%-10d %-10d %10.2f\n", $recovery, $read_ahead,
+	       $size / $elapsed);
+    }
+}
+
+kill('TERM', $mock_pid);
+close($mock);
+rmtree($s3dir);
@@ -164,6 +164,8 @@ sub msg_PORT_WRITE {
     #floor to 32k and convert in bytes (* 1024)
     $params{'use_bytes'} = int($params{'use_bytes'}/32) * 32 * 1024;
     $params{'chunk_size'} = int($params{'chunk_size'}/32) * 32 * 1024;
+    # the dumptype's shm-ring-size is in kbytes; 0 is the default size
+    $params{'shm_ring_size'} = ($params{'shm_ring_size'} || 0) * 1024;
 
     my $dump_cb = sub { $self->dump_cb(@_); };
 
@@ -181,6 +183,8 @@ sub msg_PORT_WRITE {
         $self->{'chunk_size'} = $params{'chunk_size'};
         $self->{'progname'} = $params{'progname'};
         $self->{'use_bytes'} = $params{'use_bytes'};
+        $self->{'shm_ring_size'} = $params{'shm_ring_size'};
+        $self->{'shm_ring_huge_pages'} = $params{'shm_ring_huge_pages'} || 0;
         $self->{'options'} = $params{'options'};
         $self->{'header'} = undef; # no header yet
         $self->{'cancelled'} = undef;
@@ -193,7 +197,9 @@ sub msg_PORT_WRITE {
 	$self->_assert_in_state("idle") or return;
 	$self->{'state'} = 'making_xfer';
 	$self->{'xfer_dest'} = $self->{'scribe'}->get_xfer_dest(
-				max_memory => $self->{'max_memory'});
+				max_memory => $self->{'shm_ring_size'} ||
+					      $self->{'max_memory'},
+				huge_pages => $self->{'shm_ring_huge_pages'});
 
 	if ($self->{'doing_port_write'}) {
 	    $self->{'xfer_source'} = Amanda::Xfer::Source::DirectTCPListen->new();
@@ -46,12 +46,14 @@ use constant START => message("START",
 
 use constant PORT_WRITE => message("PORT-WRITE",
     format => [ qw( handle filename hostname features diskname level datestamp
-	    chunk_size progname use_bytes options ) ],
+	    chunk_size progname use_bytes shm_ring_size shm_ring_huge_pages
+	    options ) ],
 );
 
 use constant SHM_WRITE => message("SHM-WRITE",
     format => [ qw( handle filename hostname features diskname level datestamp
-	    chunk_size progname use_bytes options ) ],
+	    chunk_size progname use_bytes shm_ring_size shm_ring_huge_pages
+	    options ) ],
 );
 
 use constant FAILED => message("FAILED",
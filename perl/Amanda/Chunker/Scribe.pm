@@ -107,7 +107,11 @@ The parameter to C<get_xfer_dest> are:
 
 =item C<max_memory>
 
-maximun size to use on the holding disk.
+size of the ring between the dumper and the chunker, in bytes.
+
+=item C<huge_pages>
+
+if true, back that ring with huge pages (optional).
 
 =back
 
@@ -371,7 +375,7 @@ sub get_xfer_dest {
 
     my $xdh;
     $xdh = Amanda::Xfer::Dest::Holding->new(
-		$params{'max_memory'});
+		$params{'max_memory'}, $params{'huge_pages'} ? 1 : 0);
     $self->{'xdh_ready'} = 0; # xdh isn't ready until we get XMSG_READY
 
     $self->{'xdh'} = $xdh;
@@ -112,6 +112,7 @@ use File::Path qw( mkpath );
 use Amanda::Config qw( :getconf );
 use Amanda::Debug qw( :logging );
 use Amanda::Util qw( sanitise_filename );
+use Amanda::Infofile;
 
 use Amanda::Curinfo::Info;
 
@@ -174,7 +175,8 @@ The C<Amanda::Curinfo> constructor is pretty straightforward:
 
    my $ci = Amanda::Curinfo->new($infodir);
 
-Where C<$infodir> is a directory.  In order to retrieve a previously
+Where C<$infodir> is a directory, or an info database if its name ends in
+C<.db> (see L<Amanda::Infofile>).  In order to retrieve a previously
 stored info file if the host and disk are known, one can use
 
    my $info = $ci->get_info($host, $disk);
@@ -218,14 +220,39 @@ sub new
 
     my $self = { infodir => $infodir };
 
+    # an infofile ending in .db is an info database, not a directory
+    if ($infodir =~ /\.db$/) {
+	$self->{'infodb'} = Amanda::Infofile::infodb_open($infodir)
+	    || return Amanda::Curinfo::Message->new(
+				source_filename => __FILE__,
+				source_line     => __LINE__,
+				code     => 1300029,
+				severity => $Amanda::Message::ERROR,
+				infofile => $infodir,
+				error    => "can't open info database");
+    }
+
     bless $self, $class;
     return $self;
 }
 
+sub DESTROY
+{
+    my ($self) = @_;
+
+    Amanda::Infofile::infodb_close($self->{'infodb'}) if $self->{'infodb'};
+}
+
 sub get_info
 {
     my ($self, $host, $disk) = @_;
 
+    if ($self->{'infodb'}) {
+	my $text = Amanda::Infofile::infodb_get_text($self->{'infodb'},
+						     $host, $disk);
+	return Amanda::Curinfo::Info->new_from_text($text);
+    }
+
     my $infodir  = $self->{infodir};
     my $host_q   = sanitise_filename($host);
     my $disk_q   = sanitise_filename($disk);
@@ -250,6 +277,18 @@ sub put_info
 {
     my ($self, $host, $disk, $info) = @_;
 
+    if ($self->{'infodb'}) {
+	Amanda::Infofile::infodb_put_text($self->{'infodb'}, $host, $disk,
+					  $info->to_text()) == 0
+	    || return Amanda::Curinfo::Message->new(
+				source_filename => __FILE__,
+				source_line     => __LINE__,
+				code     => 1300008,
+				severity => $Amanda::Message::ERROR,
+				infofile => $self->{infodir});
+	return;
+    }
+
     my $infodir     = $self->{infodir};
     my $host_q      = sanitise_filename($host);
     my $disk_q      = sanitise_filename($disk);
@@ -306,6 +345,11 @@ sub del_info
 {
     my ($self, $host, $disk) = @_;
 
+    if ($self->{'infodb'}) {
+	return Amanda::Infofile::infodb_delete($self->{'infodb'},
+					       $host, $disk) == 0;
+    }
+
     my $infodir  = $self->{infodir};
     my $host_q   = sanitise_filename($host);
     my $disk_q   = sanitise_filename($disk);
@@ -155,7 +155,24 @@ sub new
     };
 
     bless $self, $class;
-    my $err = $self->read_infofile($infofile) if -e $infofile;
+    my $err = $self->read_infofile($infofile) if defined $infofile and -e $infofile;
+    return $err if $err;
+
+    return $self;
+}
+
+# build an Info from the text of an info file, as returned by
+# Amanda::Infofile::infodb_get_text
+sub new_from_text
+{
+    my ($class, $text) = @_;
+
+    my $self = $class->new(undef);
+    return $self if !defined $text or $text eq '';
+
+    open my $fh, "<", \$text;
+    my $err = $self->read_infofile_fh($fh);
+    close $fh;
     return $err if $err;
 
     return $self;
@@ -236,28 +253,28 @@ sub read_infofile
 	return;
     };
 
+    $err = $self->read_infofile_fh($fh);
+    close $fh;
+
+    return $err;
+}
+
+sub read_infofile_fh
+{
+    my ( $self, $fh ) = @_;
+    my $err;
+
     ## read in the fixed-length data
     $err = $self->read_infofile_perfs($fh);
-    if ($err) {
-	close $fh;
-	return $err
-    }
+    return $err if $err;
 
     ## read in the stats data
     $err = $self->read_infofile_stats($fh);
-    if ($err) {
-	close $fh;
-	return $err
-    }
+    return $err if $err;
 
     ## read in the history data
     $err = $self->read_infofile_history($fh);
-    if ($err) {
-	close $fh;
-	return $err
-    }
-
-    close $fh;
+    return $err if $err;
 
     return;
 }
@@ -439,6 +456,29 @@ sub write_to_file
 				infofile => $self->{'infofile'},
 				error    => $!);
 
+    $self->write_to_fh($fh);
+    close $fh;
+
+    return 1;
+}
+
+# the text of the info file, as taken by Amanda::Infofile::infodb_put_text
+sub to_text
+{
+    my ( $self ) = @_;
+    my $text = '';
+
+    open my $fh, ">", \$text;
+    $self->write_to_fh($fh);
+    close $fh;
+
+    return $text;
+}
+
+sub write_to_fh
+{
+    my ( $self, $fh ) = @_;
+
     ## print basics
 
     print $fh "version: 0\n";    # 0 for now, may change in future
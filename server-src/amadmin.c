@@ -70,6 +70,8 @@ static int next_level0(disk_t *dp, info_t *info);
 int bump_thresh(int level);
 void export_db(int argc, char **argv);
 void import_db(int argc, char **argv);
+void infodb_import(int argc, char **argv);
+void infodb_export(int argc, char **argv);
 void hosts(int argc, char **argv);
 void dles(int argc, char **argv);
 void disklist(int argc, char **argv);
@@ -146,6 +148,10 @@ static const struct {
 	T_(" [<hostname> [<disks>]* ]* # Export curinfo database to stdout.") },
     { "import", import_db,
 	T_("\t\t\t\t # Import curinfo database from stdin.") },
+    { "infodb-import", infodb_import,
+	T_(" <infodir> [<hostname> [<disks>]* ]* # Copy info files into the curinfo database.") },
+    { "infodb-export", infodb_export,
+	T_(" <infodir> [<hostname> [<disks>]* ]* # Copy the curinfo database to info files.") },
 };
 #define NCMDS G_N_ELEMENTS(cmdtab)
 
@@ -1957,6 +1963,106 @@ impget_line(void)
 
 /* ----------------------------------------------- */
 
+/*
+ * Copy info records between the configured infofile and a directory in the
+ * text layout, e.g., to convert an infofile to or from an info database.
+ */
+
+static char *infodb_dir;
+static int infodb_count;
+
+static void infodb_copy(int argc, char **argv, char *cmdname,
+			void (*func)(disk_t *dp));
+void infodb_import_one(disk_t *dp);
+void infodb_export_one(disk_t *dp);
+
+static void
+infodb_copy(
+    int		argc,
+    char **	argv,
+    char *	cmdname,
+    void	(*func)(disk_t *dp))
+{
+    GList  *dlist;
+
+    if(argc < 4) {
+	g_fprintf(stderr,_("%s: expecting \"%s <infodir> [<hostname> [<disks>]* ]*\"\n"),
+		get_pname(), cmdname);
+	usage();
+    }
+
+    infodb_dir = config_dir_relative(argv[3]);
+    infodb_count = 0;
+
+    if(argc >= 5) {
+	/* skip the infodir */
+	diskloop(argc-1, argv+1, cmdname, func);
+    } else {
+	for(dlist = diskq.head; dlist != NULL; dlist = dlist->next) {
+	    func(dlist->data);
+	}
+    }
+
+    g_printf(_("%d info records copied\n"), infodb_count);
+    amfree(infodb_dir);
+}
+
+void
+infodb_import(
+    int		argc,
+    char **	argv)
+{
+    infodb_copy(argc, argv, "infodb-import", infodb_import_one);
+}
+
+void
+infodb_import_one(
+    disk_t *	dp)
+{
+    info_t info;
+
+    if(get_txinfo(infodb_dir, dp->host->hostname, dp->name, &info)) {
+	g_fprintf(stderr, _("Warning: no info file for %s:%s in %s\n"),
+		dp->host->hostname, dp->name, infodb_dir);
+	return;
+    }
+    if(put_info(dp->host->hostname, dp->name, &info)) {
+	g_fprintf(stderr, _("%s: could not write curinfo record for %s:%s\n"),
+		get_pname(), dp->host->hostname, dp->name);
+	return;
+    }
+    infodb_count++;
+}
+
+void
+infodb_export(
+    int		argc,
+    char **	argv)
+{
+    infodb_copy(argc, argv, "infodb-export", infodb_export_one);
+}
+
+void
+infodb_export_one(
+    disk_t *	dp)
+{
+    info_t info;
+
+    if(get_info(dp->host->hostname, dp->name, &info)) {
+	g_fprintf(stderr, _("Warning: no curinfo record for %s:%s\n"),
+		dp->host->hostname, dp->name);
+	return;
+    }
+    if(put_txinfo(infodb_dir, dp->host->hostname, dp->name, &info)) {
+	g_fprintf(stderr, _("%s: could not write info file for %s:%s in %s\n"),
+		get_pname(), dp->host->hostname, dp->name, infodb_dir);
+	return;
+    }
+    infodb_count++;
+}
+
+/* ----------------------------------------------- */
+
 void
 disklist_one(
     disk_t *	dp)
@@ -1740,6 +1740,17 @@ start_server_check(
 		infobad = 1;
 	    }
 	    amfree(conf_infofile);
+	} else if (S_ISREG(statbuf.st_mode) &&
+		   g_str_has_suffix(conf_infofile, ".db")) {
+	    /* a single-file info database, there is no per-host directory */
+	    if (access(conf_infofile, R_OK|W_OK) == -1) {
+		delete_message(amcheck_fprint_message(outf, build_message(
+			AMANDA_FILE, __LINE__, 2800236, MSG_ERROR, 2,
+			"errno", errno,
+			"infodb", conf_infofile)));
+		infobad = 1;
+	    }
+	    amfree(conf_infofile);
 	} else if (!S_ISDIR(statbuf.st_mode)) {
 	    delete_message(amcheck_fprint_message(outf, build_message(
 			AMANDA_FILE, __LINE__, 2800095, MSG_ERROR, 1,
@@ -48,6 +48,8 @@
 #include "clock.h"
 #include "match.h"
 #include "amindex.h"
+#include "index_map.h"
+#include "index_sort.h"
 #include "disk_history.h"
 #include "list_dir.h"
 #include "logfile.h"
@@ -102,7 +104,12 @@ static REMOVE_ITEM *compress_files(REMOVE_ITEM *);
 static char *uncompress_file(char *, char *, char *, int,
 			     char *, GPtrArray **,
 			     gboolean need_uncompress, gboolean need_sort);
+static char *sort_index_file(char *, char *, char *, int,
+			     char *, GPtrArray **,
+			     gboolean need_uncompress, gboolean need_sort);
 static int process_ls_dump(char *, DUMP_ITEM *, int, GPtrArray **);
+static index_map_t *open_index_map(DUMP_ITEM *);
+static void build_index_map(DUMP_ITEM *, char *);
 
 static size_t reply_buffer_size = 1;
 static char *reply_buffer = NULL;
@@ -200,7 +207,25 @@ compress_files(
     REMOVE_ITEM *prev;
     pid_t        pid;
 
-    if (file_lock_locked(lock_index)) {
+    if (file_lock_locked(lock_index) && index_sort_can_compress()) {
+	/* compress them all at once, in-process */
+	index_sort_pool_t *pool = index_sort_pool_new(0);
+
+	while(compress) {
+	    char *compressed = g_strconcat(compress->filename,
+					   COMPRESS_SUFFIX, NULL);
+
+	    dbprintf(_("compressing index file: %s\n"), compress->filename);
+	    index_sort_pool_push(pool, compress->filename, FALSE,
+				 compressed, TRUE, FALSE, TRUE, NULL);
+	    amfree(compressed);
+	    amfree(compress->filename);
+	    prev = compress;
+	    compress = compress->next;
+	    amfree(prev);
+	}
+	index_sort_pool_free(pool);
+    } else if (file_lock_locked(lock_index)) {
 	while(compress) {
 	    dbprintf(_("compressing index file: %s\n"), compress->filename);
 
@@ -224,6 +249,60 @@ compress_files(
     return compress;
 }
 
+/* open the index map of a dump, if it has one */
+static index_map_t *
+open_index_map(
+    DUMP_ITEM *	dump_item)
+{
+    char *map_filename;
+    char *errmsg = NULL;
+    index_map_t *map;
+
+    map_filename = getindex_map_fname(dump_hostname, disk_name,
+				      dump_item->date, dump_item->level);
+    map = index_map_open(map_filename, &errmsg);
+    if (!map && errmsg) {
+	dbprintf(_("not using index map: %s\n"), errmsg);
+	amfree(errmsg);
+    }
+    amfree(map_filename);
+    return map;
+}
+
+/* build the index map of a dump from its sorted index file, so that later
+ * listings need not read the whole index */
+static void
+build_index_map(
+    DUMP_ITEM *	dump_item,
+    char *	filename)
+{
+    char *map_filename;
+    char *errmsg = NULL;
+    FILE *fp;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+	return;
+
+    map_filename = getindex_map_fname(dump_hostname, disk_name,
+				      dump_item->date, dump_item->level);
+    if (index_map_build(fp, map_filename, &errmsg)) {
+	dbprintf(_("built index map %s\n"), map_filename);
+    } else {
+	dbprintf(_("can't build index map %s: %s\n"), map_filename, errmsg);
+	amfree(errmsg);
+    }
+    afclose(fp);
+    amfree(map_filename);
+}
+
+static void
+add_index_map_item(
+    const char *path,
+    gpointer	user_data)
+{
+    add_dir_list_item((DUMP_ITEM *)user_data, path);
+}
+
 /* find all matching entries in a dump listing */
 /* return -1 if error */
 static int
@@ -240,6 +319,7 @@ process_ls_dump(
     char *s;
     int ch;
     size_t len_dir_slash;
+    index_map_t *map;
 
     old_line[0] = '\0';
     if (g_str_equal(dir, "/")) {
@@ -248,6 +328,14 @@ process_ls_dump(
 	dir_slash = g_strconcat(dir, "/", NULL);
     }
 
+    /* the index map answers without reading the index */
+    if ((map = open_index_map(dump_item)) != NULL) {
+	index_map_ls(map, dir_slash, recursive, add_index_map_item, dump_item);
+	index_map_close(map);
+	amfree(dir_slash);
+	return 0;
+    }
+
     filename = get_index_name(dump_hostname, dump_item->hostname, disk_name,
 			      dump_item->date, dump_item->level, emsg);
     if (filename == NULL) {
@@ -288,6 +376,7 @@ process_ls_dump(
 	}
     }
     afclose(fp);
+    build_index_map(dump_item, filename);
     amfree(filename);
     amfree(dir_slash);
     return 0;
@@ -848,6 +937,20 @@ is_dir_valid_opaque(
     /* go back till we hit a level 0 dump */
     do
     {
+	index_map_t *map;
+
+	if ((map = open_index_map(item)) != NULL) {
+	    gboolean found = index_map_has_dir(map, ldir);
+
+	    index_map_close(map);
+	    if (found) {
+		amfree(filename);
+		amfree(ldir);
+		return 0;
+	    }
+	    goto next_dump;
+	}
+
 	amfree(filename);
 	emsg = g_ptr_array_new();
 	filename = get_index_name(dump_hostname, item->hostname, disk_name,
@@ -880,6 +983,7 @@ is_dir_valid_opaque(
 	}
 	afclose(fp);
 
+next_dump:
 	last_level = item->level;
 	do
 	{
@@ -2021,10 +2125,17 @@ uncompress_file(
 	    return NULL;
     }
 
-    if (g_str_equal(filename, new_filename)) {
-	return new_filename;
-    }
     if (!need_uncompress && !need_sort) {
+	amfree(new_filename);
+	return filename;
+    }
+    if (!need_uncompress || index_sort_can_compress()) {
+	amfree(new_filename);
+	return sort_index_file(hostname, diskname, timestamps, level,
+			       filename, emsg, need_uncompress, need_sort);
+    }
+
+    if (g_str_equal(filename, new_filename)) {
 	return new_filename;
     }
 
@@ -2233,3 +2344,57 @@ uncompress_file(
     return new_filename;
 }
 
+/* Uncompress and/or sort an index file in-process.  The result is kept as
+ * the sorted index file, where get_index_name finds it the next time. */
+static char *
+sort_index_file(
+    char       *hostname,
+    char       *diskname,
+    char       *timestamps,
+    int         level,
+    char       *filename,
+    GPtrArray **emsg,
+    gboolean    need_uncompress,
+    gboolean    need_sort)
+{
+    char *sorted_filename;
+    char *errmsg = NULL;
+    char *msg;
+    char *tmpdir = NULL;
+
+    sorted_filename = getindex_sorted_fname(hostname, diskname, timestamps,
+					    level);
+    if (getconf_seen(CNF_TMPDIR))
+	tmpdir = getconf_str(CNF_TMPDIR);
+
+    if (!index_sort_convert(filename, need_uncompress, sorted_filename, FALSE,
+			    need_sort, need_sort, tmpdir, &errmsg)) {
+	msg = g_strdup_printf(_("Can't %s index file '%s': %s"),
+			      need_sort ? _("sort") : _("uncompress"),
+			      filename, errmsg);
+	dbprintf("%s\n", msg);
+	g_ptr_array_add(*emsg, msg);
+	amfree(errmsg);
+	amfree(filename);
+	amfree(sorted_filename);
+	return NULL;
+    }
+    amfree(filename);
+
+    if (getconf_boolean(CNF_COMPRESS_INDEX)) {
+	REMOVE_ITEM *item = (REMOVE_ITEM *)g_malloc(sizeof(REMOVE_ITEM));
+
+	item->filename = g_strdup(sorted_filename);
+	if (need_sort) {
+	    /* keep it, compressed, for the next time */
+	    item->next = compress_sorted_files;
+	    compress_sorted_files = item;
+	} else {
+	    /* the compressed sorted index is still there */
+	    item->next = uncompress_remove;
+	    uncompress_remove = item;
+	}
+    }
+
+    return sorted_filename;
+}
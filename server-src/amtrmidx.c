@@ -40,6 +40,8 @@
 #include "server_util.h"
 #include "amutil.h"
 #include "amindex.h"
+#include "index_map.h"
+#include "index_sort.h"
 #include "pipespawn.h"
 
 typedef struct inames {
@@ -49,9 +51,17 @@ typedef struct inames {
     gboolean index_sorted_gz;
     gboolean index_unsorted;
     gboolean index_unsorted_gz;
+    gboolean index_map;
     gboolean state_gz;
 } inames;
 
+/* an index map to build once the conversions of a DLE are done */
+typedef struct pending_map_s {
+    char *sorted_name;
+    char *sorted_gz_name;
+    char *map_name;
+} pending_map_t;
+
 static int sort_by_name_reversed(const void *a, const void *b);
 static gboolean file_exists(char *filename);
 static pid_t run_compress(int fd_in, int *fd_out, int *fd_err,
@@ -61,6 +71,12 @@ static pid_t run_uncompress(int fd_in, int *fd_out, int *fd_err,
 static pid_t run_sort(int fd_in, int *fd_out, int *fd_err,
 		      char *source_filename, char *dest_filename);
 static gboolean wait_process(pid_t pid, int fd_err, char *name);
+static void build_index_map(char *sorted_name, char *sorted_gz_name,
+			    char *map_name);
+static gboolean convert_index(index_sort_pool_t *pool,
+			      char *src, gboolean src_compressed,
+			      char *dest, gboolean dest_compressed,
+			      gboolean sort);
 
 
 int main(int argc, char **argv);
@@ -96,6 +112,8 @@ main(
     gboolean   sort_index;
     char      *lock_file;
     file_lock *lock_index;
+    index_sort_pool_t *pool;
+    GSList    *pending_maps;
 
     glib_init();
 
@@ -310,6 +328,8 @@ main(
 		    iname->index_unsorted = TRUE;
 		} else if (strcmp(n, "unsorted.gz") == 0) {
 		    iname->index_unsorted_gz = TRUE;
+		} else if (strcmp(n, "map") == 0) {
+		    iname->index_map = TRUE;
 		} else if (strcmp(n, "state.gz") == 0) {
 		    iname->state_gz = TRUE;
 		} else {
@@ -334,6 +354,10 @@ main(
 	    closedir(d);
 	    qsort(names, name_count, sizeof(char *), sort_by_name_reversed);
 
+	    /* index files of this DLE are converted concurrently */
+	    pool = index_sort_pool_new(0);
+	    pending_maps = NULL;
+
 	    /*
 	     * Search for the first full dump past the minimum number
 	     * of index files to keep.
@@ -466,6 +490,22 @@ main(
 			amfree(filepath);
 		    }
 
+		    if (iname && iname->index_map) {
+			char *filepath = g_strconcat(path, ".map", NULL);
+			if (lstat(filepath, &sbuf) != -1 &&
+			    ((sbuf.st_mode & S_IFMT) == S_IFREG) &&
+			    ((time_t)sbuf.st_mtime < tmp_time)) {
+			    char *qfilepath = quote_string(filepath);
+			    g_debug("rm %s", qfilepath);
+		            if(amtrmidx_debug == 0 && unlink(filepath) == -1) {
+				g_debug("Error removing %s: %s",
+					 qfilepath, strerror(errno));
+			    }
+			    amfree(qfilepath);
+		        }
+			amfree(filepath);
+		    }
+
 		    if (iname && iname->state_gz) {
 			char *filepath = g_strconcat(path, ".state.gz", NULL);
 			if (lstat(filepath, &sbuf) != -1 &&
@@ -491,12 +531,14 @@ main(
 		char *sorted_gz_name = getindex_sorted_gz_fname(host, disk, datestamp, level);
 		char *unsorted_name = getindex_unsorted_fname(host, disk, datestamp, level);
 		char *unsorted_gz_name = getindex_unsorted_gz_fname(host, disk, datestamp, level);
+		char *map_name = getindex_map_fname(host, disk, datestamp, level);
 
 		gboolean orig_exist = FALSE;
 		gboolean sorted_exist = FALSE;
 		gboolean sorted_gz_exist = FALSE;
 		gboolean unsorted_exist = FALSE;
 		gboolean unsorted_gz_exist = FALSE;
+		gboolean map_exist = FALSE;
 
 		int fd;
 		int uncompress_err_fd = -1;
@@ -514,37 +556,51 @@ main(
 		    sorted_gz_exist = iname->index_sorted_gz;
 		    unsorted_exist = iname->index_unsorted;
 		    unsorted_gz_exist = iname->index_unsorted_gz;
+		    map_exist = iname->index_map;
 		} else {
 		    orig_exist = file_exists(orig_name);
 		    sorted_exist = file_exists(sorted_name);
 		    sorted_gz_exist = file_exists(sorted_gz_name);
 		    unsorted_exist = file_exists(unsorted_name);
 		    unsorted_gz_exist = file_exists(unsorted_gz_name);
+		    map_exist = file_exists(map_name);
 		}
 
 		if (sort_index && compress_index) {
 		    if (!sorted_gz_exist) {
 			if (sorted_exist) {
 			    // COMPRESS
-			    compress_pid = run_compress(-1, NULL, &compress_err_fd, sorted_name, sorted_gz_name);
-			    unlink(sorted_name);
+			    if (!convert_index(pool, sorted_name, FALSE,
+					       sorted_gz_name, TRUE, FALSE)) {
+				compress_pid = run_compress(-1, NULL, &compress_err_fd, sorted_name, sorted_gz_name);
+				unlink(sorted_name);
+			    }
 			} else if (unsorted_exist) {
 			    // SORT AND COMPRESS
-			    sort_pid = run_sort(-1, &fd, &sort_err_fd, unsorted_name, NULL);
-			    compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
-			    unlink(unsorted_name);
+			    if (!convert_index(pool, unsorted_name, FALSE,
+					       sorted_gz_name, TRUE, TRUE)) {
+				sort_pid = run_sort(-1, &fd, &sort_err_fd, unsorted_name, NULL);
+				compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
+				unlink(unsorted_name);
+			    }
 			} else if (unsorted_gz_exist) {
 			    // UNCOMPRESS SORT AND COMPRESS
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, unsorted_gz_name, NULL);
-			    sort_pid = run_sort(fd, &fd, &sort_err_fd, NULL, NULL);
-			    compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
-			    unlink(unsorted_gz_name);
+			    if (!convert_index(pool, unsorted_gz_name, TRUE,
+					       sorted_gz_name, TRUE, TRUE)) {
+				uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, unsorted_gz_name, NULL);
+				sort_pid = run_sort(fd, &fd, &sort_err_fd, NULL, NULL);
+				compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
+				unlink(unsorted_gz_name);
+			    }
 			} else if (orig_exist) {
 			    // UNCOMPRESS SORT AND COMPRESS
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, orig_name, NULL);
-			    sort_pid = run_sort(fd, &fd, &sort_err_fd, NULL, NULL);
-			    compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
-			    unlink(orig_name);
+			    if (!convert_index(pool, orig_name, TRUE,
+					       sorted_gz_name, TRUE, TRUE)) {
+				uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, orig_name, NULL);
+				sort_pid = run_sort(fd, &fd, &sort_err_fd, NULL, NULL);
+				compress_pid = run_compress(fd, NULL, &compress_err_fd, NULL, sorted_gz_name);
+				unlink(orig_name);
+			    }
 			}
 		    } else {
 			if (sorted_exist) {
@@ -561,22 +617,34 @@ main(
 		    if (!sorted_exist) {
 			if (sorted_gz_exist) {
 			    // UNCOMPRESS
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, sorted_gz_name, sorted_name);
-			    unlink(sorted_gz_name);
+			    if (!convert_index(pool, sorted_gz_name, TRUE,
+					       sorted_name, FALSE, FALSE)) {
+				uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, sorted_gz_name, sorted_name);
+				unlink(sorted_gz_name);
+			    }
 			} else if (unsorted_exist) {
 			    // SORT
-			    sort_pid = run_sort(-1, NULL, &sort_err_fd, unsorted_name, sorted_name);
-			    unlink(unsorted_name);
+			    if (!convert_index(pool, unsorted_name, FALSE,
+					       sorted_name, FALSE, TRUE)) {
+				sort_pid = run_sort(-1, NULL, &sort_err_fd, unsorted_name, sorted_name);
+				unlink(unsorted_name);
+			    }
 			} else if (unsorted_gz_exist) {
 			    // UNCOMPRESS AND SORT
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, unsorted_gz_name, NULL);
-			    sort_pid = run_sort(fd, NULL, &sort_err_fd, NULL, sorted_name);
-			    unlink(unsorted_gz_name);
+			    if (!convert_index(pool, unsorted_gz_name, TRUE,
+					       sorted_name, FALSE, TRUE)) {
+				uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, unsorted_gz_name, NULL);
+				sort_pid = run_sort(fd, NULL, &sort_err_fd, NULL, sorted_name);
+				unlink(unsorted_gz_name);
+			    }
 			} else if (orig_exist) {
 			    // UNCOMPRESS AND SORT
-			    uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, orig_name, NULL);
-			    sort_pid = run_sort(fd, NULL, &sort_err_fd, NULL, sorted_name);
-			    unlink(orig_name);
+			    if (!convert_index(pool, orig_name, TRUE,
+					       sorted_name, FALSE, TRUE)) {
+				uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd, orig_name, NULL);
+				sort_pid = run_sort(fd, NULL, &sort_err_fd, NULL, sorted_name);
+				unlink(orig_name);
+			    }
 			}
 		    } else {
 			if (sorted_gz_exist) {
@@ -593,12 +661,18 @@ main(
 		    if (!sorted_gz_exist && !unsorted_gz_exist) {
 			if (sorted_exist) {
 			    // COMPRESS sorted
-			    compress_pid = run_compress(-1, NULL, &compress_err_fd, sorted_name, sorted_gz_name);
-			    unlink(sorted_name);
+			    if (!convert_index(pool, sorted_name, FALSE,
+					       sorted_gz_name, TRUE, FALSE)) {
+				compress_pid = run_compress(-1, NULL, &compress_err_fd, sorted_name, sorted_gz_name);
+				unlink(sorted_name);
+			    }
 			} else if (unsorted_exist) {
 			    // COMPRESS unsorted
-			    compress_pid = run_compress(-1, NULL, &compress_err_fd, unsorted_name, unsorted_gz_name);
-			    unlink(unsorted_name);
+			    if (!convert_index(pool, unsorted_name, FALSE,
+					       unsorted_gz_name, TRUE, FALSE)) {
+				compress_pid = run_compress(-1, NULL, &compress_err_fd, unsorted_name, unsorted_gz_name);
+				unlink(unsorted_name);
+			    }
 			} else if (orig_exist) {
 			    // RENAME orig
 			    rename(orig_name, unsorted_gz_name);
@@ -618,16 +692,25 @@ main(
 		    if (!sorted_exist && !unsorted_exist) {
 			if (sorted_gz_exist) {
 			    // UNCOMPRESS sorted
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, sorted_gz_name, sorted_name);
-			    unlink(sorted_gz_name);
+			    if (!convert_index(pool, sorted_gz_name, TRUE,
+					       sorted_name, FALSE, FALSE)) {
+				uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, sorted_gz_name, sorted_name);
+				unlink(sorted_gz_name);
+			    }
 			} else if (unsorted_gz_exist) {
 			    // UNCOMPRESS unsorted
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, unsorted_gz_name, unsorted_name);
-			    unlink(unsorted_gz_name);
+			    if (!convert_index(pool, unsorted_gz_name, TRUE,
+					       unsorted_name, FALSE, FALSE)) {
+				uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, unsorted_gz_name, unsorted_name);
+				unlink(unsorted_gz_name);
+			    }
 			} else if (orig_exist) {
 			    // UNCOMPRESS orig
-			    uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, orig_name, unsorted_name);
-			    unlink(orig_name);
+			    if (!convert_index(pool, orig_name, TRUE,
+					       unsorted_name, FALSE, FALSE)) {
+				uncompress_pid = run_uncompress(-1, NULL, &uncompress_err_fd, orig_name, unsorted_name);
+				unlink(orig_name);
+			    }
 			}
 		    } else {
 			if (sorted_gz_exist) {
@@ -648,16 +731,43 @@ main(
 		    if (compress_pid != -1)
 			wait_process(compress_pid, compress_err_fd, "compress");
 
+		    /* the sorted index is final, map it for amindexd */
+		    if (sort_index && !map_exist && amtrmidx_debug == 0) {
+			pending_map_t *pm = g_new0(pending_map_t, 1);
+			pm->sorted_name = g_strdup(sorted_name);
+			pm->sorted_gz_name = g_strdup(sorted_gz_name);
+			pm->map_name = g_strdup(map_name);
+			pending_maps = g_slist_prepend(pending_maps, pm);
+		    }
+
 		    g_free(orig_name);
 		    g_free(sorted_name);
 		    g_free(sorted_gz_name);
 		    g_free(unsorted_name);
 		    g_free(unsorted_gz_name);
+		    g_free(map_name);
 		}
 
 		amfree(datestamp);
 		amfree(names[i]);
 	    }
+
+	    /* wait for the conversions, then map the sorted indexes */
+	    if (index_sort_pool_free(pool) > 0) {
+		g_debug("Some index files of %s:%s could not be converted",
+			diskp->host->hostname, diskp->name);
+	    }
+	    while (pending_maps) {
+		pending_map_t *pm = pending_maps->data;
+
+		build_index_map(pm->sorted_name, pm->sorted_gz_name,
+				pm->map_name);
+		g_free(pm->sorted_name);
+		g_free(pm->sorted_gz_name);
+		g_free(pm->map_name);
+		g_free(pm);
+		pending_maps = g_slist_delete_link(pending_maps, pending_maps);
+	    }
 	    g_slist_free(matching_dp);
 	    amfree(names);
 	    amfree(host);
@@ -783,6 +893,10 @@ run_sort(
     int   create_pipe = STDERR_PIPE;
     pid_t pid;
     gchar *tmpdir = getconf_str(CNF_TMPDIR);
+    /* sort in byte order, as amindexd and the index map expect; safe_env
+     * drops LANG and LC_* so this is the only locale the child sees */
+    char *sort_env[] = { "LC_ALL=C", NULL };
+    char *sort_argv[] = { SORT_PATH, "-T", NULL, NULL };
 
     if (fd_in == -1) {
 	in_fd = open(source_filename, O_RDONLY);
@@ -796,10 +910,10 @@ run_sort(
 	create_pipe |= STDOUT_PIPE;
     }
 
-
-    pid = pipespawn(SORT_PATH, create_pipe, 0,
-		    &in_fd, &out_fd, fd_err,
-		    SORT_PATH, "-T", tmpdir, NULL);
+    sort_argv[2] = tmpdir;
+    pid = pipespawnv_env(SORT_PATH, create_pipe, 0,
+			 &in_fd, &out_fd, fd_err,
+			 sort_env, sort_argv);
     close(in_fd);
     if (dest_filename) {
 	close(out_fd);
@@ -842,3 +956,64 @@ wait_process(
 
     return rval;
 }
+
+static void
+build_index_map(
+    char *sorted_name,
+    char *sorted_gz_name,
+    char *map_name)
+{
+    FILE  *stream;
+    int    fd;
+    int    uncompress_err_fd = -1;
+    pid_t  uncompress_pid = -1;
+    char  *errmsg = NULL;
+
+    if (file_exists(sorted_name)) {
+	stream = fopen(sorted_name, "r");
+    } else if (file_exists(sorted_gz_name)) {
+	uncompress_pid = run_uncompress(-1, &fd, &uncompress_err_fd,
+					sorted_gz_name, NULL);
+	stream = fdopen(fd, "r");
+    } else {
+	return;
+    }
+
+    if (stream == NULL) {
+	g_debug("Can't open the sorted index for %s: %s", map_name,
+		strerror(errno));
+	if (uncompress_pid != -1)
+	    close(fd);
+    } else {
+	if (index_map_build(stream, map_name, &errmsg)) {
+	    g_debug("built index map %s", map_name);
+	} else {
+	    g_debug("Can't build index map %s: %s", map_name, errmsg);
+	    g_free(errmsg);
+	}
+	fclose(stream);
+    }
+
+    if (uncompress_pid != -1)
+	wait_process(uncompress_pid, uncompress_err_fd, "uncompress");
+}
+
+/* Convert an index file in the pool, if it can be done in-process; SRC is
+ * removed once DEST is complete.  Returns FALSE if the caller must run the
+ * external programs. */
+static gboolean
+convert_index(
+    index_sort_pool_t *pool,
+    char     *src,
+    gboolean  src_compressed,
+    char     *dest,
+    gboolean  dest_compressed,
+    gboolean  sort)
+{
+    if ((src_compressed || dest_compressed) && !index_sort_can_compress())
+	return FALSE;
+
+    index_sort_pool_push(pool, src, src_compressed, dest, dest_compressed,
+			 sort, TRUE, NULL);
+    return TRUE;
+}
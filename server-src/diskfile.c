@@ -216,6 +216,8 @@ add_disk(
     disk->tape_splitsize = (off_t)0;
     disk->split_diskbuffer = NULL;
     disk->fallback_splitsize = (off_t)0;
+    disk->shm_ring_size = (off_t)0;
+    disk->shm_ring_huge_pages = 0;
     disk->hostname = g_strdup(hostname);
     disk->name = g_strdup(diskname);
     disk->device = g_strdup(diskname);
@@ -716,6 +718,8 @@ parse_diskline(
     disk->tape_splitsize     = dumptype_get_tape_splitsize(dtype);
     disk->split_diskbuffer   = dumptype_get_split_diskbuffer(dtype);
     disk->fallback_splitsize = dumptype_get_fallback_splitsize(dtype);
+    disk->shm_ring_size      = dumptype_get_shm_ring_size(dtype);
+    disk->shm_ring_huge_pages = dumptype_get_shm_ring_huge_pages(dtype);
     disk->maxpromoteday	     = dumptype_get_maxpromoteday(dtype);
     disk->bumppercent	     = dumptype_get_bumppercent(dtype);
     disk->bumpsize	     = dumptype_get_bumpsize(dtype);
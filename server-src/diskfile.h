@@ -100,6 +100,8 @@ typedef struct disk_s {
     off_t	tape_splitsize;         /* size of dumpfile chunks on tape */
     char	*split_diskbuffer;      /* place where we can buffer PORT-WRITE dumps other than RAM */
     off_t	fallback_splitsize;     /* size for in-RAM PORT-WRITE buffers */
+    off_t	shm_ring_size;		/* size of the dumper to chunker ring, in kbytes */
+    int		shm_ring_huge_pages;	/* back that ring with huge pages */
     int		dumpcycle;		/* days between fulls */
     long	frequency;		/* XXX - not used */
     char	*auth;			/* type of authentication (per disk) */
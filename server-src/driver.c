@@ -87,6 +87,8 @@ static int conf_runtapes;
 static unsigned long conf_reserve = 100;
 static time_t sleep_time;
 static int idle_reason;
+static int sched_passes;	/* calls to start_some_dumps */
+static times_t sched_time;	/* time spent in them */
 static char *driver_timestamp;
 static char *hd_driver_timestamp;
 static am_host_t *flushhost = NULL;
@@ -137,7 +139,6 @@ static void holdingdisk_state(char *time_str);
 static wtaper_t *idle_wtaper(taper_t *taper);
 static wtaper_t *wtaper_from_name(taper_t *taper, char *name);
 static void interface_state(char *time_str);
-static int queue_length(schedlist_t *q);
 static void read_flush(void *cookie);
 static void read_schedule(void *cookie);
 static void set_vaultqs(void);
@@ -152,6 +153,7 @@ static void start_a_vault(void);
 static void start_a_flush(void);
 static void start_degraded_mode(schedlist_t *queuep);
 static void start_some_dumps(schedlist_t *rq);
+static void do_start_some_dumps(schedlist_t *rq);
 static void continue_port_dumps(void);
 static void update_failed_dump(sched_t *sp);
 static int no_taper_flushing(void);
@@ -196,13 +198,6 @@ static const char *idle_strings[] = {
     T_("no-diskspace")
 };
 
-static void enqueue_sched(schedlist_t *list, sched_t *sp);
-static void headqueue_sched(schedlist_t *list, sched_t *sp);
-static void insert_before_sched(schedlist_t *list, GList *list_before, sched_t *sp);
-static int find_sched(schedlist_t *list, sched_t *sp);
-static sched_t *dequeue_sched(schedlist_t *list);
-static void remove_sched(schedlist_t *list, sched_t *sp);
-
 int
 main(
     int		argc,
@@ -531,6 +526,8 @@ main(
 
     runq.head = NULL;
     runq.tail = NULL;
+    runq.hosts = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				       NULL, (GDestroyNotify)g_queue_free);
     directq.head = NULL;
     directq.tail = NULL;
     waitq = origq;
@@ -792,6 +789,8 @@ main(
     amfree(newdir);
 
     check_unfree_serial();
+    driver_debug(1, _("driver: %d scheduling passes took %s secs\n"),
+		 sched_passes, walltime_str(sched_time));
     g_printf(_("driver: FINISHED time %s\n"), walltime_str(curclock()));
     fflush(stdout);
     log_add(L_FINISH,_("date %s time %s"), driver_timestamp, walltime_str(curclock()));
@@ -1480,7 +1479,12 @@ start_a_vault_wtaper(
 		    amfree(wtaper->vaultqs.src_labels_str);
 		    slist_free_full(wtaper->vaultqs.src_labels, g_free);
 		    wtaper->vaultqs.src_labels = NULL;
-		    wtaper->vaultqs = *vaultqs;
+		    wtaper->vaultqs.src_labels_str = vaultqs->src_labels_str;
+		    wtaper->vaultqs.src_labels = vaultqs->src_labels;
+		    /* move the entries, so that they know their new queue */
+		    while ((sp = dequeue_sched(&vaultqs->vaultq)) != NULL) {
+			enqueue_sched(&wtaper->vaultqs.vaultq, sp);
+		    }
 		    wtaper->taper->vaultqss = g_slist_remove_link(wtaper->taper->vaultqss, vsl);
 		    sp = dequeue_sched(&wtaper->vaultqs.vaultq);
 		    break;
@@ -1678,9 +1682,79 @@ allow_dump_dle(
     }
 }
 
+/* The run queue as offered to allow_dump_dle by one pass of
+ * do_start_some_dumps */
+typedef struct ready_dumps_s {
+    time_t      now;
+    int        *cur_idle;
+    sched_t   **delayed_sp;
+    GPtrArray  *ready;		/* the dumps of the hosts that can start one */
+} ready_dumps_t;
+
+/* A GHFunc over the host buckets of the run queue.  A host waiting for its
+ * start time, or running as many dumps as it may, is passed over whole;
+ * none of its dumps could start. */
+static void
+collect_host_dumps(
+    gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+    am_host_t     *host = key;
+    GQueue        *bucket = value;
+    ready_dumps_t *rd = user_data;
+    GList         *hlist;
+
+    if (host->start_t > rd->now) {
+	/* only the first of its dumps can shorten sleep_time */
+	*rd->cur_idle = max(*rd->cur_idle, IDLE_START_WAIT);
+	if (*rd->delayed_sp == NULL || sleep_time > host->start_t) {
+	    *rd->delayed_sp = g_queue_peek_head(bucket);
+	    sleep_time = host->start_t;
+	}
+	return;
+    }
+
+    if (host->inprogress >= host->maxdumps) {
+	*rd->cur_idle = max(*rd->cur_idle, IDLE_CLIENT_CONSTRAINED);
+	return;
+    }
+
+    for (hlist = bucket->head; hlist != NULL; hlist = hlist->next) {
+	g_ptr_array_add(rd->ready, hlist->data);
+    }
+}
+
+static int
+sched_seq_cmp(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const sched_t *sa = *(sched_t * const *)a;
+    const sched_t *sb = *(sched_t * const *)b;
+
+    return (sa->queue_seq > sb->queue_seq) - (sa->queue_seq < sb->queue_seq);
+}
+
 static void
 start_some_dumps(
     schedlist_t *rq)
+{
+    times_t pass_start = curclock();
+    times_t pass_time;
+
+    do_start_some_dumps(rq);
+
+    pass_time = timessub(curclock(), pass_start);
+    sched_time = timesadd(sched_time, pass_time);
+    sched_passes++;
+    driver_debug(2, _("start_some_dumps: pass %d took %s secs, %d queued\n"),
+		 sched_passes, walltime_str(pass_time), queue_length(rq));
+}
+
+static void
+do_start_some_dumps(
+    schedlist_t *rq)
 {
     const time_t now = time(NULL);
     int cur_idle;
@@ -1856,16 +1930,23 @@ start_some_dumps(
 	    }
 	}
 	if (sp == NULL) {
-	    for (slist = rq->head; slist != NULL;
-				   slist = slist_next) {
-		slist_next = slist->next;
-		sp = get_sched(slist);
-		assert(sp != NULL && sp->disk != NULL && sp->disk->host);
-
-		allow_dump_dle(sp, NULL, dumptype, rq, now,
-			       dumper_to_holding, &cur_idle, &delayed_sp,
-			       &sp_accept, &holdp_accept, 0);
-	    }
+	    ready_dumps_t rd;
+	    guint i;
+
+	    /* only the dumps of the hosts that can start one, merged back
+	     * into queue order, since the choice depends on that order */
+	    rd.now = now;
+	    rd.cur_idle = &cur_idle;
+	    rd.delayed_sp = &delayed_sp;
+	    rd.ready = g_ptr_array_new();
+	    g_hash_table_foreach(rq->hosts, collect_host_dumps, &rd);
+	    g_ptr_array_sort(rd.ready, sched_seq_cmp);
+	    for (i = 0; i < rd.ready->len; i++) {
+		allow_dump_dle(g_ptr_array_index(rd.ready, i), NULL, dumptype,
+			       rq, now, dumper_to_holding, &cur_idle,
+			       &delayed_sp, &sp_accept, &holdp_accept, 0);
+	    }
+	    g_ptr_array_free(rd.ready, TRUE);
 	    sp = sp_accept;
 	    holdp = holdp_accept;
 	}
@@ -2072,6 +2153,7 @@ start_degraded_mode(
     /*@keep@*/ schedlist_t *queuep)
 {
     schedlist_t newq;
+    sched_t *sp;
     off_t est_full_size;
     char *qname;
     taper_t  *taper;
@@ -2092,14 +2174,16 @@ start_degraded_mode(
 	    return;
     }
 
-    newq.head = newq.tail = 0;
+    memset(&newq, 0, sizeof(newq));
 
     dump_schedule(queuep, _("before start degraded mode"));
 
     est_full_size = (off_t)0;
     while(!empty(*queuep)) {
-	sched_t *sp = dequeue_sched(queuep);
-	disk_t  *dp = sp->disk;
+	disk_t  *dp;
+
+	sp = dequeue_sched(queuep);
+	dp = sp->disk;
 
 	qname = quote_string(dp->name);
 	if (sp->level != 0) {
@@ -2142,7 +2226,10 @@ start_degraded_mode(
         amfree(qname);
     }
 
-    /*@i@*/ *queuep = newq;
+    /* move them back, so that queuep keeps its host buckets */
+    while ((sp = dequeue_sched(&newq)) != NULL) {
+	enqueue_sched(queuep, sp);
+    }
     all_degraded_mode = (nb_storage == 0);
     for (taper = tapetable; taper < tapetable+nb_storage ; taper++) {
 	all_degraded_mode &= taper->degraded_mode;
@@ -2847,7 +2934,8 @@ handle_taper_result(
             }
 	    taper->degraded_mode = TRUE;
 	    start_degraded_mode(&runq);
-            taper->tapeq.head = taper->tapeq.tail = NULL;
+	    /* drop what was queued for it */
+	    while (dequeue_sched(&taper->tapeq) != NULL);
             aaclose(taper->fd);
 
             break;
@@ -3515,6 +3603,9 @@ dumper_chunker_result_finish(
 		    if (g_str_equal(storage_name, taper->storage_name)) {
 			sched_t *sp1 = g_new0(sched_t, 1);
 			*sp1 = *sp;
+			sp1->queue = NULL;
+			sp1->queue_link = NULL;
+			sp1->host_link = NULL;
 			sp1->action = ACTION_FLUSH;
 	                sp1->destname = g_strdup(sp->destname);
 	                sp1->dumpdate = g_strdup(sp->dumpdate);
@@ -5482,14 +5573,6 @@ update_failed_dump(
 
 /* ------------------- */
 
-static int
-queue_length(
-    schedlist_t	*q)
-{
-    if (!q) return 0;
-    return g_list_length(q->head);
-}
-
 static void
 short_dump_state(void)
 {
@@ -5963,102 +6046,6 @@ fix_index_header(
     close(fd);
 }
 
-/*
- *  * put disk on end of queue
- *   */
-
-static void
-enqueue_sched(
-    schedlist_t *list,
-    sched_t *    sp)
-{
-    list->head = g_am_list_insert_after(list->head, list->tail, sp);
-    if (list->tail) {
-	list->tail = list->tail->next;
-    } else {
-	list->tail = list->head;
-    }
-}
-
-
-/*
- *  * put disk on head of queue
- *   */
-
-static void
-headqueue_sched(
-    schedlist_t *list,
-    sched_t *    sp)
-{
-    list->head = g_list_prepend(list->head, sp);
-    if (!list->tail) {
-	list->tail = list->head;
-    }
-}
-
-static void
-insert_before_sched(
-    schedlist_t *list,
-    GList       *list_before,
-    sched_t     *sp)
-{
-    list->head = g_list_insert_before(list->head, list_before, sp);
-}
-
-/*
- *  * check if disk is present in list. Return true if so, false otherwise.
- *   */
-
-static int
-find_sched(
-    schedlist_t *list,
-    sched_t     *sp)
-{
-    GList *glist = list->head;
-
-    while (glist && glist->data != sp) {
-	glist = glist->next;
-    }
-    return (glist && glist->data == sp);
-}
-
-/*
- *  * remove disk from front of queue
- *   */
-
-static sched_t *
-dequeue_sched(
-    schedlist_t *list)
-{
-    sched_t *sp;
-
-    if (list->head == NULL) return NULL;
-
-    sp = list->head->data;
-    list->head = g_list_delete_link(list->head, list->head);
-
-    if (list->head == NULL) list->tail = NULL;
-
-    return sp;
-}
-
-static void
-remove_sched(
-    schedlist_t *list,
-    sched_t *    sp)
-{
-    GList *ltail;
-
-    if (list->tail && list->tail->data == sp) {
-	ltail = list->tail;
-	list->tail = list->tail->prev;
-	list->head = g_list_delete_link(list->head, ltail);
-    } else {
-	list->head = g_list_remove(list->head, sp);
-    }
-}
-
-
 #if 0
 static void
 dump_state(
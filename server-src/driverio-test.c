@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2008-2012 Zmanda, Inc.  All Rights Reserved.
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "testutils.h"
+#include "diskfile.h"
+#include "driverio.h"
+
+/*
+ * Utilities
+ */
+
+#define NB_HOSTS 3
+#define NB_SCHEDS 12
+
+static am_host_t hosts[NB_HOSTS];
+static disk_t disks[NB_SCHEDS];
+static sched_t scheds[NB_SCHEDS];
+
+static void
+init_scheds(void)
+{
+    int i;
+
+    memset(hosts, 0, sizeof(hosts));
+    memset(disks, 0, sizeof(disks));
+    memset(scheds, 0, sizeof(scheds));
+    for (i = 0; i < NB_SCHEDS; i++) {
+	disks[i].host = &hosts[i % NB_HOSTS];
+	scheds[i].disk = &disks[i];
+    }
+}
+
+static void
+init_queue(
+    schedlist_t *q,
+    gboolean     by_host)
+{
+    memset(q, 0, sizeof(*q));
+    if (by_host) {
+	q->hosts = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+					 NULL, (GDestroyNotify)g_queue_free);
+    }
+}
+
+static void
+free_queue(
+    schedlist_t *q)
+{
+    while (dequeue_sched(q) != NULL)
+	;
+    if (q->hosts)
+	g_hash_table_destroy(q->hosts);
+}
+
+/* check that q holds exactly the scheds of expect, in that order, that
+ * queue_seq grows along it, and that each host bucket holds the scheds of
+ * that host in queue order */
+static gboolean
+check_queue(
+    schedlist_t *q,
+    int         *expect,
+    int          nb_expect)
+{
+    GList *slist;
+    int i = 0;
+    int h;
+
+    if (queue_length(q) != nb_expect) {
+	tu_dbg("length %d, expected %d\n", queue_length(q), nb_expect);
+	return FALSE;
+    }
+
+    for (slist = q->head; slist != NULL; slist = slist->next, i++) {
+	sched_t *sp = get_sched(slist);
+
+	if (i >= nb_expect || sp != &scheds[expect[i]]) {
+	    tu_dbg("entry %d is sched %d\n", i, (int)(sp - scheds));
+	    return FALSE;
+	}
+	if (!find_sched(q, sp) || sp->queue_link != slist) {
+	    tu_dbg("sched %d does not know its link\n", expect[i]);
+	    return FALSE;
+	}
+	if (q->hosts && slist->prev &&
+	    get_sched(slist->prev)->queue_seq >= sp->queue_seq) {
+	    tu_dbg("sched %d is out of sequence\n", expect[i]);
+	    return FALSE;
+	}
+    }
+    if (i != nb_expect || (q->tail && q->tail->next != NULL) ||
+	(q->tail == NULL) != (q->head == NULL)) {
+	tu_dbg("bad tail\n");
+	return FALSE;
+    }
+
+    if (!q->hosts)
+	return TRUE;
+
+    for (h = 0; h < NB_HOSTS; h++) {
+	GQueue *bucket = g_hash_table_lookup(q->hosts, &hosts[h]);
+	GList *blist = bucket ? bucket->head : NULL;
+
+	for (i = 0; i < nb_expect; i++) {
+	    if (scheds[expect[i]].disk->host != &hosts[h])
+		continue;
+	    if (blist == NULL || blist->data != &scheds[expect[i]] ||
+		scheds[expect[i]].host_link != blist) {
+		tu_dbg("host %d: bucket does not match the queue at sched %d\n",
+		       h, expect[i]);
+		return FALSE;
+	    }
+	    blist = blist->next;
+	}
+	if (blist != NULL) {
+	    tu_dbg("host %d: extra entries in bucket\n", h);
+	    return FALSE;
+	}
+	if (bucket && g_queue_is_empty(bucket)) {
+	    tu_dbg("host %d: empty bucket left\n", h);
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
+
+/*
+ * Tests
+ */
+
+/* enqueue and headqueue keep the host buckets in queue order */
+static gboolean
+test_host_order(void)
+{
+    schedlist_t q;
+    int expect[] = { 9, 6, 0, 1, 2, 3, 4, 5 };
+    gboolean success;
+    int i;
+
+    init_scheds();
+    init_queue(&q, TRUE);
+    for (i = 0; i < 6; i++)
+	enqueue_sched(&q, &scheds[i]);
+    headqueue_sched(&q, &scheds[6]);
+    headqueue_sched(&q, &scheds[9]);
+
+    success = check_queue(&q, expect, G_N_ELEMENTS(expect));
+    free_queue(&q);
+    return success;
+}
+
+/* removing, dequeueing and re-queueing keep the buckets in step */
+static gboolean
+test_host_order_remove(void)
+{
+    schedlist_t q;
+    int expect1[] = { 1, 2, 4, 5, 6, 7, 8, 9, 10 };
+    int expect2[] = { 3, 2, 4, 5, 6, 7, 8, 9, 10, 0 };
+    int expect3[] = { 3, 2, 4, 5, 6, 7, 8, 9 };
+    gboolean success = TRUE;
+    int i;
+
+    init_scheds();
+    init_queue(&q, TRUE);
+    for (i = 0; i < 11; i++)
+	enqueue_sched(&q, &scheds[i]);
+
+    remove_sched(&q, &scheds[3]);
+    if (dequeue_sched(&q) != &scheds[0]) {
+	tu_dbg("dequeue did not return the head\n");
+	success = FALSE;
+    }
+    success = success && check_queue(&q, expect1, G_N_ELEMENTS(expect1));
+
+    enqueue_sched(&q, &scheds[0]);
+    headqueue_sched(&q, &scheds[2]);	/* already queued: moved to the head */
+    headqueue_sched(&q, &scheds[3]);
+    remove_sched(&q, &scheds[1]);
+    success = success && check_queue(&q, expect2, G_N_ELEMENTS(expect2));
+
+    /* removing the tail */
+    remove_sched(&q, &scheds[0]);
+    remove_sched(&q, &scheds[10]);
+    remove_sched(&q, &scheds[10]);	/* not queued any more: no-op */
+    success = success && check_queue(&q, expect3, G_N_ELEMENTS(expect3));
+
+    free_queue(&q);
+    return success;
+}
+
+/* a sched put on a second queue leaves the first one */
+static gboolean
+test_move_queue(void)
+{
+    schedlist_t q1, q2;
+    int expect1[] = { 0, 2, 3 };
+    int expect2[] = { 4, 5, 1 };
+    gboolean success;
+    int i;
+
+    init_scheds();
+    init_queue(&q1, TRUE);
+    init_queue(&q2, FALSE);
+    for (i = 0; i < 4; i++)
+	enqueue_sched(&q1, &scheds[i]);
+    enqueue_sched(&q2, &scheds[4]);
+    enqueue_sched(&q2, &scheds[1]);
+    insert_before_sched(&q2, q2.tail, &scheds[5]);
+
+    success = check_queue(&q1, expect1, G_N_ELEMENTS(expect1)) &&
+	      check_queue(&q2, expect2, G_N_ELEMENTS(expect2)) &&
+	      !find_sched(&q1, &scheds[1]);
+
+    free_queue(&q1);
+    free_queue(&q2);
+    return success;
+}
+
+/* an empty bucket is dropped, and a new one made when the host comes back */
+static gboolean
+test_empty_bucket(void)
+{
+    schedlist_t q;
+    int expect[] = { 1, 3 };
+    gboolean success;
+
+    init_scheds();
+    init_queue(&q, TRUE);
+    enqueue_sched(&q, &scheds[0]);
+    enqueue_sched(&q, &scheds[1]);
+    remove_sched(&q, &scheds[0]);
+    success = g_hash_table_lookup(q.hosts, &hosts[0]) == NULL;
+    enqueue_sched(&q, &scheds[3]);
+    success = success && check_queue(&q, expect, G_N_ELEMENTS(expect));
+
+    free_queue(&q);
+    return success;
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_host_order, 90),
+	TU_TEST(test_host_order_remove, 90),
+	TU_TEST(test_move_queue, 90),
+	TU_TEST(test_empty_bucket, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+}
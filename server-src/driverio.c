@@ -261,16 +261,6 @@ start_one_tape_process(
 	    error(_("taper pipe: %s"), strerror(errno));
 	    /*NOTREACHED*/
 	}
-	if (fd[0] < 0 || fd[0] >= (int)FD_SETSIZE) {
-	    error(_("taper socketpair 0: descriptor %d out of range (0 .. %d)\n"),
-	          fd[0], (int)FD_SETSIZE-1);
-            /*NOTREACHED*/
-	}
-	if (fd[1] < 0 || fd[1] >= (int)FD_SETSIZE) {
-	    error(_("taper socketpair 1: descriptor %d out of range (0 .. %d)\n"),
-	          fd[1], (int)FD_SETSIZE-1);
-            /*NOTREACHED*/
-	}
 
 	switch(taper->pid = fork()) {
 	case -1:
@@ -982,6 +972,7 @@ chunker_cmd(
     char number[NUM_STR_SIZE];
     char chunksize[NUM_STR_SIZE];
     char use[NUM_STR_SIZE];
+    char ring_size[NUM_STR_SIZE];
     char c_crc[NUM_STR_SIZE+11];
     char *o;
     int activehd=0;
@@ -1012,6 +1003,8 @@ chunker_cmd(
 		    (long long)holdingdisk_get_chunksize(h[0]->disk->hdisk));
 	    g_snprintf(use, sizeof(use), "%lld",
 		    (long long)h[0]->reserved);
+	    g_snprintf(ring_size, sizeof(ring_size), "%lld",
+		    (long long)dp->shm_ring_size);
 	    features = am_feature_to_string(dp->host->features);
 	    o = optionstr(dp);
 	    cmdline = g_strjoin(NULL, cmdstr[cmd],
@@ -1025,6 +1018,8 @@ chunker_cmd(
 			    " ", chunksize,
 			    " ", dp->program,
 			    " ", use,
+			    " ", ring_size,
+			    " ", dp->shm_ring_huge_pages ? "1" : "0",
 			    " |", o,
 			    "\n", NULL);
 	    amfree(features);
@@ -1456,3 +1451,186 @@ void free_assignedhd(
     amfree(ahd);
 }
 
+
+int
+queue_length(
+    schedlist_t	*q)
+{
+    if (!q) return 0;
+    return q->length;
+}
+
+/*
+ *  * record that sp is on list at link, and put it in its host bucket.
+ *  * A sched is on one queue at a time; the callers take it off the
+ *  * previous one first.  In a bucketed queue, queue_seq grows from head
+ *  * to tail, so that the buckets can be merged back in queue order.
+ *   */
+
+static void
+link_sched(
+    schedlist_t *list,
+    sched_t *    sp,
+    GList *      link,
+    gboolean     at_head)
+{
+    sp->queue = list;
+    sp->queue_link = link;
+    list->length++;
+
+    if (list->hosts) {
+	am_host_t *host = sp->disk->host;
+	GQueue *bucket = g_hash_table_lookup(list->hosts, host);
+
+	if (!bucket) {
+	    bucket = g_queue_new();
+	    g_hash_table_insert(list->hosts, host, bucket);
+	}
+	if (list->length == 1) {
+	    sp->queue_seq = list->first_seq = list->last_seq = 0;
+	} else if (at_head) {
+	    sp->queue_seq = --list->first_seq;
+	} else {
+	    sp->queue_seq = ++list->last_seq;
+	}
+	if (at_head) {
+	    g_queue_push_head(bucket, sp);
+	    sp->host_link = g_queue_peek_head_link(bucket);
+	} else {
+	    g_queue_push_tail(bucket, sp);
+	    sp->host_link = g_queue_peek_tail_link(bucket);
+	}
+    }
+}
+
+static void
+unlink_sched(
+    schedlist_t *list,
+    sched_t *    sp)
+{
+    if (list->hosts) {
+	am_host_t *host = sp->disk->host;
+	GQueue *bucket = g_hash_table_lookup(list->hosts, host);
+
+	g_queue_delete_link(bucket, sp->host_link);
+	if (g_queue_is_empty(bucket))
+	    g_hash_table_remove(list->hosts, host);
+    }
+
+    list->length--;
+    sp->queue = NULL;
+    sp->queue_link = NULL;
+    sp->host_link = NULL;
+}
+
+/*
+ *  * put disk on end of queue
+ *   */
+
+void
+enqueue_sched(
+    schedlist_t *list,
+    sched_t *    sp)
+{
+    if (sp->queue)
+	remove_sched(sp->queue, sp);
+    list->head = g_am_list_insert_after(list->head, list->tail, sp);
+    if (list->tail) {
+	list->tail = list->tail->next;
+    } else {
+	list->tail = list->head;
+    }
+    link_sched(list, sp, list->tail, FALSE);
+}
+
+
+/*
+ *  * put disk on head of queue
+ *   */
+
+void
+headqueue_sched(
+    schedlist_t *list,
+    sched_t *    sp)
+{
+    if (sp->queue)
+	remove_sched(sp->queue, sp);
+    list->head = g_list_prepend(list->head, sp);
+    if (!list->tail) {
+	list->tail = list->head;
+    }
+    link_sched(list, sp, list->head, TRUE);
+}
+
+/*
+ *  * insert disk before list_before; only for queues without host buckets,
+ *  * as the host buckets are kept in queue order.
+ *   */
+
+void
+insert_before_sched(
+    schedlist_t *list,
+    GList       *list_before,
+    sched_t     *sp)
+{
+    if (!list_before) {
+	enqueue_sched(list, sp);
+	return;
+    }
+    g_assert(list->hosts == NULL);
+    if (sp->queue)
+	remove_sched(sp->queue, sp);
+    list->head = g_list_insert_before(list->head, list_before, sp);
+    link_sched(list, sp, list_before->prev, FALSE);
+}
+
+/*
+ *  * check if disk is present in list. Return true if so, false otherwise.
+ *   */
+
+int
+find_sched(
+    schedlist_t *list,
+    sched_t     *sp)
+{
+    return sp->queue == list;
+}
+
+/*
+ *  * remove disk from front of queue
+ *   */
+
+sched_t *
+dequeue_sched(
+    schedlist_t *list)
+{
+    sched_t *sp;
+
+    if (list->head == NULL) return NULL;
+
+    sp = list->head->data;
+    unlink_sched(list, sp);
+    list->head = g_list_delete_link(list->head, list->head);
+
+    if (list->head == NULL) list->tail = NULL;
+
+    return sp;
+}
+
+void
+remove_sched(
+    schedlist_t *list,
+    sched_t *    sp)
+{
+    GList *link;
+
+    if (sp->queue != list)
+	return;
+
+    link = sp->queue_link;
+    if (link == list->tail) {
+	list->tail = link->prev;
+    }
+    list->head = g_list_delete_link(list->head, link);
+    unlink_sched(list, sp);
+}
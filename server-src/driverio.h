@@ -101,6 +101,11 @@ typedef struct assignedhd_s {
 
 typedef struct schedlist_s {
     GList *head, *tail;
+    int length;
+    GHashTable *hosts;		/* am_host_t * -> GQueue of its sched_t, */
+				/* in queue order; NULL if not bucketed  */
+    gint64 first_seq, last_seq;	/* queue_seq of the head and tail, when  */
+				/* bucketed                              */
 } schedlist_t;
 #define get_sched(slist) ((sched_t *)((slist)->data))
 
@@ -232,6 +237,11 @@ typedef struct sched_s {
     int   src_fileno;
     char *try_again_message;
     taper_t *prefered_taper;
+
+    schedlist_t *queue;		/* the queue it is on, or NULL */
+    GList *queue_link;		/* its link in queue->head     */
+    GList *host_link;		/* its link in its host bucket */
+    gint64 queue_seq;		/* orders a bucketed queue     */
 } sched_t;
 
 /* command/result tokens */
@@ -259,4 +269,13 @@ char *job2serial(job_t *job);
 void update_info_dumper(sched_t *sp, off_t origsize, off_t dumpsize, time_t dumptime);
 void update_info_taper(sched_t *sp, char *label, off_t filenum, int level);
 void free_assignedhd(assignedhd_t **holdp);
+
+/* run queues; a sched is on at most one queue at a time */
+int queue_length(schedlist_t *q);
+void enqueue_sched(schedlist_t *list, sched_t *sp);
+void headqueue_sched(schedlist_t *list, sched_t *sp);
+void insert_before_sched(schedlist_t *list, GList *list_before, sched_t *sp);
+int find_sched(schedlist_t *list, sched_t *sp);
+sched_t *dequeue_sched(schedlist_t *list);
+void remove_sched(schedlist_t *list, sched_t *sp);
 #endif	/* !DRIVERIO_H */
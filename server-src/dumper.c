@@ -45,6 +45,8 @@
 #include "amutil.h"
 #include "timestamp.h"
 #include "amxml.h"
+#include "parallel-gzip.h"
+#include "amxfer.h"
 
 #ifdef FAILURE_CODE
 static int dumper_try_again=0;
@@ -92,6 +94,10 @@ typedef struct filter_s {
     gint64          size;            /* number of byte use in the buffer */
     gint64          allocated_size ; /* allocated size of the buffer     */
     event_handle_t *event;
+    Xfer           *xfer;            /* in place of pid, for in-process filters */
+    int             xfer_errfd;      /* closed when the xfer is done */
+    char           *xfer_errmsg;     /* its first XMSG_ERROR */
+    gboolean        abandoned;       /* freed by filter_xfer_callback */
 } filter_t;
 static GSList *filters = NULL;
 
@@ -240,6 +246,8 @@ static int	log_msgout(logtype_t);
 static char *	dumper_get_security_conf (char *, void *);
 
 static int	runcompress(int, comp_t, char *);
+static int	runcompress_xfer(int, comp_t, char *);
+static void	filter_xfer_callback(gpointer, XMsg *, Xfer *);
 static int	runencrypt(int, encrypt_t, char *);
 
 static void	sendbackup_response(void *, pkt_t *, security_handle_t *);
@@ -2021,7 +2029,7 @@ handle_shm_ring_to_fd_thread(
     gboolean     eof_flag = FALSE;
     shm_ring_size = db->shm_ring_consumer->mc->ring_size;
 
-    sem_post(db->shm_ring_consumer->sem_write);
+    shm_ring_sem_post(db->shm_ring_consumer, db->shm_ring_consumer->sem_write);
     while (!db->shm_ring_consumer->mc->cancelled) {
 	do {
 	    if (shm_ring_sem_wait(db->shm_ring_consumer, db->shm_ring_consumer->sem_read) != 0)
@@ -2148,7 +2156,7 @@ handle_shm_ring_to_fd_thread(
 		    g_debug("%s", errstr);
 		    g_mutex_lock(shm_thread_mutex);
 		    db->shm_ring_consumer->mc->cancelled = TRUE;
-		    sem_post(db->shm_ring_consumer->sem_write);
+		    shm_ring_sem_post(db->shm_ring_consumer, db->shm_ring_consumer->sem_write);
 		    dump_result = 2;
 		    aclose(db->fd);
 		    ev_stop_dump = event_create((event_id_t)0, EV_TIME,
@@ -2169,7 +2177,7 @@ handle_shm_ring_to_fd_thread(
 		    g_debug("%s", errstr);
 		    g_mutex_lock(shm_thread_mutex);
 		    db->shm_ring_consumer->mc->cancelled = TRUE;
-		    sem_post(db->shm_ring_consumer->sem_write);
+		    shm_ring_sem_post(db->shm_ring_consumer, db->shm_ring_consumer->sem_write);
 		    dump_result = 2;
 		    aclose(db->fd);
 		    ev_stop_dump = event_create((event_id_t)0, EV_TIME,
@@ -2185,7 +2193,7 @@ handle_shm_ring_to_fd_thread(
 		    g_debug("%s", errstr);
 		    g_mutex_lock(shm_thread_mutex);
 		    db->shm_ring_consumer->mc->cancelled = TRUE;
-		    sem_post(db->shm_ring_consumer->sem_write);
+		    shm_ring_sem_post(db->shm_ring_consumer, db->shm_ring_consumer->sem_write);
 		    dump_result = 2;
 		    aclose(db->fd);
 		    ev_stop_dump = event_create((event_id_t)0, EV_TIME,
@@ -2206,13 +2214,13 @@ handle_shm_ring_to_fd_thread(
 		    read_offset -= shm_ring_size;
 		db->shm_ring_consumer->mc->read_offset = read_offset;
 		db->shm_ring_consumer->mc->readx += to_write;
-		sem_post(db->shm_ring_consumer->sem_write);
+		shm_ring_sem_post(db->shm_ring_consumer, db->shm_ring_consumer->sem_write);
 		usable -= to_write;
 	    }
 	    if (db->shm_ring_consumer->mc->write_offset == db->shm_ring_consumer->mc->read_offset &&
 		db->shm_ring_consumer->mc->eof_flag) {
 		// notify the producer that everythinng is read
-		sem_post(db->shm_ring_consumer->sem_write);
+		shm_ring_sem_post(db->shm_ring_consumer, db->shm_ring_consumer->sem_write);
 		goto shm_done;
 	    }
 	}
@@ -2260,9 +2268,9 @@ handle_shm_ring_direct(
 shm_done:
     db->shm_ring_direct->mc->need_sem_ready--;
     if (db->shm_ring_direct->mc->need_sem_ready == 0) {
-	sem_post(db->shm_ring_direct->sem_start);
+	shm_ring_sem_post(db->shm_ring_direct, db->shm_ring_direct->sem_start);
     } else {
-	sem_post(db->shm_ring_direct->sem_ready);
+	shm_ring_sem_post(db->shm_ring_direct, db->shm_ring_direct->sem_ready);
     }
     g_cond_broadcast(shm_thread_cond);
     g_mutex_unlock(shm_thread_mutex);
@@ -3006,17 +3014,28 @@ handle_filter_stderr(
     if (nread <= 0) {
 	amwait_t  wait_status;
         char *errmsg = NULL;
-	waitpid(filter->pid, &wait_status, 0);
-	if (WIFSIGNALED(wait_status)) {
-	    errmsg = g_strdup_printf("%s: terminated with signal %d",
+	if (filter->xfer) {
+	    /* the transfer is done */
+	    if (filter->xfer_errmsg) {
+		errmsg = g_strdup_printf("%s: %s", filter->name,
+					 filter->xfer_errmsg);
+		g_free(filter->xfer_errmsg);
+	    }
+	    g_source_destroy(xfer_get_source(filter->xfer));
+	    xfer_unref(filter->xfer);
+	} else {
+	    waitpid(filter->pid, &wait_status, 0);
+	    if (WIFSIGNALED(wait_status)) {
+		errmsg = g_strdup_printf("%s: terminated with signal %d",
 			filter->name, WTERMSIG(wait_status));
-	} else if (WIFEXITED(wait_status)) {
-	    if (WEXITSTATUS(wait_status) != 0) {
-		errmsg = g_strdup_printf("%s: exited with status %d",
+	    } else if (WIFEXITED(wait_status)) {
+		if (WEXITSTATUS(wait_status) != 0) {
+		    errmsg = g_strdup_printf("%s: exited with status %d",
 			filter->name, WEXITSTATUS(wait_status));
+		}
+	    } else {
+		errmsg = g_strdup_printf("%s: got bad exit", filter->name);
 	    }
-	} else {
-	    errmsg = g_strdup_printf("%s: got bad exit", filter->name);
 	}
 	if (errmsg) {
 	    g_fprintf(errf, _("? %s\n"), errmsg);
@@ -3027,7 +3046,8 @@ handle_filter_stderr(
 	    else
 		g_free(errmsg);
 	}
-	log_add(L_INFO, "pid-done %ld", (long)filter->pid);
+	if (!filter->xfer)
+	    log_add(L_INFO, "pid-done %ld", (long)filter->pid);
 
 	g_free(filter->name);
 	g_free(filter->buffer);
@@ -3220,20 +3240,20 @@ stop_dump(void)
 	    g_databuf->shm_ring_producer->mc->cancelled = TRUE;
 	    if (g_databuf->shm_ring_producer->mc->need_sem_ready) {
 		g_databuf->shm_ring_producer->mc->need_sem_ready--;
-		sem_post(g_databuf->shm_ring_producer->sem_ready);
+		shm_ring_sem_post(g_databuf->shm_ring_producer, g_databuf->shm_ring_producer->sem_ready);
 	    }
-	    sem_post(g_databuf->shm_ring_producer->sem_read);
-	    sem_post(g_databuf->shm_ring_producer->sem_write);
+	    shm_ring_sem_post(g_databuf->shm_ring_producer, g_databuf->shm_ring_producer->sem_read);
+	    shm_ring_sem_post(g_databuf->shm_ring_producer, g_databuf->shm_ring_producer->sem_write);
 	}
 	if (g_databuf->shm_ring_consumer) {
 	    g_debug("stop_dump: cancelling shm-ring-consumer");
 	    g_databuf->shm_ring_consumer->mc->cancelled = TRUE;
 	    if (g_databuf->shm_ring_consumer->mc->need_sem_ready) {
 		g_databuf->shm_ring_consumer->mc->need_sem_ready--;
-		sem_post(g_databuf->shm_ring_consumer->sem_ready);
+		shm_ring_sem_post(g_databuf->shm_ring_consumer, g_databuf->shm_ring_consumer->sem_ready);
 	    }
-	    sem_post(g_databuf->shm_ring_consumer->sem_read);
-	    sem_post(g_databuf->shm_ring_consumer->sem_write);
+	    shm_ring_sem_post(g_databuf->shm_ring_consumer, g_databuf->shm_ring_consumer->sem_read);
+	    shm_ring_sem_post(g_databuf->shm_ring_consumer, g_databuf->shm_ring_consumer->sem_write);
 	    g_debug("stop_dump done: cancelling shm-ring-consumer");
 	}
 	if (g_databuf->shm_ring_direct) {
@@ -3241,10 +3261,10 @@ stop_dump(void)
 	    g_databuf->shm_ring_direct->mc->cancelled = TRUE;
 	    if (g_databuf->shm_ring_direct->mc->need_sem_ready) {
 		g_databuf->shm_ring_direct->mc->need_sem_ready--;
-		sem_post(g_databuf->shm_ring_direct->sem_ready);
+		shm_ring_sem_post(g_databuf->shm_ring_direct, g_databuf->shm_ring_direct->sem_ready);
 	    }
-	    sem_post(g_databuf->shm_ring_direct->sem_read);
-	    sem_post(g_databuf->shm_ring_direct->sem_write);
+	    shm_ring_sem_post(g_databuf->shm_ring_direct, g_databuf->shm_ring_direct->sem_read);
+	    shm_ring_sem_post(g_databuf->shm_ring_direct, g_databuf->shm_ring_direct->sem_write);
 	}
 	// wait and kill the filters
 	if (filters) {
@@ -3277,6 +3297,11 @@ wait_filters(
 	    pid_t pid;
 	    amwait_t  retstat;
 
+	    /* a transfer is still running until it closes its fd */
+	    if (filter->xfer) {
+		alive++;
+		continue;
+	    }
 	    pid = waitpid(filter->pid, &retstat, WNOHANG);
 	    if (pid == 0)
 		alive++;
@@ -3308,7 +3333,20 @@ wait_filters(
 	}
 	for (afilter = filters; afilter != NULL; afilter = afilter->next) {
 	    filter_t *filter = afilter->data;
-	    if (kill(filter->pid, SIGTERM) < 0) {
+	    if (filter->xfer && filter->xfer_errfd >= 0) {
+		/* its messages are handled by the event loop, so it can't be
+		 * waited for here; filter_xfer_callback frees it when done */
+		g_debug("%s: cancelling the compression transfer", filter->name);
+		filter->abandoned = TRUE;
+		xfer_cancel(filter->xfer);
+		g_free(filter->name);
+		g_free(filter->buffer);
+		continue;
+	    } else if (filter->xfer) {
+		g_source_destroy(xfer_get_source(filter->xfer));
+		xfer_unref(filter->xfer);
+		g_free(filter->xfer_errmsg);
+	    } else if (kill(filter->pid, SIGTERM) < 0) {
 		if (errno != ESRCH) {
 		    g_fprintf(stderr,_("%s: can't kill '%s' command: %s\n"),
 			      get_pname(), filter->name, strerror(errno));
@@ -3347,6 +3385,9 @@ runcompress(
 
     assert(outfd >= 0);
 
+    if (comptype != COMP_SERVER_CUST && parallel_gzip_usable())
+	return runcompress_xfer(outfd, comptype, name);
+
     /* outpipe[0] is pipe's stdin, outpipe[1] is stdout. */
     if (pipe(outpipe) < 0) {
 	g_free(errstr);
@@ -3439,6 +3480,131 @@ runcompress(
     return (-1);
 }
 
+/*
+ * Called by the event loop with the messages of an in-process filter's
+ * transfer.  Closing xfer_errfd tells handle_filter_stderr it is done.
+ */
+static void
+filter_xfer_callback(
+    gpointer	data,
+    XMsg       *msg,
+    Xfer       *xfer)
+{
+    filter_t *filter = data;
+
+    switch (msg->type) {
+    case XMSG_ERROR:
+	if (!filter->xfer_errmsg)
+	    filter->xfer_errmsg = g_strdup(msg->message);
+	break;
+
+    case XMSG_DONE:
+	if (xfer->status != XFER_DONE)
+	    break;
+	aclose(filter->xfer_errfd);
+	if (filter->abandoned) {
+	    /* wait_filters gave up on it */
+	    g_source_destroy(xfer_get_source(xfer));
+	    xfer_unref(xfer);
+	    g_free(filter->xfer_errmsg);
+	    g_free(filter);
+	}
+	break;
+
+    default:
+	break;
+    }
+}
+
+/*
+ * Like runcompress, but compresses in a transfer through an
+ * xfer_filter_gzip element, on a pool of threads, instead of running
+ * COMPRESS_PATH.  The output is read by UNCOMPRESS_PATH like that of
+ * COMPRESS_PATH.  The transfer's messages are handled by the event loop; the
+ * filter's stderr pipe is closed when the transfer is done, and
+ * handle_filter_stderr then frees the transfer instead of waiting for a pid.
+ */
+static int
+runcompress_xfer(
+    int		outfd,
+    comp_t	comptype,
+    char       *name)
+{
+    int outpipe[2], rval;
+    int errpipe[2];
+    int compfd;
+    XferElement *elements[3];
+    Xfer *xfer;
+    GSource *src;
+    filter_t *filter;
+
+    if (pipe(outpipe) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("pipe: %s"), strerror(errno));
+	return (-1);
+    }
+
+    if (pipe(errpipe) < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("pipe: %s"), strerror(errno));
+	aclose(outpipe[0]);
+	aclose(outpipe[1]);
+	return (-1);
+    }
+
+    /* the transfer writes to the original outfd, the dumper to the pipe */
+    compfd = dup(outfd);
+    if (compfd < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("couldn't dup: %s"), strerror(errno));
+	aclose(outpipe[0]);
+	aclose(outpipe[1]);
+	aclose(errpipe[0]);
+	aclose(errpipe[1]);
+	return (-1);
+    }
+    rval = dup2(outpipe[1], outfd);
+    if (rval < 0) {
+	g_free(errstr);
+	errstr = g_strdup_printf(_("couldn't dup2: %s"), strerror(errno));
+    }
+    aclose(outpipe[1]);
+
+    g_debug("compressing in-process (%s)",
+	    comptype == COMP_BEST ? COMPRESS_BEST_OPT : COMPRESS_FAST_OPT);
+
+    /* the elements keep their own copy of the fds */
+    elements[0] = xfer_source_fd(outpipe[0]);
+    elements[1] = xfer_filter_gzip((comptype == COMP_BEST) ? 9 : 1, 0);
+    elements[2] = xfer_dest_fd(compfd);
+    xfer = xfer_new(elements, 3);
+    g_object_unref(elements[0]);
+    g_object_unref(elements[1]);
+    g_object_unref(elements[2]);
+    aclose(outpipe[0]);
+    aclose(compfd);
+
+    filter = g_new0(filter_t, 1);
+    filter->fd = errpipe[0];
+    filter->name = g_strdup(name);
+    filter->xfer = xfer;
+    filter->xfer_errfd = errpipe[1];
+    filters = g_slist_append(filters, filter);
+    filter->event = event_create((event_id_t)filter->fd, EV_READFD,
+				 handle_filter_stderr, filter);
+    event_activate(filter->event);
+
+    /* this may be called from the shm thread; the source is attached once
+     * the transfer is started, so its messages are all handled by the event
+     * loop */
+    xfer_start(xfer, 0, 0);
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)filter_xfer_callback, filter, NULL);
+    g_source_attach(src, NULL);
+
+    return (rval);
+}
+
 /*
  * Runs encrypt with the first arg as its stdout.  Returns
  * 0 on success or negative if error, and it's pid via the second
@@ -53,6 +53,58 @@ static gboolean logfile_has_tape(char * label, char * datestamp,
 static char *find_sort_order = NULL;
 static GStringChunk *string_chunk = NULL;
 
+/*
+ * The find catalogue
+ *
+ * Parsing every logfile on each find is slow once years of logs are kept.
+ * What search_logfile gets out of a logfile depends only on its contents,
+ * except for the volumes that are still valid in the tapelist and the disks
+ * in the disklist.  So each logfile is parsed once as if every volume and
+ * disk matched, and the results are kept in <logdir>/find.catalog, along
+ * with the volumes and disks that were checked.  A search then only has to
+ * check these against the tapelist and disklist.  If one of the volumes is
+ * no longer valid, the logfile is parsed as before.
+ *
+ * The catalogue is appended to, under <logdir>/find.catalog.lock, when a
+ * logfile is rolled (see log_rename) or searched for the first time, and
+ * rewritten without the logfiles that no longer exist once enough of it is
+ * stale.  The logfile that <logdir>/log points to is still being written and
+ * is left out.  The catalogue is a text file: a FIND_CATALOG_HEADER line,
+ * then for each logfile
+ *
+ *   LOG <logfile> <datestamp> <size> <mtime>
+ *   LABEL <label> <datestamp>		one per volume
+ *   DISK <host> <disk>			one per disk
+ *   DUMP <find_result_t fields>	one per result, in search_logfile order
+ *   END
+ *
+ * with strings quoted, and "-" for NULL.  A section is used only if the
+ * size and mtime of the logfile still match.
+ */
+
+#define FIND_CATALOG_NAME	"find.catalog"
+#define FIND_CATALOG_HEADER	"AMANDA FIND CATALOG 1"
+
+typedef struct find_catalog_log_s {
+    char *key;			/* "<logfile> <datestamp>" */
+    char *logname;		/* basename of the logfile */
+    char *datestamp;		/* as passed to search_logfile, may be NULL */
+    off_t size;
+    time_t mtime;
+    GPtrArray *labels;		/* label, datestamp, label, datestamp, ... */
+    GPtrArray *disks;		/* host, disk, host, disk, ... */
+    GPtrArray *results;		/* find_result_t *, in output order */
+    GHashTable *seen;		/* "host\ndisk" in disks, while parsing */
+} find_catalog_log_t;
+
+static char *find_catalog_dir = NULL;
+static GHashTable *find_catalog = NULL;	/* key -> find_catalog_log_t */
+
+static gboolean parse_logfile(find_result_t **output_find, const char *label,
+			      const char *passed_datestamp, const char *logfile,
+			      disklist_t *dynamic_disklist, int added_todo,
+			      find_catalog_log_t *catalog);
+
 find_result_t *
 find_dump(
     disklist_t *diskqp,
@@ -827,16 +879,667 @@ volume_matches(
     return TRUE;
 }
 
+static char *
+find_catalog_intern(
+    const char *str)
+{
+    if (!str)
+	return NULL;
+    if (string_chunk == NULL)
+	string_chunk = g_string_chunk_new(32768);
+    return g_string_chunk_insert_const(string_chunk, str);
+}
+
+static find_catalog_log_t *
+find_catalog_log_new(
+    const char *logname,
+    const char *datestamp,
+    off_t	size,
+    time_t	mtime)
+{
+    find_catalog_log_t *log = g_new0(find_catalog_log_t, 1);
+
+    log->logname = g_strdup(logname);
+    log->datestamp = g_strdup(datestamp);
+    log->key = g_strconcat(logname, " ", datestamp ? datestamp : "-", NULL);
+    log->size = size;
+    log->mtime = mtime;
+    log->labels = g_ptr_array_new();
+    log->disks = g_ptr_array_new();
+    log->results = g_ptr_array_new();
+
+    return log;
+}
+
+static void
+find_catalog_log_free(
+    gpointer data)
+{
+    find_catalog_log_t *log = data;
+    guint i;
+
+    /* the strings are all in string_chunk */
+    for (i = 0; i < log->results->len; i++)
+	g_free(g_ptr_array_index(log->results, i));
+    g_ptr_array_free(log->results, TRUE);
+    g_ptr_array_free(log->disks, TRUE);
+    g_ptr_array_free(log->labels, TRUE);
+    if (log->seen)
+	g_hash_table_destroy(log->seen);
+    g_free(log->key);
+    g_free(log->logname);
+    g_free(log->datestamp);
+    g_free(log);
+}
+
+/*
+ * Record that host:disk was checked against the disklist.  Only the first
+ * check matters, since that is when search_logfile adds a missing disk.
+ */
+static void
+find_catalog_add_disk(
+    find_catalog_log_t *log,
+    const char *host,
+    const char *disk)
+{
+    char *key = g_strconcat(host, "\n", disk, NULL);
+
+    if (g_hash_table_lookup(log->seen, key)) {
+	g_free(key);
+	return;
+    }
+    g_hash_table_insert(log->seen, key, GINT_TO_POINTER(1));
+    g_ptr_array_add(log->disks, find_catalog_intern(host));
+    g_ptr_array_add(log->disks, find_catalog_intern(disk));
+}
+
+static void
+find_catalog_put_string(
+    GString *	text,
+    const char *str)
+{
+    char *qstr;
+
+    if (!str) {
+	g_string_append(text, " -");
+	return;
+    }
+    qstr = quote_string_always(str);
+    g_string_append_c(text, ' ');
+    g_string_append(text, qstr);
+    g_free(qstr);
+}
+
+static void
+find_catalog_put_crc(
+    GString *	text,
+    crc_t *	crc)
+{
+    g_string_append_printf(text, " %08x:%lld", crc->crc, (long long)crc->size);
+}
+
+static void
+find_catalog_format(
+    GString *		text,
+    find_catalog_log_t *log)
+{
+    char sec[G_ASCII_DTOSTR_BUF_SIZE];
+    guint i;
+
+    g_string_append(text, "LOG");
+    find_catalog_put_string(text, log->logname);
+    find_catalog_put_string(text, log->datestamp);
+    g_string_append_printf(text, " %lld %lld\n",
+			   (long long)log->size, (long long)log->mtime);
+
+    for (i = 0; i + 1 < log->labels->len; i += 2) {
+	g_string_append(text, "LABEL");
+	find_catalog_put_string(text, g_ptr_array_index(log->labels, i));
+	find_catalog_put_string(text, g_ptr_array_index(log->labels, i + 1));
+	g_string_append_c(text, '\n');
+    }
+
+    for (i = 0; i + 1 < log->disks->len; i += 2) {
+	g_string_append(text, "DISK");
+	find_catalog_put_string(text, g_ptr_array_index(log->disks, i));
+	find_catalog_put_string(text, g_ptr_array_index(log->disks, i + 1));
+	g_string_append_c(text, '\n');
+    }
+
+    for (i = 0; i < log->results->len; i++) {
+	find_result_t *r = g_ptr_array_index(log->results, i);
+
+	g_string_append(text, "DUMP");
+	find_catalog_put_string(text, r->timestamp);
+	find_catalog_put_string(text, r->write_timestamp);
+	find_catalog_put_string(text, r->hostname);
+	find_catalog_put_string(text, r->diskname);
+	find_catalog_put_string(text, r->storage);
+	find_catalog_put_string(text, r->pool);
+	g_string_append_printf(text, " %d", r->level);
+	find_catalog_put_string(text, r->label);
+	g_string_append_printf(text, " %lld", (long long)r->filenum);
+	find_catalog_put_string(text, r->status);
+	find_catalog_put_string(text, r->dump_status);
+	find_catalog_put_string(text, r->message);
+	g_string_append_printf(text, " %d %d %s %lld %lld %lld",
+			       r->partnum, r->totalparts,
+			       g_ascii_dtostr(sec, sizeof(sec), r->sec),
+			       (long long)r->bytes, (long long)r->kb,
+			       (long long)r->orig_kb);
+	find_catalog_put_crc(text, &r->native_crc);
+	find_catalog_put_crc(text, &r->client_crc);
+	find_catalog_put_crc(text, &r->server_crc);
+	g_string_append_c(text, '\n');
+    }
+
+    g_string_append(text, "END\n");
+}
+
+/*
+ * Return the next space-separated, possibly quoted, word of *sp, in place,
+ * or NULL at the end of the line.
+ */
+static char *
+find_catalog_word(
+    char **sp)
+{
+    char *s = *sp;
+    char *word;
+    int ch;
+
+    ch = *s++;
+    skip_whitespace(s, ch);
+    if (ch == '\0')
+	return NULL;
+    word = s - 1;
+    skip_quoted_string(s, ch);
+    s[-1] = '\0';
+    *sp = (ch == '\0') ? s - 1 : s;
+    return word;
+}
+
+static gboolean
+find_catalog_get_string(
+    char **	sp,
+    char **	str)
+{
+    char *word = find_catalog_word(sp);
+    char *ustr;
+
+    if (!word)
+	return FALSE;
+    if (g_str_equal(word, "-")) {
+	*str = NULL;
+	return TRUE;
+    }
+    ustr = unquote_string(word);
+    *str = find_catalog_intern(ustr);
+    g_free(ustr);
+    return TRUE;
+}
+
+static gboolean
+find_catalog_get_int(
+    char **	sp,
+    gint64 *	val)
+{
+    char *word = find_catalog_word(sp);
+    char *end;
+
+    if (!word)
+	return FALSE;
+    *val = g_ascii_strtoll(word, &end, 10);
+    return *end == '\0';
+}
+
+static gboolean
+find_catalog_get_crc(
+    char **	sp,
+    crc_t *	crc)
+{
+    char *word = find_catalog_word(sp);
+
+    if (!word)
+	return FALSE;
+    parse_crc(word, crc);
+    return TRUE;
+}
+
+static find_result_t *
+find_catalog_get_result(
+    char *	s)
+{
+    find_result_t *r = g_new0(find_result_t, 1);
+    char *word;
+    gint64 level, filenum, partnum, totalparts, bytes, kb, orig_kb;
+
+    if (!find_catalog_get_string(&s, &r->timestamp) ||
+	!find_catalog_get_string(&s, &r->write_timestamp) ||
+	!find_catalog_get_string(&s, &r->hostname) ||
+	!find_catalog_get_string(&s, &r->diskname) ||
+	!find_catalog_get_string(&s, &r->storage) ||
+	!find_catalog_get_string(&s, &r->pool) ||
+	!find_catalog_get_int(&s, &level) ||
+	!find_catalog_get_string(&s, &r->label) ||
+	!find_catalog_get_int(&s, &filenum) ||
+	!find_catalog_get_string(&s, &r->status) ||
+	!find_catalog_get_string(&s, &r->dump_status) ||
+	!find_catalog_get_string(&s, &r->message) ||
+	!find_catalog_get_int(&s, &partnum) ||
+	!find_catalog_get_int(&s, &totalparts) ||
+	(word = find_catalog_word(&s)) == NULL ||
+	!find_catalog_get_int(&s, &bytes) ||
+	!find_catalog_get_int(&s, &kb) ||
+	!find_catalog_get_int(&s, &orig_kb) ||
+	!find_catalog_get_crc(&s, &r->native_crc) ||
+	!find_catalog_get_crc(&s, &r->client_crc) ||
+	!find_catalog_get_crc(&s, &r->server_crc)) {
+	g_free(r);
+	return NULL;
+    }
+
+    r->level = level;
+    r->filenum = filenum;
+    r->partnum = partnum;
+    r->totalparts = totalparts;
+    r->sec = g_ascii_strtod(word, NULL);
+    r->bytes = bytes;
+    r->kb = kb;
+    r->orig_kb = orig_kb;
+
+    return r;
+}
+
+static int
+find_catalog_lock(void)
+{
+    char *lockname;
+    int lockfd;
+
+    lockname = g_strconcat(find_catalog_dir, "/", FIND_CATALOG_NAME, ".lock",
+			   NULL);
+    lockfd = open(lockname, O_RDWR | O_CREAT, 0600);
+    g_free(lockname);
+    if (lockfd < 0)
+	return -1;
+    if (amflock(lockfd, "find.catalog") != 0) {
+	close(lockfd);
+	return -1;
+    }
+    return lockfd;
+}
+
+static void
+find_catalog_unlock(
+    int lockfd)
+{
+    if (lockfd < 0)
+	return;
+    amfunlock(lockfd, "find.catalog");
+    close(lockfd);
+}
+
+static void
+format_catalog_log(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data)
+{
+    find_catalog_format((GString *)user_data, (find_catalog_log_t *)value);
+}
+
+/*
+ * Rewrite the catalogue with only the live sections.  Must be called with
+ * the lock held.
+ */
+static void
+find_catalog_rewrite(void)
+{
+    char *filename;
+    char *newfilename;
+    GString *text;
+    int fd;
+    gboolean ok;
+
+    filename = g_strconcat(find_catalog_dir, "/", FIND_CATALOG_NAME, NULL);
+    newfilename = g_strconcat(filename, ".new", NULL);
+
+    text = g_string_new(FIND_CATALOG_HEADER "\n");
+    g_hash_table_foreach(find_catalog, format_catalog_log, text);
+
+    fd = open(newfilename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd >= 0) {
+	ok = full_write(fd, text->str, text->len) == text->len;
+	ok = (close(fd) == 0) && ok;
+	if (!ok || rename(newfilename, filename) != 0) {
+	    g_debug("could not rewrite %s: %s", filename, strerror(errno));
+	    unlink(newfilename);
+	}
+    }
+
+    g_string_free(text, TRUE);
+    g_free(newfilename);
+    g_free(filename);
+}
+
+static gboolean
+catalog_log_is_gone(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data)
+{
+    find_catalog_log_t *log = value;
+    char *logfile = g_strconcat(find_catalog_dir, "/", log->logname, NULL);
+    struct stat stat_buf;
+    gboolean gone;
+
+    gone = (stat(logfile, &stat_buf) != 0);
+    g_free(logfile);
+    if (gone)
+	(*(int *)user_data)++;
+    return gone;
+}
+
+/*
+ * Read the catalogue of the logfiles in dir, unless it is already loaded.
+ */
+static void
+find_catalog_load(
+    const char *dir)
+{
+    char *filename;
+    FILE *catf;
+    char *line;
+    char *s;
+    char *word;
+    find_catalog_log_t *log = NULL;
+    int lockfd;
+    int stale = 0;
+
+    if (find_catalog_dir && g_str_equal(find_catalog_dir, dir))
+	return;
+
+    if (find_catalog)
+	g_hash_table_destroy(find_catalog);
+    g_free(find_catalog_dir);
+    find_catalog_dir = g_strdup(dir);
+    find_catalog = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					 find_catalog_log_free);
+
+    lockfd = find_catalog_lock();
+    filename = g_strconcat(dir, "/", FIND_CATALOG_NAME, NULL);
+    catf = fopen(filename, "r");
+    g_free(filename);
+    if (!catf) {
+	find_catalog_unlock(lockfd);
+	return;
+    }
+
+    line = agets(catf);
+    if (!line || !g_str_equal(line, FIND_CATALOG_HEADER)) {
+	/* written by another version; start over */
+	g_free(line);
+	afclose(catf);
+	if (lockfd >= 0)
+	    find_catalog_rewrite();
+	find_catalog_unlock(lockfd);
+	return;
+    }
+    g_free(line);
+
+    while ((line = agets(catf)) != NULL) {
+	char *str1, *str2;
+	gint64 size, mtime;
+	gboolean ok = TRUE;
+
+	s = line;
+	word = find_catalog_word(&s);
+	if (!word) {
+	    ok = FALSE;
+	} else if (g_str_equal(word, "LOG")) {
+	    if (log)
+		find_catalog_log_free(log);
+	    log = NULL;
+	    if (find_catalog_get_string(&s, &str1) && str1 &&
+		find_catalog_get_string(&s, &str2) &&
+		find_catalog_get_int(&s, &size) &&
+		find_catalog_get_int(&s, &mtime)) {
+		log = find_catalog_log_new(str1, str2, size, mtime);
+	    } else {
+		stale++;
+	    }
+	} else if (!log) {
+	    /* the rest of a section that is being skipped */
+	} else if (g_str_equal(word, "LABEL") || g_str_equal(word, "DISK")) {
+	    GPtrArray *pairs = (*word == 'L') ? log->labels : log->disks;
+
+	    if (find_catalog_get_string(&s, &str1) &&
+		find_catalog_get_string(&s, &str2)) {
+		g_ptr_array_add(pairs, str1);
+		g_ptr_array_add(pairs, str2);
+	    } else {
+		ok = FALSE;
+	    }
+	} else if (g_str_equal(word, "DUMP")) {
+	    find_result_t *r = find_catalog_get_result(s);
+
+	    if (r)
+		g_ptr_array_add(log->results, r);
+	    else
+		ok = FALSE;
+	} else if (g_str_equal(word, "END")) {
+	    if (g_hash_table_lookup(find_catalog, log->key))
+		stale++;
+	    g_hash_table_replace(find_catalog, log->key, log);
+	    log = NULL;
+	} else {
+	    ok = FALSE;
+	}
+
+	if (!ok && log) {
+	    find_catalog_log_free(log);
+	    log = NULL;
+	    stale++;
+	}
+	g_free(line);
+    }
+    if (log) {
+	/* a section that was never finished */
+	find_catalog_log_free(log);
+	stale++;
+    }
+    afclose(catf);
+
+    g_hash_table_foreach_remove(find_catalog, catalog_log_is_gone, &stale);
+
+    if (lockfd >= 0 && stale > 0 &&
+	stale * 4 >= (int)g_hash_table_size(find_catalog))
+	find_catalog_rewrite();
+    find_catalog_unlock(lockfd);
+}
+
+static void
+find_catalog_append(
+    find_catalog_log_t *log)
+{
+    char *filename;
+    struct stat stat_buf;
+    GString *text;
+    int lockfd;
+    int fd;
+
+    lockfd = find_catalog_lock();
+    if (lockfd < 0)
+	return;
+
+    filename = g_strconcat(find_catalog_dir, "/", FIND_CATALOG_NAME, NULL);
+    fd = open(filename, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd < 0) {
+	g_debug("could not open %s: %s", filename, strerror(errno));
+    } else {
+	text = g_string_new(NULL);
+	if (fstat(fd, &stat_buf) == 0 && stat_buf.st_size == 0)
+	    g_string_append(text, FIND_CATALOG_HEADER "\n");
+	find_catalog_format(text, log);
+	if (full_write(fd, text->str, text->len) != text->len)
+	    g_debug("could not write %s: %s", filename, strerror(errno));
+	close(fd);
+	g_string_free(text, TRUE);
+    }
+
+    g_free(filename);
+    find_catalog_unlock(lockfd);
+}
+
+/*
+ * Is logfile the one that the "log" symlink of its directory points to, which
+ * amdump is still writing?
+ */
+static gboolean
+find_catalog_is_current(
+    const char *logfile,
+    const char *logname)
+{
+    char *dir = g_path_get_dirname(logfile);
+    char *link = g_strconcat(dir, "/log", NULL);
+    char target[PATH_MAX];
+    const char *base;
+    ssize_t len;
+    gboolean current = FALSE;
+
+    len = readlink(link, target, sizeof(target) - 1);
+    if (len > 0) {
+	target[len] = '\0';
+	base = strrchr(target, '/');
+	base = base ? base + 1 : target;
+	current = g_str_equal(base, logname);
+    }
+    g_free(link);
+    g_free(dir);
+    return current;
+}
+
+/*
+ * Return the catalogue section for logfile and datestamp, parsing the logfile
+ * and adding the section if it is missing or out of date.  Returns NULL if
+ * the logfile is not one that is cached.
+ */
+static find_catalog_log_t *
+find_catalog_get(
+    const char *logfile,
+    const char *datestamp)
+{
+    const char *logname;
+    struct stat stat_buf;
+    find_catalog_log_t *log;
+    find_result_t *results = NULL;
+    find_result_t *r;
+    char *dir;
+    char *key;
+
+    logname = strrchr(logfile, '/');
+    logname = logname ? logname + 1 : logfile;
+
+    /* the current logfile is still being written */
+    if (!g_str_has_prefix(logname, "log.") ||
+	find_catalog_is_current(logfile, logname))
+	return NULL;
+    if (stat(logfile, &stat_buf) != 0)
+	return NULL;
+
+    dir = g_path_get_dirname(logfile);
+    find_catalog_load(dir);
+    g_free(dir);
+
+    key = g_strconcat(logname, " ", datestamp ? datestamp : "-", NULL);
+    log = g_hash_table_lookup(find_catalog, key);
+    g_free(key);
+    if (log && log->size == stat_buf.st_size &&
+	log->mtime == stat_buf.st_mtime)
+	return log;
+
+    log = find_catalog_log_new(logname, datestamp, stat_buf.st_size,
+			       stat_buf.st_mtime);
+    log->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    parse_logfile(&results, NULL, datestamp, logfile, NULL, 0, log);
+    g_hash_table_destroy(log->seen);
+    log->seen = NULL;
+    for (r = results; r != NULL; r = r->next)
+	g_ptr_array_add(log->results, r);
+
+    g_hash_table_replace(find_catalog, log->key, log);
+    find_catalog_append(log);
+
+    return log;
+}
+
+/*
+ * Add the dumps of a catalogue section to output_find, as parse_logfile would
+ * have.  Returns FALSE if the section can't be used because one of its
+ * volumes is no longer valid.
+ */
+static gboolean
+find_catalog_apply(
+    find_catalog_log_t *log,
+    find_result_t **output_find,
+    disklist_t *dynamic_disklist,
+    int added_todo,
+    gboolean *found_something)
+{
+    guint i;
+
+    for (i = 0; i + 1 < log->labels->len; i += 2) {
+	if (!volume_matches(NULL, g_ptr_array_index(log->labels, i),
+			    g_ptr_array_index(log->labels, i + 1)))
+	    return FALSE;
+    }
+
+    for (i = 0; i + 1 < log->disks->len; i += 2) {
+	char *host = g_ptr_array_index(log->disks, i);
+	char *disk = g_ptr_array_index(log->disks, i + 1);
+	disk_t *dp;
+
+	dp = lookup_disk(host, disk);
+	if (dp == NULL && dynamic_disklist != NULL) {
+	    dp = add_disk(dynamic_disklist, host, disk);
+	    dp->todo = added_todo;
+	}
+    }
+
+    /* prepend in reverse, so the results end up in output order */
+    *found_something = FALSE;
+    for (i = log->results->len; i > 0; i--) {
+	find_result_t *r = g_ptr_array_index(log->results, i - 1);
+	find_result_t *new_output_find;
+
+	if (!find_match(r->hostname, r->diskname))
+	    continue;
+	new_output_find = g_new(find_result_t, 1);
+	*new_output_find = *r;
+	new_output_find->next = *output_find;
+	*output_find = new_output_find;
+	*found_something = TRUE;
+    }
+
+    return TRUE;
+}
+
 /* WARNING: Function accesses globals find_diskqp, curlog, curlog, curstr,
- * dynamic_disklist */
-gboolean
-search_logfile(
+ * dynamic_disklist
+ *
+ * If catalog is not NULL, every volume and every disk matches, and the
+ * volumes and disks that were checked are recorded in catalog instead.
+ */
+static gboolean
+parse_logfile(
     find_result_t **output_find,
     const char *label,
     const char *passed_datestamp,
     const char *logfile,
     disklist_t * dynamic_disklist,
-    int added_todo)
+    int added_todo,
+    find_catalog_log_t *catalog)
 {
     FILE *logf;
     char *host = NULL;
@@ -920,7 +1623,15 @@ search_logfile(
                 }
             }
 
-            right_label = volume_matches(label, ck_label, ck_datestamp);
+	    if (catalog) {
+		right_label = TRUE;
+		if (ck_label) {
+		    g_ptr_array_add(catalog->labels, find_catalog_intern(ck_label));
+		    g_ptr_array_add(catalog->labels, find_catalog_intern(ck_datestamp));
+		}
+	    } else {
+		right_label = volume_matches(label, ck_label, ck_datestamp);
+	    }
 	    if (right_label && ck_label) {
 		g_hash_table_insert(valid_label, g_strdup(ck_label),
 				    GINT_TO_POINTER(1));
@@ -1294,16 +2005,20 @@ search_logfile(
 	    if (g_str_has_prefix(rest, "error")) rest += 6;
 	    if (g_str_has_prefix(rest, "config")) rest += 7;
 
-	    dp = lookup_disk(host,disk);
-	    if ( dp == NULL ) {
-		if (dynamic_disklist == NULL) {
-		    amfree(disk);
-		    continue;
+	    if (catalog) {
+		find_catalog_add_disk(catalog, host, disk);
+	    } else {
+		dp = lookup_disk(host,disk);
+		if ( dp == NULL ) {
+		    if (dynamic_disklist == NULL) {
+			amfree(disk);
+			continue;
+		    }
+		    dp = add_disk(dynamic_disklist, host, disk);
+		    dp->todo = added_todo;
 		}
-		dp = add_disk(dynamic_disklist, host, disk);
-		dp->todo = added_todo;
 	    }
-            if (find_match(host, disk)) {
+            if (catalog || find_match(host, disk)) {
 		if(curprog == P_TAPER) {
 		    char *key = g_strdup_printf(
 					"HOST:%s DISK:%s: DATE:%s LEVEL:%d",
@@ -1507,6 +2222,55 @@ search_logfile(
     return found_something;
 }
 
+gboolean
+search_logfile(
+    find_result_t **output_find,
+    const char *label,
+    const char *passed_datestamp,
+    const char *logfile,
+    disklist_t * dynamic_disklist,
+    int added_todo)
+{
+    find_catalog_log_t *log;
+    gboolean found_something;
+
+    g_return_val_if_fail(output_find != NULL, 0);
+    g_return_val_if_fail(logfile != NULL, 0);
+
+    if (label == NULL) {
+	log = find_catalog_get(logfile, passed_datestamp);
+	if (log && find_catalog_apply(log, output_find, dynamic_disklist,
+				      added_todo, &found_something))
+	    return found_something;
+    }
+
+    return parse_logfile(output_find, label, passed_datestamp, logfile,
+			 dynamic_disklist, added_todo, NULL);
+}
+
+void
+find_catalog_add_log(
+    const char *logfile)
+{
+    const char *logname;
+    char *datestamp;
+    char *dot;
+
+    logname = strrchr(logfile, '/');
+    logname = logname ? logname + 1 : logfile;
+    if (!g_str_has_prefix(logname, "log."))
+	return;
+
+    /* find_dump passes the datestamp from the name, the perl code NULL */
+    datestamp = g_strdup(logname + 4);
+    dot = strchr(datestamp, '.');
+    if (dot)
+	*dot = '\0';
+    find_catalog_get(logfile, datestamp);
+    find_catalog_get(logfile, NULL);
+    g_free(datestamp);
+}
+
 
 /*
  * Return the set of dumps that match *all* of the given patterns (we consider
@@ -1673,39 +2437,37 @@ dump_exist(
     return(NULL);
 }
 
+/*
+ * The dump hash is keyed by "host\ndisk\ntimestamp\nlevel"; if several
+ * results have the same key, the last one in output_find wins.
+ */
+static char *
+dump_hash_key(
+    char *hostname,
+    char *diskname,
+    char *timestamp,
+    int level)
+{
+    return g_strdup_printf("%s\n%s\n%s\n%d", hostname, diskname, timestamp,
+			   level);
+}
+
 GHashTable *
 make_dump_hash(
     find_result_t *output_find)
 {
     find_result_t *output_find_result;
-    GHashTable *dump_hash = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
-    GHashTable *host_hash;
-    GHashTable *disk_hash;
-    GHashTable *time_hash;
+    GHashTable *dump_hash = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 
     for (output_find_result=output_find;
          output_find_result;
          output_find_result=output_find_result->next) {
-
-	host_hash = g_hash_table_lookup(dump_hash, output_find_result->hostname);
-	if (!host_hash) {
-	    host_hash = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
-	    g_hash_table_insert(dump_hash, output_find_result->hostname, host_hash);
-	}
-
-	disk_hash = g_hash_table_lookup(host_hash, output_find_result->diskname);
-	if (!disk_hash) {
-	    disk_hash = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_hash_table_destroy);
-	    g_hash_table_insert(host_hash, output_find_result->diskname, disk_hash);
-	}
-
-	time_hash = g_hash_table_lookup(disk_hash, output_find_result->timestamp);
-	if (!time_hash) {
-	    time_hash = g_hash_table_new(g_int_hash, g_int_equal);
-	    g_hash_table_insert(disk_hash, output_find_result->timestamp, time_hash);
-	}
-
-	g_hash_table_insert(time_hash, &output_find_result->level, output_find_result);
+	g_hash_table_replace(dump_hash,
+			     dump_hash_key(output_find_result->hostname,
+					   output_find_result->diskname,
+					   output_find_result->timestamp,
+					   output_find_result->level),
+			     output_find_result);
     }
 
     return dump_hash;
@@ -1720,27 +2482,16 @@ dump_hash_exist(
     char *timestamp,
     int level)
 {
-    GHashTable *host_hash;
-    GHashTable *disk_hash;
-    GHashTable *time_hash;
     find_result_t *output_find_result;
+    char *key = dump_hash_key(hostname, diskname, timestamp, level);
 
-    host_hash = g_hash_table_lookup(dump_hash, hostname);
-    if (!host_hash) return NULL;
-
-    disk_hash = g_hash_table_lookup(host_hash, diskname);
-    if (!disk_hash) return NULL;
-
-    time_hash = g_hash_table_lookup(disk_hash, timestamp);
-    if (!time_hash) return NULL;
-
-    output_find_result = g_hash_table_lookup(time_hash, &level);
+    output_find_result = g_hash_table_lookup(dump_hash, key);
+    g_free(key);
 
     return output_find_result;
 }
 
-void free_dump_hash(GHashTable *dump_hash G_GNUC_UNUSED)
+void free_dump_hash(GHashTable *dump_hash)
 {
-    //It fail on some machine
-    //g_hash_table_destroy(dump_hash);
+    g_hash_table_destroy(dump_hash);
 }
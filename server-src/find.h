@@ -78,6 +78,14 @@ gboolean search_logfile(find_result_t **output_find, const char *volume_label,
                         const char *log_datestamp, const char *logfile,
                         disklist_t * dynamic_disklist, int added_todo);
 
+/* Searches without a volume_label are answered from the find catalogue in
+ * the logdir, which holds the parsed contents of each rolled logfile.  This
+ * function adds logfile to the catalogue, so that the next search doesn't
+ * have to parse it.  It is called by log_rename.
+ * * logfile          : Path of a rolled log.xxx file.
+ */
+void find_catalog_add_log(const char *logfile);
+
 /* return all dumps on holding disk; not really a search at all.
  *
  * * output_find      : Put found dumps here.
@@ -91,6 +99,7 @@ void search_holding_disk(
 	disklist_t * dynamic_disklist,
 	int added_todo);
 
+/* Index output_find by host, disk, timestamp and level, for dump_hash_exist */
 GHashTable *make_dump_hash(find_result_t *output_find);
 void free_dump_hash(GHashTable *dump_hash);
 find_result_t *dump_hash_exist(GHashTable *dump_hash, char *hostname, char *diskname,
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+/* index_sort.c is built into this test with INDEX_SORT_RUN_SIZE and
+ * INDEX_SORT_MERGE_WAYS small enough that a few hundred Kbytes of lines are
+ * sorted in many runs and merged in several passes. */
+
+#include "amanda.h"
+#include "testutils.h"
+#include "simpleprng.h"
+#include "index_sort.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+#define TEST_DIR "./index-sort-test.tmp"
+#define TEST_SRC TEST_DIR "/src"
+#define TEST_DEST TEST_DIR "/dest"
+
+/*
+ * Utilities
+ */
+
+static int
+cmp_lines(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* NB_LINES index lines, mostly paths, with bytes above 0x7f and mixed case so
+ * that only a byte-order sort gets them right; some are duplicates and some
+ * have no '/'.  Returns a NULL-terminated vector. */
+static char **
+make_lines(
+    guint   nb_lines,
+    guint32 seed)
+{
+    static const char *parts[] = {
+	"usr", "Usr", "lib", "LIB", "etc", "a", "B", "_", "z z",
+	"\xc3\xa9t\xc3\xa9", "\xe2\x82\xac", "0", "9", "-"
+    };
+    simpleprng_state_t prng;
+    char **lines = g_new0(char *, nb_lines + 1);
+    guint i;
+
+    simpleprng_seed(&prng, seed);
+    for (i = 0; i < nb_lines; i++) {
+	GString *line = g_string_new("");
+	guint depth = simpleprng_rand(&prng) % 5;
+	guint j;
+
+	if (i > 0 && simpleprng_rand(&prng) % 20 == 0) {
+	    lines[i] = g_strdup(lines[simpleprng_rand(&prng) % i]);
+	    g_string_free(line, TRUE);
+	    continue;
+	}
+	if (simpleprng_rand(&prng) % 50 != 0)
+	    g_string_append_c(line, '/');
+	for (j = 0; j <= depth; j++) {
+	    g_string_append(line,
+		parts[simpleprng_rand(&prng) % G_N_ELEMENTS(parts)]);
+	    if (j < depth || simpleprng_rand(&prng) % 3 == 0)
+		g_string_append_c(line, '/');
+	}
+	g_string_append_printf(line, "%u", simpleprng_rand(&prng) % 1000);
+	lines[i] = g_string_free(line, FALSE);
+    }
+    return lines;
+}
+
+static gboolean
+write_lines(
+    char     *filename,
+    char    **lines,
+    gboolean  compressed)
+{
+    char *data = g_strjoinv("\n", lines);
+    char *text = lines[0] ? g_strconcat(data, "\n", NULL) : g_strdup("");
+    gboolean ok;
+
+    g_free(data);
+#ifdef HAVE_LIBZ
+    if (compressed) {
+	gzFile gz = gzopen(filename, "wb");
+
+	ok = gz && gzwrite(gz, text, strlen(text)) == (int)strlen(text);
+	if (gz && gzclose(gz) != Z_OK)
+	    ok = FALSE;
+	g_free(text);
+	return ok;
+    }
+#else
+    g_assert(!compressed);
+#endif
+    ok = g_file_set_contents(filename, text, -1, NULL);
+    g_free(text);
+    return ok;
+}
+
+static char *
+read_text(
+    char     *filename,
+    gboolean  compressed)
+{
+    char *text = NULL;
+
+#ifdef HAVE_LIBZ
+    if (compressed) {
+	GString *s = g_string_new("");
+	gzFile gz = gzopen(filename, "rb");
+	char buf[8192];
+	int n;
+
+	if (!gz) {
+	    g_string_free(s, TRUE);
+	    return NULL;
+	}
+	while ((n = gzread(gz, buf, sizeof(buf))) > 0)
+	    g_string_append_len(s, buf, n);
+	gzclose(gz);
+	return g_string_free(s, FALSE);
+    }
+#else
+    g_assert(!compressed);
+#endif
+    if (!g_file_get_contents(filename, &text, NULL, NULL))
+	return NULL;
+    return text;
+}
+
+/* Check that FILENAME holds LINES, less those without a '/' if ONLY_PATHS,
+ * in byte order */
+static gboolean
+check_sorted(
+    char     *filename,
+    gboolean  compressed,
+    char    **lines,
+    gboolean  only_paths)
+{
+    GPtrArray *expect = g_ptr_array_new();
+    GString *want = g_string_new("");
+    char *got = read_text(filename, compressed);
+    gboolean ok;
+    guint i;
+
+    for (i = 0; lines[i] != NULL; i++) {
+	if (!only_paths || strchr(lines[i], '/'))
+	    g_ptr_array_add(expect, lines[i]);
+    }
+    g_ptr_array_sort(expect, cmp_lines);
+    for (i = 0; i < expect->len; i++) {
+	g_string_append(want, g_ptr_array_index(expect, i));
+	g_string_append_c(want, '\n');
+    }
+
+    ok = got != NULL && g_str_equal(got, want->str);
+    if (!ok && got) {
+	char *a = got, *b = want->str;
+
+	while (*a && *a == *b) {
+	    a++;
+	    b++;
+	}
+	tu_dbg("%s differs at byte %zu of %zu\n", filename,
+	       (size_t)(a - got), want->len);
+    }
+
+    g_free(got);
+    g_string_free(want, TRUE);
+    g_ptr_array_free(expect, TRUE);
+    return ok;
+}
+
+static gboolean
+sort_one(
+    guint    nb_lines,
+    gboolean src_compressed,
+    gboolean dest_compressed,
+    gboolean only_paths)
+{
+    char **lines = make_lines(nb_lines, nb_lines + 1);
+    char *errmsg = NULL;
+    gboolean ok;
+
+    g_mkdir(TEST_DIR, 0700);
+    ok = write_lines(TEST_SRC, lines, src_compressed) &&
+	 index_sort_convert(TEST_SRC, src_compressed, TEST_DEST,
+			    dest_compressed, TRUE, only_paths, NULL, &errmsg);
+    if (errmsg) {
+	tu_dbg("index_sort_convert: %s\n", errmsg);
+	g_free(errmsg);
+    }
+    ok = ok && check_sorted(TEST_DEST, dest_compressed, lines, only_paths);
+
+    unlink(TEST_SRC);
+    unlink(TEST_DEST);
+    rmdir(TEST_DIR);
+    g_strfreev(lines);
+    return ok;
+}
+
+/*
+ * Tests
+ */
+
+/* a file that is sorted in one run */
+static gboolean
+test_sort_small(void)
+{
+    return sort_one(100, FALSE, FALSE, FALSE) &&
+	   sort_one(0, FALSE, FALSE, FALSE) &&
+	   sort_one(1, FALSE, FALSE, FALSE);
+}
+
+/* a file sorted in many runs, merged in several passes */
+static gboolean
+test_sort_merge(void)
+{
+    return sort_one(20000, FALSE, FALSE, FALSE);
+}
+
+/* amtrmidx keeps only the lines with a '/' */
+static gboolean
+test_sort_only_paths(void)
+{
+    return sort_one(100, FALSE, FALSE, TRUE) &&
+	   sort_one(20000, FALSE, FALSE, TRUE);
+}
+
+static gboolean
+test_sort_compressed(void)
+{
+    if (!index_sort_can_compress()) {
+	tu_dbg("no in-process compression\n");
+	return TRUE;
+    }
+    return sort_one(100, TRUE, TRUE, FALSE) &&
+	   sort_one(20000, TRUE, FALSE, FALSE) &&
+	   sort_one(20000, FALSE, TRUE, TRUE);
+}
+
+/* several files at once, the sources unlinked once done */
+static gboolean
+test_sort_pool(void)
+{
+    index_sort_pool_t *pool = index_sort_pool_new(3);
+    char **lines[5];
+    gboolean ok = TRUE;
+    guint i;
+
+    g_mkdir(TEST_DIR, 0700);
+    for (i = 0; i < G_N_ELEMENTS(lines); i++) {
+	char *src = g_strdup_printf("%s.%u", TEST_SRC, i);
+	char *dest = g_strdup_printf("%s.%u", TEST_DEST, i);
+
+	lines[i] = make_lines(1000 + i * 5000, i + 1);
+	ok = ok && write_lines(src, lines[i], FALSE);
+	index_sort_pool_push(pool, src, FALSE, dest, FALSE, TRUE, TRUE, NULL);
+	g_free(src);
+	g_free(dest);
+    }
+    if (index_sort_pool_free(pool) != 0) {
+	tu_dbg("some conversions failed\n");
+	ok = FALSE;
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(lines); i++) {
+	char *src = g_strdup_printf("%s.%u", TEST_SRC, i);
+	char *dest = g_strdup_printf("%s.%u", TEST_DEST, i);
+
+	if (access(src, F_OK) == 0) {
+	    tu_dbg("%s was not unlinked\n", src);
+	    ok = FALSE;
+	    unlink(src);
+	}
+	ok = ok && check_sorted(dest, FALSE, lines[i], FALSE);
+	unlink(dest);
+	g_free(src);
+	g_free(dest);
+	g_strfreev(lines[i]);
+    }
+    rmdir(TEST_DIR);
+    return ok;
+}
+
+/*
+ * Main driver
+ */
+
+int
+main(int argc, char **argv)
+{
+    static TestUtilsTest tests[] = {
+	TU_TEST(test_sort_small, 90),
+	TU_TEST(test_sort_merge, 90),
+	TU_TEST(test_sort_only_paths, 90),
+	TU_TEST(test_sort_compressed, 90),
+	TU_TEST(test_sort_pool, 90),
+	TU_END()
+    };
+
+    glib_init();
+
+    return testutils_run_tests(argc, argv, tests);
+}
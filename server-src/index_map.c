@@ -0,0 +1,503 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+/*
+ * Binary, memory-mapped form of a sorted index file.
+ *
+ * File layout, in the byte order of the host that wrote it:
+ *
+ *   index_map_header_t
+ *   string table:    each path of the index, NUL-terminated, in sorted order
+ *   entry table:     guint64 offset into the string table, for each path
+ *   directory table: index_map_dir_t, for each directory, in sorted order
+ *
+ * A directory is every prefix of a path that ends in a '/'.  Since the paths
+ * are sorted, all the paths below a directory are contiguous; the directory
+ * record gives their range, and the index of the first directory record that
+ * is not below it.  A non-recursive listing walks the entries of a directory
+ * and skips over each subdirectory in one step, so it costs O(log n) to find
+ * the directory plus O(1) per result.
+ */
+
+#include "amanda.h"
+#include "index_map.h"
+
+#define INDEX_MAP_MAGIC		"AMIDXMAP"
+#define INDEX_MAP_VERSION	1
+#define INDEX_MAP_BYTE_ORDER	0x01020304
+
+typedef struct index_map_header_s {
+    char    magic[8];
+    guint32 version;
+    guint32 byte_order;
+    guint64 nentries;
+    guint64 ndirs;
+    guint64 string_offset;
+    guint64 string_size;
+    guint64 entry_offset;
+    guint64 dir_offset;
+} index_map_header_t;
+
+typedef struct index_map_dir_s {
+    guint64 first;	/* first entry below this directory */
+    guint64 end;	/* one past the last entry below this directory */
+    guint64 next;	/* first directory record not below this directory */
+    guint64 len;	/* length of the directory name, a prefix of entry FIRST */
+} index_map_dir_t;
+
+struct index_map_s {
+    char            *data;
+    size_t           size;
+    guint64          nentries;
+    guint64          ndirs;
+    char            *strings;
+    guint64          string_size;
+    guint64         *entries;
+    index_map_dir_t *dirs;
+};
+
+/*
+ * Building
+ */
+
+/* Read a line of any length, without its newline.  Returns FALSE at EOF. */
+static gboolean
+read_line(
+    FILE    *stream,
+    GString *line)
+{
+    char buf[STR_SIZE];
+
+    g_string_truncate(line, 0);
+    while (fgets(buf, sizeof(buf), stream) != NULL) {
+	g_string_append(line, buf);
+	if (line->len > 0 && line->str[line->len-1] == '\n') {
+	    g_string_truncate(line, line->len-1);
+	    return TRUE;
+	}
+    }
+    return line->len > 0;
+}
+
+static gboolean
+write_pad(
+    FILE    *out,
+    guint64 *offset)
+{
+    static const char zeros[8] = { 0 };
+    size_t pad = (8 - (*offset % 8)) % 8;
+
+    if (pad && fwrite(zeros, 1, pad, out) != pad)
+	return FALSE;
+    *offset += pad;
+    return TRUE;
+}
+
+gboolean
+index_map_build(
+    FILE  *stream,
+    char  *filename,
+    char **errmsg)
+{
+    char               *tmp_filename = g_strconcat(filename, ".tmp", NULL);
+    int                 fd;
+    FILE               *out = NULL;
+    GString            *line = g_string_sized_new(STR_SIZE);
+    GString            *prev = g_string_sized_new(STR_SIZE);
+    GString            *swap;
+    GArray             *entries = g_array_new(FALSE, FALSE, sizeof(guint64));
+    GArray             *dirs = g_array_new(FALSE, FALSE, sizeof(index_map_dir_t));
+    GArray             *stack = g_array_new(FALSE, FALSE, sizeof(guint64));
+    index_map_header_t  header;
+    guint64             offset;
+    gboolean            have_prev = FALSE;
+    gboolean            rval = FALSE;
+
+    *errmsg = NULL;
+
+    fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || (out = fdopen(fd, "w")) == NULL) {
+	*errmsg = g_strdup_printf(_("Can't open '%s' for writing: %s"),
+				  tmp_filename, strerror(errno));
+	if (fd != -1)
+	    close(fd);
+	goto cleanup;
+    }
+
+    /* the header is written last, once all the offsets are known */
+    memset(&header, 0, sizeof(header));
+    if (fwrite(&header, sizeof(header), 1, out) != 1)
+	goto write_error;
+    offset = sizeof(header);
+    header.string_offset = offset;
+
+    while (read_line(stream, line)) {
+	guint64 i = entries->len;
+	guint64 string_pos;
+	gsize   p;
+
+	if (!strchr(line->str, '/'))
+	    continue;
+
+	if (have_prev && strcmp(prev->str, line->str) > 0) {
+	    *errmsg = g_strdup_printf(_("index is not sorted at '%s'"),
+				      line->str);
+	    goto cleanup;
+	}
+
+	/* close the directories of the previous path that do not contain
+	 * this one; the directories on the stack are all prefixes of the
+	 * previous path */
+	while (stack->len > 0) {
+	    guint64          top = g_array_index(stack, guint64, stack->len-1);
+	    index_map_dir_t *dir = &g_array_index(dirs, index_map_dir_t, top);
+
+	    if (dir->len <= line->len &&
+		strncmp(prev->str, line->str, dir->len) == 0)
+		break;
+	    dir->end = i;
+	    dir->next = dirs->len;
+	    g_array_set_size(stack, stack->len-1);
+	}
+
+	/* and open the directories this path starts */
+	p = 0;
+	if (stack->len > 0) {
+	    guint64 top = g_array_index(stack, guint64, stack->len-1);
+	    p = g_array_index(dirs, index_map_dir_t, top).len;
+	}
+	for (; p < line->len; p++) {
+	    if (line->str[p] == '/') {
+		index_map_dir_t dir;
+		guint64         n = dirs->len;
+
+		dir.first = i;
+		dir.end = 0;
+		dir.next = 0;
+		dir.len = p + 1;
+		g_array_append_val(dirs, dir);
+		g_array_append_val(stack, n);
+	    }
+	}
+
+	string_pos = offset - header.string_offset;
+	g_array_append_val(entries, string_pos);
+	if (fwrite(line->str, 1, line->len + 1, out) != line->len + 1)
+	    goto write_error;
+	offset += line->len + 1;
+
+	swap = prev;
+	prev = line;
+	line = swap;
+	have_prev = TRUE;
+    }
+
+    if (ferror(stream)) {
+	*errmsg = g_strdup_printf(_("Error reading the index: %s"),
+				  strerror(errno));
+	goto cleanup;
+    }
+
+    while (stack->len > 0) {
+	guint64          top = g_array_index(stack, guint64, stack->len-1);
+	index_map_dir_t *dir = &g_array_index(dirs, index_map_dir_t, top);
+
+	dir->end = entries->len;
+	dir->next = dirs->len;
+	g_array_set_size(stack, stack->len-1);
+    }
+    header.string_size = offset - header.string_offset;
+
+    if (!write_pad(out, &offset))
+	goto write_error;
+    header.entry_offset = offset;
+    if (entries->len > 0 &&
+	fwrite(entries->data, sizeof(guint64), entries->len, out) != entries->len)
+	goto write_error;
+    offset += (guint64)entries->len * sizeof(guint64);
+
+    header.dir_offset = offset;
+    if (dirs->len > 0 &&
+	fwrite(dirs->data, sizeof(index_map_dir_t), dirs->len, out) != dirs->len)
+	goto write_error;
+
+    memcpy(header.magic, INDEX_MAP_MAGIC, sizeof(header.magic));
+    header.version = INDEX_MAP_VERSION;
+    header.byte_order = INDEX_MAP_BYTE_ORDER;
+    header.nentries = entries->len;
+    header.ndirs = dirs->len;
+    if (fseek(out, 0, SEEK_SET) != 0 ||
+	fwrite(&header, sizeof(header), 1, out) != 1)
+	goto write_error;
+
+    if (fclose(out) != 0) {
+	out = NULL;
+	goto write_error;
+    }
+    out = NULL;
+
+    if (rename(tmp_filename, filename) != 0) {
+	*errmsg = g_strdup_printf(_("Can't rename '%s' to '%s': %s"),
+				  tmp_filename, filename, strerror(errno));
+	goto cleanup;
+    }
+
+    rval = TRUE;
+    goto cleanup;
+
+write_error:
+    *errmsg = g_strdup_printf(_("Error writing '%s': %s"),
+			      tmp_filename, strerror(errno));
+
+cleanup:
+    if (out)
+	fclose(out);
+    if (!rval)
+	unlink(tmp_filename);
+    g_free(tmp_filename);
+    g_string_free(line, TRUE);
+    g_string_free(prev, TRUE);
+    g_array_free(entries, TRUE);
+    g_array_free(dirs, TRUE);
+    g_array_free(stack, TRUE);
+    return rval;
+}
+
+/*
+ * Reading
+ */
+
+index_map_t *
+index_map_open(
+    char  *filename,
+    char **errmsg)
+{
+    index_map_t        *map;
+    index_map_header_t *header;
+    struct stat         stat_buf;
+    char               *data;
+    guint64             size;
+    int                 fd;
+
+    *errmsg = NULL;
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+	if (errno != ENOENT)
+	    *errmsg = g_strdup_printf(_("Can't open '%s': %s"),
+				      filename, strerror(errno));
+	return NULL;
+    }
+
+    if (fstat(fd, &stat_buf) != 0) {
+	*errmsg = g_strdup_printf(_("Can't stat '%s': %s"),
+				  filename, strerror(errno));
+	close(fd);
+	return NULL;
+    }
+    size = stat_buf.st_size;
+    if (size < sizeof(index_map_header_t)) {
+	*errmsg = g_strdup_printf(_("'%s' is not an index map"), filename);
+	close(fd);
+	return NULL;
+    }
+
+    data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+	*errmsg = g_strdup_printf(_("Can't mmap '%s': %s"),
+				  filename, strerror(errno));
+	return NULL;
+    }
+
+    header = (index_map_header_t *)data;
+    if (memcmp(header->magic, INDEX_MAP_MAGIC, sizeof(header->magic)) != 0 ||
+	header->byte_order != INDEX_MAP_BYTE_ORDER) {
+	*errmsg = g_strdup_printf(_("'%s' is not an index map"), filename);
+	goto error;
+    }
+    if (header->version != INDEX_MAP_VERSION) {
+	*errmsg = g_strdup_printf(_("'%s' has unsupported version %u"),
+				  filename, header->version);
+	goto error;
+    }
+    if (header->string_offset > size ||
+	header->string_size > size - header->string_offset ||
+	(header->string_size > 0 &&
+	 data[header->string_offset + header->string_size - 1] != '\0') ||
+	header->entry_offset % 8 != 0 ||
+	header->entry_offset > size ||
+	header->nentries > (size - header->entry_offset) / sizeof(guint64) ||
+	header->dir_offset % 8 != 0 ||
+	header->dir_offset > size ||
+	header->ndirs > (size - header->dir_offset) / sizeof(index_map_dir_t)) {
+	*errmsg = g_strdup_printf(_("'%s' is truncated or corrupt"), filename);
+	goto error;
+    }
+
+    map = g_new0(index_map_t, 1);
+    map->data = data;
+    map->size = size;
+    map->nentries = header->nentries;
+    map->ndirs = header->ndirs;
+    map->strings = data + header->string_offset;
+    map->string_size = header->string_size;
+    map->entries = (guint64 *)(data + header->entry_offset);
+    map->dirs = (index_map_dir_t *)(data + header->dir_offset);
+    return map;
+
+error:
+    munmap(data, size);
+    return NULL;
+}
+
+void
+index_map_close(
+    index_map_t *map)
+{
+    if (!map)
+	return;
+    munmap(map->data, map->size);
+    g_free(map);
+}
+
+static const char *
+get_entry(
+    index_map_t *map,
+    guint64      i)
+{
+    guint64 offset = map->entries[i];
+
+    /* a corrupt offset gives an empty path, which matches nothing */
+    if (offset >= map->string_size)
+	return "";
+    return map->strings + offset;
+}
+
+/* check the record of directory D before following its indices */
+static gboolean
+dir_is_sane(
+    index_map_t *map,
+    guint64      d)
+{
+    index_map_dir_t *dir = &map->dirs[d];
+
+    return dir->first < dir->end && dir->end <= map->nentries &&
+	   dir->next > d && dir->next <= map->ndirs;
+}
+
+/* Find the record of DIR_SLASH; returns map->ndirs if there is none. */
+static guint64
+find_dir(
+    index_map_t *map,
+    char        *dir_slash)
+{
+    size_t  len = strlen(dir_slash);
+    guint64 lo = 0;
+    guint64 hi = map->ndirs;
+
+    while (lo < hi) {
+	guint64          mid = lo + (hi - lo) / 2;
+	index_map_dir_t *dir = &map->dirs[mid];
+	int              r = 0;
+
+	if (dir->first < map->nentries)
+	    r = strncmp(get_entry(map, dir->first), dir_slash,
+			MIN(dir->len, len));
+	if (r == 0) {
+	    if (dir->len == len)
+		return dir_is_sane(map, mid) ? mid : map->ndirs;
+	    r = dir->len < len ? -1 : 1;
+	}
+	if (r < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return map->ndirs;
+}
+
+gboolean
+index_map_has_dir(
+    index_map_t *map,
+    char        *dir_slash)
+{
+    return find_dir(map, dir_slash) < map->ndirs;
+}
+
+guint64
+index_map_ls(
+    index_map_t  *map,
+    char         *dir_slash,
+    gboolean      recursive,
+    index_map_fn  fn,
+    gpointer      user_data)
+{
+    guint64      d = find_dir(map, dir_slash);
+    guint64      i, end, c, next;
+    guint64      count = 0;
+    const char  *last = NULL;
+    GString     *name;
+
+    if (d == map->ndirs)
+	return 0;
+
+    i = map->dirs[d].first;
+    end = map->dirs[d].end;
+    next = map->dirs[d].next;
+    /* the first subdirectory, if any, immediately follows its parent */
+    c = d + 1;
+    name = g_string_new(NULL);
+
+    while (i < end) {
+	const char *path = get_entry(map, i);
+
+	if (!recursive && c < next && map->dirs[c].first == i &&
+	    dir_is_sane(map, c)) {
+	    index_map_dir_t *child = &map->dirs[c];
+
+	    /* list the subdirectory once, and skip everything below it */
+	    g_string_truncate(name, 0);
+	    g_string_append_len(name, path, MIN(child->len, strlen(path)));
+	    fn(name->str, user_data);
+	    count++;
+	    last = NULL;
+	    i = child->end;
+	    c = child->next;
+	    continue;
+	}
+
+	/* the text index may list a path more than once */
+	if (!last || !g_str_equal(last, path)) {
+	    fn(path, user_data);
+	    count++;
+	    last = path;
+	}
+	i++;
+    }
+
+    g_string_free(name, TRUE);
+    return count;
+}
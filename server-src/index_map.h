@@ -0,0 +1,88 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+/*
+ * Binary, memory-mapped form of a sorted index file.
+ *
+ * The map holds every path of the sorted index in a string table, plus one
+ * record per directory (every prefix of a path that ends in a '/') giving the
+ * range of paths below it.  Directory records are in sorted order, so a
+ * directory is found with a binary search, and listing it touches only the
+ * entries that are returned.
+ */
+#ifndef INDEX_MAP_H
+#define INDEX_MAP_H
+
+#include "amanda.h"
+
+typedef struct index_map_s index_map_t;
+
+/* Called for each path listed by index_map_ls. */
+typedef void (*index_map_fn)(const char *path, gpointer user_data);
+
+/* Build a map in FILENAME from the sorted index read from STREAM.  The map is
+ * written to a temporary file and renamed into place once complete.  Lines
+ * must be sorted in byte order (as by 'LC_ALL=C sort'); lines without a '/'
+ * are ignored.
+ *
+ * @param stream: the sorted index
+ * @param filename: the map file to create
+ * @param errmsg: (output) error message, if the map could not be built
+ * @returns: FALSE on error
+ */
+gboolean index_map_build(FILE *stream, char *filename, char **errmsg);
+
+/* Map an existing map file.
+ *
+ * @param filename: the map file
+ * @param errmsg: (output) error message; left NULL if the file does not exist
+ * @returns: the map, or NULL on error
+ */
+index_map_t *index_map_open(char *filename, char **errmsg);
+
+/* Unmap and free a map. */
+void index_map_close(index_map_t *map);
+
+/* Check whether any path of the index starts with DIR_SLASH, which must end
+ * in a '/'.
+ */
+gboolean index_map_has_dir(index_map_t *map, char *dir_slash);
+
+/* List the paths below DIR_SLASH, which must end in a '/'.  If RECURSIVE is
+ * false, only the entries directly in that directory are listed, truncated
+ * after their first '/'; the results are the same as those of a line by line
+ * scan of the text index.
+ *
+ * @param map: the map
+ * @param dir_slash: the directory to list
+ * @param recursive: list all descendants
+ * @param fn: called for each path, in sorted order
+ * @param user_data: passed to FN
+ * @returns: the number of paths listed
+ */
+guint64 index_map_ls(index_map_t *map, char *dir_slash, gboolean recursive,
+		     index_map_fn fn, gpointer user_data);
+
+#endif /* INDEX_MAP_H */
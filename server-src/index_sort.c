@@ -0,0 +1,915 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+/*
+ * In-process uncompression, sorting and compression of index files.
+ */
+
+#include "amanda.h"
+#include "index_sort.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+/* Lines are gathered into runs of about this size, each sorted in memory.
+ * index-sort-test builds with smaller runs and merges. */
+#ifndef INDEX_SORT_RUN_SIZE
+#define INDEX_SORT_RUN_SIZE	(16*1024*1024)
+#endif
+
+/* At most this many threads sort the runs of one file. */
+#define INDEX_SORT_MAX_THREADS	4
+
+/* At most this many runs are merged at once; more runs are merged in
+ * several passes. */
+#ifndef INDEX_SORT_MERGE_WAYS
+#define INDEX_SORT_MERGE_WAYS	64
+#endif
+
+#define INDEX_SORT_BUFFER_SIZE	(128*1024)
+
+/* A compressed index file is guessed to grow this much when uncompressed,
+ * to size the first run. */
+#define INDEX_SORT_GZIP_RATIO	8
+
+gboolean
+index_sort_can_compress(void)
+{
+#ifdef HAVE_LIBZ
+    /* zlib only speaks gzip's format */
+    return g_str_equal(COMPRESS_SUFFIX, ".gz");
+#else
+    return FALSE;
+#endif
+}
+
+static guint
+online_processors(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n > 0)
+	return (guint)n;
+#endif
+    return 1;
+}
+
+/*
+ * Reading and writing, compressed or not
+ */
+
+typedef struct index_reader_s {
+    int      fd;
+#ifdef HAVE_LIBZ
+    gzFile   gz;
+#endif
+    char    *buf;
+    gsize    pos;
+    gsize    len;
+    gboolean eof;
+    gboolean error;
+} index_reader_t;
+
+typedef struct index_writer_s {
+    FILE    *file;
+#ifdef HAVE_LIBZ
+    gzFile   gz;
+#endif
+    gboolean error;
+} index_writer_t;
+
+static index_reader_t *
+reader_new_fd(
+    int       fd,
+    gboolean  compressed)
+{
+    index_reader_t *r = g_new0(index_reader_t, 1);
+
+    r->fd = fd;
+#ifdef HAVE_LIBZ
+    if (compressed) {
+	r->gz = gzdopen(fd, "rb");
+	if (!r->gz) {
+	    g_free(r);
+	    return NULL;
+	}
+	gzbuffer(r->gz, INDEX_SORT_BUFFER_SIZE);
+    }
+#else
+    g_assert(!compressed);
+#endif
+    r->buf = g_malloc(INDEX_SORT_BUFFER_SIZE);
+    return r;
+}
+
+static index_reader_t *
+reader_open(
+    char     *filename,
+    gboolean  compressed,
+    char    **errmsg)
+{
+    index_reader_t *r;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd == -1) {
+	*errmsg = g_strdup_printf(_("Can't open '%s': %s"),
+				  filename, strerror(errno));
+	return NULL;
+    }
+    r = reader_new_fd(fd, compressed);
+    if (!r) {
+	*errmsg = g_strdup_printf(_("Can't uncompress '%s'"), filename);
+	close(fd);
+    }
+    return r;
+}
+
+static gboolean
+reader_fill(
+    index_reader_t *r)
+{
+    ssize_t n;
+
+    if (r->eof)
+	return FALSE;
+#ifdef HAVE_LIBZ
+    if (r->gz)
+	n = gzread(r->gz, r->buf, INDEX_SORT_BUFFER_SIZE);
+    else
+#endif
+	n = read(r->fd, r->buf, INDEX_SORT_BUFFER_SIZE);
+    if (n < 0 && errno == EINTR)
+	return reader_fill(r);
+    if (n <= 0) {
+	r->eof = TRUE;
+	if (n < 0)
+	    r->error = TRUE;
+	return FALSE;
+    }
+    r->pos = 0;
+    r->len = n;
+    return TRUE;
+}
+
+/* Append the next line, without its newline, to LINE.  Returns FALSE at
+ * EOF. */
+static gboolean
+reader_line(
+    index_reader_t *r,
+    GString        *line)
+{
+    gboolean got = FALSE;
+
+    g_string_truncate(line, 0);
+    while (r->pos < r->len || reader_fill(r)) {
+	char *start = r->buf + r->pos;
+	char *nl = memchr(start, '\n', r->len - r->pos);
+
+	got = TRUE;
+	if (nl) {
+	    g_string_append_len(line, start, nl - start);
+	    r->pos += nl - start + 1;
+	    return TRUE;
+	}
+	g_string_append_len(line, start, r->len - r->pos);
+	r->pos = r->len;
+    }
+    return got;
+}
+
+static gboolean
+reader_close(
+    index_reader_t *r)
+{
+    gboolean ok = !r->error;
+
+#ifdef HAVE_LIBZ
+    if (r->gz) {
+	if (gzclose(r->gz) != Z_OK)
+	    ok = FALSE;
+    } else
+#endif
+	close(r->fd);
+    g_free(r->buf);
+    g_free(r);
+    return ok;
+}
+
+static index_writer_t *
+writer_new_fd(
+    int       fd,
+    gboolean  compressed)
+{
+    index_writer_t *w = g_new0(index_writer_t, 1);
+
+#ifdef HAVE_LIBZ
+    if (compressed) {
+	/* the same level as COMPRESS_BEST_OPT */
+	w->gz = gzdopen(fd, "wb9");
+	if (!w->gz) {
+	    g_free(w);
+	    return NULL;
+	}
+	gzbuffer(w->gz, INDEX_SORT_BUFFER_SIZE);
+	return w;
+    }
+#else
+    g_assert(!compressed);
+#endif
+    w->file = fdopen(fd, "w");
+    if (!w->file) {
+	g_free(w);
+	return NULL;
+    }
+    return w;
+}
+
+static index_writer_t *
+writer_open(
+    char     *filename,
+    gboolean  compressed,
+    char    **errmsg)
+{
+    index_writer_t *w;
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+    if (fd == -1) {
+	*errmsg = g_strdup_printf(_("Can't open '%s' for writing: %s"),
+				  filename, strerror(errno));
+	return NULL;
+    }
+    w = writer_new_fd(fd, compressed);
+    if (!w) {
+	*errmsg = g_strdup_printf(_("Can't open '%s' for writing: %s"),
+				  filename, strerror(errno));
+	close(fd);
+    }
+    return w;
+}
+
+static void
+writer_write(
+    index_writer_t *w,
+    const char     *data,
+    gsize           len)
+{
+    if (w->error || len == 0)
+	return;
+#ifdef HAVE_LIBZ
+    if (w->gz) {
+	if (gzwrite(w->gz, data, len) != (int)len)
+	    w->error = TRUE;
+	return;
+    }
+#endif
+    if (fwrite(data, 1, len, w->file) != len)
+	w->error = TRUE;
+}
+
+static void
+writer_line(
+    index_writer_t *w,
+    const char     *line,
+    gsize           len)
+{
+    writer_write(w, line, len);
+    writer_write(w, "\n", 1);
+}
+
+static gboolean
+writer_close(
+    index_writer_t *w)
+{
+    gboolean ok = !w->error;
+
+#ifdef HAVE_LIBZ
+    if (w->gz) {
+	if (gzclose(w->gz) != Z_OK)
+	    ok = FALSE;
+    } else
+#endif
+    if (fclose(w->file) != 0)
+	ok = FALSE;
+    g_free(w);
+    return ok;
+}
+
+/*
+ * Sorting
+ */
+
+typedef struct sort_run_s {
+    GString  *arena;		/* the NUL-terminated lines */
+    GArray   *offsets;		/* gsize offset of each line in the arena */
+    FILE     *file;		/* once sorted and spilled */
+} sort_run_t;
+
+typedef struct sorter_s {
+    char        *tmpdir;
+    GThreadPool *pool;
+    GMutex      *mutex;
+    GCond       *cond;
+    guint        outstanding;	/* runs being sorted */
+    guint        max_outstanding;
+    GPtrArray   *runs;		/* spilled runs, in order */
+    char        *errmsg;
+} sorter_t;
+
+/* SIZE is the expected size of the lines; the arena grows past it as
+ * needed. */
+static sort_run_t *
+sort_run_new(
+    gsize size)
+{
+    sort_run_t *run = g_new0(sort_run_t, 1);
+
+    run->arena = g_string_sized_new(MIN(size, INDEX_SORT_RUN_SIZE + INDEX_SORT_BUFFER_SIZE));
+    run->offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+    return run;
+}
+
+static void
+sort_run_free(
+    sort_run_t *run)
+{
+    if (run->arena)
+	g_string_free(run->arena, TRUE);
+    if (run->offsets)
+	g_array_free(run->offsets, TRUE);
+    if (run->file)
+	fclose(run->file);
+    g_free(run);
+}
+
+static int
+compare_lines(
+    const void *a,
+    const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Sort the lines of RUN; returns them as an array of pointers into the
+ * arena. */
+static char **
+sort_run_lines(
+    sort_run_t *run)
+{
+    char **lines = g_new(char *, run->offsets->len + 1);
+    guint  i;
+
+    for (i = 0; i < run->offsets->len; i++)
+	lines[i] = run->arena->str + g_array_index(run->offsets, gsize, i);
+    qsort(lines, run->offsets->len, sizeof(char *), compare_lines);
+    return lines;
+}
+
+/* Open an anonymous temporary file in TMPDIR. */
+static FILE *
+open_tmp_run(
+    char  *tmpdir,
+    char **errmsg)
+{
+    char *tmpname = g_strconcat(tmpdir, "/amindex-sort.XXXXXX", NULL);
+    int   fd = g_mkstemp(tmpname);
+    FILE *file = NULL;
+
+    if (fd == -1) {
+	*errmsg = g_strdup_printf(_("Can't create a temporary file in '%s': %s"),
+				  tmpdir, strerror(errno));
+    } else {
+	unlink(tmpname);
+	file = fdopen(fd, "w+");
+	if (!file) {
+	    *errmsg = g_strdup_printf(_("Can't fdopen '%s': %s"),
+				      tmpname, strerror(errno));
+	    close(fd);
+	}
+    }
+    g_free(tmpname);
+    return file;
+}
+
+/* a GFunc run by the sorter's pool: sort a run and spill it to a temporary
+ * file */
+static void
+sort_run_fn(
+    gpointer data,
+    gpointer user_data)
+{
+    sort_run_t *run = data;
+    sorter_t   *sorter = user_data;
+    char      **lines;
+    char       *errmsg = NULL;
+    guint       i;
+
+    lines = sort_run_lines(run);
+    run->file = open_tmp_run(sorter->tmpdir, &errmsg);
+    if (run->file) {
+	for (i = 0; i < run->offsets->len; i++) {
+	    fputs(lines[i], run->file);
+	    putc('\n', run->file);
+	}
+	if (fflush(run->file) != 0 || ferror(run->file)) {
+	    errmsg = g_strdup_printf(_("Error writing a sorted run: %s"),
+				     strerror(errno));
+	} else {
+	    rewind(run->file);
+	}
+    }
+    g_free(lines);
+
+    /* only the file is needed from now on */
+    g_string_free(run->arena, TRUE);
+    run->arena = NULL;
+    g_array_free(run->offsets, TRUE);
+    run->offsets = NULL;
+
+    g_mutex_lock(sorter->mutex);
+    if (errmsg && !sorter->errmsg)
+	sorter->errmsg = errmsg;
+    else
+	g_free(errmsg);
+    sorter->outstanding--;
+    g_cond_broadcast(sorter->cond);
+    g_mutex_unlock(sorter->mutex);
+}
+
+/* Hand a full run to the pool, waiting for a free slot first so that at
+ * most max_outstanding runs are in memory besides the one being read. */
+static void
+sorter_push(
+    sorter_t   *sorter,
+    sort_run_t *run)
+{
+    g_mutex_lock(sorter->mutex);
+    while (sorter->outstanding >= sorter->max_outstanding)
+	g_cond_wait(sorter->cond, sorter->mutex);
+    sorter->outstanding++;
+    /* runs are merged in any order, but keep them in the order read */
+    g_ptr_array_add(sorter->runs, run);
+    g_mutex_unlock(sorter->mutex);
+
+    g_thread_pool_push(sorter->pool, run, NULL);
+}
+
+typedef struct merge_input_s {
+    FILE    *file;
+    GString *line;
+} merge_input_t;
+
+static gboolean
+merge_input_next(
+    merge_input_t *in)
+{
+    char buf[STR_SIZE];
+
+    g_string_truncate(in->line, 0);
+    while (fgets(buf, sizeof(buf), in->file) != NULL) {
+	g_string_append(in->line, buf);
+	if (in->line->len > 0 && in->line->str[in->line->len-1] == '\n') {
+	    g_string_truncate(in->line, in->line->len-1);
+	    return TRUE;
+	}
+    }
+    return in->line->len > 0;
+}
+
+static gboolean
+heap_less(
+    merge_input_t **heap,
+    guint           a,
+    guint           b)
+{
+    return strcmp(heap[a]->line->str, heap[b]->line->str) < 0;
+}
+
+static void
+heap_sift_down(
+    merge_input_t **heap,
+    guint           n,
+    guint           i)
+{
+    for (;;) {
+	guint smallest = i;
+	guint l = 2*i + 1;
+	guint r = l + 1;
+	merge_input_t *tmp;
+
+	if (l < n && heap_less(heap, l, smallest))
+	    smallest = l;
+	if (r < n && heap_less(heap, r, smallest))
+	    smallest = r;
+	if (smallest == i)
+	    return;
+	tmp = heap[i];
+	heap[i] = heap[smallest];
+	heap[smallest] = tmp;
+	i = smallest;
+    }
+}
+
+/* Merge the sorted files FILES[0..N) into OUT, or into FILE_OUT if OUT is
+ * NULL. */
+static gboolean
+merge_files(
+    FILE          **files,
+    guint           n,
+    index_writer_t *out,
+    FILE           *file_out)
+{
+    merge_input_t  *inputs = g_new0(merge_input_t, n);
+    merge_input_t **heap = g_new(merge_input_t *, n);
+    guint           nheap = 0;
+    guint           i;
+    gboolean        ok = TRUE;
+
+    for (i = 0; i < n; i++) {
+	inputs[i].file = files[i];
+	inputs[i].line = g_string_sized_new(256);
+	if (merge_input_next(&inputs[i]))
+	    heap[nheap++] = &inputs[i];
+	else if (ferror(files[i]))
+	    ok = FALSE;
+    }
+    for (i = nheap; i-- > 0; )
+	heap_sift_down(heap, nheap, i);
+
+    while (nheap > 0) {
+	merge_input_t *in = heap[0];
+
+	if (out) {
+	    writer_line(out, in->line->str, in->line->len);
+	} else {
+	    fputs(in->line->str, file_out);
+	    putc('\n', file_out);
+	}
+	if (!merge_input_next(in)) {
+	    if (ferror(in->file))
+		ok = FALSE;
+	    heap[0] = heap[--nheap];
+	}
+	heap_sift_down(heap, nheap, 0);
+    }
+
+    for (i = 0; i < n; i++)
+	g_string_free(inputs[i].line, TRUE);
+    g_free(inputs);
+    g_free(heap);
+    return ok;
+}
+
+/* Sort the lines read from IN into OUT; SIZE_HINT is the expected size of
+ * the uncompressed input. */
+static gboolean
+sort_lines(
+    index_reader_t *in,
+    index_writer_t *out,
+    gboolean        only_paths,
+    gsize           size_hint,
+    char           *tmpdir,
+    guint           nthreads,
+    char          **errmsg)
+{
+    sorter_t    sorter;
+    sort_run_t *run = sort_run_new(size_hint);
+    GString    *line = g_string_sized_new(STR_SIZE);
+    gboolean    ok = TRUE;
+    guint       i;
+
+    memset(&sorter, 0, sizeof(sorter));
+    sorter.tmpdir = tmpdir;
+    sorter.runs = g_ptr_array_new();
+
+    while (reader_line(in, line)) {
+	gsize offset = run->arena->len;
+
+	if (only_paths && !strchr(line->str, '/'))
+	    continue;
+	g_string_append_len(run->arena, line->str, line->len + 1);
+	g_array_append_val(run->offsets, offset);
+
+	if (run->arena->len >= INDEX_SORT_RUN_SIZE) {
+	    if (!sorter.pool) {
+		sorter.mutex = g_mutex_new();
+		sorter.cond = g_cond_new();
+		sorter.max_outstanding = nthreads;
+		sorter.pool = g_thread_pool_new(sort_run_fn, &sorter,
+						nthreads, 0, NULL);
+	    }
+	    sorter_push(&sorter, run);
+	    run = sort_run_new(INDEX_SORT_RUN_SIZE + INDEX_SORT_BUFFER_SIZE);
+	}
+    }
+    g_string_free(line, TRUE);
+
+    if (!sorter.pool) {
+	/* everything fit in memory */
+	char **lines = sort_run_lines(run);
+
+	for (i = 0; i < run->offsets->len; i++)
+	    writer_line(out, lines[i], strlen(lines[i]));
+	g_free(lines);
+	sort_run_free(run);
+	g_ptr_array_free(sorter.runs, TRUE);
+	return TRUE;
+    }
+
+    if (run->offsets->len > 0)
+	sorter_push(&sorter, run);
+    else
+	sort_run_free(run);
+    g_thread_pool_free(sorter.pool, FALSE, TRUE);
+    g_mutex_free(sorter.mutex);
+    g_cond_free(sorter.cond);
+
+    if (sorter.errmsg) {
+	*errmsg = sorter.errmsg;
+	ok = FALSE;
+    } else {
+	GPtrArray *files = g_ptr_array_new();
+
+	for (i = 0; i < sorter.runs->len; i++) {
+	    sort_run_t *r = g_ptr_array_index(sorter.runs, i);
+	    g_ptr_array_add(files, r->file);
+	    r->file = NULL;
+	}
+
+	/* merge in several passes if there are too many runs */
+	while (ok && files->len > INDEX_SORT_MERGE_WAYS) {
+	    FILE *merged = open_tmp_run(tmpdir, errmsg);
+
+	    if (!merged) {
+		ok = FALSE;
+		break;
+	    }
+	    ok = merge_files((FILE **)files->pdata, INDEX_SORT_MERGE_WAYS,
+			     NULL, merged);
+	    if (fflush(merged) != 0 || ferror(merged))
+		ok = FALSE;
+	    rewind(merged);
+	    for (i = 0; i < INDEX_SORT_MERGE_WAYS; i++)
+		fclose(g_ptr_array_index(files, i));
+	    g_ptr_array_remove_range(files, 0, INDEX_SORT_MERGE_WAYS);
+	    g_ptr_array_add(files, merged);
+	    if (!ok)
+		*errmsg = g_strdup_printf(_("Error merging sorted runs: %s"),
+					  strerror(errno));
+	}
+	if (ok && !merge_files((FILE **)files->pdata, files->len, out, NULL)) {
+	    *errmsg = g_strdup_printf(_("Error reading sorted runs: %s"),
+				      strerror(errno));
+	    ok = FALSE;
+	}
+	for (i = 0; i < files->len; i++)
+	    fclose(g_ptr_array_index(files, i));
+	g_ptr_array_free(files, TRUE);
+    }
+
+    for (i = 0; i < sorter.runs->len; i++)
+	sort_run_free(g_ptr_array_index(sorter.runs, i));
+    g_ptr_array_free(sorter.runs, TRUE);
+    return ok;
+}
+
+/* Copy the lines, or all the data, read from IN into OUT. */
+static void
+copy_lines(
+    index_reader_t *in,
+    index_writer_t *out,
+    gboolean        only_paths)
+{
+    if (only_paths) {
+	GString *line = g_string_sized_new(STR_SIZE);
+
+	while (reader_line(in, line)) {
+	    if (strchr(line->str, '/'))
+		writer_line(out, line->str, line->len);
+	}
+	g_string_free(line, TRUE);
+    } else {
+	while (in->pos < in->len || reader_fill(in)) {
+	    writer_write(out, in->buf + in->pos, in->len - in->pos);
+	    in->pos = in->len;
+	}
+    }
+}
+
+static gboolean
+convert(
+    char      *src,
+    gboolean   src_compressed,
+    char      *dest,
+    gboolean   dest_compressed,
+    gboolean   sort,
+    gboolean   only_paths,
+    char      *tmpdir,
+    guint      sort_threads,
+    char     **errmsg)
+{
+    index_reader_t *in;
+    index_writer_t *out;
+    char           *tmp_dest;
+    char           *dest_dir = NULL;
+    gboolean        ok = TRUE;
+
+    *errmsg = NULL;
+    if ((src_compressed || dest_compressed) && !index_sort_can_compress()) {
+	*errmsg = g_strdup(_("compressed index files are not supported in-process"));
+	return FALSE;
+    }
+
+    in = reader_open(src, src_compressed, errmsg);
+    if (!in)
+	return FALSE;
+
+    tmp_dest = g_strdup_printf("%s.%ld.tmp", dest, (long)getpid());
+    out = writer_open(tmp_dest, dest_compressed, errmsg);
+    if (!out) {
+	reader_close(in);
+	g_free(tmp_dest);
+	return FALSE;
+    }
+
+    if (sort) {
+	struct stat st;
+	gsize size_hint = INDEX_SORT_RUN_SIZE;
+
+	if (fstat(in->fd, &st) == 0) {
+	    guint64 size = (guint64)st.st_size + 1;
+
+	    if (src_compressed)
+		size *= INDEX_SORT_GZIP_RATIO;
+	    size_hint = MIN(size, INDEX_SORT_RUN_SIZE);
+	}
+	if (!tmpdir)
+	    tmpdir = dest_dir = g_path_get_dirname(dest);
+	ok = sort_lines(in, out, only_paths, size_hint, tmpdir, sort_threads,
+			errmsg);
+	g_free(dest_dir);
+    } else {
+	copy_lines(in, out, only_paths);
+    }
+
+    if (!reader_close(in) && ok) {
+	*errmsg = g_strdup_printf(_("Error reading '%s'"), src);
+	ok = FALSE;
+    }
+    if (!writer_close(out) && ok) {
+	*errmsg = g_strdup_printf(_("Error writing '%s': %s"),
+				  tmp_dest, strerror(errno));
+	ok = FALSE;
+    }
+    if (ok && rename(tmp_dest, dest) != 0) {
+	*errmsg = g_strdup_printf(_("Can't rename '%s' to '%s': %s"),
+				  tmp_dest, dest, strerror(errno));
+	ok = FALSE;
+    }
+    if (!ok)
+	unlink(tmp_dest);
+    g_free(tmp_dest);
+    return ok;
+}
+
+gboolean
+index_sort_convert(
+    char      *src,
+    gboolean   src_compressed,
+    char      *dest,
+    gboolean   dest_compressed,
+    gboolean   sort,
+    gboolean   only_paths,
+    char      *tmpdir,
+    char     **errmsg)
+{
+    return convert(src, src_compressed, dest, dest_compressed, sort,
+		   only_paths, tmpdir,
+		   MIN(online_processors(), INDEX_SORT_MAX_THREADS), errmsg);
+}
+
+/*
+ * Converting several files at once
+ */
+
+struct index_sort_pool_s {
+    GThreadPool *pool;
+    GMutex      *mutex;
+    guint        failures;
+};
+
+typedef struct index_sort_job_s {
+    index_sort_pool_t *pool;
+    char     *src;
+    gboolean  src_compressed;
+    char     *dest;
+    gboolean  dest_compressed;
+    gboolean  sort;
+    gboolean  unlink_src;
+    char     *tmpdir;
+} index_sort_job_t;
+
+/* a GFunc run by the pool */
+static void
+index_sort_job_fn(
+    gpointer data,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    index_sort_job_t *job = data;
+    char *errmsg = NULL;
+
+    /* the files are converted in parallel, so each gets a single sorting
+     * thread */
+    if (convert(job->src, job->src_compressed, job->dest, job->dest_compressed,
+		job->sort, FALSE, job->tmpdir, 1, &errmsg)) {
+	g_debug("converted index %s to %s", job->src, job->dest);
+	if (job->unlink_src)
+	    unlink(job->src);
+    } else {
+	g_debug("Can't convert index %s to %s: %s", job->src, job->dest,
+		errmsg);
+	g_free(errmsg);
+	g_mutex_lock(job->pool->mutex);
+	job->pool->failures++;
+	g_mutex_unlock(job->pool->mutex);
+    }
+
+    g_free(job->src);
+    g_free(job->dest);
+    g_free(job->tmpdir);
+    g_free(job);
+}
+
+index_sort_pool_t *
+index_sort_pool_new(
+    guint max_threads)
+{
+    index_sort_pool_t *pool = g_new0(index_sort_pool_t, 1);
+
+    if (max_threads == 0)
+	max_threads = online_processors();
+    pool->mutex = g_mutex_new();
+    pool->pool = g_thread_pool_new(index_sort_job_fn, pool, max_threads, 0,
+				   NULL);
+    return pool;
+}
+
+void
+index_sort_pool_push(
+    index_sort_pool_t *pool,
+    char     *src,
+    gboolean  src_compressed,
+    char     *dest,
+    gboolean  dest_compressed,
+    gboolean  sort,
+    gboolean  unlink_src,
+    char     *tmpdir)
+{
+    index_sort_job_t *job = g_new0(index_sort_job_t, 1);
+
+    job->pool = pool;
+    job->src = g_strdup(src);
+    job->src_compressed = src_compressed;
+    job->dest = g_strdup(dest);
+    job->dest_compressed = dest_compressed;
+    job->sort = sort;
+    job->unlink_src = unlink_src;
+    job->tmpdir = g_strdup(tmpdir);
+    g_thread_pool_push(pool->pool, job, NULL);
+}
+
+guint
+index_sort_pool_free(
+    index_sort_pool_t *pool)
+{
+    guint failures;
+
+    g_thread_pool_free(pool->pool, FALSE, TRUE);
+    failures = pool->failures;
+    g_mutex_free(pool->mutex);
+    g_free(pool);
+    return failures;
+}
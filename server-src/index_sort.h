@@ -0,0 +1,88 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2013-2016 Carbonite, Inc.  All Rights Reserved.
+ * All Rights Reserved.
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that
+ * copyright notice and this permission notice appear in supporting
+ * documentation, and that the name of U.M. not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  U.M. makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as is"
+ * without express or implied warranty.
+ *
+ * U.M. DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE, INCLUDING ALL
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO EVENT SHALL U.M.
+ * BE LIABLE FOR ANY SPECIAL, INDIRECT OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ * Authors: the Amanda Development Team.  Its members are listed in a
+ * file named AUTHORS, in the root directory of this distribution.
+ */
+/*
+ * In-process uncompression, sorting and compression of index files, in
+ * place of the COMPRESS_PATH, UNCOMPRESS_PATH and SORT_PATH pipelines.
+ *
+ * Compressed index files are read and written with zlib, which is only
+ * possible when Amanda is built with it and COMPRESS_PATH is gzip; callers
+ * check index_sort_can_compress() and fall back to the external programs
+ * otherwise.  Sorting is always done in-process, in byte order, like
+ * 'LC_ALL=C sort', with a bounded amount of memory: runs are sorted by a
+ * pool of threads and spilled to temporary files, then merged.
+ */
+#ifndef INDEX_SORT_H
+#define INDEX_SORT_H
+
+#include "amanda.h"
+
+/* Can compressed index files be read and written in-process? */
+gboolean index_sort_can_compress(void);
+
+/* Copy the index file SRC to DEST, uncompressing, sorting and compressing it
+ * as requested.  DEST is written to a temporary file and renamed into place
+ * once complete.
+ *
+ * @param src: the index file to read
+ * @param src_compressed: SRC is compressed
+ * @param dest: the index file to write
+ * @param dest_compressed: compress DEST
+ * @param sort: sort the lines in byte order
+ * @param only_paths: drop the lines that do not contain a '/'
+ * @param tmpdir: where to spill sorted runs; NULL for the directory of DEST
+ * @param errmsg: (output) error message
+ * @returns: FALSE on error
+ */
+gboolean index_sort_convert(char *src, gboolean src_compressed,
+			    char *dest, gboolean dest_compressed,
+			    gboolean sort, gboolean only_paths,
+			    char *tmpdir, char **errmsg);
+
+/* A pool of threads running index_sort_convert, so that several index files
+ * are converted concurrently. */
+typedef struct index_sort_pool_s index_sort_pool_t;
+
+/* Create a pool running up to MAX_THREADS conversions at once; 0 means one
+ * per online processor. */
+index_sort_pool_t *index_sort_pool_new(guint max_threads);
+
+/* Queue a conversion; the arguments are as for index_sort_convert, and SRC is
+ * unlinked once DEST is complete if UNLINK_SRC is set.  The strings are
+ * copied. */
+void index_sort_pool_push(index_sort_pool_t *pool,
+			  char *src, gboolean src_compressed,
+			  char *dest, gboolean dest_compressed,
+			  gboolean sort, gboolean unlink_src,
+			  char *tmpdir);
+
+/* Wait for all the queued conversions and free the pool.  Errors are logged
+ * with g_debug.
+ *
+ * @returns: the number of conversions that failed
+ */
+guint index_sort_pool_free(index_sort_pool_t *pool);
+
+#endif /* INDEX_SORT_H */
@@ -35,22 +35,34 @@
 #include "conffile.h"
 #include "infofile.h"
 #include "amutil.h"
+#include <sys/mman.h>
 
 static void zero_info(info_t *);
 
   static char *infodir = NULL;
+  static infodb_t *infodb = NULL;
   static char *infofile = NULL;
   static char *newinfofile;
   static int writing;
 
-  static FILE *open_txinfofile(char *, char *, char *);
+  /* a text info record is read from a file, or from a buffer */
+  typedef struct info_lines_s {
+      FILE *file;
+      const char *buf;
+      const char *end;
+  } info_lines_t;
+
+  static FILE *open_txinfofile(char *, char *, char *, char *);
   static int close_txinfofile(FILE *);
-  static int read_txinfofile(FILE *, info_t *);
+  static char *info_gets(info_lines_t *);
+  static int read_txinfofile(info_lines_t *, info_t *);
+  static void info_to_text(GString *, info_t *);
   static int write_txinfofile(FILE *, info_t *);
-  static int delete_txinfofile(char *, char *);
+  static int delete_txinfofile(char *, char *, char *);
 
 static FILE *
 open_txinfofile(
+    char *	dir,
     char *	host,
     char *	disk,
     char *	mode)
@@ -66,7 +78,7 @@ open_txinfofile(
     myhost = sanitise_filename(host);
     mydisk = sanitise_filename(disk);
 
-    infofile = g_strjoin(NULL, infodir,
+    infofile = g_strjoin(NULL, dir,
 			 "/", myhost,
 			 "/", mydisk,
 			 "/info",
@@ -128,10 +140,37 @@ close_txinfofile(
     return rc;
 }
 
+/*
+ * Return the next line of a text info record, without its newline.  Lines
+ * read from a buffer are not subject to agets's comment and continuation
+ * handling; info_to_text never writes either.
+ */
+static char *
+info_gets(
+    info_lines_t *lines)
+{
+    const char *eol;
+    char *line;
+
+    if (lines->file)
+	return agets(lines->file);
+
+    if (lines->buf >= lines->end)
+	return NULL;
+
+    eol = memchr(lines->buf, '\n', lines->end - lines->buf);
+    if (eol == NULL)
+	eol = lines->end;
+    line = g_strndup(lines->buf, eol - lines->buf);
+    lines->buf = (eol < lines->end) ? eol + 1 : eol;
+
+    return line;
+}
+
 /* XXX - code assumes AVG_COUNT == 3 */
 static int
 read_txinfofile(
-    FILE *	infof,
+    info_lines_t *lines,
     info_t *	info)
 {
     char *line = NULL;
@@ -145,7 +184,7 @@ read_txinfofile(
 
     /* get version: command: lines */
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	if (line[0] != '\0')
 	    break;
 	amfree(line);
@@ -155,7 +194,7 @@ read_txinfofile(
     amfree(line);
     if(rc != 1) return -2;
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	if (line[0] != '\0')
 	    break;
 	amfree(line);
@@ -169,7 +208,7 @@ read_txinfofile(
 
     pp = &info->full;
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	if (line[0] != '\0')
 	    break;
 	amfree(line);
@@ -180,7 +219,7 @@ read_txinfofile(
     amfree(line);
     if(rc > 3) return -2;
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	if (line[0] != '\0')
 	    break;
 	amfree(line);
@@ -195,7 +234,7 @@ read_txinfofile(
 
     pp = &info->incr;
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	if (line[0] != '\0')
 	    break;
 	amfree(line);
@@ -206,7 +245,7 @@ read_txinfofile(
     amfree(line);
     if(rc > 3) return -2;
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	if (line[0] != '\0')
 	    break;
 	amfree(line);
@@ -219,7 +258,7 @@ read_txinfofile(
 
     /* get stats for dump levels */
 
-    for(rc = -2; (line = agets(infof)) != NULL; free(line)) {
+    for(rc = -2; (line = info_gets(lines)) != NULL; free(line)) {
 	stats_t onestat;	/* one stat record */
 	int level = 0;
 	long long off_t_tmp;
@@ -328,7 +367,7 @@ read_txinfofile(
 	info->history[i].level = -2;
     }
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	history_t onehistory;	/* one history record */
 	long long off_t_tmp;
 
@@ -401,7 +440,7 @@ read_txinfofile(
     }
     amfree(line);
 
-    while ((line = agets(infof)) != NULL) {
+    while ((line = info_gets(lines)) != NULL) {
 	if (line[0] != '\0')
 	    break;
 	amfree(line);
@@ -410,9 +449,9 @@ read_txinfofile(
     return rc;
 }
 
-static int
-write_txinfofile(
-    FILE *	infof,
+static void
+info_to_text(
+    GString *	text,
     info_t *	info)
 {
     int i;
@@ -420,68 +459,83 @@ write_txinfofile(
     perf_t *pp;
     int level;
 
-    g_fprintf(infof, _("version: %d\n"), 0);
+    g_string_append_printf(text, _("version: %d\n"), 0);
 
-    g_fprintf(infof, _("command: %u\n"), info->command);
+    g_string_append_printf(text, _("command: %u\n"), info->command);
 
     pp = &info->full;
 
-    g_fprintf(infof, "full-rate:");
+    g_string_append(text, "full-rate:");
     for(i=0; i<AVG_COUNT; i++)
 	if(pp->rate[i] >= 0.0)
-	    g_fprintf(infof, " %lf", pp->rate[i]);
-    g_fprintf(infof, "\n");
+	    g_string_append_printf(text, " %lf", pp->rate[i]);
+    g_string_append(text, "\n");
 
-    g_fprintf(infof, "full-comp:");
+    g_string_append(text, "full-comp:");
     for(i=0; i<AVG_COUNT; i++)
 	if(pp->comp[i] >= 0.0)
-	    g_fprintf(infof, " %lf", pp->comp[i]);
-    g_fprintf(infof, "\n");
+	    g_string_append_printf(text, " %lf", pp->comp[i]);
+    g_string_append(text, "\n");
 
     pp = &info->incr;
 
-    g_fprintf(infof, "incr-rate:");
+    g_string_append(text, "incr-rate:");
     for(i=0; i<AVG_COUNT; i++)
 	if(pp->rate[i] >= 0.0)
-	    g_fprintf(infof, " %lf", pp->rate[i]);
-    g_fprintf(infof, "\n");
+	    g_string_append_printf(text, " %lf", pp->rate[i]);
+    g_string_append(text, "\n");
 
-    g_fprintf(infof, "incr-comp:");
+    g_string_append(text, "incr-comp:");
     for(i=0; i<AVG_COUNT; i++)
 	if(pp->comp[i] >= 0.0)
-	    g_fprintf(infof, " %lf", pp->comp[i]);
-    g_fprintf(infof, "\n");
+	    g_string_append_printf(text, " %lf", pp->comp[i]);
+    g_string_append(text, "\n");
 
     for(level=0; level<DUMP_LEVELS; level++) {
 	sp = &info->inf[level];
 
 	if(sp->date < (time_t)0 && sp->label[0] == '\0') continue;
 
-	g_fprintf(infof, "stats: %d %lld %lld %jd %lld",
+	g_string_append_printf(text, "stats: %d %lld %lld %jd %lld",
 		level, (long long)sp->size, (long long)sp->csize,
 		(intmax_t)sp->secs, (long long)sp->date);
 	if(sp->label[0] != '\0')
-	    g_fprintf(infof, " %lld %s", (long long)sp->filenum, sp->label);
-	g_fprintf(infof, "\n");
+	    g_string_append_printf(text, " %lld %s", (long long)sp->filenum, sp->label);
+	g_string_append(text, "\n");
     }
 
-    g_fprintf(infof, _("last_level: %d %d\n"), info->last_level, info->consecutive_runs);
+    g_string_append_printf(text, _("last_level: %d %d\n"), info->last_level, info->consecutive_runs);
 
     for(i=0;i < NB_HISTORY && info->history[i].level > -1;i++) {
-	g_fprintf(infof, _("history: %d %lld %lld %jd %jd\n"),
+	g_string_append_printf(text, _("history: %d %lld %lld %jd %jd\n"),
 		info->history[i].level,
 		(long long)info->history[i].size,
 		(long long)info->history[i].csize,
 		(intmax_t)info->history[i].date,
 		(intmax_t)info->history[i].secs);
     }
-    g_fprintf(infof, "//\n");
+    g_string_append(text, "//\n");
+}
 
-    return 0;
+static int
+write_txinfofile(
+    FILE *	infof,
+    info_t *	info)
+{
+    GString *text = g_string_sized_new(1024);
+    int rc = 0;
+
+    info_to_text(text, info);
+    if (fputs(text->str, infof) == EOF)
+	rc = -1;
+    g_string_free(text, TRUE);
+
+    return rc;
 }
 
 static int
 delete_txinfofile(
+    char *	dir,
     char *	host,
     char *	disk)
 {
@@ -492,7 +546,7 @@ delete_txinfofile(
 
     myhost = sanitise_filename(host);
     mydisk = sanitise_filename(disk);
-    fn = g_strjoin(NULL, infodir,
+    fn = g_strjoin(NULL, dir,
 		   "/", myhost,
 		   "/", mydisk,
 		   "/info",
@@ -505,18 +559,833 @@ delete_txinfofile(
     unlink(fn_new);
     amfree(fn_new);
 
-    rc = rmpdir(fn, infodir);
+    rc = rmpdir(fn, dir);
     amfree(fn);
 
     return rc;
 }
 
+int
+get_txinfo(
+    char *	dir,
+    char *	hostname,
+    char *	diskname,
+    info_t *	info)
+{
+    FILE *infof;
+    info_lines_t lines = { NULL, NULL, NULL };
+    int rc;
+
+    (void) zero_info(info);
+
+    infof = open_txinfofile(dir, hostname, diskname, "r");
+
+    if(infof == NULL) {
+	rc = -1; /* record not found */
+    }
+    else {
+	lines.file = infof;
+	rc = read_txinfofile(&lines, info);
+
+	close_txinfofile(infof);
+    }
+
+    return rc;
+}
+
+int
+put_txinfo(
+    char *	dir,
+    char *	hostname,
+    char *	diskname,
+    info_t *	info)
+{
+    FILE *infof;
+    int rc;
+
+    infof = open_txinfofile(dir, hostname, diskname, "w");
+
+    if(infof == NULL) return -1;
+
+    rc = write_txinfofile(infof, info);
+
+    rc = rc || close_txinfofile(infof);
+
+    return rc;
+}
+
+/*
+ * The info database
+ *
+ * An infofile whose name ends in ".db" is a single file rather than a
+ * directory tree.  It starts with a 16-byte header (INFODB_MAGIC, then the
+ * version as a little-endian 32-bit integer, then 4 reserved bytes),
+ * followed by an append-only log of records.  Each record has a 16-byte
+ * header:
+ *
+ *   uint32 size	  size of the record, header and padding included
+ *   uint32 crc		  CRC-32C of the rest of the record, up to the padding
+ *   uint16 hostlen
+ *   uint16 disklen
+ *   uint32 datalen	  0 for a deletion
+ *
+ * followed by the host name, the disk name, the encoded info_t (see
+ * infodb_encode), and zero padding to a multiple of 8 bytes.  All integers
+ * are little-endian.
+ *
+ * The file is mmap'd, and an index from "host\ndisk" to the latest record
+ * is built by scanning it, so a get_info is a hash lookup and a decode.
+ * Readers take no lock; before each access they stat the file and scan any
+ * records appended since.  Writers lock "<infofile>.lock", append a record
+ * and scan it.  A record is visible once it is complete: a torn record left
+ * by a crash fails its CRC, stops the scan, and is dropped by the next
+ * writer, which compacts the file.  When less than half of a large file is
+ * live, the latest records are copied to "<infofile>.new", which is synced
+ * and renamed over the infofile; other processes notice the new inode and
+ * rescan.  Nothing is synced on a plain put_info, so an update can be lost
+ * by a system crash, but never half-applied.
+ */
+
+#define INFODB_MAGIC		"AMINFODB"
+#define INFODB_VERSION		1
+#define INFODB_HEADER_SIZE	16
+#define INFODB_RECORD_HEADER	16
+#define INFODB_MAP_SLACK	(1024*1024)
+#define INFODB_COMPACT_SIZE	(1024*1024)
+
+struct infodb_s {
+    char       *filename;
+    char       *lockname;
+    int		fd;
+    int		lockfd;
+    gboolean	writable;
+    dev_t	dev;
+    ino_t	ino;
+    guint8     *map;
+    size_t	map_size;
+    off_t	file_size;
+    off_t	scanned;	/* end of the last good record */
+    off_t	live;		/* bytes of records in the index */
+    GHashTable *index;		/* "host\ndisk" -> infodb_rec_t */
+};
+
+typedef struct infodb_rec_s {
+    off_t	offset;
+    guint32	size;
+} infodb_rec_t;
+
+typedef struct infodb_cursor_s {
+    const guint8 *p;
+    const guint8 *end;
+    gboolean	error;
+} infodb_cursor_t;
+
+static guint32
+infodb_le32(
+    const guint8 *p)
+{
+    guint32 v;
+
+    memcpy(&v, p, sizeof(v));
+    return GUINT32_FROM_LE(v);
+}
+
+static guint16
+infodb_le16(
+    const guint8 *p)
+{
+    guint16 v;
+
+    memcpy(&v, p, sizeof(v));
+    return GUINT16_FROM_LE(v);
+}
+
+static void
+infodb_put32(
+    GByteArray *buf,
+    guint32	v)
+{
+    v = GUINT32_TO_LE(v);
+    g_byte_array_append(buf, (guint8 *)&v, sizeof(v));
+}
+
+static void
+infodb_put64(
+    GByteArray *buf,
+    guint64	v)
+{
+    v = GUINT64_TO_LE(v);
+    g_byte_array_append(buf, (guint8 *)&v, sizeof(v));
+}
+
+static void
+infodb_putdouble(
+    GByteArray *buf,
+    double	d)
+{
+    guint64 v;
+
+    memcpy(&v, &d, sizeof(v));
+    infodb_put64(buf, v);
+}
+
+static guint32
+infodb_get32(
+    infodb_cursor_t *c)
+{
+    guint32 v;
+
+    if (c->end - c->p < (ptrdiff_t)sizeof(v)) {
+	c->error = TRUE;
+	return 0;
+    }
+    memcpy(&v, c->p, sizeof(v));
+    c->p += sizeof(v);
+    return GUINT32_FROM_LE(v);
+}
+
+static guint64
+infodb_get64(
+    infodb_cursor_t *c)
+{
+    guint64 v;
+
+    if (c->end - c->p < (ptrdiff_t)sizeof(v)) {
+	c->error = TRUE;
+	return 0;
+    }
+    memcpy(&v, c->p, sizeof(v));
+    c->p += sizeof(v);
+    return GUINT64_FROM_LE(v);
+}
+
+static double
+infodb_getdouble(
+    infodb_cursor_t *c)
+{
+    guint64 v = infodb_get64(c);
+    double d;
+
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+/*
+ * Encode info as: command, last_level, consecutive_runs, the full and incr
+ * rates and comps, the count of stats followed by each (level, size, csize,
+ * secs, date, filenum, label length, label), and the count of history
+ * entries followed by each (level, size, csize, date, secs).
+ */
+static void
+infodb_encode(
+    GByteArray *buf,
+    info_t *	info)
+{
+    int i;
+    int level;
+    guint32 count;
+    stats_t *sp;
+    history_t *hp;
+
+    infodb_put32(buf, info->command);
+    infodb_put32(buf, (guint32)info->last_level);
+    infodb_put32(buf, (guint32)info->consecutive_runs);
+    for (i = 0; i < AVG_COUNT; i++)
+	infodb_putdouble(buf, info->full.rate[i]);
+    for (i = 0; i < AVG_COUNT; i++)
+	infodb_putdouble(buf, info->full.comp[i]);
+    for (i = 0; i < AVG_COUNT; i++)
+	infodb_putdouble(buf, info->incr.rate[i]);
+    for (i = 0; i < AVG_COUNT; i++)
+	infodb_putdouble(buf, info->incr.comp[i]);
+
+    count = 0;
+    for (level = 0; level < DUMP_LEVELS; level++) {
+	sp = &info->inf[level];
+	if (sp->date >= (time_t)0 || sp->label[0] != '\0')
+	    count++;
+    }
+    infodb_put32(buf, count);
+    for (level = 0; level < DUMP_LEVELS; level++) {
+	guint32 labellen;
+
+	sp = &info->inf[level];
+	if (sp->date < (time_t)0 && sp->label[0] == '\0')
+	    continue;
+	labellen = strlen(sp->label);
+	infodb_put32(buf, level);
+	infodb_put64(buf, (guint64)sp->size);
+	infodb_put64(buf, (guint64)sp->csize);
+	infodb_put64(buf, (guint64)sp->secs);
+	infodb_put64(buf, (guint64)sp->date);
+	infodb_put64(buf, (guint64)sp->filenum);
+	infodb_put32(buf, labellen);
+	g_byte_array_append(buf, (guint8 *)sp->label, labellen);
+    }
+
+    for (count = 0; count < NB_HISTORY && info->history[count].level > -1;
+	 count++) {
+    }
+    infodb_put32(buf, count);
+    for (i = 0; i < (int)count; i++) {
+	hp = &info->history[i];
+	infodb_put32(buf, (guint32)hp->level);
+	infodb_put64(buf, (guint64)hp->size);
+	infodb_put64(buf, (guint64)hp->csize);
+	infodb_put64(buf, (guint64)hp->date);
+	infodb_put64(buf, (guint64)hp->secs);
+    }
+}
+
+static int
+infodb_decode(
+    const guint8 *data,
+    size_t	len,
+    info_t *	info)
+{
+    infodb_cursor_t c = { data, data + len, FALSE };
+    guint32 count;
+    guint32 n;
+    int i;
+
+    (void) zero_info(info);
+
+    info->command = infodb_get32(&c);
+    info->last_level = (gint32)infodb_get32(&c);
+    info->consecutive_runs = (gint32)infodb_get32(&c);
+    for (i = 0; i < AVG_COUNT; i++)
+	info->full.rate[i] = infodb_getdouble(&c);
+    for (i = 0; i < AVG_COUNT; i++)
+	info->full.comp[i] = infodb_getdouble(&c);
+    for (i = 0; i < AVG_COUNT; i++)
+	info->incr.rate[i] = infodb_getdouble(&c);
+    for (i = 0; i < AVG_COUNT; i++)
+	info->incr.comp[i] = infodb_getdouble(&c);
+
+    count = infodb_get32(&c);
+    if (count > DUMP_LEVELS)
+	return -2;
+    for (n = 0; n < count && !c.error; n++) {
+	guint32 level = infodb_get32(&c);
+	guint32 labellen;
+	stats_t onestat;
+
+	memset(&onestat, 0, sizeof(onestat));
+	onestat.size = (off_t)infodb_get64(&c);
+	onestat.csize = (off_t)infodb_get64(&c);
+	onestat.secs = (time_t)infodb_get64(&c);
+	onestat.date = (time_t)infodb_get64(&c);
+	onestat.filenum = (off_t)infodb_get64(&c);
+	labellen = infodb_get32(&c);
+	if (c.error || level >= DUMP_LEVELS || labellen >= MAX_LABEL ||
+	    (ptrdiff_t)labellen > c.end - c.p)
+	    return -2;
+	memcpy(onestat.label, c.p, labellen);
+	onestat.label[labellen] = '\0';
+	c.p += labellen;
+	info->inf[level] = onestat;
+    }
+
+    count = infodb_get32(&c);
+    if (count > NB_HISTORY)
+	return -2;
+    for (n = 0; n < count && !c.error; n++) {
+	history_t *hp = &info->history[n];
+
+	hp->level = (gint32)infodb_get32(&c);
+	hp->size = (off_t)infodb_get64(&c);
+	hp->csize = (off_t)infodb_get64(&c);
+	hp->date = (time_t)infodb_get64(&c);
+	hp->secs = (time_t)infodb_get64(&c);
+    }
+
+    return c.error ? -2 : 0;
+}
+
+static void
+infodb_unmap(
+    infodb_t *db)
+{
+    if (db->map) {
+	munmap(db->map, db->map_size);
+	db->map = NULL;
+	db->map_size = 0;
+    }
+}
+
+/* (re)open the file at db->filename, forgetting everything about the old one */
+static int
+infodb_reopen(
+    infodb_t *db)
+{
+    struct stat st;
+
+    infodb_unmap(db);
+    if (db->fd >= 0)
+	close(db->fd);
+    if (db->index)
+	g_hash_table_destroy(db->index);
+    db->index = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    db->file_size = 0;
+    db->scanned = 0;
+    db->live = 0;
+
+    db->writable = TRUE;
+    db->fd = open(db->filename, O_RDWR | O_CREAT, 0600);
+    if (db->fd == -1 && errno == EACCES) {
+	db->writable = FALSE;
+	db->fd = open(db->filename, O_RDONLY);
+    }
+    if (db->fd == -1) {
+	g_debug("infodb: can't open '%s': %s", db->filename, strerror(errno));
+	return -1;
+    }
+    if (fstat(db->fd, &st) == -1) {
+	g_debug("infodb: can't stat '%s': %s", db->filename, strerror(errno));
+	close(db->fd);
+	db->fd = -1;
+	return -1;
+    }
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+
+    return 0;
+}
+
+/* add the records between db->scanned and the end of the file to the index */
+static void
+infodb_scan(
+    infodb_t *db)
+{
+    while (db->file_size - db->scanned >= INFODB_RECORD_HEADER) {
+	const guint8 *p = db->map + db->scanned;
+	guint32 size = infodb_le32(p);
+	guint32 crc = infodb_le32(p + 4);
+	guint16 hostlen = infodb_le16(p + 8);
+	guint16 disklen = infodb_le16(p + 10);
+	guint32 datalen = infodb_le32(p + 12);
+	size_t used = (size_t)INFODB_RECORD_HEADER + hostlen + disklen + datalen;
+	infodb_rec_t *rec;
+	crc_t crc32;
+	char *key;
+
+	if (size < INFODB_RECORD_HEADER || size % 8 != 0 ||
+	    size > db->file_size - db->scanned || used > size)
+	    break;
+	crc32_init(&crc32);
+	crc32_add((uint8_t *)p + 8, used - 8, &crc32);
+	if (crc32_finish(&crc32) != crc)
+	    break;
+
+	key = g_malloc(hostlen + disklen + 2);
+	memcpy(key, p + INFODB_RECORD_HEADER, hostlen);
+	key[hostlen] = '\n';
+	memcpy(key + hostlen + 1, p + INFODB_RECORD_HEADER + hostlen, disklen);
+	key[hostlen + 1 + disklen] = '\0';
+
+	rec = g_hash_table_lookup(db->index, key);
+	if (rec)
+	    db->live -= rec->size;
+	if (datalen > 0) {
+	    rec = g_new(infodb_rec_t, 1);
+	    rec->offset = db->scanned;
+	    rec->size = size;
+	    g_hash_table_insert(db->index, key, rec);
+	    db->live += size;
+	} else {
+	    g_hash_table_remove(db->index, key);
+	    g_free(key);
+	}
+
+	db->scanned += size;
+    }
+}
+
+/* catch up with the changes made by other processes */
+static int
+infodb_refresh(
+    infodb_t *db)
+{
+    struct stat st;
+
+    if (stat(db->filename, &st) == -1 ||
+	st.st_dev != db->dev || st.st_ino != db->ino) {
+	/* compacted by another process */
+	if (infodb_reopen(db) == -1 || fstat(db->fd, &st) == -1)
+	    return -1;
+    }
+
+    db->file_size = st.st_size;
+    if (db->scanned >= db->file_size)
+	return 0;
+
+    /* map past the end of the file, so that appends rarely need a remap */
+    if ((size_t)db->file_size > db->map_size) {
+	size_t map_size = db->file_size + db->file_size / 2 + INFODB_MAP_SLACK;
+
+	infodb_unmap(db);
+	db->map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, db->fd, 0);
+	if (db->map == MAP_FAILED) {
+	    g_debug("infodb: can't mmap '%s': %s", db->filename,
+		    strerror(errno));
+	    db->map = NULL;
+	    return -1;
+	}
+	db->map_size = map_size;
+    }
+
+    if (db->scanned == 0) {
+	if (db->file_size < INFODB_HEADER_SIZE)
+	    return 0; /* not initialized yet */
+	if (memcmp(db->map, INFODB_MAGIC, strlen(INFODB_MAGIC)) != 0 ||
+	    infodb_le32(db->map + 8) != INFODB_VERSION) {
+	    g_debug("infodb: '%s' is not an info database", db->filename);
+	    return -1;
+	}
+	db->scanned = INFODB_HEADER_SIZE;
+    }
+
+    infodb_scan(db);
+
+    return 0;
+}
+
+static int
+write_infodb_header(
+    int		fd)
+{
+    guint8 header[INFODB_HEADER_SIZE];
+    guint32 version = GUINT32_TO_LE(INFODB_VERSION);
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, INFODB_MAGIC, strlen(INFODB_MAGIC));
+    memcpy(header + 8, &version, sizeof(version));
+
+    if (full_write(fd, header, sizeof(header)) != sizeof(header))
+	return -1;
+    return 0;
+}
+
+static int
+infodb_rec_cmp(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const infodb_rec_t *ra = *(infodb_rec_t **)a;
+    const infodb_rec_t *rb = *(infodb_rec_t **)b;
+
+    if (ra->offset < rb->offset) return -1;
+    if (ra->offset > rb->offset) return 1;
+    return 0;
+}
+
+static void
+infodb_add_rec(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data)
+{
+    g_ptr_array_add((GPtrArray *)user_data, value);
+}
+
+/*
+ * Replace the file with one holding only the records in the index.  Called
+ * with the lock held.
+ */
+static int
+infodb_compact(
+    infodb_t *db)
+{
+    char *newname = g_strconcat(db->filename, ".new", NULL);
+    GPtrArray *recs = g_ptr_array_new();
+    guint i;
+    int fd;
+    int rc = -1;
+
+    fd = open(newname, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+	g_debug("infodb: can't open '%s': %s", newname, strerror(errno));
+	goto done;
+    }
+
+    g_hash_table_foreach(db->index, infodb_add_rec, recs);
+    g_ptr_array_sort(recs, infodb_rec_cmp);
+
+    if (write_infodb_header(fd) == -1)
+	goto write_error;
+    for (i = 0; i < recs->len; i++) {
+	infodb_rec_t *rec = g_ptr_array_index(recs, i);
+
+	if (full_write(fd, db->map + rec->offset, rec->size) != rec->size)
+	    goto write_error;
+    }
+    if (fsync(fd) == -1)
+	goto write_error;
+    if (close(fd) == -1) {
+	fd = -1;
+	goto write_error;
+    }
+    fd = -1;
+    if (rename(newname, db->filename) == -1)
+	goto write_error;
+
+    g_debug("infodb: compacted '%s' from %lld to %lld bytes", db->filename,
+	    (long long)db->file_size,
+	    (long long)(db->live + INFODB_HEADER_SIZE));
+    rc = infodb_refresh(db);
+    goto done;
+
+write_error:
+    g_debug("infodb: can't write '%s': %s", newname, strerror(errno));
+    if (fd != -1)
+	close(fd);
+    unlink(newname);
+
+done:
+    g_ptr_array_free(recs, TRUE);
+    g_free(newname);
+    return rc;
+}
+
+/*
+ * Append a record for host:disk; DATA is NULL to delete it.
+ */
+static int
+infodb_write(
+    infodb_t *	db,
+    char *	host,
+    char *	disk,
+    guint8 *	data,
+    size_t	datalen)
+{
+    size_t hostlen = strlen(host);
+    size_t disklen = strlen(disk);
+    GByteArray *rec;
+    crc_t crc;
+    size_t padded;
+    guint32 v;
+    int rc = -1;
+
+    if (!db->writable || db->lockfd == -1 ||
+	hostlen > G_MAXUINT16 || disklen > G_MAXUINT16)
+	return -1;
+
+    if (amflock(db->lockfd, "infodb") != 0)
+	return -1;
+
+    if (infodb_refresh(db) == -1)
+	goto unlock;
+
+    if (db->file_size < INFODB_HEADER_SIZE) {
+	if (ftruncate(db->fd, 0) == -1 ||
+	    lseek(db->fd, 0, SEEK_SET) == -1 ||
+	    write_infodb_header(db->fd) == -1 ||
+	    infodb_refresh(db) == -1)
+	    goto unlock;
+    }
+
+    /* drop a torn record left by a crash */
+    if (db->scanned < db->file_size) {
+	if (infodb_compact(db) == -1)
+	    goto unlock;
+    }
+
+    if (!data)
+	datalen = 0;
+    padded = (INFODB_RECORD_HEADER + hostlen + disklen + datalen + 7) & ~(size_t)7;
+    rec = g_byte_array_sized_new(padded);
+    infodb_put32(rec, padded);
+    infodb_put32(rec, 0); /* crc, filled in below */
+    infodb_put32(rec, hostlen | (disklen << 16)); /* the two uint16 */
+    infodb_put32(rec, datalen);
+    g_byte_array_append(rec, (guint8 *)host, hostlen);
+    g_byte_array_append(rec, (guint8 *)disk, disklen);
+    if (data)
+	g_byte_array_append(rec, data, datalen);
+    crc32_init(&crc);
+    crc32_add(rec->data + 8, rec->len - 8, &crc);
+    v = GUINT32_TO_LE(crc32_finish(&crc));
+    memcpy(rec->data + 4, &v, sizeof(v));
+    while (rec->len < padded) {
+	guint8 zero = 0;
+	g_byte_array_append(rec, &zero, 1);
+    }
+
+    if (lseek(db->fd, db->file_size, SEEK_SET) == -1 ||
+	full_write(db->fd, rec->data, rec->len) != rec->len) {
+	g_debug("infodb: can't write '%s': %s", db->filename, strerror(errno));
+	g_byte_array_free(rec, TRUE);
+	goto unlock;
+    }
+    g_byte_array_free(rec, TRUE);
+
+    if (infodb_refresh(db) == -1)
+	goto unlock;
+    rc = 0;
+
+    if (db->file_size > INFODB_COMPACT_SIZE && db->live * 2 < db->file_size)
+	infodb_compact(db);
+
+unlock:
+    amfunlock(db->lockfd, "infodb");
+    return rc;
+}
+
+infodb_t *
+infodb_open(
+    char *	filename)
+{
+    infodb_t *db = g_new0(infodb_t, 1);
+
+    make_crc_table();
+
+    db->filename = g_strdup(filename);
+    db->lockname = g_strconcat(filename, ".lock", NULL);
+    db->fd = -1;
+    db->lockfd = open(db->lockname, O_RDWR | O_CREAT, 0600);
+
+    if (infodb_reopen(db) == -1 || infodb_refresh(db) == -1) {
+	infodb_close(db);
+	return NULL;
+    }
+
+    return db;
+}
+
+void
+infodb_close(
+    infodb_t *	db)
+{
+    infodb_unmap(db);
+    if (db->fd >= 0)
+	close(db->fd);
+    if (db->lockfd >= 0)
+	close(db->lockfd);
+    if (db->index)
+	g_hash_table_destroy(db->index);
+    g_free(db->filename);
+    g_free(db->lockname);
+    g_free(db);
+}
+
+int
+infodb_get(
+    infodb_t *	db,
+    char *	hostname,
+    char *	diskname,
+    info_t *	info)
+{
+    infodb_rec_t *rec;
+    const guint8 *p;
+    char *key;
+
+    (void) zero_info(info);
+
+    if (infodb_refresh(db) == -1)
+	return -1;
+
+    key = g_strconcat(hostname, "\n", diskname, NULL);
+    rec = g_hash_table_lookup(db->index, key);
+    g_free(key);
+    if (!rec)
+	return -1; /* record not found */
+
+    p = db->map + rec->offset;
+    return infodb_decode(p + INFODB_RECORD_HEADER + infodb_le16(p + 8) +
+			 infodb_le16(p + 10),
+			 infodb_le32(p + 12), info);
+}
+
+int
+infodb_put(
+    infodb_t *	db,
+    char *	hostname,
+    char *	diskname,
+    info_t *	info)
+{
+    GByteArray *data = g_byte_array_sized_new(1024);
+    int rc;
+
+    infodb_encode(data, info);
+    rc = infodb_write(db, hostname, diskname, data->data, data->len);
+    g_byte_array_free(data, TRUE);
+
+    return rc;
+}
+
+int
+infodb_delete(
+    infodb_t *	db,
+    char *	hostname,
+    char *	diskname)
+{
+    char *key;
+    gboolean found;
+
+    if (infodb_refresh(db) == -1)
+	return -1;
+
+    key = g_strconcat(hostname, "\n", diskname, NULL);
+    found = g_hash_table_lookup(db->index, key) != NULL;
+    g_free(key);
+    if (!found)
+	return -1;
+
+    return infodb_write(db, hostname, diskname, NULL, 0);
+}
+
+char *
+infodb_get_text(
+    infodb_t *	db,
+    char *	hostname,
+    char *	diskname)
+{
+    info_t *info = g_new(info_t, 1);
+    GString *text;
+
+    if (infodb_get(db, hostname, diskname, info) != 0) {
+	g_free(info);
+	return NULL;
+    }
+
+    text = g_string_sized_new(1024);
+    info_to_text(text, info);
+    g_free(info);
+
+    return g_string_free(text, FALSE);
+}
+
+int
+infodb_put_text(
+    infodb_t *	db,
+    char *	hostname,
+    char *	diskname,
+    char *	text)
+{
+    info_lines_t lines = { NULL, text, text + strlen(text) };
+    info_t *info = g_new(info_t, 1);
+    int rc;
+
+    (void) zero_info(info);
+    rc = read_txinfofile(&lines, info);
+    if (rc == 0)
+	rc = infodb_put(db, hostname, diskname, info);
+    g_free(info);
+
+    return rc;
+}
+
 int
 open_infofile(
     char *	filename)
 {
     assert(infodir == NULL);
 
+    if (g_str_has_suffix(filename, ".db")) {
+	infodb = infodb_open(filename);
+	if (!infodb)
+	    return -1;
+    }
     infodir = g_strdup(filename);
 
     return 0; /* success! */
@@ -527,6 +1396,10 @@ close_infofile(void)
 {
     assert(infodir != NULL);
 
+    if (infodb) {
+	infodb_close(infodb);
+	infodb = NULL;
+    }
     amfree(infodir);
 }
 
@@ -644,26 +1517,10 @@ get_info(
     char *	diskname,
     info_t *	info)
 {
-    int rc;
-
-    (void) zero_info(info);
+    if (infodb)
+	return infodb_get(infodb, hostname, diskname, info);
 
-    {
-	FILE *infof;
-
-	infof = open_txinfofile(hostname, diskname, "r");
-
-	if(infof == NULL) {
-	    rc = -1; /* record not found */
-	}
-	else {
-	    rc = read_txinfofile(infof, info);
-
-	    close_txinfofile(infof);
-	}
-    }
-
-    return rc;
+    return get_txinfo(infodir, hostname, diskname, info);
 }
 
 
@@ -673,18 +1530,10 @@ put_info(
      char *	diskname,
      info_t *	info)
 {
-    FILE *infof;
-    int rc;
+    if (infodb)
+	return infodb_put(infodb, hostname, diskname, info);
 
-    infof = open_txinfofile(hostname, diskname, "w");
-
-    if(infof == NULL) return -1;
-
-    rc = write_txinfofile(infof, info);
-
-    rc = rc || close_txinfofile(infof);
-
-    return rc;
+    return put_txinfo(infodir, hostname, diskname, info);
 }
 
 
@@ -693,10 +1542,14 @@ del_info(
     char *	hostname,
     char *	diskname)
 {
-    return delete_txinfofile(hostname, diskname);
+    if (infodb)
+	return infodb_delete(infodb, hostname, diskname);
+
+    return delete_txinfofile(infodir, hostname, diskname);
 }
 
 
+
 #ifdef TEST
 
 void dump_rec(info_t *info);
@@ -95,4 +95,24 @@ int get_info(char *hostname, char *diskname, info_t *info);
 int put_info(char *hostname, char *diskname, info_t *info);
 int del_info(char *hostname, char *diskname);
 
+/* Access the text layout in DIR directly, whatever the infofile is; used to
+ * convert it to and from an info database. */
+int get_txinfo(char *dir, char *hostname, char *diskname, info_t *info);
+int put_txinfo(char *dir, char *hostname, char *diskname, info_t *info);
+
+/* An info database is a single mmap'd file, used when the infofile name ends
+ * in ".db".  get_info and friends use it through open_infofile; these are for
+ * callers that need their own handle.  The _text functions convert to and
+ * from the text layout; infodb_get_text returns NULL if there is no record,
+ * and its result must be freed by the caller. */
+typedef struct infodb_s infodb_t;
+
+infodb_t *infodb_open(char *filename);
+void infodb_close(infodb_t *db);
+int infodb_get(infodb_t *db, char *hostname, char *diskname, info_t *info);
+int infodb_put(infodb_t *db, char *hostname, char *diskname, info_t *info);
+int infodb_delete(infodb_t *db, char *hostname, char *diskname);
+char *infodb_get_text(infodb_t *db, char *hostname, char *diskname);
+int infodb_put_text(infodb_t *db, char *hostname, char *diskname, char *text);
+
 #endif /* ! INFOFILE_H */
@@ -36,6 +36,7 @@
 #include "conffile.h"
 
 #include "logfile.h"
+#include "find.h"
 
 char *logtype_str[] = {
     "BOGUS",
@@ -310,8 +311,24 @@ log_rename(
     logfile = g_strjoin(NULL, conf_logdir, "/log", NULL);
 
     if (lstat(logfile, &statbuf) == 0 && S_ISLNK(statbuf.st_mode)) {
+	char target[PATH_MAX];
+	ssize_t len = readlink(logfile, target, sizeof(target) - 1);
+
 	g_debug("Remove symbolic link %s", logfile);
 	unlink(logfile);
+	/* the logfile it points to is complete now */
+	if (len > 0) {
+	    target[len] = '\0';
+	    if (target[0] == '/') {
+		find_catalog_add_log(target);
+	    } else {
+		fname = g_strconcat(conf_logdir, "/", target, NULL);
+		find_catalog_add_log(fname);
+		amfree(fname);
+	    }
+	}
+	amfree(logfile);
+	amfree(conf_logdir);
 	return;
     }
 
@@ -325,6 +342,8 @@ log_rename(
     if(rename(logfile, fname) == -1) {
 	g_debug(_("could not rename \"%s\" to \"%s\": %s"),
 	      logfile, fname, strerror(errno));
+    } else {
+	find_catalog_add_log(fname);
     }
 
     amfree(fname);
@@ -70,6 +70,7 @@ int	conf_dumpcycle;
 int	conf_runspercycle;
 int	conf_tapecycle;
 time_t	conf_etimeout;
+int	conf_estimate_parallel;
 int	conf_reserve;
 int	conf_usetimestamps;
 
@@ -116,6 +117,7 @@ typedef struct est_s {
 
 typedef struct estlist_s {
     GList *head, *tail;
+    GHashTable *index;	/* est_t * -> its link, so remove_est need not search */
 } estlist_t;
 #define get_est(elist) ((est_t *)((elist)->data))
 
@@ -126,8 +128,11 @@ estlist_t pestq;	// PREP received, waiting for PREP or REP
 estlist_t estq;		// REP received and valid, analyze not done
 estlist_t failq;	// REP received, failed
 estlist_t schedq;	// REP received and valid, analyze done.
+estlist_t doneq;	// REP received and valid, for the DONE QUEUE dump
 estlist_t activeq;	//
 
+static GHashTable *est_by_disk = NULL;	/* disk_t * -> est_t *, for find_est_for_dp */
+
 gint64 total_size;
 double total_lev0, balanced_size, balance_threshold;
 gint64 tape_length;
@@ -193,6 +198,9 @@ static void insert_est(estlist_t *list, est_t *est, int (*cmp)(est_t *a, est_t *
 static est_t *find_est_for_dp(disk_t *dp);
 static est_t *dequeue_est(estlist_t *list);
 static void remove_est(estlist_t *list, est_t *	est);
+static void sort_est(estlist_t *list, GCompareFunc cmp);
+static gboolean est_in_queue(estlist_t *list, est_t *est);
+static gint schedule_order_compare(gconstpointer a, gconstpointer b);
 static void est_dump_queue(char      *st,
 			   estlist_t  q,
 			   int        npr,
@@ -404,6 +412,7 @@ main(
     conf_dumpcycle = getconf_int(CNF_DUMPCYCLE);
     conf_runspercycle = getconf_int(CNF_RUNSPERCYCLE);
     conf_etimeout = (time_t)getconf_int(CNF_ETIMEOUT);
+    conf_estimate_parallel = getconf_int(CNF_ESTIMATE_PARALLEL);
     conf_reserve  = getconf_int(CNF_RESERVE);
     conf_usetimestamps = getconf_boolean(CNF_USETIMESTAMPS);
 
@@ -706,6 +715,15 @@ main(
     pestq.head = pestq.tail = NULL;
     waitq.head = waitq.tail = NULL;
     failq.head = failq.tail = NULL;
+    doneq.head = doneq.tail = NULL;
+
+    /* the estimates are analyzed as they come in, see start_estimates() */
+			/* an empty tape still has a label and an endmark */
+    total_size = ((gint64)tt_blocksize_kb + (gint64)tape_mark) * (gint64)2;
+    total_lev0 = 0.0;
+    balanced_size = 0.0;
+
+    schedq.head = schedq.tail = NULL;
 
     get_estimates();
 
@@ -715,13 +733,26 @@ main(
 		    walltime_str(timessub(curclock(), section_start)));
 
     /*
-     * At this point, all disks with estimates are in estq, and
-     * all the disks on hosts that didn't respond to our inquiry
-     * are in failq.
+     * At this point, most disks with estimates have already been
+     * analyzed onto schedq, the rest (those whose estimate timed out
+     * part way) are in estq, and all the disks on hosts that didn't
+     * respond to our inquiry are in failq.  doneq has every disk with
+     * an estimate, in the order they came in.
      */
 
+    {
+	GList  *elist;
+
+	for (elist = estq.head; elist != NULL; elist = elist->next)
+	    enqueue_est(&doneq, get_est(elist));
+    }
     est_dump_queue("FAILED", failq, 15, stderr);
-    est_dump_queue("DONE", estq, 15, stderr);
+    est_dump_queue("DONE", doneq, 15, stderr);
+    while (!empty(doneq)) dequeue_est(&doneq);
+    if (doneq.index) {
+	g_hash_table_destroy(doneq.index);
+	doneq.index = NULL;
+    }
 
     if (!empty(failq)) {
         exit_status = EXIT_FAILURE;
@@ -739,14 +770,9 @@ main(
     g_fprintf(stderr,_("\nANALYZING ESTIMATES...\n"));
     section_start = curclock();
 
-			/* an empty tape still has a label and an endmark */
-    total_size = ((gint64)tt_blocksize_kb + (gint64)tape_mark) * (gint64)2;
-    total_lev0 = 0.0;
-    balanced_size = 0.0;
-
-    schedq.head = schedq.tail = NULL;
     while(!empty(estq)) analyze_estimate(dequeue_est(&estq));
     while(!empty(failq)) handle_failed(dequeue_est(&failq));
+    sort_est(&schedq, schedule_order_compare);
 
     run_server_global_scripts(EXECUTE_ON_POST_ESTIMATE, get_config_name(),
 			      planner_timestamp);
@@ -1332,6 +1358,9 @@ setup_estimate(
 	    ep->estimate[2].level, (long long)ep->estimate[2].nsize);
 
     assert(ep->estimate[0].level != -1);
+    if (!est_by_disk)
+	est_by_disk = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_hash_table_insert(est_by_disk, dp, ep);
     enqueue_est(&startq, ep);
     amfree(qname);
 }
@@ -1578,45 +1607,303 @@ static disk_t *lookup_hostdisk(am_host_t *hp, char *str);
 static void handle_result(void *datap, pkt_t *pkt, security_handle_t *sech);
 
 
-static void get_estimates(void)
+/*
+ * Estimate requests are sent a host at a time.  With estimate-parallel, at
+ * most that many hosts on each network interface are asked at once.  The
+ * hosts that took longest to answer on the previous run are asked first, so
+ * that a slow client starts early instead of being the last one waited for.
+ * How long each host took is kept in <logdir>/estimate-times.
+ */
+
+typedef struct est_host_s {
+    am_host_t *host;
+    int        order;		/* position on startq */
+    double     latency;		/* secs it took last run, or -1 if unknown */
+    times_t    start;
+} est_host_t;
+
+typedef struct est_netif_s {
+    GList *hosts;		/* est_host_t not asked yet, slowest first */
+    int    active;		/* hosts being asked */
+} est_netif_t;
+
+static GHashTable *est_netifs = NULL;	/* netif_t * -> est_netif_t * */
+static GHashTable *est_active = NULL;	/* am_host_t * -> est_host_t * */
+static GHashTable *est_latency = NULL;	/* hostname -> double * */
+
+static char *
+estimate_times_file(void)
+{
+    char *logdir = config_dir_relative(getconf_str(CNF_LOGDIR));
+    char *filename = g_strconcat(logdir, "/estimate-times", NULL);
+
+    amfree(logdir);
+    return filename;
+}
+
+static void
+load_estimate_times(void)
 {
-    int something_started;
+    char *filename = estimate_times_file();
+    FILE *f;
+    char *line;
+
+    est_latency = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, g_free);
+    if ((f = fopen(filename, "r")) == NULL) {
+	amfree(filename);
+	return;
+    }
+    for (; (line = agets(f)) != NULL; free(line)) {
+	char hostname[1024];
+	double secs;
+
+	if (sscanf(line, "%1023s %lf", hostname, &secs) == 2) {
+	    double *latency = g_new(double, 1);
+	    *latency = secs;
+	    g_hash_table_insert(est_latency, g_strdup(hostname), latency);
+	}
+    }
+    fclose(f);
+    amfree(filename);
+}
+
+static void
+write_estimate_time(
+    gpointer key,
+    gpointer value,
+    gpointer user_data)
+{
+    g_fprintf((FILE *)user_data, "%s %.3f\n", (char *)key, *(double *)value);
+}
+
+static void
+save_estimate_times(void)
+{
+    char *filename = estimate_times_file();
+    char *tmpfilename = g_strconcat(filename, ".tmp", NULL);
+    FILE *f;
+
+    if ((f = fopen(tmpfilename, "w")) == NULL) {
+	g_debug("Can't write %s: %s", tmpfilename, strerror(errno));
+    } else {
+	g_hash_table_foreach(est_latency, write_estimate_time, f);
+	if (fclose(f) != 0 || rename(tmpfilename, filename) != 0) {
+	    g_debug("Can't write %s: %s", filename, strerror(errno));
+	    unlink(tmpfilename);
+	}
+    }
+    amfree(tmpfilename);
+    amfree(filename);
+}
+
+/* slowest first; hosts never seen before are assumed to be slow */
+static int
+est_host_order(
+    est_host_t *a,
+    est_host_t *b)
+{
+    double la = a->latency < 0 ? G_MAXDOUBLE : a->latency;
+    double lb = b->latency < 0 ? G_MAXDOUBLE : b->latency;
+
+    if (la != lb)
+	return la > lb ? -1 : 1;
+    return a->order - b->order;
+}
+
+static gint
+est_host_compare(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return est_host_order((est_host_t *)a, (est_host_t *)b);
+}
+
+static void
+sort_netif_hosts(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data G_GNUC_UNUSED)
+{
+    est_netif_t *en = value;
+
+    en->hosts = g_list_sort(en->hosts, est_host_compare);
+}
+
+/* the hosts never asked are still on the list */
+static void
+free_est_netif(
+    gpointer data)
+{
+    est_netif_t *en = data;
+
+    g_list_foreach(en->hosts, (GFunc)g_free, NULL);
+    g_list_free(en->hosts);
+    g_free(en);
+}
+
+static void
+queue_estimate_hosts(void)
+{
+    GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
     GList *elist;
+    int order = 0;
 
-    something_started = 1;
-    while (something_started) {
-	something_started = 0;
-	for (elist = startq.head; elist != NULL; elist = elist->next) {
-	    est_t  *ep = get_est(elist);
-	    disk_t *dp = ep->disk;
-	    disk_t *dp1;
-	    am_host_t *hostp = dp->host;
-	    if (hostp->status == HOST_READY) {
-		something_started = 1;
-		run_server_host_scripts(EXECUTE_ON_PRE_HOST_ESTIMATE,
-					get_config_name(), planner_timestamp,
-					hostp);
-		for(dp1 = hostp->disks; dp1 != NULL; dp1 = dp1->hostnext) {
-		    if (dp1->todo) {
-			est_t *ep1;
-			ep1 = find_est_for_dp(dp1);
-			run_server_dle_scripts(EXECUTE_ON_PRE_DLE_ESTIMATE,
-					   get_config_name(), planner_timestamp,
-					   dp1, ep1->estimate[0].level, BOGUS);
-		    }
-		}
-		getsize(hostp);
-		protocol_check();
-		/*
-		 * dp is no longer on startq, so elist is not valid
-		 * and we have to start all over.
-		 */
-		break;
-	    }
+    est_netifs = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				       NULL, free_est_netif);
+    est_active = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+				       NULL, g_free);
+
+    for (elist = startq.head; elist != NULL; elist = elist->next) {
+	am_host_t *hostp = get_est(elist)->disk->host;
+	est_host_t *eh;
+	est_netif_t *en;
+	double *latency;
+
+	if (hostp->status != HOST_READY ||
+	    g_hash_table_lookup(seen, hostp))
+	    continue;
+	g_hash_table_insert(seen, hostp, hostp);
+
+	eh = g_new0(est_host_t, 1);
+	eh->host = hostp;
+	eh->order = order++;
+	latency = g_hash_table_lookup(est_latency, hostp->hostname);
+	eh->latency = latency ? *latency : -1;
+
+	en = g_hash_table_lookup(est_netifs, hostp->netif);
+	if (!en) {
+	    en = g_new0(est_netif_t, 1);
+	    g_hash_table_insert(est_netifs, hostp->netif, en);
 	}
+	en->hosts = g_list_prepend(en->hosts, eh);
+    }
+    g_hash_table_foreach(est_netifs, sort_netif_hosts, NULL);
+    g_hash_table_destroy(seen);
+}
+
+static void
+pick_estimate_host(
+    gpointer key G_GNUC_UNUSED,
+    gpointer value,
+    gpointer user_data)
+{
+    est_netif_t *en = value;
+    est_netif_t **best = user_data;
+
+    if (!en->hosts)
+	return;
+    if (conf_estimate_parallel > 0 && en->active >= conf_estimate_parallel)
+	return;
+    if (!*best || est_host_order(en->hosts->data, (*best)->hosts->data) < 0)
+	*best = en;
+}
+
+/* the next host to ask, or NULL if every interface is busy or done */
+static est_host_t *
+next_estimate_host(void)
+{
+    est_netif_t *en = NULL;
+    est_host_t *eh;
+
+    g_hash_table_foreach(est_netifs, pick_estimate_host, &en);
+    if (!en)
+	return NULL;
+
+    eh = en->hosts->data;
+    en->hosts = g_list_delete_link(en->hosts, en->hosts);
+    return eh;
+}
+
+static void
+finish_estimate_host(
+    am_host_t *hostp)
+{
+    est_host_t *eh = g_hash_table_lookup(est_active, hostp);
+    est_netif_t *en;
+    double *latency;
+    times_t took;
+
+    if (!eh)
+	return;
+    en = g_hash_table_lookup(est_netifs, hostp->netif);
+    en->active--;
+
+    took = timessub(curclock(), eh->start);
+    latency = g_new(double, 1);
+    *latency = (double)took.tv_sec + (double)took.tv_usec / 1000000.0;
+    g_hash_table_insert(est_latency, g_strdup(hostp->hostname), latency);
+    g_hash_table_remove(est_active, hostp);	/* frees eh */
+}
+
+static void
+start_estimate_host(
+    est_host_t *eh)
+{
+    am_host_t *hostp = eh->host;
+    est_netif_t *en = g_hash_table_lookup(est_netifs, hostp->netif);
+    disk_t *dp1;
+
+    run_server_host_scripts(EXECUTE_ON_PRE_HOST_ESTIMATE,
+			    get_config_name(), planner_timestamp, hostp);
+    for (dp1 = hostp->disks; dp1 != NULL; dp1 = dp1->hostnext) {
+	if (dp1->todo) {
+	    est_t *ep1 = find_est_for_dp(dp1);
+	    run_server_dle_scripts(EXECUTE_ON_PRE_DLE_ESTIMATE,
+				   get_config_name(), planner_timestamp,
+				   dp1, ep1->estimate[0].level, BOGUS);
+	}
+    }
+
+    eh->start = curclock();
+    en->active++;
+    g_hash_table_insert(est_active, hostp, eh);
+    getsize(hostp);
+    if (hostp->status != HOST_ACTIVE) {
+	/* nothing was sent, or the request failed */
+	finish_estimate_host(hostp);
+    }
+}
+
+/*
+ * Ask as many hosts as the limits allow, then analyze the estimates that
+ * came in, so that the analysis is done while waiting on slow clients.
+ * check is set for the first call, from outside the event loop, to look
+ * at the replies that came in between requests.
+ */
+static void
+start_estimates(
+    gboolean check)
+{
+    est_host_t *eh;
+
+    while ((eh = next_estimate_host()) != NULL) {
+	start_estimate_host(eh);
+	if (check)
+	    protocol_check();
+    }
+
+    while (!empty(estq)) {
+	est_t *ep = dequeue_est(&estq);
+
+	enqueue_est(&doneq, ep);
+	analyze_estimate(ep);
     }
+}
+
+static void get_estimates(void)
+{
+    load_estimate_times();
+    queue_estimate_hosts();
+
+    start_estimates(TRUE);
     protocol_run();
 
+    save_estimate_times();
+    g_hash_table_destroy(est_latency);
+    g_hash_table_destroy(est_active);
+    g_hash_table_destroy(est_netifs);
+
     while(!empty(waitq)) {
 	est_t *ep = dequeue_est(&waitq);
 	ep->errstr = _("hmm, disk was stranded on waitq");
@@ -2438,6 +2725,9 @@ next_line:
     }
     if (errbuf)
 	goto error_return;
+    if (pkt->type != P_PREP && hostp->status != HOST_ACTIVE)
+	finish_estimate_host(hostp);
+    start_estimates(FALSE);
     return;
 
  NAK_parse_failed:
@@ -2521,6 +2811,8 @@ next_line:
     while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
 	g_debug("reap: %d", (int)pid);
     }
+    finish_estimate_host(hostp);
+    start_estimates(FALSE);
 }
 
 
@@ -2638,7 +2930,8 @@ static void analyze_estimate(
               ep->dump_est->level, (long long)ep->dump_est->nsize,
               (long long)ep->dump_est->csize);
 
-    insert_est(&schedq, ep, schedule_order);
+    /* schedq is sorted once every estimate has been analyzed */
+    enqueue_est(&schedq, ep);
 
     total_size += (gint64)tt_blocksize_kb + ep->dump_est->csize + tape_mark;
 
@@ -2729,6 +3022,14 @@ static int schedule_order(
     return 0;
 }
 
+static gint
+schedule_order_compare(
+    gconstpointer a,
+    gconstpointer b)
+{
+    return schedule_order((est_t *)a, (est_t *)b);
+}
+
 
 static one_est_t *pick_inclevel(
     est_t *ep)
@@ -2830,6 +3131,27 @@ static void delay_one_dump(est_t *ep, int delete, ...);
 static int promote_highest_priority_incremental(void);
 static int promote_hills(void);
 
+/* a full dump that step 2.a of delay_dumps may delay */
+typedef struct delay_candidate_s {
+    est_t *ep;
+    time_t date;		/* of its last full dump */
+    int pos;			/* its position from the tail of schedq */
+} delay_candidate_t;
+
+/* latest full dump first, then nearest the tail of schedq */
+static int
+delay_candidate_order(
+    gconstpointer a,
+    gconstpointer b)
+{
+    const delay_candidate_t *ca = a;
+    const delay_candidate_t *cb = b;
+
+    if (ca->date != cb->date)
+	return ca->date > cb->date ? -1 : 1;
+    return ca->pos - cb->pos;
+}
+
 /* delay any dumps that will not fit */
 static void delay_dumps(void)
 {
@@ -2851,6 +3173,9 @@ static void delay_dumps(void)
     gint64	full_size;
     time_t      timestamps;
     int         priority;
+    GArray *	candidates;
+    delay_candidate_t candidate;
+    guint	next_candidate = 0;
 
     biq.head = biq.tail = NULL;
 
@@ -2965,34 +3290,67 @@ static void delay_dumps(void)
 	}
     }
 
-    /* 2.a. Do not delay forced full */
+    /* 2.a. Do not delay forced full
+     *
+     * Each pass delays the full dump with the latest previous full, nearest
+     * the tail of schedq among equals.  The first pass scans schedq and
+     * remembers the dumps it could delay; these do not change as others are
+     * delayed, so the later passes take them in order from that list
+     * instead of scanning again.
+     */
     delayed_ep = NULL;
     delayed_dp = NULL;
+    candidates = NULL;
     do {
 	delayed_ep = NULL;
 	delayed_dp = NULL;
 	timestamps = 0;
-	for (elist = schedq.tail;
-	     elist != NULL && total_size > tape_length;
-	     elist = elist_prev) {
-	    elist_prev = elist->prev;
-	    ep = get_est(elist);
-	    dp = ep->disk;
+	if (!candidates) {
+	    candidates = g_array_new(FALSE, FALSE, sizeof(delay_candidate_t));
+	    for (elist = schedq.tail;
+		 elist != NULL && total_size > tape_length;
+		 elist = elist_prev) {
+		elist_prev = elist->prev;
+		ep = get_est(elist);
+		dp = ep->disk;
+
+		if(ep->dump_est->level != 0) continue;
+
+		get_info(dp->host->hostname, dp->name, &info);
+		if(ISSET(info.command, FORCE_FULL)) {
+		    nb_forced_level_0 += 1;
+		    preserve_ep = ep;
+		    continue;
+		}
 
-	    if(ep->dump_est->level != 0) continue;
+		candidate.ep = ep;
+		candidate.date = ep->info->inf[0].date;
+		candidate.pos = candidates->len;
+		g_array_append_val(candidates, candidate);
 
-	    get_info(dp->host->hostname, dp->name, &info);
-	    if(ISSET(info.command, FORCE_FULL)) {
-		nb_forced_level_0 += 1;
-		preserve_ep = ep;
-		continue;
+		if (ep != preserve_ep &&
+		    ep->info->inf[0].date > timestamps) {
+		    delayed_ep = ep;
+		    delayed_dp = dp;
+		    timestamps = ep->info->inf[0].date;
+		}
 	    }
-
-	    if (ep != preserve_ep &&
-		ep->info->inf[0].date > timestamps) {
+	    g_array_sort(candidates, delay_candidate_order);
+	} else {
+	    while (total_size > tape_length &&
+		   next_candidate < candidates->len) {
+		candidate = g_array_index(candidates, delay_candidate_t,
+					  next_candidate++);
+		ep = candidate.ep;
+		if (candidate.date <= timestamps)
+		    break;
+		if (ep == preserve_ep ||
+		    !est_in_queue(&schedq, ep) ||
+		    ep->dump_est->level != 0)
+		    continue;
 		delayed_ep = ep;
-		delayed_dp = dp;
-		timestamps = ep->info->inf[0].date;
+		delayed_dp = ep->disk;
+		break;
 	    }
 	}
 	if (delayed_ep) {
@@ -3020,6 +3378,8 @@ static void delay_dumps(void)
 			   message, NULL);
 	}
     } while (delayed_ep);
+    if (candidates)
+	g_array_free(candidates, TRUE);
 
     /* 2.b. Delay forced full if needed */
     if(nb_forced_level_0 > 0 && total_size > tape_length) {
@@ -3244,15 +3604,34 @@ static void delay_one_dump(est_t *ep, int delete, ...)
 }
 
 
+static void
+count_up(
+    GHashTable *counts,
+    gpointer	key)
+{
+    g_hash_table_insert(counts, key,
+	GINT_TO_POINTER(GPOINTER_TO_INT(g_hash_table_lookup(counts, key)) + 1));
+}
+
+static int
+count_of(
+    GHashTable *counts,
+    gconstpointer key)
+{
+    return GPOINTER_TO_INT(g_hash_table_lookup(counts, key));
+}
+
 static int promote_highest_priority_incremental(void)
 {
-    GList  *elist, *elist1;
+    GList  *elist;
     disk_t *dp, *dp1, *dp_promote;
     est_t  *ep, *ep1, *ep_promote;
     gint64 new_total, new_lev0;
     int check_days;
     int nb_today, nb_same_day, nb_today2;
     int nb_disk_today, nb_disk_same_day;
+    GHashTable *day_disks, *host_today, *host_day_disks;
+    char *key;
     char *qname;
 
     /*
@@ -3260,6 +3639,29 @@ static int promote_highest_priority_incremental(void)
      * cause total_size to exceed tape_length
      */
 
+    /*
+     * Count the full dumps scheduled today, and the incrementals by the
+     * day of their next full, in total and for each host.  Nothing below
+     * changes them until a dump is promoted.
+     */
+    nb_disk_today = 0;
+    day_disks = g_hash_table_new(g_direct_hash, g_direct_equal);
+    host_today = g_hash_table_new(g_str_hash, g_str_equal);
+    host_day_disks = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, NULL);
+    for (elist = schedq.head; elist != NULL; elist = elist->next) {
+	ep1 = get_est(elist);
+	dp1 = ep1->disk;
+	if(ep1->dump_est->level == 0) {
+	    nb_disk_today++;
+	    count_up(host_today, dp1->host->hostname);
+	} else {
+	    count_up(day_disks, GINT_TO_POINTER(ep1->next_level0));
+	    count_up(host_day_disks, g_strdup_printf("%d %s",
+			ep1->next_level0, dp1->host->hostname));
+	}
+    }
+
     dp_promote = NULL;
     ep_promote = NULL;
     for (elist = schedq.head; elist != NULL; elist = elist->next) {
@@ -3287,24 +3689,12 @@ static int promote_highest_priority_incremental(void)
 	if(new_total > tape_length)
 	    continue;
 
-	nb_today = 0;
-	nb_same_day = 0;
-	nb_disk_today = 0;
-	nb_disk_same_day = 0;
-	for (elist1 = schedq.head; elist1 != NULL; elist1 = elist1->next) {
-	    ep1 = get_est(elist1);
-	    dp1 = ep1->disk;
-	    if(ep1->dump_est->level == 0)
-		nb_disk_today++;
-	    else if(ep1->next_level0 == ep->next_level0)
-		nb_disk_same_day++;
-	    if(g_str_equal(dp->host->hostname, dp1->host->hostname)) {
-		if(ep1->dump_est->level == 0)
-		    nb_today++;
-		else if(ep1->next_level0 == ep->next_level0)
-		    nb_same_day++;
-	    }
-	}
+	nb_disk_same_day = count_of(day_disks,
+				    GINT_TO_POINTER(ep->next_level0));
+	nb_today = count_of(host_today, dp->host->hostname);
+	key = g_strdup_printf("%d %s", ep->next_level0, dp->host->hostname);
+	nb_same_day = count_of(host_day_disks, key);
+	g_free(key);
 
 	/* do not promote if overflow balanced size and something today */
 	/* promote if nothing today */
@@ -3342,6 +3732,9 @@ static int promote_highest_priority_incremental(void)
 	}
 	amfree(qname);
     }
+    g_hash_table_destroy(day_disks);
+    g_hash_table_destroy(host_today);
+    g_hash_table_destroy(host_day_disks);
 
     if (ep_promote) {
 	one_est_t *level0_est;
@@ -3674,6 +4067,22 @@ est_dump_queue(
 }
 
 
+/*
+ * record the link holding est in list
+ */
+
+static void
+index_est(
+    estlist_t *list,
+    est_t *	est,
+    GList *	link)
+{
+    if (!list->index)
+	list->index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    g_hash_table_insert(list->index, est, link);
+}
+
+
 /*
  * put est on end of queue
  */
@@ -3689,6 +4098,7 @@ enqueue_est(
     } else {
 	list->tail = list->head;
     }
+    index_est(list, est, list->tail);
 }
 
 
@@ -3715,64 +4125,53 @@ insert_est(
 	if (!list->tail) {
 	    list->tail = list->head;
 	}
+	index_est(list, est, ptr->prev);
     } else {
 	enqueue_est(list, est);
     }
 }
 
 
-static est_t *
-find_est_for_dp(
-    disk_t *dp)
+/*
+ * sort the whole queue.  The sort is stable, so the order is the same as if
+ * each est had been put in with insert_est, in queue order.
+ */
+
+static void
+sort_est(
+    estlist_t *list,
+    GCompareFunc cmp)
 {
     GList *elist;
-    est_t *ep;
 
-    for (elist = waitq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = pestq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = estq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = startq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = failq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = schedq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
-    }
-    for (elist = activeq.head; elist != NULL; elist = elist->next) {
-	ep = get_est(elist);
-	if (ep->disk == dp) {
-	    return ep;
-	}
+    list->head = g_list_sort(list->head, cmp);
+    list->tail = g_list_last(list->head);
+    for (elist = list->head; elist != NULL; elist = elist->next) {
+	index_est(list, get_est(elist), elist);
     }
+}
 
-    g_critical("find_est_for_dp return NULL");
-    return NULL;
+
+static gboolean
+est_in_queue(
+    estlist_t *list,
+    est_t *	est)
+{
+    return list->index && g_hash_table_lookup(list->index, est) != NULL;
+}
+
+
+static est_t *
+find_est_for_dp(
+    disk_t *dp)
+{
+    est_t *ep = NULL;
+
+    if (est_by_disk)
+	ep = g_hash_table_lookup(est_by_disk, dp);
+    if (!ep)
+	g_critical("find_est_for_dp return NULL");
+    return ep;
 }
 
 
@@ -3790,6 +4189,7 @@ dequeue_est(
 
     est = list->head->data;
     list->head = g_list_delete_link(list->head, list->head);
+    g_hash_table_remove(list->index, est);
 
     if(list->head == NULL) list->tail = NULL;
 
@@ -3801,14 +4201,16 @@ remove_est(
     estlist_t *list,
     est_t *	est)
 {
-    GList *ltail;
+    GList *link;
 
-    if (list->tail && list->tail->data == est) {
-	ltail = list->tail;
-	list->tail = list->tail->prev;
-	list->head = g_list_delete_link(list->head, ltail);
-    } else {
-	list->head = g_list_remove(list->head, est);
-    }
-}
+    if (!list->index)
+	return;
+    link = g_hash_table_lookup(list->index, est);
+    if (!link)
+	return;
+    g_hash_table_remove(list->index, est);
 
+    if (link == list->tail)
+	list->tail = link->prev;
+    list->head = g_list_delete_link(list->head, link);
+}
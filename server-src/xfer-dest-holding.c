@@ -37,6 +37,24 @@
 #define HEADER_BLOCK_BYTES  DISK_BLOCK_BYTES
 #define HOLDING_BLOCK_BYTES DISK_BLOCK_BYTES
 
+/* With holding-direct-io, data is written in blocks of HOLDING_DIRECT_IO_BYTES,
+ * up to HOLDING_DIRECT_IO_WRITES of them at a time.  Writes whose length and
+ * offset are multiples of HOLDING_DIRECT_IO_ALIGN go through O_DIRECT. */
+#define HOLDING_DIRECT_IO_BYTES  (1024*1024)
+#define HOLDING_DIRECT_IO_WRITES 4
+#define HOLDING_DIRECT_IO_ALIGN  4096
+
+/* One write in flight */
+typedef struct holding_write_s {
+    char     *buf;		/* HOLDING_DIRECT_IO_ALIGN-aligned */
+    char     *buf_alloc;	/* what to free */
+    gsize     len;
+    off_t     offset;
+    gboolean  direct;		/* write through direct_fd */
+    gboolean  done;
+    int       error;		/* errno, if the write failed */
+} holding_write_t;
+
 /*
  * Xfer Dest Holding
  */
@@ -53,6 +71,9 @@ typedef struct XferDestHolding {
      */
 
     char       *first_filename;
+    size_t      max_memory;	/* size of the shm ring, or 0 */
+    gboolean    huge_pages;	/* back the shm ring with huge pages */
+
     /* The thread doing the actual writes to tape; this also handles buffering
      * for streaming */
     GThread *holding_thread;
@@ -99,6 +120,23 @@ typedef struct XferDestHolding {
 	   CHUNK_NO_ROOM = 4,		/* the last write failed with ENOSPC */
 	   CHUNK_FAILED  = 8		/* any other error */
     } chunk_status;
+
+    /* Direct I/O
+     *
+     * With holding-direct-io, the data is written by the threads of
+     * direct_pool, from aligned copies of the ring.  The data stays in the
+     * ring until its write is done, so a failed write leaves it there for
+     * the next chunk, as with synchronous writes.  The done flags are
+     * governed by direct_mutex, which is the mem_ring mutex for a mem_ring;
+     * the holding thread is woken by add_cond or sem_read, as when data is
+     * added to the ring.
+     */
+    gboolean     direct_io;
+    int          direct_fd;	/* the chunk file opened O_DIRECT, or -1 */
+    gboolean     direct_refused;	/* the filesystem refused an O_DIRECT write */
+    GThreadPool *direct_pool;
+    GMutex      *direct_mutex;
+    holding_write_t direct_writes[HOLDING_DIRECT_IO_WRITES];
 } XferDestHolding;
 
 static GType xfer_dest_holding_get_type(void);
@@ -122,6 +160,11 @@ typedef struct {
 static int close_chunk(XferDestHolding *xdh, char *cont_filename, char **mesg);
 static ssize_t write_header(XferDestHolding *xdh, int fd);
 static size_t full_write_with_fake_enospc(int fd, const void *buf, size_t count);
+static void direct_io_start(XferDestHolding *self);
+static void direct_io_stop(XferDestHolding *self);
+static void direct_io_open(XferDestHolding *self);
+static gboolean holding_thread_write_chunk_direct(XferDestHolding *self, char **mesg);
+static void holding_write_thread(gpointer data, gpointer user_data);
 
 /* we use a function pointer for full_write, so that we can "shim" in
  * full_write_with_fake_enospc for testing
@@ -318,7 +361,14 @@ holding_thread(
     DBG(1, "(this is the holding thread)");
 
     self->mem_ring = xfer_element_get_mem_ring(elt->upstream);
-    mem_ring_consumer_set_size(self->mem_ring, HOLDING_BLOCK_BYTES*32, HOLDING_BLOCK_BYTES);
+    direct_io_start(self);
+    if (self->direct_io) {
+	mem_ring_consumer_set_size(self->mem_ring,
+		HOLDING_DIRECT_IO_BYTES*(HOLDING_DIRECT_IO_WRITES+1),
+		HOLDING_BLOCK_BYTES);
+    } else {
+	mem_ring_consumer_set_size(self->mem_ring, HOLDING_BLOCK_BYTES*32, HOLDING_BLOCK_BYTES);
+    }
 
     /* This is the outer loop, that loops once for each holding file or
      * CONTINUE command */
@@ -434,10 +484,14 @@ failure_port_write_header:
 	    self->fd = fd;
 	    self->header_bytes_written = HEADER_BLOCK_BYTES;
 	    self->chunk_offset = HEADER_BLOCK_BYTES;
+	    direct_io_open(self);
 	}
 
 	DBG(2, "beginning to write chunk");
-	done = holding_thread_write_chunk(self, &mesg);
+	if (self->direct_io)
+	    done = holding_thread_write_chunk_direct(self, &mesg);
+	else
+	    done = holding_thread_write_chunk(self, &mesg);
 	DBG(2, "done writing chunk");
 
 	if (!done) /* cancelled */
@@ -464,6 +518,7 @@ no_room:
 	}
     }
     g_mutex_unlock(self->state_mutex);
+    direct_io_stop(self);
 
     if (self->chunk_status == CHUNK_FAILED) {
 	msg = xmsg_new(XFER_ELEMENT(self), XMSG_ERROR, 0);
@@ -527,7 +582,7 @@ shm_holding_thread_consume_block(
     elt->shm_ring->mc->read_offset += written;
     if (elt->shm_ring->mc->read_offset >= elt->shm_ring->mc->ring_size)
 	elt->shm_ring->mc->read_offset -= elt->shm_ring->mc->ring_size;
-    sem_post(elt->shm_ring->sem_write);
+    shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
 }
 
 /* Write an entire chunk.  Called with the state_mutex held */
@@ -621,7 +676,7 @@ failure_shm_write_data:
      */
     if (elt->cancelled) {
 	elt->shm_ring->mc->cancelled = TRUE;
-	sem_post(elt->shm_ring->sem_write);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
 	return FALSE;
     } else if (elt->shm_ring->mc->cancelled) {
 	xfer_cancel_with_error(elt, "shm_ring cancelled");
@@ -643,7 +698,17 @@ shm_holding_thread(
 
     DBG(1, "(this is the holding thread)");
 
-    shm_ring_consumer_set_size(elt->shm_ring, HOLDING_BLOCK_BYTES*32, HOLDING_BLOCK_BYTES);
+    direct_io_start(self);
+    if (self->direct_io) {
+	shm_ring_consumer_set_size(elt->shm_ring,
+		MAX(self->max_memory,
+		    HOLDING_DIRECT_IO_BYTES*(HOLDING_DIRECT_IO_WRITES+1)),
+		HOLDING_BLOCK_BYTES);
+    } else {
+	shm_ring_consumer_set_size(elt->shm_ring,
+		self->max_memory ? self->max_memory : HOLDING_BLOCK_BYTES*32,
+		HOLDING_BLOCK_BYTES);
+    }
 
     /* This is the outer loop, that loops once for each holding file or
      * CONTINUE command */
@@ -759,10 +824,14 @@ failure_shm_write_header:
 	    self->fd = fd;
 	    self->header_bytes_written = HEADER_BLOCK_BYTES;
 	    self->chunk_offset = HEADER_BLOCK_BYTES;
+	    direct_io_open(self);
 	}
 
 	DBG(2, "beginning to write chunk");
-	done = shm_holding_thread_write_chunk(self, &mesg);
+	if (self->direct_io)
+	    done = holding_thread_write_chunk_direct(self, &mesg);
+	else
+	    done = shm_holding_thread_write_chunk(self, &mesg);
 	DBG(2, "done writing chunk");
 
 	if (!done) /* cancelled */
@@ -789,9 +858,10 @@ no_room:
 	}
     }
     g_mutex_unlock(self->state_mutex);
+    direct_io_stop(self);
 
     // notify the producer that everythinng is read
-    sem_post(elt->shm_ring->sem_write);
+    shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
 
     if (self->chunk_status == CHUNK_FAILED) {
 	xfer_cancel_with_error(elt, "%s", mesg);
@@ -817,6 +887,307 @@ no_room:
     return NULL;
 }
 
+/*
+ * Direct I/O engine
+ */
+
+/* Set up the engine, if holding-direct-io is set.  Fake ENOSPC counts the
+ * bytes of each synchronous write, so it keeps the synchronous writes. */
+static void
+direct_io_start(
+    XferDestHolding *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    int i;
+
+    self->direct_io = getconf_boolean(CNF_HOLDING_DIRECT_IO) &&
+		      db_full_write == full_write;
+    if (!self->direct_io)
+	return;
+
+    DBG(1, "writing with %d threads, %d bytes at a time",
+	HOLDING_DIRECT_IO_WRITES, HOLDING_DIRECT_IO_BYTES);
+    if (elt->shm_ring)
+	self->direct_mutex = g_mutex_new();
+    else
+	self->direct_mutex = self->mem_ring->mutex;
+    for (i = 0; i < HOLDING_DIRECT_IO_WRITES; i++) {
+	holding_write_t *w = &self->direct_writes[i];
+
+	w->buf_alloc = g_malloc(HOLDING_DIRECT_IO_BYTES + HOLDING_DIRECT_IO_ALIGN);
+	w->buf = (char *)(((uintptr_t)w->buf_alloc + HOLDING_DIRECT_IO_ALIGN - 1)
+			  & ~(uintptr_t)(HOLDING_DIRECT_IO_ALIGN - 1));
+    }
+    self->direct_pool = g_thread_pool_new(holding_write_thread, self,
+					  HOLDING_DIRECT_IO_WRITES, FALSE,
+					  NULL);
+}
+
+static void
+direct_io_stop(
+    XferDestHolding *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    int i;
+
+    if (!self->direct_io)
+	return;
+
+    /* every write is done by now; this just joins the threads */
+    g_thread_pool_free(self->direct_pool, FALSE, TRUE);
+    self->direct_pool = NULL;
+    for (i = 0; i < HOLDING_DIRECT_IO_WRITES; i++) {
+	amfree(self->direct_writes[i].buf_alloc);
+	self->direct_writes[i].buf = NULL;
+    }
+    if (elt->shm_ring)
+	g_mutex_free(self->direct_mutex);
+    self->direct_mutex = NULL;
+}
+
+/* Open the new chunk file a second time, for O_DIRECT writes.  The header
+ * and any unaligned tail still go through self->fd. */
+static void
+direct_io_open(
+    XferDestHolding *self)
+{
+#ifdef O_DIRECT
+    char *tmp_filename;
+
+    if (!self->direct_io || self->direct_refused)
+	return;
+
+    tmp_filename = g_strjoin(NULL, self->filename, ".tmp", NULL);
+    self->direct_fd = open(tmp_filename, O_WRONLY|O_DIRECT);
+    if (self->direct_fd == -1) {
+	g_debug("Can't open '%s' with O_DIRECT, using buffered writes: %s",
+		tmp_filename, strerror(errno));
+	self->direct_refused = TRUE;
+    }
+    g_free(tmp_filename);
+#else
+    (void)self;
+#endif
+}
+
+/* A GFunc run by direct_pool, for each write */
+static void
+holding_write_thread(
+    gpointer data,
+    gpointer user_data)
+{
+    holding_write_t *w = data;
+    XferDestHolding *self = XFER_DEST_HOLDING(user_data);
+    XferElement *elt = XFER_ELEMENT(self);
+    int fd = w->direct ? self->direct_fd : self->fd;
+    gsize done = 0;
+    int error = 0;
+
+    while (done < w->len) {
+	ssize_t n = pwrite(fd, w->buf + done, w->len - done, w->offset + done);
+
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n < 0 && errno == EINVAL && fd == self->direct_fd) {
+	    /* the filesystem takes O_DIRECT opens but not the writes */
+	    g_debug("O_DIRECT write refused, using buffered writes");
+	    self->direct_refused = TRUE;
+	    fd = self->fd;
+	    continue;
+	}
+	if (n <= 0) {
+	    error = (n < 0) ? errno : ENOSPC;
+	    break;
+	}
+	done += n;
+    }
+
+    g_mutex_lock(self->direct_mutex);
+    w->error = error;
+    w->done = TRUE;
+    if (elt->shm_ring)
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+    else
+	g_cond_broadcast(self->mem_ring->add_cond);
+    g_mutex_unlock(self->direct_mutex);
+}
+
+/* Wait for data to be added to the ring or for a write to be done.  Called
+ * with direct_mutex held. */
+static void
+direct_io_wait(
+    XferDestHolding *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+
+    if (elt->shm_ring) {
+	g_mutex_unlock(self->direct_mutex);
+	if (shm_ring_sem_wait(elt->shm_ring, elt->shm_ring->sem_read) != 0) {
+	    /* the producer is gone; keep waiting for the writes */
+	    elt->shm_ring->mc->cancelled = TRUE;
+	}
+	g_mutex_lock(self->direct_mutex);
+    } else {
+	g_cond_wait(self->mem_ring->add_cond, self->mem_ring->mutex);
+    }
+}
+
+/* Write an entire chunk through the direct I/O engine.  Called with the
+ * state_mutex held */
+static gboolean
+holding_thread_write_chunk_direct(
+    XferDestHolding  *self,
+    char            **mesg)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    shm_ring_t *shm_ring = elt->shm_ring;
+    char       *ring_data;
+    guint64     ring_size;
+    guint64     in_flight = 0;	/* bytes past readx handed to the writers */
+    int         first = 0;	/* the oldest write in flight */
+    int         nwrites = 0;
+    gboolean    failed = FALSE;
+
+    if (shm_ring) {
+	ring_data = shm_ring->data;
+	ring_size = shm_ring->mc->ring_size;
+    } else {
+	ring_data = self->mem_ring->buffer;
+	ring_size = self->mem_ring->ring_size;
+    }
+
+    self->chunk_status = CHUNK_OK;
+
+    g_mutex_lock(self->direct_mutex);
+    while (1) {
+	holding_write_t *w = &self->direct_writes[first];
+	gboolean cancelled = elt->cancelled ||
+			     (shm_ring && shm_ring->mc->cancelled);
+	guint64 written, readx, read_offset;
+	gboolean eof;
+
+	/* retire the writes in order; once one has failed, the later ones
+	 * are truncated away and their data is left in the ring */
+	if (nwrites > 0 && w->done) {
+	    if (!failed && w->error) {
+		amfree(*mesg);
+		*mesg = g_strdup_printf("Failed to write data to holding file '%s.tmp': %s", self->filename, strerror(w->error));
+		failed = TRUE;
+		self->chunk_status = CHUNK_NO_ROOM;
+	    } else if (!failed) {
+		crc32_add((uint8_t *)w->buf, w->len, &elt->crc);
+		self->chunk_offset += w->len;
+		self->data_bytes_written += w->len;
+		self->use_bytes -= w->len;
+		if (shm_ring)
+		    shm_holding_thread_consume_block(self, w->len);
+		else
+		    holding_thread_consume_block(self, w->len);
+	    }
+	    in_flight -= w->len;
+	    w->done = FALSE;
+	    first = (first + 1) % HOLDING_DIRECT_IO_WRITES;
+	    nwrites--;
+	    continue;
+	}
+
+	if (failed || cancelled) {
+	    if (nwrites == 0)
+		break;
+	    direct_io_wait(self);
+	    continue;
+	}
+
+	/* eof_flag first: once it is set, written is final */
+	if (shm_ring) {
+	    eof = shm_ring->mc->eof_flag;
+	    written = shm_ring->mc->written;
+	    readx = shm_ring->mc->readx;
+	    read_offset = shm_ring->mc->read_offset;
+	} else {
+	    eof = self->mem_ring->eof_flag;
+	    written = self->mem_ring->written;
+	    readx = self->mem_ring->readx;
+	    read_offset = self->mem_ring->read_offset;
+	}
+
+	/* hand a full block, or whatever is left at EOF or at the end of
+	 * the chunk, to a writer */
+	if (nwrites < HOLDING_DIRECT_IO_WRITES) {
+	    guint64 avail = written - readx - in_flight;
+	    guint64 len = MIN(HOLDING_DIRECT_IO_BYTES,
+			      self->use_bytes - in_flight);
+
+	    if (len > 0 && avail > 0 && (avail >= len || eof)) {
+		guint64 start = (read_offset + in_flight) % ring_size;
+		guint64 part;
+
+		w = &self->direct_writes[(first + nwrites) % HOLDING_DIRECT_IO_WRITES];
+		w->len = MIN(len, avail);
+		w->offset = self->chunk_offset + in_flight;
+		w->direct = self->direct_fd != -1 && !self->direct_refused &&
+			    w->len % HOLDING_DIRECT_IO_ALIGN == 0 &&
+			    w->offset % HOLDING_DIRECT_IO_ALIGN == 0;
+		w->error = 0;
+		in_flight += w->len;
+		nwrites++;
+
+		/* the producer does not touch this data until it is consumed,
+		 * so it can be copied without the lock */
+		g_mutex_unlock(self->direct_mutex);
+		part = MIN(w->len, ring_size - start);
+		memcpy(w->buf, ring_data + start, part);
+		if (part < w->len)
+		    memcpy(w->buf + part, ring_data, w->len - part);
+		DBG(8, "writing %zu bytes to holding%s", w->len,
+		    w->direct ? " with O_DIRECT" : "");
+		g_thread_pool_push(self->direct_pool, w, NULL);
+		g_mutex_lock(self->direct_mutex);
+		continue;
+	    }
+	}
+
+	if (nwrites == 0) {
+	    if (self->use_bytes == 0) {
+		/* end of chunk; see whether there is more to write */
+		self->chunk_status = CHUNK_EOC;
+		if (eof && written == readx)
+		    self->chunk_status = CHUNK_EOF;
+		else if (!eof && written - readx <= HOLDING_BLOCK_BYTES) {
+		    direct_io_wait(self);
+		    continue;
+		}
+		break;
+	    }
+	    if (eof && written == readx) {
+		self->chunk_status = CHUNK_EOF;
+		break;
+	    }
+	}
+
+	direct_io_wait(self);
+    }
+    g_mutex_unlock(self->direct_mutex);
+
+    if (failed && ftruncate(self->fd, self->chunk_offset) != 0) {
+	g_debug("ftruncate failed: %s", strerror(errno));
+	return FALSE;
+    }
+
+    if (elt->cancelled) {
+	if (shm_ring) {
+	    shm_ring->mc->cancelled = TRUE;
+	    shm_ring_sem_post(shm_ring, shm_ring->sem_write);
+	}
+	return FALSE;
+    } else if (shm_ring && shm_ring->mc->cancelled) {
+	xfer_cancel_with_error(elt, "shm_ring cancelled");
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
 /*
  * Element mechanics
  */
@@ -862,10 +1233,10 @@ cancel_impl(
     }
     if (elt->shm_ring) {
 	elt->shm_ring->mc->cancelled = TRUE;
-	sem_post(elt->shm_ring->sem_ready);
-	sem_post(elt->shm_ring->sem_start);
-	sem_post(elt->shm_ring->sem_read);
-	sem_post(elt->shm_ring->sem_write);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_ready);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_start);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
     }
 
     g_mutex_lock(self->state_mutex);
@@ -952,6 +1323,10 @@ close_chunk(
 	*mesg = g_strdup_printf("Failed to rewrite header on holding file '%s': %s", self->filename, strerror(save_errno));
 	close(self->fd);
 	self->fd = -1;
+	if (self->direct_fd != -1) {
+	    close(self->direct_fd);
+	    self->direct_fd = -1;
+	}
 	g_free(self->filename);
 	self->filename = NULL;
 	errno = save_errno;
@@ -979,6 +1354,10 @@ close_chunk(
 #ifdef FAILURE_CODE
 failure_close_chunk_close:
 #endif
+    if (self->direct_fd != -1) {
+	close(self->direct_fd);
+	self->direct_fd = -1;
+    }
     if (close_result == -1) {
 	*mesg = g_strdup_printf("Failed to close holding file '%s': %s", self->filename, strerror(save_errno));
     }
@@ -1012,6 +1391,7 @@ instance_init(
     self->state_cond = g_cond_new();
 
     self->fd = -1;
+    self->direct_fd = -1;
     self->use_bytes = 0;
     self->paused = TRUE;
     self->chunk_header = NULL;
@@ -1027,8 +1407,11 @@ static gboolean
 setup_impl(
     XferElement *elt)
 {
+    XferDestHolding *self = XFER_DEST_HOLDING(elt);
+
     if (elt->input_mech == XFER_MECH_SHM_RING) {
 	elt->shm_ring = shm_ring_create(NULL);
+	elt->shm_ring->mc->huge_pages = self->huge_pages;
     }
 
     return TRUE;
@@ -1119,13 +1502,16 @@ xfer_dest_holding_get_type (void)
 
 XferElement *
 xfer_dest_holding(
-    size_t max_memory G_GNUC_UNUSED)
+    size_t   max_memory,
+    gboolean huge_pages)
 {
     XferDestHolding *self = (XferDestHolding *)g_object_new(XFER_DEST_HOLDING_TYPE, NULL);
     XferElement *elt = XFER_ELEMENT(self);
     char *env;
 
     self->paused = TRUE;
+    self->max_memory = max_memory;
+    self->huge_pages = huge_pages;
 
     /* set up a fake ENOSPC for testing purposes.  Note that this counts
      * headers as well as data written to disk. */
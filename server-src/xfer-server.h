@@ -53,10 +53,13 @@ xfer_source_holding_get_bytes_read(
  *
  * @param max_memory: total amount of memory to use for buffers, or zero
  *		      for a reasonable default.
+ * @param huge_pages: back the shm ring with huge pages, where the
+ *		      system allows it.
  * @return: new element
  */
 XferElement *xfer_dest_holding(
-    size_t max_memory);
+    size_t max_memory,
+    gboolean huge_pages);
 
 void
 xfer_dest_holding_start_chunk(
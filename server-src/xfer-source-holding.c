@@ -25,6 +25,7 @@
 #include "amutil.h"
 #include "xfer-server.h"
 #include "xfer-device.h"
+#include "conffile.h"
 
 /*
  * Class declaration
@@ -47,6 +48,15 @@ static GObjectClass *parent_class = NULL;
  * Main object structure
  */
 
+/* an open holding chunk, with its header already read */
+typedef struct holding_chunk_s {
+    int fd;
+    char *filename;
+    char *cont_filename;	/* NULL for the last chunk */
+    off_t st_size;
+    off_t advised;		/* file offset up to which read-ahead was requested */
+} holding_chunk_t;
+
 typedef struct XferSourceHolding {
     XferElement __parent__;
 
@@ -70,6 +80,14 @@ typedef struct XferSourceHolding {
     mem_ring_t *mem_ring;
     gboolean mem_ring_ready;
 
+    /* read-ahead (holding-read-ahead); see read_ahead() */
+    gsize read_ahead;
+    gboolean drop_behind;
+    off_t advised;
+    off_t dropped;
+    holding_chunk_t prefetch;	/* the next chunk, opened early */
+    gboolean prefetched;
+
     XferElement *dest_taper;
 } XferSourceHolding;
 
@@ -84,6 +102,7 @@ typedef struct {
 } XferSourceHoldingClass;
 
 static gboolean start_new_chunk(XferSourceHolding *self);
+static void read_ahead(XferSourceHolding *self);
 
 /*
  * Implementation
@@ -124,6 +143,7 @@ holding_thread(
     uint64_t producer_block_size;
     uint64_t consumer_block_size;
     uint64_t mem_ring_size;
+    uint64_t ring_size;
     ssize_t  to_read_size;
     size_t   bytes_read;
 
@@ -135,7 +155,14 @@ holding_thread(
     self->mem_ring_ready = TRUE;
     g_cond_broadcast(self->state_cond);
     g_mutex_unlock(self->state_mutex);
-    mem_ring_producer_set_size(self->mem_ring, HOLDING_BLOCK_BYTES*32, HOLDING_BLOCK_BYTES);
+    /* the ring holds holding-read-ahead bytes, and at least 32 blocks */
+    ring_size = (self->read_ahead + HOLDING_BLOCK_BYTES - 1) / HOLDING_BLOCK_BYTES
+		* HOLDING_BLOCK_BYTES;
+    if (ring_size < HOLDING_BLOCK_BYTES*32)
+	ring_size = HOLDING_BLOCK_BYTES*32;
+    DBG(1, "ring size %llu, read-ahead %llu", (unsigned long long)ring_size,
+	(unsigned long long)self->read_ahead);
+    mem_ring_producer_set_size(self->mem_ring, ring_size, HOLDING_BLOCK_BYTES);
     mem_ring_size = self->mem_ring->ring_size;
     producer_block_size = self->mem_ring->producer_block_size;
     consumer_block_size = self->mem_ring->consumer_block_size;
@@ -183,6 +210,7 @@ holding_thread(
 	    self->current_offset += bytes_read;
 	    self->bytes_read += bytes_read;
 	    crc32_add((uint8_t *)self->mem_ring->buffer + self->mem_ring->write_offset, bytes_read, &elt->crc);
+	    read_ahead(self);
 	    write_offset += bytes_read;
 	    write_offset %= mem_ring_size;
 	    g_mutex_lock(self->mem_ring->mutex);
@@ -237,15 +265,101 @@ return_eof:
     return NULL;
 }
 
+/* Open the holding file FILENAME and read its header into CHUNK.
+ *
+ * @returns: FALSE, with ERRMSG set, on error
+ */
 static gboolean
-start_new_chunk(
-    XferSourceHolding *self)
+open_chunk(
+    char *filename,
+    holding_chunk_t *chunk,
+    char **errmsg)
 {
-    XferElement *elt = XFER_ELEMENT(self);
-    char *hdrbuf = NULL;
+    char *hdrbuf;
     dumpfile_t hdr;
     size_t bytes_read;
     struct stat finfo;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+	*errmsg = g_strdup_printf("while opening holding file '%s': %s",
+				  filename, strerror(errno));
+	return FALSE;
+    }
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (fstat(fd, &finfo) < 0) {
+	*errmsg = g_strdup_printf("while finding size of holding file '%s': %s",
+				  filename, strerror(errno));
+	close(fd);
+	return FALSE;
+    }
+
+    /* read the header from the file and determine the filename of the
+     * next chunk
+     */
+    hdrbuf = g_malloc(DISK_BLOCK_BYTES);
+    bytes_read = read_fully(fd, hdrbuf, DISK_BLOCK_BYTES, NULL);
+    if (bytes_read < DISK_BLOCK_BYTES) {
+	*errmsg = g_strdup_printf("while reading header from holding file '%s': %s",
+				  filename, strerror(errno));
+	g_free(hdrbuf);
+	close(fd);
+	return FALSE;
+    }
+
+    parse_file_header(hdrbuf, &hdr, DISK_BLOCK_BYTES);
+    g_free(hdrbuf);
+
+    if (hdr.type != F_DUMPFILE && hdr.type != F_CONT_DUMPFILE) {
+	if (hdr.type == F_SPLIT_DUMPFILE) {
+	    g_debug("Reading a SPLIT_DUMPFILE) from holding disk");
+	} else {
+	    *errmsg = g_strdup_printf("unexpected header type %d in holding file '%s'",
+				      hdr.type, filename);
+	    dumpfile_free_data(&hdr);
+	    close(fd);
+	    return FALSE;
+	}
+    }
+
+    chunk->fd = fd;
+    chunk->filename = g_strdup(filename);
+    if (hdr.cont_filename[0]) {
+	chunk->cont_filename = g_strdup(hdr.cont_filename);
+    } else {
+	chunk->cont_filename = NULL;
+    }
+    chunk->st_size = finfo.st_size;
+    chunk->advised = DISK_BLOCK_BYTES;
+    dumpfile_free_data(&hdr);
+
+    return TRUE;
+}
+
+static void
+close_chunk(
+    holding_chunk_t *chunk)
+{
+    if (chunk->fd != -1)
+	close(chunk->fd);
+    chunk->fd = -1;
+    g_free(chunk->filename);
+    chunk->filename = NULL;
+    g_free(chunk->cont_filename);
+    chunk->cont_filename = NULL;
+}
+
+static gboolean
+start_new_chunk(
+    XferSourceHolding *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    holding_chunk_t chunk;
+    char *errmsg = NULL;
     gboolean seek_done = FALSE;
 
     while (!seek_done &&
@@ -274,25 +388,32 @@ start_new_chunk(
 	    self->next_filename = g_strdup(self->first_filename);
 	}
 
-	if (self->fd == -1) {
-	    /* if we have no next filename, then we're at EOF */
-	    if (!self->next_filename) {
-		g_debug("no next_filename");
-		return FALSE;
-	    }
+	/* if we have no next filename, then we're at EOF */
+	if (!self->next_filename) {
+	    g_debug("no next_filename");
+	    return FALSE;
+	}
 
-	    /* otherwise, open up the next file */
-	    self->fd = open(self->next_filename, O_RDONLY);
-	    if (self->fd < 0) {
-		xfer_cancel_with_error(XFER_ELEMENT(self),
-			"while opening holding file '%s': %s",
-			self->next_filename, strerror(errno));
+	/* otherwise, open up the next file, unless read_ahead already did */
+	if (self->prefetch.fd != -1 &&
+	    g_str_equal(self->prefetch.filename, self->next_filename)) {
+	    chunk = self->prefetch;
+	    self->prefetch.fd = -1;
+	    self->prefetch.filename = NULL;
+	    self->prefetch.cont_filename = NULL;
+	} else {
+	    close_chunk(&self->prefetch);
+	    if (!open_chunk(self->next_filename, &chunk, &errmsg)) {
+		xfer_cancel_with_error(XFER_ELEMENT(self), "%s", errmsg);
+		g_free(errmsg);
 		wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
 		return FALSE;
 	    }
-
 	}
-
+	self->fd = chunk.fd;
+	self->advised = chunk.advised;
+	self->dropped = 0;
+	self->prefetched = FALSE;
 
 	/* get a downstream XferDestTaper, if one exists.  This check happens
 	 * for each chunk, but chunks are large, so that's OK. */
@@ -312,71 +433,18 @@ start_new_chunk(
 
 	/* tell a XferDestTaper about the new file */
 	if (self->dest_taper) {
-	    struct stat st;
-	    if (fstat(self->fd, &st) < 0) {
-		xfer_cancel_with_error(XFER_ELEMENT(self),
-		    "while finding size of holding file '%s': %s",
-		    self->next_filename, strerror(errno));
-		wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
-		return FALSE;
-	    }
-
 	    xfer_dest_taper_cache_inform(self->dest_taper,
 		self->next_filename,
 		DISK_BLOCK_BYTES,
-		st.st_size - DISK_BLOCK_BYTES);
-	}
-
-	/* read the header from the file and determine the size and
-	 * filename of the next chunk
-	 */
-	hdrbuf = g_malloc(DISK_BLOCK_BYTES);
-	bytes_read = read_fully(self->fd, hdrbuf, DISK_BLOCK_BYTES, NULL);
-	if (bytes_read < DISK_BLOCK_BYTES) {
-	    g_free(hdrbuf);
-	    xfer_cancel_with_error(XFER_ELEMENT(self),
-		"while reading header from holding file '%s': %s",
-		self->next_filename, strerror(errno));
-	    wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
-	    return FALSE;
-	}
-
-	parse_file_header(hdrbuf, &hdr, DISK_BLOCK_BYTES);
-	g_free(hdrbuf);
-	hdrbuf = NULL;
-
-	if (hdr.type != F_DUMPFILE && hdr.type != F_CONT_DUMPFILE) {
-	    if (hdr.type == F_SPLIT_DUMPFILE) {
-		g_debug("Reading a SPLIT_DUMPFILE) from holding disk");
-	    } else {
-		dumpfile_free_data(&hdr);
-		xfer_cancel_with_error(XFER_ELEMENT(self),
-			"unexpected header type %d in holding file '%s'",
-			hdr.type, self->next_filename);
-		wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
-		return FALSE;
-	    }
-	}
-
-	if (fstat(self->fd, &finfo) == -1) {
-	    dumpfile_free_data(&hdr);
-	    xfer_cancel_with_error(XFER_ELEMENT(self),
-		"Can't stat holding file '%s': %s",
-		self->next_filename, strerror(errno));
-	    wait_until_xfer_cancelled(XFER_ELEMENT(self)->xfer);
-	    return FALSE;
+		chunk.st_size - DISK_BLOCK_BYTES);
 	}
 
 	self->current_offset = self->offset_file += self->fsize;	/* fsize of previous chunk */
-	self->fsize = finfo.st_size - DISK_BLOCK_BYTES;
+	self->fsize = chunk.st_size - DISK_BLOCK_BYTES;
 
 	g_free(self->next_filename);
-	if (hdr.cont_filename[0]) {
-	    self->next_filename = g_strdup(hdr.cont_filename);
-	} else {
-	    self->next_filename = NULL;
-	}
-	dumpfile_free_data(&hdr);
+	self->next_filename = chunk.cont_filename;
+	g_free(chunk.filename);
     };
 
     if (lseek(self->fd, elt->offset - self->offset_file + DISK_BLOCK_BYTES, SEEK_SET) == -1) {
@@ -391,6 +459,64 @@ start_new_chunk(
     return TRUE;
 }
 
+/* Keep the kernel reading ahead of us, so that the taper is not left
+ * waiting for the disk.  The current chunk is advised a window of
+ * holding-read-ahead bytes at a time, and once its end is within the window
+ * the next chunk is opened, its header read and the start of its data
+ * advised too, so that start_new_chunk finds it ready.  With
+ * holding-direct-io, the pages already read are dropped from the cache.
+ */
+static void
+read_ahead(
+    XferSourceHolding *self)
+{
+    off_t pos;
+    off_t end;
+    off_t len;
+    char *errmsg = NULL;
+
+    if (self->read_ahead == 0 || self->fd == -1)
+	return;
+
+    pos = self->current_offset - self->offset_file + DISK_BLOCK_BYTES;
+    end = self->fsize + DISK_BLOCK_BYTES;
+
+    /* issue a whole window at once, rather than a little for each block */
+    if (self->advised < pos)
+	self->advised = pos;
+    if (self->advised < end &&
+	self->advised - pos < (off_t)self->read_ahead) {
+	len = MIN(end, pos + 2 * (off_t)self->read_ahead) - self->advised;
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(self->fd, self->advised, len, POSIX_FADV_WILLNEED);
+	if (self->drop_behind && self->dropped < pos) {
+	    posix_fadvise(self->fd, self->dropped, pos - self->dropped,
+			  POSIX_FADV_DONTNEED);
+	    self->dropped = pos;
+	}
+#endif
+	self->advised += len;
+    }
+
+    if (end - pos >= (off_t)self->read_ahead ||
+	!self->next_filename || self->prefetched)
+	return;
+
+    /* errors are reported when start_new_chunk opens the chunk itself */
+    self->prefetched = TRUE;
+    if (!open_chunk(self->next_filename, &self->prefetch, &errmsg)) {
+	g_debug("could not open the next chunk early: %s", errmsg);
+	g_free(errmsg);
+	return;
+    }
+    len = MIN(self->prefetch.st_size - DISK_BLOCK_BYTES, (off_t)self->read_ahead);
+#ifdef HAVE_POSIX_FADVISE
+    posix_fadvise(self->prefetch.fd, DISK_BLOCK_BYTES, len, POSIX_FADV_WILLNEED);
+#endif
+    self->prefetch.advised = DISK_BLOCK_BYTES + len;
+    DBG(2, "opened next chunk '%s' early", self->prefetch.filename);
+}
+
 /* pick an arbitrary block size for reading */
 #define HOLDING_BLOCK_SIZE (1024*128)
 
@@ -466,6 +592,7 @@ pull_buffer_impl(
 	    *size = bytes_read;
 	    self->bytes_read += bytes_read;
 	    crc32_add((uint8_t *)buf, bytes_read, &elt->crc);
+	    read_ahead(self);
 	    g_mutex_unlock(self->start_recovery_mutex);
 	    return buf;
 	}
@@ -555,6 +682,7 @@ pull_buffer_static_impl(
 	    *size = bytes_read;
 	    self->bytes_read += bytes_read;
 	    crc32_add((uint8_t *)buf, bytes_read, &elt->crc);
+	    read_ahead(self);
 	    g_mutex_unlock(self->start_recovery_mutex);
 	    return buf;
 	}
@@ -614,10 +742,10 @@ cancel_impl(
 
     if (elt->shm_ring) {
 	elt->shm_ring->mc->cancelled = TRUE;
-	sem_post(elt->shm_ring->sem_ready);
-	sem_post(elt->shm_ring->sem_start);
-	sem_post(elt->shm_ring->sem_read);
-	sem_post(elt->shm_ring->sem_write);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_ready);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_start);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+	shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
     }
 
     if (self->mem_ring) {
@@ -665,6 +793,7 @@ instance_init(
 
     elt->can_generate_eof = TRUE;
     self->fd = -1;
+    self->prefetch.fd = -1;
     self->paused = TRUE;
     self->current_offset = 0;
     self->offset_file = -1;
@@ -694,6 +823,7 @@ finalize_impl(
     g_mutex_free(self->start_recovery_mutex);
     if (self->fd != -1)
 	close(self->fd); /* ignore error; we were probably already cancelled */
+    close_chunk(&self->prefetch);
 
     G_OBJECT_CLASS(parent_class)->finalize(obj_self);
 }
@@ -762,6 +892,10 @@ xfer_source_holding(
     self->first_filename = g_strdup(filename);
     self->next_filename = g_strdup(filename);
     self->bytes_read = 0;
+    if (config_is_initialized()) {
+	self->read_ahead = getconf_size(CNF_HOLDING_READ_AHEAD);
+	self->drop_behind = getconf_boolean(CNF_HOLDING_DIRECT_IO);
+    }
 
     return elt;
 }
@@ -520,6 +520,228 @@ pull_static_and_write(XferElementGlue *self)
     close_write_fd(self);
 }
 
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+/* splice(2) needs a pipe on at least one side, and tee(2) needs pipes on both
+ * sides, so the zero-copy path is only used between pipes and sockets. */
+static gboolean
+fd_can_splice(
+    int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+	return FALSE;
+    return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+}
+
+static gboolean
+fd_is_pipe(
+    int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+	return FALSE;
+    return S_ISFIFO(st.st_mode);
+}
+
+/* Move data from rfd to wfd with splice(2), without copying it through user
+ * space.  Each chunk is first duplicated with tee(2) into a private pipe, and
+ * the CRC is computed from that copy.  If rfd is not a pipe, the data is
+ * spliced into a staging pipe first.
+ *
+ * Returns TRUE if the transfer is finished (EOF, cancellation or a fatal
+ * error), or FALSE if the caller must continue with the copy loop; the latter
+ * happens when the kernel refuses to splice to wfd, or when a write error
+ * must be drained.  In that case the staging pipe has been flushed to wfd, so
+ * the copy loop can carry on reading rfd.
+ *
+ * *spliced is set if any bytes were spliced to wfd, and *copied if any had to
+ * be written from user space. */
+static gboolean
+splice_and_write(
+    XferElementGlue *self,
+    int rfd,
+    int wfd,
+    char *buf,
+    gboolean *spliced,
+    gboolean *copied)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    int crc_pipe[2] = { -1, -1 };
+    int stage_pipe[2] = { -1, -1 };
+    int src = rfd;
+    size_t staged = 0;
+    gboolean moved_any = FALSE;
+    gboolean finished = TRUE;
+
+    if (pipe(crc_pipe) < 0) {
+	g_debug("splice_and_write: can't create crc pipe: %s", strerror(errno));
+	return FALSE;
+    }
+    if (!fd_is_pipe(rfd)) {
+	if (pipe(stage_pipe) < 0) {
+	    g_debug("splice_and_write: can't create staging pipe: %s",
+		    strerror(errno));
+	    close(crc_pipe[0]);
+	    close(crc_pipe[1]);
+	    return FALSE;
+	}
+	src = stage_pipe[0];
+    }
+
+    while (!elt->cancelled) {
+	ssize_t teed;
+	size_t done = 0;
+
+	if (stage_pipe[0] != -1 && staged == 0) {
+	    ssize_t n = splice(rfd, NULL, stage_pipe[1], NULL,
+			       GLUE_BUFFER_SIZE, SPLICE_F_MOVE | SPLICE_F_MORE);
+	    if (n < 0) {
+		if (!moved_any && (errno == EINVAL || errno == ENOSYS)) {
+		    g_debug("splice_and_write: can't splice from fd %d: %s",
+			    rfd, strerror(errno));
+		    finished = FALSE;
+		} else if (!elt->cancelled) {
+		    xfer_cancel_with_error(elt,
+			_("Error reading from fd %d: %s"), rfd, strerror(errno));
+		    wait_until_xfer_cancelled(elt->xfer);
+		}
+		break;
+	    } else if (n == 0) {
+		break;
+	    }
+	    staged = n;
+	}
+
+	/* duplicate the next chunk for the CRC; tee does not consume it */
+	teed = tee(src, crc_pipe[1],
+		   staged ? staged : GLUE_BUFFER_SIZE, 0);
+	if (teed < 0) {
+	    if (!moved_any && staged == 0 &&
+		(errno == EINVAL || errno == ENOSYS)) {
+		g_debug("splice_and_write: can't tee fd %d: %s",
+			src, strerror(errno));
+		finished = FALSE;
+	    } else if (!elt->cancelled) {
+		xfer_cancel_with_error(elt,
+		    _("Error reading from fd %d: %s"), rfd, strerror(errno));
+		wait_until_xfer_cancelled(elt->xfer);
+	    }
+	    break;
+	} else if (teed == 0) {
+	    break;
+	}
+
+	/* move it to the downstream fd */
+	while (done < (size_t)teed) {
+	    ssize_t n = splice(src, NULL, wfd, NULL, teed - done,
+			       SPLICE_F_MOVE | SPLICE_F_MORE);
+	    if (n <= 0)
+		break;
+	    done += n;
+	    moved_any = TRUE;
+	}
+
+	if (done < (size_t)teed) {
+	    int save_errno = errno;
+	    size_t len = teed - done;
+
+	    /* take the rest of the chunk out of the source pipe */
+	    if (read_fully(src, buf, len, NULL) < len) {
+		if (!elt->cancelled) {
+		    xfer_cancel_with_error(elt,
+			_("Error reading from fd %d: %s"), src, strerror(errno));
+		    wait_until_xfer_cancelled(elt->xfer);
+		}
+		break;
+	    }
+	    if (!moved_any && (save_errno == EINVAL || save_errno == ENOSYS)) {
+		g_debug("splice_and_write: can't splice to fd %d: %s",
+			wfd, strerror(save_errno));
+		if (full_write(wfd, buf, len) < len) {
+		    save_errno = errno;
+		} else {
+		    save_errno = 0;
+		}
+		*copied = TRUE;
+	    }
+	    if (save_errno) {
+		if (elt->downstream->must_drain) {
+		    g_debug("Could not write to fd %d: %s", wfd,
+			    strerror(save_errno));
+		} else if (elt->downstream->ignore_broken_pipe &&
+			   save_errno == EPIPE) {
+		} else {
+		    if (!elt->cancelled) {
+			xfer_cancel_with_error(elt,
+			    _("Could not write to fd %d: %s"),
+			    wfd, strerror(save_errno));
+			wait_until_xfer_cancelled(elt->xfer);
+		    }
+		    break;
+		}
+	    }
+	    finished = FALSE;
+	}
+
+	/* compute the CRC from the tee'd copy */
+	if (read_fully(crc_pipe[0], buf, teed, NULL) < (size_t)teed) {
+	    if (!elt->cancelled) {
+		xfer_cancel_with_error(elt,
+		    _("Error reading from crc pipe: %s"), strerror(errno));
+		wait_until_xfer_cancelled(elt->xfer);
+	    }
+	    finished = TRUE;
+	    break;
+	}
+	crc32_add((uint8_t *)buf, teed, &elt->crc);
+	if (staged)
+	    staged -= teed;
+
+	if (!finished)
+	    break;
+    }
+
+    /* hand any staged data to the copy loop's destination */
+    if (!finished && staged > 0) {
+	if (read_fully(stage_pipe[0], buf, staged, NULL) < staged) {
+	    if (!elt->cancelled) {
+		xfer_cancel_with_error(elt,
+		    _("Error reading from staging pipe: %s"), strerror(errno));
+		wait_until_xfer_cancelled(elt->xfer);
+	    }
+	    finished = TRUE;
+	} else {
+	    if (!elt->downstream->drain_mode &&
+		full_write(wfd, buf, staged) < staged &&
+		!elt->downstream->must_drain &&
+		!(elt->downstream->ignore_broken_pipe && errno == EPIPE)) {
+		if (!elt->cancelled) {
+		    xfer_cancel_with_error(elt,
+			_("Could not write to fd %d: %s"),
+			wfd, strerror(errno));
+		    wait_until_xfer_cancelled(elt->xfer);
+		}
+		finished = TRUE;
+	    }
+	    crc32_add((uint8_t *)buf, staged, &elt->crc);
+	    *copied = TRUE;
+	}
+    }
+
+    close(crc_pipe[0]);
+    close(crc_pipe[1]);
+    if (stage_pipe[0] != -1) {
+	close(stage_pipe[0]);
+	close(stage_pipe[1]);
+    }
+
+    *spliced = moved_any;
+    return finished;
+}
+#endif
+
 static void
 read_and_write(XferElementGlue *self)
 {
@@ -530,10 +752,22 @@ read_and_write(XferElementGlue *self)
     int rfd = get_read_fd(self);
     int wfd = get_write_fd(self);
     XMsg *msg;
+    const char *mech;
+    gboolean spliced = FALSE, copied = FALSE;
+    gboolean done = FALSE;
     crc32_init(&elt->crc);
 
-    g_debug("read_and_write: read from %d, write to %d", rfd, wfd);
-    while (!elt->cancelled) {
+#if defined(HAVE_SPLICE) && defined(HAVE_TEE)
+    if (!elt->downstream->drain_mode &&
+	fd_can_splice(rfd) && fd_can_splice(wfd)) {
+	g_debug("read_and_write: splice from %d to %d", rfd, wfd);
+	done = splice_and_write(self, rfd, wfd, buf, &spliced, &copied);
+    }
+#endif
+
+    if (!done)
+	g_debug("read_and_write: read from %d, write to %d", rfd, wfd);
+    while (!done && !elt->cancelled) {
 	size_t len;
 
 	/* read from upstream */
@@ -567,6 +801,7 @@ read_and_write(XferElementGlue *self)
 	    }
 	}
 	crc32_add((uint8_t *)buf, len, &elt->crc);
+	copied = TRUE;
     }
 
     if (elt->cancelled && elt->expect_eof)
@@ -579,20 +814,28 @@ read_and_write(XferElementGlue *self)
     /* close the fd we've been writing, as an EOF signal to downstream */
     close_write_fd(self);
 
-    g_debug("read_and_write upstream CRC: %08x      size %lld",
+    /* name what actually moved the bytes */
+    if (spliced)
+	mech = copied ? "splice+copy" : "splice";
+    else
+	mech = "copy";
+
+    g_debug("read_and_write (%s) upstream CRC: %08x      size %lld", mech,
 	    crc32_finish(&elt->crc), (long long)elt->crc.size);
     g_debug("sending XMSG_CRC message");
     msg = xmsg_new(elt->upstream, XMSG_CRC, 0);
     msg->crc = crc32_finish(&elt->crc);
     msg->size = elt->crc.size;
+    msg->message = g_strdup(mech);
     xfer_queue_message(elt->xfer, msg);
 
-    g_debug("read_and_write downstream CRC: %08x      size %lld",
+    g_debug("read_and_write (%s) downstream CRC: %08x      size %lld", mech,
 	    crc32_finish(&elt->crc), (long long)elt->crc.size);
     g_debug("sending XMSG_CRC message");
     msg = xmsg_new(elt->downstream, XMSG_CRC, 0);
     msg->crc = crc32_finish(&elt->crc);
     msg->size = elt->crc.size;
+    msg->message = g_strdup(mech);
     xfer_queue_message(elt->xfer, msg);
 
     amfree(buf);
@@ -906,7 +1149,7 @@ read_to_shm_ring(
 	    elt->shm_ring->mc->written += n;
 	    elt->shm_ring->data_avail += n;
 	    if (elt->shm_ring->data_avail >= consumer_block_size) {
-		sem_post(elt->shm_ring->sem_read);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
 		elt->shm_ring->data_avail -= consumer_block_size;
 	    }
 	    if (n <= (ssize_t)iov[0].iov_len) {
@@ -928,8 +1171,8 @@ read_to_shm_ring(
 	xfer_cancel_with_error(elt, "shm_ring cancelled");
     }
 
-    sem_post(elt->shm_ring->sem_read);
-    sem_post(elt->shm_ring->sem_read);
+    shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
+    shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
 
     // wait for the consumer to read everything
     while (!elt->cancelled &&
@@ -1009,7 +1252,7 @@ pull_static_to_shm_ring(
 	    elt->shm_ring->mc->written += len;
 	    elt->shm_ring->data_avail += len;
 	    if (elt->shm_ring->data_avail >= consumer_block_size) {
-		sem_post(elt->shm_ring->sem_read);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read);
 		elt->shm_ring->data_avail -= consumer_block_size;
 	    }
 	    crc32_add((uint8_t *)base, len, &elt->crc);
@@ -1025,8 +1268,8 @@ pull_static_to_shm_ring(
     } else if (elt->shm_ring->mc->cancelled) {
 	xfer_cancel_with_error(elt, "shm_ring cancelled");
     }
-    sem_post(elt->shm_ring->sem_read); // for the last block
-    sem_post(elt->shm_ring->sem_read); // for the eof_flag
+    shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read); // for the last block
+    shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_read); // for the eof_flag
 
     // wait for the consumer to read everything
     while (!elt->cancelled &&
@@ -1061,7 +1304,7 @@ shm_ring_and_push_buffer_static(XferElementGlue *self)
 
     shm_ring_consumer_set_size(elt->shm_ring, SHM_RING_SIZE, SHM_RING_BLOCK_SIZE);
     shm_ring_size = elt->shm_ring->mc->ring_size;
-    sem_post(elt->shm_ring->sem_write);
+    shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
     while (!elt->shm_ring->mc->cancelled) {
 	do {
 	    usable = elt->shm_ring->mc->written - elt->shm_ring->mc->readx;
@@ -1089,14 +1332,14 @@ shm_ring_and_push_buffer_static(XferElementGlue *self)
 		    read_offset -= shm_ring_size;
 		elt->shm_ring->mc->read_offset = read_offset;
 		elt->shm_ring->mc->readx += to_write;
-		sem_post(elt->shm_ring->sem_write);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
 		usable -= to_write;
 	    }
 	    if (elt->shm_ring->mc->write_offset == elt->shm_ring->mc->read_offset &&
                 elt->shm_ring->mc->eof_flag) {
 		// notify the producer that everythinng is read
 		xfer_element_push_buffer_static(elt->downstream, NULL, 0);
-		sem_post(elt->shm_ring->sem_write);
+		shm_ring_sem_post(elt->shm_ring, elt->shm_ring->sem_write);
 		return;
 	    }
 	}
@@ -0,0 +1,313 @@
+/*
+ * Amanda, The Advanced Maryland Automatic Network Disk Archiver
+ * Copyright (c) 2016-2016 Carbonite, Inc.  All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ *
+ * Contact information: Carbonite Inc., 756 N Pastoria Ave
+ * Sunnyvale, CA 94085, or: http://www.zmanda.com
+ */
+
+#include "amanda.h"
+#include "amxfer.h"
+#include "parallel-gzip.h"
+
+/*
+ * Class declaration
+ *
+ * This declaration is entirely private; nothing but xfer_filter_gzip() references
+ * it directly.
+ */
+
+GType xfer_filter_gzip_get_type(void);
+#define XFER_FILTER_GZIP_TYPE (xfer_filter_gzip_get_type())
+#define XFER_FILTER_GZIP(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_gzip_get_type(), XferFilterGzip)
+#define XFER_FILTER_GZIP_CONST(obj) G_TYPE_CHECK_INSTANCE_CAST((obj), xfer_filter_gzip_get_type(), XferFilterGzip const)
+#define XFER_FILTER_GZIP_CLASS(klass) G_TYPE_CHECK_CLASS_CAST((klass), xfer_filter_gzip_get_type(), XferFilterGzipClass)
+#define IS_XFER_FILTER_GZIP(obj) G_TYPE_CHECK_INSTANCE_TYPE((obj), xfer_filter_gzip_get_type ())
+#define XFER_FILTER_GZIP_GET_CLASS(obj) G_TYPE_INSTANCE_GET_CLASS((obj), xfer_filter_gzip_get_type(), XferFilterGzipClass)
+
+static GObjectClass *parent_class = NULL;
+
+/*
+ * Main object structure
+ */
+
+typedef struct XferFilterGzip {
+    XferElement __parent__;
+
+    int level;
+    int threads;
+    parallel_gzip_t *pgz;
+
+    /* compressed data not yet passed downstream */
+    GQueue *pending;
+    gboolean eof;
+} XferFilterGzip;
+
+/*
+ * Class definition
+ */
+
+typedef struct {
+    XferElementClass __parent__;
+} XferFilterGzipClass;
+
+typedef struct gzip_output_s {
+    gpointer buf;
+    gsize len;
+} gzip_output_t;
+
+/*
+ * Utilities
+ */
+
+static gboolean
+queue_output(
+    gpointer      user_data,
+    gconstpointer buf,
+    gsize         len,
+    char        **errmsg G_GNUC_UNUSED)
+{
+    XferFilterGzip *self = (XferFilterGzip *)user_data;
+    gzip_output_t *output = g_new(gzip_output_t, 1);
+
+    output->buf = g_memdup(buf, len);
+    output->len = len;
+    g_queue_push_tail(self->pending, output);
+    return TRUE;
+}
+
+static void
+push_pending(
+    XferFilterGzip *self)
+{
+    gzip_output_t *output;
+
+    while ((output = g_queue_pop_head(self->pending)) != NULL) {
+	xfer_element_push_buffer(XFER_ELEMENT(self)->downstream,
+				 output->buf, output->len);
+	g_free(output);
+    }
+}
+
+static void
+gzip_failed(
+    XferFilterGzip *self)
+{
+    XferElement *elt = XFER_ELEMENT(self);
+    char *errmsg = parallel_gzip_free(self->pgz);
+
+    self->pgz = NULL;
+    xfer_cancel_with_error(elt, _("compression failed: %s"),
+			   errmsg ? errmsg : _("unknown error"));
+    g_free(errmsg);
+    wait_until_xfer_cancelled(elt->xfer);
+}
+
+/*
+ * Implementation
+ */
+
+static gpointer
+pull_buffer_impl(
+    XferElement *elt,
+    size_t *size)
+{
+    XferFilterGzip *self = (XferFilterGzip *)elt;
+    gzip_output_t *output;
+    gpointer buf;
+    size_t len;
+    gboolean ok;
+
+    /* pull from upstream until some compressed data comes out */
+    while (g_queue_is_empty(self->pending)) {
+	if (elt->cancelled) {
+	    /* drain our upstream only if we're expecting an EOF */
+	    if (elt->expect_eof) {
+		xfer_element_drain_buffers(XFER_ELEMENT(self)->upstream);
+	    }
+
+	    /* return an EOF */
+	    *size = 0;
+	    return NULL;
+	}
+
+	if (self->eof) {
+	    *size = 0;
+	    return NULL;
+	}
+
+	buf = xfer_element_pull_buffer(XFER_ELEMENT(self)->upstream, &len);
+	if (buf) {
+	    ok = parallel_gzip_write(self->pgz, buf, len);
+	    g_free(buf);
+	} else {
+	    ok = parallel_gzip_finish(self->pgz);
+	    self->eof = TRUE;
+	}
+	if (!ok) {
+	    gzip_failed(self);
+	    *size = 0;
+	    return NULL;
+	}
+    }
+
+    output = g_queue_pop_head(self->pending);
+    buf = output->buf;
+    *size = output->len;
+    g_free(output);
+    return buf;
+}
+
+static void
+push_buffer_impl(
+    XferElement *elt,
+    gpointer buf,
+    size_t len)
+{
+    XferFilterGzip *self = (XferFilterGzip *)elt;
+
+    /* drop the buffer if we've been cancelled */
+    if (elt->cancelled) {
+	amfree(buf);
+	return;
+    }
+
+    /* compress the given buffer and pass whatever is ready downstream */
+    if (buf) {
+	if (!parallel_gzip_write(self->pgz, buf, len)) {
+	    amfree(buf);
+	    gzip_failed(self);
+	    return;
+	}
+	amfree(buf);
+	push_pending(self);
+	return;
+    }
+
+    /* EOF: pass along the rest, then the EOF */
+    if (!parallel_gzip_finish(self->pgz)) {
+	gzip_failed(self);
+	return;
+    }
+    push_pending(self);
+    xfer_element_push_buffer(XFER_ELEMENT(self)->downstream, NULL, 0);
+}
+
+static gboolean
+setup_impl(
+    XferElement *elt)
+{
+    XferFilterGzip *self = (XferFilterGzip *)elt;
+
+    self->pgz = parallel_gzip_new(self->level, self->threads, queue_output,
+				  self);
+    return TRUE;
+}
+
+static void
+instance_init(
+    XferElement *elt)
+{
+    XferFilterGzip *self = (XferFilterGzip *)elt;
+
+    elt->can_generate_eof = TRUE;
+    self->pending = g_queue_new();
+}
+
+static void
+finalize_impl(
+    GObject * obj_self)
+{
+    XferFilterGzip *self = XFER_FILTER_GZIP(obj_self);
+    gzip_output_t *output;
+
+    if (self->pgz)
+	g_free(parallel_gzip_free(self->pgz));
+    self->pgz = NULL;
+
+    while ((output = g_queue_pop_head(self->pending)) != NULL) {
+	g_free(output->buf);
+	g_free(output);
+    }
+    g_queue_free(self->pending);
+
+    /* chain up */
+    G_OBJECT_CLASS(parent_class)->finalize(obj_self);
+}
+
+static void
+class_init(
+    XferFilterGzipClass * selfc)
+{
+    XferElementClass *klass = XFER_ELEMENT_CLASS(selfc);
+    GObjectClass *goc = G_OBJECT_CLASS(selfc);
+    static xfer_element_mech_pair_t mech_pairs[] = {
+	{ XFER_MECH_PULL_BUFFER, XFER_MECH_PULL_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_PUSH_BUFFER, XFER_MECH_PUSH_BUFFER, XFER_NROPS(1), XFER_NTHREADS(0), XFER_NALLOC(1) },
+	{ XFER_MECH_NONE, XFER_MECH_NONE, XFER_NROPS(0), XFER_NTHREADS(0), XFER_NALLOC(0) },
+    };
+
+    klass->setup = setup_impl;
+    klass->push_buffer = push_buffer_impl;
+    klass->pull_buffer = pull_buffer_impl;
+    goc->finalize = finalize_impl;
+
+    klass->perl_class = "Amanda::Xfer::Filter::Gzip";
+    klass->mech_pairs = mech_pairs;
+
+    parent_class = g_type_class_peek_parent(selfc);
+}
+
+GType
+xfer_filter_gzip_get_type (void)
+{
+    static GType type = 0;
+
+    if (G_UNLIKELY(type == 0)) {
+        static const GTypeInfo info = {
+            sizeof (XferFilterGzipClass),
+            (GBaseInitFunc) NULL,
+            (GBaseFinalizeFunc) NULL,
+            (GClassInitFunc) class_init,
+            (GClassFinalizeFunc) NULL,
+            NULL /* class_data */,
+            sizeof (XferFilterGzip),
+            0 /* n_preallocs */,
+            (GInstanceInitFunc) instance_init,
+            NULL
+        };
+
+        type = g_type_register_static (XFER_ELEMENT_TYPE, "XferFilterGzip", &info, 0);
+    }
+
+    return type;
+}
+
+/* create an element of this class; prototype is in xfer-element.h */
+XferElement *
+xfer_filter_gzip(
+    int level,
+    int threads)
+{
+    XferFilterGzip *xfg = (XferFilterGzip *)g_object_new(XFER_FILTER_GZIP_TYPE, NULL);
+    XferElement *elt = XFER_ELEMENT(xfg);
+
+    xfg->level = level;
+    xfg->threads = threads;
+
+    return elt;
+}
@@ -562,6 +562,20 @@ XferElement *xfer_filter_xor(
  */
 XferElement *xfer_filter_crc(void);
 
+/* A transfer filter that compresses the data that passes through it with
+ * gzip, on a pool of threads.  The output is a series of gzip members, which
+ * 'gzip -dc' reads as a single stream.
+ *
+ * Implemented in filter-gzip.c
+ *
+ * @param level: zlib compression level, 1 (fast) to 9 (best)
+ * @param threads: number of compression threads; 0 for the default
+ * @return: new element
+ */
+XferElement *xfer_filter_gzip(
+    int level,
+    int threads);
+
 /* A transfer destination that consumes all bytes it is given, optionally
  * validating that they match those produced by source_random
  *
@@ -30,6 +30,10 @@
 #include "simpleprng.h"
 #include "sockaddr-util.h"
 
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 /* Having tests repeat exactly is an advantage, so we use a hard-coded
  * random seed. */
 #define RANDOM_SEED 0xf00d
@@ -1574,6 +1578,79 @@ test_xfer_files_filter(void)
     return test_xfer_files(TRUE);
 }
 
+/****
+ * Compress random data with the gzip filter, and check that zlib reads it back
+ */
+
+#ifdef HAVE_LIBZ
+static int
+test_xfer_gzip(void)
+{
+    unsigned int i;
+    GSource *src;
+    char *out_filename = "xfer-test.tmp.gz"; /* current directory is writeable */
+    gsize len = 3*1024*1024 + 17;
+    simpleprng_state_t prng;
+    guint8 *buf;
+    gzFile gz;
+    int wfd, n;
+    Xfer *xfer;
+    XferElement *elements[3];
+
+    wfd = open(out_filename, O_WRONLY|O_CREAT|O_TRUNC, 0777);
+    if (wfd < 0) {
+	g_critical("Could not open '%s': %s", out_filename, strerror(errno));
+	exit(1);
+    }
+
+    elements[0] = xfer_source_random(len, RANDOM_SEED);
+    elements[1] = xfer_filter_gzip(1, 2);
+    elements[2] = xfer_dest_fd(wfd);
+
+    xfer = xfer_new(elements, G_N_ELEMENTS(elements));
+    src = xfer_get_source(xfer);
+    g_source_set_callback(src, (GSourceFunc)test_xfer_generic_callback, NULL, NULL);
+    g_source_attach(src, NULL);
+    tu_dbg("Transfer: %s\n", xfer_repr(xfer));
+
+    /* unreference the elements */
+    for (i = 0; i < G_N_ELEMENTS(elements); i++) {
+	g_object_unref(elements[i]);
+	g_assert(G_OBJECT(elements[i])->ref_count == 1);
+	elements[i] = NULL;
+    }
+
+    xfer_start(xfer, 0, 0);
+
+    g_main_loop_run(default_main_loop());
+    g_assert(xfer->status == XFER_DONE);
+
+    close(wfd);
+    xfer_unref(xfer);
+
+    buf = g_malloc(len + 1);
+    gz = gzopen(out_filename, "rb");
+    g_assert(gz != NULL);
+    n = gzread(gz, buf, len + 1);
+    gzclose(gz);
+    unlink(out_filename); /* ignore any errors */
+
+    if (n != (int)len) {
+	tu_dbg("read %d bytes back, expected %u\n", n, (guint)len);
+	g_free(buf);
+	return 0;
+    }
+    simpleprng_seed(&prng, RANDOM_SEED);
+    if (!simpleprng_verify_buffer(&prng, buf, len)) {
+	g_free(buf);
+	return 0;
+    }
+
+    g_free(buf);
+    return 1;
+}
+#endif
+
 /*****
  * test each possible combination of source and destination mechansim
  */
@@ -1662,6 +1739,9 @@ main(int argc, char **argv)
 	TU_TEST(test_xfer_simple, 90),
 	TU_TEST(test_xfer_files_simple, 90),
 	TU_TEST(test_xfer_files_filter, 90),
+#ifdef HAVE_LIBZ
+	TU_TEST(test_xfer_gzip, 90),
+#endif
         TU_TEST(test_glue_READFD_READFD, 90),
         TU_TEST(test_glue_READFD_WRITEFD, 90),
         TU_TEST(test_glue_READFD_PUSH, 90),
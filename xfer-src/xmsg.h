@@ -117,6 +117,7 @@ typedef enum {
     /* XMSG_CRC:
      *  - crc
      *  - size
+     *  - message (optional; how the data was moved, e.g. "copy" or "splice")
      */
     XMSG_CRC = 8,
 